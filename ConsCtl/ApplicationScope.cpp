@@ -22,10 +22,14 @@
 //
 //---------------------------------------------------------------------------
 #include "ApplicationScope.h"
+#if defined(_WIN32)
 #include "NtDriverController.h"
 #include "ThreadMonitor.h"
 #include "WinUtils.h"
-#include "ThreadMonitor.h"
+#else
+#include "NetlinkMonitor.h"
+#include "ProcPollMonitor.h"
+#endif
 #include "QueueContainer.h"
 
 //---------------------------------------------------------------------------
@@ -34,14 +38,6 @@
 //
 //---------------------------------------------------------------------------
 
-//
-// Structure for holding info about activating/deactivating the driver
-//
-typedef struct _ActivateInfo
-{
-    BOOLEAN  bActivate;
-} ACTIVATE_INFO, *PACTIVATE_INFO;
-
 
 //---------------------------------------------------------------------------
 //
@@ -56,19 +52,28 @@ CApplicationScope* CApplicationScope::sm_pInstance = NULL;
 //
 //---------------------------------------------------------------------------
 CApplicationScope::CApplicationScope(
-	CCallbackHandler* pHandler       // User-supplied object for handling notifications
+	CCallbackHandler*    pHandler,       // User-supplied object for handling notifications
+	QUEUE_IMPLEMENTATION eQueue          // How the event queue is built
 	):
 	m_pDriverCtl(NULL),
 	m_bIsActive(FALSE),
+	m_bySubscriptions(0),
+	m_pdwFilter(NULL),
+	m_cbFilter(0),
+	m_dwPollInterval(0),
+	m_bSourceDetails(TRUE),
 	m_pProcessMonitor(NULL),
+	m_Lock(TEXT("application scope")),
 	m_pRequestManager(NULL)
 {
-	m_pRequestManager = new CQueueContainer(pHandler);	
+	m_pRequestManager = new CQueueContainer(pHandler, eQueue);	
+#if defined(_WIN32)
 	//
 	// An instance of the class responsible for loading and unloading
 	// the kernel driver
 	//
 	m_pDriverCtl = new CNtDriverController();
+#endif
 }
 
 //---------------------------------------------------------------------------
@@ -79,10 +84,13 @@ CApplicationScope::CApplicationScope(
 CApplicationScope::~CApplicationScope()
 {
 	StopMonitoring();
+#if defined(_WIN32)
 	if (m_bIsActive)
 		m_pDriverCtl->StopAndRemove();
 	delete m_pDriverCtl;
+#endif
 	delete m_pRequestManager;
+	delete [] m_pdwFilter;
 }
 
 //---------------------------------------------------------------------------
@@ -121,17 +129,20 @@ CApplicationScope& CApplicationScope::operator=(const CApplicationScope& rhs)
 // 2. "More Effective C++" by Scott Meyers - Item 26
 //---------------------------------------------------------------------------
 CApplicationScope& CApplicationScope::GetInstance(
-	CCallbackHandler* pHandler       // User-supplied object for handling notifications
+	CCallbackHandler*    pHandler,       // User-supplied object for handling notifications
+	QUEUE_IMPLEMENTATION eQueue          // Used by the first call only
 	) 
 {
+#if defined(_WIN32)
 	VerifyIsWindowsNtRequired();
+#endif
 	if (!sm_pInstance)
 	{
 		CLockMgr<CCSWrapper> guard(g_AppSingeltonLock, TRUE);
 		if (!sm_pInstance)
 		{
 			assert( NULL != pHandler );
-			static CApplicationScope instance(pHandler);
+			static CApplicationScope instance(pHandler, eQueue);
 			sm_pInstance = &instance;
 		}
 	} // if
@@ -139,6 +150,7 @@ CApplicationScope& CApplicationScope::GetInstance(
 	return *sm_pInstance;
 }
 
+#if defined(_WIN32)
 //
 // Activate/deactivate the monitoring process
 //
@@ -202,10 +214,15 @@ BOOL CApplicationScope::SetActive(BOOL bActive)
 		//
 		if (bActive)
 		{
+			//
+			// The filter goes first, thus no unwanted event gets through
+			//
+			SendFilter(hDriverFile);
 			//
 			// Set input parameters for the driver routine
 			//
-			activateInfo.bActivate = bActive;
+			activateInfo.bActivated    = (OBSRV_U8)bActive;
+			activateInfo.Subscriptions = (OBSRV_U8)m_bySubscriptions;
 			//
 			// Activate/Deactivate the process
 			//
@@ -227,12 +244,75 @@ BOOL CApplicationScope::SetActive(BOOL bActive)
 	} // if
 	return bResult;
 }
+#else
+//
+// Activate/deactivate the monitoring process. There is no driver, the
+// monitor listens to the kernel's process events connector, or scans
+// /proc if it isn't allowed to.
+//
+BOOL CApplicationScope::SetActive(BOOL bActive)
+{
+	BOOL bResult = FALSE;
+	//
+	// Verify the system hasn't been activate before
+	//
+	if (m_bIsActive != bActive)
+	{
+		if (bActive)
+		{
+			if (!m_pRequestManager->StartReceivingNotifications())
+				return FALSE;
+			m_pProcessMonitor = new CNetlinkMonitor(
+				TEXT("{30F8934F-F57F-4ced-93A6-AF68CD0F6E79}"), 
+				m_pRequestManager,
+				m_bySubscriptions,
+				m_bSourceDetails
+				);
+			m_pProcessMonitor->SetActive( TRUE );
+			//
+			// Listening takes CAP_NET_ADMIN
+			//
+			if (!m_pProcessMonitor->GetIsActive())
+			{
+				delete m_pProcessMonitor;
+				m_pProcessMonitor = new CProcPollMonitor(
+					TEXT("{30F8934F-F57F-4ced-93A6-AF68CD0F6E79}"), 
+					m_pRequestManager,
+					(0 != m_dwPollInterval) ? m_dwPollInterval : PROC_POLL_DEFAULT_INTERVAL
+					);
+				m_pProcessMonitor->SetActive( TRUE );
+			}
+			if (!m_pProcessMonitor->GetIsActive())
+			{
+				delete m_pProcessMonitor;
+				m_pProcessMonitor = NULL;
+				m_pRequestManager->StopReceivingNotifications();
+				return FALSE;
+			}
+		}
+		else
+		{
+			//
+			// Stop and release the monitoring thread, then the queue
+			// has nothing more coming
+			//
+			delete m_pProcessMonitor;
+			m_pProcessMonitor = NULL;
+			m_pRequestManager->StopReceivingNotifications();
+		}
+		m_bIsActive = bActive;
+		bResult   = TRUE;
+	} // if
+	return bResult;
+}
+#endif
 
 //
 // Initiates process of monitoring process creation/termination
 //
 BOOL CApplicationScope::StartMonitoring(
-	PVOID pvParam        // Pointer to a parameter value passed to the object 
+	PVOID pvParam,            // Pointer to a parameter value passed to the object 
+	BYTE  bySubscriptions     // Additional events, e.g. OBSRV_SUBSCRIBE_IMAGE_LOAD
 	)
 {
 	CLockMgr<CCSWrapper> guard(m_Lock, TRUE);
@@ -243,6 +323,7 @@ BOOL CApplicationScope::StartMonitoring(
 	if (!m_bIsActive)
 	{
 		m_pRequestManager->SetExternalParam( pvParam );
+		m_bySubscriptions = bySubscriptions;
 		//
 		// Activate the monitoring process
 		//
@@ -265,4 +346,151 @@ void CApplicationScope::StopMonitoring()
 	return;
 }
 
+//
+// Let the driver drop unwanted process events
+//
+BOOL CApplicationScope::SetFilter(
+	const OBSRV_FILTER_RULE* pRules,
+	DWORD                    nRules
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_Lock, TRUE);
+	PDWORD pdwFilter = NULL;
+	DWORD  cbFilter  = 0;
+	BOOL   bResult   = TRUE;
+
+#if !defined(_WIN32)
+	//
+	// The connector can't filter, and filtering in here would spare
+	// nothing but the callback
+	//
+	if (0 != nRules)
+		return FALSE;
+#endif
+	if (0 != nRules)
+	{
+		cbFilter = ObsrvFilterCompiledSize(pRules, nRules);
+		if (0 == cbFilter)
+			return FALSE;
+		//
+		// DWORDs keep the filter aligned
+		//
+		pdwFilter = new DWORD[cbFilter / sizeof(DWORD)];
+		cbFilter  = ObsrvFilterCompile(pRules, nRules, pdwFilter, cbFilter);
+	}
+	delete [] m_pdwFilter;
+	m_pdwFilter = pdwFilter;
+	m_cbFilter  = cbFilter;
+
+#if defined(_WIN32)
+	if (m_bIsActive)
+	{
+		HANDLE hDriverFile = ::CreateFile(
+			TEXT("\\\\.\\ProcObsrv"),
+			GENERIC_READ | GENERIC_WRITE, 
+			FILE_SHARE_READ | FILE_SHARE_WRITE,
+			0,                     // Default security
+			OPEN_EXISTING,
+			0,                     // Perform synchronous I/O
+			0);                    // No template
+		bResult = (INVALID_HANDLE_VALUE != hDriverFile);
+		if (bResult)
+		{
+			bResult = SendFilter(hDriverFile);
+			::CloseHandle(hDriverFile);
+		}
+	} // if
+#endif
+
+	return bResult;
+}
+
+#if defined(_WIN32)
+//
+// Hand the compiled filter over to the driver
+//
+BOOL CApplicationScope::SendFilter(HANDLE hDriverFile)
+{
+	DWORD dwBytesReturned = 0;
+
+	return ::DeviceIoControl(
+		hDriverFile,
+		IOCTL_PROCOBSRV_SET_FILTER,
+		m_pdwFilter, 
+		m_cbFilter,
+		NULL, 
+		0,
+		&dwBytesReturned,
+		NULL
+		);
+}
+#endif
+
+//
+// Time between two scans of /proc
+//
+void CApplicationScope::SetPollInterval(DWORD dwMilliseconds)
+{
+	CLockMgr<CCSWrapper> guard(m_Lock, TRUE);
+
+	m_dwPollInterval = dwMilliseconds;
+}
+
+//
+// Bound the event queue
+//
+BOOL CApplicationScope::SetQueueLimits(
+	DWORD                 dwMaxElements,
+	ULONG64               ullMaxBytes,
+	QUEUE_OVERFLOW_POLICY ePolicy
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_Lock, TRUE);
+
+	if (m_bIsActive)
+		return FALSE;
+	return m_pRequestManager->SetLimits(dwMaxElements, ullMaxBytes, ePolicy);
+}
+
+//
+// Fold the create and the exit of short-lived processes together
+//
+BOOL CApplicationScope::SetLifetimeCoalescing(BOOL bEnable)
+{
+	CLockMgr<CCSWrapper> guard(m_Lock, TRUE);
+
+	if (m_bIsActive)
+		return FALSE;
+	return m_pRequestManager->SetLifetimeCoalescing(bEnable);
+}
+
+//
+// Let the source read the details of new processes, or leave them
+//
+BOOL CApplicationScope::SetSourceDetails(BOOL bEnable)
+{
+	CLockMgr<CCSWrapper> guard(m_Lock, TRUE);
+
+	if (m_bIsActive)
+		return FALSE;
+	m_bSourceDetails = bEnable;
+	return TRUE;
+}
+
+//
+// Retrieve the event counters, including the number of lost events
+//
+void CApplicationScope::GetStats(QUEUE_STATS& stats)
+{
+	m_pRequestManager->GetStats(stats);
+}
+
+//
+// Print the per stage latency histograms
+//
+void CApplicationScope::DumpLatency() const
+{
+	m_pRequestManager->DumpLatency();
+}
+
 //----------------------------End of the file -------------------------------
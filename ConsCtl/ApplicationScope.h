@@ -30,7 +30,14 @@
 //---------------------------------------------------------------------------
 #include "LockMgr.h"
 #include "QueuedItem.h"
+#include "QueueContainer.h"
+#if defined(_WIN32)
 #include "ThreadMonitor.h"
+#else
+#include "NetlinkMonitor.h"
+#include "ProcPollMonitor.h"
+#endif
+#include "../Shared/ObsrvFilter.h"
 
 //---------------------------------------------------------------------------
 //
@@ -38,7 +45,6 @@
 // 
 //---------------------------------------------------------------------------
 class CNtDriverController;
-class CProcessThreadMonitor;
 
 //---------------------------------------------------------------------------
 //
@@ -68,7 +74,8 @@ private:
 	// Default constructor
 	//
 	CApplicationScope(
-		CCallbackHandler* pHandler       // User-supplied object for handling notifications
+		CCallbackHandler*    pHandler,       // User-supplied object for handling notifications
+		QUEUE_IMPLEMENTATION eQueue          // How the event queue is built
 		);
 	//
 	// Copy constructor
@@ -82,6 +89,12 @@ private:
 	// Activate/deactivate the monitoring process
 	//
 	BOOL SetActive(BOOL bActive);
+#if defined(_WIN32)
+	//
+	// Hand the compiled filter over to the driver
+	//
+	BOOL SendFilter(HANDLE hDriverFile);
+#endif
 	//
 	// Instance's pointer holder
 	//
@@ -93,7 +106,7 @@ private:
 	CQueueContainer* m_pRequestManager;
 	//
 	// An instance of the class responsible for loading and unloading
-	// the kernel driver
+	// the kernel driver, NULL on Linux
 	//
 	CNtDriverController* m_pDriverCtl;
 	//
@@ -101,9 +114,31 @@ private:
 	//
 	BOOL m_bIsActive;
 	//
+	// Events subscribed to on top of process create/terminate
+	// (OBSRV_SUBSCRIBE_xxx)
+	//
+	BYTE m_bySubscriptions;
+	//
+	// Compiled filter (ObsrvFilter.h), NULL if everything is wanted
+	//
+	PDWORD m_pdwFilter;
+	DWORD  m_cbFilter;
+	//
+	// Time between two scans of /proc (milliseconds), should the
+	// connector be out of reach on Linux
+	//
+	DWORD m_dwPollInterval;
+	//
+	// Whether the connector source reads the image path and command line
+	// of new processes itself
+	//
+	BOOL m_bSourceDetails;
+	//
 	// A thread for receiving notification from the kernel-mode driver
+	// (CProcessThreadMonitor), or from the process events connector on
+	// Linux (CNetlinkMonitor), or by scanning /proc (CProcPollMonitor)
 	//
-	CProcessThreadMonitor* m_pProcessMonitor;
+	CCustomThread* m_pProcessMonitor;
 	//
 	// A guard object used for protecting access to the class attributes
 	//
@@ -118,7 +153,8 @@ public:
 	// 2. "More Effective C++" by Scott Meyers - Item 26
 	//
 	static CApplicationScope& GetInstance(
-		CCallbackHandler* pHandler       // User-supplied object for handling notifications
+		CCallbackHandler*    pHandler,                  // User-supplied object for handling notifications
+		QUEUE_IMPLEMENTATION eQueue = QUEUE_LOCK_FREE   // Used by the first call only
 		);
 	//
 	// Destructor
@@ -128,12 +164,59 @@ public:
 	// Initiates process of monitoring process creation/termination
 	//
 	BOOL StartMonitoring(
-		PVOID pvParam        // Pointer to a parameter value passed to the object 
+		PVOID pvParam,            // Pointer to a parameter value passed to the object 
+		BYTE  bySubscriptions = 0 // Additional events, e.g. OBSRV_SUBSCRIBE_IMAGE_LOAD
 		);
 	//
 	// Ends up the whole process of monitoring
 	//
 	void StopMonitoring();
+	//
+	// Let the driver drop unwanted process events (see ObsrvFilter.h). 
+	// Takes effect right away if monitoring is active, otherwise on 
+	// activation. No rules remove the filter. Linux has no filter, rules
+	// are refused there.
+	//
+	BOOL SetFilter(
+		const OBSRV_FILTER_RULE* pRules,
+		DWORD                    nRules
+		);
+	//
+	// Time between two scans of /proc, used on Linux when listening to
+	// the process events connector isn't permitted. Takes effect on
+	// activation.
+	//
+	void SetPollInterval(DWORD dwMilliseconds);
+	//
+	// Bound the event queue and choose what happens when it is full
+	// (see CQueueContainer::SetLimits()). Only while not monitoring.
+	//
+	BOOL SetQueueLimits(
+		DWORD                 dwMaxElements,
+		ULONG64               ullMaxBytes,
+		QUEUE_OVERFLOW_POLICY ePolicy
+		);
+	//
+	// Hand short-lived processes over as lifetimes (see
+	// CQueueContainer::SetLifetimeCoalescing()). Only while not
+	// monitoring.
+	//
+	BOOL SetLifetimeCoalescing(BOOL bEnable);
+	//
+	// Whether the process events connector source reads the image path
+	// and command line of new processes from /proc, on by default. Turn
+	// it off when a CEnrichmentStage reads them instead. Scanning /proc
+	// reads them anyway; Windows ignores it. Only while not monitoring.
+	//
+	BOOL SetSourceDetails(BOOL bEnable);
+	//
+	// Retrieve the event counters, including the number of lost events
+	//
+	void GetStats(QUEUE_STATS& stats);
+	//
+	// Print the per stage latency histograms
+	//
+	void DumpLatency() const;
 };
 
 #endif // !defined(_APPLICATIONSCOPE_H_)
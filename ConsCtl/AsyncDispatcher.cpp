@@ -0,0 +1,240 @@
+//---------------------------------------------------------------------------
+//
+// AsyncDispatcher.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Callback handlers written as C++20 coroutines
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "AsyncDispatcher.h"
+#include <assert.h>
+
+//---------------------------------------------------------------------------
+//
+// class CHandlerTask
+//
+//---------------------------------------------------------------------------
+
+//
+// The coroutine has finished. It is freed before the dispatcher learns
+// about it, thus nothing is left once the dispatcher is idle.
+//
+std::coroutine_handle<> CHandlerTask::promise_type::CFinalAwaiter::await_suspend(
+	std::coroutine_handle<promise_type> hCoroutine
+	) noexcept
+{
+	CAsyncDispatcher* pDispatcher = hCoroutine.promise().pDispatcher;
+	PASYNC_SLOT       pSlot       = hCoroutine.promise().pSlot;
+
+	hCoroutine.destroy();
+
+	return pDispatcher->OnCompleted(pSlot);
+}
+
+//
+// Hand the coroutine over to the dispatcher
+//
+std::coroutine_handle<CHandlerTask::promise_type> CHandlerTask::Detach(
+	CAsyncDispatcher* pDispatcher,
+	PASYNC_SLOT       pSlot
+	)
+{
+	std::coroutine_handle<promise_type> hCoroutine = m_hCoroutine;
+
+	hCoroutine.promise().pDispatcher = pDispatcher;
+	hCoroutine.promise().pSlot       = pSlot;
+	m_hCoroutine = std::coroutine_handle<promise_type>();
+
+	return hCoroutine;
+}
+
+//---------------------------------------------------------------------------
+//
+// class CAsyncDispatcher
+//
+//---------------------------------------------------------------------------
+CAsyncDispatcher::CAsyncDispatcher(
+	CAsyncCallbackHandler* pHandler,
+	DWORD                  dwMaxInFlight
+	):
+	m_pHandler(pHandler),
+	m_pvParam(NULL),
+	m_pFreeSlots(NULL),
+	m_dwInFlight(0),
+	m_csSlots(TEXT("async slots")),
+	m_ullWaits(0)
+{
+	assert(NULL != m_pHandler);
+	if (0 == dwMaxInFlight)
+		dwMaxInFlight = 1;
+	m_Slots.resize(dwMaxInFlight);
+	for (DWORD i = 0; i < dwMaxInFlight; i++)
+	{
+		m_Slots[i].pNext = m_pFreeSlots;
+		m_pFreeSlots     = &m_Slots[i];
+	} // for
+	m_evtSlotFree = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	assert(NULL != m_evtSlotFree);
+}
+
+CAsyncDispatcher::~CAsyncDispatcher()
+{
+	WaitUntilIdle();
+	::CloseHandle(m_evtSlotFree);
+}
+
+//
+// Wait until every event taken so far has been handled
+//
+void CAsyncDispatcher::WaitUntilIdle()
+{
+	while (0 != GetInFlight())
+		::WaitForSingleObject(m_evtSlotFree, INFINITE);
+}
+
+//
+// Events being handled or waiting for their process
+//
+DWORD CAsyncDispatcher::GetInFlight()
+{
+	CLockMgr<CCSWrapper> guard(m_csSlots, TRUE);
+	return m_dwInFlight;
+}
+
+//
+// Times the retrieval thread has waited for an event to finish
+//
+ULONG64 CAsyncDispatcher::GetWaits() const
+{
+	return m_ullWaits.load(std::memory_order_relaxed);
+}
+
+//
+// A single event, started like a batch of one
+//
+void CAsyncDispatcher::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	if (NULL != pQueuedItem)
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+}
+
+//
+// Start a coroutine per event, waiting when there are too many
+//
+void CAsyncDispatcher::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	m_pvParam.store(pvParam, std::memory_order_relaxed);
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		PASYNC_SLOT pSlot  = AllocateSlot();
+		BOOL        bStart = TRUE;
+
+		pSlot->item  = pQueuedItems[i];
+		pSlot->pNext = NULL;
+		{
+			CLockMgr<CCSWrapper> guard(m_csSlots, TRUE);
+			unordered_map<DWORD, PASYNC_SLOT>::iterator it = m_LastSlots.find(pSlot->item.hProcessId);
+			//
+			// The process has an event in flight, this one waits for it
+			//
+			if (it != m_LastSlots.end())
+			{
+				it->second->pNext = pSlot;
+				it->second        = pSlot;
+				bStart            = FALSE;
+			}
+			else
+				m_LastSlots[pSlot->item.hProcessId] = pSlot;
+		}
+		//
+		// Runs until the handler suspends for the first time
+		//
+		if (bStart)
+			CreateCoroutine(pSlot).resume();
+	} // for
+}
+
+//
+// A free slot, waiting until there is one
+//
+PASYNC_SLOT CAsyncDispatcher::AllocateSlot()
+{
+	while (TRUE)
+	{
+		{
+			CLockMgr<CCSWrapper> guard(m_csSlots, TRUE);
+			PASYNC_SLOT pSlot = m_pFreeSlots;
+
+			if (NULL != pSlot)
+			{
+				m_pFreeSlots = pSlot->pNext;
+				m_dwInFlight++;
+				return pSlot;
+			}
+		}
+		m_ullWaits.fetch_add(1, std::memory_order_relaxed);
+		::WaitForSingleObject(m_evtSlotFree, INFINITE);
+	} // while
+}
+
+//
+// Create the coroutine of an event, ready to run
+//
+std::coroutine_handle<> CAsyncDispatcher::CreateCoroutine(PASYNC_SLOT pSlot)
+{
+	CHandlerTask task = m_pHandler->OnProcessEventAsync(
+		&pSlot->item,
+		m_pvParam.load(std::memory_order_relaxed)
+		);
+
+	return task.Detach(this, pSlot);
+}
+
+//
+// An event has been handled. Returns the coroutine of the next event of
+// its process, to be resumed right away, or a coroutine that does
+// nothing.
+//
+std::coroutine_handle<> CAsyncDispatcher::OnCompleted(PASYNC_SLOT pSlot)
+{
+	PASYNC_SLOT pNext;
+	{
+		CLockMgr<CCSWrapper> guard(m_csSlots, TRUE);
+
+		pNext = pSlot->pNext;
+		if (NULL == pNext)
+			m_LastSlots.erase(pSlot->item.hProcessId);
+		pSlot->pNext = m_pFreeSlots;
+		m_pFreeSlots = pSlot;
+		m_dwInFlight--;
+		//
+		// Signaled before letting go of the lock, the dispatcher may be
+		// destroyed as soon as it sees nothing in flight
+		//
+		::SetEvent(m_evtSlotFree);
+	}
+	if (NULL != pNext)
+		return CreateCoroutine(pNext);
+
+	return std::noop_coroutine();
+}
+
+//----------------------------End of the file -------------------------------
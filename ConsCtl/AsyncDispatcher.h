@@ -0,0 +1,270 @@
+//---------------------------------------------------------------------------
+//
+// AsyncDispatcher.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Callback handlers written as C++20 coroutines
+//
+// DESCRIPTION:
+//              A CAsyncCallbackHandler returns a CHandlerTask, i.e. it is
+//              a coroutine, and may co_await its I/O (name resolution, a
+//              remote sink) rather than block on it. CAsyncDispatcher is
+//              the CCallbackHandler passed to CApplicationScope: it starts
+//              a coroutine per event on the retrieval thread, which takes
+//              the next event as soon as the coroutine suspends. Whatever
+//              resumes the coroutine (the I/O library's thread, usually)
+//              runs it on.
+//
+//              Up to a given number of events are in flight at once, the
+//              retrieval thread waits for one of them to finish beyond
+//              that. The events of a process are handled one after the
+//              other: one that comes while another of its process is in
+//              flight waits for it, and is started by the thread that
+//              finishes the former. Events of different processes may
+//              finish in any order.
+//
+//              The event passed to the coroutine is a copy, valid until it
+//              finishes. Exceptions escaping a coroutine are swallowed.
+//
+//---------------------------------------------------------------------------
+#if !defined(_ASYNCDISPATCHER_H_)
+#define _ASYNCDISPATCHER_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "CallbackHandler.h"
+#include "LockMgr.h"
+#include <atomic>
+#include <coroutine>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events in flight by default
+//
+#define ASYNC_DEFAULT_IN_FLIGHT         64
+
+class CAsyncDispatcher;
+
+//
+// An event being handled, or waiting for the previous one of its process
+//
+typedef struct _AsyncSlot
+{
+	QUEUED_ITEM        item;
+	struct _AsyncSlot* pNext;   // Next event of the process, or the next
+	                            // free slot
+} ASYNC_SLOT, *PASYNC_SLOT;
+
+//---------------------------------------------------------------------------
+//
+// class CHandlerTask
+//
+// What a CAsyncCallbackHandler coroutine returns. The coroutine doesn't
+// run until the dispatcher starts it, and frees itself when done.
+//
+//---------------------------------------------------------------------------
+class CHandlerTask
+{
+public:
+	struct promise_type
+	{
+		CAsyncDispatcher* pDispatcher;
+		PASYNC_SLOT       pSlot;
+
+		promise_type():
+			pDispatcher(NULL),
+			pSlot(NULL)
+		{
+		}
+		CHandlerTask get_return_object()
+		{
+			return CHandlerTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept
+		{
+			return std::suspend_always();
+		}
+		//
+		// Tell the dispatcher, and go on with the next event of the
+		// process, if any
+		//
+		struct CFinalAwaiter
+		{
+			bool await_ready() noexcept
+			{
+				return false;
+			}
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> hCoroutine) noexcept;
+			void await_resume() noexcept
+			{
+			}
+		};
+		CFinalAwaiter final_suspend() noexcept
+		{
+			return CFinalAwaiter();
+		}
+		void return_void()
+		{
+		}
+		void unhandled_exception()
+		{
+			// Handle all exceptions
+		}
+	};
+
+	CHandlerTask(CHandlerTask&& rhs) noexcept:
+		m_hCoroutine(rhs.m_hCoroutine)
+	{
+		rhs.m_hCoroutine = std::coroutine_handle<promise_type>();
+	}
+	~CHandlerTask()
+	{
+		//
+		// Never started
+		//
+		if (m_hCoroutine)
+			m_hCoroutine.destroy();
+	}
+private:
+	friend class CAsyncDispatcher;
+
+	explicit CHandlerTask(std::coroutine_handle<promise_type> hCoroutine):
+		m_hCoroutine(hCoroutine)
+	{
+	}
+	CHandlerTask(const CHandlerTask&);
+	CHandlerTask& operator=(const CHandlerTask&);
+	//
+	// Hand the coroutine over to the dispatcher
+	//
+	std::coroutine_handle<promise_type> Detach(
+		CAsyncDispatcher* pDispatcher,
+		PASYNC_SLOT       pSlot
+		);
+
+	std::coroutine_handle<promise_type> m_hCoroutine;
+};
+
+//---------------------------------------------------------------------------
+//
+// class CAsyncCallbackHandler
+//
+//---------------------------------------------------------------------------
+class CAsyncCallbackHandler
+{
+public:
+	virtual ~CAsyncCallbackHandler() {}
+	//
+	// Handle an event of any kind. pQueuedItem stays valid until the
+	// coroutine finishes.
+	//
+	virtual CHandlerTask OnProcessEventAsync(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		) = 0;
+};
+
+//---------------------------------------------------------------------------
+//
+// class CAsyncDispatcher
+//
+//---------------------------------------------------------------------------
+class CAsyncDispatcher: public CCallbackHandler
+{
+public:
+	CAsyncDispatcher(
+		CAsyncCallbackHandler* pHandler,
+		DWORD                  dwMaxInFlight = ASYNC_DEFAULT_IN_FLIGHT
+		);
+	//
+	// Wait until every event has been handled
+	//
+	virtual ~CAsyncDispatcher();
+	//
+	// Wait until every event taken so far has been handled. Not while
+	// the retrieval thread still calls this handler.
+	//
+	void WaitUntilIdle();
+	//
+	// Events being handled or waiting for their process
+	//
+	DWORD GetInFlight();
+	//
+	// Times the retrieval thread has waited for an event to finish
+	//
+	ULONG64 GetWaits() const;
+	//
+	// A single event, started like a batch of one
+	//
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		);
+	//
+	// Start a coroutine per event, waiting when there are too many
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+private:
+	friend struct CHandlerTask::promise_type::CFinalAwaiter;
+	//
+	// A free slot, waiting until there is one
+	//
+	PASYNC_SLOT AllocateSlot();
+	//
+	// Create the coroutine of an event, ready to run
+	//
+	std::coroutine_handle<> CreateCoroutine(PASYNC_SLOT pSlot);
+	//
+	// An event has been handled. Returns the coroutine of the next event
+	// of its process, or one that does nothing.
+	//
+	std::coroutine_handle<> OnCompleted(PASYNC_SLOT pSlot);
+	//
+	// The actual handler
+	//
+	CAsyncCallbackHandler* m_pHandler;
+	std::atomic<PVOID>     m_pvParam;
+	//
+	// The slots, free ones linked through pNext, and the last slot
+	// taken per process having events in flight. Guarded by m_csSlots.
+	//
+	vector<ASYNC_SLOT>                  m_Slots;
+	PASYNC_SLOT                         m_pFreeSlots;
+	DWORD                               m_dwInFlight;
+	unordered_map<DWORD, PASYNC_SLOT>   m_LastSlots;
+	CCSWrapper                          m_csSlots;
+	//
+	// Signaled whenever an event has been handled
+	//
+	HANDLE m_evtSlotFree;
+	//
+	// Times the retrieval thread has waited for a slot
+	//
+	std::atomic<ULONG64> m_ullWaits;
+};
+
+#endif // !defined(_ASYNCDISPATCHER_H_)
+//----------------------------End of the file -------------------------------
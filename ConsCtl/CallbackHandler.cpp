@@ -22,12 +22,17 @@
 //---------------------------------------------------------------------------
 #include "Common.h"
 #include "CallbackHandler.h"
+#if !defined(_WIN32)
+#include <stdio.h>
+#include <unistd.h>
+#endif
 
 //---------------------------------------------------------------------------
 //
 // class CCallbackHandler
 //
 //---------------------------------------------------------------------------
+#if defined(_WIN32)
 CCallbackHandler::CCallbackHandler():
 	m_hModPsapi(NULL),
 	m_pfnEnumProcessModules(NULL),
@@ -58,7 +63,99 @@ CCallbackHandler::~CCallbackHandler()
 	if (NULL != m_hModPsapi)
 		::FreeLibrary(m_hModPsapi);
 }
+#else
+CCallbackHandler::CCallbackHandler()
+{
+}
+
+CCallbackHandler::~CCallbackHandler()
+{
+}
+#endif
+
+//
+// Dispatch a batch of events one at a time
+//
+void CCallbackHandler::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems, 
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		PQUEUED_ITEM pQueuedItem = &pQueuedItems[i];
+
+		if (QUEUED_ITEM_IMAGE_LOAD == pQueuedItem->eKind)
+			OnImageEvent( pQueuedItem, pvParam );
+		else if (QUEUED_ITEM_THREAD == pQueuedItem->eKind)
+			OnThreadEvent( pQueuedItem, pvParam );
+		else if ((QUEUED_ITEM_EXEC == pQueuedItem->eKind) ||
+		         (QUEUED_ITEM_UID == pQueuedItem->eKind))
+			OnProcessChangeEvent( pQueuedItem, pvParam );
+		else if (QUEUED_ITEM_LIFETIME == pQueuedItem->eKind)
+			OnProcessLifetimeEvent( pQueuedItem, pvParam );
+		else
+			OnProcessEvent( pQueuedItem, pvParam );
+	} // for
+}
+
+//
+// Image loads are ignored unless a handler overrides this method
+//
+void CCallbackHandler::OnImageEvent(
+	PQUEUED_ITEM pQueuedItem, 
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pQueuedItem);
+	UNREFERENCED_PARAMETER(pvParam);
+}
 
+//
+// So are thread events
+//
+void CCallbackHandler::OnThreadEvent(
+	PQUEUED_ITEM pQueuedItem, 
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pQueuedItem);
+	UNREFERENCED_PARAMETER(pvParam);
+}
+
+//
+// As are process changes
+//
+void CCallbackHandler::OnProcessChangeEvent(
+	PQUEUED_ITEM pQueuedItem, 
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pQueuedItem);
+	UNREFERENCED_PARAMETER(pvParam);
+}
+
+//
+// A process lifetime is handed over as its create and its exit, to
+// handlers that don't know about lifetimes
+//
+void CCallbackHandler::OnProcessLifetimeEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	QUEUED_ITEM item = *pQueuedItem;
+
+	item.eKind   = QUEUED_ITEM_PROCESS;
+	item.bCreate = TRUE;
+	OnProcessEvent( &item, pvParam );
+	item.bCreate      = FALSE;
+	item.llSourceTime = pQueuedItem->llExitTime;
+	OnProcessEvent( &item, pvParam );
+}
+
+#if defined(_WIN32)
 //
 // Return the name of the process by its ID using PSAPI
 //
@@ -117,5 +214,29 @@ BOOL CCallbackHandler::GetProcessName(
 	} // if
 	return bResult;
 }
+#else
+//
+// Return the name of the process by its ID, read from /proc
+//
+BOOL CCallbackHandler::GetProcessName(
+	DWORD  dwProcessId,
+	LPTSTR lpFileName, 
+	DWORD  dwLen
+	)
+{
+	char    szLink[32];
+	ssize_t cchRead;
+
+	if ((NULL == lpFileName) || (0 == dwLen))
+		return FALSE;
+	snprintf(szLink, sizeof(szLink), "/proc/%u/exe", dwProcessId);
+	cchRead = ::readlink(szLink, lpFileName, dwLen - 1);
+	if (cchRead < 0)
+		cchRead = 0;
+	lpFileName[cchRead] = '\0';
+
+	return (0 != cchRead);
+}
+#endif
 
 //--------------------- End of the file -------------------------------------
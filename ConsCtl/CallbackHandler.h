@@ -21,7 +21,14 @@
 #pragma once
 #endif // _MSC_VER > 1000
 
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
 
+#if defined(_WIN32)
 //---------------------------------------------------------------------------
 //
 //                   typedefs for PSAPI.DLL functions 
@@ -40,6 +47,7 @@ typedef DWORD (WINAPI * PFNGETMODULEFILENAMEEX)(
     LPTSTR  lpFilename,
     DWORD   nSize
 	);
+#endif // defined(_WIN32)
 
 //---------------------------------------------------------------------------
 //
@@ -58,19 +66,70 @@ public:
 		PQUEUED_ITEM pQueuedItem, 
 		PVOID        pvParam
 		) = 0;
+	//
+	// Called with every batch of events the retrieval thread has taken
+	// off the queue, in the order they were queued. The default hands
+	// them over one at a time to the methods for their kinds. Handlers
+	// that write to a file or a socket override it and pay their per
+	// call costs once per batch. The items are valid until it returns.
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems, 
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+	//
+	// Called for every image mapped into a process, if image loads have
+	// been subscribed to. They come at a far higher rate than process 
+	// events, thus the handler should return quickly.
+	//
+	virtual void OnImageEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		);
+	//
+	// Called for every thread created or exited, if thread events have
+	// been subscribed to. Those come at the highest rate of all.
+	//
+	virtual void OnThreadEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		);
+	//
+	// Called when a running process has executed another image or
+	// changed its user IDs (QUEUED_ITEM_EXEC, QUEUED_ITEM_UID). Only the
+	// Linux event source reports those.
+	//
+	virtual void OnProcessChangeEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		);
+	//
+	// Called for a process that has been created and has exited while
+	// both events were queued (QUEUED_ITEM_LIFETIME), if the queue has
+	// been told to coalesce them. The default calls OnProcessEvent()
+	// twice, for the create and for the exit.
+	//
+	virtual void OnProcessLifetimeEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		);
 protected:
 	//
-	// Return the name of the process by its ID using PSAPI
+	// Return the name of the process by its ID using PSAPI, or 
+	// /proc/<pid>/exe on Linux
 	//
 	BOOL GetProcessName(
 		DWORD  dwProcessId,
 		LPTSTR lpFileName, 
 		DWORD  dwLen
 		);
+#if defined(_WIN32)
 private:
 	HMODULE                 m_hModPsapi;
 	PFNENUMPROCESSMODULES   m_pfnEnumProcessModules;	
 	PFNGETMODULEFILENAMEEX  m_pfnGetModuleFileNameEx;
+#endif
 };
 
 #endif // !defined(_CALLBACKHANDLER_H_)
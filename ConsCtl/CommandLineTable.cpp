@@ -0,0 +1,124 @@
+//---------------------------------------------------------------------------
+//
+// CommandLineTable.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Command lines on their way from the sources to the cache
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "CommandLineTable.h"
+
+//---------------------------------------------------------------------------
+//
+// class CCommandLineTable
+//
+//---------------------------------------------------------------------------
+CCommandLineTable::CCommandLineTable(ULONG64 ullBudget):
+	m_dwFirstId(COMMAND_LINE_TABLE_NO_ID + 1),
+	m_ullBudget(ullBudget),
+	m_csTable(TEXT("command line table"))
+{
+	::ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+CCommandLineTable::~CCommandLineTable()
+{
+}
+
+//
+// The table the command lines of the events travel in. Created on first
+// use, by whichever source or handler comes first.
+//
+CCommandLineTable& CCommandLineTable::GetInstance()
+{
+	static CCommandLineTable s_Table;
+
+	return s_Table;
+}
+
+//
+// Keep a command line, dropping the oldest ones for room
+//
+DWORD CCommandLineTable::Add(const WCHAR* pszCommandLine)
+{
+	if ((NULL == pszCommandLine) || (0 == pszCommandLine[0]))
+		return COMMAND_LINE_TABLE_NO_ID;
+
+	wstring  commandLine(pszCommandLine);
+	ULONG64  ullBytes = (commandLine.size() + 1) * sizeof(WCHAR);
+	CLockMgr<CCSWrapper> guard(m_csTable, TRUE);
+
+	if (ullBytes > m_ullBudget)
+		return COMMAND_LINE_TABLE_NO_ID;
+	while (m_Stats.ullBytes + ullBytes > m_ullBudget)
+	{
+		m_Stats.ullBytes -= (m_Strings.front().size() + 1) * sizeof(WCHAR);
+		m_Strings.pop_front();
+		m_dwFirstId++;
+		m_Stats.ullEvicted++;
+	} // while
+	//
+	// The IDs have gone round, the ones still kept would be taken for
+	// others
+	//
+	if (COMMAND_LINE_TABLE_NO_ID == (DWORD)(m_dwFirstId + m_Strings.size()))
+	{
+		m_Stats.ullEvicted += m_Strings.size();
+		m_Strings.clear();
+		m_Stats.ullBytes = 0;
+		m_dwFirstId      = COMMAND_LINE_TABLE_NO_ID + 1;
+	}
+	m_Strings.push_back(std::move(commandLine));
+	m_Stats.ullBytes += ullBytes;
+	m_Stats.ullAdded++;
+
+	return m_dwFirstId + (DWORD)m_Strings.size() - 1;
+}
+
+//
+// Copy the command line of an ID
+//
+BOOL CCommandLineTable::Resolve(
+	DWORD    dwId,
+	wstring& commandLine
+	)
+{
+	if (COMMAND_LINE_TABLE_NO_ID == dwId)
+		return FALSE;
+
+	CLockMgr<CCSWrapper> guard(m_csTable, TRUE);
+	DWORD dwIndex = dwId - m_dwFirstId;
+
+	if ((dwId < m_dwFirstId) || (dwIndex >= m_Strings.size()))
+	{
+		m_Stats.ullMissed++;
+		return FALSE;
+	}
+	commandLine = m_Strings[dwIndex];
+
+	return TRUE;
+}
+
+//
+// Take a snapshot of the counters
+//
+void CCommandLineTable::GetStats(COMMAND_LINE_TABLE_STATS& stats)
+{
+	CLockMgr<CCSWrapper> guard(m_csTable, TRUE);
+
+	stats = m_Stats;
+	stats.dwStrings = (DWORD)m_Strings.size();
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,124 @@
+//---------------------------------------------------------------------------
+//
+// CommandLineTable.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Command lines on their way from the sources to the cache
+//
+// DESCRIPTION:
+//              Command lines are nearly all different (arguments, temp
+//              paths, process IDs), thus keeping every one for good, as
+//              CStringTable does with image paths, would use up any
+//              budget. CCommandLineTable keeps the command lines of the
+//              events only while they travel: a source adds the command
+//              line it has read and the event carries the ID it gets
+//              back, then CProcessCache copies the command line into the
+//              process it keeps.
+//
+//              The table is bounded by a number of bytes, beyond which
+//              the oldest command lines go. Resolve() copies the command
+//              line out and fails once it has gone. IDs are not reused
+//              until 4G command lines have gone through.
+//
+//              Add() and Resolve() may be called by any thread.
+//
+//---------------------------------------------------------------------------
+#if !defined(_COMMANDLINETABLE_H_)
+#define _COMMANDLINETABLE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "LockMgr.h"
+#include <deque>
+#include <string>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// The ID of the empty command line, and of one that has not been kept
+//
+#define COMMAND_LINE_TABLE_NO_ID        0
+//
+// Bytes the command lines take at most by default
+//
+#define COMMAND_LINE_TABLE_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+//---------------------------------------------------------------------------
+//
+// struct _CommandLineTableStats
+//
+//---------------------------------------------------------------------------
+typedef struct _CommandLineTableStats
+{
+	ULONG64 ullAdded;        // Command lines kept
+	ULONG64 ullEvicted;      // Of those, the ones dropped for room
+	ULONG64 ullMissed;       // Resolve() calls for one dropped already
+	DWORD   dwStrings;       // Command lines kept now
+	ULONG64 ullBytes;        // Taken up by them
+} COMMAND_LINE_TABLE_STATS, *PCOMMAND_LINE_TABLE_STATS;
+
+//---------------------------------------------------------------------------
+//
+// class CCommandLineTable
+//
+//---------------------------------------------------------------------------
+class CCommandLineTable
+{
+public:
+	CCommandLineTable(ULONG64 ullBudget = COMMAND_LINE_TABLE_DEFAULT_BUDGET);
+	virtual ~CCommandLineTable();
+	//
+	// The table the command lines of the events travel in
+	//
+	static CCommandLineTable& GetInstance();
+	//
+	// Keep a command line, dropping the oldest ones for room. The ID to
+	// give the event, COMMAND_LINE_TABLE_NO_ID for an empty command line
+	// or one larger than the budget.
+	//
+	DWORD Add(const WCHAR* pszCommandLine);
+	//
+	// Copy the command line of an ID. FALSE for COMMAND_LINE_TABLE_NO_ID
+	// and once the command line has gone.
+	//
+	BOOL Resolve(
+		DWORD    dwId,
+		wstring& commandLine
+		);
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(COMMAND_LINE_TABLE_STATS& stats);
+private:
+	//
+	// The command lines, oldest first; the first has the ID m_dwFirstId
+	// and the others follow
+	//
+	deque<wstring> m_Strings;
+	DWORD          m_dwFirstId;
+	ULONG64        m_ullBudget;
+	//
+	// Guarded by m_csTable, as is all the rest
+	//
+	COMMAND_LINE_TABLE_STATS m_Stats;
+	CCSWrapper               m_csTable;
+};
+
+#endif // !defined(_COMMANDLINETABLE_H_)
+//----------------------------End of the file -------------------------------
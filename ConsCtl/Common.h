@@ -28,7 +28,28 @@
 // Includes
 //
 //---------------------------------------------------------------------------
-#include <windows.h>
+#include "Platform.h"
+
+//
+// Longest command line read for an event (characters, including the 
+// terminating zero). Longer ones are truncated.
+//
+#define QUEUED_ITEM_MAX_COMMAND_LINE   1024
+
+//
+// What a queued item describes
+//
+enum QUEUED_ITEM_KIND
+{
+	QUEUED_ITEM_PROCESS,     // Process created or terminated (bCreate)
+	QUEUED_ITEM_IMAGE_LOAD,  // Image mapped into hProcessId
+	QUEUED_ITEM_THREAD,      // Thread of hProcessId created or exited (bCreate)
+	QUEUED_ITEM_EXEC,        // hProcessId started running dwImageId (Linux)
+	QUEUED_ITEM_UID,         // hProcessId changed its user IDs (Linux)
+	QUEUED_ITEM_LIFETIME     // hProcessId created and exited, both events
+	                         // still queued (see CQueueContainer::
+	                         // SetLifetimeCoalescing())
+};
 
 
 //---------------------------------------------------------------------------
@@ -38,9 +59,64 @@
 //---------------------------------------------------------------------------
 typedef struct _QueuedItem  
 {
+	QUEUED_ITEM_KIND eKind;
 	DWORD32  hParentId;
     DWORD32  hProcessId;
     BOOLEAN bCreate;
+	//
+	// Assigned by the driver, increases by one for every event. Gaps 
+	// mean lost events, 0 means the source doesn't number its events.
+	//
+	ULONG64  ullSequence;
+	//
+	// Captured by the driver when the event happened
+	//
+	DWORD32  dwCreatingThreadId;  // Create only
+	DWORD32  dwSessionId;
+	DWORD32  dwExitStatus;        // Terminate only
+	//
+	// Image load only
+	//
+	ULONG64  ullImageBase;
+	ULONG64  ullImageSize;
+	BOOLEAN  bSystemImage;           // Mapped into kernel space
+	//
+	// Thread only
+	//
+	DWORD32  dwThreadId;
+	//
+	// User ID change only
+	//
+	DWORD32  dwRealUid;
+	DWORD32  dwEffectiveUid;
+	//
+	// Process lifetime only: when the exit happened. llSourceTime is
+	// when the process was created.
+	//
+	LONGLONG llExitTime;
+	//
+	// ID of the process's image path in the string table
+	// (CStringTable::GetInstance()), 0 if not known. An image load
+	// carries the loaded image's path instead. The source sets it when
+	// it has read the path, a CProcessCache the event has gone through
+	// sets it on the events of processes it knows, whatever their kind
+	// but image loads.
+	//
+	// ID of the command line the source has read in the command line
+	// table (CCommandLineTable::GetInstance()), 0 if none. The table
+	// keeps it only for a while; a CProcessCache copies it into the
+	// process it keeps.
+	//
+	DWORD32  dwImageId;
+	DWORD32  dwCommandLineId;
+	//
+	// QueryPerformanceCounter() values taken along the way, 0 if not 
+	// taken. The driver stamps the event when its notify routine runs.
+	//
+	LONGLONG llSourceTime;    // Event reported by the source
+	LONGLONG llEnqueueTime;   // Appended to the queue
+	LONGLONG llDequeueTime;   // Taken off the queue
+	LONGLONG llCallbackTime;  // Handed over to the callback handler
 } QUEUED_ITEM, *PQUEUED_ITEM;
 
 
@@ -15,13 +15,25 @@
 //                                                                         
 //---------------------------------------------------------------------------
 
+#if defined(_WIN32)
 #include <conio.h>
 #include <tchar.h>
 #include <Windows.h>
 #include <Psapi.h>
+#else
+#include <locale.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #include "Common.h"
 #include "ApplicationScope.h"
 #include "CallbackHandler.h"
+#include "EnrichmentStage.h"
+#include "ParallelDispatcher.h"
+#include "ProcessCache.h"
+#include "ProcessTree.h"
+#include <atomic>
 
 //
 // This constant is declared only for testing putposes and
@@ -29,6 +41,15 @@
 // the system
 //
 const int MAX_TEST_PROCESSES = 3;
+//
+// Memory the event queue may take at most
+//
+const ULONG64 QUEUE_MEMORY_BUDGET = 64 * 1024 * 1024;
+//
+// The handler below takes its time, several processes are handled at
+// once
+//
+const DWORD DISPATCH_WORKERS = 4;
 //---------------------------------------------------------------------------
 // 
 // class CWhatheverYouWantToHold
@@ -60,11 +81,34 @@ private:
 // 
 // class CMyCallbackHandler
 //
-// Implements an interface for receiving notifications
+// Implements an interface for receiving notifications. It is called by
+// the workers of a CParallelDispatcher, thus from several threads.
 //
 //---------------------------------------------------------------------------
 class CMyCallbackHandler: public CCallbackHandler
 {
+public:
+	CMyCallbackHandler():
+		m_ullThreadsCreated(0),
+		m_ullThreadsExited(0),
+		m_pCache(NULL),
+		m_pTree(NULL)
+	{
+	}
+	//
+	// Thread events received so far, by all the workers
+	//
+	std::atomic<ULONG64> m_ullThreadsCreated;
+	std::atomic<ULONG64> m_ullThreadsExited;
+	//
+	// Details of the processes, taken down before the events get here
+	//
+	CProcessCache* m_pCache;
+	//
+	// Parent/child relations of the processes seen
+	//
+	CProcessTree*  m_pTree;
+private:
 	//
 	// Implements an event method
 	//
@@ -103,16 +147,18 @@ class CMyCallbackHandler: public CCallbackHandler
 				);
 			*/
 
-			// because of delays in the queue, 
-			// not all programs may succeed in getting the `FileName`, 
-			// especially when shutting down, 
-			// the program may have died out but not yet queried the target.
-			HANDLE hProcess = ::OpenProcess(
-				PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pQueuedItem->hProcessId);
-			if (hProcess) {
-				::GetModuleFileNameEx(hProcess, NULL, szFileName, MAX_PATH);
-				::CloseHandle(hProcess);
-			}
+			// the event carries the ID of the image, which the driver
+			// captured when the process was created. If it couldn't, the
+			// process cache has asked the process once, as soon as its
+			// creation came out of the queue. It knows the image of an
+			// exited process too.
+			const WCHAR* pszImagePath = 
+				CStringTable::GetInstance().Resolve(pQueuedItem->dwImageId);
+#if defined(_WIN32)
+			_tcsncpy(szFileName, pszImagePath, MAX_PATH - 1);
+#else
+			snprintf(szFileName, MAX_PATH, "%.*ls", MAX_PATH - 1, pszImagePath);
+#endif
 
 			if (pQueuedItem->bCreate)
 				//
@@ -128,23 +174,227 @@ class CMyCallbackHandler: public CCallbackHandler
 			else
 				wsprintf(
 					szBuffer,
-					TEXT("Process has been terminated: PID=0x%.8X\n"),
-					pQueuedItem->hProcessId);
+					TEXT("Process has been terminated: PID=0x%.8X %s, exit status=0x%.8X\n"),
+					pQueuedItem->hProcessId,
+					szFileName,
+					pQueuedItem->dwExitStatus);
 			//
 			// Output to the console screen
 			//
-			_tprintf(szBuffer);
+			_tprintf(TEXT("%s"), szBuffer);
 		} // if
 	}
+	//
+	// Implements the image load event method. There is no delay here,
+	// images are loaded at a much higher rate than processes are created.
+	//
+	virtual void OnImageEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		)
+	{
+		if (NULL != pQueuedItem)
+			_tprintf(
+				TEXT("    Image loaded: PID=0x%.8X base=0x%.16") TFMT_X64 TEXT(" %") TFMT_WSTR TEXT("\n"),
+				pQueuedItem->hProcessId,
+				pQueuedItem->ullImageBase,
+				CStringTable::GetInstance().Resolve(pQueuedItem->dwImageId)
+				);
+	}
+	//
+	// Implements the thread event method. Threads come and go far too
+	// often for printing every one of them, thus they are just counted.
+	//
+	virtual void OnThreadEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		)
+	{
+		if (NULL == pQueuedItem)
+			return;
+		if (pQueuedItem->bCreate)
+			m_ullThreadsCreated++;
+		else
+			m_ullThreadsExited++;
+	}
+	//
+	// Implements the process change event method (Linux only)
+	//
+	virtual void OnProcessChangeEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		)
+	{
+		if (NULL == pQueuedItem)
+			return;
+		if (QUEUED_ITEM_EXEC == pQueuedItem->eKind)
+			_tprintf(
+				TEXT("    Image executed: PID=0x%.8X %") TFMT_WSTR TEXT("\n"),
+				pQueuedItem->hProcessId,
+				CStringTable::GetInstance().Resolve(pQueuedItem->dwImageId)
+				);
+		else
+			_tprintf(
+				TEXT("    User IDs changed: PID=0x%.8X real=%u effective=%u\n"),
+				pQueuedItem->hProcessId,
+				pQueuedItem->dwRealUid,
+				pQueuedItem->dwEffectiveUid
+				);
+	}
+	//
+	// Implements the process lifetime event method, a process that has
+	// already exited when its creation is handled
+	//
+	virtual void OnProcessLifetimeEvent(
+		PQUEUED_ITEM pQueuedItem, 
+		PVOID        pvParam
+		)
+	{
+		if (NULL == pQueuedItem)
+			return;
+		_tprintf(
+			TEXT("Process has come and gone: PID=0x%.8X %") TFMT_WSTR TEXT(", ")
+			TEXT("lived %") TFMT_U64 TEXT(" us, exit status=0x%.8X\n"),
+			pQueuedItem->hProcessId,
+			CStringTable::GetInstance().Resolve(pQueuedItem->dwImageId),
+			TimestampToNanoseconds(pQueuedItem->llExitTime - pQueuedItem->llSourceTime) / 1000,
+			pQueuedItem->dwExitStatus
+			);
+	}
 };
 
+//---------------------------------------------------------------------------
+// ShowStats
+//
+// Show how many events have been received and lost
+//---------------------------------------------------------------------------
+static void ShowStats(
+	CApplicationScope&  appScope,
+	CMyCallbackHandler*  pHandler,
+	CParallelDispatcher* pDispatcher,
+	CEnrichmentStage*    pStage
+	)
+{
+	ENRICH_STATS enrich;
+	QUEUE_STATS workers;
+	QUEUE_STATS stats;
+	appScope.GetStats(stats);
+	_tprintf(
+		TEXT("Received: %") TFMT_U64 TEXT(", delivered: %") TFMT_U64 TEXT(", missed: %") TFMT_U64 TEXT(", ")
+		TEXT("out of order: %") TFMT_U64 TEXT(", dropped by the driver: %") TFMT_U64 TEXT("\n"),
+		stats.ullReceived,
+		stats.ullDelivered,
+		stats.ullMissed,
+		stats.ullOutOfOrder,
+		stats.ullDriverOverflow
+		);
+	_tprintf(
+		TEXT("Threads created: %") TFMT_U64 TEXT(", exited: %") TFMT_U64 TEXT(", dropped by the driver: %") TFMT_U64 TEXT("\n"),
+		pHandler->m_ullThreadsCreated.load(),
+		pHandler->m_ullThreadsExited.load(),
+		stats.ullThreadDropped
+		);
+	_tprintf(
+		TEXT("Queue full, dropped: %") TFMT_U64 TEXT(" newest, %") TFMT_U64 TEXT(" oldest, %") TFMT_U64 TEXT(" coalesced, ")
+		TEXT("waits: %") TFMT_U64 TEXT("\n"),
+		stats.ullDroppedNewest,
+		stats.ullDroppedOldest,
+		stats.ullCoalesced,
+		stats.ullProducerWaits
+		);
+	_tprintf(
+		TEXT("Lifetimes: %") TFMT_U64 TEXT(", events folded into them: %") TFMT_U64 TEXT("\n"),
+		stats.ullLifetimes,
+		stats.ullLifetimeEvents
+		);
+	pDispatcher->GetStats(workers);
+	_tprintf(
+		TEXT("Workers: %u, handled: %") TFMT_U64 TEXT(", waiting: %u, dispatch waits: %") TFMT_U64 TEXT("\n"),
+		pDispatcher->GetWorkerCount(),
+		workers.ullDelivered,
+		workers.dwQueueDepth,
+		workers.ullProducerWaits
+		);
+	if (NULL != pHandler->m_pCache)
+	{
+		PROCESS_CACHE_STATS cache;
+		STRING_TABLE_STATS  strings;
+		COMMAND_LINE_TABLE_STATS commandLines;
+
+		pHandler->m_pCache->GetStats(cache);
+		CStringTable::GetInstance().GetStats(strings);
+		CCommandLineTable::GetInstance().GetStats(commandLines);
+		_tprintf(
+			TEXT("Process cache: %u processes, hits: %") TFMT_U64 TEXT(", misses: %") TFMT_U64 TEXT(", ")
+			TEXT("taken down: %") TFMT_U64 TEXT(" (%") TFMT_U64 TEXT(" asked), evicted: %") TFMT_U64 TEXT("\n"),
+			cache.dwEntries,
+			cache.ullHits,
+			cache.ullMisses,
+			cache.ullFilled,
+			cache.ullQueried,
+			cache.ullEvicted
+			);
+		_tprintf(
+			TEXT("Strings: %u (%") TFMT_U64 TEXT(" bytes, %") TFMT_U64 TEXT(" in the arena), ")
+			TEXT("interned: %") TFMT_U64 TEXT(", refused: %") TFMT_U64 TEXT("\n"),
+			strings.dwStrings,
+			strings.ullStringBytes,
+			strings.ullArenaBytes,
+			strings.ullLookups,
+			strings.ullRefused
+			);
+		_tprintf(
+			TEXT("Command lines: %u (%") TFMT_U64 TEXT(" bytes), added: %") TFMT_U64 TEXT(", ")
+			TEXT("evicted: %") TFMT_U64 TEXT(", gone before the cache: %") TFMT_U64 TEXT("\n"),
+			commandLines.dwStrings,
+			commandLines.ullBytes,
+			commandLines.ullAdded,
+			commandLines.ullEvicted,
+			commandLines.ullMissed
+			);
+	}
+	if (NULL != pHandler->m_pTree)
+	{
+		PROCESS_TREE_STATS tree;
+
+		pHandler->m_pTree->GetStats(tree);
+		_tprintf(
+			TEXT("Process tree: %u processes (%u running, %u exited, %u lingering), ")
+			TEXT("taken down: %") TFMT_U64 TEXT(" (%") TFMT_U64 TEXT(" asked), removed: %") TFMT_U64 TEXT(", ")
+			TEXT("pool: %") TFMT_U64 TEXT(" bytes\n"),
+			tree.dwNodes,
+			tree.dwRunning,
+			tree.dwExited,
+			tree.dwLingering,
+			tree.ullInserted,
+			tree.ullQueried,
+			tree.ullRemoved,
+			tree.ullPoolBytes
+			);
+	}
+	pStage->GetStats(enrich);
+	_tprintf(
+		TEXT("Enrichment: %") TFMT_U64 TEXT(" events, read for: %") TFMT_U64 TEXT(", with an image: %") TFMT_U64 TEXT(", ")
+		TEXT("waits: %") TFMT_U64 TEXT("\n"),
+		enrich.ullEvents,
+		enrich.ullEnriched,
+		enrich.ullSucceeded,
+		enrich.ullProducerWaits
+		);
+	appScope.DumpLatency();
+	CCSWrapper::DumpProfile();
+}
+
+#if defined(_WIN32)
 //---------------------------------------------------------------------------
 // Perform
 //
 // Thin wrapper around __try..__finally
 //---------------------------------------------------------------------------
 void Perform(
-	CCallbackHandler*        pHandler,
+	CMyCallbackHandler*      pHandler,
+	CParallelDispatcher*     pDispatcher,
+	CEnrichmentStage*        pStage,
 	CWhatheverYouWantToHold* pParamObject
 	)
 {
@@ -160,15 +410,32 @@ void Perform(
 	// Create the only instance of this object
 	//
 	CApplicationScope& g_AppScope = CApplicationScope::GetInstance(
-		pHandler     // User-supplied object for handling notifications
+		pStage       // Passes the notifications on to the process cache,
+		             // then the process tree and pDispatcher, which
+		             // passes them on to pHandler
+		);
+	//
+	// A stalled handler mustn't take all the memory there is
+	//
+	g_AppScope.SetQueueLimits(
+		0,                         // No bound on the count
+		QUEUE_MEMORY_BUDGET,       // but on the bytes
+		QUEUE_OVERFLOW_DROP_NEWEST
 		);
+	//
+	// Processes that come and go before they have been handled are
+	// handled once
+	//
+	g_AppScope.SetLifetimeCoalescing(TRUE);
 	__try
 	{
 		//
 		// Initiate monitoring
 		//
 		g_AppScope.StartMonitoring(
-			pParamObject // Pointer to a parameter value passed to the object 
+			pParamObject,              // Pointer to a parameter value passed to the object 
+			OBSRV_SUBSCRIBE_IMAGE_LOAD | // DLLs mapped into the processes as well
+			OBSRV_SUBSCRIBE_THREAD       // and their threads
 			);
 		for (i = 0; i < MAX_TEST_PROCESSES; i++)
 		{
@@ -204,10 +471,21 @@ void Perform(
 			::Sleep(10);
 		} // for
 	
-		while(!kbhit())
+		//
+		// 'L' prints the latency histograms, any other key quits
+		//
+		_tprintf(TEXT("Press 'L' for latencies, any other key to quit\n"));
+		while (TRUE)
 		{
-		}
-		_getch();
+			while(!kbhit())
+			{
+			}
+			int nKey = _getch();
+			if (('l' != nKey) && ('L' != nKey))
+				break;
+			g_AppScope.DumpLatency();
+		} // while
+		ShowStats(g_AppScope, pHandler, pDispatcher, pStage);
 	}
 	__finally
 	{
@@ -217,6 +495,95 @@ void Perform(
 		g_AppScope.StopMonitoring();
 	}
 }
+#else
+//---------------------------------------------------------------------------
+// Perform
+//
+// Same as above with a few sleep(1) instances in place of Notepad
+//---------------------------------------------------------------------------
+void Perform(
+	CMyCallbackHandler*      pHandler,
+	CParallelDispatcher*     pDispatcher,
+	CEnrichmentStage*        pStage,
+	CWhatheverYouWantToHold* pParamObject
+	)
+{
+	pid_t processArr[MAX_TEST_PROCESSES] = {0};
+	int   i;
+
+	//
+	// Create the only instance of this object
+	//
+	CApplicationScope& g_AppScope = CApplicationScope::GetInstance(
+		pStage       // Passes the notifications on to the process cache,
+		             // then the process tree and pDispatcher, which
+		             // passes them on to pHandler
+		);
+	//
+	// A stalled handler mustn't take all the memory there is
+	//
+	g_AppScope.SetQueueLimits(
+		0,                         // No bound on the count
+		QUEUE_MEMORY_BUDGET,       // but on the bytes
+		QUEUE_OVERFLOW_DROP_NEWEST
+		);
+	//
+	// Processes that come and go before they have been handled are
+	// handled once
+	//
+	g_AppScope.SetLifetimeCoalescing(TRUE);
+	//
+	// Initiate monitoring
+	//
+	if (!g_AppScope.StartMonitoring(
+			pParamObject,              // Pointer to a parameter value passed to the object 
+			OBSRV_SUBSCRIBE_THREAD     // Threads of the processes as well
+			))
+	{
+		_tprintf(TEXT("Listening to process events requires CAP_NET_ADMIN (root)\n"));
+		return;
+	}
+	for (i = 0; i < MAX_TEST_PROCESSES; i++)
+	{
+		// Spawn sleep's instances
+		processArr[i] = ::fork();
+		if (0 == processArr[i])
+		{
+			::execlp("sleep", "sleep", "60", (char*)NULL);
+			::_exit(127);
+		}
+	} // for
+	::Sleep(5000);
+	for (i = 0; i < MAX_TEST_PROCESSES; i++)
+	{
+		if (processArr[i] > 0)
+		{
+			// Kill sleep's instances
+			::kill(processArr[i], SIGKILL);
+			::waitpid(processArr[i], NULL, 0);
+		} // if
+		::Sleep(10);
+	} // for
+	//
+	// 'L' prints the latency histograms, any other key quits
+	//
+	_tprintf(TEXT("Press 'L' and Enter for latencies, Enter to quit\n"));
+	while (TRUE)
+	{
+		int nKey = getchar();
+		if (('l' != nKey) && ('L' != nKey))
+			break;
+		while (('\n' != nKey) && (EOF != nKey))
+			nKey = getchar();
+		g_AppScope.DumpLatency();
+	} // while
+	ShowStats(g_AppScope, pHandler, pDispatcher, pStage);
+	//
+	// Terminate the process of observing processes
+	//
+	g_AppScope.StopMonitoring();
+}
+#endif
 
 //---------------------------------------------------------------------------
 // 
@@ -226,9 +593,29 @@ void Perform(
 int main(int argc, char* argv[])
 {
 	CMyCallbackHandler      myHandler;
+	CParallelDispatcher     myDispatcher(&myHandler, DISPATCH_WORKERS);
+	CProcessTree            myTree(&myDispatcher);
+	CProcessCache           myCache(&myTree);
+	//
+	// Reads what the source couldn't provide, off the retrieval thread
+	//
+	CEnrichmentStage        myStage(&myCache);
 	CWhatheverYouWantToHold myView; 
 
-	Perform( &myHandler, &myView );
+#if !defined(_WIN32)
+	//
+	// Paths and command lines are converted by the locale's encoding
+	//
+	setlocale(LC_ALL, "");
+#endif
+	//
+	// Cheap enough to be left on
+	//
+	CCSWrapper::SetProfiling(TRUE);
+
+	myHandler.m_pCache = &myCache;
+	myHandler.m_pTree  = &myTree;
+	Perform( &myHandler, &myDispatcher, &myStage, &myView );
 
 	return 0;
 }
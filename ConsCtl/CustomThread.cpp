@@ -15,7 +15,6 @@
 //                                                                         
 //---------------------------------------------------------------------------
 #include "CustomThread.h"
-#include <process.h>
 #include <assert.h>
 
 //---------------------------------------------------------------------------
@@ -36,10 +35,10 @@ typedef unsigned (__stdcall *PTHREAD_START) (void *);
 
 HANDLE CCustomThread::sm_hThread = NULL;
 
-CCustomThread::CCustomThread(TCHAR* pszThreadGuid):
-	m_hShutdownEvent(NULL),
-	m_bThreadActive(NULL),
-	m_dwThreadId(NULL)
+CCustomThread::CCustomThread(const TCHAR* pszThreadGuid):
+	m_bThreadActive(FALSE),
+	m_dwThreadId(0),
+	m_hShutdownEvent(NULL)
 {
 	if (NULL != pszThreadGuid)
 		_tcscpy(m_szThreadGuid, pszThreadGuid);
@@ -71,7 +70,7 @@ void CCustomThread::SetActive(BOOL bValue)
 
 			if (0 != _tcslen(m_szThreadGuid))
 				m_hShutdownEvent = ::CreateEvent(NULL, FALSE, FALSE, m_szThreadGuid);
-			ULONG ulResult = _beginthreadex(
+			uintptr_t ulResult = _beginthreadex(
 				(void *)NULL,
 				(unsigned)0,
 				(PTHREAD_START)CCustomThread::ThreadFunc,
@@ -79,7 +78,7 @@ void CCustomThread::SetActive(BOOL bValue)
 				(unsigned)0,
 				(unsigned *)&m_dwThreadId
 				);
-			if (ulResult != -1)
+			if (0 != ulResult)
 				//
 				// Wait until the thread gets activated
 				//
@@ -91,6 +90,7 @@ void CCustomThread::SetActive(BOOL bValue)
 		{
 			if ( GetIsActive() )
 			{
+				OnBeforeDeactivate();
 				if (NULL != m_hShutdownEvent)
 					//
 					// Signal the thread's event
@@ -118,8 +118,10 @@ void CCustomThread::SetActive(BOOL bValue)
 //
 BOOL CCustomThread::GetIsActive()
 {
-	CLockMgr<CCSWrapper> lockMgr(m_CritSec, TRUE);	
-	return m_bThreadActive;
+	//
+	// Polled in loops, thus an atomic rather than a lock
+	//
+	return m_bThreadActive.load(std::memory_order_acquire);
 }
 
 //
@@ -127,8 +129,7 @@ BOOL CCustomThread::GetIsActive()
 //
 void CCustomThread::SetIsActive(BOOL bValue)
 {
-	CLockMgr<CCSWrapper> lockMgr(m_CritSec, TRUE);	
-	m_bThreadActive = bValue;
+	m_bThreadActive.store(bValue, std::memory_order_release);
 }
 
 
@@ -173,6 +174,14 @@ BOOL CCustomThread::OnBeforeActivate()
 	return TRUE;
 }
 
+//
+// Called when the thread is asked to stop
+//
+void CCustomThread::OnBeforeDeactivate()
+{
+	// Do nothing
+}
+
 //
 // Called after the thread function exits
 //
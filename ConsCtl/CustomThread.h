@@ -23,10 +23,8 @@
 // Includes
 //
 //---------------------------------------------------------------------------
-#include "common.h"
-#include <tchar.h>
-#include <windows.h>
-#include "LockMgr.h"
+#include "Common.h"
+#include <atomic>
 
 
 //---------------------------------------------------------------------------
@@ -40,7 +38,7 @@
 class CCustomThread  
 {
 public:
-	CCustomThread(TCHAR* pszThreadGuid);
+	CCustomThread(const TCHAR* pszThreadGuid);
 	virtual ~CCustomThread();
 	//
 	// Activate / Stop the thread 
@@ -66,10 +64,9 @@ private:
 	//
 	// Thread attributes
 	//
-	BOOL          m_bThreadActive;
-	DWORD         m_dwThreadId;
-	static HANDLE sm_hThread;
-	CCSWrapper    m_CritSec;
+	std::atomic<BOOL> m_bThreadActive;
+	DWORD             m_dwThreadId;
+	static HANDLE     sm_hThread;
 	//
 	// The name of the shut down event
 	//
@@ -87,6 +84,11 @@ protected:
 	//
 	virtual BOOL OnBeforeActivate();
 	//
+	// Called when the thread is asked to stop, before its shut down 
+	// event is signaled. For threads that wait on something else.
+	//
+	virtual void OnBeforeDeactivate();
+	//
 	// Called after the thread function exits
 	//
 	virtual void OnAfterDeactivate();
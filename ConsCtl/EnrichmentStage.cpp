@@ -0,0 +1,377 @@
+//---------------------------------------------------------------------------
+//
+// EnrichmentStage.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Reading the details of processes on a pool of threads
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "EnrichmentStage.h"
+#include "StringTable.h"
+#include "CommandLineTable.h"
+#if !defined(_WIN32)
+#include "ProcFs.h"
+#endif
+#include <assert.h>
+
+//---------------------------------------------------------------------------
+//
+// class CEnrichmentStage
+//
+//---------------------------------------------------------------------------
+CEnrichmentStage::CEnrichmentStage(
+	CCallbackHandler* pHandler,
+	DWORD             dwWorkers,
+	DWORD             dwWindow
+	):
+	m_pHandler(pHandler),
+	m_pvParam(NULL),
+	m_pItems(NULL),
+	m_pbDone(NULL),
+	m_ullMask(0),
+	m_ullNextIn(0),
+	m_ullNextOut(0),
+	m_csDrain(TEXT("enrichment drain")),
+	m_bProducerWaiting(FALSE),
+	m_bStopping(FALSE),
+	m_dwNextWorker(0),
+	m_OutputHandler(this),
+	m_pOutput(NULL),
+	m_ullEvents(0),
+	m_ullEnriched(0),
+	m_ullSucceeded(0),
+	m_ullProducerWaits(0)
+{
+	ULONG64 ullSize = 1;
+
+	assert(NULL != m_pHandler);
+	if (0 == dwWorkers)
+		dwWorkers = 1;
+	if (dwWorkers > ENRICH_MAX_WORKERS)
+		dwWorkers = ENRICH_MAX_WORKERS;
+	if (0 == dwWindow)
+		dwWindow = ENRICH_DEFAULT_WINDOW;
+	while (ullSize < dwWindow)
+		ullSize <<= 1;
+	m_ullMask = ullSize - 1;
+	m_pItems  = new QUEUED_ITEM[(size_t)ullSize];
+	m_pbDone  = new std::atomic<BOOL>[(size_t)ullSize];
+	for (ULONG64 i = 0; i < ullSize; i++)
+		m_pbDone[i].store(FALSE, std::memory_order_relaxed);
+	m_evtRoom = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	assert(NULL != m_evtRoom);
+	//
+	// Events leave the buffer for the actual handler no faster than it
+	// takes them
+	//
+	m_pOutput = new CQueueContainer(&m_OutputHandler);
+	m_pOutput->SetLimits((DWORD)ullSize, 0, QUEUE_OVERFLOW_BLOCK);
+	m_pOutput->StartReceivingNotifications();
+	for (DWORD i = 0; i < dwWorkers; i++)
+	{
+		CWorker* pWorker = new CWorker(this);
+
+		pWorker->SetActive(TRUE);
+		m_Workers.push_back(pWorker);
+	} // for
+}
+
+CEnrichmentStage::~CEnrichmentStage()
+{
+	m_bStopping.store(TRUE);
+	::SetEvent(m_evtRoom);
+	for (size_t i = 0; i < m_Workers.size(); i++)
+	{
+		CWorker* pWorker = m_Workers[i];
+
+		::SetEvent(pWorker->m_evtWork);
+		while (pWorker->GetIsActive())
+			::Sleep(1);
+		delete pWorker;
+	} // for
+	m_pOutput->StopReceivingNotifications();
+	delete m_pOutput;
+	::CloseHandle(m_evtRoom);
+	delete [] m_pbDone;
+	delete [] m_pItems;
+}
+
+//
+// Take a snapshot of the counters
+//
+void CEnrichmentStage::GetStats(ENRICH_STATS& stats) const
+{
+	stats.ullEvents        = m_ullEvents.load(std::memory_order_relaxed);
+	stats.ullEnriched      = m_ullEnriched.load(std::memory_order_relaxed);
+	stats.ullSucceeded     = m_ullSucceeded.load(std::memory_order_relaxed);
+	stats.ullProducerWaits = m_ullProducerWaits.load(std::memory_order_relaxed);
+}
+
+//
+// A single event, taken like a batch of one
+//
+void CEnrichmentStage::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	if (NULL != pQueuedItem)
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+}
+
+//
+// Give every event a ticket and a slot, hand the ones lacking details
+// to the workers in turn and mark the others done
+//
+void CEnrichmentStage::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	DWORD dwWorkers = (DWORD)m_Workers.size();
+	DWORD dwHanded  = 0;
+
+	m_pvParam.store(pvParam, std::memory_order_relaxed);
+	m_ullEvents.fetch_add(dwCount, std::memory_order_relaxed);
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		ULONG64 ullTicket = m_ullNextIn++;
+
+		while (ullTicket - m_ullNextOut.load() > m_ullMask)
+		{
+			if (m_bStopping.load())
+				return;
+			//
+			// The events of this batch that needed nothing are passed on
+			// by no one else
+			//
+			Drain();
+			if (ullTicket - m_ullNextOut.load() <= m_ullMask)
+				break;
+			m_bProducerWaiting.store(TRUE);
+			if (ullTicket - m_ullNextOut.load() <= m_ullMask)
+			{
+				m_bProducerWaiting.store(FALSE);
+				break;
+			}
+			m_ullProducerWaits.fetch_add(1, std::memory_order_relaxed);
+			::WaitForSingleObject(m_evtRoom, ENRICH_WAIT_POLL);
+		} // while
+
+		ULONG64 ullSlot = ullTicket & m_ullMask;
+
+		m_pItems[ullSlot] = pQueuedItems[i];
+		if (!NeedsDetails(m_pItems[ullSlot]))
+		{
+			m_pbDone[ullSlot].store(TRUE);
+			continue;
+		}
+		CWorker* pWorker = m_Workers[m_dwNextWorker];
+
+		m_dwNextWorker = (m_dwNextWorker + 1) % dwWorkers;
+		{
+			CLockMgr<CCSWrapper> guard(pWorker->m_csTickets, TRUE);
+
+			pWorker->m_Tickets.push_back(ullTicket);
+		}
+		::SetEvent(pWorker->m_evtWork);
+		dwHanded++;
+	} // for
+	m_ullEnriched.fetch_add(dwHanded, std::memory_order_relaxed);
+	Drain();
+}
+
+//
+// Whether an event lacks details a worker could read. Lifetimes are of
+// processes that have exited already.
+//
+BOOL CEnrichmentStage::NeedsDetails(const QUEUED_ITEM& item)
+{
+	if (STRING_TABLE_NO_ID != item.dwImageId)
+		return FALSE;
+	if (QUEUED_ITEM_EXEC == item.eKind)
+		return TRUE;
+	return ((QUEUED_ITEM_PROCESS == item.eKind) && item.bCreate);
+}
+
+//
+// Read the details of the event's process
+//
+void CEnrichmentStage::Enrich(PQUEUED_ITEM pItem)
+{
+	WCHAR szImagePath[MAX_PATH];
+
+#if defined(_WIN32)
+	GetProcessName(pItem->hProcessId, szImagePath, MAX_PATH);
+#else
+	ReadProcessImage(pItem->hProcessId, szImagePath, MAX_PATH);
+	if (COMMAND_LINE_TABLE_NO_ID == pItem->dwCommandLineId)
+	{
+		WCHAR szCommandLine[QUEUED_ITEM_MAX_COMMAND_LINE];
+
+		ReadProcessCommandLine(pItem->hProcessId, szCommandLine, QUEUED_ITEM_MAX_COMMAND_LINE);
+		pItem->dwCommandLineId = CCommandLineTable::GetInstance().Add(szCommandLine);
+	}
+	if (0 == pItem->hParentId)
+	{
+		DWORD   dwParentId = 0;
+		ULONG64 ullStartTime;
+
+		ReadProcessStat(pItem->hProcessId, &dwParentId, &ullStartTime);
+		pItem->hParentId = dwParentId;
+	}
+#endif
+	pItem->dwImageId = CStringTable::GetInstance().Intern(szImagePath);
+	if (STRING_TABLE_NO_ID != pItem->dwImageId)
+		m_ullSucceeded.fetch_add(1, std::memory_order_relaxed);
+}
+
+//
+// The thread function of a worker: take the tickets handed over so far
+// and enrich their events one after the other
+//
+void CEnrichmentStage::HandleTickets(CWorker* pWorker)
+{
+	vector<ULONG64> tickets;
+
+	while (!m_bStopping.load())
+	{
+		{
+			CLockMgr<CCSWrapper> guard(pWorker->m_csTickets, TRUE);
+
+			tickets.swap(pWorker->m_Tickets);
+		}
+		if (tickets.empty())
+		{
+			::WaitForSingleObject(pWorker->m_evtWork, INFINITE);
+			continue;
+		}
+		for (size_t i = 0; i < tickets.size(); i++)
+		{
+			ULONG64 ullSlot = tickets[i] & m_ullMask;
+
+			Enrich(&m_pItems[ullSlot]);
+			m_pbDone[ullSlot].store(TRUE);
+			Drain();
+		} // for
+		tickets.clear();
+	} // while
+}
+
+//
+// Append the events done at the head of the buffer to the output queue,
+// a contiguous run of slots at a time, then free their slots.
+//
+// Whoever marks an event done calls this. The head is stored before the
+// slot there is checked, and an event is marked done before the head is
+// checked, thus either the thread draining sees the event done or the
+// one marking it sees it at the head.
+//
+void CEnrichmentStage::Drain()
+{
+	ULONG64 ullHead = m_ullNextOut.load();
+
+	if (!m_pbDone[ullHead & m_ullMask].load())
+		return;
+
+	CLockMgr<CCSWrapper> guard(m_csDrain, TRUE);
+
+	ullHead = m_ullNextOut.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		ULONG64 ullFirst = ullHead & m_ullMask;
+		ULONG64 ullCount = 0;
+
+		while ((ullFirst + ullCount <= m_ullMask) &&
+		       m_pbDone[ullFirst + ullCount].load())
+			ullCount++;
+		if (0 == ullCount)
+			break;
+		//
+		// Blocks while the actual handler is behind
+		//
+		m_pOutput->AppendBatch(&m_pItems[ullFirst], (DWORD)ullCount);
+		for (ULONG64 i = 0; i < ullCount; i++)
+			m_pbDone[ullFirst + i].store(FALSE, std::memory_order_relaxed);
+		ullHead += ullCount;
+		m_ullNextOut.store(ullHead);
+		if (m_bProducerWaiting.load() && m_bProducerWaiting.exchange(FALSE))
+			::SetEvent(m_evtRoom);
+	} // for
+}
+
+//---------------------------------------------------------------------------
+//
+// class CEnrichmentStage::CWorker
+//
+//---------------------------------------------------------------------------
+CEnrichmentStage::CWorker::CWorker(CEnrichmentStage* pStage):
+	CCustomThread(NULL),
+	m_pStage(pStage),
+	m_csTickets(TEXT("enrichment tickets"))
+{
+	m_evtWork = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	assert(NULL != m_evtWork);
+}
+
+CEnrichmentStage::CWorker::~CWorker()
+{
+	::CloseHandle(m_evtWork);
+}
+
+void CEnrichmentStage::CWorker::Run()
+{
+	m_pStage->HandleTickets(this);
+}
+
+//---------------------------------------------------------------------------
+//
+// class CEnrichmentStage::COutputHandler
+//
+//---------------------------------------------------------------------------
+CEnrichmentStage::COutputHandler::COutputHandler(CEnrichmentStage* pOwner):
+	m_pOwner(pOwner)
+{
+}
+
+void CEnrichmentStage::COutputHandler::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pvParam);
+
+	m_pOwner->m_pHandler->OnProcessEvent(
+		pQueuedItem,
+		m_pOwner->m_pvParam.load(std::memory_order_relaxed)
+		);
+}
+
+void CEnrichmentStage::COutputHandler::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pvParam);
+
+	m_pOwner->m_pHandler->OnProcessEvents(
+		pQueuedItems,
+		dwCount,
+		m_pOwner->m_pvParam.load(std::memory_order_relaxed)
+		);
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,214 @@
+//---------------------------------------------------------------------------
+//
+// EnrichmentStage.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Reading the details of processes on a pool of threads
+//
+// DESCRIPTION:
+//              The image path and command line of a process can be read
+//              only while it runs. A handler asking for them after the
+//              event has waited in the queue often finds the process gone,
+//              and a source reading them itself holds up the events behind.
+//              CEnrichmentStage is a handler wrapping another one, meant to
+//              be the first after the queue of CApplicationScope: it hands
+//              the creates and exec()s lacking details to a few worker
+//              threads as soon as they come out of the queue, and passes
+//              the events on once they are done, in the order they came.
+//
+//              Events that need nothing pass through a reorder buffer of
+//              a given number of events (a power of 2) along with the
+//              others. The events leaving it are appended to a queue of
+//              their own, whose retrieval thread calls the actual handler,
+//              thus the workers never wait for a slow handler unless that
+//              queue is full. When the buffer is full the thread passing
+//              events in waits.
+//
+//              On Linux the connector source reads the details itself,
+//              unless told not to (CApplicationScope::SetSourceDetails()).
+//
+//---------------------------------------------------------------------------
+#if !defined(_ENRICHMENTSTAGE_H_)
+#define _ENRICHMENTSTAGE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "CallbackHandler.h"
+#include "CustomThread.h"
+#include "QueueContainer.h"
+#include <atomic>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Worker threads at most and by default, events in the reorder buffer by
+// default, and how often (milliseconds) a thread waiting for room checks
+// whether the stage is still there
+//
+#define ENRICH_MAX_WORKERS              32
+#define ENRICH_DEFAULT_WORKERS          4
+#define ENRICH_DEFAULT_WINDOW           1024
+#define ENRICH_WAIT_POLL                10
+
+//---------------------------------------------------------------------------
+//
+// struct _EnrichStats
+//
+//---------------------------------------------------------------------------
+typedef struct _EnrichStats
+{
+	ULONG64 ullEvents;         // Events passed through
+	ULONG64 ullEnriched;       // Of those, handed over to a worker
+	ULONG64 ullSucceeded;      // Of those, with an image path once done
+	ULONG64 ullProducerWaits;  // Times the reorder buffer has been full
+} ENRICH_STATS, *PENRICH_STATS;
+
+//---------------------------------------------------------------------------
+//
+// class CEnrichmentStage
+//
+//---------------------------------------------------------------------------
+class CEnrichmentStage: public CCallbackHandler
+{
+public:
+	CEnrichmentStage(
+		CCallbackHandler* pHandler,
+		DWORD             dwWorkers = ENRICH_DEFAULT_WORKERS,
+		DWORD             dwWindow  = ENRICH_DEFAULT_WINDOW
+		);
+	//
+	// Stop the workers and the output queue. Events not passed on yet
+	// are not handled.
+	//
+	virtual ~CEnrichmentStage();
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(ENRICH_STATS& stats) const;
+	//
+	// A single event, taken like a batch of one
+	//
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		);
+	//
+	// Put the events into the reorder buffer and the ones lacking
+	// details to the workers. Called by one thread at a time.
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+private:
+	//
+	// A worker, with a thread and a list of tickets (positions in the
+	// reorder buffer) of its own
+	//
+	class CWorker: public CCustomThread
+	{
+	public:
+		CWorker(CEnrichmentStage* pStage);
+		virtual ~CWorker();
+
+		CEnrichmentStage* m_pStage;
+		//
+		// Signaled when tickets have been added, or for stopping
+		//
+		HANDLE            m_evtWork;
+		vector<ULONG64>   m_Tickets;
+		CCSWrapper        m_csTickets;
+	protected:
+		virtual void Run();
+	};
+	//
+	// The handler of the output queue, calling the actual handler
+	//
+	class COutputHandler: public CCallbackHandler
+	{
+	public:
+		COutputHandler(CEnrichmentStage* pOwner);
+		virtual void OnProcessEvent(
+			PQUEUED_ITEM pQueuedItem,
+			PVOID        pvParam
+			);
+		virtual void OnProcessEvents(
+			PQUEUED_ITEM pQueuedItems,
+			DWORD        dwCount,
+			PVOID        pvParam
+			);
+	private:
+		CEnrichmentStage* m_pOwner;
+	};
+	//
+	// Whether an event lacks details a worker could read
+	//
+	static BOOL NeedsDetails(const QUEUED_ITEM& item);
+	//
+	// Read the details of the event's process
+	//
+	void Enrich(PQUEUED_ITEM pItem);
+	//
+	// The thread function of a worker
+	//
+	void HandleTickets(CWorker* pWorker);
+	//
+	// Pass the events done at the head of the reorder buffer on, if
+	// there are any. Called after marking an event done.
+	//
+	void Drain();
+	//
+	// The actual handler, and the parameter passed on to it
+	//
+	CCallbackHandler*  m_pHandler;
+	std::atomic<PVOID> m_pvParam;
+	//
+	// The reorder buffer, a power of 2 of events and whether each is
+	// done. The events are kept apart from the flags, thus a run of them
+	// is appended to the output queue at once. Tickets are 64-bit
+	// counters of the events taken in, never wrapping around.
+	//
+	PQUEUED_ITEM         m_pItems;
+	std::atomic<BOOL>*   m_pbDone;
+	ULONG64              m_ullMask;
+	ULONG64              m_ullNextIn;    // Used by the thread passing events in
+	std::atomic<ULONG64> m_ullNextOut;   // Advanced under m_csDrain
+	CCSWrapper           m_csDrain;
+	//
+	// The thread passing events in waits for room
+	//
+	std::atomic<BOOL> m_bProducerWaiting;
+	HANDLE            m_evtRoom;
+	std::atomic<BOOL> m_bStopping;
+
+	vector<CWorker*> m_Workers;
+	DWORD            m_dwNextWorker;
+	COutputHandler   m_OutputHandler;
+	CQueueContainer* m_pOutput;
+
+	std::atomic<ULONG64> m_ullEvents;
+	std::atomic<ULONG64> m_ullEnriched;
+	std::atomic<ULONG64> m_ullSucceeded;
+	std::atomic<ULONG64> m_ullProducerWaits;
+};
+
+#endif // !defined(_ENRICHMENTSTAGE_H_)
+//----------------------------End of the file -------------------------------
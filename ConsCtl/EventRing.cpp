@@ -0,0 +1,425 @@
+//---------------------------------------------------------------------------
+//
+// EventRing.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Ring of events shared by any number of subscribers
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "EventRing.h"
+#include <algorithm>
+#include <assert.h>
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A RING_LAG_DROP subscriber not copying anything
+//
+#define RING_NOT_READING                (~(ULONG64)0)
+
+//---------------------------------------------------------------------------
+//
+// class CEventRing
+//
+//---------------------------------------------------------------------------
+CEventRing::CEventRing(DWORD dwSize):
+	m_ullMask(0),
+	m_pvParam(NULL),
+	m_ullClaimed(0),
+	m_ullPublished(0),
+	m_bProducerWaiting(FALSE),
+	m_ullProducerWaits(0),
+	m_bStarted(FALSE),
+	m_bStopping(FALSE)
+{
+	ULONG64 ullSize = 2;
+
+	while (ullSize < dwSize)
+		ullSize <<= 1;
+	m_Ring.resize((size_t)ullSize);
+	m_ullMask = ullSize - 1;
+	m_evtProgress = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	assert(NULL != m_evtProgress);
+}
+
+CEventRing::~CEventRing()
+{
+	Stop();
+	for (size_t i = 0; i < m_Subscribers.size(); i++)
+		delete m_Subscribers[i];
+	::CloseHandle(m_evtProgress);
+}
+
+//
+// Add a subscriber, before the ring has been started
+//
+int CEventRing::Subscribe(
+	CCallbackHandler* pHandler,
+	RING_LAG_POLICY   ePolicy
+	)
+{
+	if (m_bStarted || (NULL == pHandler))
+		return -1;
+	m_Subscribers.push_back(new CSubscriber(this, pHandler, ePolicy));
+
+	return (int)m_Subscribers.size() - 1;
+}
+
+//
+// Start the threads of the subscribers
+//
+BOOL CEventRing::Start()
+{
+	if (m_bStarted)
+		return FALSE;
+	m_bStopping.store(FALSE);
+	for (size_t i = 0; i < m_Subscribers.size(); i++)
+	{
+		m_Subscribers[i]->SetActive(TRUE);
+		if (!m_Subscribers[i]->GetIsActive())
+		{
+			Stop();
+			return FALSE;
+		}
+	} // for
+	m_bStarted = TRUE;
+
+	return TRUE;
+}
+
+//
+// Stop the threads of the subscribers
+//
+void CEventRing::Stop()
+{
+	m_bStopping.store(TRUE);
+	::SetEvent(m_evtProgress);
+	for (size_t i = 0; i < m_Subscribers.size(); i++)
+	{
+		CSubscriber* pSubscriber = m_Subscribers[i];
+
+		::SetEvent(pSubscriber->m_evtAvailable);
+		while (pSubscriber->GetIsActive())
+			::Sleep(1);
+	} // for
+	m_bStarted = FALSE;
+}
+
+//
+// Number of subscribers
+//
+DWORD CEventRing::GetSubscriberCount() const
+{
+	return (DWORD)m_Subscribers.size();
+}
+
+//
+// Counters of a subscriber
+//
+void CEventRing::GetSubscriberStats(
+	DWORD                  dwIndex,
+	RING_SUBSCRIBER_STATS& stats
+	) const
+{
+	::ZeroMemory((PBYTE)&stats, sizeof(stats));
+	if (dwIndex >= m_Subscribers.size())
+		return;
+
+	const CSubscriber* pSubscriber = m_Subscribers[dwIndex];
+	ULONG64            ullCursor   = pSubscriber->m_ullCursor.load();
+	ULONG64            ullPublished = m_ullPublished.load();
+
+	stats.ullDelivered = pSubscriber->m_ullDelivered.load(std::memory_order_relaxed);
+	stats.ullMissed    = pSubscriber->m_ullMissed.load(std::memory_order_relaxed);
+	stats.ullLag       = (ullPublished > ullCursor) ? ullPublished - ullCursor : 0;
+}
+
+//
+// Times the producer has waited for a RING_LAG_BLOCK subscriber
+//
+ULONG64 CEventRing::GetProducerWaits() const
+{
+	return m_ullProducerWaits.load(std::memory_order_relaxed);
+}
+
+//
+// A single event, written like a batch of one
+//
+void CEventRing::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	if (NULL != pQueuedItem)
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+}
+
+//
+// Write the batch into the ring, waiting for room as needed
+//
+void CEventRing::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	const ULONG64 ullSize = m_ullMask + 1;
+
+	m_pvParam.store(pvParam, std::memory_order_relaxed);
+	while (0 != dwCount)
+	{
+		DWORD   dwChunk = (DWORD)std::min<ULONG64>(dwCount, ullSize);
+		ULONG64 ullNext = m_ullPublished.load(std::memory_order_relaxed);
+		ULONG64 ullEnd  = ullNext + dwChunk;
+
+		//
+		// Announce the slots about to be overwritten, then make sure no
+		// subscriber still needs them
+		//
+		m_ullClaimed.store(ullEnd);
+		while (!HasRoom(ullEnd))
+		{
+			if (m_bStopping.load())
+				return;
+			m_bProducerWaiting.store(TRUE);
+			if (HasRoom(ullEnd))
+			{
+				m_bProducerWaiting.store(FALSE);
+				break;
+			}
+			m_ullProducerWaits.fetch_add(1, std::memory_order_relaxed);
+			::WaitForSingleObject(m_evtProgress, RING_WAIT_POLL);
+		} // while
+		for (DWORD i = 0; i < dwChunk; i++)
+			m_Ring[(size_t)((ullNext + i) & m_ullMask)] = pQueuedItems[i];
+		m_ullPublished.store(ullEnd);
+		//
+		// Wake up those that have run out of events
+		//
+		for (size_t i = 0; i < m_Subscribers.size(); i++)
+		{
+			CSubscriber* pSubscriber = m_Subscribers[i];
+
+			if (pSubscriber->m_bSleeping.load() && pSubscriber->m_bSleeping.exchange(FALSE))
+				::SetEvent(pSubscriber->m_evtAvailable);
+		} // for
+		pQueuedItems += dwChunk;
+		dwCount      -= dwChunk;
+	} // while
+}
+
+//
+// Whether the producer may write the events up to ullEnd (exclusive),
+// overwriting those before ullEnd - size
+//
+BOOL CEventRing::HasRoom(ULONG64 ullEnd) const
+{
+	const ULONG64 ullSize = m_ullMask + 1;
+
+	if (ullEnd <= ullSize)
+		return TRUE;
+
+	ULONG64 ullLimit = ullEnd - ullSize;
+	for (size_t i = 0; i < m_Subscribers.size(); i++)
+	{
+		const CSubscriber* pSubscriber = m_Subscribers[i];
+
+		if (RING_LAG_BLOCK == pSubscriber->m_ePolicy)
+		{
+			if (pSubscriber->m_ullCursor.load(std::memory_order_acquire) < ullLimit)
+				return FALSE;
+		}
+		else
+		{
+			//
+			// Not while it copies any of them
+			//
+			ULONG64 ullReading = pSubscriber->m_ullReading.load();
+			if ((RING_NOT_READING != ullReading) && (ullReading < ullLimit))
+				return FALSE;
+		}
+	} // for
+
+	return TRUE;
+}
+
+//
+// Wake up the producer if it waits for room
+//
+void CEventRing::OnProgress()
+{
+	if (m_bProducerWaiting.load() && m_bProducerWaiting.exchange(FALSE))
+		::SetEvent(m_evtProgress);
+}
+
+//
+// The thread function of a subscriber
+//
+void CEventRing::ReadEvents(CSubscriber* pSubscriber)
+{
+	while (!m_bStopping.load())
+	{
+		BOOL bDelivered = (RING_LAG_BLOCK == pSubscriber->m_ePolicy) ?
+			DeliverBlocking(pSubscriber) :
+			DeliverCopy(pSubscriber);
+
+		if (bDelivered)
+			continue;
+		//
+		// Tell the producer before checking once more, thus either it
+		// sees this one sleeping or this one sees the new events
+		//
+		pSubscriber->m_bSleeping.store(TRUE);
+		if ((m_ullPublished.load() != pSubscriber->m_ullCursor.load(std::memory_order_relaxed)) ||
+		    m_bStopping.load())
+		{
+			pSubscriber->m_bSleeping.store(FALSE);
+			continue;
+		}
+		::WaitForSingleObject(pSubscriber->m_evtAvailable, INFINITE);
+	} // while
+}
+
+//
+// Copy the next events out and hand them over (RING_LAG_BLOCK). They
+// aren't overwritten until the cursor has been moved past them, thus
+// after the copy. Handlers write into the events they are given (cf.
+// CProcessCache), and other subscribers read the same slots meanwhile,
+// thus none of them is handed the ring itself.
+//
+BOOL CEventRing::DeliverBlocking(CSubscriber* pSubscriber)
+{
+	ULONG64 ullCursor    = pSubscriber->m_ullCursor.load(std::memory_order_relaxed);
+	ULONG64 ullPublished = m_ullPublished.load(std::memory_order_acquire);
+
+	if (ullPublished == ullCursor)
+		return FALSE;
+
+	size_t nFirst  = (size_t)(ullCursor & m_ullMask);
+	DWORD  dwCount = (DWORD)std::min<ULONG64>(ullPublished - ullCursor, RING_DELIVERY_BATCH);
+	DWORD  dwFirstPart = (DWORD)std::min<size_t>(dwCount, m_Ring.size() - nFirst);
+
+	std::copy(&m_Ring[nFirst], &m_Ring[nFirst] + dwFirstPart, &pSubscriber->m_Batch[0]);
+	std::copy(&m_Ring[0], &m_Ring[0] + (dwCount - dwFirstPart), &pSubscriber->m_Batch[dwFirstPart]);
+	pSubscriber->m_ullCursor.store(ullCursor + dwCount);
+	OnProgress();
+
+	pSubscriber->m_pHandler->OnProcessEvents(
+		&pSubscriber->m_Batch[0],
+		dwCount,
+		m_pvParam.load(std::memory_order_relaxed)
+		);
+	pSubscriber->m_ullDelivered.store(
+		pSubscriber->m_ullDelivered.load(std::memory_order_relaxed) + dwCount,
+		std::memory_order_relaxed
+		);
+
+	return TRUE;
+}
+
+//
+// Copy the next events out and hand them over (RING_LAG_DROP). Events
+// the ring has gone round past are skipped.
+//
+BOOL CEventRing::DeliverCopy(CSubscriber* pSubscriber)
+{
+	const ULONG64 ullSize      = m_ullMask + 1;
+	ULONG64       ullCursor    = pSubscriber->m_ullCursor.load(std::memory_order_relaxed);
+	ULONG64       ullPublished;
+
+	while (TRUE)
+	{
+		ullPublished = m_ullPublished.load(std::memory_order_acquire);
+		if (ullPublished == ullCursor)
+			return FALSE;
+		//
+		// Announce the copy, then make sure the producer isn't about to
+		// overwrite the first event. If it is, it has seen this one
+		// copying and waits.
+		//
+		pSubscriber->m_ullReading.store(ullCursor);
+
+		ULONG64 ullClaimed = m_ullClaimed.load();
+		if (ullClaimed <= ullCursor + ullSize)
+			break;
+		pSubscriber->m_ullReading.store(RING_NOT_READING);
+		pSubscriber->m_ullMissed.store(
+			pSubscriber->m_ullMissed.load(std::memory_order_relaxed) + ullClaimed - ullSize - ullCursor,
+			std::memory_order_relaxed
+			);
+		ullCursor = ullClaimed - ullSize;
+		pSubscriber->m_ullCursor.store(ullCursor);
+		OnProgress();
+	} // while
+
+	DWORD dwCount = (DWORD)std::min<ULONG64>(ullPublished - ullCursor, RING_DELIVERY_BATCH);
+	for (DWORD i = 0; i < dwCount; i++)
+		pSubscriber->m_Batch[i] = m_Ring[(size_t)((ullCursor + i) & m_ullMask)];
+	pSubscriber->m_ullReading.store(RING_NOT_READING);
+	pSubscriber->m_ullCursor.store(ullCursor + dwCount);
+	OnProgress();
+
+	pSubscriber->m_pHandler->OnProcessEvents(
+		&pSubscriber->m_Batch[0],
+		dwCount,
+		m_pvParam.load(std::memory_order_relaxed)
+		);
+	pSubscriber->m_ullDelivered.store(
+		pSubscriber->m_ullDelivered.load(std::memory_order_relaxed) + dwCount,
+		std::memory_order_relaxed
+		);
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------------------
+//
+// class CEventRing::CSubscriber
+//
+//---------------------------------------------------------------------------
+CEventRing::CSubscriber::CSubscriber(
+	CEventRing*       pRing,
+	CCallbackHandler* pHandler,
+	RING_LAG_POLICY   ePolicy
+	):
+	CCustomThread(NULL),
+	m_pRing(pRing),
+	m_pHandler(pHandler),
+	m_ePolicy(ePolicy),
+	m_ullCursor(0),
+	m_ullReading(RING_NOT_READING),
+	m_bSleeping(FALSE),
+	m_ullDelivered(0),
+	m_ullMissed(0)
+{
+	m_evtAvailable = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	assert(NULL != m_evtAvailable);
+	m_Batch.resize(RING_DELIVERY_BATCH);
+}
+
+CEventRing::CSubscriber::~CSubscriber()
+{
+	::CloseHandle(m_evtAvailable);
+}
+
+void CEventRing::CSubscriber::Run()
+{
+	m_pRing->ReadEvents(this);
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,233 @@
+//---------------------------------------------------------------------------
+//
+// EventRing.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Ring of events shared by any number of subscribers
+//
+// DESCRIPTION:
+//              CEventRing is the one handler of CApplicationScope and hands
+//              every event over to several others (a console printer, a
+//              journal writer, a detector), each at its own pace. The
+//              events are written once into a ring; every subscriber has a
+//              thread and a cursor of its own and reads them from there.
+//
+//              Every subscriber is handed a copy of its events, a batch at
+//              a time, and may write into them as wrapping handlers do.
+//              A subscriber with RING_LAG_BLOCK never misses an event: no
+//              event is overwritten before it has copied it out, thus the
+//              slowest of them holds the ring up (and the events wait in
+//              the queue of CApplicationScope). One with RING_LAG_DROP
+//              never holds it up for longer than it takes to copy a batch
+//              out: if the ring has gone round past its cursor, it skips
+//              the events overwritten and counts them as missed.
+//
+//              The sequences of the ring are 64-bit counters of the events
+//              written, never wrapping around. The producer announces the
+//              events it is going to write (claimed), then writes them and
+//              publishes them. Subscribers that have nothing to read, and
+//              the producer waiting for room, tell so before they wait,
+//              and only then are they signaled (cf. CMpscQueue).
+//
+//---------------------------------------------------------------------------
+#if !defined(_EVENTRING_H_)
+#define _EVENTRING_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "CallbackHandler.h"
+#include "CustomThread.h"
+#include <atomic>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events in the ring by default (rounded up to a power of 2), events
+// handed over to a subscriber at once at most, and how often
+// (milliseconds) the producer waiting for room checks whether the
+// subscribers are still there
+//
+#define RING_DEFAULT_SIZE               1024
+#define RING_DELIVERY_BATCH             256
+#define RING_WAIT_POLL                  10
+
+//
+// What happens when the ring has gone round to a subscriber's cursor
+//
+enum RING_LAG_POLICY
+{
+	RING_LAG_BLOCK,   // Wait for the subscriber
+	RING_LAG_DROP     // Overwrite, the subscriber misses the events
+};
+
+//---------------------------------------------------------------------------
+//
+// struct _RingSubscriberStats
+//
+//---------------------------------------------------------------------------
+typedef struct _RingSubscriberStats
+{
+	ULONG64 ullDelivered;   // Events handed over to the subscriber
+	ULONG64 ullMissed;      // Events overwritten before it could read them
+	ULONG64 ullLag;         // Events published but not read yet
+} RING_SUBSCRIBER_STATS, *PRING_SUBSCRIBER_STATS;
+
+//---------------------------------------------------------------------------
+//
+// class CEventRing
+//
+//---------------------------------------------------------------------------
+class CEventRing: public CCallbackHandler
+{
+public:
+	CEventRing(DWORD dwSize = RING_DEFAULT_SIZE);
+	//
+	// Stop the subscribers
+	//
+	virtual ~CEventRing();
+	//
+	// Add a subscriber, before the ring has been started. Returns its
+	// index, or -1.
+	//
+	int Subscribe(
+		CCallbackHandler* pHandler,
+		RING_LAG_POLICY   ePolicy
+		);
+	//
+	// Start the threads of the subscribers
+	//
+	BOOL Start();
+	//
+	// Stop them. Events they haven't read yet are not handled.
+	//
+	void Stop();
+	//
+	// Number of subscribers
+	//
+	DWORD GetSubscriberCount() const;
+	//
+	// Counters of a subscriber
+	//
+	void GetSubscriberStats(
+		DWORD                  dwIndex,
+		RING_SUBSCRIBER_STATS& stats
+		) const;
+	//
+	// Times the producer has waited for a RING_LAG_BLOCK subscriber
+	//
+	ULONG64 GetProducerWaits() const;
+	//
+	// A single event, written like a batch of one
+	//
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		);
+	//
+	// Write the batch into the ring, waiting for room as needed. Called
+	// by the retrieval thread only.
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+private:
+	//
+	// A subscriber, with a thread of its own
+	//
+	class CSubscriber: public CCustomThread
+	{
+	public:
+		CSubscriber(
+			CEventRing*       pRing,
+			CCallbackHandler* pHandler,
+			RING_LAG_POLICY   ePolicy
+			);
+		virtual ~CSubscriber();
+
+		CEventRing*       m_pRing;
+		CCallbackHandler* m_pHandler;
+		RING_LAG_POLICY   m_ePolicy;
+		//
+		// Signaled when there is something to read, or for stopping
+		//
+		HANDLE            m_evtAvailable;
+		//
+		// Events copied out
+		//
+		vector<QUEUED_ITEM> m_Batch;
+		//
+		// Written by the subscriber, read by the producer. Each on a
+		// cache line of its own, the producer reads them all the time.
+		//
+		alignas(64) std::atomic<ULONG64> m_ullCursor;   // Next to read
+		alignas(64) std::atomic<ULONG64> m_ullReading;  // First being copied
+		std::atomic<BOOL>                m_bSleeping;
+		std::atomic<ULONG64>             m_ullDelivered;
+		std::atomic<ULONG64>             m_ullMissed;
+	protected:
+		virtual void Run();
+	};
+	//
+	// The thread function of a subscriber
+	//
+	void ReadEvents(CSubscriber* pSubscriber);
+	//
+	// Hand the next events over, FALSE if there are none
+	//
+	BOOL DeliverBlocking(CSubscriber* pSubscriber);
+	BOOL DeliverCopy(CSubscriber* pSubscriber);
+	//
+	// Whether the producer may write the events up to ullEnd (exclusive)
+	//
+	BOOL HasRoom(ULONG64 ullEnd) const;
+	//
+	// Wake up the producer if it waits for room
+	//
+	void OnProgress();
+	//
+	// The slots, a power of 2 of them
+	//
+	vector<QUEUED_ITEM> m_Ring;
+	ULONG64             m_ullMask;
+	//
+	// Parameter passed on to the subscribers
+	//
+	std::atomic<PVOID>  m_pvParam;
+	//
+	// Written by the producer only
+	//
+	alignas(64) std::atomic<ULONG64> m_ullClaimed;   // Being written up to
+	alignas(64) std::atomic<ULONG64> m_ullPublished; // Readable up to
+	std::atomic<BOOL>                m_bProducerWaiting;
+	std::atomic<ULONG64>             m_ullProducerWaits;
+	//
+	// Signaled when a subscriber has made room and the producer waits
+	//
+	HANDLE m_evtProgress;
+
+	vector<CSubscriber*> m_Subscribers;
+	BOOL                 m_bStarted;
+	std::atomic<BOOL>    m_bStopping;
+};
+
+#endif // !defined(_EVENTRING_H_)
+//----------------------------End of the file -------------------------------
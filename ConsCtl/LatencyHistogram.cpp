@@ -0,0 +1,202 @@
+//---------------------------------------------------------------------------
+//
+// LatencyHistogram.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Log-linear latency histogram
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "LatencyHistogram.h"
+#include <stdio.h>
+
+//---------------------------------------------------------------------------
+//
+// Local helpers
+//
+//---------------------------------------------------------------------------
+
+//
+// Index of the most significant bit set (ullValue != 0)
+//
+static DWORD MostSignificantBit(ULONG64 ullValue)
+{
+	DWORD dwBit = 0;
+	if (ullValue >> 32) { ullValue >>= 32; dwBit += 32; }
+	if (ullValue >> 16) { ullValue >>= 16; dwBit += 16; }
+	if (ullValue >> 8)  { ullValue >>= 8;  dwBit += 8;  }
+	if (ullValue >> 4)  { ullValue >>= 4;  dwBit += 4;  }
+	if (ullValue >> 2)  { ullValue >>= 2;  dwBit += 2;  }
+	if (ullValue >> 1)  { dwBit += 1; }
+	return dwBit;
+}
+
+//---------------------------------------------------------------------------
+//
+// class CLatencyHistogram
+//
+//---------------------------------------------------------------------------
+CLatencyHistogram::CLatencyHistogram()
+{
+	Reset();
+}
+
+CLatencyHistogram::~CLatencyHistogram()
+{
+
+}
+
+//
+// Values below SUB_BUCKET_COUNT get a bucket each. Above that, every
+// power of two [2^n, 2^(n+1)) is split into SUB_BUCKET_COUNT equal
+// buckets.
+//
+DWORD CLatencyHistogram::GetBucketIndex(ULONG64 ullValue)
+{
+	if (ullValue < SUB_BUCKET_COUNT)
+		return (DWORD)ullValue;
+
+	DWORD dwShift = MostSignificantBit(ullValue) - SUB_BUCKET_BITS;
+	DWORD dwSub   = (DWORD)(ullValue >> dwShift) & (SUB_BUCKET_COUNT - 1);
+	return ((dwShift + 1) << SUB_BUCKET_BITS) + dwSub;
+}
+
+//
+// Middle of the range covered by a bucket
+//
+ULONG64 CLatencyHistogram::GetBucketValue(DWORD dwIndex)
+{
+	DWORD dwGroup = dwIndex >> SUB_BUCKET_BITS;
+	DWORD dwSub   = dwIndex & (SUB_BUCKET_COUNT - 1);
+
+	if (0 == dwGroup)
+		return dwSub;
+
+	DWORD   dwShift = dwGroup - 1;
+	ULONG64 ullLow  = (ULONG64)(SUB_BUCKET_COUNT + dwSub) << dwShift;
+	return ullLow + (((1ULL << dwShift) - 1) >> 1);
+}
+
+//
+// Count a single value (nanoseconds)
+//
+void CLatencyHistogram::Record(ULONG64 ullValue)
+{
+	m_Buckets[GetBucketIndex(ullValue)].fetch_add(1, std::memory_order_relaxed);
+	m_ullCount.fetch_add(1, std::memory_order_relaxed);
+
+	ULONG64 ullSeen = m_ullMin.load(std::memory_order_relaxed);
+	while ((ullValue < ullSeen) &&
+	       !m_ullMin.compare_exchange_weak(ullSeen, ullValue, std::memory_order_relaxed))
+	{
+	}
+	ullSeen = m_ullMax.load(std::memory_order_relaxed);
+	while ((ullValue > ullSeen) &&
+	       !m_ullMax.compare_exchange_weak(ullSeen, ullValue, std::memory_order_relaxed))
+	{
+	}
+}
+
+//
+// Count the time between two timestamps
+//
+void CLatencyHistogram::RecordInterval(LONGLONG llStart, LONGLONG llEnd)
+{
+	if ((0 != llStart) && (0 != llEnd))
+		Record(TimestampToNanoseconds(llEnd - llStart));
+}
+
+//
+// Number of recorded values
+//
+ULONG64 CLatencyHistogram::GetCount() const
+{
+	return m_ullCount.load(std::memory_order_relaxed);
+}
+
+//
+// Walk the buckets until the requested share of values is covered
+//
+ULONG64 CLatencyHistogram::GetPercentile(double dPercentile) const
+{
+	ULONG64 ullCount = GetCount();
+	if (0 == ullCount)
+		return 0;
+	if (dPercentile > 100.0)
+		dPercentile = 100.0;
+
+	ULONG64 ullTarget = (ULONG64)((dPercentile / 100.0) * (double)ullCount + 0.5);
+	if (0 == ullTarget)
+		ullTarget = 1;
+
+	ULONG64 ullSeen = 0;
+	for (DWORD i = 0; i < BUCKET_COUNT; i++)
+	{
+		ullSeen += m_Buckets[i].load(std::memory_order_relaxed);
+		if (ullSeen >= ullTarget)
+		{
+			//
+			// Don't report beyond the exact extremes
+			//
+			ULONG64 ullValue = GetBucketValue(i);
+			if (ullValue > GetMax())
+				ullValue = GetMax();
+			if (ullValue < GetMin())
+				ullValue = GetMin();
+			return ullValue;
+		}
+	}
+	return GetMax();
+}
+
+ULONG64 CLatencyHistogram::GetMin() const
+{
+	return (0 == GetCount()) ? 0 : m_ullMin.load(std::memory_order_relaxed);
+}
+
+ULONG64 CLatencyHistogram::GetMax() const
+{
+	return m_ullMax.load(std::memory_order_relaxed);
+}
+
+//
+// Forget all recorded values
+//
+void CLatencyHistogram::Reset()
+{
+	for (DWORD i = 0; i < BUCKET_COUNT; i++)
+		m_Buckets[i].store(0, std::memory_order_relaxed);
+	m_ullCount.store(0, std::memory_order_relaxed);
+	m_ullMin.store(~0ULL, std::memory_order_relaxed);
+	m_ullMax.store(0, std::memory_order_relaxed);
+}
+
+//
+// Print a one-line summary, values in microseconds
+//
+void CLatencyHistogram::Dump(LPCTSTR pszName) const
+{
+	_tprintf(
+		TEXT("%-20s count=%-10") TFMT_U64 TEXT(" min=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us\n"),
+		pszName,
+		GetCount(),
+		GetMin() / 1000.0,
+		GetPercentile(50.0) / 1000.0,
+		GetPercentile(90.0) / 1000.0,
+		GetPercentile(99.0) / 1000.0,
+		GetPercentile(99.9) / 1000.0,
+		GetMax() / 1000.0
+		);
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,132 @@
+//---------------------------------------------------------------------------
+//
+// LatencyHistogram.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Log-linear latency histogram
+//
+// DESCRIPTION:
+//              Values (nanoseconds) are counted in buckets that are linear
+//              within each power of two, as in HdrHistogram. With 32
+//              sub-buckets per power of two the relative error of any
+//              reported percentile stays below 3.2%, for the whole 64-bit
+//              range, in a fixed 15KB table. Recording is a couple of
+//              instructions and an interlocked increment, thus it may be
+//              called from any thread without locking.
+//
+//---------------------------------------------------------------------------
+#if !defined(_LATENCYHISTOGRAM_H_)
+#define _LATENCYHISTOGRAM_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include <atomic>
+
+//---------------------------------------------------------------------------
+//
+// Timestamps
+//
+// QueryPerformanceCounter() ticks, the same clock the driver reads
+// through KeQueryPerformanceCounter(). On Linux CLOCK_MONOTONIC
+// nanoseconds, the clock of the kernel's process events.
+//
+//---------------------------------------------------------------------------
+inline LONGLONG QueryTimestamp()
+{
+	LARGE_INTEGER liNow;
+	::QueryPerformanceCounter(&liNow);
+	return liNow.QuadPart;
+}
+
+//
+// Convert the difference of two timestamps to nanoseconds
+//
+inline ULONG64 TimestampToNanoseconds(LONGLONG llTicks)
+{
+	static LONGLONG s_llFrequency = 0;
+	if (0 == s_llFrequency)
+	{
+		LARGE_INTEGER liFrequency;
+		::QueryPerformanceFrequency(&liFrequency);
+		s_llFrequency = liFrequency.QuadPart;
+	}
+	if (llTicks <= 0)
+		return 0;
+	return (ULONG64)(llTicks / s_llFrequency) * 1000000000ULL +
+		(ULONG64)(llTicks % s_llFrequency) * 1000000000ULL / s_llFrequency;
+}
+
+//---------------------------------------------------------------------------
+//
+// class CLatencyHistogram
+//
+//---------------------------------------------------------------------------
+class CLatencyHistogram
+{
+public:
+	CLatencyHistogram();
+	virtual ~CLatencyHistogram();
+	//
+	// Count a single value (nanoseconds)
+	//
+	void Record(ULONG64 ullValue);
+	//
+	// Count the time between two timestamps
+	//
+	void RecordInterval(LONGLONG llStart, LONGLONG llEnd);
+	//
+	// Number of recorded values
+	//
+	ULONG64 GetCount() const;
+	//
+	// Smallest value v such that dPercentile percent of all values are
+	// less or equal to v (within the bucket precision)
+	//
+	ULONG64 GetPercentile(double dPercentile) const;
+	//
+	// Exact extremes
+	//
+	ULONG64 GetMin() const;
+	ULONG64 GetMax() const;
+	//
+	// Forget all recorded values
+	//
+	void Reset();
+	//
+	// Print a one-line summary, values in microseconds
+	//
+	void Dump(LPCTSTR pszName) const;
+private:
+	enum
+	{
+		SUB_BUCKET_BITS  = 5,
+		SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,
+		BUCKET_COUNT     = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT
+	};
+	//
+	// Bucket a value falls into, and the value a bucket stands for
+	//
+	static DWORD   GetBucketIndex(ULONG64 ullValue);
+	static ULONG64 GetBucketValue(DWORD dwIndex);
+	//
+	// Counters
+	//
+	std::atomic<ULONG64> m_Buckets[BUCKET_COUNT];
+	std::atomic<ULONG64> m_ullCount;
+	std::atomic<ULONG64> m_ullMin;
+	std::atomic<ULONG64> m_ullMax;
+};
+
+#endif // !defined(_LATENCYHISTOGRAM_H_)
+//----------------------------End of the file -------------------------------
@@ -14,6 +14,65 @@
 //                                                                         
 //---------------------------------------------------------------------------
 #include "LockMgr.h"
+#include "LatencyHistogram.h"
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Lock registry
+//
+// The named locks alive, and the counters of those destroyed, per name.
+// Never freed, locks may be destroyed as late as the program exits.
+//
+//---------------------------------------------------------------------------
+typedef struct _LockRegistry
+{
+	CRITICAL_SECTION                      cs;
+	vector<CCSWrapper*>                   Live;
+	map<basic_string<TCHAR>, LOCK_STATS>  Retired;
+} LOCK_REGISTRY, *PLOCK_REGISTRY;
+
+static PLOCK_REGISTRY CreateLockRegistry()
+{
+	PLOCK_REGISTRY pRegistry = new LOCK_REGISTRY;
+
+	::InitializeCriticalSection( &pRegistry->cs );
+	return pRegistry;
+}
+
+//
+// Locks are created by static constructors too, before main(), hence
+// the function local static
+//
+static PLOCK_REGISTRY GetLockRegistry()
+{
+	static PLOCK_REGISTRY s_pRegistry = CreateLockRegistry();
+
+	return s_pRegistry;
+}
+
+//
+// Add the counters of a lock to a sum
+//
+static void AddLockStats(
+	LOCK_STATS&       sum,
+	const LOCK_STATS& stats
+	)
+{
+	sum.ullAcquisitions += stats.ullAcquisitions;
+	sum.ullContended    += stats.ullContended;
+	sum.ullWaitTotal    += stats.ullWaitTotal;
+	sum.ullHoldSamples  += stats.ullHoldSamples;
+	sum.ullHoldTotal    += stats.ullHoldTotal;
+	if (stats.ullWaitMax > sum.ullWaitMax)
+		sum.ullWaitMax = stats.ullWaitMax;
+	if (stats.ullHoldMax > sum.ullHoldMax)
+		sum.ullHoldMax = stats.ullHoldMax;
+}
 
 //---------------------------------------------------------------------------
 //
@@ -23,15 +82,29 @@
 //
 //---------------------------------------------------------------------------
 
+std::atomic<BOOL> CCSWrapper::sm_bProfiling(FALSE);
+
 //---------------------------------------------------------------------------
 //
 // Constructor
 //
 //---------------------------------------------------------------------------
-CCSWrapper::CCSWrapper()
+CCSWrapper::CCSWrapper(LPCTSTR pszName):
+	m_nRecursion(0),
+	m_pszName(pszName),
+	m_llAcquired(0),
+	m_nPins(0)
 {
-	m_nSpinCount = 0;
+	::ZeroMemory(&m_Stats, sizeof(m_Stats));
 	::InitializeCriticalSection( &m_cs );
+	if (NULL != m_pszName)
+	{
+		PLOCK_REGISTRY pRegistry = GetLockRegistry();
+
+		::EnterCriticalSection( &pRegistry->cs );
+		pRegistry->Live.push_back(this);
+		::LeaveCriticalSection( &pRegistry->cs );
+	}
 }
 
 //---------------------------------------------------------------------------
@@ -41,6 +114,30 @@ CCSWrapper::CCSWrapper()
 //---------------------------------------------------------------------------
 CCSWrapper::~CCSWrapper()
 {
+	if (NULL != m_pszName)
+	{
+		PLOCK_REGISTRY pRegistry = GetLockRegistry();
+
+		::EnterCriticalSection( &pRegistry->cs );
+		for (size_t i = 0; i < pRegistry->Live.size(); i++)
+			if (pRegistry->Live[i] == this)
+			{
+				pRegistry->Live.erase(pRegistry->Live.begin() + i);
+				break;
+			}
+		::LeaveCriticalSection( &pRegistry->cs );
+		//
+		// DumpProfile() may have taken it off the registry just before
+		//
+		while (0 != m_nPins.load())
+			::Sleep(1);
+		if (0 != m_Stats.ullAcquisitions)
+		{
+			::EnterCriticalSection( &pRegistry->cs );
+			AddLockStats(pRegistry->Retired[m_pszName], m_Stats);
+			::LeaveCriticalSection( &pRegistry->cs );
+		}
+	}
 	::DeleteCriticalSection( &m_cs );
 }
 
@@ -52,8 +149,42 @@ CCSWrapper::~CCSWrapper()
 //---------------------------------------------------------------------------
 void CCSWrapper::Enter()
 {
-	::EnterCriticalSection( &m_cs );
-	m_nSpinCount++;
+	if (!sm_bProfiling.load(std::memory_order_relaxed))
+	{
+		::EnterCriticalSection( &m_cs );
+		if (0 == m_nRecursion++)
+			m_llAcquired = 0;
+		return;
+	}
+	//
+	// Only an acquisition that fails to take the lock right away looks
+	// at the clock before it
+	//
+	LONGLONG llWaitStart = 0;
+	LONGLONG llNow       = 0;
+
+	if (!::TryEnterCriticalSection( &m_cs ))
+	{
+		llWaitStart = QueryTimestamp();
+		::EnterCriticalSection( &m_cs );
+	}
+	m_Stats.ullAcquisitions++;
+	if (0 != m_nRecursion++)
+		return;
+	if (0 != llWaitStart)
+	{
+		llNow = QueryTimestamp();
+
+		ULONG64 ullWait = (ULONG64)(llNow - llWaitStart);
+
+		m_Stats.ullContended++;
+		m_Stats.ullWaitTotal += ullWait;
+		if (ullWait > m_Stats.ullWaitMax)
+			m_Stats.ullWaitMax = ullWait;
+	}
+	m_llAcquired = 0;
+	if (0 == (m_Stats.ullAcquisitions & (LOCK_HOLD_SAMPLE - 1)))
+		m_llAcquired = (0 != llNow) ? llNow : QueryTimestamp();
 }
 
 //---------------------------------------------------------------------------
@@ -63,8 +194,109 @@ void CCSWrapper::Enter()
 //---------------------------------------------------------------------------
 void CCSWrapper::Leave()
 {
-	m_nSpinCount--;
+	if ((0 == --m_nRecursion) && (0 != m_llAcquired))
+	{
+		ULONG64 ullHold = (ULONG64)(QueryTimestamp() - m_llAcquired);
+
+		m_Stats.ullHoldSamples++;
+		m_Stats.ullHoldTotal += ullHold;
+		if (ullHold > m_Stats.ullHoldMax)
+			m_Stats.ullHoldMax = ullHold;
+	}
+	::LeaveCriticalSection( &m_cs );
+}
+
+//
+// The name given, NULL for none
+//
+LPCTSTR CCSWrapper::GetName() const
+{
+	return m_pszName;
+}
+
+//
+// Take a snapshot of the counters, without counting it
+//
+void CCSWrapper::GetStats(LOCK_STATS& stats)
+{
+	::EnterCriticalSection( &m_cs );
+	stats = m_Stats;
 	::LeaveCriticalSection( &m_cs );
 }
 
+//
+// Count how all locks are used, or stop counting
+//
+void CCSWrapper::SetProfiling(BOOL bEnable)
+{
+	sm_bProfiling.store(bEnable, std::memory_order_relaxed);
+}
+
+BOOL CCSWrapper::GetProfiling()
+{
+	return sm_bProfiling.load(std::memory_order_relaxed);
+}
+
+//
+// Print the counters of the named locks, added up per name.
+//
+// Named locks are created and destroyed under the registry lock, which
+// may happen while another named lock is held. Hence the counters of a
+// lock are never read under the registry lock: the lock is pinned under
+// it, then read and unpinned without it. Its destructor waits for the
+// pin. A lock destroyed after the registry has been copied is left out.
+//
+void CCSWrapper::DumpProfile()
+{
+	PLOCK_REGISTRY                       pRegistry = GetLockRegistry();
+	map<basic_string<TCHAR>, LOCK_STATS> sums;
+	vector<CCSWrapper*>                  live;
+
+	::EnterCriticalSection( &pRegistry->cs );
+	sums = pRegistry->Retired;
+	live = pRegistry->Live;
+	::LeaveCriticalSection( &pRegistry->cs );
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		CCSWrapper* pLock = NULL;
+		LOCK_STATS  stats;
+
+		::EnterCriticalSection( &pRegistry->cs );
+		for (size_t j = 0; j < pRegistry->Live.size(); j++)
+			if (pRegistry->Live[j] == live[i])
+			{
+				pLock = live[i];
+				pLock->m_nPins++;
+				break;
+			}
+		::LeaveCriticalSection( &pRegistry->cs );
+		if (NULL == pLock)
+			continue;
+		pLock->GetStats(stats);
+		AddLockStats(sums[pLock->GetName()], stats);
+		pLock->m_nPins--;
+	} // for
+
+	_tprintf(TEXT("Locks%s:\n"), GetProfiling() ? TEXT("") : TEXT(" (not profiling)"));
+	_tprintf(TEXT("  %-20s %12s %10s %12s %10s %12s %10s\n"),
+		TEXT("name"), TEXT("acquired"), TEXT("contended"),
+		TEXT("wait us"), TEXT("max us"), TEXT("avg held ns"), TEXT("max us"));
+	for (map<basic_string<TCHAR>, LOCK_STATS>::const_iterator it = sums.begin(); it != sums.end(); ++it)
+	{
+		const LOCK_STATS& stats = it->second;
+
+		_tprintf(
+			TEXT("  %-20s %12") TFMT_U64 TEXT(" %10") TFMT_U64 TEXT(" %12") TFMT_U64 TEXT(" %10") TFMT_U64 
+			TEXT(" %12") TFMT_U64 TEXT(" %10") TFMT_U64 TEXT("\n"),
+			it->first.c_str(),
+			stats.ullAcquisitions,
+			stats.ullContended,
+			TimestampToNanoseconds(stats.ullWaitTotal) / 1000,
+			TimestampToNanoseconds(stats.ullWaitMax) / 1000,
+			(0 != stats.ullHoldSamples) ? TimestampToNanoseconds(stats.ullHoldTotal) / stats.ullHoldSamples : 0,
+			TimestampToNanoseconds(stats.ullHoldMax) / 1000
+			);
+	} // for
+}
+
 //--------------------- End of the file -------------------------------------
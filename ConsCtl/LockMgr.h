@@ -9,7 +9,14 @@
 //              2. Interface declaration of CCSWrapper CRITICAL_SECTION wrapper 
 //
 // DESCRIPTION:
-//              
+//              CCSWrapper can count how a lock is used (acquisitions, 
+//              contended ones, time waited and time held). The counters
+//              are off by default and turned on for all locks at once.
+//              They are kept under the lock itself, thus cost no atomic
+//              operation, and the clock is read only by acquisitions
+//              that wait and by one in LOCK_HOLD_SAMPLE, whose hold time
+//              is measured. Locks are tagged by the name they are given,
+//              and DumpProfile() prints those of the named ones.
 //
 // AUTHOR:		Ivo Ivanov
 //                                                                         
@@ -27,6 +34,36 @@
 //
 //---------------------------------------------------------------------------
 #include "Common.h"
+#include <atomic>
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// One acquisition in this many (a power of 2) has its hold time measured
+//
+#define LOCK_HOLD_SAMPLE                16
+
+//---------------------------------------------------------------------------
+//
+// struct _LockStats
+//
+// Counters of a lock. Times are in QueryTimestamp() ticks.
+//
+//---------------------------------------------------------------------------
+typedef struct _LockStats
+{
+	ULONG64 ullAcquisitions;  // Enter() calls, recursive ones included
+	ULONG64 ullContended;     // Those that waited for another thread
+	ULONG64 ullWaitTotal;     // Time spent waiting
+	ULONG64 ullWaitMax;
+	ULONG64 ullHoldSamples;   // Outermost acquisitions whose hold was timed
+	ULONG64 ullHoldTotal;     // Time from their Enter() to their Leave()
+	ULONG64 ullHoldMax;
+} LOCK_STATS, *PLOCK_STATS;
 
 //---------------------------------------------------------------------------
 //
@@ -38,7 +75,11 @@
 class CCSWrapper
 {
 public:
-	CCSWrapper();
+	//
+	// A lock with a name is reported by DumpProfile(). The name isn't
+	// copied.
+	//
+	CCSWrapper(LPCTSTR pszName = NULL);
 	virtual ~CCSWrapper();
 	// 
 	// This function waits for ownership of the specified critical section object 
@@ -48,9 +89,45 @@ public:
 	// Releases ownership of the specified critical section object. 
 	// 
 	void Leave();
+	//
+	// The name given, NULL for none
+	//
+	LPCTSTR GetName() const;
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(LOCK_STATS& stats);
+	//
+	// Count how all locks are used, or stop counting. While off, a lock
+	// costs a single relaxed load per Enter().
+	//
+	static void SetProfiling(BOOL bEnable);
+	static BOOL GetProfiling();
+	//
+	// Print the counters of the named locks, added up per name. Those of
+	// locks already destroyed are included.
+	//
+	static void DumpProfile();
 private:
 	CRITICAL_SECTION m_cs;
-	long m_nSpinCount;
+	//
+	// Enter() calls of the owner not left yet
+	//
+	long m_nRecursion;
+	LPCTSTR m_pszName;
+	//
+	// Guarded by m_cs. m_llAcquired is when the owner has taken the 
+	// lock, 0 if the hold isn't timed.
+	//
+	LOCK_STATS m_Stats;
+	LONGLONG   m_llAcquired;
+	//
+	// Set while DumpProfile() reads the counters of a named lock, which
+	// isn't destroyed meanwhile
+	//
+	std::atomic<long> m_nPins;
+
+	static std::atomic<BOOL> sm_bProfiling;
 };
 
 
@@ -0,0 +1,248 @@
+//---------------------------------------------------------------------------
+//
+// MpscQueue.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Lock-free multi-producer/single-consumer queue
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "MpscQueue.h"
+
+//---------------------------------------------------------------------------
+//
+// class CMpscQueue
+//
+//---------------------------------------------------------------------------
+CMpscQueue::CMpscQueue():
+	m_pHead(NULL),
+	m_bSleeping(TRUE),
+	m_pSpare(NULL),
+	m_pRetiredFirst(NULL),
+	m_pRetiredLast(NULL),
+	m_dwRetired(0),
+	m_ullPushed(0),
+	m_ullPopped(0)
+{
+	m_pHead = new MPSC_NODE;
+	m_pHead->pNext.store(NULL, std::memory_order_relaxed);
+	m_pTail.store(m_pHead, std::memory_order_relaxed);
+}
+
+CMpscQueue::~CMpscQueue()
+{
+	DeleteNodes(m_pHead);
+	DeleteNodes(m_pSpare.load(std::memory_order_relaxed));
+	DeleteNodes(m_pRetiredFirst);
+}
+
+//
+// Free a chain of nodes
+//
+void CMpscQueue::DeleteNodes(MPSC_NODE* pNode)
+{
+	while (NULL != pNode)
+	{
+		MPSC_NODE* pNext = pNode->pNext.load(std::memory_order_relaxed);
+		delete pNode;
+		pNode = pNext;
+	} // while
+}
+
+//
+// A chain of dwCount nodes
+//
+CMpscQueue::MPSC_NODE* CMpscQueue::AllocateNodes(DWORD dwCount)
+{
+	MPSC_NODE* pFirst  = m_pSpare.exchange(NULL, std::memory_order_acquire);
+	MPSC_NODE* pLast   = NULL;
+	DWORD      dwTaken = 0;
+
+	if (NULL != pFirst)
+	{
+		DWORD dwLength = pFirst->dwChainLength;
+
+		for (pLast = pFirst; dwTaken + 1 < dwCount && dwTaken + 1 < dwLength; dwTaken++)
+			pLast = pLast->pNext.load(std::memory_order_relaxed);
+		dwTaken++;
+		//
+		// Put back what isn't needed. Should the consumer have filled
+		// the slot meanwhile, its chain is dropped.
+		//
+		MPSC_NODE* pRest = pLast->pNext.load(std::memory_order_relaxed);
+		if (NULL != pRest)
+		{
+			pRest->dwChainLength = dwLength - dwTaken;
+			DeleteNodes(m_pSpare.exchange(pRest, std::memory_order_acq_rel));
+		}
+	} // if
+	//
+	// Make up for the rest
+	//
+	for (; dwTaken < dwCount; dwTaken++)
+	{
+		MPSC_NODE* pNode = new MPSC_NODE;
+
+		if (NULL == pLast)
+			pFirst = pNode;
+		else
+			pLast->pNext.store(pNode, std::memory_order_relaxed);
+		pLast = pNode;
+	} // for
+	pLast->pNext.store(NULL, std::memory_order_relaxed);
+
+	return pFirst;
+}
+
+//
+// A node has been taken off
+//
+void CMpscQueue::RetireNode(MPSC_NODE* pNode)
+{
+	pNode->pNext.store(m_pRetiredFirst, std::memory_order_relaxed);
+	if (NULL == m_pRetiredFirst)
+		m_pRetiredLast = pNode;
+	m_pRetiredFirst = pNode;
+	if (++m_dwRetired < MPSC_RETIRE_BATCH)
+		return;
+	//
+	// Join the spare nodes not used yet, unless there are too many of
+	// them after a burst
+	//
+	MPSC_NODE* pSpare = m_pSpare.exchange(NULL, std::memory_order_acquire);
+	if (NULL != pSpare)
+	{
+		if (m_dwRetired + pSpare->dwChainLength <= MPSC_MAX_SPARE_NODES)
+		{
+			m_pRetiredLast->pNext.store(pSpare, std::memory_order_relaxed);
+			m_dwRetired += pSpare->dwChainLength;
+		}
+		else
+			DeleteNodes(pSpare);
+	}
+	m_pRetiredFirst->dwChainLength = m_dwRetired;
+	//
+	// A producer may have put its rest back meanwhile, it is dropped
+	//
+	DeleteNodes(m_pSpare.exchange(m_pRetiredFirst, std::memory_order_acq_rel));
+	m_pRetiredFirst = NULL;
+	m_pRetiredLast  = NULL;
+	m_dwRetired     = 0;
+}
+
+//
+// Append a number of elements as a single step
+//
+BOOL CMpscQueue::PushBatch(
+	const QUEUED_ITEM* pElements,
+	DWORD              dwCount,
+	LONGLONG           llEnqueueTime
+	)
+{
+	MPSC_NODE* pFirst;
+	MPSC_NODE* pLast = NULL;
+
+	if (0 == dwCount)
+		return FALSE;
+	//
+	// Fill a private chain first
+	//
+	pFirst = AllocateNodes(dwCount);
+	for (MPSC_NODE* pNode = pFirst; NULL != pNode; pNode = pNode->pNext.load(std::memory_order_relaxed))
+	{
+		pNode->item = *pElements++;
+		pNode->item.llEnqueueTime = llEnqueueTime;
+		pLast = pNode;
+	} // for
+	//
+	// Counted before the consumer can see them, thus the depth never
+	// goes negative
+	//
+	m_ullPushed.fetch_add(dwCount, std::memory_order_relaxed);
+	//
+	// Take the tail's place, then link the former tail to the batch.
+	// Until then the consumer finds the queue empty at the former tail.
+	//
+	MPSC_NODE* pPrev = m_pTail.exchange(pLast, std::memory_order_acq_rel);
+	pPrev->pNext.store(pFirst, std::memory_order_release);
+	//
+	// Pairs with the fence in PrepareToSleep(): either the consumer sees
+	// the batch, or this sees it sleeping
+	//
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!m_bSleeping.load(std::memory_order_relaxed))
+		return FALSE;
+	//
+	// Only one producer wakes it up
+	//
+	return m_bSleeping.exchange(FALSE, std::memory_order_relaxed);
+}
+
+//
+// Take the oldest element off
+//
+BOOL CMpscQueue::Pop(QUEUED_ITEM& element)
+{
+	MPSC_NODE* pNext = m_pHead->pNext.load(std::memory_order_acquire);
+
+	if (NULL == pNext)
+		return FALSE;
+	//
+	// The node taken off stays as the new head, its item is done with
+	//
+	element = pNext->item;
+	RetireNode(m_pHead);
+	m_pHead = pNext;
+	m_ullPopped.fetch_add(1, std::memory_order_relaxed);
+
+	return TRUE;
+}
+
+//
+// The consumer is about to wait
+//
+BOOL CMpscQueue::PrepareToSleep()
+{
+	m_bSleeping.store(TRUE, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (NULL == m_pHead->pNext.load(std::memory_order_acquire))
+		return TRUE;
+	//
+	// Something has come in. A producer may have seen the flag already
+	// and is going to signal; the consumer then just wakes up once more
+	// than needed.
+	//
+	m_bSleeping.store(FALSE, std::memory_order_relaxed);
+
+	return FALSE;
+}
+
+//
+// Elements appended so far
+//
+ULONG64 CMpscQueue::GetPushedCount() const
+{
+	return m_ullPushed.load(std::memory_order_relaxed);
+}
+
+//
+// Elements waiting
+//
+DWORD CMpscQueue::GetDepth() const
+{
+	ULONG64 ullPopped = m_ullPopped.load(std::memory_order_relaxed);
+
+	return (DWORD)(m_ullPushed.load(std::memory_order_relaxed) - ullPopped);
+}
+
+//----------------------------End of the file -------------------------------
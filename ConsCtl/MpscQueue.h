@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+//
+// MpscQueue.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Lock-free multi-producer/single-consumer queue
+//
+// DESCRIPTION:
+//              A linked list of items (D. Vyukov's MPSC node queue).
+//              Producers link a whole batch with one atomic exchange of
+//              the tail; the single consumer unlinks from the head
+//              without any atomic read-modify-write. Neither side ever
+//              waits for the other.
+//
+//              Waking the consumer is left to the caller, but the queue
+//              tells when it is needed: the consumer announces that it is
+//              going to sleep (PrepareToSleep()), and only the first
+//              producer to append after that is told to wake it up. As
+//              long as the consumer keeps up no event is signaled at all.
+//
+//              Nodes taken off are kept for reuse rather than freed. The
+//              consumer hands them back as a chain in a single slot,
+//              which a producer empties, takes what it needs from and
+//              refills. Both only ever exchange the slot as a whole, thus
+//              there is no ABA problem.
+//
+//---------------------------------------------------------------------------
+#if !defined(_MPSCQUEUE_H_)
+#define _MPSCQUEUE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include <atomic>
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Nodes the consumer collects before it hands them back, and the number
+// kept for reuse at most (the rest is freed)
+//
+#define MPSC_RETIRE_BATCH               32
+#define MPSC_MAX_SPARE_NODES            512
+
+//---------------------------------------------------------------------------
+//
+// class CMpscQueue
+//
+//---------------------------------------------------------------------------
+class CMpscQueue
+{
+public:
+	CMpscQueue();
+	virtual ~CMpscQueue();
+	//
+	// Append a number of elements, stamped with llEnqueueTime, as a
+	// single step. Any thread may call it. Returns TRUE if the consumer
+	// is asleep and the caller has to wake it up.
+	//
+	BOOL PushBatch(
+		const QUEUED_ITEM* pElements,
+		DWORD              dwCount,
+		LONGLONG           llEnqueueTime
+		);
+	//
+	// Take the oldest element off, FALSE if there is none. Only the
+	// consumer thread may call it.
+	//
+	BOOL Pop(QUEUED_ITEM& element);
+	//
+	// The consumer is about to wait. Returns FALSE if elements have
+	// come in meanwhile, in which case it mustn't.
+	//
+	BOOL PrepareToSleep();
+	//
+	// Elements appended so far, and those waiting
+	//
+	ULONG64 GetPushedCount() const;
+	DWORD GetDepth() const;
+private:
+	//
+	// An element and the link to the next one
+	//
+	struct MPSC_NODE
+	{
+		std::atomic<MPSC_NODE*> pNext;
+		DWORD                   dwChainLength; // Of a spare chain, at its head
+		QUEUED_ITEM             item;
+	};
+	//
+	// A chain of dwCount nodes, reused ones first
+	//
+	MPSC_NODE* AllocateNodes(DWORD dwCount);
+	//
+	// Free a chain of nodes
+	//
+	static void DeleteNodes(MPSC_NODE* pNode);
+	//
+	// A node has been taken off (consumer only)
+	//
+	void RetireNode(MPSC_NODE* pNode);
+	//
+	// The node last taken off (initially an empty one), owned by the
+	// consumer. Its successor is the oldest element.
+	//
+	MPSC_NODE* m_pHead;
+	//
+	// The node last appended
+	//
+	std::atomic<MPSC_NODE*> m_pTail;
+	//
+	// Whether the consumer waits (or is about to) for a wake-up
+	//
+	std::atomic<BOOL> m_bSleeping;
+	//
+	// A chain of nodes for reuse, NULL if there is none
+	//
+	std::atomic<MPSC_NODE*> m_pSpare;
+	//
+	// Nodes taken off but not handed back yet (consumer only)
+	//
+	MPSC_NODE* m_pRetiredFirst;
+	MPSC_NODE* m_pRetiredLast;
+	DWORD      m_dwRetired;
+	//
+	// Counters of appended and removed elements
+	//
+	std::atomic<ULONG64> m_ullPushed;
+	std::atomic<ULONG64> m_ullPopped;
+};
+
+#endif // !defined(_MPSCQUEUE_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,448 @@
+//---------------------------------------------------------------------------
+//
+// NetlinkMonitor.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Thread management
+//
+// DESCRIPTION:
+//              Receives fork, exec, exit and user ID change events from
+//              the kernel's process events connector and appends them to
+//              the queue.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "NetlinkMonitor.h"
+#include "ProcFs.h"
+#include "StringTable.h"
+#include "CommandLineTable.h"
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+
+//
+// proc_event::what values, as fixed by the connector's ABI. Older
+// headers declare them inside struct proc_event, newer ones outside,
+// thus C++ can't name them the same way with both.
+//
+#define NETLINK_EVENT_NONE              0x00000000
+#define NETLINK_EVENT_FORK              0x00000001
+#define NETLINK_EVENT_EXEC              0x00000002
+#define NETLINK_EVENT_UID               0x00000004
+#define NETLINK_EVENT_EXIT              0x80000000
+
+//---------------------------------------------------------------------------
+//
+// class CNetlinkMonitor
+//
+//---------------------------------------------------------------------------
+CNetlinkMonitor::CNetlinkMonitor(
+	const TCHAR*         pszThreadGuid,     // Thread unique ID
+	CQueueContainer*     pRequestManager,   // The underlying store
+	BYTE                 bySubscriptions,   // OBSRV_SUBSCRIBE_THREAD
+	BOOL                 bReadDetails       // Image and command line
+	):
+	CCustomThread(pszThreadGuid),
+	m_pRequestManager(pRequestManager),
+	m_bySubscriptions(bySubscriptions),
+	m_bReadDetails(bReadDetails),
+	m_nSocket(-1),
+	m_nWakeup(-1),
+	m_pbMessages(NULL),
+	m_ullSequence(0),
+	m_Items(NETLINK_BATCH_MESSAGES),
+	m_dwItems(0)
+{
+	assert(NULL != pRequestManager);
+	m_pbMessages = new BYTE[NETLINK_BATCH_MESSAGES * NETLINK_MESSAGE_SIZE];
+}
+
+CNetlinkMonitor::~CNetlinkMonitor()
+{
+	//
+	// Stop the thread while OnAfterDeactivate() is still ours
+	//
+	SetActive(FALSE);
+	CloseSocket();
+	delete [] m_pbMessages;
+}
+
+//
+// Open the connector socket and start listening
+//
+BOOL CNetlinkMonitor::OnBeforeActivate()
+{
+	struct sockaddr_nl addr;
+	int                cbBuffer = NETLINK_RECEIVE_BUFFER;
+
+	m_nSocket = ::socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (m_nSocket < 0)
+		return FALSE;
+	m_nWakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_nWakeup < 0)
+	{
+		CloseSocket();
+		return FALSE;
+	}
+	//
+	// SO_RCVBUFFORCE goes past net.core.rmem_max, but needs the same
+	// privilege listening does. Fall back to what the limit allows.
+	//
+	if (0 != ::setsockopt(m_nSocket, SOL_SOCKET, SO_RCVBUFFORCE, &cbBuffer, sizeof(cbBuffer)))
+		::setsockopt(m_nSocket, SOL_SOCKET, SO_RCVBUF, &cbBuffer, sizeof(cbBuffer));
+
+	::ZeroMemory(&addr, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid    = 0;         // Assigned by the kernel
+	if ((0 != ::bind(m_nSocket, (struct sockaddr*)&addr, sizeof(addr))) ||
+	    !Listen(TRUE))
+	{
+		CloseSocket();
+		return FALSE;
+	}
+	m_CpuNextSequence.clear();
+	m_ullSequence = 0;
+
+	return TRUE;
+}
+
+//
+// Wake the thread up for stopping
+//
+void CNetlinkMonitor::OnBeforeDeactivate()
+{
+	ULONG64 ullValue = 1;
+
+	if (m_nWakeup >= 0)
+		::write(m_nWakeup, &ullValue, sizeof(ullValue));
+}
+
+//
+// Stop listening and close the socket
+//
+void CNetlinkMonitor::OnAfterDeactivate()
+{
+	if (m_nSocket >= 0)
+		Listen(FALSE);
+	CloseSocket();
+}
+
+//
+// Close the socket, if it is open
+//
+void CNetlinkMonitor::CloseSocket()
+{
+	if (m_nSocket >= 0)
+		::close(m_nSocket);
+	m_nSocket = -1;
+	if (m_nWakeup >= 0)
+		::close(m_nWakeup);
+	m_nWakeup = -1;
+}
+
+//
+// Tell the connector to start or stop multicasting process events
+//
+BOOL CNetlinkMonitor::Listen(BOOL bListen)
+{
+	BYTE abMessage[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+	struct nlmsghdr*       pHeader = (struct nlmsghdr*)abMessage;
+	struct cn_msg*         pMsg    = (struct cn_msg*)NLMSG_DATA(pHeader);
+	enum proc_cn_mcast_op* pOp     = (enum proc_cn_mcast_op*)pMsg->data;
+
+	::ZeroMemory(abMessage, sizeof(abMessage));
+	pHeader->nlmsg_len  = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+	pHeader->nlmsg_type = NLMSG_DONE;
+	pMsg->id.idx        = CN_IDX_PROC;
+	pMsg->id.val        = CN_VAL_PROC;
+	pMsg->len           = sizeof(enum proc_cn_mcast_op);
+	*pOp                = bListen ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+
+	return (::send(m_nSocket, abMessage, pHeader->nlmsg_len, 0) == (ssize_t)pHeader->nlmsg_len);
+}
+
+//
+// A user supplied implementation of the thread function.
+// Override Run() and insert the code that should be executed when
+// the thread runs.
+//
+void CNetlinkMonitor::Run()
+{
+	struct pollfd pfds[2];
+
+	pfds[0].fd     = m_nSocket;
+	pfds[0].events = POLLIN;
+	pfds[1].fd     = m_nWakeup;
+	pfds[1].events = POLLIN;
+	while (TRUE)
+	{
+		pfds[0].revents = 0;
+		pfds[1].revents = 0;
+		int nReady = ::poll(pfds, 2, -1);
+		if ((nReady < 0) && (EINTR != errno))
+			break;
+		//
+		// Asked to stop
+		//
+		if (0 != pfds[1].revents)
+			break;
+		if (0 != pfds[0].revents)
+			ReceiveEvents();
+	} // while
+}
+
+//
+// Receive everything that has arrived, a batch of datagrams at a time
+//
+void CNetlinkMonitor::ReceiveEvents()
+{
+	struct mmsghdr messages[NETLINK_BATCH_MESSAGES];
+	struct iovec   vectors[NETLINK_BATCH_MESSAGES];
+	int            nReceived;
+
+	for (DWORD i = 0; i < NETLINK_BATCH_MESSAGES; i++)
+	{
+		vectors[i].iov_base = m_pbMessages + i * NETLINK_MESSAGE_SIZE;
+		vectors[i].iov_len  = NETLINK_MESSAGE_SIZE;
+	}
+	while (TRUE)
+	{
+		::ZeroMemory(messages, sizeof(messages));
+		for (DWORD i = 0; i < NETLINK_BATCH_MESSAGES; i++)
+		{
+			messages[i].msg_hdr.msg_iov    = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		nReceived = ::recvmmsg(m_nSocket, messages, NETLINK_BATCH_MESSAGES, MSG_DONTWAIT, NULL);
+		if (nReceived < 0)
+		{
+			//
+			// The receive buffer has overflowed. The events lost show up
+			// as gaps in the connector's numbers, just carry on.
+			//
+			if (ENOBUFS == errno)
+				continue;
+			break;
+		}
+		m_dwItems = 0;
+		for (int i = 0; i < nReceived; i++)
+			DecodeDatagram(
+				(const BYTE*)vectors[i].iov_base,
+				messages[i].msg_len
+				);
+		if (0 != m_dwItems)
+			m_pRequestManager->AppendBatch(&m_Items[0], m_dwItems);
+		//
+		// A short batch has emptied the socket
+		//
+		if (NETLINK_BATCH_MESSAGES != nReceived)
+			break;
+	} // while
+}
+
+//
+// Decode the netlink messages of a datagram
+//
+void CNetlinkMonitor::DecodeDatagram(
+	const BYTE* pbData,
+	DWORD       cbData
+	)
+{
+	const struct nlmsghdr* pHeader = (const struct nlmsghdr*)pbData;
+	int                    cbLeft  = (int)cbData;
+
+	for (; NLMSG_OK(pHeader, cbLeft); pHeader = NLMSG_NEXT(pHeader, cbLeft))
+	{
+		const struct cn_msg* pMsg = (const struct cn_msg*)NLMSG_DATA(pHeader);
+		struct proc_event    event;
+		DWORD                cbEvent;
+
+		if ((NLMSG_ERROR == pHeader->nlmsg_type) || (NLMSG_NOOP == pHeader->nlmsg_type))
+			continue;
+		if (pHeader->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg)))
+			continue;
+		if ((CN_IDX_PROC != pMsg->id.idx) || (CN_VAL_PROC != pMsg->id.val))
+			continue;
+		//
+		// Older kernels send shorter events, missing fields stay zero
+		//
+		cbEvent = pMsg->len;
+		if (cbEvent > pHeader->nlmsg_len - NLMSG_LENGTH(sizeof(struct cn_msg)))
+			cbEvent = pHeader->nlmsg_len - NLMSG_LENGTH(sizeof(struct cn_msg));
+		if (cbEvent < offsetof(struct proc_event, event_data))
+			continue;
+		if (cbEvent > sizeof(event))
+			cbEvent = sizeof(event);
+		::ZeroMemory(&event, sizeof(event));
+		memcpy(&event, pMsg->data, cbEvent);
+		DecodeEvent(event, pMsg->seq);
+	} // for
+}
+
+//
+// Number of events the kernel has dropped on the CPU
+//
+DWORD CNetlinkMonitor::CountMissed(
+	DWORD dwCpu,
+	DWORD dwCpuSequence
+	)
+{
+	DWORD dwMissed = 0;
+
+	if (dwCpu >= m_CpuNextSequence.size())
+		m_CpuNextSequence.resize(dwCpu + 1, 0);
+	if (0 != m_CpuNextSequence[dwCpu])
+	{
+		DWORD dwGap = dwCpuSequence - (DWORD)m_CpuNextSequence[dwCpu];
+		//
+		// A step back would be a restarted numbering, not a loss
+		//
+		if (dwGap < 0x80000000)
+			dwMissed = dwGap;
+	}
+	m_CpuNextSequence[dwCpu] = (ULONG64)dwCpuSequence + 1;
+
+	return dwMissed;
+}
+
+//
+// Read the image path and command line of the event's process. They
+// go to the string table and to the command line table, the event
+// carries their IDs.
+//
+void CNetlinkMonitor::ReadDetails(QUEUED_ITEM& queuedItem)
+{
+	WCHAR szImagePath[MAX_PATH];
+	WCHAR szCommandLine[QUEUED_ITEM_MAX_COMMAND_LINE];
+
+	ReadProcessImage(queuedItem.hProcessId, szImagePath, MAX_PATH);
+	ReadProcessCommandLine(queuedItem.hProcessId, szCommandLine, QUEUED_ITEM_MAX_COMMAND_LINE);
+	queuedItem.dwImageId       = CStringTable::GetInstance().Intern(szImagePath);
+	queuedItem.dwCommandLineId = CCommandLineTable::GetInstance().Add(szCommandLine);
+}
+
+//
+// Turn a single process event into a queued item
+//
+void CNetlinkMonitor::DecodeEvent(
+	const struct proc_event& event,
+	DWORD                    dwCpuSequence
+	)
+{
+	BOOL  bWanted = TRUE;
+	DWORD dwMissed;
+
+	//
+	// The acknowledgement of Listen() isn't an event
+	//
+	if (NETLINK_EVENT_NONE == (DWORD)event.what)
+		return;
+	dwMissed = CountMissed(event.cpu, dwCpuSequence);
+	if (m_dwItems == m_Items.size())
+		m_Items.resize(2 * m_Items.size());
+
+	QUEUED_ITEM& queuedItem = m_Items[m_dwItems];
+
+	::ZeroMemory(&queuedItem, sizeof(queuedItem));
+	switch ((DWORD)event.what)
+	{
+		//
+		// Threads are tasks sharing the thread group ID of their
+		// process, the group's first task is the process
+		//
+		case NETLINK_EVENT_FORK:
+			if (event.event_data.fork.child_pid == event.event_data.fork.child_tgid)
+			{
+				queuedItem.eKind              = QUEUED_ITEM_PROCESS;
+				queuedItem.bCreate            = TRUE;
+				queuedItem.hProcessId         = event.event_data.fork.child_tgid;
+				queuedItem.hParentId          = event.event_data.fork.parent_tgid;
+				queuedItem.dwCreatingThreadId = event.event_data.fork.parent_pid;
+				//
+				// Still the parent's image, until the child executes
+				// another one
+				//
+				if (m_bReadDetails)
+					ReadDetails(queuedItem);
+			}
+			else
+			{
+				queuedItem.eKind      = QUEUED_ITEM_THREAD;
+				queuedItem.bCreate    = TRUE;
+				queuedItem.hProcessId = event.event_data.fork.child_tgid;
+				queuedItem.dwThreadId = event.event_data.fork.child_pid;
+				bWanted = (0 != (m_bySubscriptions & OBSRV_SUBSCRIBE_THREAD));
+			}
+			break;
+		case NETLINK_EVENT_EXEC:
+			queuedItem.eKind      = QUEUED_ITEM_EXEC;
+			queuedItem.hProcessId = event.event_data.exec.process_tgid;
+			if (m_bReadDetails)
+				ReadDetails(queuedItem);
+			break;
+		case NETLINK_EVENT_UID:
+			queuedItem.eKind          = QUEUED_ITEM_UID;
+			queuedItem.hProcessId     = event.event_data.id.process_tgid;
+			queuedItem.dwThreadId     = event.event_data.id.process_pid;
+			queuedItem.dwRealUid      = event.event_data.id.r.ruid;
+			queuedItem.dwEffectiveUid = event.event_data.id.e.euid;
+			break;
+		case NETLINK_EVENT_EXIT:
+			if (event.event_data.exit.process_pid == event.event_data.exit.process_tgid)
+			{
+				queuedItem.eKind        = QUEUED_ITEM_PROCESS;
+				queuedItem.bCreate      = FALSE;
+				queuedItem.hProcessId   = event.event_data.exit.process_tgid;
+				queuedItem.hParentId    = event.event_data.exit.parent_tgid;
+				queuedItem.dwExitStatus = event.event_data.exit.exit_code;  // wait() status
+			}
+			else
+			{
+				queuedItem.eKind      = QUEUED_ITEM_THREAD;
+				queuedItem.bCreate    = FALSE;
+				queuedItem.hProcessId = event.event_data.exit.process_tgid;
+				queuedItem.dwThreadId = event.event_data.exit.process_pid;
+				bWanted = (0 != (m_bySubscriptions & OBSRV_SUBSCRIBE_THREAD));
+			}
+			break;
+		default:
+			bWanted = FALSE;
+			break;
+	} // switch
+	//
+	// Only lost events are skipped, thus the queue's gaps count what the
+	// kernel has dropped and nothing else
+	//
+	m_ullSequence += dwMissed;
+	if (!bWanted)
+		return;
+	queuedItem.ullSequence  = ++m_ullSequence;
+	//
+	// Stamped with CLOCK_MONOTONIC, the clock QueryTimestamp() reads
+	//
+	queuedItem.llSourceTime = (LONGLONG)event.timestamp_ns;
+	m_dwItems++;
+}
+
+//----------------------------End of the file -------------------------------
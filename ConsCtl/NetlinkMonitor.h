@@ -0,0 +1,183 @@
+//---------------------------------------------------------------------------
+//
+// NetlinkMonitor.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Thread management
+//
+// DESCRIPTION:
+//              The Linux event source. It stands in for CProcessThreadMonitor
+//              and listens to the kernel's process events connector
+//              (NETLINK_CONNECTOR, CN_IDX_PROC) instead of the driver.
+//              Listening requires CAP_NET_ADMIN.
+//
+//              The thread sleeps in a single poll() on the socket and on
+//              an eventfd that is written when it is asked to stop, thus
+//              it wakes up for events or for shutting down, and never
+//              otherwise.
+//
+//---------------------------------------------------------------------------
+#if !defined(_NETLINKMONITOR_H_)
+#define _NETLINKMONITOR_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "CustomThread.h"
+#include "QueueContainer.h"
+#include "../Shared/ObsrvIoctl.h"
+#include <vector>
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Datagrams taken by a single recvmmsg() call, and the room for each
+// of them. The kernel sends one event per datagram.
+//
+#define NETLINK_BATCH_MESSAGES          64
+#define NETLINK_MESSAGE_SIZE            1024
+
+//
+// Socket receive buffer asked for. Bursts of forks are absorbed here
+// while the monitor is busy; once it is full the kernel drops events.
+//
+#define NETLINK_RECEIVE_BUFFER          (8 * 1024 * 1024)
+
+//---------------------------------------------------------------------------
+//
+// Forward declarations
+//
+//---------------------------------------------------------------------------
+struct proc_event;
+
+//---------------------------------------------------------------------------
+//
+// class CNetlinkMonitor
+//
+//---------------------------------------------------------------------------
+class CNetlinkMonitor: public CCustomThread
+{
+public:
+	CNetlinkMonitor(
+		const TCHAR*         pszThreadGuid,     // Thread unique ID
+		CQueueContainer*     pRequestManager,   // The underlying store
+		BYTE                 bySubscriptions,   // OBSRV_SUBSCRIBE_THREAD
+		BOOL                 bReadDetails = TRUE // Image and command line
+		);
+	virtual ~CNetlinkMonitor();
+protected:
+	//
+	// A user supplied implementation of the thread function.
+	// Override Run() and insert the code that should be executed when
+	// the thread runs.
+	//
+	virtual void Run();
+	//
+	// Open the connector socket and start listening
+	//
+	virtual BOOL OnBeforeActivate();
+	//
+	// Wake the thread up for stopping
+	//
+	virtual void OnBeforeDeactivate();
+	//
+	// Stop listening and close the socket
+	//
+	virtual void OnAfterDeactivate();
+	//
+	// Tell the connector to start or stop multicasting process events
+	//
+	BOOL Listen(BOOL bListen);
+	//
+	// Close the socket, if it is open
+	//
+	void CloseSocket();
+	//
+	// Receive everything that has arrived, a batch of datagrams at a
+	// time, and append each batch to the queue at once
+	//
+	void ReceiveEvents();
+	//
+	// Decode the netlink messages of a datagram into m_Items
+	//
+	void DecodeDatagram(
+		const BYTE* pbData,
+		DWORD       cbData
+		);
+	//
+	// Turn a single process event into a queued item, if it is wanted
+	//
+	void DecodeEvent(
+		const struct proc_event& event,
+		DWORD                    dwCpuSequence
+		);
+	//
+	// Number of events the kernel has dropped on the event's CPU since
+	// the previous one from there
+	//
+	DWORD CountMissed(
+		DWORD dwCpu,
+		DWORD dwCpuSequence
+		);
+	//
+	// Read the image path and command line of the event's process
+	//
+	void ReadDetails(QUEUED_ITEM& queuedItem);
+	//
+	// The underlying store wrapped up by the custom template
+	//
+	CQueueContainer* m_pRequestManager;
+	//
+	// Events subscribed to on top of process create/terminate
+	//
+	BYTE m_bySubscriptions;
+	//
+	// Whether creates and exec()s are given the image path and command
+	// line read from /proc. Left to a later stage (CEnrichmentStage) the
+	// reads no longer hold up the events behind.
+	//
+	BOOL m_bReadDetails;
+	//
+	// NETLINK_CONNECTOR socket, -1 if it isn't open
+	//
+	int m_nSocket;
+	//
+	// eventfd written for stopping the thread, -1 if it isn't open
+	//
+	int m_nWakeup;
+	//
+	// Room for a batch of datagrams
+	//
+	PBYTE m_pbMessages;
+	//
+	// The connector numbers the events of every CPU. Next number
+	// expected from each CPU (the low 32 bits), 0 until the first event
+	// from there comes in.
+	//
+	vector<ULONG64> m_CpuNextSequence;
+	//
+	// Sequence number of the last queued item. Lost events are skipped,
+	// thus the queue counts them as missed.
+	//
+	ULONG64 m_ullSequence;
+	//
+	// Items of a batch, reused from batch to batch
+	//
+	vector<QUEUED_ITEM> m_Items;
+	DWORD               m_dwItems;
+};
+
+#endif // !defined(_NETLINKMONITOR_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,179 @@
+//---------------------------------------------------------------------------
+//
+// ParallelDispatcher.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Callback handler spreading the events over worker threads
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ParallelDispatcher.h"
+
+//---------------------------------------------------------------------------
+//
+// class CParallelDispatcher
+//
+//---------------------------------------------------------------------------
+CParallelDispatcher::CParallelDispatcher(
+	CCallbackHandler* pHandler,
+	DWORD             dwWorkers,
+	DWORD             dwWorkerQueue
+	):
+	m_pHandler(pHandler),
+	m_pvParam(NULL),
+	m_WorkerHandler(this)
+{
+	assert(NULL != m_pHandler);
+	if (0 == dwWorkers)
+		dwWorkers = 1;
+	if (dwWorkers > DISPATCH_MAX_WORKERS)
+		dwWorkers = DISPATCH_MAX_WORKERS;
+	if (0 == dwWorkerQueue)
+		dwWorkerQueue = DISPATCH_DEFAULT_WORKER_QUEUE;
+	m_Parts.resize(dwWorkers);
+	for (DWORD i = 0; i < dwWorkers; i++)
+	{
+		CQueueContainer* pWorker = new CQueueContainer(&m_WorkerHandler);
+		//
+		// A worker that falls behind holds the dispatch up
+		//
+		pWorker->SetLimits(dwWorkerQueue, 0, QUEUE_OVERFLOW_BLOCK);
+		pWorker->StartReceivingNotifications();
+		m_Workers.push_back(pWorker);
+	} // for
+}
+
+CParallelDispatcher::~CParallelDispatcher()
+{
+	for (size_t i = 0; i < m_Workers.size(); i++)
+	{
+		m_Workers[i]->StopReceivingNotifications();
+		delete m_Workers[i];
+	} // for
+}
+
+//
+// Number of worker threads
+//
+DWORD CParallelDispatcher::GetWorkerCount() const
+{
+	return (DWORD)m_Workers.size();
+}
+
+//
+// Counters of all worker queues added up
+//
+void CParallelDispatcher::GetStats(QUEUE_STATS& stats)
+{
+	::ZeroMemory((PBYTE)&stats, sizeof(stats));
+	for (size_t i = 0; i < m_Workers.size(); i++)
+	{
+		QUEUE_STATS worker;
+
+		m_Workers[i]->GetStats(worker);
+		stats.ullReceived      += worker.ullReceived;
+		stats.ullDelivered     += worker.ullDelivered;
+		stats.ullProducerWaits += worker.ullProducerWaits;
+		stats.dwQueueDepth     += worker.dwQueueDepth;
+	} // for
+}
+
+//
+// The worker a process is handled by. Process IDs come in sequences,
+// thus they are scrambled (Fibonacci hashing) before being mapped onto
+// the workers.
+//
+DWORD CParallelDispatcher::GetWorker(DWORD dwProcessId) const
+{
+	DWORD dwHash = dwProcessId * 0x9E3779B1;
+
+	return (DWORD)(((ULONG64)dwHash * m_Workers.size()) >> 32);
+}
+
+//
+// A single event, dispatched like a batch of one
+//
+void CParallelDispatcher::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	if (NULL != pQueuedItem)
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+}
+
+//
+// Sort the batch by worker and append every part to its queue
+//
+void CParallelDispatcher::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	m_pvParam.store(pvParam, std::memory_order_relaxed);
+	if (1 == m_Workers.size())
+	{
+		m_Workers[0]->AppendBatch(pQueuedItems, dwCount);
+		return;
+	}
+	for (DWORD i = 0; i < dwCount; i++)
+		m_Parts[GetWorker(pQueuedItems[i].hProcessId)].push_back(pQueuedItems[i]);
+	for (size_t i = 0; i < m_Parts.size(); i++)
+	{
+		if (m_Parts[i].empty())
+			continue;
+		m_Workers[i]->AppendBatch(&m_Parts[i][0], (DWORD)m_Parts[i].size());
+		m_Parts[i].clear();
+	} // for
+}
+
+//---------------------------------------------------------------------------
+//
+// class CParallelDispatcher::CWorkerHandler
+//
+//---------------------------------------------------------------------------
+CParallelDispatcher::CWorkerHandler::CWorkerHandler(CParallelDispatcher* pOwner):
+	m_pOwner(pOwner)
+{
+}
+
+void CParallelDispatcher::CWorkerHandler::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pvParam);
+
+	m_pOwner->m_pHandler->OnProcessEvent(
+		pQueuedItem,
+		m_pOwner->m_pvParam.load(std::memory_order_relaxed)
+		);
+}
+
+void CParallelDispatcher::CWorkerHandler::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	UNREFERENCED_PARAMETER(pvParam);
+
+	m_pOwner->m_pHandler->OnProcessEvents(
+		pQueuedItems,
+		dwCount,
+		m_pOwner->m_pvParam.load(std::memory_order_relaxed)
+		);
+}
+
+//----------------------------End of the file -------------------------------
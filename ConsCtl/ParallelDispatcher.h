@@ -0,0 +1,160 @@
+//---------------------------------------------------------------------------
+//
+// ParallelDispatcher.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Callback handler spreading the events over worker threads
+//
+// DESCRIPTION:
+//              The retrieval thread calls one handler at a time, thus a
+//              handler that takes long (disk, network) caps the number of
+//              events handled per second. CParallelDispatcher is a handler
+//              itself, which sorts every batch it gets by a hash of the
+//              process ID and appends each part to a queue of its own,
+//              with a retrieval thread of its own calling the actual
+//              handler. The events of a process thus stay in order, while
+//              those of different processes are handled in parallel.
+//
+//              The worker queues are bounded and block when full, so a
+//              worker that falls behind stalls the dispatch and the events
+//              pile up in the queue of CApplicationScope, where its
+//              overflow policy applies.
+//
+//              The actual handler is called from several threads at once
+//              and must be thread safe. Events of different processes,
+//              e.g. a parent's and its child's creates, may be handled in
+//              any order.
+//
+//              The parameter given with the events (the one passed to
+//              StartMonitoring()) must stay the same for as long as the
+//              dispatcher runs. It isn't queued with the events, the
+//              workers pass on the one that came with the latest batch.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PARALLELDISPATCHER_H_)
+#define _PARALLELDISPATCHER_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "CallbackHandler.h"
+#include "QueueContainer.h"
+#include <atomic>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Worker threads at most, and events a worker queue holds by default
+//
+#define DISPATCH_MAX_WORKERS            64
+#define DISPATCH_DEFAULT_WORKER_QUEUE   256
+
+//---------------------------------------------------------------------------
+//
+// class CParallelDispatcher
+//
+//---------------------------------------------------------------------------
+class CParallelDispatcher: public CCallbackHandler
+{
+public:
+	//
+	// Start dwWorkers threads (1 to DISPATCH_MAX_WORKERS) calling
+	// pHandler, each with a queue of dwWorkerQueue events
+	//
+	CParallelDispatcher(
+		CCallbackHandler* pHandler,
+		DWORD             dwWorkers,
+		DWORD             dwWorkerQueue = DISPATCH_DEFAULT_WORKER_QUEUE
+		);
+	//
+	// Stop the workers. Events still queued are not handled.
+	//
+	virtual ~CParallelDispatcher();
+	//
+	// Number of worker threads
+	//
+	DWORD GetWorkerCount() const;
+	//
+	// Counters of all worker queues added up: events received, handled,
+	// waiting, and the times the dispatch has waited for a worker
+	//
+	void GetStats(QUEUE_STATS& stats);
+	//
+	// A single event, dispatched like a batch of one
+	//
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		);
+	//
+	// Sort the batch by worker and append every part to its queue
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+private:
+	//
+	// The handler of the worker queues. It calls the actual handler with
+	// the parameter of the latest batch, which must not change while the
+	// workers run.
+	//
+	class CWorkerHandler: public CCallbackHandler
+	{
+	public:
+		CWorkerHandler(CParallelDispatcher* pOwner);
+		virtual void OnProcessEvent(
+			PQUEUED_ITEM pQueuedItem,
+			PVOID        pvParam
+			);
+		virtual void OnProcessEvents(
+			PQUEUED_ITEM pQueuedItems,
+			DWORD        dwCount,
+			PVOID        pvParam
+			);
+	private:
+		CParallelDispatcher* m_pOwner;
+	};
+	//
+	// The worker a process is handled by
+	//
+	DWORD GetWorker(DWORD dwProcessId) const;
+	//
+	// The actual handler
+	//
+	CCallbackHandler* m_pHandler;
+	//
+	// Parameter passed on to the actual handler
+	//
+	std::atomic<PVOID> m_pvParam;
+	CWorkerHandler     m_WorkerHandler;
+	//
+	// A queue and a retrieval thread per worker
+	//
+	vector<CQueueContainer*> m_Workers;
+	//
+	// Events of the current batch sorted by worker, used by the thread
+	// dispatching only
+	//
+	vector< vector<QUEUED_ITEM> > m_Parts;
+};
+
+#endif // !defined(_PARALLELDISPATCHER_H_)
+//----------------------------End of the file -------------------------------
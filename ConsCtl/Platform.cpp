@@ -0,0 +1,390 @@
+//---------------------------------------------------------------------------
+//
+// Platform.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Threading, synchronization and runtime primitives
+//
+// DESCRIPTION:
+//              The pthreads implementation of the Win32 subset. Kernel
+//              objects share one lock and one condition variable. Waiters
+//              register with the objects they wait for, thus signaling an
+//              object nobody waits for is a plain store under the lock and
+//              wakes no one.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Platform.h"
+
+#if !defined(_WIN32)
+
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Event or mutex behind a HANDLE
+//
+typedef struct _KernelObject
+{
+	BOOL      bMutex;
+	BOOL      bManualReset;  // Events only
+	BOOL      bSignaled;     // Events only
+	pthread_t Owner;         // Mutexes only, valid if dwRecursion != 0
+	DWORD     dwRecursion;   // Mutexes only
+	DWORD     dwWaiters;     // Threads blocked on the object
+} KERNEL_OBJECT, *PKERNEL_OBJECT;
+
+//
+// What a new thread has to start with
+//
+typedef struct _ThreadStart
+{
+	unsigned (*pfnStart)(void*);
+	void*    pvArgList;
+} THREAD_START, *PTHREAD_START;
+
+//---------------------------------------------------------------------------
+//
+// Global variables
+//
+//---------------------------------------------------------------------------
+static pthread_mutex_t g_ObjectLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_ObjectSignaled;
+static pthread_once_t  g_ObjectOnce = PTHREAD_ONCE_INIT;
+
+//---------------------------------------------------------------------------
+//
+// Local helpers
+//
+//---------------------------------------------------------------------------
+
+//
+// Timeouts are measured on CLOCK_MONOTONIC, thus setting the clock
+// doesn't shorten or extend them
+//
+static void InitObjects()
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&g_ObjectSignaled, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static PKERNEL_OBJECT NewObject(BOOL bMutex)
+{
+	PKERNEL_OBJECT pObject = new KERNEL_OBJECT;
+
+	pthread_once(&g_ObjectOnce, InitObjects);
+	::ZeroMemory(pObject, sizeof(*pObject));
+	pObject->bMutex = bMutex;
+
+	return pObject;
+}
+
+//
+// Take the object if it is signaled. Called with g_ObjectLock held.
+//
+static BOOL TryAcquire(PKERNEL_OBJECT pObject)
+{
+	if (pObject->bMutex)
+	{
+		if ((0 != pObject->dwRecursion) &&
+		    !pthread_equal(pObject->Owner, pthread_self()))
+			return FALSE;
+		pObject->Owner = pthread_self();
+		pObject->dwRecursion++;
+		return TRUE;
+	}
+	if (!pObject->bSignaled)
+		return FALSE;
+	if (!pObject->bManualReset)
+		pObject->bSignaled = FALSE;
+
+	return TRUE;
+}
+
+//
+// Let the waiters know. Called with g_ObjectLock held.
+//
+static void WakeWaiters(PKERNEL_OBJECT pObject)
+{
+	if (0 != pObject->dwWaiters)
+		pthread_cond_broadcast(&g_ObjectSignaled);
+}
+
+static void* ThreadEntry(void* pvParam)
+{
+	THREAD_START start = *(PTHREAD_START)pvParam;
+
+	delete (PTHREAD_START)pvParam;
+	start.pfnStart(start.pvArgList);
+
+	return NULL;
+}
+
+//---------------------------------------------------------------------------
+//
+// Runtime
+//
+//---------------------------------------------------------------------------
+void Sleep(DWORD dwMilliseconds)
+{
+	struct timespec ts;
+
+	ts.tv_sec  = dwMilliseconds / 1000;
+	ts.tv_nsec = (long)(dwMilliseconds % 1000) * 1000000L;
+	while ((0 != nanosleep(&ts, &ts)) && (EINTR == errno))
+	{
+	}
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER* pliCount)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	pliCount->QuadPart = (LONGLONG)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+	return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* pliFrequency)
+{
+	pliFrequency->QuadPart = 1000000000LL;
+
+	return TRUE;
+}
+
+//---------------------------------------------------------------------------
+//
+// Critical sections
+//
+//---------------------------------------------------------------------------
+void InitializeCriticalSection(CRITICAL_SECTION* pcs)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(pcs, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION* pcs)
+{
+	pthread_mutex_destroy(pcs);
+}
+
+//---------------------------------------------------------------------------
+//
+// Events and mutexes
+//
+//---------------------------------------------------------------------------
+HANDLE CreateEvent(
+	PVOID   pvAttributes,
+	BOOL    bManualReset,
+	BOOL    bInitialState,
+	LPCTSTR pszName
+	)
+{
+	PKERNEL_OBJECT pObject = NewObject(FALSE);
+
+	UNREFERENCED_PARAMETER(pvAttributes);
+	UNREFERENCED_PARAMETER(pszName);
+	pObject->bManualReset = bManualReset;
+	pObject->bSignaled    = bInitialState;
+
+	return pObject;
+}
+
+HANDLE CreateMutex(
+	PVOID   pvAttributes,
+	BOOL    bInitialOwner,
+	LPCTSTR pszName
+	)
+{
+	PKERNEL_OBJECT pObject = NewObject(TRUE);
+
+	UNREFERENCED_PARAMETER(pvAttributes);
+	UNREFERENCED_PARAMETER(pszName);
+	if (bInitialOwner)
+	{
+		pObject->Owner       = pthread_self();
+		pObject->dwRecursion = 1;
+	}
+
+	return pObject;
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+	PKERNEL_OBJECT pObject = (PKERNEL_OBJECT)hEvent;
+
+	pthread_mutex_lock(&g_ObjectLock);
+	pObject->bSignaled = TRUE;
+	WakeWaiters(pObject);
+	pthread_mutex_unlock(&g_ObjectLock);
+
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+	PKERNEL_OBJECT pObject = (PKERNEL_OBJECT)hEvent;
+
+	pthread_mutex_lock(&g_ObjectLock);
+	pObject->bSignaled = FALSE;
+	pthread_mutex_unlock(&g_ObjectLock);
+
+	return TRUE;
+}
+
+BOOL ReleaseMutex(HANDLE hMutex)
+{
+	PKERNEL_OBJECT pObject = (PKERNEL_OBJECT)hMutex;
+	BOOL           bResult = FALSE;
+
+	pthread_mutex_lock(&g_ObjectLock);
+	if ((0 != pObject->dwRecursion) &&
+	    pthread_equal(pObject->Owner, pthread_self()))
+	{
+		if (0 == --pObject->dwRecursion)
+			WakeWaiters(pObject);
+		bResult = TRUE;
+	}
+	pthread_mutex_unlock(&g_ObjectLock);
+
+	return bResult;
+}
+
+BOOL CloseHandle(HANDLE hObject)
+{
+	delete (PKERNEL_OBJECT)hObject;
+
+	return TRUE;
+}
+
+DWORD WaitForSingleObject(
+	HANDLE hObject,
+	DWORD  dwMilliseconds
+	)
+{
+	return ::WaitForMultipleObjects(1, &hObject, FALSE, dwMilliseconds);
+}
+
+DWORD WaitForMultipleObjects(
+	DWORD         nCount,
+	const HANDLE* phObjects,
+	BOOL          bWaitAll,
+	DWORD         dwMilliseconds
+	)
+{
+	struct timespec tsDeadline;
+	DWORD           dwResult = WAIT_TIMEOUT;
+	BOOL            bWaiting = FALSE;
+	DWORD           i;
+
+	assert(!bWaitAll);
+	if (INFINITE != dwMilliseconds)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &tsDeadline);
+		tsDeadline.tv_sec  += dwMilliseconds / 1000;
+		tsDeadline.tv_nsec += (long)(dwMilliseconds % 1000) * 1000000L;
+		if (tsDeadline.tv_nsec >= 1000000000L)
+		{
+			tsDeadline.tv_sec++;
+			tsDeadline.tv_nsec -= 1000000000L;
+		}
+	} // if
+	pthread_mutex_lock(&g_ObjectLock);
+	while (TRUE)
+	{
+		for (i = 0; i < nCount; i++)
+			if (TryAcquire((PKERNEL_OBJECT)phObjects[i]))
+				break;
+		if (i < nCount)
+		{
+			dwResult = WAIT_OBJECT_0 + i;
+			break;
+		}
+		if (0 == dwMilliseconds)
+			break;
+		if (!bWaiting)
+		{
+			for (i = 0; i < nCount; i++)
+				((PKERNEL_OBJECT)phObjects[i])->dwWaiters++;
+			bWaiting = TRUE;
+		}
+		if (INFINITE == dwMilliseconds)
+			pthread_cond_wait(&g_ObjectSignaled, &g_ObjectLock);
+		else if (ETIMEDOUT == pthread_cond_timedwait(&g_ObjectSignaled, &g_ObjectLock, &tsDeadline))
+			dwMilliseconds = 0; // One more look, then give up
+	} // while
+	if (bWaiting)
+		for (i = 0; i < nCount; i++)
+			((PKERNEL_OBJECT)phObjects[i])->dwWaiters--;
+	pthread_mutex_unlock(&g_ObjectLock);
+
+	return dwResult;
+}
+
+//---------------------------------------------------------------------------
+//
+// Threads
+//
+//---------------------------------------------------------------------------
+uintptr_t _beginthreadex(
+	void*     pvSecurity,
+	unsigned  cbStackSize,
+	unsigned  (*pfnStart)(void*),
+	void*     pvArgList,
+	unsigned  dwInitFlag,
+	unsigned* pdwThreadId
+	)
+{
+	pthread_attr_t attr;
+	pthread_t      thread;
+	PTHREAD_START  pStart = new THREAD_START;
+	int            nResult;
+
+	UNREFERENCED_PARAMETER(pvSecurity);
+	UNREFERENCED_PARAMETER(dwInitFlag);
+	pStart->pfnStart  = pfnStart;
+	pStart->pvArgList = pvArgList;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (0 != cbStackSize)
+		pthread_attr_setstacksize(&attr, cbStackSize);
+	nResult = pthread_create(&thread, &attr, ThreadEntry, pStart);
+	pthread_attr_destroy(&attr);
+	if (0 != nResult)
+	{
+		delete pStart;
+		return 0;
+	}
+	if (NULL != pdwThreadId)
+		*pdwThreadId = (unsigned)(uintptr_t)thread;
+
+	return (uintptr_t)thread;
+}
+
+#endif // !defined(_WIN32)
+
+//--------------------- End of the file -------------------------------------
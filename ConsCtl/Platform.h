@@ -0,0 +1,250 @@
+//---------------------------------------------------------------------------
+//
+// Platform.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Threading, synchronization and runtime primitives
+//
+// DESCRIPTION:
+//              On Windows this is nothing but the system headers. Elsewhere
+//              it provides the subset of the Win32 API the pipeline is
+//              written against - types, kernel objects (events and
+//              mutexes), waits, threads and timestamps - on top of
+//              pthreads, thus CCustomThread, CCSWrapper, CQueueContainer
+//              and the rest build unchanged.
+//
+//              The kernel objects live in the process only. Names are
+//              accepted and ignored. WaitForMultipleObjects() supports
+//              waiting for any one of the objects only.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PLATFORM_H_)
+#define _PLATFORM_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#if defined(_WIN32)
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include <windows.h>
+#include <tchar.h>
+#include <process.h>
+
+//
+// printf() conversions of 64-bit values
+//
+#define TFMT_U64                TEXT("I64u")
+#define TFMT_X64                TEXT("I64X")
+//
+// and of WCHAR strings (Unicode build)
+//
+#define TFMT_WSTR               TEXT("s")
+
+#else // !defined(_WIN32)
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+typedef int                 BOOL;
+typedef unsigned char       BYTE, *PBYTE;
+typedef unsigned char       BOOLEAN;
+typedef char                CHAR;
+typedef wchar_t             WCHAR;
+typedef unsigned int        DWORD, *PDWORD, *LPDWORD;
+typedef uint32_t            DWORD32;
+typedef int                 LONG;
+typedef unsigned int        ULONG;
+typedef long long           LONGLONG;
+typedef unsigned long long  ULONG64;
+typedef void*               PVOID;
+typedef void*               HANDLE;
+//
+// No Unicode build, TCHAR is always a char
+//
+typedef char                TCHAR, *LPTSTR;
+typedef const char*         LPCTSTR;
+
+typedef union _LARGE_INTEGER
+{
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+//
+// CRITICAL_SECTION is a recursive mutex
+//
+typedef pthread_mutex_t     CRITICAL_SECTION;
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+#define TRUE                    1
+#define FALSE                   0
+#define MAX_PATH                260
+#define INFINITE                0xFFFFFFFF
+#define WAIT_OBJECT_0           0
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+#define WINAPI
+#define __stdcall
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+
+#define TEXT(s)                 s
+#define _tcscpy                 strcpy
+#define _tcsncpy                strncpy
+#define _tcscat                 strcat
+#define _tcslen                 strlen
+#define _tprintf                printf
+#define wsprintf                sprintf
+
+#define TFMT_U64                "llu"
+#define TFMT_X64                "llX"
+#define TFMT_WSTR               "ls"
+
+//---------------------------------------------------------------------------
+//
+// Runtime
+//
+//---------------------------------------------------------------------------
+inline void ZeroMemory(PVOID pvDest, size_t cbLength)
+{
+	memset(pvDest, 0, cbLength);
+}
+
+//
+// There is no debugger output, the messages are dropped
+//
+inline void OutputDebugString(LPCTSTR pszMessage)
+{
+	UNREFERENCED_PARAMETER(pszMessage);
+}
+
+void Sleep(DWORD dwMilliseconds);
+
+//
+// CLOCK_MONOTONIC in nanoseconds, the clock the kernel stamps its
+// process events with
+//
+BOOL QueryPerformanceCounter(LARGE_INTEGER* pliCount);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* pliFrequency);
+
+//---------------------------------------------------------------------------
+//
+// Critical sections
+//
+//---------------------------------------------------------------------------
+void InitializeCriticalSection(CRITICAL_SECTION* pcs);
+void DeleteCriticalSection(CRITICAL_SECTION* pcs);
+
+inline void EnterCriticalSection(CRITICAL_SECTION* pcs)
+{
+	pthread_mutex_lock(pcs);
+}
+
+inline BOOL TryEnterCriticalSection(CRITICAL_SECTION* pcs)
+{
+	return (0 == pthread_mutex_trylock(pcs));
+}
+
+inline void LeaveCriticalSection(CRITICAL_SECTION* pcs)
+{
+	pthread_mutex_unlock(pcs);
+}
+
+//---------------------------------------------------------------------------
+//
+// Events and mutexes
+//
+//---------------------------------------------------------------------------
+HANDLE CreateEvent(
+	PVOID   pvAttributes,  // Ignored
+	BOOL    bManualReset,
+	BOOL    bInitialState,
+	LPCTSTR pszName        // Ignored
+	);
+
+HANDLE CreateMutex(
+	PVOID   pvAttributes,  // Ignored
+	BOOL    bInitialOwner,
+	LPCTSTR pszName        // Ignored
+	);
+
+BOOL SetEvent(HANDLE hEvent);
+BOOL ResetEvent(HANDLE hEvent);
+BOOL ReleaseMutex(HANDLE hMutex);
+BOOL CloseHandle(HANDLE hObject);
+
+DWORD WaitForSingleObject(
+	HANDLE hObject,
+	DWORD  dwMilliseconds
+	);
+
+//
+// bWaitAll must be FALSE
+//
+DWORD WaitForMultipleObjects(
+	DWORD         nCount,
+	const HANDLE* phObjects,
+	BOOL          bWaitAll,
+	DWORD         dwMilliseconds
+	);
+
+//---------------------------------------------------------------------------
+//
+// Threads
+//
+//---------------------------------------------------------------------------
+
+//
+// Start a detached thread. Returns 0 on failure.
+//
+uintptr_t _beginthreadex(
+	void*     pvSecurity,   // Ignored
+	unsigned  cbStackSize,
+	unsigned  (*pfnStart)(void*),
+	void*     pvArgList,
+	unsigned  dwInitFlag,   // Ignored
+	unsigned* pdwThreadId
+	);
+
+//
+// Returning from the thread function is all it takes
+//
+inline void _endthreadex(unsigned dwExitCode)
+{
+	UNREFERENCED_PARAMETER(dwExitCode);
+}
+
+inline HANDLE GetCurrentThread()
+{
+	return (HANDLE)(uintptr_t)pthread_self();
+}
+
+#endif // !defined(_WIN32)
+
+#endif // !defined(_PLATFORM_H_)
+
+//--------------------- End of the file -------------------------------------
@@ -0,0 +1,194 @@
+//---------------------------------------------------------------------------
+//
+// ProcFs.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Reading process details from /proc (Linux)
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ProcFs.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+//---------------------------------------------------------------------------
+//
+// Local helpers
+//
+//---------------------------------------------------------------------------
+
+//
+// Convert a multibyte string of cbText bytes. Bytes that don't form a
+// character are taken as they are, thus nothing gets cut off.
+//
+static void WidenString(
+	const char* pszText,
+	size_t      cbText,
+	WCHAR*      pszOut,
+	DWORD       cchOut
+	)
+{
+	mbstate_t state;
+	DWORD     cchCopied = 0;
+
+	::ZeroMemory(&state, sizeof(state));
+	while ((cbText > 0) && (cchCopied + 1 < cchOut))
+	{
+		size_t cbChar = mbrtowc(&pszOut[cchCopied], pszText, cbText, &state);
+
+		if ((0 == cbChar) || (cbChar > cbText))
+		{
+			pszOut[cchCopied] = (WCHAR)(unsigned char)*pszText;
+			::ZeroMemory(&state, sizeof(state));
+			cbChar = 1;
+		}
+		pszText += cbChar;
+		cbText  -= cbChar;
+		cchCopied++;
+	} // while
+	pszOut[cchCopied] = L'\0';
+}
+
+//---------------------------------------------------------------------------
+//
+// Functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Path of the image a process runs, empty if it has gone meanwhile
+//
+void ReadProcessImage(
+	DWORD  dwProcessId,
+	WCHAR* pszImagePath,
+	DWORD  cchImagePath
+	)
+{
+	char    szLink[32];
+	char    szPath[4096];
+	ssize_t cbPath;
+
+	snprintf(szLink, sizeof(szLink), "/proc/%u/exe", dwProcessId);
+	cbPath = ::readlink(szLink, szPath, sizeof(szPath));
+	if (cbPath < 0)
+		cbPath = 0;
+	WidenString(szPath, (size_t)cbPath, pszImagePath, cchImagePath);
+}
+
+//
+// Arguments of a process separated by blanks, empty if it has gone
+// meanwhile (or is a kernel thread)
+//
+void ReadProcessCommandLine(
+	DWORD  dwProcessId,
+	WCHAR* pszCommandLine,
+	DWORD  cchCommandLine
+	)
+{
+	char    szFile[32];
+	char    szArgs[QUEUED_ITEM_MAX_COMMAND_LINE];
+	ssize_t cbArgs = 0;
+	int     nFile;
+
+	snprintf(szFile, sizeof(szFile), "/proc/%u/cmdline", dwProcessId);
+	nFile = ::open(szFile, O_RDONLY | O_CLOEXEC);
+	if (nFile >= 0)
+	{
+		cbArgs = ::read(nFile, szArgs, sizeof(szArgs));
+		::close(nFile);
+	}
+	if (cbArgs < 0)
+		cbArgs = 0;
+	//
+	// The arguments are zero terminated, the last one included
+	//
+	if ((cbArgs > 0) && ('\0' == szArgs[cbArgs - 1]))
+		cbArgs--;
+	for (ssize_t i = 0; i < cbArgs; i++)
+		if ('\0' == szArgs[i])
+			szArgs[i] = ' ';
+	WidenString(szArgs, (size_t)cbArgs, pszCommandLine, cchCommandLine);
+}
+
+//
+// Parent ID and start time from /proc/<pid>/stat
+//
+BOOL ReadProcessStat(
+	DWORD    dwProcessId,
+	PDWORD   pdwParentId,
+	ULONG64* pullStartTime
+	)
+{
+	char        szFile[32];
+	char        szStat[1024];
+	ssize_t     cbStat = -1;
+	const char* pszField;
+	const char* pszEnd;
+	int         nFile;
+
+	snprintf(szFile, sizeof(szFile), "/proc/%u/stat", dwProcessId);
+	nFile = ::open(szFile, O_RDONLY | O_CLOEXEC);
+	if (nFile >= 0)
+	{
+		cbStat = ::read(nFile, szStat, sizeof(szStat) - 1);
+		::close(nFile);
+	}
+	if (cbStat <= 0)
+		return FALSE;
+	szStat[cbStat] = '\0';
+	pszEnd = szStat + cbStat;
+	//
+	// The name (field 2) is in parentheses and may contain anything,
+	// including blanks and parentheses. Field 3 follows the last ')'.
+	//
+	pszField = (const char*)memrchr(szStat, ')', cbStat);
+	if ((NULL == pszField) || (pszField + 2 >= pszEnd))
+		return FALSE;
+	pszField += 2;
+	for (int nField = 3; nField < 22; nField++)
+	{
+		if (4 == nField)
+			*pdwParentId = (DWORD)strtoul(pszField, NULL, 10);
+		pszField = (const char*)memchr(pszField, ' ', pszEnd - pszField);
+		if (NULL == pszField)
+			return FALSE;
+		pszField++;
+	} // for
+	*pullStartTime = strtoull(pszField, NULL, 10);
+
+	return TRUE;
+}
+
+//
+// Start times count clock ticks on CLOCK_BOOTTIME, which goes on while
+// the system is suspended, unlike CLOCK_MONOTONIC
+//
+LONGLONG StartTimeToTimestamp(ULONG64 ullStartTime)
+{
+	static LONGLONG s_llTickLength = 0;
+	struct timespec tsBoot;
+	struct timespec tsMonotonic;
+
+	if (0 == s_llTickLength)
+		s_llTickLength = 1000000000LL / ::sysconf(_SC_CLK_TCK);
+	clock_gettime(CLOCK_BOOTTIME, &tsBoot);
+	clock_gettime(CLOCK_MONOTONIC, &tsMonotonic);
+
+	return (LONGLONG)ullStartTime * s_llTickLength -
+		((LONGLONG)(tsBoot.tv_sec - tsMonotonic.tv_sec) * 1000000000LL +
+		 (tsBoot.tv_nsec - tsMonotonic.tv_nsec));
+}
+
+//----------------------------End of the file -------------------------------
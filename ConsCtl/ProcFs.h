@@ -0,0 +1,73 @@
+//---------------------------------------------------------------------------
+//
+// ProcFs.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Reading process details from /proc (Linux)
+//
+// DESCRIPTION:
+//              The event sources that have no driver to capture the
+//              details of a process read them from /proc instead. A
+//              process may be gone by then, in which case the functions
+//              fail or return empty strings.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PROCFS_H_)
+#define _PROCFS_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+
+//---------------------------------------------------------------------------
+//
+// Functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Path of the image a process runs
+//
+void ReadProcessImage(
+	DWORD  dwProcessId,
+	WCHAR* pszImagePath,
+	DWORD  cchImagePath
+	);
+
+//
+// Arguments of a process separated by blanks, empty for kernel threads
+//
+void ReadProcessCommandLine(
+	DWORD  dwProcessId,
+	WCHAR* pszCommandLine,
+	DWORD  cchCommandLine
+	);
+
+//
+// Parent ID and start time (clock ticks after boot) from
+// /proc/<pid>/stat. The start time tells a process from an earlier one
+// that had the same ID.
+//
+BOOL ReadProcessStat(
+	DWORD    dwProcessId,
+	PDWORD   pdwParentId,
+	ULONG64* pullStartTime
+	);
+
+//
+// Convert a start time to a QueryTimestamp() value
+//
+LONGLONG StartTimeToTimestamp(ULONG64 ullStartTime);
+
+#endif // !defined(_PROCFS_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,124 @@
+//---------------------------------------------------------------------------
+//
+// ProcPollMonitor.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Thread management
+//
+// DESCRIPTION:
+//              Scans /proc periodically and appends the processes created
+//              and exited in between to the queue.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ProcPollMonitor.h"
+#include "ProcFs.h"
+#include "StringTable.h"
+#include "CommandLineTable.h"
+#include "LatencyHistogram.h"
+
+//---------------------------------------------------------------------------
+//
+// class CProcPollMonitor
+//
+//---------------------------------------------------------------------------
+CProcPollMonitor::CProcPollMonitor(
+	const TCHAR*         pszThreadGuid,     // Thread unique ID
+	CQueueContainer*     pRequestManager,   // The underlying store
+	DWORD                dwScanInterval     // Milliseconds
+	):
+	CCustomThread(pszThreadGuid),
+	m_pRequestManager(pRequestManager),
+	m_dwScanInterval(dwScanInterval)
+{
+	assert(NULL != pRequestManager);
+	if (m_dwScanInterval < PROC_POLL_MIN_INTERVAL)
+		m_dwScanInterval = PROC_POLL_MIN_INTERVAL;
+	if (m_dwScanInterval > PROC_POLL_MAX_INTERVAL)
+		m_dwScanInterval = PROC_POLL_MAX_INTERVAL;
+}
+
+CProcPollMonitor::~CProcPollMonitor()
+{
+	SetActive(FALSE);
+}
+
+//
+// Take the first snapshot
+//
+BOOL CProcPollMonitor::OnBeforeActivate()
+{
+	m_Snapshot.Reset();
+	m_Changes.clear();
+
+	return m_Snapshot.Scan(m_Changes);
+}
+
+//
+// A user supplied implementation of the thread function.
+// Override Run() and insert the code that should be executed when
+// the thread runs.
+//
+void CProcPollMonitor::Run()
+{
+	while (WAIT_TIMEOUT == ::WaitForSingleObject(m_hShutdownEvent, m_dwScanInterval))
+		ScanProcesses();
+}
+
+//
+// Scan /proc once and append what has changed to the queue
+//
+void CProcPollMonitor::ScanProcesses()
+{
+	LONGLONG llScanTime = QueryTimestamp();
+	WCHAR    szImagePath[MAX_PATH];
+	WCHAR    szCommandLine[QUEUED_ITEM_MAX_COMMAND_LINE];
+
+	m_Changes.clear();
+	if (!m_Snapshot.Scan(m_Changes) || m_Changes.empty())
+		return;
+	if (m_Items.size() < m_Changes.size())
+		m_Items.resize(m_Changes.size());
+
+	for (size_t i = 0; i < m_Changes.size(); i++)
+	{
+		const PROC_CHANGE& change     = m_Changes[i];
+		QUEUED_ITEM&       queuedItem = m_Items[i];
+
+		::ZeroMemory(&queuedItem, sizeof(queuedItem));
+		queuedItem.eKind      = QUEUED_ITEM_PROCESS;
+		queuedItem.bCreate    = change.bCreate;
+		queuedItem.hProcessId = change.dwProcessId;
+		queuedItem.hParentId  = change.dwParentId;
+		if (change.bCreate)
+		{
+			ReadProcessImage(change.dwProcessId, szImagePath, MAX_PATH);
+			ReadProcessCommandLine(change.dwProcessId, szCommandLine, QUEUED_ITEM_MAX_COMMAND_LINE);
+			queuedItem.dwImageId       = CStringTable::GetInstance().Intern(szImagePath);
+			queuedItem.dwCommandLineId = CCommandLineTable::GetInstance().Add(szCommandLine);
+			queuedItem.llSourceTime = StartTimeToTimestamp(change.ullStartTime);
+		}
+		else
+		{
+			//
+			// The process has exited some time before the scan
+			//
+			queuedItem.llSourceTime = llScanTime;
+		}
+		//
+		// Not numbered, nothing can be told lost
+		//
+		queuedItem.ullSequence = 0;
+	} // for
+	m_pRequestManager->AppendBatch(&m_Items[0], (DWORD)m_Changes.size());
+}
+
+//----------------------------End of the file -------------------------------
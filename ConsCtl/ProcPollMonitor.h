@@ -0,0 +1,103 @@
+//---------------------------------------------------------------------------
+//
+// ProcPollMonitor.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Thread management
+//
+// DESCRIPTION:
+//              The unprivileged Linux event source. It lists /proc every
+//              so often and reports the processes that have come and gone
+//              since the previous scan (see CProcSnapshot). It takes over
+//              when CNetlinkMonitor can't listen.
+//
+//              Processes that live shorter than the scan interval go
+//              unnoticed, there are no thread events, and exit statuses
+//              are unknown. Nothing is counted as lost either, the items
+//              aren't numbered.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PROCPOLLMONITOR_H_)
+#define _PROCPOLLMONITOR_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "CustomThread.h"
+#include "QueueContainer.h"
+#include "ProcSnapshot.h"
+#include <vector>
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Time between two scans (milliseconds), and the range accepted
+//
+#define PROC_POLL_DEFAULT_INTERVAL      250
+#define PROC_POLL_MIN_INTERVAL          10
+#define PROC_POLL_MAX_INTERVAL          60000
+
+//---------------------------------------------------------------------------
+//
+// class CProcPollMonitor
+//
+//---------------------------------------------------------------------------
+class CProcPollMonitor: public CCustomThread
+{
+public:
+	CProcPollMonitor(
+		const TCHAR*         pszThreadGuid,     // Thread unique ID
+		CQueueContainer*     pRequestManager,   // The underlying store
+		DWORD                dwScanInterval     // Milliseconds
+		);
+	virtual ~CProcPollMonitor();
+protected:
+	//
+	// A user supplied implementation of the thread function.
+	// Override Run() and insert the code that should be executed when
+	// the thread runs.
+	//
+	virtual void Run();
+	//
+	// Take the first snapshot, the processes already running aren't
+	// reported
+	//
+	virtual BOOL OnBeforeActivate();
+	//
+	// Scan /proc once and append what has changed to the queue
+	//
+	void ScanProcesses();
+	//
+	// The underlying store wrapped up by the custom template
+	//
+	CQueueContainer* m_pRequestManager;
+	//
+	// Time between two scans (milliseconds)
+	//
+	DWORD m_dwScanInterval;
+	//
+	// The processes seen by the last scan
+	//
+	CProcSnapshot m_Snapshot;
+	//
+	// Changes found by a scan and the items made of them, reused from
+	// scan to scan
+	//
+	vector<PROC_CHANGE> m_Changes;
+	vector<QUEUED_ITEM> m_Items;
+};
+
+#endif // !defined(_PROCPOLLMONITOR_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,276 @@
+//---------------------------------------------------------------------------
+//
+// ProcSnapshot.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Table of the running processes, kept up to date by diffing
+//              consecutive listings of /proc (Linux)
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ProcSnapshot.h"
+#include "ProcFs.h"
+#include <algorithm>
+#include <dirent.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+//
+// class CProcSnapshot
+//
+//---------------------------------------------------------------------------
+CProcSnapshot::CProcSnapshot():
+	m_bFilled(FALSE)
+{
+}
+
+CProcSnapshot::~CProcSnapshot()
+{
+}
+
+//
+// Number of processes in the table
+//
+DWORD CProcSnapshot::GetCount() const
+{
+	return (DWORD)m_Keys.size();
+}
+
+//
+// Forget all processes, the next scan starts over
+//
+void CProcSnapshot::Reset()
+{
+	m_Keys.clear();
+	m_ParentIds.clear();
+	m_StartTimes.clear();
+	m_bFilled = FALSE;
+}
+
+//
+// List /proc, one key per process directory
+//
+BOOL CProcSnapshot::ListProcesses(vector<ULONG64>& keys)
+{
+	DIR*           pDir = ::opendir("/proc");
+	struct dirent* pEntry;
+
+	if (NULL == pDir)
+		return FALSE;
+	while (NULL != (pEntry = ::readdir(pDir)))
+	{
+		const char* pszName     = pEntry->d_name;
+		DWORD       dwProcessId = 0;
+
+		if (('\0' == *pszName) || (DT_DIR != pEntry->d_type))
+			continue;
+		for (; ('0' <= *pszName) && ('9' >= *pszName); pszName++)
+			dwProcessId = dwProcessId * 10 + (*pszName - '0');
+		if ('\0' == *pszName)
+			keys.push_back(MakeKey(dwProcessId, pEntry->d_ino));
+	} // while
+	::closedir(pDir);
+
+	return TRUE;
+}
+
+//
+// Parent ID and start time of a process from /proc/<pid>/stat
+//
+BOOL CProcSnapshot::ReadProcess(
+	DWORD    dwProcessId,
+	PDWORD   pdwParentId,
+	ULONG64* pullStartTime
+	)
+{
+	return ReadProcessStat(dwProcessId, pdwParentId, pullStartTime);
+}
+
+//
+// Number of leading keys two arrays have in common
+//
+size_t CProcSnapshot::CountEqualKeys(
+	const ULONG64* pLeft,
+	const ULONG64* pRight,
+	size_t         nMax
+	)
+{
+	size_t n = 0;
+
+#if defined(__AVX2__)
+	for (; n + 4 <= nMax; n += 4)
+	{
+		__m256i equal = _mm256_cmpeq_epi64(
+			_mm256_loadu_si256((const __m256i*)(pLeft + n)),
+			_mm256_loadu_si256((const __m256i*)(pRight + n)));
+		if (-1 != _mm256_movemask_epi8(equal))
+			break;
+	} // for
+#elif defined(__SSE2__)
+	//
+	// No 64-bit compare before SSE4.1, equal bytes are as good
+	//
+	for (; n + 4 <= nMax; n += 4)
+	{
+		__m128i equal0 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i*)(pLeft + n)),
+			_mm_loadu_si128((const __m128i*)(pRight + n)));
+		__m128i equal1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i*)(pLeft + n + 2)),
+			_mm_loadu_si128((const __m128i*)(pRight + n + 2)));
+		if (0xFFFF != _mm_movemask_epi8(_mm_and_si128(equal0, equal1)))
+			break;
+	} // for
+#endif
+	while ((n < nMax) && (pLeft[n] == pRight[n]))
+		n++;
+
+	return n;
+}
+
+//
+// Add a process to the next table
+//
+void CProcSnapshot::AppendNext(
+	ULONG64 ullKey,
+	DWORD   dwParentId,
+	ULONG64 ullStartTime
+	)
+{
+	m_NextKeys.push_back(ullKey);
+	m_NextParentIds.push_back(dwParentId);
+	m_NextStartTimes.push_back(ullStartTime);
+}
+
+//
+// List /proc and find out what has changed
+//
+BOOL CProcSnapshot::Scan(vector<PROC_CHANGE>& changes)
+{
+	PROC_CHANGE change;
+	size_t      i = 0;
+	size_t      j = 0;
+
+	m_Listing.clear();
+	if (!ListProcesses(m_Listing))
+		return FALSE;
+	//
+	// The kernel lists the processes in the order of their IDs already
+	//
+	if (!std::is_sorted(m_Listing.begin(), m_Listing.end()))
+		std::sort(m_Listing.begin(), m_Listing.end());
+
+	m_NextKeys.clear();
+	m_NextParentIds.clear();
+	m_NextStartTimes.clear();
+	m_NextKeys.reserve(m_Listing.size());
+	m_NextParentIds.reserve(m_Listing.size());
+	m_NextStartTimes.reserve(m_Listing.size());
+
+	const size_t nOld = m_Keys.size();
+	const size_t nNew = m_Listing.size();
+
+	while (j < nNew)
+	{
+		//
+		// Unchanged processes are taken over as a whole run
+		//
+		if (i < nOld)
+		{
+			size_t nRun = CountEqualKeys(&m_Keys[i], &m_Listing[j], std::min(nOld - i, nNew - j));
+
+			if (0 != nRun)
+			{
+				m_NextKeys.insert(m_NextKeys.end(), m_Keys.begin() + i, m_Keys.begin() + i + nRun);
+				m_NextParentIds.insert(m_NextParentIds.end(), m_ParentIds.begin() + i, m_ParentIds.begin() + i + nRun);
+				m_NextStartTimes.insert(m_NextStartTimes.end(), m_StartTimes.begin() + i, m_StartTimes.begin() + i + nRun);
+				i += nRun;
+				j += nRun;
+				continue;
+			}
+		} // if
+
+		DWORD   dwProcessId  = GetKeyProcessId(m_Listing[j]);
+		DWORD   dwParentId   = 0;
+		ULONG64 ullStartTime = 0;
+		//
+		// A process listed before but not anymore has exited
+		//
+		if ((i < nOld) && (GetKeyProcessId(m_Keys[i]) < dwProcessId))
+		{
+			change.dwProcessId  = GetKeyProcessId(m_Keys[i]);
+			change.dwParentId   = m_ParentIds[i];
+			change.ullStartTime = m_StartTimes[i];
+			change.bCreate      = FALSE;
+			changes.push_back(change);
+			i++;
+			continue;
+		}
+		BOOL bAlive = ReadProcess(dwProcessId, &dwParentId, &ullStartTime);
+		//
+		// Same ID, another directory. Either the directory has been
+		// rebuilt, or the process has exited and the ID been reused.
+		//
+		if ((i < nOld) && (GetKeyProcessId(m_Keys[i]) == dwProcessId))
+		{
+			if (bAlive && (ullStartTime == m_StartTimes[i]))
+			{
+				AppendNext(m_Listing[j], m_ParentIds[i], ullStartTime);
+				i++;
+				j++;
+				continue;
+			}
+			change.dwProcessId  = dwProcessId;
+			change.dwParentId   = m_ParentIds[i];
+			change.ullStartTime = m_StartTimes[i];
+			change.bCreate      = FALSE;
+			changes.push_back(change);
+			i++;
+		} // if
+		//
+		// A process that has gone right after the listing is skipped
+		//
+		if (bAlive)
+		{
+			AppendNext(m_Listing[j], dwParentId, ullStartTime);
+			if (m_bFilled)
+			{
+				change.dwProcessId  = dwProcessId;
+				change.dwParentId   = dwParentId;
+				change.ullStartTime = ullStartTime;
+				change.bCreate      = TRUE;
+				changes.push_back(change);
+			}
+		} // if
+		j++;
+	} // while
+	for (; i < nOld; i++)
+	{
+		change.dwProcessId  = GetKeyProcessId(m_Keys[i]);
+		change.dwParentId   = m_ParentIds[i];
+		change.ullStartTime = m_StartTimes[i];
+		change.bCreate      = FALSE;
+		changes.push_back(change);
+	} // for
+
+	m_Keys.swap(m_NextKeys);
+	m_ParentIds.swap(m_NextParentIds);
+	m_StartTimes.swap(m_NextStartTimes);
+	m_bFilled = TRUE;
+
+	return TRUE;
+}
+
+//----------------------------End of the file -------------------------------
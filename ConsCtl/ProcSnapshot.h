@@ -0,0 +1,145 @@
+//---------------------------------------------------------------------------
+//
+// ProcSnapshot.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Table of the running processes, kept up to date by diffing
+//              consecutive listings of /proc (Linux)
+//
+// DESCRIPTION:
+//              Every process is keyed by its ID and the inode number of
+//              its /proc directory, both of which come with the directory
+//              listing. The table is sorted by key, as is the listing.
+//              Merging the two yields the processes that have exited and
+//              those that have been created. Runs of unchanged keys are
+//              compared 32 bytes at a time (SSE2, AVX2 if enabled), thus
+//              the common case costs little more than the listing itself.
+//
+//              Only keys that differ cause /proc/<pid>/stat to be read. A
+//              new inode number for a known ID may be the same process
+//              (the kernel has dropped and rebuilt its directory) or a new
+//              one that got the ID again; the start time tells which.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PROCSNAPSHOT_H_)
+#define _PROCSNAPSHOT_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// struct _ProcChange
+//
+// A process found created or exited
+//
+//---------------------------------------------------------------------------
+typedef struct _ProcChange
+{
+	DWORD   dwProcessId;
+	DWORD   dwParentId;
+	ULONG64 ullStartTime;  // Clock ticks after boot
+	BOOL    bCreate;
+} PROC_CHANGE, *PPROC_CHANGE;
+
+//---------------------------------------------------------------------------
+//
+// class CProcSnapshot
+//
+//---------------------------------------------------------------------------
+class CProcSnapshot
+{
+public:
+	CProcSnapshot();
+	virtual ~CProcSnapshot();
+	//
+	// List /proc and append what has changed since the previous call to
+	// changes, exits and creates in the order of the process IDs. The
+	// first call only fills the table. Returns FALSE if /proc couldn't
+	// be listed.
+	//
+	BOOL Scan(vector<PROC_CHANGE>& changes);
+	//
+	// Number of processes in the table
+	//
+	DWORD GetCount() const;
+	//
+	// Forget all processes, the next scan starts over
+	//
+	void Reset();
+protected:
+	//
+	// Fill keys with a key per process, see MakeKey(). The default
+	// implementation lists /proc.
+	//
+	virtual BOOL ListProcesses(vector<ULONG64>& keys);
+	//
+	// Parent ID and start time of a process, FALSE if it is gone. The
+	// default implementation reads /proc/<pid>/stat.
+	//
+	virtual BOOL ReadProcess(
+		DWORD    dwProcessId,
+		PDWORD   pdwParentId,
+		ULONG64* pullStartTime
+		);
+	//
+	// Sort key: the process ID above the low 32 bits of the inode number
+	//
+	static ULONG64 MakeKey(DWORD dwProcessId, ULONG64 ullInode)
+	{
+		return ((ULONG64)dwProcessId << 32) | (DWORD)ullInode;
+	}
+	static DWORD GetKeyProcessId(ULONG64 ullKey)
+	{
+		return (DWORD)(ullKey >> 32);
+	}
+private:
+	//
+	// Number of leading keys two arrays have in common, at most nMax
+	//
+	static size_t CountEqualKeys(
+		const ULONG64* pLeft,
+		const ULONG64* pRight,
+		size_t         nMax
+		);
+	//
+	// Add a process to the next table
+	//
+	void AppendNext(ULONG64 ullKey, DWORD dwParentId, ULONG64 ullStartTime);
+	//
+	// The table, one array per field. The keys are sorted.
+	//
+	vector<ULONG64> m_Keys;
+	vector<DWORD>   m_ParentIds;
+	vector<ULONG64> m_StartTimes;
+	//
+	// The table being built by a scan, swapped with the above when done
+	//
+	vector<ULONG64> m_NextKeys;
+	vector<DWORD>   m_NextParentIds;
+	vector<ULONG64> m_NextStartTimes;
+	//
+	// Keys of the current listing
+	//
+	vector<ULONG64> m_Listing;
+	//
+	// Whether the table has been filled
+	//
+	BOOL m_bFilled;
+};
+
+#endif // !defined(_PROCSNAPSHOT_H_)
+//----------------------------End of the file -------------------------------
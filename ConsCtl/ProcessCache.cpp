@@ -0,0 +1,323 @@
+//---------------------------------------------------------------------------
+//
+// ProcessCache.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Details of the processes seen, shared by the handlers
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ProcessCache.h"
+#if !defined(_WIN32)
+#include "ProcFs.h"
+#endif
+#include <assert.h>
+
+//---------------------------------------------------------------------------
+//
+// class CProcessCache
+//
+//---------------------------------------------------------------------------
+CProcessCache::CProcessCache(
+	CCallbackHandler* pHandler,
+	DWORD             dwMaxEntries
+	):
+	m_pHandler(pHandler),
+	m_dwMaxEntries(dwMaxEntries),
+	m_csCache(TEXT("process cache"))
+{
+	assert(NULL != m_pHandler);
+	if (0 == m_dwMaxEntries)
+		m_dwMaxEntries = 1;
+	m_itFirstExited = m_Processes.end();
+	::ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+CProcessCache::~CProcessCache()
+{
+}
+
+//
+// The process that had the ID at llTime
+//
+BOOL CProcessCache::Lookup(
+	DWORD         dwProcessId,
+	LONGLONG      llTime,
+	PROCESS_INFO& info,
+	wstring*      pCommandLine
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_csCache, TRUE);
+	PROCESS_INDEX::iterator it = Find(dwProcessId, llTime);
+
+	if (it == m_Index.end())
+	{
+		m_Stats.ullMisses++;
+		return FALSE;
+	}
+	m_Stats.ullHits++;
+	info = it->second->info;
+	if (NULL != pCommandLine)
+		*pCommandLine = it->second->commandLine;
+	//
+	// Exited processes stay in the order they exited
+	//
+	if (!info.bExited)
+		m_Processes.splice(m_Processes.begin(), m_Processes, it->second);
+
+	return TRUE;
+}
+
+//
+// Take a snapshot of the counters
+//
+void CProcessCache::GetStats(PROCESS_CACHE_STATS& stats)
+{
+	CLockMgr<CCSWrapper> guard(m_csCache, TRUE);
+
+	stats = m_Stats;
+	stats.dwEntries = (DWORD)m_Index.size();
+}
+
+//
+// A single event, handled like a batch of one
+//
+void CProcessCache::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	if (NULL != pQueuedItem)
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+}
+
+//
+// Take the batch down, then pass it on, with image IDs
+//
+void CProcessCache::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	{
+		CLockMgr<CCSWrapper> guard(m_csCache, TRUE);
+
+		for (DWORD i = 0; i < dwCount; i++)
+			Update(pQueuedItems[i]);
+	}
+	m_pHandler->OnProcessEvents(pQueuedItems, dwCount, pvParam);
+}
+
+//
+// Take a single event down, and tell it the image ID of its process
+//
+void CProcessCache::Update(QUEUED_ITEM& item)
+{
+	PROCESS_INDEX::iterator it;
+	PPROCESS_ENTRY          pEntry;
+	BOOL                    bCreate = 
+		((QUEUED_ITEM_PROCESS == item.eKind) && item.bCreate) ||
+		(QUEUED_ITEM_LIFETIME == item.eKind);
+
+	if (bCreate)
+	{
+		//
+		// The exit of the process that had the ID before has been lost
+		//
+		it = Find(item.hProcessId, item.llSourceTime);
+		if ((it != m_Index.end()) && !it->second->info.bExited)
+		{
+			it->second->info.bExited    = TRUE;
+			it->second->info.llExitTime = item.llSourceTime;
+			Retire(it->second);
+		}
+		pEntry = Insert(item.hProcessId, item.llSourceTime);
+		pEntry->info.dwParentId  = item.hParentId;
+		pEntry->info.dwSessionId = item.dwSessionId;
+		pEntry->info.dwImageId   = item.dwImageId;
+		CCommandLineTable::GetInstance().Resolve(item.dwCommandLineId, pEntry->commandLine);
+		//
+		// The child runs as its parent did
+		//
+		it = Find(item.hParentId, item.llSourceTime);
+		if ((it != m_Index.end()) && it->second->info.bUserKnown)
+		{
+			pEntry->info.bUserKnown     = TRUE;
+			pEntry->info.dwRealUid      = it->second->info.dwRealUid;
+			pEntry->info.dwEffectiveUid = it->second->info.dwEffectiveUid;
+		}
+		if ((STRING_TABLE_NO_ID == pEntry->info.dwImageId) && (QUEUED_ITEM_LIFETIME != item.eKind))
+			Query(pEntry);
+		item.dwImageId = pEntry->info.dwImageId;
+		if (QUEUED_ITEM_LIFETIME == item.eKind)
+		{
+			pEntry->info.bExited      = TRUE;
+			pEntry->info.llExitTime   = item.llExitTime;
+			pEntry->info.dwExitStatus = item.dwExitStatus;
+			Retire(m_Index[PROCESS_KEY(item.hProcessId, item.llSourceTime)]);
+		}
+		return;
+	}
+	it = Find(item.hProcessId, item.llSourceTime);
+	if (QUEUED_ITEM_PROCESS == item.eKind)
+	{
+		if (it == m_Index.end())
+			return;
+		item.dwImageId = it->second->info.dwImageId;
+		if (!it->second->info.bExited)
+		{
+			it->second->info.bExited      = TRUE;
+			it->second->info.llExitTime   = item.llSourceTime;
+			it->second->info.dwExitStatus = item.dwExitStatus;
+			Retire(it->second);
+		}
+		return;
+	}
+	//
+	// Any other event of a process not seen so far takes it down
+	//
+	if (it == m_Index.end())
+	{
+		pEntry = Insert(item.hProcessId, 0);
+		Query(pEntry);
+	}
+	else
+		pEntry = &*it->second;
+	if (QUEUED_ITEM_EXEC == item.eKind)
+	{
+		if (STRING_TABLE_NO_ID != item.dwImageId)
+			pEntry->info.dwImageId = item.dwImageId;
+		CCommandLineTable::GetInstance().Resolve(item.dwCommandLineId, pEntry->commandLine);
+	}
+	else if (QUEUED_ITEM_UID == item.eKind)
+	{
+		pEntry->info.bUserKnown     = TRUE;
+		pEntry->info.dwRealUid      = item.dwRealUid;
+		pEntry->info.dwEffectiveUid = item.dwEffectiveUid;
+	}
+	//
+	// An image load carries the path of the image loaded
+	//
+	if (QUEUED_ITEM_IMAGE_LOAD != item.eKind)
+		item.dwImageId = pEntry->info.dwImageId;
+}
+
+//
+// The process that had the ID at llTime: the last one started by then,
+// unless it had exited before
+//
+CProcessCache::PROCESS_INDEX::iterator CProcessCache::Find(
+	DWORD    dwProcessId,
+	LONGLONG llTime
+	)
+{
+	PROCESS_INDEX::iterator it = m_Index.upper_bound(PROCESS_KEY(dwProcessId, llTime));
+
+	if (it == m_Index.begin())
+		return m_Index.end();
+	--it;
+	if (it->first.first != dwProcessId)
+		return m_Index.end();
+	if (it->second->info.bExited && (llTime > it->second->info.llExitTime))
+		return m_Index.end();
+
+	return it;
+}
+
+//
+// Take a process down, making room first
+//
+CProcessCache::PPROCESS_ENTRY CProcessCache::Insert(
+	DWORD    dwProcessId,
+	LONGLONG llStartTime
+	)
+{
+	PROCESS_KEY             key(dwProcessId, llStartTime);
+	PROCESS_INDEX::iterator it = m_Index.find(key);
+
+	//
+	// A repeated create starts over
+	//
+	if (it != m_Index.end())
+	{
+		if (it->second == m_itFirstExited)
+			++m_itFirstExited;
+		m_Processes.erase(it->second);
+		m_Index.erase(it);
+	}
+	//
+	// Exited processes go first, the least recently used running one
+	// once there are none
+	//
+	while (m_Index.size() >= m_dwMaxEntries)
+	{
+		PROCESS_LIST::iterator itLast = --m_Processes.end();
+
+		if (itLast == m_itFirstExited)
+			m_itFirstExited = m_Processes.end();
+		m_Index.erase(PROCESS_KEY(itLast->info.dwProcessId, itLast->info.llStartTime));
+		m_Processes.erase(itLast);
+		m_Stats.ullEvicted++;
+	} // while
+	m_Processes.push_front(PROCESS_ENTRY());
+
+	PPROCESS_ENTRY pEntry = &m_Processes.front();
+
+	::ZeroMemory(&pEntry->info, sizeof(pEntry->info));
+	pEntry->info.dwProcessId = dwProcessId;
+	pEntry->info.llStartTime = llStartTime;
+	m_Index[key] = m_Processes.begin();
+	m_Stats.ullFilled++;
+
+	return pEntry;
+}
+
+//
+// Move a process that has exited in front of the exited ones
+//
+void CProcessCache::Retire(PROCESS_LIST::iterator itProcess)
+{
+	if (itProcess == m_itFirstExited)
+		return;
+	m_Processes.splice(m_itFirstExited, m_Processes, itProcess);
+	m_itFirstExited = itProcess;
+}
+
+//
+// Ask the system about a process the event had no details of
+//
+void CProcessCache::Query(PPROCESS_ENTRY pEntry)
+{
+	WCHAR szImagePath[MAX_PATH];
+
+	m_Stats.ullQueried++;
+#if defined(_WIN32)
+	GetProcessName(pEntry->info.dwProcessId, szImagePath, MAX_PATH);
+#else
+	WCHAR   szCommandLine[QUEUED_ITEM_MAX_COMMAND_LINE];
+	ULONG64 ullStartTime;
+
+	ReadProcessImage(pEntry->info.dwProcessId, szImagePath, MAX_PATH);
+	if (pEntry->commandLine.empty())
+	{
+		ReadProcessCommandLine(pEntry->info.dwProcessId, szCommandLine, QUEUED_ITEM_MAX_COMMAND_LINE);
+		pEntry->commandLine = szCommandLine;
+	}
+	if (0 == pEntry->info.dwParentId)
+		ReadProcessStat(pEntry->info.dwProcessId, &pEntry->info.dwParentId, &ullStartTime);
+#endif
+	pEntry->info.dwImageId = CStringTable::GetInstance().Intern(szImagePath);
+}
+
+//----------------------------End of the file -------------------------------
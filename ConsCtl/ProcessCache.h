@@ -0,0 +1,211 @@
+//---------------------------------------------------------------------------
+//
+// ProcessCache.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Details of the processes seen, shared by the handlers
+//
+// DESCRIPTION:
+//              CProcessCache is a handler wrapping another one. It takes
+//              down the details of every process (image, command line,
+//              parent, user) once, when the process is created, keeps
+//              them up to date with its exec() and user ID changes, and
+//              passes the events on. Handlers look the details up rather
+//              than asking the system again (OpenProcess(), PSAPI, /proc)
+//              for every event.
+//
+//              Process IDs are reused, thus a process is known by its ID
+//              and its start time, and Lookup() takes the time of the
+//              event: it finds the process that had the ID then, even if
+//              it has exited since. An exited process is kept until room
+//              is needed, before any running one. The cache is bounded;
+//              beyond the bound the least recently used process goes.
+//
+//              Processes that were running before they were seen being
+//              created are taken down the first time an event of theirs
+//              comes, with a start time of 0.
+//
+//              Image paths are kept in the string table
+//              (CStringTable::GetInstance()), the processes and the events
+//              passed on carry their IDs. Command lines are nearly all
+//              different; the cache copies the one an event brings in
+//              the command line table (CCommandLineTable::GetInstance())
+//              into the process it keeps, and Lookup() hands it out.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PROCESSCACHE_H_)
+#define _PROCESSCACHE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "CallbackHandler.h"
+#include "LockMgr.h"
+#include "StringTable.h"
+#include "CommandLineTable.h"
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Processes kept by default
+//
+#define PROCESS_CACHE_DEFAULT_SIZE      2048
+
+//---------------------------------------------------------------------------
+//
+// struct _ProcessInfo
+//
+//---------------------------------------------------------------------------
+typedef struct _ProcessInfo
+{
+	DWORD    dwProcessId;
+	DWORD    dwParentId;
+	LONGLONG llStartTime;       // Source time of the create, 0 if not seen
+	LONGLONG llExitTime;        // Source time of the exit, 0 while running
+	BOOL     bExited;
+	DWORD    dwExitStatus;
+	DWORD    dwSessionId;       // Windows
+	BOOL     bUserKnown;        // Linux, from the parent or a change
+	DWORD    dwRealUid;
+	DWORD    dwEffectiveUid;
+	DWORD    dwImageId;         // See CStringTable::GetInstance()
+} PROCESS_INFO, *PPROCESS_INFO;
+
+//---------------------------------------------------------------------------
+//
+// struct _ProcessCacheStats
+//
+//---------------------------------------------------------------------------
+typedef struct _ProcessCacheStats
+{
+	ULONG64 ullHits;        // Lookups answered
+	ULONG64 ullMisses;      // Lookups of processes not known
+	ULONG64 ullFilled;      // Processes taken down
+	ULONG64 ullQueried;     // Of those, the ones the system was asked about
+	ULONG64 ullEvicted;     // Processes dropped for room
+	DWORD   dwEntries;      // Processes kept
+} PROCESS_CACHE_STATS, *PPROCESS_CACHE_STATS;
+
+//---------------------------------------------------------------------------
+//
+// class CProcessCache
+//
+//---------------------------------------------------------------------------
+class CProcessCache: public CCallbackHandler
+{
+public:
+	CProcessCache(
+		CCallbackHandler* pHandler,
+		DWORD             dwMaxEntries = PROCESS_CACHE_DEFAULT_SIZE
+		);
+	virtual ~CProcessCache();
+	//
+	// The process that had the ID at llTime (QueryTimestamp() ticks,
+	// e.g. an event's llSourceTime), and its command line if asked for.
+	// Thread safe.
+	//
+	BOOL Lookup(
+		DWORD         dwProcessId,
+		LONGLONG      llTime,
+		PROCESS_INFO& info,
+		wstring*      pCommandLine = NULL
+		);
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(PROCESS_CACHE_STATS& stats);
+	//
+	// A single event, handled like a batch of one
+	//
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		);
+	//
+	// Take the batch down and give its events the image IDs of their
+	// processes, then pass it on
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+private:
+	//
+	// A process kept, with its own copy of its command line
+	//
+	typedef struct _ProcessEntry
+	{
+		PROCESS_INFO info;
+		wstring      commandLine;
+	} PROCESS_ENTRY, *PPROCESS_ENTRY;
+	//
+	// Processes by ID and start time
+	//
+	typedef pair<DWORD, LONGLONG>                   PROCESS_KEY;
+	typedef list<PROCESS_ENTRY>                     PROCESS_LIST;
+	typedef map<PROCESS_KEY, PROCESS_LIST::iterator> PROCESS_INDEX;
+	//
+	// Take a single event down, under m_csCache
+	//
+	void Update(QUEUED_ITEM& item);
+	//
+	// The process that had the ID at llTime, m_Index.end() if not known
+	//
+	PROCESS_INDEX::iterator Find(
+		DWORD    dwProcessId,
+		LONGLONG llTime
+		);
+	//
+	// Take a process down, making room first
+	//
+	PPROCESS_ENTRY Insert(
+		DWORD    dwProcessId,
+		LONGLONG llStartTime
+		);
+	//
+	// Move a process that has exited among the exited ones
+	//
+	void Retire(PROCESS_LIST::iterator itProcess);
+	//
+	// Ask the system about a process the event had no details of
+	//
+	void Query(PPROCESS_ENTRY pEntry);
+	//
+	// The actual handler
+	//
+	CCallbackHandler* m_pHandler;
+	DWORD             m_dwMaxEntries;
+	//
+	// Running processes, most recently used first, then the exited
+	// ones, most recently exited first, from m_itFirstExited on. Guarded
+	// by m_csCache, as are the counters.
+	//
+	PROCESS_LIST           m_Processes;
+	PROCESS_LIST::iterator m_itFirstExited;
+	PROCESS_INDEX          m_Index;
+	PROCESS_CACHE_STATS    m_Stats;
+	CCSWrapper             m_csCache;
+};
+
+#endif // !defined(_PROCESSCACHE_H_)
+//----------------------------End of the file -------------------------------
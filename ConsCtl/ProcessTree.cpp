@@ -0,0 +1,520 @@
+//---------------------------------------------------------------------------
+//
+// ProcessTree.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Parent/child relations of the processes seen
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ProcessTree.h"
+#include "LatencyHistogram.h"
+#if !defined(_WIN32)
+#include "ProcFs.h"
+#endif
+#include <algorithm>
+#include <assert.h>
+
+//---------------------------------------------------------------------------
+//
+// class CProcessTree
+//
+//---------------------------------------------------------------------------
+CProcessTree::CProcessTree(
+	CCallbackHandler* pHandler,
+	DWORD             dwRetention,
+	DWORD             dwMaxExited
+	):
+	m_pHandler(pHandler),
+	m_ullRetention((ULONG64)dwRetention * 1000000),
+	m_dwMaxExited(dwMaxExited),
+	m_dwFreeNode(PROCESS_TREE_NO_NODE),
+	m_dwUsedNodes(0),
+	m_dwFirstExited(PROCESS_TREE_NO_NODE),
+	m_dwLastExited(PROCESS_TREE_NO_NODE),
+	m_csTree(TEXT("process tree"))
+{
+	assert(NULL != m_pHandler);
+	::ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+CProcessTree::~CProcessTree()
+{
+	for (size_t i = 0; i < m_Chunks.size(); i++)
+		delete [] m_Chunks[i];
+}
+
+//
+// The process that has the ID now, or had it last
+//
+BOOL CProcessTree::GetProcess(
+	DWORD              dwProcessId,
+	PROCESS_NODE_INFO& info
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_csTree, TRUE);
+	DWORD dwNode = FindNode(dwProcessId);
+
+	if (PROCESS_TREE_NO_NODE == dwNode)
+		return FALSE;
+	GetInfo(dwNode, info);
+
+	return TRUE;
+}
+
+//
+// Whether dwAncestorId is up the chain of dwProcessId
+//
+BOOL CProcessTree::IsDescendant(
+	DWORD dwProcessId,
+	DWORD dwAncestorId
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_csTree, TRUE);
+	DWORD dwNode = FindNode(dwProcessId);
+
+	for (DWORD i = 0; (PROCESS_TREE_NO_NODE != dwNode) && (i < PROCESS_TREE_MAX_DEPTH); i++)
+	{
+		dwNode = GetNode(dwNode)->dwParent;
+		if ((PROCESS_TREE_NO_NODE != dwNode) && (dwAncestorId == GetNode(dwNode)->dwProcessId))
+			return TRUE;
+	} // for
+
+	return FALSE;
+}
+
+//
+// IDs of the ancestors of a process, parent first
+//
+DWORD CProcessTree::GetAncestors(
+	DWORD          dwProcessId,
+	vector<DWORD>& ancestors
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_csTree, TRUE);
+	DWORD dwNode = FindNode(dwProcessId);
+
+	ancestors.clear();
+	if (PROCESS_TREE_NO_NODE == dwNode)
+		return 0;
+	dwNode = GetNode(dwNode)->dwParent;
+	while ((PROCESS_TREE_NO_NODE != dwNode) && (ancestors.size() < PROCESS_TREE_MAX_DEPTH))
+	{
+		ancestors.push_back(GetNode(dwNode)->dwProcessId);
+		dwNode = GetNode(dwNode)->dwParent;
+	} // while
+
+	return (DWORD)ancestors.size();
+}
+
+//
+// The process and its descendants, depth first. Exited processes are
+// left out of a running only subtree, their descendants are not.
+//
+DWORD CProcessTree::GetSubtree(
+	DWORD                      dwProcessId,
+	vector<PROCESS_NODE_INFO>& nodes,
+	BOOL                       bRunningOnly
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_csTree, TRUE);
+	DWORD                dwNode = FindNode(dwProcessId);
+	vector<DWORD>        pending;
+
+	nodes.clear();
+	if (PROCESS_TREE_NO_NODE == dwNode)
+		return 0;
+	nodes.reserve(GetNode(dwNode)->dwDescendants + 1);
+	pending.push_back(dwNode);
+	while (!pending.empty())
+	{
+		PPROCESS_NODE pNode;
+
+		dwNode = pending.back();
+		pending.pop_back();
+		pNode = GetNode(dwNode);
+		if (!bRunningOnly || !pNode->bExited)
+		{
+			nodes.push_back(PROCESS_NODE_INFO());
+			GetInfo(dwNode, nodes.back());
+		}
+		for (DWORD dwChild = pNode->dwFirstChild;
+		     PROCESS_TREE_NO_NODE != dwChild;
+		     dwChild = GetNode(dwChild)->dwNextSibling)
+			pending.push_back(dwChild);
+	} // while
+
+	return (DWORD)nodes.size();
+}
+
+//
+// Take a snapshot of the counters
+//
+void CProcessTree::GetStats(PROCESS_TREE_STATS& stats)
+{
+	CLockMgr<CCSWrapper> guard(m_csTree, TRUE);
+
+	stats = m_Stats;
+	stats.ullPoolBytes = (ULONG64)m_Chunks.size() * sizeof(PROCESS_NODE) << PROCESS_TREE_CHUNK_SHIFT;
+}
+
+//
+// A single event, handled like a batch of one
+//
+void CProcessTree::OnProcessEvent(
+	PQUEUED_ITEM pQueuedItem,
+	PVOID        pvParam
+	)
+{
+	if (NULL != pQueuedItem)
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+}
+
+//
+// Take the batch down, then pass it on
+//
+void CProcessTree::OnProcessEvents(
+	PQUEUED_ITEM pQueuedItems,
+	DWORD        dwCount,
+	PVOID        pvParam
+	)
+{
+	{
+		CLockMgr<CCSWrapper> guard(m_csTree, TRUE);
+
+		for (DWORD i = 0; i < dwCount; i++)
+			Update(pQueuedItems[i]);
+		Expire();
+	}
+	m_pHandler->OnProcessEvents(pQueuedItems, dwCount, pvParam);
+}
+
+//
+// Parent of a process not seen being created
+//
+BOOL CProcessTree::QueryParent(
+	DWORD  dwProcessId,
+	PDWORD pdwParentId
+	)
+{
+#if defined(_WIN32)
+	UNREFERENCED_PARAMETER(dwProcessId);
+	UNREFERENCED_PARAMETER(pdwParentId);
+
+	return FALSE;
+#else
+	ULONG64 ullStartTime;
+
+	return ReadProcessStat(dwProcessId, pdwParentId, &ullStartTime);
+#endif
+}
+
+//
+// The node of the process that has the ID
+//
+DWORD CProcessTree::FindNode(DWORD dwProcessId) const
+{
+	unordered_map<DWORD, DWORD>::const_iterator it = m_Index.find(dwProcessId);
+
+	return (it != m_Index.end()) ? it->second : PROCESS_TREE_NO_NODE;
+}
+
+//
+// Take a single event down
+//
+void CProcessTree::Update(const QUEUED_ITEM& item)
+{
+	DWORD dwNode;
+
+	if (((QUEUED_ITEM_PROCESS == item.eKind) && item.bCreate) ||
+	    (QUEUED_ITEM_LIFETIME == item.eKind))
+	{
+		//
+		// The exit of the process that had the ID before has been lost
+		//
+		dwNode = FindNode(item.hProcessId);
+		if ((PROCESS_TREE_NO_NODE != dwNode) && !GetNode(dwNode)->bExited)
+			Exit(dwNode, item.llSourceTime);
+		dwNode = Insert(item.hProcessId, item.hParentId, item.llSourceTime);
+		if (QUEUED_ITEM_LIFETIME == item.eKind)
+			Exit(dwNode, item.llExitTime);
+		return;
+	}
+	if (QUEUED_ITEM_PROCESS != item.eKind)
+		return;
+	dwNode = FindNode(item.hProcessId);
+	if ((PROCESS_TREE_NO_NODE != dwNode) && !GetNode(dwNode)->bExited)
+		Exit(dwNode, item.llSourceTime);
+}
+
+//
+// Take a process down below its parent
+//
+DWORD CProcessTree::Insert(
+	DWORD    dwProcessId,
+	DWORD    dwParentId,
+	LONGLONG llStartTime
+	)
+{
+	DWORD dwParent = PROCESS_TREE_NO_NODE;
+
+	if ((0 != dwParentId) && (dwProcessId != dwParentId))
+		dwParent = FindParent(dwParentId);
+
+	DWORD         dwNode = AllocateNode();
+	PPROCESS_NODE pNode  = GetNode(dwNode);
+
+	::ZeroMemory(pNode, sizeof(*pNode));
+	pNode->dwProcessId   = dwProcessId;
+	pNode->dwParent      = PROCESS_TREE_NO_NODE;
+	pNode->dwFirstChild  = PROCESS_TREE_NO_NODE;
+	pNode->dwNextSibling = PROCESS_TREE_NO_NODE;
+	pNode->dwPrevSibling = PROCESS_TREE_NO_NODE;
+	pNode->dwNextExited  = PROCESS_TREE_NO_NODE;
+	pNode->llStartTime   = llStartTime;
+	if (PROCESS_TREE_NO_NODE != dwParent)
+		Link(dwNode, dwParent);
+	m_Index[dwProcessId] = dwNode;
+	m_Stats.ullInserted++;
+	m_Stats.dwNodes++;
+	m_Stats.dwRunning++;
+
+	return dwNode;
+}
+
+//
+// The node of a running parent. A parent not seen being created is taken
+// down now, after the ancestors it has that aren't there either, up to
+// one that is or to the top.
+//
+DWORD CProcessTree::FindParent(DWORD dwParentId)
+{
+	vector<DWORD> missing;
+	DWORD         dwProcessId = dwParentId;
+	DWORD         dwNode      = PROCESS_TREE_NO_NODE;
+
+	while (missing.size() < PROCESS_TREE_MAX_DEPTH)
+	{
+		DWORD dwGrandParentId = 0;
+
+		dwNode = FindNode(dwProcessId);
+		if ((PROCESS_TREE_NO_NODE != dwNode) && !GetNode(dwNode)->bExited)
+			break;
+		dwNode = PROCESS_TREE_NO_NODE;
+		missing.push_back(dwProcessId);
+		m_Stats.ullQueried++;
+		if (!QueryParent(dwProcessId, &dwGrandParentId) ||
+		    (0 == dwGrandParentId) ||
+		    (missing.end() != find(missing.begin(), missing.end(), dwGrandParentId)))
+			break;
+		dwProcessId = dwGrandParentId;
+	} // while
+	//
+	// From the top down, each one below the one taken down before
+	//
+	for (size_t i = missing.size(); i-- > 0; )
+	{
+		DWORD dwAbove = dwNode;
+
+		dwNode = Insert(missing[i], 0, 0);
+		if (PROCESS_TREE_NO_NODE != dwAbove)
+			Link(dwNode, dwAbove);
+	} // for
+
+	return dwNode;
+}
+
+//
+// Make a root the first child of a parent, and count it in with all the
+// parent's ancestors
+//
+void CProcessTree::Link(
+	DWORD dwNode,
+	DWORD dwParent
+	)
+{
+	PPROCESS_NODE pNode   = GetNode(dwNode);
+	PPROCESS_NODE pParent = GetNode(dwParent);
+
+	pNode->dwParent      = dwParent;
+	pNode->dwNextSibling = pParent->dwFirstChild;
+	if (PROCESS_TREE_NO_NODE != pParent->dwFirstChild)
+		GetNode(pParent->dwFirstChild)->dwPrevSibling = dwNode;
+	pParent->dwFirstChild = dwNode;
+	for (DWORD i = 0; (PROCESS_TREE_NO_NODE != dwParent) && (i < PROCESS_TREE_MAX_DEPTH); i++)
+	{
+		pParent = GetNode(dwParent);
+		pParent->dwDescendants++;
+		pParent->dwRunningDescendants++;
+		dwParent = pParent->dwParent;
+	} // for
+}
+
+//
+// Mark a process exited, count it out of the running descendants of its
+// ancestors and queue it for removal
+//
+void CProcessTree::Exit(
+	DWORD    dwNode,
+	LONGLONG llExitTime
+	)
+{
+	PPROCESS_NODE pNode    = GetNode(dwNode);
+	DWORD         dwParent = pNode->dwParent;
+
+	pNode->bExited    = TRUE;
+	pNode->llExitTime = llExitTime;
+	for (DWORD i = 0; (PROCESS_TREE_NO_NODE != dwParent) && (i < PROCESS_TREE_MAX_DEPTH); i++)
+	{
+		PPROCESS_NODE pParent = GetNode(dwParent);
+
+		pParent->dwRunningDescendants--;
+		dwParent = pParent->dwParent;
+	} // for
+	pNode->dwNextExited = PROCESS_TREE_NO_NODE;
+	if (PROCESS_TREE_NO_NODE != m_dwLastExited)
+		GetNode(m_dwLastExited)->dwNextExited = dwNode;
+	else
+		m_dwFirstExited = dwNode;
+	m_dwLastExited = dwNode;
+	m_Stats.dwRunning--;
+	m_Stats.dwExited++;
+}
+
+//
+// Drop the exited processes beyond the window, and the oldest ones beyond
+// the bound. Those with descendants linger until the last has gone.
+//
+void CProcessTree::Expire()
+{
+	LONGLONG llNow = QueryTimestamp();
+
+	while (PROCESS_TREE_NO_NODE != m_dwFirstExited)
+	{
+		DWORD         dwNode = m_dwFirstExited;
+		PPROCESS_NODE pNode  = GetNode(dwNode);
+
+		if ((m_Stats.dwExited <= m_dwMaxExited) &&
+		    ((llNow <= pNode->llExitTime) ||
+		     (TimestampToNanoseconds(llNow - pNode->llExitTime) < m_ullRetention)))
+			break;
+		m_dwFirstExited = pNode->dwNextExited;
+		if (PROCESS_TREE_NO_NODE == m_dwFirstExited)
+			m_dwLastExited = PROCESS_TREE_NO_NODE;
+		m_Stats.dwExited--;
+		if (PROCESS_TREE_NO_NODE != pNode->dwFirstChild)
+		{
+			pNode->bLingering = TRUE;
+			m_Stats.dwLingering++;
+		}
+		else
+			Remove(dwNode);
+	} // while
+}
+
+//
+// Unlink a process without children and give its node back. A parent
+// that lingered for it goes too, once it was the last child.
+//
+void CProcessTree::Remove(DWORD dwNode)
+{
+	while (PROCESS_TREE_NO_NODE != dwNode)
+	{
+		PPROCESS_NODE pNode    = GetNode(dwNode);
+		DWORD         dwParent = pNode->dwParent;
+
+		assert(PROCESS_TREE_NO_NODE == pNode->dwFirstChild);
+		if (PROCESS_TREE_NO_NODE != pNode->dwPrevSibling)
+			GetNode(pNode->dwPrevSibling)->dwNextSibling = pNode->dwNextSibling;
+		else if (PROCESS_TREE_NO_NODE != dwParent)
+			GetNode(dwParent)->dwFirstChild = pNode->dwNextSibling;
+		if (PROCESS_TREE_NO_NODE != pNode->dwNextSibling)
+			GetNode(pNode->dwNextSibling)->dwPrevSibling = pNode->dwPrevSibling;
+		for (DWORD i = 0, dwAncestor = dwParent;
+		     (PROCESS_TREE_NO_NODE != dwAncestor) && (i < PROCESS_TREE_MAX_DEPTH);
+		     i++)
+		{
+			PPROCESS_NODE pAncestor = GetNode(dwAncestor);
+
+			pAncestor->dwDescendants--;
+			dwAncestor = pAncestor->dwParent;
+		} // for
+		//
+		// The ID may have gone to another process meanwhile
+		//
+		unordered_map<DWORD, DWORD>::iterator it = m_Index.find(pNode->dwProcessId);
+		if ((it != m_Index.end()) && (dwNode == it->second))
+			m_Index.erase(it);
+		if (pNode->bLingering)
+			m_Stats.dwLingering--;
+		FreeNode(dwNode);
+		m_Stats.dwNodes--;
+		m_Stats.ullRemoved++;
+		dwNode = PROCESS_TREE_NO_NODE;
+		if ((PROCESS_TREE_NO_NODE != dwParent) &&
+		    GetNode(dwParent)->bLingering &&
+		    (PROCESS_TREE_NO_NODE == GetNode(dwParent)->dwFirstChild))
+			dwNode = dwParent;
+	} // while
+}
+
+//
+// Take a node from the free chain, or from the last chunk, adding one
+// when it is full
+//
+DWORD CProcessTree::AllocateNode()
+{
+	DWORD dwNode = m_dwFreeNode;
+
+	if (PROCESS_TREE_NO_NODE != dwNode)
+	{
+		m_dwFreeNode = GetNode(dwNode)->dwNextSibling;
+		return dwNode;
+	}
+	if (m_dwUsedNodes == (DWORD)(m_Chunks.size() << PROCESS_TREE_CHUNK_SHIFT))
+		m_Chunks.push_back(new PROCESS_NODE[1 << PROCESS_TREE_CHUNK_SHIFT]);
+
+	return m_dwUsedNodes++;
+}
+
+//
+// Give a node back to the free chain
+//
+void CProcessTree::FreeNode(DWORD dwNode)
+{
+	GetNode(dwNode)->dwNextSibling = m_dwFreeNode;
+	m_dwFreeNode = dwNode;
+}
+
+//
+// Fill in the info of a node
+//
+void CProcessTree::GetInfo(
+	DWORD              dwNode,
+	PROCESS_NODE_INFO& info
+	) const
+{
+	PPROCESS_NODE pNode = GetNode(dwNode);
+
+	info.dwProcessId          = pNode->dwProcessId;
+	info.dwParentId           = 0;
+	if (PROCESS_TREE_NO_NODE != pNode->dwParent)
+		info.dwParentId = GetNode(pNode->dwParent)->dwProcessId;
+	info.llStartTime          = pNode->llStartTime;
+	info.llExitTime           = pNode->llExitTime;
+	info.bExited              = pNode->bExited;
+	info.dwDescendants        = pNode->dwDescendants;
+	info.dwRunningDescendants = pNode->dwRunningDescendants;
+}
+
+//----------------------------End of the file -------------------------------
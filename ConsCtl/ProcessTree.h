@@ -0,0 +1,296 @@
+//---------------------------------------------------------------------------
+//
+// ProcessTree.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Parent/child relations of the processes seen
+//
+// DESCRIPTION:
+//              CProcessTree is a handler wrapping another one. It links
+//              every process created to its parent (hParentId), keeps
+//              the number of descendants of every process up to date as
+//              processes are created and exit, and passes the events on.
+//              Handlers ask it whether a process descends from another,
+//              for its ancestors or for its subtree rather than walking
+//              the system's process list every time.
+//
+//              Processes live in a pool of nodes allocated a chunk at a
+//              time and linked by their index in the pool; a map finds
+//              the node of the process that has an ID now. Exited
+//              processes are kept for a while (the retention window),
+//              and at most a number of them; once they go, those that
+//              still have descendants kept stay until the last of them
+//              has gone, thus a chain of ancestors never breaks.
+//
+//              Parents not seen being created are taken down as they are
+//              first needed, with their own ancestors (read from /proc
+//              on Linux), and stay as long as they run.
+//
+//---------------------------------------------------------------------------
+#if !defined(_PROCESSTREE_H_)
+#define _PROCESSTREE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "CallbackHandler.h"
+#include "LockMgr.h"
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Exited processes are kept for a minute by default, 64K of them at most
+//
+#define PROCESS_TREE_DEFAULT_RETENTION  60000
+#define PROCESS_TREE_DEFAULT_MAX_EXITED 65536
+//
+// Nodes per chunk of the pool (as a shift), and the index of no node
+//
+#define PROCESS_TREE_CHUNK_SHIFT        12
+#define PROCESS_TREE_NO_NODE            ((DWORD)-1)
+//
+// Ancestors followed at most, against a chain looping through a reused
+// process ID
+//
+#define PROCESS_TREE_MAX_DEPTH          1024
+
+//---------------------------------------------------------------------------
+//
+// struct _ProcessNodeInfo
+//
+//---------------------------------------------------------------------------
+typedef struct _ProcessNodeInfo
+{
+	DWORD    dwProcessId;
+	DWORD    dwParentId;            // 0 if not known
+	LONGLONG llStartTime;           // Source time of the create, 0 if not seen
+	LONGLONG llExitTime;            // Source time of the exit, 0 while running
+	BOOL     bExited;
+	DWORD    dwDescendants;         // Kept in the tree, running or not
+	DWORD    dwRunningDescendants;
+} PROCESS_NODE_INFO, *PPROCESS_NODE_INFO;
+
+//---------------------------------------------------------------------------
+//
+// struct _ProcessTreeStats
+//
+//---------------------------------------------------------------------------
+typedef struct _ProcessTreeStats
+{
+	DWORD   dwNodes;        // Processes in the tree
+	DWORD   dwRunning;      // Of those, running
+	DWORD   dwExited;       // Exited, within the window
+	DWORD   dwLingering;    // Exited, beyond the window but with descendants
+	ULONG64 ullInserted;    // Processes taken down
+	ULONG64 ullQueried;     // Of those, parents asked the system about
+	ULONG64 ullRemoved;     // Exited processes dropped
+	ULONG64 ullPoolBytes;   // Taken by the node pool
+} PROCESS_TREE_STATS, *PPROCESS_TREE_STATS;
+
+//---------------------------------------------------------------------------
+//
+// class CProcessTree
+//
+//---------------------------------------------------------------------------
+class CProcessTree: public CCallbackHandler
+{
+public:
+	CProcessTree(
+		CCallbackHandler* pHandler,
+		DWORD             dwRetention = PROCESS_TREE_DEFAULT_RETENTION,   // Milliseconds
+		DWORD             dwMaxExited = PROCESS_TREE_DEFAULT_MAX_EXITED
+		);
+	virtual ~CProcessTree();
+	//
+	// The process that has the ID now, or had it last. Thread safe, as
+	// are the other queries.
+	//
+	BOOL GetProcess(
+		DWORD              dwProcessId,
+		PROCESS_NODE_INFO& info
+		);
+	//
+	// Whether a process with the ID dwAncestorId is up the chain of the
+	// process that has the ID dwProcessId
+	//
+	BOOL IsDescendant(
+		DWORD dwProcessId,
+		DWORD dwAncestorId
+		);
+	//
+	// IDs of the ancestors of a process kept in the tree, parent first.
+	// Returns their number.
+	//
+	DWORD GetAncestors(
+		DWORD          dwProcessId,
+		vector<DWORD>& ancestors
+		);
+	//
+	// The process and its descendants, depth first, the running ones
+	// only if asked so. Returns their number.
+	//
+	DWORD GetSubtree(
+		DWORD                      dwProcessId,
+		vector<PROCESS_NODE_INFO>& nodes,
+		BOOL                       bRunningOnly = FALSE
+		);
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(PROCESS_TREE_STATS& stats);
+	//
+	// A single event, handled like a batch of one
+	//
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		);
+	//
+	// Take the creates and exits of the batch down, drop the exited
+	// processes that have had their time, then pass the batch on
+	//
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		);
+protected:
+	//
+	// Parent of a process not seen being created, FALSE if not known.
+	// The default implementation reads /proc/<pid>/stat on Linux.
+	//
+	virtual BOOL QueryParent(
+		DWORD  dwProcessId,
+		PDWORD pdwParentId
+		);
+private:
+	//
+	// A process in the pool. Nodes are linked by their index: to the
+	// parent, to the first child and to the siblings. Free nodes are
+	// chained through dwNextSibling, exited ones in the order they
+	// exited through dwNextExited.
+	//
+	typedef struct _ProcessNode
+	{
+		DWORD    dwProcessId;
+		DWORD    dwParent;
+		DWORD    dwFirstChild;
+		DWORD    dwNextSibling;
+		DWORD    dwPrevSibling;
+		DWORD    dwNextExited;
+		DWORD    dwDescendants;
+		DWORD    dwRunningDescendants;
+		LONGLONG llStartTime;
+		LONGLONG llExitTime;
+		BYTE     bExited;
+		BYTE     bLingering;        // Beyond the window, waiting for its descendants
+	} PROCESS_NODE, *PPROCESS_NODE;
+	//
+	// The node at an index of the pool
+	//
+	PPROCESS_NODE GetNode(DWORD dwNode) const
+	{
+		return &m_Chunks[dwNode >> PROCESS_TREE_CHUNK_SHIFT][dwNode & ((1 << PROCESS_TREE_CHUNK_SHIFT) - 1)];
+	}
+	//
+	// The node of the process that has the ID, PROCESS_TREE_NO_NODE if
+	// none
+	//
+	DWORD FindNode(DWORD dwProcessId) const;
+	//
+	// Take a single event down, under m_csTree
+	//
+	void Update(const QUEUED_ITEM& item);
+	//
+	// Take a process down below its parent
+	//
+	DWORD Insert(
+		DWORD    dwProcessId,
+		DWORD    dwParentId,
+		LONGLONG llStartTime
+		);
+	//
+	// The node of a parent, taken down with its ancestors if need be
+	//
+	DWORD FindParent(DWORD dwParentId);
+	//
+	// Make a root the first child of a parent
+	//
+	void Link(
+		DWORD dwNode,
+		DWORD dwParent
+		);
+	//
+	// Mark a process exited and queue it for removal
+	//
+	void Exit(
+		DWORD    dwNode,
+		LONGLONG llExitTime
+		);
+	//
+	// Drop the exited processes beyond the window or the bound
+	//
+	void Expire();
+	//
+	// Drop a process without children, then its ancestors waiting for
+	// it
+	//
+	void Remove(DWORD dwNode);
+	//
+	// Take a node from the pool, and give it back
+	//
+	DWORD AllocateNode();
+	void FreeNode(DWORD dwNode);
+	//
+	// Fill in the info of a node
+	//
+	void GetInfo(
+		DWORD              dwNode,
+		PROCESS_NODE_INFO& info
+		) const;
+	//
+	// The actual handler
+	//
+	CCallbackHandler* m_pHandler;
+	ULONG64           m_ullRetention;    // Nanoseconds
+	DWORD             m_dwMaxExited;
+	//
+	// The pool, a chunk at a time, and the chain of free nodes. Guarded
+	// by m_csTree, as is all the rest.
+	//
+	vector<PPROCESS_NODE> m_Chunks;
+	DWORD                 m_dwFreeNode;
+	DWORD                 m_dwUsedNodes;     // Nodes taken from the chunks so far
+	//
+	// Processes by ID, the ones that have the ID now or had it last
+	//
+	unordered_map<DWORD, DWORD> m_Index;
+	//
+	// Exited processes within the window, in the order they exited
+	//
+	DWORD m_dwFirstExited;
+	DWORD m_dwLastExited;
+
+	PROCESS_TREE_STATS m_Stats;
+	CCSWrapper         m_csTree;
+};
+
+#endif // !defined(_PROCESSTREE_H_)
+//----------------------------End of the file -------------------------------
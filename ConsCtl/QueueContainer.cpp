@@ -20,9 +20,49 @@
 //
 //---------------------------------------------------------------------------
 
-#include "common.h"
+#include "Common.h"
 #include "QueueContainer.h"
 
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+
+//
+// Elements taken off the lock-free queue for a single batch callback
+//
+#define QUEUE_LOCK_FREE_BATCH           256
+
+//
+// Capacity of a batch kept after a burst; larger ones are freed
+//
+#define QUEUE_BATCH_KEEP                4096
+
+//
+// Elements dropped off the front of the locked queue before it is
+// compacted, at least, and as a share of the bound (1/8)
+//
+#define QUEUE_COMPACT_MIN               64
+#define QUEUE_COMPACT_SHIFT             3
+
+//
+// Coalescing scans the whole queue, thus only when that removes at
+// least 1/32 of it
+//
+#define QUEUE_COALESCE_RATIO            32
+
+//
+// How often (milliseconds) a producer waiting for room checks whether
+// the retrieval thread still runs
+//
+#define QUEUE_BLOCK_POLL                10
+
+//
+// No element (CoalesceLifetimes())
+//
+#define QUEUE_NO_INDEX                  ((DWORD)-1)
+
 //---------------------------------------------------------------------------
 //
 // class CQueueContainer
@@ -32,9 +72,30 @@
 //
 // Queue's constructor
 //
-CQueueContainer::CQueueContainer(CCallbackHandler* pHandler):
-	m_pHandler(pHandler)
+CQueueContainer::CQueueContainer(
+	CCallbackHandler*    pHandler,
+	QUEUE_IMPLEMENTATION eImplementation
+	):
+	m_nQueueFirst(0),
+	m_dwPairsQueued(0),
+	m_dwCapacity(0),
+	m_eOverflowPolicy(QUEUE_OVERFLOW_DROP_NEWEST),
+	m_bCoalesceLifetimes(FALSE),
+	m_pLockFreeQueue(NULL),
+	m_pHandler(pHandler),
+	m_csStats(TEXT("queue stats")),
+	m_bInline(QUEUE_INLINE == eImplementation),
+	m_bInlineActive(FALSE),
+	m_csInline(TEXT("inline delivery"))
 {
+	::ZeroMemory((PBYTE)&m_Stats, sizeof(m_Stats));
+	::ZeroMemory((PBYTE)&m_ConsumerStats, sizeof(m_ConsumerStats));
+	::ZeroMemory((PBYTE)&m_PublishedStats, sizeof(m_PublishedStats));
+	if (QUEUE_LOCK_FREE == eImplementation)
+	{
+		m_pLockFreeQueue = new CMpscQueue();
+		m_Batch.resize(QUEUE_LOCK_FREE_BATCH);
+	}
 	Init();
 }
 
@@ -94,6 +155,13 @@ HANDLE CQueueContainer::Get_ElementAvailableHandle() const
 BOOL CQueueContainer::StartReceivingNotifications()
 {
 	BOOL bResult = FALSE;
+	if (m_bInline)
+	{
+		CLockMgr<CCSWrapper> guard(m_csInline, TRUE);
+		bResult = !m_bInlineActive;
+		m_bInlineActive = TRUE;
+		return bResult;
+	}
 	if (!m_pRetrievalThread->GetIsActive())
 	{
 		m_pRetrievalThread->SetActive( TRUE );
@@ -107,8 +175,25 @@ BOOL CQueueContainer::StartReceivingNotifications()
 //
 void CQueueContainer::StopReceivingNotifications()
 {
+	if (m_bInline)
+	{
+		//
+		// Taken once the handler has returned
+		//
+		CLockMgr<CCSWrapper> guard(m_csInline, TRUE);
+		m_bInlineActive = FALSE;
+		return;
+	}
 	if (m_pRetrievalThread->GetIsActive())
+	{
 		::SetEvent(m_evtShutdownRemove);
+		//
+		// Wait until the thread is done, thus the handler doesn't get 
+		// called any more once this returns
+		//
+		while (m_pRetrievalThread->GetIsActive())
+			::Sleep(1);
+	}
 }
 
 //
@@ -131,6 +216,11 @@ void CQueueContainer::Init()
 	m_evtShutdownRemove = ::CreateEvent(NULL, FALSE, FALSE, NULL);
 	assert(NULL != m_evtShutdownRemove);
 	//
+	// And one for producers waiting for room
+	//
+	m_evtSpaceAvailable = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	assert(NULL != m_evtSpaceAvailable);
+	//
 	// Create a thread for picking up posted in the queue item notifications
 	//
 	m_pRetrievalThread = new CRetrievalThread(
@@ -150,24 +240,103 @@ void CQueueContainer::Done()
 		::CloseHandle(m_evtElementAvailable);
 	if (NULL != m_evtShutdownRemove)
 		::CloseHandle(m_evtShutdownRemove);
+	if (NULL != m_evtSpaceAvailable)
+		::CloseHandle(m_evtSpaceAvailable);
 	if (NULL != m_mtxMonitor)
 		::CloseHandle(m_mtxMonitor);
+	delete m_pLockFreeQueue;
 }
 	
 //
 // Insert data into the queue
 //
 BOOL CQueueContainer::Append(const QUEUED_ITEM& element)
+{
+	return AppendBatch(&element, 1);
+}
+
+//
+// Insert a number of elements at once
+//
+BOOL CQueueContainer::AppendBatch(
+	const QUEUED_ITEM* pElements,
+	DWORD              dwCount
+	)
 {
 	BOOL bResult = FALSE;
+
+	if (m_bInline)
+		return DeliverInline(pElements, dwCount);
+	//
+	// No lock, and the retrieval thread gets woken up only if it waits
+	//
+	if (NULL != m_pLockFreeQueue)
+	{
+		if (0 != m_dwCapacity)
+		{
+			//
+			// Append what fits, as long as the retrieval thread runs
+			//
+			while ((m_pLockFreeQueue->GetDepth() + dwCount > m_dwCapacity) &&
+			       (QUEUE_OVERFLOW_BLOCK == m_eOverflowPolicy))
+			{
+				DWORD dwDepth = m_pLockFreeQueue->GetDepth();
+				DWORD dwRoom  = (dwDepth < m_dwCapacity) ? m_dwCapacity - dwDepth : 0;
+
+				//
+				// The retrieval thread may have made room meanwhile
+				//
+				if (dwRoom > dwCount)
+					dwRoom = dwCount;
+				if (0 != dwRoom)
+				{
+					if (m_pLockFreeQueue->PushBatch(pElements, dwRoom, QueryTimestamp()))
+						::SetEvent(m_evtElementAvailable);
+					pElements += dwRoom;
+					dwCount   -= dwRoom;
+				}
+				if (!WaitForLockFreeRoom())
+					break;
+			} // while
+			DWORD dwDepth = m_pLockFreeQueue->GetDepth();
+			DWORD dwRoom  = (dwDepth < m_dwCapacity) ? m_dwCapacity - dwDepth : 0;
+			if (dwCount > dwRoom)
+			{
+				AddDropped(dwCount - dwRoom);
+				dwCount = dwRoom;
+			}
+		} // if
+		if (m_pLockFreeQueue->PushBatch(pElements, dwCount, QueryTimestamp()))
+			::SetEvent(m_evtElementAvailable);
+		return TRUE;
+	}
 	DWORD dw = ::WaitForSingleObject(m_mtxMonitor, INFINITE);
 	bResult = (WAIT_OBJECT_0 == dw);
 	if (bResult)
 	{
-		//
-		// Add it to the STL queue
-		//
-		m_Queue.push_back(element);
+		LONGLONG llEnqueueTime = QueryTimestamp();
+
+		for (DWORD i = 0; i < dwCount; i++)
+		{
+			const QUEUED_ITEM& element = pElements[i];
+
+			m_Stats.ullReceived++;
+			CountSequence(m_Stats, element.ullSequence);
+			//
+			// A full queue waits, makes room or drops the element
+			//
+			if ((0 != m_dwCapacity) &&
+			    (GetLockedDepth() >= m_dwCapacity) &&
+			    !MakeRoom(element))
+				continue;
+			//
+			// Add it to the STL queue
+			//
+			m_Queue.push_back(element);
+			m_Queue.back().llEnqueueTime = llEnqueueTime;
+			if ((QUEUE_OVERFLOW_COALESCE == m_eOverflowPolicy) && (0 != m_dwCapacity))
+				CountQueuedProcess(element);
+		} // for
 		//
 		// Notify the waiting thread that there is 
 		// available element in the queue for processing 
@@ -178,31 +347,91 @@ BOOL CQueueContainer::Append(const QUEUED_ITEM& element)
 	return bResult;
 }
 
+//
+// Hand the elements appended over right away. They are copied, the
+// delivery stamps them and may fold them up.
+//
+BOOL CQueueContainer::DeliverInline(
+	const QUEUED_ITEM* pElements,
+	DWORD              dwCount
+	)
+{
+	CLockMgr<CCSWrapper> guard(m_csInline, TRUE);
+
+	if (!m_bInlineActive)
+		return FALSE;
+	if (0 == dwCount)
+		return TRUE;
+
+	LONGLONG llNow = QueryTimestamp();
+
+	m_Batch.assign(pElements, pElements + dwCount);
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		m_Batch[i].llEnqueueTime = llNow;
+		m_Batch[i].llDequeueTime = llNow;
+		CountSequence(m_ConsumerStats, m_Batch[i].ullSequence);
+	} // for
+	m_ConsumerStats.ullReceived  += dwCount;
+	m_ConsumerStats.ullDelivered += dwCount;
+	{
+		CLockMgr<CCSWrapper> statsGuard(m_csStats, TRUE);
+		m_PublishedStats = m_ConsumerStats;
+	}
+	DeliverBatch(&m_Batch[0], dwCount);
+	m_Batch.clear();
+	if (m_Batch.capacity() > QUEUE_BATCH_KEEP)
+		vector<QUEUED_ITEM>().swap(m_Batch);
+
+	return TRUE;
+}
+
+//
+// Whether the events are being handed over to the callback handler
+//
+BOOL CQueueContainer::IsReceiving()
+{
+	if (m_bInline)
+	{
+		CLockMgr<CCSWrapper> guard(m_csInline, TRUE);
+		return m_bInlineActive;
+	}
+	return m_pRetrievalThread->GetIsActive();
+}
+
 //
 // Implement specific behavior when kernel mode driver notifies 
 // the user-mode app
 //
 void CQueueContainer::DoOnProcessCreatedTerminated()
 {
-	QUEUED_ITEM element;
-	// Initially we have atleast one element for processing
-	BOOL bRemoveFromQueue = TRUE;
-	while (bRemoveFromQueue)
+	if (NULL != m_pLockFreeQueue)
+	{
+		DrainLockFreeQueue();
+		return;
+	}
+	size_t nFirst = 0;
+
+	while (TRUE)
 	{
 		DWORD dwResult = ::WaitForSingleObject(
 			m_mtxMonitor, INFINITE
 			);
 		if (WAIT_OBJECT_0 == dwResult)
 		{
-			bRemoveFromQueue = (m_Queue.size() > 0); 
-			// Is there anything in the queue
-			if (bRemoveFromQueue)
-			{
-				// Get the element from the queue
-				element = m_Queue.front();	
-				m_Queue.pop_front();
-			} // if
-			else
+			//
+			// Take all the pending elements at once. The queue gets the
+			// emptied batch back, thus neither reallocates once warm.
+			//
+			m_Queue.swap(m_Batch);
+			nFirst = m_nQueueFirst;
+			m_nQueueFirst = 0;
+			m_QueuedCreates.clear();
+			m_dwPairsQueued = 0;
+			m_Stats.ullDelivered += m_Batch.size() - nFirst;
+			if (0 != m_dwCapacity)
+				::SetEvent(m_evtSpaceAvailable);
+			if (m_Batch.empty())
 				//
 				// Let's make sure that the event hasn't been 
 				// left in signaled state if there are no items 
@@ -211,40 +440,562 @@ void CQueueContainer::DoOnProcessCreatedTerminated()
 				::ResetEvent(m_evtElementAvailable);
 		} // if
 		::ReleaseMutex(m_mtxMonitor);
-		//
-		// Process it only there is an element that has 
-		// been picked up
-		//
-		if (bRemoveFromQueue)	
-			m_pHandler->OnProcessEvent( &element, m_pvParam );
-		else
+		if (m_Batch.empty())
 			break;
+
+		LONGLONG llDequeueTime = QueryTimestamp();
+		for (size_t i = nFirst; i < m_Batch.size(); i++)
+			m_Batch[i].llDequeueTime = llDequeueTime;
+		if (nFirst < m_Batch.size())
+			DeliverBatch(&m_Batch[nFirst], (DWORD)(m_Batch.size() - nFirst));
+		m_Batch.clear();
+		if (m_Batch.capacity() > QUEUE_BATCH_KEEP)
+			vector<QUEUED_ITEM>().swap(m_Batch);
 	} // while
 }
 
 //
-// Set an external parameter, thus we could take the advantage 
-// of it later on in the callback routine
+// Take everything off the lock-free queue
 //
-void CQueueContainer::SetExternalParam(PVOID pvParam)
+void CQueueContainer::DrainLockFreeQueue()
 {
-	m_pvParam = pvParam;
+	DWORD dwCount;
+
+	do
+	{
+		do
+		{
+			for (dwCount = 0; dwCount < QUEUE_LOCK_FREE_BATCH; dwCount++)
+			{
+				QUEUED_ITEM& element = m_Batch[dwCount];
+
+				if (!m_pLockFreeQueue->Pop(element))
+					break;
+				element.llDequeueTime = QueryTimestamp();
+				CountSequence(m_ConsumerStats, element.ullSequence);
+			} // for
+			if (0 != dwCount)
+			{
+				if (0 != m_dwCapacity)
+					::SetEvent(m_evtSpaceAvailable);
+				m_ConsumerStats.ullDelivered += dwCount;
+				{
+					CLockMgr<CCSWrapper> guard(m_csStats, TRUE);
+					m_PublishedStats = m_ConsumerStats;
+				}
+				DeliverBatch(&m_Batch[0], dwCount);
+			}
+		} while (QUEUE_LOCK_FREE_BATCH == dwCount);
+	//
+	// Whatever has come in since the last Pop() is taken care of before
+	// waiting, no wake-up is sent for it
+	//
+	} while (!m_pLockFreeQueue->PrepareToSleep());
 }
 
 //
-// Delegate this method to a call of CCallbackHandler 
+// Hand a batch of elements over to the callback handler
 //
-void CQueueContainer::OnProcessEvent(PQUEUED_ITEM pQueuedItem)
+void CQueueContainer::DeliverBatch(
+	PQUEUED_ITEM pElements,
+	DWORD        dwCount
+	)
 {
-	if (pQueuedItem->bCreate)
-		::OutputDebugString(TEXT("Process created.\n")); 
+	if (m_bCoalesceLifetimes)
+		dwCount = CoalesceLifetimes(pElements, dwCount);
+
+	LONGLONG llCallbackTime = QueryTimestamp();
+
+	for (DWORD i = 0; i < dwCount; i++)
+		pElements[i].llCallbackTime = llCallbackTime;
+	m_pHandler->OnProcessEvents( pElements, dwCount, m_pvParam );
+	LONGLONG llCallbackEnd = QueryTimestamp();
+	//
+	// The time spent in the handler is counted once per call, the
+	// other stages once per element
+	//
+	m_Latency[LATENCY_CALLBACK].RecordInterval(
+		llCallbackTime, llCallbackEnd);
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		const QUEUED_ITEM& element = pElements[i];
+
+		m_Latency[LATENCY_SOURCE_TO_ENQUEUE].RecordInterval(
+			element.llSourceTime, element.llEnqueueTime);
+		m_Latency[LATENCY_QUEUE_WAIT].RecordInterval(
+			element.llEnqueueTime, element.llDequeueTime);
+		m_Latency[LATENCY_DISPATCH].RecordInterval(
+			element.llDequeueTime, element.llCallbackTime);
+		m_Latency[LATENCY_END_TO_END].RecordInterval(
+			element.llSourceTime, llCallbackEnd);
+	} // for
+}
+
+//
+// Turn the creates and exits of the same processes in a batch into
+// lifetimes. The create becomes the record, the exit and the exec()s
+// in between are taken out.
+//
+DWORD CQueueContainer::CoalesceLifetimes(
+	PQUEUED_ITEM pElements,
+	DWORD        dwCount
+	)
+{
+	DWORD dwLifetimes = 0;
+	DWORD dwFolded    = 0;
+
+	m_PendingCreates.clear();
+	m_ExecLinks.assign(dwCount, QUEUE_NO_INDEX);
+	m_Folded.assign(dwCount, FALSE);
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		PQUEUED_ITEM pElement = &pElements[i];
+
+		if ((QUEUED_ITEM_PROCESS == pElement->eKind) && pElement->bCreate)
+		{
+			PENDING_CREATE pending = { i, QUEUE_NO_INDEX };
+			m_PendingCreates[pElement->hProcessId] = pending;
+			continue;
+		}
+		unordered_map<DWORD, PENDING_CREATE>::iterator it = m_PendingCreates.find(pElement->hProcessId);
+		if (it == m_PendingCreates.end())
+			continue;
+		if (QUEUED_ITEM_EXEC == pElement->eKind)
+		{
+			m_ExecLinks[i]        = it->second.dwLastExec;
+			it->second.dwLastExec = i;
+		}
+		else if (QUEUED_ITEM_PROCESS == pElement->eKind)
+		{
+			PQUEUED_ITEM pCreate = &pElements[it->second.dwCreate];
+
+			if (QUEUE_NO_INDEX != it->second.dwLastExec)
+			{
+				PQUEUED_ITEM pExec = &pElements[it->second.dwLastExec];
+
+				if (0 != pExec->dwImageId)
+					pCreate->dwImageId = pExec->dwImageId;
+				if (0 != pExec->dwCommandLineId)
+					pCreate->dwCommandLineId = pExec->dwCommandLineId;
+			} // if
+			for (DWORD j = it->second.dwLastExec; QUEUE_NO_INDEX != j; j = m_ExecLinks[j])
+			{
+				m_Folded[j] = TRUE;
+				dwFolded++;
+			} // for
+			pCreate->eKind        = QUEUED_ITEM_LIFETIME;
+			pCreate->bCreate      = FALSE;
+			pCreate->dwExitStatus = pElement->dwExitStatus;
+			pCreate->llExitTime   = pElement->llSourceTime;
+			m_Folded[i] = TRUE;
+			dwFolded++;
+			dwLifetimes++;
+			m_PendingCreates.erase(it);
+		}
+		else
+			//
+			// Something else has happened to the process meanwhile, it
+			// would be handed over after the exit
+			//
+			m_PendingCreates.erase(it);
+	} // for
+	if (0 == dwLifetimes)
+		return dwCount;
+	//
+	// Close the gaps, keeping the order
+	//
+	DWORD dwKept = 0;
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		if (m_Folded[i])
+			continue;
+		if (dwKept != i)
+			pElements[dwKept] = pElements[i];
+		dwKept++;
+	} // for
+	m_ConsumerStats.ullLifetimes      += dwLifetimes;
+	m_ConsumerStats.ullLifetimeEvents += dwFolded;
+	{
+		CLockMgr<CCSWrapper> guard(m_csStats, TRUE);
+		m_PublishedStats.ullLifetimes      = m_ConsumerStats.ullLifetimes;
+		m_PublishedStats.ullLifetimeEvents = m_ConsumerStats.ullLifetimeEvents;
+	}
+
+	return dwKept;
+}
+
+//
+// Check the sequence number against the previous event. A jump forward 
+// means events were lost on the way, a step back is a repeat (or the 
+// driver has been restarted). 0 means the source doesn't number them.
+//
+void CQueueContainer::CountSequence(
+	QUEUE_STATS& stats,
+	ULONG64      ullSequence
+	)
+{
+	if (0 == ullSequence)
+		return;
+	if (0 != stats.ullLastSequence)
+	{
+		if (ullSequence > stats.ullLastSequence + 1)
+			stats.ullMissed += ullSequence - stats.ullLastSequence - 1;
+		else if (ullSequence <= stats.ullLastSequence)
+			stats.ullOutOfOrder++;
+	}
+	stats.ullLastSequence = ullSequence;
+}
+
+//
+// Events in m_Queue not taken off yet
+//
+DWORD CQueueContainer::GetLockedDepth() const
+{
+	return (DWORD)(m_Queue.size() - m_nQueueFirst);
+}
+
+//
+// The locked queue is full, make room for another element
+//
+BOOL CQueueContainer::MakeRoom(const QUEUED_ITEM& element)
+{
+	BOOL bAbsorbed = FALSE;
+
+	switch (m_eOverflowPolicy)
+	{
+		case QUEUE_OVERFLOW_BLOCK:
+			while (GetLockedDepth() >= m_dwCapacity)
+			{
+				if (!m_pRetrievalThread->GetIsActive())
+				{
+					m_Stats.ullDroppedNewest++;
+					return FALSE;
+				}
+				m_Stats.ullProducerWaits++;
+				//
+				// Let go of the lock while waiting, the retrieval thread
+				// needs it. What this batch has appended so far can be
+				// taken off meanwhile.
+				//
+				::SetEvent(m_evtElementAvailable);
+				::ReleaseMutex(m_mtxMonitor);
+				::WaitForSingleObject(m_evtSpaceAvailable, QUEUE_BLOCK_POLL);
+				::WaitForSingleObject(m_mtxMonitor, INFINITE);
+			} // while
+			return TRUE;
+		case QUEUE_OVERFLOW_DROP_OLDEST:
+			m_nQueueFirst++;
+			m_Stats.ullDroppedOldest++;
+			//
+			// Move the rest forward once the dropped ones make up an
+			// eighth of the bound
+			//
+			if ((m_nQueueFirst >= QUEUE_COMPACT_MIN) && 
+			    (m_nQueueFirst >= (m_dwCapacity >> QUEUE_COMPACT_SHIFT)))
+			{
+				m_Queue.erase(m_Queue.begin(), m_Queue.begin() + m_nQueueFirst);
+				m_nQueueFirst = 0;
+			}
+			return TRUE;
+		case QUEUE_OVERFLOW_COALESCE:
+		{
+			DWORD dwPairs = m_dwPairsQueued;
+
+			if ((QUEUED_ITEM_PROCESS == element.eKind) && 
+			    !element.bCreate && 
+			    (m_QueuedCreates.end() != m_QueuedCreates.find(element.hProcessId)))
+				dwPairs++;
+			//
+			// Too few pairs to be worth a scan, the element is dropped
+			// like with QUEUE_OVERFLOW_DROP_NEWEST
+			//
+			if ((2 * dwPairs * QUEUE_COALESCE_RATIO >= GetLockedDepth()) &&
+			    (0 != CoalesceQueue(element, &bAbsorbed)))
+			{
+				if (!bAbsorbed)
+					return TRUE;
+				m_Stats.ullCoalesced++;
+				return FALSE;
+			}
+			m_Stats.ullDroppedNewest++;
+			return FALSE;
+		}
+		default:
+			m_Stats.ullDroppedNewest++;
+			return FALSE;
+	} // switch
+}
+
+//
+// Keep track of the process creates and exits in the locked queue
+//
+void CQueueContainer::CountQueuedProcess(const QUEUED_ITEM& element)
+{
+	if (QUEUED_ITEM_PROCESS != element.eKind)
+		return;
+	if (element.bCreate)
+	{
+		m_QueuedCreates[element.hProcessId]++;
+		return;
+	}
+	unordered_map<DWORD, DWORD>::iterator it = m_QueuedCreates.find(element.hProcessId);
+	if (it != m_QueuedCreates.end())
+	{
+		m_dwPairsQueued++;
+		if (0 == --it->second)
+			m_QueuedCreates.erase(it);
+	}
+}
+
+//
+// Remove the creates and exits of processes that have both in the queue
+//
+DWORD CQueueContainer::CoalesceQueue(
+	const QUEUED_ITEM& incoming,
+	BOOL*              pbAbsorbed
+	)
+{
+	//
+	// Position of the last create of each process without an exit yet
+	//
+	unordered_map<DWORD, size_t> creates;
+	vector<BYTE>                 removed(m_Queue.size(), FALSE);
+	DWORD                        dwRemoved = 0;
+
+	*pbAbsorbed = FALSE;
+	for (size_t i = m_nQueueFirst; i < m_Queue.size(); i++)
+	{
+		const QUEUED_ITEM& element = m_Queue[i];
+
+		if (QUEUED_ITEM_PROCESS != element.eKind)
+			continue;
+		if (element.bCreate)
+			creates[element.hProcessId] = i;
+		else
+		{
+			unordered_map<DWORD, size_t>::iterator it = creates.find(element.hProcessId);
+			if (it != creates.end())
+			{
+				removed[it->second] = TRUE;
+				removed[i]          = TRUE;
+				dwRemoved += 2;
+				creates.erase(it);
+			}
+		}
+	} // for
+	if ((QUEUED_ITEM_PROCESS == incoming.eKind) && !incoming.bCreate)
+	{
+		unordered_map<DWORD, size_t>::iterator it = creates.find(incoming.hProcessId);
+		if (it != creates.end())
+		{
+			removed[it->second] = TRUE;
+			dwRemoved++;
+			*pbAbsorbed = TRUE;
+			//
+			// The create is gone, the queue is left with the processes
+			// it had no exit for
+			//
+			unordered_map<DWORD, DWORD>::iterator itCount = m_QueuedCreates.find(incoming.hProcessId);
+			if ((itCount != m_QueuedCreates.end()) && (0 == --itCount->second))
+				m_QueuedCreates.erase(itCount);
+		}
+	}
+	m_dwPairsQueued = 0;
+	if (0 == dwRemoved)
+		return 0;
+	//
+	// Close the gaps, keeping the order
+	//
+	size_t nKept = m_nQueueFirst;
+	for (size_t i = m_nQueueFirst; i < m_Queue.size(); i++)
+	{
+		if (removed[i])
+			continue;
+		if (nKept != i)
+			m_Queue[nKept] = m_Queue[i];
+		nKept++;
+	} // for
+	m_Queue.resize(nKept);
+	m_Stats.ullCoalesced += dwRemoved;
+
+	return dwRemoved;
+}
+
+//
+// Wait until the lock-free queue has room
+//
+BOOL CQueueContainer::WaitForLockFreeRoom()
+{
+	while (m_pLockFreeQueue->GetDepth() >= m_dwCapacity)
+	{
+		if (!m_pRetrievalThread->GetIsActive())
+			return FALSE;
+		if (WAIT_OBJECT_0 == ::WaitForSingleObject(m_mtxMonitor, INFINITE))
+		{
+			m_Stats.ullProducerWaits++;
+			::ReleaseMutex(m_mtxMonitor);
+		}
+		::WaitForSingleObject(m_evtSpaceAvailable, QUEUE_BLOCK_POLL);
+	} // while
+
+	return TRUE;
+}
+
+//
+// Count events dropped by an append
+//
+void CQueueContainer::AddDropped(ULONG64 ullDropped)
+{
+	if (WAIT_OBJECT_0 == ::WaitForSingleObject(m_mtxMonitor, INFINITE))
+	{
+		m_Stats.ullDroppedNewest += ullDropped;
+		::ReleaseMutex(m_mtxMonitor);
+	}
+}
+
+//
+// Bound the queue and choose the overflow policy
+//
+BOOL CQueueContainer::SetLimits(
+	DWORD                 dwMaxElements,
+	ULONG64               ullMaxBytes,
+	QUEUE_OVERFLOW_POLICY ePolicy
+	)
+{
+	ULONG64 ullCapacity = dwMaxElements;
+
+	if (IsReceiving())
+		return FALSE;
+	if (m_bInline && ((0 != dwMaxElements) || (0 != ullMaxBytes)))
+		return FALSE;
+	if ((NULL != m_pLockFreeQueue) &&
+	    (QUEUE_OVERFLOW_BLOCK != ePolicy) && 
+	    (QUEUE_OVERFLOW_DROP_NEWEST != ePolicy))
+		return FALSE;
+	//
+	// The elements are all of a size
+	//
+	if (0 != ullMaxBytes)
+	{
+		ULONG64 ullByBytes = ullMaxBytes / sizeof(QUEUED_ITEM);
+		if (0 == ullByBytes)
+			ullByBytes = 1;
+		if ((0 == ullCapacity) || (ullByBytes < ullCapacity))
+			ullCapacity = ullByBytes;
+	}
+	if (ullCapacity > 0xFFFFFFFF)
+		ullCapacity = 0xFFFFFFFF;
+	m_dwCapacity      = (DWORD)ullCapacity;
+	m_eOverflowPolicy = ePolicy;
+
+	return TRUE;
+}
+
+//
+// Hand processes created and exited meanwhile over as lifetimes
+//
+BOOL CQueueContainer::SetLifetimeCoalescing(BOOL bEnable)
+{
+	if (IsReceiving())
+		return FALSE;
+	m_bCoalesceLifetimes = bEnable;
+
+	return TRUE;
+}
+
+//
+// Record the overflow counter reported by the driver
+//
+void CQueueContainer::SetDriverOverflow(ULONG64 ullOverflow)
+{
+	if (WAIT_OBJECT_0 == ::WaitForSingleObject(m_mtxMonitor, INFINITE))
+	{
+		m_Stats.ullDriverOverflow = ullOverflow;
+		::ReleaseMutex(m_mtxMonitor);
+	}
+}
+
+//
+// Add to the number of thread events the driver couldn't buffer
+//
+void CQueueContainer::AddThreadDropped(ULONG64 ullDropped)
+{
+	if (WAIT_OBJECT_0 == ::WaitForSingleObject(m_mtxMonitor, INFINITE))
+	{
+		m_Stats.ullThreadDropped += ullDropped;
+		::ReleaseMutex(m_mtxMonitor);
+	}
+}
+
+//
+// Take a snapshot of the counters
+//
+void CQueueContainer::GetStats(QUEUE_STATS& stats)
+{
+	if (WAIT_OBJECT_0 == ::WaitForSingleObject(m_mtxMonitor, INFINITE))
+	{
+		stats = m_Stats;
+		stats.dwQueueDepth = GetLockedDepth();
+		::ReleaseMutex(m_mtxMonitor);
+
+		CLockMgr<CCSWrapper> guard(m_csStats, TRUE);
+		stats.ullLifetimes      = m_PublishedStats.ullLifetimes;
+		stats.ullLifetimeEvents = m_PublishedStats.ullLifetimeEvents;
+		if (m_bInline)
+		{
+			stats.ullReceived     = m_PublishedStats.ullReceived;
+			stats.ullDelivered    = m_PublishedStats.ullDelivered;
+			stats.ullMissed       = m_PublishedStats.ullMissed;
+			stats.ullOutOfOrder   = m_PublishedStats.ullOutOfOrder;
+			stats.ullLastSequence = m_PublishedStats.ullLastSequence;
+		}
+		else if (NULL != m_pLockFreeQueue)
+		{
+			stats.ullReceived     = m_pLockFreeQueue->GetPushedCount();
+			stats.ullDelivered    = m_PublishedStats.ullDelivered;
+			stats.ullMissed       = m_PublishedStats.ullMissed;
+			stats.ullOutOfOrder   = m_PublishedStats.ullOutOfOrder;
+			stats.ullLastSequence = m_PublishedStats.ullLastSequence;
+			stats.dwQueueDepth    = m_pLockFreeQueue->GetDepth();
+		}
+	}
 	else
-		::OutputDebugString(TEXT("Process terminated.\n")); 
+		::ZeroMemory((PBYTE)&stats, sizeof(stats));
+}
 
-	m_pHandler->OnProcessEvent(
-			pQueuedItem,
-			m_pvParam
-			);
+//
+// Print the latency histograms of all stages
+//
+void CQueueContainer::DumpLatency() const
+{
+	static LPCTSTR s_pszStage[LATENCY_STAGE_COUNT] =
+	{
+		TEXT("source->enqueue"),
+		TEXT("queue wait"),
+		TEXT("dispatch"),
+		TEXT("callback"),
+		TEXT("end-to-end")
+	};
+	for (DWORD i = 0; i < LATENCY_STAGE_COUNT; i++)
+		m_Latency[i].Dump(s_pszStage[i]);
+}
+
+//
+// Start measuring latencies from scratch
+//
+void CQueueContainer::ResetLatency()
+{
+	for (DWORD i = 0; i < LATENCY_STAGE_COUNT; i++)
+		m_Latency[i].Reset();
+}
+
+//
+// Set an external parameter, thus we could take the advantage 
+// of it later on in the callback routine
+//
+void CQueueContainer::SetExternalParam(PVOID pvParam)
+{
+	m_pvParam = pvParam;
 }
 
 //----------------------------End of the file -------------------------------
\ No newline at end of file
@@ -27,12 +27,95 @@
 //
 //---------------------------------------------------------------------------
 
-#include "common.h"
+#include "Common.h"
 #include "CallbackHandler.h"
 #include "RetrievalThread.h" 
+#include "LatencyHistogram.h"
+#include "MpscQueue.h"
+#include "LockMgr.h"
 #include <assert.h>
-#include <deque>
+#include <vector>
+#include <unordered_map>
 using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// struct _QueueStats
+//
+// Counters describing what has happened to the events so far
+//
+//---------------------------------------------------------------------------
+typedef struct _QueueStats
+{
+	ULONG64 ullReceived;       // Events appended to the queue
+	ULONG64 ullDelivered;      // Events handed over to the callback handler
+	ULONG64 ullMissed;         // Sequence numbers skipped (lost events)
+	ULONG64 ullOutOfOrder;     // Events older than the last one (repeats)
+	ULONG64 ullLastSequence;   // Sequence number of the last event
+	ULONG64 ullDriverOverflow; // Events dropped by the driver, as it reports
+	ULONG64 ullThreadDropped;  // Thread events the driver couldn't buffer
+	ULONG64 ullDroppedNewest;  // Events not queued, the queue being full
+	ULONG64 ullDroppedOldest;  // Queued events dropped to make room
+	ULONG64 ullCoalesced;      // Creates and exits dropped in pairs
+	ULONG64 ullProducerWaits;  // Times an append has waited for room
+	ULONG64 ullLifetimes;      // Creates and exits handed over as one
+	ULONG64 ullLifetimeEvents; // Events folded into them (exits, exec()s)
+	DWORD   dwQueueDepth;      // Events waiting for the callback handler
+} QUEUE_STATS, *PQUEUE_STATS;
+
+//
+// How the queue is built. QUEUE_LOCKED guards a vector with a mutex and
+// signals the retrieval thread on every append. QUEUE_LOCK_FREE appends
+// without locking (CMpscQueue) and signals only if the retrieval thread
+// has run out of work and waits. QUEUE_INLINE has no queue and no
+// retrieval thread: the thread appending the events (the monitor) hands
+// them over to the callback handler itself, thus a single thread waits
+// for the source and dispatches. Only for handlers that keep up, as a
+// slow one holds up the source.
+//
+enum QUEUE_IMPLEMENTATION
+{
+	QUEUE_LOCKED,
+	QUEUE_LOCK_FREE,
+	QUEUE_INLINE
+};
+
+//
+// What an append does when the queue is full
+//
+enum QUEUE_OVERFLOW_POLICY
+{
+	QUEUE_OVERFLOW_BLOCK,        // Wait until the retrieval thread makes room
+	QUEUE_OVERFLOW_DROP_NEWEST,  // Drop the event being appended
+	QUEUE_OVERFLOW_DROP_OLDEST,  // Drop the oldest queued event (QUEUE_LOCKED)
+	QUEUE_OVERFLOW_COALESCE      // Drop processes that have been created and
+	                             // exited while queued, both events, then
+	                             // the newest (QUEUE_LOCKED)
+};
+
+//
+// A process create in the batch being delivered, and the last exec() of
+// the process after it
+//
+typedef struct _PendingCreate
+{
+	DWORD dwCreate;
+	DWORD dwLastExec;
+} PENDING_CREATE, *PPENDING_CREATE;
+
+//
+// Stages of an event's way, each one measured by its own histogram
+//
+enum LATENCY_STAGE
+{
+	LATENCY_SOURCE_TO_ENQUEUE, // Driver notify routine -> queue
+	LATENCY_QUEUE_WAIT,        // Queue -> taken off by the retrieval thread
+	LATENCY_DISPATCH,          // Taken off -> callback handler invoked
+	LATENCY_CALLBACK,          // Time spent in the callback handler, per call
+	LATENCY_END_TO_END,        // Driver notify routine -> callback returned
+	LATENCY_STAGE_COUNT
+};
+
 //---------------------------------------------------------------------------
 //
 // class CQueueContainer
@@ -41,14 +124,18 @@ using namespace std;
 class CQueueContainer
 {
 public:
-	CQueueContainer(CCallbackHandler* pHandler);
+	CQueueContainer(
+		CCallbackHandler*    pHandler,
+		QUEUE_IMPLEMENTATION eImplementation = QUEUE_LOCK_FREE
+		);
 	virtual ~CQueueContainer();
 	//
 	// Initates the process of handling notification
 	//
 	BOOL StartReceivingNotifications();
 	//
-	// Shutdown if there is something in progress
+	// Shutdown if there is something in progress, and wait until the
+	// callback handler has returned
 	//
 	void StopReceivingNotifications();
 	//
@@ -56,6 +143,56 @@ public:
 	//
 	BOOL Append(const QUEUED_ITEM& element);
 	//
+	// Insert a number of elements at once, taking the lock (if any) and
+	// waking up the retrieval thread only once
+	//
+	BOOL AppendBatch(
+		const QUEUED_ITEM* pElements,
+		DWORD              dwCount
+		);
+	//
+	// Bound the queue to dwMaxElements events and ullMaxBytes bytes,
+	// whichever is less (0 for no bound), and choose what happens when
+	// it is full. Only while not receiving notifications. With
+	// QUEUE_LOCK_FREE only QUEUE_OVERFLOW_BLOCK and _DROP_NEWEST are
+	// available, and the bound may be exceeded by the batches appended
+	// at the same time. QUEUE_INLINE takes no bound.
+	//
+	BOOL SetLimits(
+		DWORD                 dwMaxElements,
+		ULONG64               ullMaxBytes,
+		QUEUE_OVERFLOW_POLICY ePolicy
+		);
+	//
+	// Hand a process that has been created and has exited while both
+	// events were waiting over as a single QUEUED_ITEM_LIFETIME record,
+	// in place of the create. exec()s in between are folded in, the
+	// record carrying the image executed last. Any other event of the
+	// process in between keeps them apart. Only while not receiving
+	// notifications.
+	//
+	BOOL SetLifetimeCoalescing(BOOL bEnable);
+	//
+	// Add to the number of thread events the driver couldn't buffer
+	//
+	void AddThreadDropped(ULONG64 ullDropped);
+	//
+	// Record the overflow counter reported by the driver
+	//
+	void SetDriverOverflow(ULONG64 ullOverflow);
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(QUEUE_STATS& stats);
+	//
+	// Print the latency histograms of all stages
+	//
+	void DumpLatency() const;
+	//
+	// Start measuring latencies from scratch
+	//
+	void ResetLatency();
+	//
 	// A method for accessing handle to an internal event handle
 	//
 	HANDLE Get_ElementAvailableHandle() const;
@@ -68,10 +205,6 @@ public:
 	// of it later on in the callback routine
 	//
 	void SetExternalParam(PVOID pvParam);
-	//
-	// Delegate this method to a call of CCallbackHandler 
-	//
-	void OnProcessEvent(PQUEUED_ITEM pQueuedItem);
 private:
 	//
 	// Initialize the system
@@ -86,6 +219,77 @@ private:
 	//
 	void DoOnProcessCreatedTerminated();
 	//
+	// Whether the events are being handed over to the callback handler
+	//
+	BOOL IsReceiving();
+	//
+	// Hand the elements appended over right away (QUEUE_INLINE)
+	//
+	BOOL DeliverInline(
+		const QUEUED_ITEM* pElements,
+		DWORD              dwCount
+		);
+	//
+	// Take everything off the lock-free queue, until it is empty and
+	// the retrieval thread may wait
+	//
+	void DrainLockFreeQueue();
+	//
+	// Hand a batch of elements over to the callback handler and record
+	// their latencies
+	//
+	void DeliverBatch(
+		PQUEUED_ITEM pElements,
+		DWORD        dwCount
+		);
+	//
+	// Turn the creates and exits of the same processes in a batch into
+	// lifetimes. Returns the number of elements left.
+	//
+	DWORD CoalesceLifetimes(
+		PQUEUED_ITEM pElements,
+		DWORD        dwCount
+		);
+	//
+	// Check an element's sequence number against the previous one
+	//
+	static void CountSequence(
+		QUEUE_STATS& stats,
+		ULONG64      ullSequence
+		);
+	//
+	// Events in m_Queue not taken off yet (QUEUE_LOCKED)
+	//
+	DWORD GetLockedDepth() const;
+	//
+	// The locked queue is full. Make room for another element as the
+	// policy says, or return FALSE if it is to be dropped. Called and
+	// returns with m_mtxMonitor held.
+	//
+	BOOL MakeRoom(const QUEUED_ITEM& element);
+	//
+	// Keep track of the process creates and exits in the locked queue
+	//
+	void CountQueuedProcess(const QUEUED_ITEM& element);
+	//
+	// Remove the creates and exits of processes that have both in the
+	// queue. Returns the number of elements removed, and whether the
+	// incoming element has found its create (and is to be dropped too).
+	//
+	DWORD CoalesceQueue(
+		const QUEUED_ITEM& incoming,
+		BOOL*              pbAbsorbed
+		);
+	//
+	// Wait until the lock-free queue has room. FALSE if the retrieval
+	// thread has stopped.
+	//
+	BOOL WaitForLockFreeRoom();
+	//
+	// Count events dropped by an append, under m_mtxMonitor
+	//
+	void AddDropped(ULONG64 ullDropped);
+	//
 	// Thread that gets all queued event items 
 	//
 	CRetrievalThread* m_pRetrievalThread;
@@ -99,9 +303,50 @@ private:
 	//
 	HANDLE m_evtShutdownRemove;
 	//
-	// Underlying STL container
+	// Underlying STL container (QUEUE_LOCKED). The retrieval thread
+	// swaps it with m_Batch, taking all the pending elements at once.
 	//
-	deque<QUEUED_ITEM> m_Queue;
+	vector<QUEUED_ITEM> m_Queue;
+	//
+	// Elements at the front of m_Queue that have been dropped
+	// (QUEUE_OVERFLOW_DROP_OLDEST), removed in bulk now and then
+	//
+	size_t m_nQueueFirst;
+	//
+	// Process creates in m_Queue without an exit yet, per process ID,
+	// and the number of processes with both (QUEUE_OVERFLOW_COALESCE)
+	//
+	unordered_map<DWORD, DWORD> m_QueuedCreates;
+	DWORD                       m_dwPairsQueued;
+	//
+	// Bound on the number of queued elements, 0 if there is none, and
+	// what happens when it is reached
+	//
+	DWORD                 m_dwCapacity;
+	QUEUE_OVERFLOW_POLICY m_eOverflowPolicy;
+	//
+	// Signaled by the retrieval thread when it has taken elements off,
+	// for producers waiting for room (QUEUE_OVERFLOW_BLOCK)
+	//
+	HANDLE m_evtSpaceAvailable;
+	//
+	// Elements being delivered, owned by the retrieval thread (by the
+	// appending thread holding m_csInline, with QUEUE_INLINE)
+	//
+	vector<QUEUED_ITEM> m_Batch;
+	//
+	// Whether lifetimes are made, and the retrieval thread's bookkeeping
+	// for them: the creates of the batch per process ID, the exec()s
+	// linked per process, and the elements folded
+	//
+	BOOL                                m_bCoalesceLifetimes;
+	unordered_map<DWORD, PENDING_CREATE> m_PendingCreates;
+	vector<DWORD>                       m_ExecLinks;
+	vector<BYTE>                        m_Folded;
+	//
+	// The lock-free queue, NULL with QUEUE_LOCKED
+	//
+	CMpscQueue* m_pLockFreeQueue;
 	//
 	// Monitor mutex
 	//
@@ -114,6 +359,32 @@ private:
 	// Pointer to anything
 	//
 	PVOID m_pvParam;
+	//
+	// Counters guarded by m_mtxMonitor. ullLastSequence is used for 
+	// detecting gaps.
+	//
+	QUEUE_STATS m_Stats;
+	//
+	// With the lock-free queue the retrieval thread checks the sequence
+	// numbers and counts the deliveries, without one the appending
+	// thread. It publishes its counters to m_PublishedStats, guarded by
+	// m_csStats, with every batch.
+	//
+	QUEUE_STATS m_ConsumerStats;
+	QUEUE_STATS m_PublishedStats;
+	CCSWrapper  m_csStats;
+	//
+	// QUEUE_INLINE, and whether the events are handed over. Appending
+	// threads hold m_csInline while the handler runs, thus one at a 
+	// time calls it, and none once it has been stopped.
+	//
+	BOOL       m_bInline;
+	BOOL       m_bInlineActive;
+	CCSWrapper m_csInline;
+	//
+	// Per stage latencies. They are recorded without holding any lock.
+	//
+	CLatencyHistogram m_Latency[LATENCY_STAGE_COUNT];
 };
 
 #endif // !defined(_QUEUECONTAINER_H_)
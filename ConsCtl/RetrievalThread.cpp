@@ -23,7 +23,7 @@
 //---------------------------------------------------------------------------
 
 CRetrievalThread::CRetrievalThread(
-	TCHAR*            pszThreadGuid,
+	const TCHAR*      pszThreadGuid,
 	CQueueContainer*  pQueue
 	):
 	CCustomThread(pszThreadGuid),
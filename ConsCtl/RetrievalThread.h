@@ -46,7 +46,7 @@ class CRetrievalThread: public CCustomThread
 {
 public:
 	CRetrievalThread(
-		TCHAR*           pszThreadGuid,
+		const TCHAR*     pszThreadGuid,
 		CQueueContainer* pQueue
 		);
 	virtual ~CRetrievalThread();
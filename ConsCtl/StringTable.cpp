@@ -0,0 +1,240 @@
+//---------------------------------------------------------------------------
+//
+// StringTable.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Image paths kept once, known by an ID
+//
+// DESCRIPTION:
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "StringTable.h"
+#include <string.h>
+#include <wchar.h>
+
+//---------------------------------------------------------------------------
+//
+// class CStringTable
+//
+//---------------------------------------------------------------------------
+CStringTable::CStringTable(ULONG64 ullBudget):
+	m_dwNextId(STRING_TABLE_NO_ID + 1),
+	m_ullBudget(ullBudget),
+	m_ullArenaBytes(0)
+{
+	for (DWORD i = 0; i < STRING_TABLE_SHARDS; i++)
+		m_pShards[i] = new STRING_SHARD;
+	for (DWORD i = 0; i < STRING_TABLE_MAX_PAGES; i++)
+		m_Pages[i].store(NULL, std::memory_order_relaxed);
+}
+
+CStringTable::~CStringTable()
+{
+	for (DWORD i = 0; i < STRING_TABLE_SHARDS; i++)
+	{
+		PSTRING_SHARD pShard = m_pShards[i];
+
+		for (size_t j = 0; j < pShard->chunks.size(); j++)
+			delete [] pShard->chunks[j];
+		delete pShard;
+	} // for
+	for (DWORD i = 0; i < STRING_TABLE_MAX_PAGES; i++)
+		delete [] m_Pages[i].load(std::memory_order_relaxed);
+}
+
+//
+// The table the strings of the events are kept in. Created on first use,
+// by whichever source or handler comes first.
+//
+CStringTable& CStringTable::GetInstance()
+{
+	static CStringTable s_Table;
+
+	return s_Table;
+}
+
+//
+// The ID of a string, added if it isn't there yet
+//
+DWORD CStringTable::Intern(const WCHAR* pszString)
+{
+	if ((NULL == pszString) || (0 == pszString[0]))
+		return STRING_TABLE_NO_ID;
+
+	wstring_view string(pszString);
+	STRING_KEY   key = { string, hash<wstring_view>()(string) };
+	//
+	// The map takes the low bits for its buckets
+	//
+	PSTRING_SHARD pShard = m_pShards[(key.nHash >> 11) & (STRING_TABLE_SHARDS - 1)];
+	CLockMgr<CCSWrapper> guard(pShard->csShard, TRUE);
+
+	pShard->ullLookups++;
+
+	STRING_INDEX::const_iterator it = pShard->index.find(key);
+
+	if (it != pShard->index.end())
+		return it->second;
+
+	const WCHAR* pszStored = Store(pShard, string);
+	DWORD        dwId      = STRING_TABLE_NO_ID;
+
+	if (NULL != pszStored)
+		dwId = Publish(pszStored);
+	if (STRING_TABLE_NO_ID == dwId)
+	{
+		pShard->ullRefused++;
+		return STRING_TABLE_NO_ID;
+	}
+	key.string = wstring_view(pszStored, string.size());
+	pShard->index.emplace(key, dwId);
+	pShard->ullAdded++;
+	pShard->ullStringBytes += (string.size() + 1) * sizeof(WCHAR);
+
+	return dwId;
+}
+
+//
+// The string of an ID
+//
+const WCHAR* CStringTable::Resolve(DWORD dwId) const
+{
+	DWORD dwPage = dwId >> STRING_TABLE_PAGE_SHIFT;
+
+	if ((STRING_TABLE_NO_ID == dwId) || (dwPage >= STRING_TABLE_MAX_PAGES))
+		return L"";
+
+	std::atomic<const WCHAR*>* pPage = m_Pages[dwPage].load(std::memory_order_acquire);
+
+	if (NULL == pPage)
+		return L"";
+
+	const WCHAR* pszString =
+		pPage[dwId & ((1 << STRING_TABLE_PAGE_SHIFT) - 1)].load(std::memory_order_acquire);
+
+	return (NULL != pszString) ? pszString : L"";
+}
+
+//
+// Take a snapshot of the counters
+//
+void CStringTable::GetStats(STRING_TABLE_STATS& stats)
+{
+	::ZeroMemory((PBYTE)&stats, sizeof(stats));
+	for (DWORD i = 0; i < STRING_TABLE_SHARDS; i++)
+	{
+		PSTRING_SHARD pShard = m_pShards[i];
+		CLockMgr<CCSWrapper> guard(pShard->csShard, TRUE);
+
+		stats.ullLookups     += pShard->ullLookups;
+		stats.ullAdded       += pShard->ullAdded;
+		stats.ullRefused     += pShard->ullRefused;
+		stats.dwStrings      += (DWORD)pShard->index.size();
+		stats.ullStringBytes += pShard->ullStringBytes;
+	} // for
+	stats.ullArenaBytes = m_ullArenaBytes.load(std::memory_order_relaxed);
+}
+
+//
+// Copy a string into the shard's arena. What is left of a chunk too
+// small for the string is not used.
+//
+const WCHAR* CStringTable::Store(
+	PSTRING_SHARD pShard,
+	wstring_view  string
+	)
+{
+	size_t cchString = string.size() + 1;
+
+	if (cchString > pShard->cchFree)
+	{
+		size_t cchChunk = STRING_TABLE_CHUNK / sizeof(WCHAR);
+
+		if (cchChunk < cchString)
+			cchChunk = cchString;
+
+		ULONG64 cbChunk = cchChunk * sizeof(WCHAR);
+
+		if (m_ullArenaBytes.fetch_add(cbChunk, std::memory_order_relaxed) + cbChunk > m_ullBudget)
+		{
+			m_ullArenaBytes.fetch_sub(cbChunk, std::memory_order_relaxed);
+			return NULL;
+		}
+		pShard->chunks.push_back(new WCHAR[cchChunk]);
+		pShard->pszFree = pShard->chunks.back();
+		pShard->cchFree = cchChunk;
+	}
+
+	WCHAR* pszStored = pShard->pszFree;
+
+	memcpy(pszStored, string.data(), string.size() * sizeof(WCHAR));
+	pszStored[string.size()] = 0;
+	pShard->pszFree += cchString;
+	pShard->cchFree -= cchString;
+
+	return pszStored;
+}
+
+//
+// Give a stored string the next ID and make it resolvable
+//
+DWORD CStringTable::Publish(const WCHAR* pszString)
+{
+	DWORD dwId = m_dwNextId.load(std::memory_order_relaxed);
+
+	do
+	{
+		if ((dwId >> STRING_TABLE_PAGE_SHIFT) >= STRING_TABLE_MAX_PAGES)
+			return STRING_TABLE_NO_ID;
+	} while (!m_dwNextId.compare_exchange_weak(dwId, dwId + 1, std::memory_order_relaxed));
+
+	DWORD                      dwPage = dwId >> STRING_TABLE_PAGE_SHIFT;
+	std::atomic<const WCHAR*>* pPage  = m_Pages[dwPage].load(std::memory_order_acquire);
+
+	//
+	// Shards adding their strings at once may both allocate the page,
+	// the one installed first is kept
+	//
+	if (NULL == pPage)
+	{
+		std::atomic<const WCHAR*>* pNewPage =
+			new std::atomic<const WCHAR*>[1 << STRING_TABLE_PAGE_SHIFT];
+
+		for (DWORD i = 0; i < (1 << STRING_TABLE_PAGE_SHIFT); i++)
+			pNewPage[i].store(NULL, std::memory_order_relaxed);
+		if (m_Pages[dwPage].compare_exchange_strong(pPage, pNewPage, std::memory_order_acq_rel))
+			pPage = pNewPage;
+		else
+			delete [] pNewPage;
+	}
+	pPage[dwId & ((1 << STRING_TABLE_PAGE_SHIFT) - 1)].store(pszString, std::memory_order_release);
+
+	return dwId;
+}
+
+//---------------------------------------------------------------------------
+//
+// struct CStringTable::_StringShard
+//
+//---------------------------------------------------------------------------
+CStringTable::_StringShard::_StringShard():
+	csShard(TEXT("string table")),
+	pszFree(NULL),
+	cchFree(0),
+	ullLookups(0),
+	ullAdded(0),
+	ullRefused(0),
+	ullStringBytes(0)
+{
+}
+
+//----------------------------End of the file -------------------------------
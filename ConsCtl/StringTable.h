@@ -0,0 +1,188 @@
+//---------------------------------------------------------------------------
+//
+// StringTable.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Image paths kept once, known by an ID
+//
+// DESCRIPTION:
+//              The same few thousand image paths come with millions of
+//              events. CStringTable keeps every string it is given once,
+//              in an arena, and hands out a 32-bit ID for it that stays
+//              the same for the lifetime of the table. Holders of the ID
+//              compare IDs rather than strings and get the string back
+//              with Resolve() only when they need it.
+//
+//              The sources intern the image paths of the events as they
+//              read them into the table GetInstance() returns, and the
+//              events carry the IDs from then on. Command lines, nearly
+//              all different, are not kept here but in the table of
+//              CommandLineTable.h, which lets the old ones go.
+//
+//              Intern() may be called by any thread; the strings are
+//              spread over shards, each with a lock of its own, by their
+//              hash. Resolve() takes no lock. Strings are never removed,
+//              thus the arena is bounded by a number of bytes, beyond
+//              which new strings are refused.
+//
+//---------------------------------------------------------------------------
+#if !defined(_STRINGTABLE_H_)
+#define _STRINGTABLE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "Common.h"
+#include "LockMgr.h"
+#include <atomic>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// The ID of the empty string, and of a string that has been refused
+//
+#define STRING_TABLE_NO_ID              0
+//
+// Shards (a power of 2), IDs per page of the ID directory (a power of 2)
+// and pages at most, thus 16M strings
+//
+#define STRING_TABLE_SHARDS             16
+#define STRING_TABLE_PAGE_SHIFT         12
+#define STRING_TABLE_MAX_PAGES          4096
+//
+// Bytes the arena takes from the heap at a time, and at most by default
+//
+#define STRING_TABLE_CHUNK              (64 * 1024)
+#define STRING_TABLE_DEFAULT_BUDGET     (64 * 1024 * 1024)
+
+//---------------------------------------------------------------------------
+//
+// struct _StringTableStats
+//
+//---------------------------------------------------------------------------
+typedef struct _StringTableStats
+{
+	ULONG64 ullLookups;      // Intern() calls with a string
+	ULONG64 ullAdded;        // Of those, strings not there yet
+	ULONG64 ullRefused;      // Of those, strings beyond the budget
+	DWORD   dwStrings;       // Strings kept
+	ULONG64 ullStringBytes;  // Taken up by them
+	ULONG64 ullArenaBytes;   // Taken from the heap by the arena
+} STRING_TABLE_STATS, *PSTRING_TABLE_STATS;
+
+//---------------------------------------------------------------------------
+//
+// class CStringTable
+//
+//---------------------------------------------------------------------------
+class CStringTable
+{
+public:
+	CStringTable(ULONG64 ullBudget = STRING_TABLE_DEFAULT_BUDGET);
+	virtual ~CStringTable();
+	//
+	// The table the strings of the events are kept in
+	//
+	static CStringTable& GetInstance();
+	//
+	// The ID of a string, added if it isn't there yet.
+	// STRING_TABLE_NO_ID for an empty string or once the budget has been
+	// used up.
+	//
+	DWORD Intern(const WCHAR* pszString);
+	//
+	// The string of an ID, the empty string for STRING_TABLE_NO_ID. The
+	// pointer stays valid for the lifetime of the table.
+	//
+	const WCHAR* Resolve(DWORD dwId) const;
+	//
+	// Take a snapshot of the counters
+	//
+	void GetStats(STRING_TABLE_STATS& stats);
+private:
+	//
+	// A string and its hash, taken once for both the shard and the map
+	//
+	typedef struct _StringKey
+	{
+		wstring_view string;
+		size_t       nHash;
+
+		bool operator==(const _StringKey& other) const
+		{
+			return (nHash == other.nHash) && (string == other.string);
+		}
+	} STRING_KEY;
+
+	typedef struct _StringKeyHash
+	{
+		size_t operator()(const STRING_KEY& key) const
+		{
+			return key.nHash;
+		}
+	} STRING_KEY_HASH;
+
+	typedef unordered_map<STRING_KEY, DWORD, STRING_KEY_HASH> STRING_INDEX;
+	//
+	// A share of the strings, with an arena of its own
+	//
+	typedef struct _StringShard
+	{
+		_StringShard();
+
+		CCSWrapper     csShard;
+		STRING_INDEX   index;
+		vector<WCHAR*> chunks;
+		WCHAR*         pszFree;     // Room left in the last chunk
+		size_t         cchFree;
+		ULONG64        ullLookups;
+		ULONG64        ullAdded;
+		ULONG64        ullRefused;
+		ULONG64        ullStringBytes;
+	} STRING_SHARD, *PSTRING_SHARD;
+	//
+	// Copy a string into the shard's arena, NULL beyond the budget
+	//
+	const WCHAR* Store(
+		PSTRING_SHARD pShard,
+		wstring_view  string
+		);
+	//
+	// Give a stored string the next ID, STRING_TABLE_NO_ID when they
+	// have run out
+	//
+	DWORD Publish(const WCHAR* pszString);
+
+	STRING_SHARD* m_pShards[STRING_TABLE_SHARDS];
+	//
+	// ID -> string, pages allocated as the IDs get there and published
+	// with a release store, thus read without a lock
+	//
+	std::atomic<std::atomic<const WCHAR*>*> m_Pages[STRING_TABLE_MAX_PAGES];
+	std::atomic<DWORD>                      m_dwNextId;
+	//
+	// Bytes the arenas of all shards may take, and have taken
+	//
+	ULONG64              m_ullBudget;
+	std::atomic<ULONG64> m_ullArenaBytes;
+};
+
+#endif // !defined(_STRINGTABLE_H_)
+//----------------------------End of the file -------------------------------
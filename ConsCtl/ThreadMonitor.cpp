@@ -23,6 +23,8 @@
 //---------------------------------------------------------------------------
 #include "ThreadMonitor.h"
 #include "NtDriverController.h"
+#include "StringTable.h"
+#include "CommandLineTable.h"
 
 //---------------------------------------------------------------------------
 //
@@ -32,12 +34,17 @@
 CProcessThreadMonitor::CProcessThreadMonitor(
 	TCHAR*               pszThreadGuid,     // Thread unique ID
 	CNtDriverController* pDriverController, // service controller
-	CQueueContainer*     pRequestManager    // The underlying store
+	CQueueContainer*     pRequestManager,   // The underlying store
+	NOTIFICATION_MODE    eMode
 	):
 	CCustomThread(pszThreadGuid),
 	m_pRequestManager(pRequestManager),
 	m_hKernelEvent(INVALID_HANDLE_VALUE),
-	m_hDriverFile(INVALID_HANDLE_VALUE)
+	m_hDriverFile(INVALID_HANDLE_VALUE),
+	m_pbBatchBuffer(NULL),
+	m_cbBatchBuffer(0),
+	m_eMode(eMode),
+	m_hSectionEvent(NULL)
 {
 	assert(NULL != pDriverController);
 	//
@@ -46,12 +53,26 @@ CProcessThreadMonitor::CProcessThreadMonitor(
 	//
 	m_pDriverCtl = pDriverController;
 
-	::ZeroMemory((PBYTE)&m_LastCallbackInfo, sizeof(m_LastCallbackInfo));
+	::ZeroMemory((PBYTE)&m_ovRetrieve, sizeof(m_ovRetrieve));
+	::ZeroMemory((PBYTE)&m_SectionReader, sizeof(m_SectionReader));
+	//
+	// Allocate the buffer for the batch retrieval
+	//
+	m_cbBatchBuffer = OBSRV_BATCH_DEFAULT_SIZE;
+	m_pbBatchBuffer = new BYTE[m_cbBatchBuffer];
+	for (DWORD i = 0; i < PENDED_READS_COUNT; i++)
+	{
+		::ZeroMemory((PBYTE)&m_PendedReads[i].ov, sizeof(OVERLAPPED));
+		m_PendedReads[i].pbBuffer = new BYTE[m_cbBatchBuffer];
+		m_PendedReads[i].bInFlight = FALSE;
+	}
 }
 
 CProcessThreadMonitor::~CProcessThreadMonitor()
 {
-
+	for (DWORD i = 0; i < PENDED_READS_COUNT; i++)
+		delete [] m_PendedReads[i].pbBuffer;
+	delete [] m_pbBatchBuffer;
 }
 
 //
@@ -60,6 +81,137 @@ CProcessThreadMonitor::~CProcessThreadMonitor()
 // the thread runs.
 //
 void CProcessThreadMonitor::Run()
+{
+	if (NOTIFY_SHARED_SECTION == m_eMode)
+		RunSharedSection();
+	else if (NOTIFY_PENDED_READS == m_eMode)
+		RunPendedReads();
+	else
+		RunKernelEvent();
+}
+
+//
+// Read the shared section until it is empty, then sleep until the 
+// driver sets the section event
+//
+void CProcessThreadMonitor::RunSharedSection()
+{
+	DWORD dwBytesReturned;
+
+	if (!MapSharedSection())
+	{
+		::OutputDebugString(TEXT("Shared section not available, using pended reads.\n")); 
+		RunPendedReads();
+		return;
+	}
+
+	HANDLE handles[2] = 
+	{
+		m_hShutdownEvent,
+		m_hSectionEvent
+	};
+
+	while (TRUE)
+	{
+		ReadSharedSection();
+		switch (ObsrvSectionPrepareWait(&m_SectionReader))
+		{
+			//
+			// Records have been published after the last read
+			//
+			case OBSRV_SECTION_READY:
+				continue;
+			//
+			// The section has been full, thus the driver still holds 
+			// records it couldn't move
+			//
+			case OBSRV_SECTION_REFILL:
+				::ResetEvent(m_ovRetrieve.hEvent);
+				::DeviceIoControl(
+					m_hDriverFile,
+					IOCTL_PROCOBSRV_REFILL_SECTION,
+					0, 
+					0,
+					0, 
+					0,
+					&dwBytesReturned,
+					&m_ovRetrieve
+					);
+				::GetOverlappedResult(m_hDriverFile, &m_ovRetrieve, &dwBytesReturned, TRUE);
+				continue;
+		} // switch
+		DWORD dwResult = ::WaitForMultipleObjects(
+			sizeof(handles)/sizeof(handles[0]), // number of handles in array
+			&handles[0],                        // object-handle array
+			FALSE,                              // wait option
+			INFINITE                            // time-out interval
+			);
+		//
+		// the system shuts down
+		//
+		if (handles[dwResult - WAIT_OBJECT_0] == m_hShutdownEvent)
+			break;
+	} // while
+	//
+	// Whatever has been published so far is still queued. The section
+	// goes away with the driver handle.
+	//
+	ReadSharedSection();
+	ObsrvSectionRelease(&m_SectionReader);
+}
+
+//
+// Ask the driver to map the shared section and attach to it
+//
+BOOL CProcessThreadMonitor::MapSharedSection()
+{
+	SECTION_MAP_INFO mapInfo;
+	DWORD            dwBytesReturned = 0;
+
+	::ZeroMemory((PBYTE)&mapInfo, sizeof(mapInfo));
+	mapInfo.hEvent = (OBSRV_U64)(ULONG_PTR)m_hSectionEvent;
+	::ResetEvent(m_ovRetrieve.hEvent);
+	::DeviceIoControl(
+		m_hDriverFile,
+		IOCTL_PROCOBSRV_MAP_SECTION,
+		&mapInfo, 
+		sizeof(mapInfo),
+		&mapInfo, 
+		sizeof(mapInfo),
+		&dwBytesReturned,
+		&m_ovRetrieve
+		);
+	if (!::GetOverlappedResult(m_hDriverFile, &m_ovRetrieve, &dwBytesReturned, TRUE) ||
+	    (sizeof(mapInfo) != dwBytesReturned))
+		return FALSE;
+
+	return ObsrvSectionAttach(
+		&m_SectionReader, 
+		(void*)(ULONG_PTR)mapInfo.pvSection, 
+		(size_t)mapInfo.cbSection
+		);
+}
+
+//
+// Append all records found in the shared section to the queue. They 
+// are decoded in place, the space is given back once they are queued.
+//
+void CProcessThreadMonitor::ReadSharedSection()
+{
+	const void* pvRecord;
+	DWORD       dwSize;
+
+	while (0 != (dwSize = ObsrvSectionRead(&m_SectionReader, &pvRecord)))
+		AppendRecord((const BYTE*)pvRecord, dwSize);
+	ObsrvSectionRelease(&m_SectionReader);
+	m_pRequestManager->SetDriverOverflow(ObsrvSectionOverflow(&m_SectionReader));
+}
+
+//
+// Wait on the driver's named event and fetch the records whenever 
+// it gets pulsed
+//
+void CProcessThreadMonitor::RunKernelEvent()
 {
 	HANDLE handles[2] = 
 	{
@@ -81,13 +233,119 @@ void CProcessThreadMonitor::Run()
 		if (handles[dwResult - WAIT_OBJECT_0] == m_hShutdownEvent)
 			break;
 		//
-		// The kernel event has been just signaled
+		// The kernel event has been just signaled. Several processes 
+		// might have been started since the last pulse, so drain all 
+		// records the driver has queued.
 		//
 		else
 			RetrieveFromKernelDriver();
 	} // while
 }
 
+//
+// Keep PENDED_READS_COUNT read requests pending in the driver and 
+// re-issue each of them as soon as it has been completed
+//
+void CProcessThreadMonitor::RunPendedReads()
+{
+	DWORD nNext   = 0;
+	BOOL  bPended = TRUE;
+
+	for (DWORD i = 0; bPended && (i < PENDED_READS_COUNT); i++)
+		bPended = IssuePendedRead(i);
+
+	while (bPended)
+	{
+		//
+		// The driver completes the requests in the order they were 
+		// issued, thus waiting on the oldest one keeps the records
+		// in order
+		//
+		HANDLE handles[2] = 
+		{
+			m_hShutdownEvent,
+			m_PendedReads[nNext].ov.hEvent
+		};
+		DWORD dwResult = ::WaitForMultipleObjects(
+			sizeof(handles)/sizeof(handles[0]), // number of handles in array
+			&handles[0],                        // object-handle array
+			FALSE,                              // wait option
+			INFINITE                            // time-out interval
+			);
+		//
+		// the system shuts down
+		//
+		if (handles[dwResult - WAIT_OBJECT_0] == m_hShutdownEvent)
+			break;
+		CompletePendedRead(nNext, FALSE);
+		bPended = IssuePendedRead(nNext);
+		nNext = (nNext + 1) % PENDED_READS_COUNT;
+	} // while
+	//
+	// Cancel whatever is still pending and wait until the driver has 
+	// given the buffers back. Records delivered in the meantime are
+	// still queued.
+	//
+	::CancelIoEx(m_hDriverFile, NULL);
+	for (DWORD i = 0; i < PENDED_READS_COUNT; i++)
+		CompletePendedRead((nNext + i) % PENDED_READS_COUNT, TRUE);
+	//
+	// The driver doesn't accept pended reads - fall back to the
+	// kernel event
+	//
+	if (!bPended)
+	{
+		::OutputDebugString(TEXT("Pended reads failed, using the kernel event.\n")); 
+		RunKernelEvent();
+	}
+}
+
+//
+// Send the n-th pended read request to the driver
+//
+BOOL CProcessThreadMonitor::IssuePendedRead(DWORD nIndex)
+{
+	PENDED_READ& read = m_PendedReads[nIndex];
+	DWORD        dwBytesReturned;
+
+	::ResetEvent(read.ov.hEvent);
+	BOOL bReturnCode = ::DeviceIoControl(
+		m_hDriverFile,
+		IOCTL_PROCOBSRV_WAIT_PROCINFO,
+		0, 
+		0,
+		read.pbBuffer, 
+		m_cbBatchBuffer,
+		&dwBytesReturned,
+		&read.ov
+		);
+
+	read.bInFlight = (bReturnCode || (ERROR_IO_PENDING == ::GetLastError()));
+	return read.bInFlight;
+}
+
+//
+// Append the records of a completed pended read to the queue. 
+// bWait tells whether to block until the driver completes it.
+//
+void CProcessThreadMonitor::CompletePendedRead(DWORD nIndex, BOOL bWait)
+{
+	PENDED_READ&       read = m_PendedReads[nIndex];
+	DWORD              dwBytesReturned = 0;
+	OBSRV_BATCH_HEADER header;
+	const BYTE*        pbRecords;
+
+	if (!read.bInFlight)
+		return;
+	read.bInFlight = FALSE;
+	if (::GetOverlappedResult(m_hDriverFile, &read.ov, &dwBytesReturned, bWait))
+	{
+		pbRecords = (const BYTE*)ObsrvBatchDecode(read.pbBuffer, dwBytesReturned, &header);
+		if (NULL != pbRecords)
+			AppendRecords(pbRecords, header);
+	}
+}
+
 //
 // Perform action prior to activate the thread
 //
@@ -110,6 +368,34 @@ BOOL CProcessThreadMonitor::OnBeforeActivate()
 		// Attach to kernel mode created event handle
 		//
 		bResult = OpenKernelModeEvent();
+	if (bResult)
+	{
+		//
+		// Create event handles for async notification from the driver.
+		// They are reused by all retrieval requests.
+		//
+		m_ovRetrieve.hEvent = ::CreateEvent(
+			NULL,  // Default security
+			TRUE,  // Manual reset
+			FALSE, // non-signaled state
+			NULL
+			); 
+		bResult = (NULL != m_ovRetrieve.hEvent);
+		for (DWORD i = 0; bResult && (i < PENDED_READS_COUNT); i++)
+		{
+			m_PendedReads[i].ov.hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+			bResult = (NULL != m_PendedReads[i].ov.hEvent);
+		}
+	}
+	if (bResult)
+	{
+		//
+		// Auto reset, the driver sets it once for each time the monitor
+		// goes to sleep
+		//
+		m_hSectionEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+		bResult = (NULL != m_hSectionEvent);
+	}
 
 	return bResult;
 }
@@ -119,6 +405,24 @@ BOOL CProcessThreadMonitor::OnBeforeActivate()
 //
 void CProcessThreadMonitor::OnAfterDeactivate()
 {
+	if (NULL != m_ovRetrieve.hEvent)
+	{
+		::CloseHandle(m_ovRetrieve.hEvent);
+		m_ovRetrieve.hEvent = NULL;
+	}
+	if (NULL != m_hSectionEvent)
+	{
+		::CloseHandle(m_hSectionEvent);
+		m_hSectionEvent = NULL;
+	}
+	for (DWORD i = 0; i < PENDED_READS_COUNT; i++)
+	{
+		if (NULL != m_PendedReads[i].ov.hEvent)
+		{
+			::CloseHandle(m_PendedReads[i].ov.hEvent);
+			m_PendedReads[i].ov.hEvent = NULL;
+		}
+	}
 	if (INVALID_HANDLE_VALUE != m_hKernelEvent)
 	{
 		::CloseHandle(m_hKernelEvent);
@@ -150,35 +454,30 @@ BOOL CProcessThreadMonitor::OpenKernelModeEvent()
 }
 
 //
-// Retrieve data from the kernel mode driver.
+// Fetch a single batch of records with one DeviceIoControl round trip
 //
-void CProcessThreadMonitor::RetrieveFromKernelDriver()
+BOOL CProcessThreadMonitor::ReadBatch(
+	const BYTE*&        pbRecords,
+	OBSRV_BATCH_HEADER& header
+	)
 {
-	OVERLAPPED  ov          = { 0 };
-	BOOL        bReturnCode = FALSE;
-	DWORD       dwBytesReturned;
-	PROCESS_CALLBACK_INFO  callbackInfo;
-	QUEUED_ITEM queuedItem;         
-	//
-    // Create an event handle for async notification from the driver
-	//
-	ov.hEvent = ::CreateEvent(
-		NULL,  // Default security
-		TRUE,  // Manual reset
-		FALSE, // non-signaled state
-		NULL
-		); 
+	BOOL               bReturnCode = FALSE;
+	DWORD              dwBytesReturned = 0;
+
+	pbRecords = NULL;
+	::ResetEvent(m_ovRetrieve.hEvent);
 	//
 	// Get the process info
 	//
 	bReturnCode = ::DeviceIoControl(
 		m_hDriverFile,
-		IOCTL_PROCOBSRV_GET_PROCINFO,
+		IOCTL_PROCOBSRV_GET_PROCINFO_BATCH,
 		0, 
 		0,
-		&callbackInfo, sizeof(callbackInfo),
+		m_pbBatchBuffer, 
+		m_cbBatchBuffer,
 		&dwBytesReturned,
-		&ov
+		&m_ovRetrieve
 		);
 	//
 	// Wait here for the event handle to be set, indicating
@@ -186,37 +485,229 @@ void CProcessThreadMonitor::RetrieveFromKernelDriver()
 	//
 	bReturnCode = ::GetOverlappedResult(
 		m_hDriverFile, 
-		&ov,
+		&m_ovRetrieve,
 		&dwBytesReturned, 
 		TRUE
 		);
+	if (!bReturnCode)
+		return FALSE;
 	//
-	// Prevent duplicated events
+	// Validate what the driver has returned
 	//
-	if ( (m_LastCallbackInfo.bCreate != callbackInfo.bCreate) ||
-	     (m_LastCallbackInfo.hParentId != callbackInfo.hParentId) ||
-		 (m_LastCallbackInfo.hProcessId != callbackInfo.hProcessId) )
+	pbRecords = (const BYTE*)ObsrvBatchDecode(m_pbBatchBuffer, dwBytesReturned, &header);
+
+	return (NULL != pbRecords);
+}
+
+//
+// Retrieve all pending records from the kernel mode driver and 
+// append them to the queue
+//
+BOOL CProcessThreadMonitor::RetrieveFromKernelDriver()
+{
+	const BYTE*        pbRecords;
+	OBSRV_BATCH_HEADER header;
+
+	do
 	{
+		if (!ReadBatch(pbRecords, header))
+			return FALSE;
+		AppendRecords(pbRecords, header);
+	} while (0 != (header.Flags & OBSRV_BATCH_FLAG_MORE_PENDING));
+
+	return TRUE;
+}
+
+//
+// Copy a string of a decoded record into a fixed size buffer
+//
+static void CopyRecordString(
+	WCHAR*           pszDest,
+	DWORD            cchDest,
+	const OBSRV_U16* pszSource,
+	DWORD            cchSource
+	)
+{
+	if (cchSource >= cchDest)
+		cchSource = cchDest - 1;
+	if (0 != cchSource)
+		::CopyMemory(pszDest, pszSource, cchSource * sizeof(WCHAR));
+	pszDest[cchSource] = L'\0';
+}
+
+//
+// Decode the records of a batch and hand them over to the queue
+//
+void CProcessThreadMonitor::AppendRecords(
+	const BYTE*               pbRecords,
+	const OBSRV_BATCH_HEADER& header
+	)
+{
+	DWORD dwOffset = 0;
+	DWORD dwSize;
+
+	for (DWORD i = 0; i < header.Count; i++)
+	{
+		dwSize = AppendRecord(pbRecords + dwOffset, header.Bytes - dwOffset);
 		//
-		// Setup the queued element
-		//
-		::ZeroMemory((PBYTE)&queuedItem, sizeof(queuedItem));
-		queuedItem.hParentId = callbackInfo.hParentId;
-		queuedItem.hProcessId = callbackInfo.hProcessId;
-		queuedItem.bCreate = callbackInfo.bCreate;
-		//
-		// and add it to the queue
-		//
-		m_pRequestManager->Append(queuedItem);
-		//
-		// Hold last event
+		// The rest of the batch can't be trusted
 		//
-		m_LastCallbackInfo = callbackInfo;
-	} // if
+		if (0 == dwSize)
+			break;
+		dwOffset += dwSize;
+	} // for
+	m_pRequestManager->SetDriverOverflow(header.Overflow);
+}
+
+//
+// Decode a single record and hand it over to the queue
+//
+DWORD CProcessThreadMonitor::AppendRecord(
+	const BYTE* pbRecord,
+	DWORD       cbAvailable
+	)
+{
+	QUEUED_ITEM       queuedItem;         
+	OBSRV_RECORD_VIEW view;
+	DWORD             dwSize;
+	WCHAR             szImagePath[MAX_PATH];
+	WCHAR             szCommandLine[QUEUED_ITEM_MAX_COMMAND_LINE];
+
+	dwSize = ObsrvRecordDecode(pbRecord, cbAvailable, &view);
+	if (0 == dwSize)
+		return 0;
+	if (OBSRV_KIND_IMAGE_LOAD == view.Kind)
+	{
+		AppendImages(pbRecord, view);
+		return dwSize;
+	}
+	if (OBSRV_KIND_THREAD == view.Kind)
+	{
+		AppendThreads(pbRecord, view);
+		return dwSize;
+	}
+	if (!ObsrvIsProcessKind(view.Kind))
+		return dwSize;
+	//
+	// Every record is numbered by the driver, thus repeats are real 
+	// events (e.g. a PID reused right away) and lost records show up
+	// as gaps in the queue's statistics
+	//
+	::ZeroMemory((PBYTE)&queuedItem, sizeof(queuedItem));
+	queuedItem.eKind              = QUEUED_ITEM_PROCESS;
+	queuedItem.hParentId          = view.ParentId;
+	queuedItem.hProcessId         = view.ProcessId;
+	queuedItem.bCreate            = (OBSRV_KIND_PROCESS_CREATE == view.Kind);
+	queuedItem.ullSequence        = view.Sequence;
+	queuedItem.dwCreatingThreadId = view.CreatingThreadId;
+	queuedItem.dwSessionId        = view.SessionId;
+	queuedItem.dwExitStatus       = view.ExitStatus;
+	CopyRecordString(
+		szImagePath, 
+		MAX_PATH,
+		view.ImagePath, 
+		view.ImagePathLength
+		);
+	CopyRecordString(
+		szCommandLine, 
+		QUEUED_ITEM_MAX_COMMAND_LINE,
+		view.CommandLine, 
+		view.CommandLineLength
+		);
+	queuedItem.dwImageId       = CStringTable::GetInstance().Intern(szImagePath);
+	queuedItem.dwCommandLineId = CCommandLineTable::GetInstance().Add(szCommandLine);
+	//
+	// The driver reads the same performance counter as 
+	// QueryPerformanceCounter() does
 	//
+	queuedItem.llSourceTime = view.Timestamp;
 	//
+	// and add it to the queue
 	//
-	::CloseHandle(ov.hEvent);
+	m_pRequestManager->Append(queuedItem);
+
+	return dwSize;
+}
+
+//
+// Split a batch of image loads the driver has coalesced into one queued
+// item per image
+//
+void CProcessThreadMonitor::AppendImages(
+	const BYTE*              pbRecord,
+	const OBSRV_RECORD_VIEW& view
+	)
+{
+	QUEUED_ITEM      queuedItem;         
+	OBSRV_IMAGE_VIEW image;
+	WCHAR            szImagePath[MAX_PATH];
+	OBSRV_U32        nOffset = 0;
+
+	::ZeroMemory((PBYTE)&queuedItem, sizeof(queuedItem));
+	queuedItem.eKind        = QUEUED_ITEM_IMAGE_LOAD;
+	queuedItem.hProcessId   = view.ProcessId;
+	queuedItem.llSourceTime = view.Timestamp;
+	//
+	// The batch carries a single sequence number. The images following
+	// the first one are left unnumbered, thus they don't show up as 
+	// repeats.
+	//
+	queuedItem.ullSequence  = view.Sequence;
+	while (ObsrvRecordNextImage(pbRecord, &nOffset, &image))
+	{
+		queuedItem.ullImageBase = image.ImageBase;
+		queuedItem.ullImageSize = image.ImageSize;
+		queuedItem.bSystemImage = (0 != (image.Flags & OBSRV_IMAGE_FLAG_SYSTEM));
+		CopyRecordString(
+			szImagePath, 
+			MAX_PATH,
+			image.ImagePath, 
+			image.ImagePathLength
+			);
+		queuedItem.dwImageId = CStringTable::GetInstance().Intern(szImagePath);
+		m_pRequestManager->Append(queuedItem);
+		queuedItem.ullSequence = 0;
+	} // while
+}
+
+//
+// Split a record of thread events the driver has merged from its per-CPU
+// buffers. They are many, thus they are queued with a single append.
+//
+void CProcessThreadMonitor::AppendThreads(
+	const BYTE*              pbRecord,
+	const OBSRV_RECORD_VIEW& view
+	)
+{
+	OBSRV_THREAD_ENTRY thread;
+	OBSRV_U32          nOffset = 0;
+	DWORD              dwCount = 0;
+
+	if (0 != view.Dropped)
+		m_pRequestManager->AddThreadDropped(view.Dropped);
+	//
+	// Grown items are zeroed, the fields set below are all that differs
+	// from one thread event to another
+	//
+	if (m_ThreadItems.size() < view.ThreadCount)
+		m_ThreadItems.resize(view.ThreadCount);
+	while ((dwCount < view.ThreadCount) && 
+	       ObsrvRecordNextThread(pbRecord, &nOffset, &thread))
+	{
+		QUEUED_ITEM& queuedItem = m_ThreadItems[dwCount++];
+
+		queuedItem.eKind        = QUEUED_ITEM_THREAD;
+		queuedItem.hProcessId   = thread.ProcessId;
+		queuedItem.dwThreadId   = thread.ThreadId;
+		queuedItem.bCreate      = (0 != (thread.Flags & OBSRV_THREAD_FLAG_CREATE));
+		queuedItem.llSourceTime = thread.Timestamp;
+		//
+		// Numbered like the images of a batch
+		//
+		queuedItem.ullSequence  = (1 == dwCount) ? view.Sequence : 0;
+	} // while
+	if (0 != dwCount)
+		m_pRequestManager->AppendBatch(&m_ThreadItems[0], dwCount);
 }
 
 //----------------------------End of the file -------------------------------
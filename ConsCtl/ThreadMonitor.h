@@ -27,37 +27,44 @@
 //---------------------------------------------------------------------------
 #include "CustomThread.h"
 #include "QueueContainer.h"
+#include "../Shared/ObsrvIoctl.h"
+#include "../Shared/ObsrvBatch.h"
+#include "../Shared/ObsrvSection.h"
+#include <vector>
 
 //---------------------------------------------------------------------------
 //
-// Typedefs
+// Aplication scope consts and typedefs
 //
 //---------------------------------------------------------------------------
 
 //
-// Structure for process callback information
+// Number of read requests kept pending in the driver
 //
-//typedef struct _ProcessCallbackInfo
-//{
-//    DWORD32  hParentId;
-//    DWORD32  hProcessId;
-//    BOOLEAN  bCreate;
-//} PROCESS_CALLBACK_INFO, *PPROCESS_CALLBACK_INFO;
-
-typedef QUEUED_ITEM PROCESS_CALLBACK_INFO;
+#define PENDED_READS_COUNT              4
 
-//---------------------------------------------------------------------------
 //
-// Aplication scope consts and typedefs
+// How the monitor learns about new records
 //
-//---------------------------------------------------------------------------
-
-#define FILE_DEVICE_UNKNOWN             0x00000022
-#define IOCTL_UNKNOWN_BASE              FILE_DEVICE_UNKNOWN
-#define IOCTL_PROCOBSRV_ACTIVATE_MONITORING    \
-	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0800, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
-#define IOCTL_PROCOBSRV_GET_PROCINFO    \
-	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0801, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+enum NOTIFICATION_MODE
+{
+	//
+	// Wait on the driver's named event, then fetch the records. A pulse 
+	// that fires while the thread is busy is lost.
+	//
+	NOTIFY_KERNEL_EVENT,
+	//
+	// Keep read requests pending in the driver, which completes them 
+	// with the records (inverted call)
+	//
+	NOTIFY_PENDED_READS,
+	//
+	// Read the records in place from a section the driver maps into 
+	// the process. The driver signals an event only when the monitor
+	// has gone to sleep.
+	//
+	NOTIFY_SHARED_SECTION
+};
 
 
 
@@ -78,7 +85,8 @@ public:
 	CProcessThreadMonitor(
 		TCHAR*               pszThreadGuid,     // Thread unique ID
 		CNtDriverController* pDriverController, // service controller
-		CQueueContainer*     pRequestManager    // The underlying store
+		CQueueContainer*     pRequestManager,   // The underlying store
+		NOTIFICATION_MODE    eMode = NOTIFY_SHARED_SECTION
 		);
 	virtual ~CProcessThreadMonitor();
 private:
@@ -103,13 +111,76 @@ protected:
 	//
 	virtual void OnAfterDeactivate();
 	//
+	// Thread function bodies for both notification modes
+	//
+	void RunKernelEvent();
+	void RunPendedReads();
+	void RunSharedSection();
+	//
+	// Ask the driver to map the shared section and attach to it
+	//
+	BOOL MapSharedSection();
+	//
+	// Append all records found in the shared section to the queue
+	//
+	void ReadSharedSection();
+	//
+	// Send the n-th pended read request to the driver
+	//
+	BOOL IssuePendedRead(DWORD nIndex);
+	//
+	// Append the records of a completed pended read to the queue. 
+	// bWait tells whether to block until the driver completes it.
+	//
+	void CompletePendedRead(DWORD nIndex, BOOL bWait);
+	//
 	// Attach to kernel mode created event handle
 	//
 	BOOL OpenKernelModeEvent();
 	//
-	// Retrieve data from the kernel mode driver.
+	// Retrieve all pending records from the kernel mode driver and 
+	// append them to the queue
+	//
+	BOOL RetrieveFromKernelDriver();
 	//
-	void RetrieveFromKernelDriver();
+	// Fetch a single batch of records with one DeviceIoControl round trip.
+	// On success pbRecords points to the encoded records inside the 
+	// internal batch buffer; they remain valid until the next call. 
+	// header tells how many there are and whether more are pending.
+	//
+	BOOL ReadBatch(
+		const BYTE*&        pbRecords,
+		OBSRV_BATCH_HEADER& header
+		);
+	//
+	// Decode the records of a batch and hand them over to the queue
+	//
+	void AppendRecords(
+		const BYTE*               pbRecords,
+		const OBSRV_BATCH_HEADER& header
+		);
+	//
+	// Decode a single record and hand it over to the queue. Returns its
+	// size, or 0 if it isn't valid.
+	//
+	DWORD AppendRecord(
+		const BYTE* pbRecord,
+		DWORD       cbAvailable
+		);
+	//
+	// Queue the images of a decoded image load record one by one
+	//
+	void AppendImages(
+		const BYTE*              pbRecord,
+		const OBSRV_RECORD_VIEW& view
+		);
+	//
+	// Queue the thread events of a decoded thread record all at once
+	//
+	void AppendThreads(
+		const BYTE*              pbRecord,
+		const OBSRV_RECORD_VIEW& view
+		);
 	//
 	// The underlying store wrapped up by the custom template
 	//
@@ -123,9 +194,38 @@ protected:
 	//
 	HANDLE m_hDriverFile;
 	//
-	// Keep the state of the last received event
+	// Reused for every retrieval request sent to the driver
+	//
+	OVERLAPPED m_ovRetrieve;
+	//
+	// Buffer receiving the batches of records
+	//
+	PBYTE m_pbBatchBuffer;
+	DWORD m_cbBatchBuffer;
+	//
+	// Notification mode selected at construction time
+	//
+	NOTIFICATION_MODE m_eMode;
+	//
+	// Read requests kept pending in NOTIFY_PENDED_READS mode. Each one 
+	// has its own event and batch buffer.
+	//
+	struct PENDED_READ
+	{
+		OVERLAPPED ov;
+		PBYTE      pbBuffer;
+		BOOL       bInFlight;
+	} m_PendedReads[PENDED_READS_COUNT];
+	//
+	// NOTIFY_SHARED_SECTION mode: the event the driver sets to wake the
+	// monitor up, and the reading end of the section
+	//
+	HANDLE               m_hSectionEvent;
+	OBSRV_SECTION_READER m_SectionReader;
+	//
+	// Items of a thread record, reused from record to record
 	//
-	PROCESS_CALLBACK_INFO  m_LastCallbackInfo;
+	vector<QUEUED_ITEM>  m_ThreadItems;
 };
 
 #endif // !defined(_THREADMONITOR_H_)
@@ -9,7 +9,7 @@
 //              monitoring. 
 //
 // DESCRIPTION:
-//              This code is based on the James Finnegans sample 
+//              This code is based on the James Finnegan�s sample 
 //              (MSJ January 1999).
 //
 // Ivo Ivanov, January 2002
@@ -22,6 +22,13 @@
 //  
 //---------------------------------------------------------------------------
 #include <ntddk.h>
+#include "../Shared/ObsrvIoctl.h"
+#include "../Shared/ObsrvRing.h"
+#include "../Shared/ObsrvBatch.h"
+#include "../Shared/ObsrvPend.h"
+#include "../Shared/ObsrvSection.h"
+#include "../Shared/ObsrvFilter.h"
+#include "../Shared/ObsrvPerCpu.h"
 
 //---------------------------------------------------------------------------
 //
@@ -29,12 +36,22 @@
 //  
 //---------------------------------------------------------------------------
 
-#define FILE_DEVICE_UNKNOWN             0x00000022
-#define IOCTL_UNKNOWN_BASE              FILE_DEVICE_UNKNOWN
-#define IOCTL_PROCOBSRV_ACTIVATE_MONITORING    \
-	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0800, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
-#define IOCTL_PROCOBSRV_GET_PROCINFO    \
-	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0801, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// Pool tag used for all allocations made by the driver ('ObsR')
+//
+#define PROCOBSRV_POOL_TAG              'RsbO'
+//
+// Image loads are coalesced per process into this many open batches,
+// picked by a hash of the process ID
+//
+#define IMAGE_BATCH_SLOTS               16
+//
+// Bounds of the "FlushInterval" value (milliseconds) - how long an open
+// image batch waits for more images of its process, and thread events
+// wait in the per-CPU buffers
+//
+#define FLUSH_DEFAULT_INTERVAL          10
+#define FLUSH_MAX_INTERVAL              1000
 //---------------------------------------------------------------------------
 //
 // Forward declaration
@@ -47,35 +64,85 @@ NTSTATUS DispatchCreateClose(
 	IN PDEVICE_OBJECT DeviceObject, 
 	IN PIRP Irp
 	);
+NTSTATUS DispatchCleanup(
+	IN PDEVICE_OBJECT DeviceObject, 
+	IN PIRP Irp
+	);
 NTSTATUS DispatchIoctl(
 	IN PDEVICE_OBJECT DeviceObject, 
 	IN PIRP Irp
 	);
 //
+// Cancel-safe queue callbacks for the parked read requests
+//
+VOID CsqInsertIrp(
+	IN PIO_CSQ Csq, 
+	IN PIRP    Irp
+	);
+VOID CsqRemoveIrp(
+	IN PIO_CSQ Csq, 
+	IN PIRP    Irp
+	);
+PIRP CsqPeekNextIrp(
+	IN PIO_CSQ Csq, 
+	IN PIRP    Irp, 
+	IN PVOID   PeekContext
+	);
+VOID CsqAcquireLock(
+	IN PIO_CSQ Csq, 
+	OUT PKIRQL Irql
+	);
+VOID CsqReleaseLock(
+	IN PIO_CSQ Csq, 
+	IN KIRQL   Irql
+	);
+VOID CsqCompleteCanceledIrp(
+	IN PIO_CSQ Csq, 
+	IN PIRP    Irp
+	);
+//
 // Process function callback
 //  
 VOID ProcessCallback(
-	IN HANDLE  hParentId, 
-	IN HANDLE  hProcessId, 
+	IN OUT PEPROCESS              Process,
+	IN HANDLE                     hProcessId,
+	IN OPTIONAL PPS_CREATE_NOTIFY_INFO CreateInfo
+	);
+//
+// Image load callback
+//
+VOID LoadImageCallback(
+	IN OPTIONAL PUNICODE_STRING FullImageName,
+	IN HANDLE                   hProcessId,
+	IN PIMAGE_INFO              ImageInfo
+	);
+//
+// Thread create/exit callback
+//
+VOID ThreadCallback(
+	IN HANDLE  hProcessId,
+	IN HANDLE  hThreadId,
 	IN BOOLEAN bCreate
 	);
 //
-// Structure for holding info about activating/deactivating the driver
+// Exported by the kernel, but not declared by ntddk.h
 //
-typedef struct _ActivateInfo
-{
-    BOOLEAN  bActivated;
-} ACTIVATE_INFO, *PACTIVATE_INFO;
+NTKERNELAPI ULONG    PsGetProcessSessionId(IN PEPROCESS Process);
+NTKERNELAPI NTSTATUS PsGetProcessExitStatus(IN PEPROCESS Process);
+NTKERNELAPI HANDLE   PsGetProcessInheritedFromUniqueProcessId(IN PEPROCESS Process);
 
 //
-// Structure for process callback information
+// Image loads of a single process, coalesced into one record until it
+// is full, the process exits, another process needs the slot or the 
+// flush timer fires
 //
-typedef struct _ProcessCallbackInfo
+typedef struct _IMAGE_BATCH
 {
-    DWORD32  hParentId;
-	DWORD32  hProcessId;
-    BOOLEAN bCreate;
-} PROCESS_CALLBACK_INFO, *PPROCESS_CALLBACK_INFO;
+	ULONG               ProcessId;
+	LONGLONG            Timestamp;  // First image of the batch
+	PVOID               Buffer;     // NULL if the slot is free
+	OBSRV_RECORD_WRITER Writer;
+} IMAGE_BATCH, *PIMAGE_BATCH;
 
 //
 // Private storage for process retreiving 
@@ -83,24 +150,146 @@ typedef struct _ProcessCallbackInfo
 typedef struct _DEVICE_EXTENSION 
 {
     PDEVICE_OBJECT DeviceObject;
-	//
-	// Shared section
-	//
-    HANDLE  hProcessId;
 	//
 	// Process section data
 	//
     PKEVENT ProcessEvent;
-    HANDLE  hParentId;
-    BOOLEAN bCreate;
+	//
+	// Records waiting to be picked up by the user-mode app. The notify
+	// routine pushes without locking, readers are serialized by 
+	// RingReadLock.
+	//
+	OBSRV_RING       Ring;
+	POBSRV_RING_CELL RingCells;
+	FAST_MUTEX       RingReadLock;
+	//
+	// Read requests kept pending by the user-mode app until records
+	// arrive (see ObsrvPend.h)
+	//
+	IO_CSQ           PendingReads;
+	OBSRV_PEND_QUEUE PendQueue;
+	KSPIN_LOCK       PendLock;
+	//
+	// Section shared with the user-mode app (see ObsrvSection.h). It is
+	// set up and torn down under RingReadLock and fed by the deliver 
+	// step.
+	//
+	ULONG                SectionDataSize;
+	PVOID                SectionMemory;
+	PMDL                 SectionMdl;
+	PVOID                SectionUserAddress;
+	PFILE_OBJECT         SectionOwner;
+	PKEVENT              SectionEvent;
+	OBSRV_SECTION_WRITER SectionWriter;
+	//
+	// Open image load batches, guarded by ImageLock
+	//
+	FAST_MUTEX           ImageLock;
+	IMAGE_BATCH          ImageBatches[IMAGE_BATCH_SLOTS];
+	//
+	// Per-CPU buffers of thread events (see ObsrvPerCpu.h), allocated on
+	// activation if thread events have been subscribed to. The callback
+	// fills them at DISPATCH_LEVEL, flushing merges them under 
+	// ThreadLock. ThreadDropped holds drops not reported yet.
+	//
+	FAST_MUTEX           ThreadLock;
+	ULONG                ThreadBufferCount;
+	ULONG                ThreadBufferCapacity;
+	POBSRV_CPU_BUFFER    ThreadBuffers;
+	PVOID                ThreadEntries;
+	PVOID                ThreadMergeScratch;
+	ULONG64              ThreadDropped;
+	//
+	// The flush timer is armed when an image batch gets opened or a 
+	// thread event gets buffered, and runs the flush work item once 
+	// FlushDelay has passed
+	//
+	KTIMER               FlushTimer;
+	KDPC                 FlushDpc;
+	PIO_WORKITEM         FlushWorkItem;
+	LARGE_INTEGER        FlushDelay;
+	LONG                 FlushArmed;
+	LONG                 FlushQueued;
+	//
+	// Compiled filter (ObsrvFilter.h) process events have to pass, NULL
+	// if none. Replaced under FilterLock held exclusively.
+	//
+	EX_PUSH_LOCK         FilterLock;
+	PVOID                Filter;
+	volatile BOOLEAN     FilterNeedsImagePath;
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
+//
+// Unmap the shared section on cleanup of the handle that has mapped it
+//
+VOID UnmapSection(
+	IN PDEVICE_EXTENSION extension,
+	IN PFILE_OBJECT      fileObject
+	);
+//
+// Release the per-CPU thread event buffers
+//
+VOID FreeThreadBuffers(
+	IN PDEVICE_EXTENSION extension
+	);
+//
+// Merge the per-CPU buffers into the ring, TRUE if anything was appended
+//
+BOOLEAN FlushThreadBuffers(
+	IN PDEVICE_EXTENSION extension
+	);
+//
+// Flush timer DPC and work item
+//
+VOID FlushDpcRoutine(
+	IN PKDPC Dpc,
+	IN PVOID DeferredContext,
+	IN PVOID SystemArgument1,
+	IN PVOID SystemArgument2
+	);
+VOID FlushWorker(
+	IN PDEVICE_OBJECT DeviceObject,
+	IN PVOID          Context
+	);
+
 //
 // Global variables
 //
 PDEVICE_OBJECT g_pDeviceObject;
 ACTIVATE_INFO  g_ActivateInfo;
 
+//
+// Read a DWORD value (e.g. "RingCapacity") of the driver's service key
+//
+ULONG QueryDwordValue(
+	IN PUNICODE_STRING RegistryPath,
+	IN PWSTR           pszName,
+	IN ULONG           ulDefault
+	)
+{
+	RTL_QUERY_REGISTRY_TABLE queryTable[2];
+	ULONG                    ulValue = ulDefault;
+
+	RtlZeroMemory(queryTable, sizeof(queryTable));
+	queryTable[0].Flags         = RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK;
+	queryTable[0].Name          = pszName;
+	queryTable[0].EntryContext  = &ulValue;
+	queryTable[0].DefaultType   = (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD;
+	queryTable[0].DefaultData   = &ulDefault;
+	queryTable[0].DefaultLength = sizeof(ulDefault);
+
+	if (!NT_SUCCESS(RtlQueryRegistryValues(
+			RTL_REGISTRY_ABSOLUTE, 
+			RegistryPath->Buffer, 
+			queryTable, 
+			NULL, 
+			NULL
+			)))
+		ulValue = ulDefault;
+
+	return ulValue;
+}
+
 //
 // The main entry point of the driver module
 //
@@ -116,9 +305,10 @@ NTSTATUS DriverEntry(
     PDEVICE_OBJECT            pDeviceObject;
     PDEVICE_EXTENSION         extension;
 	HANDLE                    hProcessHandle;
+	ULONG                     ulRingCapacity;
+	ULONG                     ulFlushInterval;
 
 	UNREFERENCED_PARAMETER(DriverObject);
-	UNREFERENCED_PARAMETER(RegistryPath);
 
 	//    
 	// Point uszDriverString at the driver name
@@ -142,6 +332,85 @@ NTSTATUS DriverEntry(
 	// Assign extension variable
 	//
     extension = pDeviceObject->DeviceExtension;
+	//
+	// Allocate the event ring
+	//
+	ulRingCapacity = ObsrvRingRoundCapacity(
+		QueryDwordValue(RegistryPath, L"RingCapacity", OBSRV_RING_DEFAULT_CAPACITY)
+		);
+	extension->RingCells = ExAllocatePool2(
+		POOL_FLAG_NON_PAGED,
+		ObsrvRingStorageSize(ulRingCapacity),
+		PROCOBSRV_POOL_TAG
+		);
+	if (NULL == extension->RingCells)
+	{
+		IoDeleteDevice(pDeviceObject);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	ObsrvRingInit(&extension->Ring, extension->RingCells, ulRingCapacity);
+	ExInitializeFastMutex(&extension->RingReadLock);
+	//
+	// The shared section is allocated once an app asks for it
+	//
+	extension->SectionDataSize = ObsrvSectionRoundSize(
+		QueryDwordValue(RegistryPath, L"SectionSize", OBSRV_SECTION_DEFAULT_SIZE)
+		);
+	extension->SectionMemory   = NULL;
+	//
+	// Image load batching
+	//
+	ExInitializeFastMutex(&extension->ImageLock);
+	RtlZeroMemory(extension->ImageBatches, sizeof(extension->ImageBatches));
+	//
+	// Thread event buffers are allocated once an app subscribes to them
+	//
+	ExInitializeFastMutex(&extension->ThreadLock);
+	extension->ThreadBufferCapacity = ObsrvCpuBufferRoundCapacity(
+		QueryDwordValue(RegistryPath, L"ThreadBufferCapacity", OBSRV_CPU_BUFFER_DEFAULT_CAPACITY)
+		);
+	extension->ThreadBuffers        = NULL;
+	extension->ThreadEntries        = NULL;
+	extension->ThreadMergeScratch   = NULL;
+	extension->ThreadBufferCount    = 0;
+	//
+	// Flushing of both
+	//
+	KeInitializeTimer(&extension->FlushTimer);
+	KeInitializeDpc(&extension->FlushDpc, FlushDpcRoutine, extension);
+	ulFlushInterval = QueryDwordValue(RegistryPath, L"FlushInterval", FLUSH_DEFAULT_INTERVAL);
+	if ((0 == ulFlushInterval) || (ulFlushInterval > FLUSH_MAX_INTERVAL))
+		ulFlushInterval = FLUSH_DEFAULT_INTERVAL;
+	extension->FlushDelay.QuadPart = -10000LL * ulFlushInterval;
+	extension->FlushArmed          = 0;
+	extension->FlushQueued         = 0;
+	extension->FlushWorkItem       = IoAllocateWorkItem(pDeviceObject);
+	//
+	// Everything passes until an app installs a filter
+	//
+	ExInitializePushLock(&extension->FilterLock);
+	extension->Filter               = NULL;
+	extension->FilterNeedsImagePath = FALSE;
+	if (NULL == extension->FlushWorkItem)
+	{
+		ExFreePoolWithTag(extension->RingCells, PROCOBSRV_POOL_TAG);
+		IoDeleteDevice(pDeviceObject);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	//
+	// Setup the queue of parked read requests
+	//
+	ObsrvPendQueueInit(&extension->PendQueue);
+	KeInitializeSpinLock(&extension->PendLock);
+	IoCsqInitialize(
+		&extension->PendingReads,
+		CsqInsertIrp,
+		CsqRemoveIrp,
+		CsqPeekNextIrp,
+		CsqAcquireLock,
+		CsqReleaseLock,
+		CsqCompleteCanceledIrp
+		);
     //
 	// Point uszDeviceString at the device name
 	//
@@ -156,6 +425,8 @@ NTSTATUS DriverEntry(
 		//
         // Delete device object if not successful
 		//
+		IoFreeWorkItem(extension->FlushWorkItem);
+		ExFreePoolWithTag(extension->RingCells, PROCOBSRV_POOL_TAG);
         IoDeleteDevice(pDeviceObject);
         return ntStatus;
     }
@@ -166,13 +437,15 @@ NTSTATUS DriverEntry(
 	//
 	// Setup initial state
 	//
-	g_ActivateInfo.bActivated = FALSE;
+	g_ActivateInfo.bActivated    = FALSE;
+	g_ActivateInfo.Subscriptions = 0;
 	//
     // Load structure to point to IRP handlers
 	//
     DriverObject->DriverUnload                         = UnloadDriver;
     DriverObject->MajorFunction[IRP_MJ_CREATE]         = DispatchCreateClose;
     DriverObject->MajorFunction[IRP_MJ_CLOSE]          = DispatchCreateClose;
+    DriverObject->MajorFunction[IRP_MJ_CLEANUP]        = DispatchCleanup;
     DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = DispatchIoctl;
 	//
     // Create event for user-mode processes to monitor
@@ -209,32 +482,794 @@ NTSTATUS DispatchCreateClose(IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp)
 }
 
 //
-// Process function callback
+// Cleanup routine - the handle has been closed, so cancel all read 
+// requests the owner has left pending
 //
-VOID ProcessCallback(
-	IN HANDLE  hParentId, 
-	IN HANDLE  hProcessId, 
-	IN BOOLEAN bCreate
+NTSTATUS DispatchCleanup(IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp)
+{
+	PDEVICE_EXTENSION extension  = DeviceObject->DeviceExtension;
+	PFILE_OBJECT      fileObject = IoGetCurrentIrpStackLocation(Irp)->FileObject;
+	PIRP              pendingIrp;
+
+	while (NULL != (pendingIrp = IoCsqRemoveNextIrp(&extension->PendingReads, fileObject)))
+	{
+		pendingIrp->IoStatus.Status      = STATUS_CANCELLED;
+		pendingIrp->IoStatus.Information = 0;
+		IoCompleteRequest(pendingIrp, IO_NO_INCREMENT);
+	}
+	//
+	// We are in the context of the process the section has been mapped
+	// into, so it can be unmapped now
+	//
+	UnmapSection(extension, fileObject);
+
+    Irp->IoStatus.Status      = STATUS_SUCCESS;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    return STATUS_SUCCESS;
+}
+
+//
+// Cancel-safe queue callbacks. The IRPs are linked through 
+// Tail.Overlay.ListEntry into the portable pending queue.
+//
+VOID CsqInsertIrp(IN PIO_CSQ Csq, IN PIRP Irp)
+{
+	PDEVICE_EXTENSION extension = CONTAINING_RECORD(Csq, DEVICE_EXTENSION, PendingReads);
+
+	ObsrvPendQueueInsert(
+		&extension->PendQueue, 
+		(POBSRV_PEND_LINK)&Irp->Tail.Overlay.ListEntry
+		);
+}
+
+VOID CsqRemoveIrp(IN PIO_CSQ Csq, IN PIRP Irp)
+{
+	PDEVICE_EXTENSION extension = CONTAINING_RECORD(Csq, DEVICE_EXTENSION, PendingReads);
+
+	ObsrvPendQueueRemove(
+		&extension->PendQueue, 
+		(POBSRV_PEND_LINK)&Irp->Tail.Overlay.ListEntry
+		);
+}
+
+PIRP CsqPeekNextIrp(IN PIO_CSQ Csq, IN PIRP Irp, IN PVOID PeekContext)
+{
+	PDEVICE_EXTENSION extension = CONTAINING_RECORD(Csq, DEVICE_EXTENSION, PendingReads);
+	POBSRV_PEND_LINK  pLink     = NULL;
+	PIRP              nextIrp;
+
+	if (NULL != Irp)
+		pLink = (POBSRV_PEND_LINK)&Irp->Tail.Overlay.ListEntry;
+	//
+	// PeekContext, when given, restricts the search to a file object
+	//
+	while (NULL != (pLink = ObsrvPendQueuePeekNext(&extension->PendQueue, pLink)))
+	{
+		nextIrp = CONTAINING_RECORD(pLink, IRP, Tail.Overlay.ListEntry);
+		if ((NULL == PeekContext) || 
+		    (IoGetCurrentIrpStackLocation(nextIrp)->FileObject == (PFILE_OBJECT)PeekContext))
+			return nextIrp;
+	}
+	return NULL;
+}
+
+VOID CsqAcquireLock(IN PIO_CSQ Csq, OUT PKIRQL Irql)
+{
+	PDEVICE_EXTENSION extension = CONTAINING_RECORD(Csq, DEVICE_EXTENSION, PendingReads);
+
+	KeAcquireSpinLock(&extension->PendLock, Irql);
+}
+
+VOID CsqReleaseLock(IN PIO_CSQ Csq, IN KIRQL Irql)
+{
+	PDEVICE_EXTENSION extension = CONTAINING_RECORD(Csq, DEVICE_EXTENSION, PendingReads);
+
+	KeReleaseSpinLock(&extension->PendLock, Irql);
+}
+
+VOID CsqCompleteCanceledIrp(IN PIO_CSQ Csq, IN PIRP Irp)
+{
+	UNREFERENCED_PARAMETER(Csq);
+
+	Irp->IoStatus.Status      = STATUS_CANCELLED;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+//
+// Free the variable length fields of a record taken off the ring
+//
+VOID ReleaseRecord(
+	IN POBSRV_PROCESS_RECORD pRecord
 	)
 {
-	PDEVICE_EXTENSION extension;
+	if (NULL != pRecord->Extra)
+	{
+		ExFreePoolWithTag(pRecord->Extra, PROCOBSRV_POOL_TAG);
+		pRecord->Extra = NULL;
+	}
+}
+
+//
+// Encode image path and command line into a pool allocated record, 
+// truncated to OBSRV_PROCESS_EXTRA_MAX_SIZE. Returns NULL if there is 
+// neither of them or no memory.
+//
+PVOID CaptureCreateStrings(
+	IN PPS_CREATE_NOTIFY_INFO CreateInfo
+	)
+{
+	OBSRV_RECORD_WRITER writer;
+	ULONG               cbFields = 0;
+	ULONG               cbExtra;
+	PVOID               pvExtra;
+
+	if (NULL != CreateInfo->ImageFileName)
+		cbFields += ObsrvRecordFieldSize(CreateInfo->ImageFileName->Length);
+	if (NULL != CreateInfo->CommandLine)
+		cbFields += ObsrvRecordFieldSize(CreateInfo->CommandLine->Length);
+	if (0 == cbFields)
+		return NULL;
+	cbExtra = OBSRV_RECORD_ALIGN(sizeof(OBSRV_RECORD_HEADER) + cbFields);
+	if (cbExtra > OBSRV_PROCESS_EXTRA_MAX_SIZE)
+		cbExtra = OBSRV_PROCESS_EXTRA_MAX_SIZE;
+
+	pvExtra = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbExtra, PROCOBSRV_POOL_TAG);
+	if (NULL == pvExtra)
+		return NULL;
 	//
-    // Assign extension variable
+	// The image path goes first, thus it is the command line that gets
+	// truncated
 	//
-	extension = g_pDeviceObject->DeviceExtension;
+	ObsrvRecordBegin(&writer, pvExtra, cbExtra, 0, 0, 0);
+	if (NULL != CreateInfo->ImageFileName)
+		ObsrvRecordPutString(
+			&writer, 
+			OBSRV_TAG_IMAGE_PATH, 
+			(const OBSRV_U16*)CreateInfo->ImageFileName->Buffer, 
+			CreateInfo->ImageFileName->Length / sizeof(WCHAR)
+			);
+	if (NULL != CreateInfo->CommandLine)
+		ObsrvRecordPutString(
+			&writer, 
+			OBSRV_TAG_COMMAND_LINE, 
+			(const OBSRV_U16*)CreateInfo->CommandLine->Buffer, 
+			CreateInfo->CommandLine->Length / sizeof(WCHAR)
+			);
+	ObsrvRecordEnd(&writer);
+
+	return pvExtra;
+}
+
+//
+// Deliver step: complete parked read requests for as long as there are
+// records in the ring, after moving what fits into a mapped section.
+// Called after every append and every parking.
+//
+VOID DeliverPendingReads(
+	IN PDEVICE_EXTENSION extension
+	)
+{
+	LIST_ENTRY completedIrps;
+	PLIST_ENTRY pEntry;
+	PIRP       Irp;
+	PVOID      pvBuffer;
+
+	InitializeListHead(&completedIrps);
+
+	ExAcquireFastMutex(&extension->RingReadLock);
 	//
-    // Assign current values into device extension.  
-	// User-mode apps will pick it up using DeviceIoControl calls.
+	// A mapped section takes everything that fits, the consumer is only 
+	// woken up if it has gone to sleep
 	//
-    extension->hParentId  = hParentId;
-    extension->hProcessId = hProcessId;
-    extension->bCreate    = bCreate;
+	if ((NULL != extension->SectionMemory) &&
+	    ObsrvSectionFillFromRing(&extension->SectionWriter, &extension->Ring, ReleaseRecord))
+		KeSetEvent(extension->SectionEvent, IO_NO_INCREMENT, FALSE);
+	//
+	// A request is taken off the queue only once the oldest record has
+	// been published. A producer that has claimed a cell but not
+	// published it yet runs the deliver step once it is done. Putting a
+	// request back would queue it behind newer ones, and the app waits
+	// for them in the order it issued them.
+	//
+	while (NULL != ObsrvRingPeek(&extension->Ring))
+	{
+		Irp = IoCsqRemoveNextIrp(&extension->PendingReads, NULL);
+		if (NULL == Irp)
+			break;
+		pvBuffer = MmGetSystemAddressForMdlSafe(
+			Irp->MdlAddress, 
+			NormalPagePriority | MdlMappingNoExecute
+			);
+		if (NULL != pvBuffer)
+		{
+			Irp->IoStatus.Information = ObsrvBatchFillFromRing(
+				&extension->Ring, 
+				pvBuffer, 
+				IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.OutputBufferLength,
+				ReleaseRecord
+				);
+			Irp->IoStatus.Status = STATUS_SUCCESS;
+		}
+		else
+		{
+			Irp->IoStatus.Information = 0;
+			Irp->IoStatus.Status      = STATUS_INSUFFICIENT_RESOURCES;
+		}
+		InsertTailList(&completedIrps, &Irp->Tail.Overlay.ListEntry);
+	} // while
+	ExReleaseFastMutex(&extension->RingReadLock);
+	//
+	// Complete outside of the lock
+	//
+	while (!IsListEmpty(&completedIrps))
+	{
+		pEntry = RemoveHeadList(&completedIrps);
+		Irp    = CONTAINING_RECORD(pEntry, IRP, Tail.Overlay.ListEntry);
+		IoCompleteRequest(Irp, IO_NO_INCREMENT);
+	}
+}
+
+//
+// Tell the user-mode apps that records have been appended
+//
+VOID NotifyConsumers(
+	IN PDEVICE_EXTENSION extension
+	)
+{
 	//
     // Signal the event thus the user-mode apps listening will be aware
     // that something interesting has happened.  
 	//
     KeSetEvent(extension->ProcessEvent, 0, FALSE);
     KeClearEvent(extension->ProcessEvent);
+	//
+	// Apps using the pended read model get the record right away
+	//
+	DeliverPendingReads(extension);
+}
+
+//
+// Make sure the flush timer runs. Cheap if it already does.
+//
+VOID ArmFlush(
+	IN PDEVICE_EXTENSION extension
+	)
+{
+	if ((0 == ReadNoFence(&extension->FlushArmed)) &&
+	    (0 == InterlockedExchange(&extension->FlushArmed, 1)))
+		KeSetTimer(&extension->FlushTimer, extension->FlushDelay, &extension->FlushDpc);
+}
+
+//
+// The batch slot of a process. Process IDs are multiples of four.
+//
+PIMAGE_BATCH ImageBatchSlot(
+	IN PDEVICE_EXTENSION extension,
+	IN ULONG             ulProcessId
+	)
+{
+	return &extension->ImageBatches[(ulProcessId >> 2) % IMAGE_BATCH_SLOTS];
+}
+
+//
+// Start a new batch in a free slot. Called with ImageLock held.
+//
+BOOLEAN OpenImageBatch(
+	IN PDEVICE_EXTENSION extension,
+	IN PIMAGE_BATCH      pBatch,
+	IN ULONG             ulProcessId
+	)
+{
+	UNREFERENCED_PARAMETER(extension);
+
+	pBatch->Buffer = ExAllocatePool2(
+		POOL_FLAG_NON_PAGED, 
+		OBSRV_PROCESS_EXTRA_MAX_SIZE, 
+		PROCOBSRV_POOL_TAG
+		);
+	if (NULL == pBatch->Buffer)
+		return FALSE;
+	pBatch->ProcessId = ulProcessId;
+	pBatch->Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+	ObsrvRecordBegin(&pBatch->Writer, pBatch->Buffer, OBSRV_PROCESS_EXTRA_MAX_SIZE, 0, 0, 0);
+
+	return TRUE;
+}
+
+//
+// Close a batch and append it to the ring, which takes over the buffer.
+// Called with ImageLock held. Returns TRUE if there was a batch.
+//
+BOOLEAN FlushImageBatch(
+	IN PDEVICE_EXTENSION extension,
+	IN PIMAGE_BATCH      pBatch
+	)
+{
+	OBSRV_PROCESS_RECORD record;
+
+	if (NULL == pBatch->Buffer)
+		return FALSE;
+	ObsrvRecordEnd(&pBatch->Writer);
+
+	RtlZeroMemory(&record, sizeof(record));
+	record.Kind       = OBSRV_KIND_IMAGE_LOAD;
+	record.Timestamp  = pBatch->Timestamp;
+	record.hProcessId = pBatch->ProcessId;
+	record.Extra      = pBatch->Buffer;
+	pBatch->Buffer    = NULL;
+	if (!ObsrvRingPush(&extension->Ring, &record))
+		ReleaseRecord(&record);
+
+	return TRUE;
+}
+
+//
+// Flush the open batches of all processes (bAll) or of a single one.
+// Returns TRUE if anything has been appended.
+//
+BOOLEAN FlushImageBatches(
+	IN PDEVICE_EXTENSION extension,
+	IN BOOLEAN           bAll,
+	IN ULONG             ulProcessId
+	)
+{
+	PIMAGE_BATCH pBatch;
+	BOOLEAN      bFlushed = FALSE;
+	ULONG        i;
+
+	ExAcquireFastMutex(&extension->ImageLock);
+	if (bAll)
+	{
+		for (i = 0; i < IMAGE_BATCH_SLOTS; i++)
+			bFlushed |= FlushImageBatch(extension, &extension->ImageBatches[i]);
+	}
+	else
+	{
+		pBatch = ImageBatchSlot(extension, ulProcessId);
+		if ((NULL != pBatch->Buffer) && (pBatch->ProcessId == ulProcessId))
+			bFlushed = FlushImageBatch(extension, pBatch);
+	}
+	ExReleaseFastMutex(&extension->ImageLock);
+
+	return bFlushed;
+}
+
+//
+// Evaluate the installed filter against a process record. The image 
+// path is only looked up if the filter has prefix rules.
+//
+BOOLEAN PassesFilter(
+	IN PDEVICE_EXTENSION           extension,
+	IN PEPROCESS                   Process,
+	IN const OBSRV_PROCESS_RECORD* pRecord
+	)
+{
+	OBSRV_FILTER_EVENT event;
+	PUNICODE_STRING    pImageName = NULL;
+	BOOLEAN            bPass      = TRUE;
+
+	if (NULL == extension->Filter)
+		return TRUE;
+
+	event.ProcessId       = pRecord->hProcessId;
+	event.ParentId        = pRecord->hParentId;
+	event.SessionId       = pRecord->SessionId;
+	event.ImagePath       = NULL;
+	event.ImagePathLength = 0;
+	//
+	// The same NT path for create and exit, thus both are treated alike
+	//
+	if (extension->FilterNeedsImagePath &&
+	    NT_SUCCESS(SeLocateProcessImageName(Process, &pImageName)))
+	{
+		event.ImagePath       = (const OBSRV_U16*)pImageName->Buffer;
+		event.ImagePathLength = pImageName->Length / sizeof(WCHAR);
+	}
+
+	KeEnterCriticalRegion();
+	ExAcquirePushLockShared(&extension->FilterLock);
+	if (NULL != extension->Filter)
+		bPass = (BOOLEAN)ObsrvFilterMatch(extension->Filter, &event);
+	ExReleasePushLockShared(&extension->FilterLock);
+	KeLeaveCriticalRegion();
+
+	if (NULL != pImageName)
+		ExFreePool(pImageName);
+
+	return bPass;
+}
+
+//
+// Process function callback
+//
+VOID ProcessCallback(
+	IN OUT PEPROCESS              Process,
+	IN HANDLE                     hProcessId,
+	IN OPTIONAL PPS_CREATE_NOTIFY_INFO CreateInfo
+	)
+{
+	PDEVICE_EXTENSION    extension;
+	OBSRV_PROCESS_RECORD record;
+	BOOLEAN              bFlushed = FALSE;
+	//
+    // Assign extension variable
+	//
+	extension = g_pDeviceObject->DeviceExtension;
+	//
+    // Append current values to the ring. User-mode apps will pick 
+	// them up using DeviceIoControl calls. If the ring is full the
+	// record is counted as overflow and dropped.
+	//
+	RtlZeroMemory(&record, sizeof(record));
+	record.Timestamp  = KeQueryPerformanceCounter(NULL).QuadPart;
+	record.hProcessId = (DWORD32)(HandleToHandle32(hProcessId));
+	record.SessionId  = PsGetProcessSessionId(Process);
+	if (NULL != CreateInfo)
+	{
+		record.bCreate           = TRUE;
+		record.Kind              = OBSRV_KIND_PROCESS_CREATE;
+		record.hParentId         = (DWORD32)(HandleToHandle32(CreateInfo->ParentProcessId));
+		record.CreatingProcessId = (DWORD32)(HandleToHandle32(CreateInfo->CreatingThreadId.UniqueProcess));
+		record.CreatingThreadId  = (DWORD32)(HandleToHandle32(CreateInfo->CreatingThreadId.UniqueThread));
+	}
+	else
+	{
+		record.bCreate    = FALSE;
+		record.Kind       = OBSRV_KIND_PROCESS_EXIT;
+		record.hParentId  = (DWORD32)(HandleToHandle32(PsGetProcessInheritedFromUniqueProcessId(Process)));
+		record.ExitStatus = (ULONG)PsGetProcessExitStatus(Process);
+		//
+		// The images the process has loaded and the exits of its threads
+		// go ahead of its exit
+		//
+		bFlushed = FlushImageBatches(extension, FALSE, record.hProcessId) |
+		           FlushThreadBuffers(extension);
+	}
+	//
+	// Events the app isn't interested in never leave the kernel. What
+	// has been flushed ahead of them still has to be delivered.
+	//
+	if (!PassesFilter(extension, Process, &record))
+	{
+		if (bFlushed)
+			NotifyConsumers(extension);
+		return;
+	}
+	//
+	// Whatever is known about the new process is captured now, instead
+	// of being looked up later when it may be gone
+	//
+	if (NULL != CreateInfo)
+		record.Extra = CaptureCreateStrings(CreateInfo);
+	if (!ObsrvRingPush(&extension->Ring, &record))
+		ReleaseRecord(&record);
+
+	NotifyConsumers(extension);
+}
+
+//
+// Image load callback. Runs at PASSIVE_LEVEL in the context of the
+// process the image is mapped into.
+//
+VOID LoadImageCallback(
+	IN OPTIONAL PUNICODE_STRING FullImageName,
+	IN HANDLE                   hProcessId,
+	IN PIMAGE_INFO              ImageInfo
+	)
+{
+	PDEVICE_EXTENSION extension   = g_pDeviceObject->DeviceExtension;
+	ULONG             ulProcessId = (DWORD32)(HandleToHandle32(hProcessId));
+	PIMAGE_BATCH      pBatch      = ImageBatchSlot(extension, ulProcessId);
+	const OBSRV_U16*  pszPath     = NULL;
+	ULONG             cchPath     = 0;
+	ULONG             ulFlags     = 0;
+	BOOLEAN           bStored     = FALSE;
+	BOOLEAN           bFlushed    = FALSE;
+	BOOLEAN           bOpened     = FALSE;
+
+	if (NULL != FullImageName)
+	{
+		pszPath = (const OBSRV_U16*)FullImageName->Buffer;
+		cchPath = FullImageName->Length / sizeof(WCHAR);
+	}
+	if (ImageInfo->SystemModeImage)
+		ulFlags |= OBSRV_IMAGE_FLAG_SYSTEM;
+
+	ExAcquireFastMutex(&extension->ImageLock);
+	if (NULL != pBatch->Buffer)
+	{
+		if (pBatch->ProcessId == ulProcessId)
+			bStored = (BOOLEAN)ObsrvRecordPutImage(
+				&pBatch->Writer,
+				(ULONG_PTR)ImageInfo->ImageBase,
+				ImageInfo->ImageSize,
+				ulFlags,
+				pszPath,
+				cchPath,
+				FALSE
+				);
+		//
+		// Either another process needs the slot or the batch is full
+		//
+		if (!bStored)
+			bFlushed = FlushImageBatch(extension, pBatch);
+	}
+	if (!bStored)
+	{
+		bOpened = OpenImageBatch(extension, pBatch, ulProcessId);
+		if (bOpened)
+			ObsrvRecordPutImage(
+				&pBatch->Writer,
+				(ULONG_PTR)ImageInfo->ImageBase,
+				ImageInfo->ImageSize,
+				ulFlags,
+				pszPath,
+				cchPath,
+				TRUE
+				);
+		else
+			ObsrvRingDrop(&extension->Ring);
+	}
+	ExReleaseFastMutex(&extension->ImageLock);
+	//
+	// A new batch waits at most FlushDelay for more images
+	//
+	if (bOpened)
+		ArmFlush(extension);
+	if (bFlushed)
+		NotifyConsumers(extension);
+}
+
+//
+// Allocate a buffer for every CPU that may ever be present
+//
+BOOLEAN AllocateThreadBuffers(
+	IN PDEVICE_EXTENSION extension
+	)
+{
+	ULONG nCount    = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	ULONG nCapacity = extension->ThreadBufferCapacity;
+	ULONG i;
+
+	extension->ThreadBuffers = ExAllocatePool2(
+		POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED,
+		nCount * sizeof(OBSRV_CPU_BUFFER),
+		PROCOBSRV_POOL_TAG
+		);
+	extension->ThreadEntries = ExAllocatePool2(
+		POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED,
+		nCount * ObsrvCpuBufferStorageSize(nCapacity),
+		PROCOBSRV_POOL_TAG
+		);
+	extension->ThreadMergeScratch = ExAllocatePool2(
+		POOL_FLAG_NON_PAGED,
+		ObsrvCpuMergeScratchSize(nCount),
+		PROCOBSRV_POOL_TAG
+		);
+	if ((NULL == extension->ThreadBuffers) || 
+	    (NULL == extension->ThreadEntries) ||
+	    (NULL == extension->ThreadMergeScratch))
+	{
+		FreeThreadBuffers(extension);
+		return FALSE;
+	}
+	for (i = 0; i < nCount; i++)
+		ObsrvCpuBufferInit(
+			&extension->ThreadBuffers[i],
+			(POBSRV_THREAD_ENTRY)extension->ThreadEntries + (SIZE_T)i * nCapacity,
+			nCapacity
+			);
+	extension->ThreadBufferCount = nCount;
+	extension->ThreadDropped     = 0;
+
+	return TRUE;
+}
+
+//
+// Free the thread event buffers. The thread callback must have been 
+// removed and the buffers flushed.
+//
+VOID FreeThreadBuffers(
+	IN PDEVICE_EXTENSION extension
+	)
+{
+	if (NULL != extension->ThreadBuffers)
+		ExFreePoolWithTag(extension->ThreadBuffers, PROCOBSRV_POOL_TAG);
+	if (NULL != extension->ThreadEntries)
+		ExFreePoolWithTag(extension->ThreadEntries, PROCOBSRV_POOL_TAG);
+	if (NULL != extension->ThreadMergeScratch)
+		ExFreePoolWithTag(extension->ThreadMergeScratch, PROCOBSRV_POOL_TAG);
+	extension->ThreadBuffers      = NULL;
+	extension->ThreadEntries      = NULL;
+	extension->ThreadMergeScratch = NULL;
+	extension->ThreadBufferCount  = 0;
+}
+
+//
+// Merge the per-CPU buffers into thread records, oldest event first, and
+// append them to the ring. Returns TRUE if anything has been appended.
+//
+BOOLEAN FlushThreadBuffers(
+	IN PDEVICE_EXTENSION extension
+	)
+{
+	OBSRV_CPU_MERGE           merge;
+	OBSRV_RECORD_WRITER       writer;
+	OBSRV_PROCESS_RECORD      record;
+	const OBSRV_THREAD_ENTRY* pEntry;
+	PVOID                     pvBuffer;
+	BOOLEAN                   bFlushed = FALSE;
+	ULONG                     i;
+
+	if (NULL == extension->ThreadBuffers)
+		return FALSE;
+
+	ExAcquireFastMutex(&extension->ThreadLock);
+	for (i = 0; i < extension->ThreadBufferCount; i++)
+		extension->ThreadDropped += ObsrvCpuBufferTakeDropped(&extension->ThreadBuffers[i]);
+	ObsrvCpuMergeBegin(
+		&merge, 
+		extension->ThreadBuffers, 
+		extension->ThreadBufferCount, 
+		extension->ThreadMergeScratch
+		);
+	pEntry = ObsrvCpuMergePeek(&merge);
+	while (NULL != pEntry)
+	{
+		//
+		// What is left stays buffered until the next flush
+		//
+		pvBuffer = ExAllocatePool2(
+			POOL_FLAG_NON_PAGED, 
+			OBSRV_PROCESS_EXTRA_MAX_SIZE, 
+			PROCOBSRV_POOL_TAG
+			);
+		if (NULL == pvBuffer)
+			break;
+		RtlZeroMemory(&record, sizeof(record));
+		record.Kind      = OBSRV_KIND_THREAD;
+		record.Timestamp = pEntry->Timestamp;
+		ObsrvRecordBegin(&writer, pvBuffer, OBSRV_PROCESS_EXTRA_MAX_SIZE, 0, 0, 0);
+		//
+		// The losses go with the next record, thus every thread record
+		// carries at least one event
+		//
+		if (0 != extension->ThreadDropped)
+		{
+			ObsrvRecordPutU32(
+				&writer, 
+				OBSRV_TAG_DROPPED, 
+				(extension->ThreadDropped > MAXULONG) ? MAXULONG : (ULONG)extension->ThreadDropped
+				);
+			extension->ThreadDropped = 0;
+		}
+		while ((NULL != pEntry) && ObsrvRecordPut(&writer, OBSRV_TAG_THREAD, pEntry, sizeof(*pEntry)))
+		{
+			ObsrvCpuMergePop(&merge);
+			pEntry = ObsrvCpuMergePeek(&merge);
+		} // while
+		ObsrvRecordEnd(&writer);
+		record.Extra = pvBuffer;
+		if (!ObsrvRingPush(&extension->Ring, &record))
+			ReleaseRecord(&record);
+		bFlushed = TRUE;
+	} // while
+	ExReleaseFastMutex(&extension->ThreadLock);
+
+	return bFlushed;
+}
+
+//
+// Thread create/exit callback. Runs at PASSIVE_LEVEL or APC_LEVEL in 
+// the context of the creating or exiting thread, thus at a very high 
+// rate on a busy host. It doesn't take any lock: the event goes into 
+// the buffer of the current CPU, which stays ours as long as we run at
+// DISPATCH_LEVEL.
+//
+VOID ThreadCallback(
+	IN HANDLE  hProcessId,
+	IN HANDLE  hThreadId,
+	IN BOOLEAN bCreate
+	)
+{
+	PDEVICE_EXTENSION  extension = g_pDeviceObject->DeviceExtension;
+	POBSRV_CPU_BUFFER  pBuffer;
+	OBSRV_THREAD_ENTRY entry;
+	ULONG64            ullCount;
+	LARGE_INTEGER      liDueTime;
+	KIRQL              oldIrql;
+
+	entry.ProcessId = (DWORD32)(HandleToHandle32(hProcessId));
+	entry.ThreadId  = (DWORD32)(HandleToHandle32(hThreadId));
+	entry.Flags     = bCreate ? OBSRV_THREAD_FLAG_CREATE : 0;
+	entry.Reserved  = 0;
+
+	KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+	pBuffer = &extension->ThreadBuffers[KeGetCurrentProcessorIndex()];
+	//
+	// Stamped on the CPU that publishes it, thus every buffer is in 
+	// timestamp order
+	//
+	entry.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+	ObsrvCpuBufferPush(pBuffer, &entry);
+	ullCount = ObsrvCpuBufferCount(pBuffer);
+	KeLowerIrql(oldIrql);
+
+	ArmFlush(extension);
+	//
+	// A buffer getting half full doesn't wait for the timer. If it has
+	// already expired the flush is on its way anyway.
+	//
+	if ((ullCount == pBuffer->Capacity / 2) && KeCancelTimer(&extension->FlushTimer))
+	{
+		liDueTime.QuadPart = -1LL;
+		KeSetTimer(&extension->FlushTimer, liDueTime, &extension->FlushDpc);
+	}
+}
+
+//
+// The flush timer has expired. Flushing pushes to the ring and runs the
+// deliver step, which must not happen at DISPATCH_LEVEL, thus a work 
+// item does it.
+//
+VOID FlushDpcRoutine(
+	IN PKDPC Dpc,
+	IN PVOID DeferredContext,
+	IN PVOID SystemArgument1,
+	IN PVOID SystemArgument2
+	)
+{
+	PDEVICE_EXTENSION extension = DeferredContext;
+
+	UNREFERENCED_PARAMETER(Dpc);
+	UNREFERENCED_PARAMETER(SystemArgument1);
+	UNREFERENCED_PARAMETER(SystemArgument2);
+
+	InterlockedIncrement(&extension->FlushQueued);
+	IoQueueWorkItem(extension->FlushWorkItem, FlushWorker, DelayedWorkQueue, extension);
+}
+
+//
+// Flush all open image batches and the thread event buffers
+//
+VOID FlushWorker(
+	IN PDEVICE_OBJECT DeviceObject,
+	IN PVOID          Context
+	)
+{
+	PDEVICE_EXTENSION extension = Context;
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+	//
+	// Events arriving from now on arm the timer again
+	//
+	InterlockedExchange(&extension->FlushArmed, 0);
+	if (FlushImageBatches(extension, TRUE, 0) | FlushThreadBuffers(extension))
+		NotifyConsumers(extension);
+	InterlockedDecrement(&extension->FlushQueued);
+}
+
+//
+// Called once the image load and thread callbacks have been removed: 
+// stop the flush timer, wait for a flush in progress and flush what is 
+// left
+//
+VOID StopFlush(
+	IN PDEVICE_EXTENSION extension
+	)
+{
+	LARGE_INTEGER liDelay;
+
+	KeCancelTimer(&extension->FlushTimer);
+	KeFlushQueuedDpcs();
+	liDelay.QuadPart = -10000LL; // 1 ms
+	while (0 != InterlockedCompareExchange(&extension->FlushQueued, 0, 0))
+		KeDelayExecutionThread(KernelMode, FALSE, &liDelay);
+	InterlockedExchange(&extension->FlushArmed, 0);
+	if (FlushImageBatches(extension, TRUE, 0) | FlushThreadBuffers(extension))
+		NotifyConsumers(extension);
 }
 
 //
@@ -247,11 +1282,17 @@ NTSTATUS ActivateMonitoringHanlder(
 	NTSTATUS               ntStatus = STATUS_UNSUCCESSFUL;
 	PIO_STACK_LOCATION     irpStack  = IoGetCurrentIrpStackLocation(Irp);
 	PACTIVATE_INFO         pActivateInfo;
+	OBSRV_U8               Subscriptions = 0;
 	
 	if (irpStack->Parameters.DeviceIoControl.InputBufferLength >= 
-	   sizeof(ACTIVATE_INFO))		
+	   RTL_SIZEOF_THROUGH_FIELD(ACTIVATE_INFO, bActivated))		
 	{
 		pActivateInfo = Irp->AssociatedIrp.SystemBuffer;
+		//
+		// Older apps send bActivated only
+		//
+		if (irpStack->Parameters.DeviceIoControl.InputBufferLength >= sizeof(ACTIVATE_INFO))
+			Subscriptions = pActivateInfo->Subscriptions;
 		if (g_ActivateInfo.bActivated != pActivateInfo->bActivated)
 		{
 			if (pActivateInfo->bActivated) 
@@ -259,11 +1300,25 @@ NTSTATUS ActivateMonitoringHanlder(
 				//
 				// Set up callback routines
 				//
-				ntStatus = PsSetCreateProcessNotifyRoutine(ProcessCallback, FALSE);
+				ntStatus = PsSetCreateProcessNotifyRoutineEx(ProcessCallback, FALSE);
 				if (ntStatus != STATUS_SUCCESS)
 				{
 					return ntStatus;
 				}
+				if ((0 != (Subscriptions & OBSRV_SUBSCRIBE_IMAGE_LOAD)) &&
+				    NT_SUCCESS(PsSetLoadImageNotifyRoutine(LoadImageCallback)))
+					g_ActivateInfo.Subscriptions |= OBSRV_SUBSCRIBE_IMAGE_LOAD;
+				//
+				// Thread events cost nothing unless asked for
+				//
+				if ((0 != (Subscriptions & OBSRV_SUBSCRIBE_THREAD)) &&
+				    AllocateThreadBuffers(g_pDeviceObject->DeviceExtension))
+				{
+					if (NT_SUCCESS(PsSetCreateThreadNotifyRoutine(ThreadCallback)))
+						g_ActivateInfo.Subscriptions |= OBSRV_SUBSCRIBE_THREAD;
+					else
+						FreeThreadBuffers(g_pDeviceObject->DeviceExtension);
+				}
 				//
 				// Setup the global data structure
 				//
@@ -275,11 +1330,21 @@ NTSTATUS ActivateMonitoringHanlder(
 				// restore the call back routine, thus givinig chance to the 
 				// user mode application to unload dynamically the driver
 				//
-				ntStatus = PsSetCreateProcessNotifyRoutine(ProcessCallback, TRUE);
+				ntStatus = PsSetCreateProcessNotifyRoutineEx(ProcessCallback, TRUE);
 				if (ntStatus != STATUS_SUCCESS)
 					return ntStatus;
 				else
 					g_ActivateInfo.bActivated = FALSE;
+				if (0 != (g_ActivateInfo.Subscriptions & OBSRV_SUBSCRIBE_IMAGE_LOAD))
+					PsRemoveLoadImageNotifyRoutine(LoadImageCallback);
+				if (0 != (g_ActivateInfo.Subscriptions & OBSRV_SUBSCRIBE_THREAD))
+					PsRemoveCreateThreadNotifyRoutine(ThreadCallback);
+				if (0 != g_ActivateInfo.Subscriptions)
+				{
+					StopFlush(g_pDeviceObject->DeviceExtension);
+					FreeThreadBuffers(g_pDeviceObject->DeviceExtension);
+				}
+				g_ActivateInfo.Subscriptions = 0;
 			}
 			ntStatus = STATUS_SUCCESS;
 		} // if
@@ -288,6 +1353,250 @@ NTSTATUS ActivateMonitoringHanlder(
 	return ntStatus;
 }
 
+//
+// IOCTL handler for draining the ring into the caller's buffer
+//
+NTSTATUS GetProcInfoBatchHandler(
+	IN PDEVICE_EXTENSION extension,
+	IN PIRP              Irp,
+	OUT PULONG_PTR       pulInformation
+	)
+{
+	PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
+	ULONG              cbBuffer = irpStack->Parameters.DeviceIoControl.OutputBufferLength;
+	PVOID              pvBuffer;
+
+	if ((NULL == Irp->MdlAddress) || (cbBuffer < OBSRV_BATCH_MIN_SIZE))
+		return STATUS_BUFFER_TOO_SMALL;
+	//
+	// METHOD_OUT_DIRECT - the records are written straight into the 
+	// locked user pages
+	//
+	pvBuffer = MmGetSystemAddressForMdlSafe(
+		Irp->MdlAddress, 
+		NormalPagePriority | MdlMappingNoExecute
+		);
+	if (NULL == pvBuffer)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	ExAcquireFastMutex(&extension->RingReadLock);
+	*pulInformation = ObsrvBatchFillFromRing(&extension->Ring, pvBuffer, cbBuffer, ReleaseRecord);
+	ExReleaseFastMutex(&extension->RingReadLock);
+
+	return STATUS_SUCCESS;
+}
+
+//
+// IOCTL handler for parking a read request until records are available
+//
+NTSTATUS WaitProcInfoHandler(
+	IN PDEVICE_EXTENSION extension,
+	IN PIRP              Irp
+	)
+{
+	PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
+
+	if ((NULL == Irp->MdlAddress) || 
+	    (irpStack->Parameters.DeviceIoControl.OutputBufferLength < OBSRV_BATCH_MIN_SIZE))
+		return STATUS_BUFFER_TOO_SMALL;
+	//
+	// Park first, then run the deliver step - that way a record 
+	// appended in between cannot be missed
+	//
+	IoCsqInsertIrp(&extension->PendingReads, Irp, NULL);
+	DeliverPendingReads(extension);
+
+	return STATUS_PENDING;
+}
+
+//
+// IOCTL handler for replacing the filter
+//
+NTSTATUS SetFilterHandler(
+	IN PDEVICE_EXTENSION extension,
+	IN PIRP              Irp
+	)
+{
+	PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
+	ULONG              cbFilter = irpStack->Parameters.DeviceIoControl.InputBufferLength;
+	PVOID              pvFilter = NULL;
+	PVOID              pvOld;
+
+	if (0 != cbFilter)
+	{
+		if (cbFilter > OBSRV_FILTER_MAX_SIZE)
+			return STATUS_INVALID_PARAMETER;
+		//
+		// Evaluated at PASSIVE_LEVEL only
+		//
+		pvFilter = ExAllocatePool2(POOL_FLAG_PAGED, cbFilter, PROCOBSRV_POOL_TAG);
+		if (NULL == pvFilter)
+			return STATUS_INSUFFICIENT_RESOURCES;
+		RtlCopyMemory(pvFilter, Irp->AssociatedIrp.SystemBuffer, cbFilter);
+		if (!ObsrvFilterValidate(pvFilter, cbFilter))
+		{
+			ExFreePoolWithTag(pvFilter, PROCOBSRV_POOL_TAG);
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	KeEnterCriticalRegion();
+	ExAcquirePushLockExclusive(&extension->FilterLock);
+	pvOld = extension->Filter;
+	extension->Filter = pvFilter;
+	extension->FilterNeedsImagePath = (NULL != pvFilter) && ObsrvFilterNeedsImagePath(pvFilter);
+	ExReleasePushLockExclusive(&extension->FilterLock);
+	KeLeaveCriticalRegion();
+
+	if (NULL != pvOld)
+		ExFreePoolWithTag(pvOld, PROCOBSRV_POOL_TAG);
+
+	return STATUS_SUCCESS;
+}
+
+//
+// IOCTL handler for mapping the shared section into the caller
+//
+NTSTATUS MapSectionHandler(
+	IN PDEVICE_EXTENSION extension,
+	IN PIRP              Irp,
+	OUT PULONG_PTR       pulInformation
+	)
+{
+	PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(Irp);
+	PSECTION_MAP_INFO  pMapInfo = Irp->AssociatedIrp.SystemBuffer;
+	NTSTATUS           ntStatus;
+	PKEVENT            pEvent   = NULL;
+	PVOID              pvMemory = NULL;
+	PMDL               pMdl     = NULL;
+	PVOID              pvUser   = NULL;
+	SIZE_T             cbSection;
+
+	if ((irpStack->Parameters.DeviceIoControl.InputBufferLength < sizeof(SECTION_MAP_INFO)) ||
+	    (irpStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(SECTION_MAP_INFO)))
+		return STATUS_BUFFER_TOO_SMALL;
+	if (NULL != extension->SectionMemory)
+		return STATUS_DEVICE_BUSY;
+	//
+	// The event the consumer sleeps on
+	//
+	ntStatus = ObReferenceObjectByHandle(
+		(HANDLE)(ULONG_PTR)pMapInfo->hEvent,
+		EVENT_MODIFY_STATE,
+		*ExEventObjectType,
+		Irp->RequestorMode,
+		(PVOID*)&pEvent,
+		NULL
+		);
+	if (!NT_SUCCESS(ntStatus))
+		return ntStatus;
+	//
+	// Whole pages, zeroed, thus nothing but the section becomes visible
+	//
+	cbSection = ROUND_TO_PAGES(ObsrvSectionTotalSize(extension->SectionDataSize));
+	pvMemory  = ExAllocatePool2(POOL_FLAG_NON_PAGED, cbSection, PROCOBSRV_POOL_TAG);
+	if (NULL != pvMemory)
+		pMdl = IoAllocateMdl(pvMemory, (ULONG)cbSection, FALSE, FALSE, NULL);
+	if (NULL != pMdl)
+	{
+		MmBuildMdlForNonPagedPool(pMdl);
+		__try
+		{
+			pvUser = MmMapLockedPagesSpecifyCache(
+				pMdl, 
+				UserMode, 
+				MmCached, 
+				NULL, 
+				FALSE, 
+				NormalPagePriority
+				);
+		}
+		__except(EXCEPTION_EXECUTE_HANDLER)
+		{
+			pvUser = NULL;
+		}
+	}
+	if (NULL == pvUser)
+	{
+		if (NULL != pMdl)
+			IoFreeMdl(pMdl);
+		if (NULL != pvMemory)
+			ExFreePoolWithTag(pvMemory, PROCOBSRV_POOL_TAG);
+		ObDereferenceObject(pEvent);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	//
+	// Hand the section over to the deliver step
+	//
+	ExAcquireFastMutex(&extension->RingReadLock);
+	if (NULL == extension->SectionMemory)
+	{
+		ObsrvSectionCreate(&extension->SectionWriter, pvMemory, extension->SectionDataSize);
+		extension->SectionMdl         = pMdl;
+		extension->SectionUserAddress = pvUser;
+		extension->SectionOwner       = irpStack->FileObject;
+		extension->SectionEvent       = pEvent;
+		extension->SectionMemory      = pvMemory;
+		pvMemory = NULL;
+	}
+	ExReleaseFastMutex(&extension->RingReadLock);
+	//
+	// Somebody else has been faster
+	//
+	if (NULL != pvMemory)
+	{
+		MmUnmapLockedPages(pvUser, pMdl);
+		IoFreeMdl(pMdl);
+		ExFreePoolWithTag(pvMemory, PROCOBSRV_POOL_TAG);
+		ObDereferenceObject(pEvent);
+		return STATUS_DEVICE_BUSY;
+	}
+
+	pMapInfo->pvSection = (ULONG_PTR)pvUser;
+	pMapInfo->cbSection = cbSection;
+	*pulInformation     = sizeof(SECTION_MAP_INFO);
+	//
+	// Move whatever has been buffered so far
+	//
+	DeliverPendingReads(extension);
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Unmap and free the shared section if fileObject has mapped it
+//
+VOID UnmapSection(
+	IN PDEVICE_EXTENSION extension,
+	IN PFILE_OBJECT      fileObject
+	)
+{
+	PVOID   pvMemory = NULL;
+	PMDL    pMdl;
+	PVOID   pvUser;
+	PKEVENT pEvent;
+
+	ExAcquireFastMutex(&extension->RingReadLock);
+	if ((NULL != extension->SectionMemory) && (fileObject == extension->SectionOwner))
+	{
+		pvMemory = extension->SectionMemory;
+		pMdl     = extension->SectionMdl;
+		pvUser   = extension->SectionUserAddress;
+		pEvent   = extension->SectionEvent;
+		extension->SectionMemory = NULL;
+		extension->SectionOwner  = NULL;
+	}
+	ExReleaseFastMutex(&extension->RingReadLock);
+
+	if (NULL != pvMemory)
+	{
+		MmUnmapLockedPages(pvUser, pMdl);
+		IoFreeMdl(pMdl);
+		ExFreePoolWithTag(pvMemory, PROCOBSRV_POOL_TAG);
+		ObDereferenceObject(pEvent);
+	}
+}
+
 //
 // The dispatch routine
 //
@@ -300,6 +1609,9 @@ NTSTATUS DispatchIoctl(
     PIO_STACK_LOCATION     irpStack  = IoGetCurrentIrpStackLocation(Irp);
     PDEVICE_EXTENSION      extension = DeviceObject->DeviceExtension;
     PPROCESS_CALLBACK_INFO pProcCallbackInfo;
+	OBSRV_PROCESS_RECORD   record;
+	BOOLEAN                bFound;
+	ULONG_PTR              ulInformation = 0;
 	//
     // These IOCTL handlers are the set and get interfaces between
     // the driver and the user mode app
@@ -316,15 +1628,66 @@ NTSTATUS DispatchIoctl(
 				if (irpStack->Parameters.DeviceIoControl.OutputBufferLength >= 
 				   sizeof(PROCESS_CALLBACK_INFO))
 				{
-					pProcCallbackInfo = Irp->AssociatedIrp.SystemBuffer;
-					pProcCallbackInfo->hParentId  = (DWORD32)(HandleToHandle32(extension->hParentId));
-					pProcCallbackInfo->hProcessId = (DWORD32)(HandleToHandle32(extension->hProcessId));
-					pProcCallbackInfo->bCreate    = extension->bCreate;
-    
-					ntStatus = STATUS_SUCCESS;
+					//
+					// Hand out the oldest pending process record, there is
+					// no room for anything else
+					//
+					ExAcquireFastMutex(&extension->RingReadLock);
+					bFound = FALSE;
+					while (!bFound && ObsrvRingPop(&extension->Ring, &record))
+					{
+						bFound = (BOOLEAN)ObsrvIsProcessKind(record.Kind);
+						if (!bFound)
+							ReleaseRecord(&record);
+					}
+					if (bFound)
+					{
+						pProcCallbackInfo = Irp->AssociatedIrp.SystemBuffer;
+						pProcCallbackInfo->hParentId  = record.hParentId;
+						pProcCallbackInfo->hProcessId = record.hProcessId;
+						pProcCallbackInfo->bCreate    = record.bCreate;
+						ReleaseRecord(&record);
+
+						ulInformation = sizeof(PROCESS_CALLBACK_INFO);
+						ntStatus = STATUS_SUCCESS;
+					}
+					else
+						ntStatus = STATUS_NO_MORE_ENTRIES;
+					ExReleaseFastMutex(&extension->RingReadLock);
 				}
 				break;
 			}
+        case IOCTL_PROCOBSRV_GET_PROCINFO_BATCH:
+			{
+				ntStatus = GetProcInfoBatchHandler(extension, Irp, &ulInformation);
+				break;
+			}
+        case IOCTL_PROCOBSRV_WAIT_PROCINFO:
+			{
+				ntStatus = WaitProcInfoHandler(extension, Irp);
+				//
+				// The IRP belongs to the queue now
+				//
+				if (STATUS_PENDING == ntStatus)
+					return ntStatus;
+				break;
+			}
+        case IOCTL_PROCOBSRV_MAP_SECTION:
+			{
+				ntStatus = MapSectionHandler(extension, Irp, &ulInformation);
+				break;
+			}
+        case IOCTL_PROCOBSRV_REFILL_SECTION:
+			{
+				DeliverPendingReads(extension);
+				ntStatus = STATUS_SUCCESS;
+				break;
+			}
+        case IOCTL_PROCOBSRV_SET_FILTER:
+			{
+				ntStatus = SetFilterHandler(extension, Irp);
+				break;
+			}
 
         default:
             break;
@@ -335,8 +1698,7 @@ NTSTATUS DispatchIoctl(
     // Set number of bytes to copy back to user-mode
 	//
     if(ntStatus == STATUS_SUCCESS)
-        Irp->IoStatus.Information = 
-			irpStack->Parameters.DeviceIoControl.OutputBufferLength;
+        Irp->IoStatus.Information = ulInformation;
     else
         Irp->IoStatus.Information = 0;
 
@@ -352,6 +1714,8 @@ void UnloadDriver(
 	)
 {
     UNICODE_STRING  uszDeviceString;
+	PDEVICE_EXTENSION extension = DriverObject->DeviceObject->DeviceExtension;
+	OBSRV_PROCESS_RECORD record;
 	//
 	//  By default the I/O device is configured incorrectly or the 
 	// configuration parameters to the driver are incorrect.
@@ -363,8 +1727,27 @@ void UnloadDriver(
 		// restore the call back routine, thus givinig chance to the 
 		// user mode application to unload dynamically the driver
 		//
-		ntStatus = PsSetCreateProcessNotifyRoutine(ProcessCallback, TRUE);
+		ntStatus = PsSetCreateProcessNotifyRoutineEx(ProcessCallback, TRUE);
+	if (0 != (g_ActivateInfo.Subscriptions & OBSRV_SUBSCRIBE_IMAGE_LOAD))
+		PsRemoveLoadImageNotifyRoutine(LoadImageCallback);
+	if (0 != (g_ActivateInfo.Subscriptions & OBSRV_SUBSCRIBE_THREAD))
+		PsRemoveCreateThreadNotifyRoutine(ThreadCallback);
+	if (0 != g_ActivateInfo.Subscriptions)
+		StopFlush(extension);
+	FreeThreadBuffers(extension);
+	IoFreeWorkItem(extension->FlushWorkItem);
+	if (NULL != extension->Filter)
+		ExFreePoolWithTag(extension->Filter, PROCOBSRV_POOL_TAG);
 
+	if (NULL != extension->RingCells)
+	{
+		//
+		// Free what nobody has picked up
+		//
+		while (ObsrvRingPop(&extension->Ring, &record))
+			ReleaseRecord(&record);
+		ExFreePoolWithTag(extension->RingCells, PROCOBSRV_POOL_TAG);
+	}
 	IoDeleteDevice(DriverObject->DeviceObject);
 
 	RtlInitUnicodeString(&uszDeviceString, L"\\DosDevices\\ProcObsrv");
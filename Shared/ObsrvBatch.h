@@ -0,0 +1,228 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvBatch.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Layout of the buffer returned by the batch retrieval IOCTL
+//
+// DESCRIPTION:
+//              A batch is a fixed header followed by Count records in the
+//              format of ObsrvRecord.h, laid out back to back. The driver
+//              encodes it straight into the caller's output buffer, the
+//              user-mode app decodes it in place. Decoding validates every
+//              field against the number of bytes actually returned, thus a
+//              short or corrupt buffer is rejected rather than read past
+//              its end.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVBATCH_H_)
+#define _OBSRVBATCH_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvRing.h"
+#include "ObsrvRecord.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+#define OBSRV_BATCH_VERSION            2
+//
+// Set when records were still pending in the driver after the batch
+// had been filled up
+//
+#define OBSRV_BATCH_FLAG_MORE_PENDING  0x00000001
+//
+// The smallest buffer the driver accepts - it holds a record of any size
+//
+#define OBSRV_BATCH_MIN_SIZE           \
+	(sizeof(OBSRV_BATCH_HEADER) + OBSRV_RECORD_MAX_SIZE)
+//
+// Upper bound of OBSRV_PROCESS_RECORD::Extra, leaving room for the fixed
+// fields ObsrvBatchEncodeProcess() adds
+//
+#define OBSRV_PROCESS_EXTRA_MAX_SIZE   (OBSRV_RECORD_MAX_SIZE - 128)
+//
+// Buffer size the user-mode app uses per round trip
+//
+#define OBSRV_BATCH_DEFAULT_SIZE       (64 * 1024)
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+typedef struct _ObsrvBatchHeader
+{
+	OBSRV_U32  Version;
+	OBSRV_U32  Count;         // Number of records following the header
+	OBSRV_U32  Flags;         // OBSRV_BATCH_FLAG_xxx
+	OBSRV_U32  Bytes;         // Size of the records following the header
+	OBSRV_U64  Overflow;      // Records dropped by the driver so far
+} OBSRV_BATCH_HEADER, *POBSRV_BATCH_HEADER;
+
+//
+// Called for every record taken off the ring, e.g. to free its Extra
+//
+typedef void (*OBSRV_RECORD_RELEASE)(POBSRV_PROCESS_RECORD pRecord);
+
+//---------------------------------------------------------------------------
+//
+// Functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Prepare an empty batch. Returns 0 if the buffer cannot even hold the
+// header.
+//
+OBSRV_INLINE int ObsrvBatchInit(
+	void*  pvBuffer,
+	size_t cbBuffer
+	)
+{
+	POBSRV_BATCH_HEADER pHeader = (POBSRV_BATCH_HEADER)pvBuffer;
+
+	if (cbBuffer < sizeof(OBSRV_BATCH_HEADER))
+		return 0;
+	pHeader->Version  = OBSRV_BATCH_VERSION;
+	pHeader->Count    = 0;
+	pHeader->Flags    = 0;
+	pHeader->Bytes    = 0;
+	pHeader->Overflow = 0;
+
+	return 1;
+}
+
+//
+// Encode a record taken from the ring into the wire format. Process 
+// events get their fixed fields, any other kind carries everything but
+// the process ID in Extra. Returns the record's size, 0 if it doesn't 
+// fit into cbBuffer bytes.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvBatchEncodeProcess(
+	const OBSRV_PROCESS_RECORD* pRecord,
+	void*                       pvBuffer,
+	size_t                      cbBuffer
+	)
+{
+	OBSRV_RECORD_WRITER writer;
+	int                 bFits;
+
+	if (!ObsrvRecordBegin(
+			&writer,
+			pvBuffer,
+			(cbBuffer > OBSRV_RECORD_MAX_SIZE) ? OBSRV_RECORD_MAX_SIZE : (OBSRV_U32)cbBuffer,
+			pRecord->Kind,
+			pRecord->Sequence,
+			pRecord->Timestamp
+			))
+		return 0;
+
+	bFits = ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, pRecord->hProcessId);
+	if (bFits && ObsrvIsProcessKind(pRecord->Kind))
+		bFits = ObsrvRecordPutU32(&writer, OBSRV_TAG_PARENT_ID, pRecord->hParentId) &&
+		        ObsrvRecordPutU32(&writer, OBSRV_TAG_SESSION_ID, pRecord->SessionId);
+	if (bFits && (OBSRV_KIND_PROCESS_CREATE == pRecord->Kind))
+		bFits = ObsrvRecordPutU32(&writer, OBSRV_TAG_CREATING_PROCESS_ID, pRecord->CreatingProcessId) &&
+		        ObsrvRecordPutU32(&writer, OBSRV_TAG_CREATING_THREAD_ID, pRecord->CreatingThreadId);
+	if (bFits && (OBSRV_KIND_PROCESS_EXIT == pRecord->Kind))
+		bFits = ObsrvRecordPutU32(&writer, OBSRV_TAG_EXIT_STATUS, pRecord->ExitStatus);
+	if (bFits && (NULL != pRecord->Extra))
+		bFits = ObsrvRecordPutFields(&writer, pRecord->Extra);
+
+	return bFits ? ObsrvRecordEnd(&writer) : 0;
+}
+
+//
+// Move as many records from the ring into the batch as fit. Must be
+// called by the ring's only consumer. pfnRelease (may be NULL) is called
+// for every record moved. Returns the number of bytes used.
+//
+OBSRV_INLINE size_t ObsrvBatchFillFromRing(
+	POBSRV_RING          pRing,
+	void*                pvBuffer,
+	size_t               cbBuffer,
+	OBSRV_RECORD_RELEASE pfnRelease
+	)
+{
+	POBSRV_BATCH_HEADER         pHeader = (POBSRV_BATCH_HEADER)pvBuffer;
+	OBSRV_U8*                   pbNext  = (OBSRV_U8*)(pHeader + 1);
+	const OBSRV_PROCESS_RECORD* pPeeked;
+	OBSRV_PROCESS_RECORD        record;
+	OBSRV_U32                   cbRecord;
+
+	if (!ObsrvBatchInit(pvBuffer, cbBuffer))
+		return 0;
+	cbBuffer -= sizeof(OBSRV_BATCH_HEADER);
+	//
+	// Encode the oldest record first and take it off the ring only if it
+	// fit. Its sequence number is known once it has been popped.
+	//
+	while (NULL != (pPeeked = ObsrvRingPeek(pRing)))
+	{
+		cbRecord = ObsrvBatchEncodeProcess(pPeeked, pbNext, cbBuffer - pHeader->Bytes);
+		if (0 == cbRecord)
+			break;
+		ObsrvRingPop(pRing, &record);
+		((POBSRV_RECORD_HEADER)pbNext)->Sequence = record.Sequence;
+		if (NULL != pfnRelease)
+			pfnRelease(&record);
+
+		pbNext          += cbRecord;
+		pHeader->Bytes  += cbRecord;
+		pHeader->Count++;
+	} // while
+
+	pHeader->Overflow = ObsrvRingOverflow(pRing);
+	if (ObsrvRingCount(pRing) > 0)
+		pHeader->Flags |= OBSRV_BATCH_FLAG_MORE_PENDING;
+
+	return sizeof(OBSRV_BATCH_HEADER) + pHeader->Bytes;
+}
+
+//
+// Validate cbBuffer bytes received from the driver. Returns a pointer to
+// the first record, or NULL if the buffer isn't a well-formed batch. The
+// records themselves are validated by ObsrvRecordDecode().
+//
+OBSRV_INLINE const void* ObsrvBatchDecode(
+	const void*          pvBuffer,
+	size_t               cbBuffer,
+	OBSRV_BATCH_HEADER*  pHeader
+	)
+{
+	const OBSRV_BATCH_HEADER* pSource = (const OBSRV_BATCH_HEADER*)pvBuffer;
+
+	if ((NULL == pvBuffer) || (cbBuffer < sizeof(OBSRV_BATCH_HEADER)))
+		return NULL;
+	if ((OBSRV_BATCH_VERSION != pSource->Version) ||
+	    (pSource->Bytes > cbBuffer - sizeof(OBSRV_BATCH_HEADER)))
+		return NULL;
+
+	*pHeader = *pSource;
+	return pSource + 1;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVBATCH_H_)
+//----------------------------End of the file -------------------------------
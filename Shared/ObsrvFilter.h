@@ -0,0 +1,642 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvFilter.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Compiled event filter evaluated by the driver
+//
+// DESCRIPTION:
+//              The user-mode app describes which process events it wants as
+//              a list of rules, compiles them into a single flat block and
+//              hands that over to the driver (IOCTL_PROCOBSRV_SET_FILTER).
+//              The driver evaluates it before an event is queued, thus
+//              unwanted events never leave the kernel.
+//
+//              A rule allows or denies events by process ID, parent ID,
+//              session ID or image path prefix. Deny rules always win. If
+//              there is any allow rule, an event has to match at least one
+//              of them; otherwise everything not denied passes.
+//
+//              +--------+-----------------------------+-------+-------+
+//              | Header | Lists[Field * 2 + Action]   | IDs   | Pool  |
+//              +--------+-----------------------------+-------+-------+
+//
+//              IDs are kept as sorted arrays and looked up by binary search.
+//              Prefixes are stored upper-cased (ASCII only, NT paths are
+//              case-insensitive), sorted, and with every prefix dropped that
+//              starts with another prefix of the same list. Then the only
+//              candidate for a path is the greatest prefix not above it, so
+//              a lookup is a binary search as well. Either way the cost
+//              grows with the logarithm of the number of rules.
+//
+//              Neither the compiler nor the evaluator allocates memory. The
+//              driver validates the whole block, including the order of
+//              the lists, before it installs it.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVFILTER_H_)
+#define _OBSRVFILTER_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvTypes.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+#define OBSRV_FILTER_VERSION           1
+//
+// Upper bound of a compiled filter the driver accepts
+//
+#define OBSRV_FILTER_MAX_SIZE          (1024 * 1024)
+
+//
+// What a rule looks at
+//
+#define OBSRV_FILTER_PROCESS_ID        0
+#define OBSRV_FILTER_PARENT_ID         1
+#define OBSRV_FILTER_SESSION_ID        2
+#define OBSRV_FILTER_IMAGE_PREFIX      3
+#define OBSRV_FILTER_FIELD_COUNT       4
+
+//
+// What a rule does with a matching event
+//
+#define OBSRV_FILTER_ALLOW             0
+#define OBSRV_FILTER_DENY              1
+
+#define OBSRV_FILTER_LIST_COUNT        (OBSRV_FILTER_FIELD_COUNT * 2)
+#define OBSRV_FILTER_LIST(nField, nAction) ((nField) * 2 + (nAction))
+
+//
+// Case folding of path characters
+//
+#define OBSRV_FILTER_FOLD(ch)          \
+	((OBSRV_U16)((((ch) >= 'a') && ((ch) <= 'z')) ? ((ch) - 'a' + 'A') : (ch)))
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A single rule as the app describes it
+//
+typedef struct _ObsrvFilterRule
+{
+	OBSRV_U32         Field;         // OBSRV_FILTER_PROCESS_ID ...
+	OBSRV_U32         Action;        // OBSRV_FILTER_ALLOW or _DENY
+	OBSRV_U32         Value;         // ID rules
+	OBSRV_U32         PrefixLength;  // Prefix rules, characters
+	const OBSRV_U16*  Prefix;        // Prefix rules, UTF-16
+} OBSRV_FILTER_RULE, *POBSRV_FILTER_RULE;
+
+//
+// A list inside the compiled filter. ID lists hold OBSRV_U32 values,
+// prefix lists hold OBSRV_FILTER_PREFIX entries.
+//
+typedef struct _ObsrvFilterList
+{
+	OBSRV_U32  Offset;        // From the start of the filter
+	OBSRV_U32  Count;
+} OBSRV_FILTER_LIST, *POBSRV_FILTER_LIST;
+
+typedef struct _ObsrvFilterPrefix
+{
+	OBSRV_U32  Offset;        // Folded UTF-16, from the start of the filter
+	OBSRV_U32  Length;        // Characters
+} OBSRV_FILTER_PREFIX, *POBSRV_FILTER_PREFIX;
+
+typedef struct _ObsrvFilterHeader
+{
+	OBSRV_U32          Version;       // OBSRV_FILTER_VERSION
+	OBSRV_U32          Size;          // Bytes, including the header
+	OBSRV_U32          Reserved[2];
+	OBSRV_FILTER_LIST  Lists[OBSRV_FILTER_LIST_COUNT];
+} OBSRV_FILTER_HEADER, *POBSRV_FILTER_HEADER;
+
+//
+// What the filter is evaluated against
+//
+typedef struct _ObsrvFilterEvent
+{
+	OBSRV_U32         ProcessId;
+	OBSRV_U32         ParentId;
+	OBSRV_U32         SessionId;
+	const OBSRV_U16*  ImagePath;       // NULL if unknown
+	OBSRV_U32         ImagePathLength; // Characters
+} OBSRV_FILTER_EVENT, *POBSRV_FILTER_EVENT;
+
+//---------------------------------------------------------------------------
+//
+// Helpers
+//
+//---------------------------------------------------------------------------
+
+//
+// Compare two strings, the first one already folded. Returns <0, 0 or >0.
+// *pbPrefix is set if the first one is a prefix of (or equal to) the
+// second one.
+//
+OBSRV_INLINE int ObsrvFilterCompare(
+	const OBSRV_U16* pszFolded,
+	OBSRV_U32        cchFolded,
+	const OBSRV_U16* pszText,
+	OBSRV_U32        cchText,
+	int*             pbPrefix
+	)
+{
+	OBSRV_U32 i;
+	OBSRV_U16 ch;
+
+	*pbPrefix = 0;
+	for (i = 0; (i < cchFolded) && (i < cchText); i++)
+	{
+		ch = OBSRV_FILTER_FOLD(pszText[i]);
+		if (pszFolded[i] != ch)
+			return (pszFolded[i] < ch) ? -1 : 1;
+	}
+	if (cchFolded <= cchText)
+	{
+		*pbPrefix = 1;
+		return (cchFolded == cchText) ? 0 : -1;
+	}
+
+	return 1;
+}
+
+//
+// Number of leading characters a folded string and a path have in common
+//
+OBSRV_INLINE OBSRV_U32 ObsrvFilterCommonLength(
+	const OBSRV_U16* pszFolded,
+	OBSRV_U32        cchFolded,
+	const OBSRV_U16* pszText,
+	OBSRV_U32        cchText
+	)
+{
+	OBSRV_U32 i;
+
+	for (i = 0; (i < cchFolded) && (i < cchText); i++)
+		if (pszFolded[i] != OBSRV_FILTER_FOLD(pszText[i]))
+			break;
+
+	return i;
+}
+
+OBSRV_INLINE const OBSRV_U16* ObsrvFilterPrefixText(
+	const OBSRV_U8*            pbFilter,
+	const OBSRV_FILTER_PREFIX* pPrefix
+	)
+{
+	return (const OBSRV_U16*)(pbFilter + pPrefix->Offset);
+}
+
+//
+// Sift down step of the heap sorts below
+//
+OBSRV_INLINE void ObsrvFilterSiftIds(OBSRV_U32* pIds, OBSRV_U32 nRoot, OBSRV_U32 nCount)
+{
+	OBSRV_U32 nChild;
+	OBSRV_U32 nSwap;
+
+	while ((nChild = 2 * nRoot + 1) < nCount)
+	{
+		if ((nChild + 1 < nCount) && (pIds[nChild] < pIds[nChild + 1]))
+			nChild++;
+		if (pIds[nRoot] >= pIds[nChild])
+			break;
+		nSwap = pIds[nRoot]; pIds[nRoot] = pIds[nChild]; pIds[nChild] = nSwap;
+		nRoot = nChild;
+	} // while
+}
+
+OBSRV_INLINE int ObsrvFilterPrefixLess(
+	const OBSRV_U8*            pbFilter,
+	const OBSRV_FILTER_PREFIX* pLeft,
+	const OBSRV_FILTER_PREFIX* pRight
+	)
+{
+	int bPrefix;
+
+	return ObsrvFilterCompare(
+		ObsrvFilterPrefixText(pbFilter, pLeft), pLeft->Length,
+		ObsrvFilterPrefixText(pbFilter, pRight), pRight->Length,
+		&bPrefix
+		) < 0;
+}
+
+OBSRV_INLINE void ObsrvFilterSiftPrefixes(
+	const OBSRV_U8*      pbFilter,
+	POBSRV_FILTER_PREFIX pPrefixes,
+	OBSRV_U32            nRoot,
+	OBSRV_U32            nCount
+	)
+{
+	OBSRV_U32           nChild;
+	OBSRV_FILTER_PREFIX swap;
+
+	while ((nChild = 2 * nRoot + 1) < nCount)
+	{
+		if ((nChild + 1 < nCount) &&
+		    ObsrvFilterPrefixLess(pbFilter, &pPrefixes[nChild], &pPrefixes[nChild + 1]))
+			nChild++;
+		if (!ObsrvFilterPrefixLess(pbFilter, &pPrefixes[nRoot], &pPrefixes[nChild]))
+			break;
+		swap = pPrefixes[nRoot]; pPrefixes[nRoot] = pPrefixes[nChild]; pPrefixes[nChild] = swap;
+		nRoot = nChild;
+	} // while
+}
+
+//---------------------------------------------------------------------------
+//
+// Compiler
+//
+//---------------------------------------------------------------------------
+
+//
+// Bytes needed to compile nRules rules. Returns 0 if a rule is invalid
+// or the result would exceed OBSRV_FILTER_MAX_SIZE.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvFilterCompiledSize(
+	const OBSRV_FILTER_RULE* pRules,
+	OBSRV_U32                nRules
+	)
+{
+	OBSRV_U64 cbSize = sizeof(OBSRV_FILTER_HEADER);
+	OBSRV_U32 i;
+
+	for (i = 0; i < nRules; i++)
+	{
+		if ((pRules[i].Field >= OBSRV_FILTER_FIELD_COUNT) || (pRules[i].Action > OBSRV_FILTER_DENY))
+			return 0;
+		if (OBSRV_FILTER_IMAGE_PREFIX != pRules[i].Field)
+			cbSize += sizeof(OBSRV_U32);
+		else if ((0 == pRules[i].PrefixLength) || (NULL == pRules[i].Prefix) ||
+		         (pRules[i].PrefixLength > 0xFFFF))
+			return 0;
+		else
+			cbSize += sizeof(OBSRV_FILTER_PREFIX) +
+				((pRules[i].PrefixLength * sizeof(OBSRV_U16) + 3) & ~3u);
+	} // for
+
+	return (cbSize > OBSRV_FILTER_MAX_SIZE) ? 0 : (OBSRV_U32)cbSize;
+}
+
+//
+// Compile nRules rules into cbBuffer bytes (4-byte aligned, at least
+// ObsrvFilterCompiledSize()). Returns the size of the filter, 0 if the
+// rules are invalid or the buffer is too small.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvFilterCompile(
+	const OBSRV_FILTER_RULE* pRules,
+	OBSRV_U32                nRules,
+	void*                    pvBuffer,
+	OBSRV_U32                cbBuffer
+	)
+{
+	POBSRV_FILTER_HEADER pHeader  = (POBSRV_FILTER_HEADER)pvBuffer;
+	OBSRV_U8*            pbFilter = (OBSRV_U8*)pvBuffer;
+	OBSRV_U32            cbSize   = ObsrvFilterCompiledSize(pRules, nRules);
+	OBSRV_U32            nOffset;
+	OBSRV_U32            nPool;
+	OBSRV_U32            nList;
+	OBSRV_U32            i;
+	OBSRV_U32            j;
+	OBSRV_U32            nKept;
+	OBSRV_U32*           pIds;
+	POBSRV_FILTER_PREFIX pPrefixes;
+	OBSRV_FILTER_PREFIX  swap;
+	OBSRV_U16*           pszText;
+	int                  bPrefix;
+
+	if ((0 == cbSize) || (cbSize > cbBuffer))
+		return 0;
+	//
+	// Lay the lists out back to back, the string pool goes last
+	//
+	for (i = 0; i < sizeof(*pHeader); i++)
+		pbFilter[i] = 0;
+	pHeader->Version = OBSRV_FILTER_VERSION;
+	pHeader->Size    = cbSize;
+	for (i = 0; i < nRules; i++)
+		pHeader->Lists[OBSRV_FILTER_LIST(pRules[i].Field, pRules[i].Action)].Count++;
+	nOffset = sizeof(OBSRV_FILTER_HEADER);
+	for (nList = 0; nList < OBSRV_FILTER_LIST_COUNT; nList++)
+	{
+		pHeader->Lists[nList].Offset = nOffset;
+		nOffset += pHeader->Lists[nList].Count *
+			((nList / 2 == OBSRV_FILTER_IMAGE_PREFIX) ?
+				(OBSRV_U32)sizeof(OBSRV_FILTER_PREFIX) : (OBSRV_U32)sizeof(OBSRV_U32));
+		pHeader->Lists[nList].Count = 0;
+	}
+	nPool = nOffset;
+	for (i = 0; i < nRules; i++)
+	{
+		POBSRV_FILTER_LIST pList = &pHeader->Lists[OBSRV_FILTER_LIST(pRules[i].Field, pRules[i].Action)];
+		if (OBSRV_FILTER_IMAGE_PREFIX != pRules[i].Field)
+		{
+			pIds = (OBSRV_U32*)(pbFilter + pList->Offset);
+			pIds[pList->Count++] = pRules[i].Value;
+			continue;
+		}
+		pPrefixes = (POBSRV_FILTER_PREFIX)(pbFilter + pList->Offset);
+		pPrefixes[pList->Count].Offset = nPool;
+		pPrefixes[pList->Count].Length = pRules[i].PrefixLength;
+		pList->Count++;
+		pszText = (OBSRV_U16*)(pbFilter + nPool);
+		for (j = 0; j < pRules[i].PrefixLength; j++)
+			pszText[j] = OBSRV_FILTER_FOLD(pRules[i].Prefix[j]);
+		if (0 != (j & 1))
+			pszText[j] = 0;
+		nPool += (pRules[i].PrefixLength * sizeof(OBSRV_U16) + 3) & ~3u;
+	} // for
+	//
+	// Sort, drop duplicates and prefixes covered by shorter ones
+	//
+	for (nList = 0; nList < OBSRV_FILTER_LIST_COUNT; nList++)
+	{
+		POBSRV_FILTER_LIST pList  = &pHeader->Lists[nList];
+		OBSRV_U32          nCount = pList->Count;
+
+		if (nCount < 2)
+			continue;
+		if (nList / 2 != OBSRV_FILTER_IMAGE_PREFIX)
+		{
+			pIds = (OBSRV_U32*)(pbFilter + pList->Offset);
+			for (i = nCount / 2; i-- > 0; )
+				ObsrvFilterSiftIds(pIds, i, nCount);
+			for (i = nCount - 1; i > 0; i--)
+			{
+				j = pIds[0]; pIds[0] = pIds[i]; pIds[i] = j;
+				ObsrvFilterSiftIds(pIds, 0, i);
+			}
+			for (i = 1, nKept = 1; i < nCount; i++)
+				if (pIds[i] != pIds[nKept - 1])
+					pIds[nKept++] = pIds[i];
+		}
+		else
+		{
+			pPrefixes = (POBSRV_FILTER_PREFIX)(pbFilter + pList->Offset);
+			for (i = nCount / 2; i-- > 0; )
+				ObsrvFilterSiftPrefixes(pbFilter, pPrefixes, i, nCount);
+			for (i = nCount - 1; i > 0; i--)
+			{
+				swap = pPrefixes[0]; pPrefixes[0] = pPrefixes[i]; pPrefixes[i] = swap;
+				ObsrvFilterSiftPrefixes(pbFilter, pPrefixes, 0, i);
+			}
+			for (i = 1, nKept = 1; i < nCount; i++)
+			{
+				ObsrvFilterCompare(
+					ObsrvFilterPrefixText(pbFilter, &pPrefixes[nKept - 1]), pPrefixes[nKept - 1].Length,
+					ObsrvFilterPrefixText(pbFilter, &pPrefixes[i]), pPrefixes[i].Length,
+					&bPrefix
+					);
+				if (!bPrefix)
+					pPrefixes[nKept++] = pPrefixes[i];
+			} // for
+		}
+		pList->Count = nKept;
+	} // for
+
+	return cbSize;
+}
+
+//---------------------------------------------------------------------------
+//
+// Validation and evaluation
+//
+//---------------------------------------------------------------------------
+
+//
+// Check a filter received from user mode. Returns 0 unless every offset
+// is in range and every list is in the order the lookups rely on.
+//
+OBSRV_INLINE int ObsrvFilterValidate(
+	const void* pvFilter,
+	size_t      cbFilter
+	)
+{
+	const OBSRV_U8*            pbFilter = (const OBSRV_U8*)pvFilter;
+	const OBSRV_FILTER_HEADER* pHeader  = (const OBSRV_FILTER_HEADER*)pvFilter;
+	const OBSRV_FILTER_LIST*   pList;
+	const OBSRV_U32*           pIds;
+	const OBSRV_FILTER_PREFIX* pPrefixes;
+	OBSRV_U32                  nList;
+	OBSRV_U32                  cbEntry;
+	OBSRV_U32                  i;
+	int                        bPrefix;
+
+	if ((NULL == pvFilter) || (cbFilter < sizeof(OBSRV_FILTER_HEADER)) ||
+	    (cbFilter > OBSRV_FILTER_MAX_SIZE) || (0 != ((size_t)pvFilter & 3)) ||
+	    (OBSRV_FILTER_VERSION != pHeader->Version) || (pHeader->Size != cbFilter))
+		return 0;
+
+	for (nList = 0; nList < OBSRV_FILTER_LIST_COUNT; nList++)
+	{
+		pList   = &pHeader->Lists[nList];
+		cbEntry = (nList / 2 == OBSRV_FILTER_IMAGE_PREFIX) ?
+			(OBSRV_U32)sizeof(OBSRV_FILTER_PREFIX) : (OBSRV_U32)sizeof(OBSRV_U32);
+		if ((0 != (pList->Offset & 3)) || (pList->Offset > cbFilter) ||
+		    (pList->Count > (cbFilter - pList->Offset) / cbEntry))
+			return 0;
+		if (nList / 2 != OBSRV_FILTER_IMAGE_PREFIX)
+		{
+			pIds = (const OBSRV_U32*)(pbFilter + pList->Offset);
+			for (i = 1; i < pList->Count; i++)
+				if (pIds[i - 1] >= pIds[i])
+					return 0;
+			continue;
+		}
+		pPrefixes = (const OBSRV_FILTER_PREFIX*)(pbFilter + pList->Offset);
+		for (i = 0; i < pList->Count; i++)
+		{
+			if ((0 == pPrefixes[i].Length) || (0 != (pPrefixes[i].Offset & 1)) ||
+			    (pPrefixes[i].Offset > cbFilter) ||
+			    (pPrefixes[i].Length > (cbFilter - pPrefixes[i].Offset) / sizeof(OBSRV_U16)))
+				return 0;
+			if ((i > 0) &&
+			    ((ObsrvFilterCompare(
+					ObsrvFilterPrefixText(pbFilter, &pPrefixes[i - 1]), pPrefixes[i - 1].Length,
+					ObsrvFilterPrefixText(pbFilter, &pPrefixes[i]), pPrefixes[i].Length,
+					&bPrefix
+					) >= 0) || bPrefix))
+				return 0;
+		} // for
+	} // for
+
+	return 1;
+}
+
+//
+// Binary search of a sorted ID list
+//
+OBSRV_INLINE int ObsrvFilterHasId(
+	const OBSRV_U8*          pbFilter,
+	const OBSRV_FILTER_LIST* pList,
+	OBSRV_U32                nId
+	)
+{
+	const OBSRV_U32* pIds  = (const OBSRV_U32*)(pbFilter + pList->Offset);
+	OBSRV_U32        nLow  = 0;
+	OBSRV_U32        nHigh = pList->Count;
+	OBSRV_U32        nMid;
+
+	while (nLow < nHigh)
+	{
+		nMid = nLow + (nHigh - nLow) / 2;
+		if (pIds[nMid] == nId)
+			return 1;
+		if (pIds[nMid] < nId)
+			nLow = nMid + 1;
+		else
+			nHigh = nMid;
+	} // while
+
+	return 0;
+}
+
+//
+// Find the greatest prefix not above the path and check whether it is
+// one of its prefixes. The prefixes between the two bounds share with
+// the path whatever both bounds share with it, thus the comparison
+// starts past that (device paths share a long head).
+//
+OBSRV_INLINE int ObsrvFilterHasPrefix(
+	const OBSRV_U8*          pbFilter,
+	const OBSRV_FILTER_LIST* pList,
+	const OBSRV_U16*         pszPath,
+	OBSRV_U32                cchPath
+	)
+{
+	const OBSRV_FILTER_PREFIX* pPrefixes = (const OBSRV_FILTER_PREFIX*)(pbFilter + pList->Offset);
+	const OBSRV_U16*           pszText;
+	OBSRV_U32                  nLow      = 0;
+	OBSRV_U32                  nHigh     = pList->Count;
+	OBSRV_U32                  cchLow    = 0;
+	OBSRV_U32                  cchHigh   = 0;
+	OBSRV_U32                  cchText;
+	OBSRV_U32                  nMid;
+	OBSRV_U32                  i;
+
+	//
+	// The first and the last prefix bound all the others
+	//
+	if (0 != nHigh)
+	{
+		cchLow  = ObsrvFilterCommonLength(ObsrvFilterPrefixText(pbFilter, &pPrefixes[0]),
+			pPrefixes[0].Length, pszPath, cchPath);
+		cchHigh = ObsrvFilterCommonLength(ObsrvFilterPrefixText(pbFilter, &pPrefixes[nHigh - 1]),
+			pPrefixes[nHigh - 1].Length, pszPath, cchPath);
+	}
+	while (nLow < nHigh)
+	{
+		nMid    = nLow + (nHigh - nLow) / 2;
+		pszText = ObsrvFilterPrefixText(pbFilter, &pPrefixes[nMid]);
+		cchText = pPrefixes[nMid].Length;
+		for (i = (cchLow < cchHigh) ? cchLow : cchHigh; (i < cchText) && (i < cchPath); i++)
+			if (pszText[i] != OBSRV_FILTER_FOLD(pszPath[i]))
+				break;
+		if (i == cchText)
+			return 1;
+		if ((i < cchPath) && (pszText[i] < OBSRV_FILTER_FOLD(pszPath[i])))
+		{
+			nLow   = nMid + 1;
+			cchLow = i;
+		}
+		else
+		{
+			nHigh   = nMid;
+			cchHigh = i;
+		}
+	} // while
+
+	return 0;
+}
+
+//
+// Tell whether the filter looks at image paths at all, thus the caller
+// can skip looking them up
+//
+OBSRV_INLINE int ObsrvFilterNeedsImagePath(const void* pvFilter)
+{
+	const OBSRV_FILTER_HEADER* pHeader = (const OBSRV_FILTER_HEADER*)pvFilter;
+
+	return (0 != pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_ALLOW)].Count) ||
+	       (0 != pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_DENY)].Count);
+}
+
+//
+// Evaluate a validated filter. Returns 1 if the event passes.
+//
+OBSRV_INLINE int ObsrvFilterMatch(
+	const void*               pvFilter,
+	const OBSRV_FILTER_EVENT* pEvent
+	)
+{
+	const OBSRV_U8*            pbFilter = (const OBSRV_U8*)pvFilter;
+	const OBSRV_FILTER_HEADER* pHeader  = (const OBSRV_FILTER_HEADER*)pvFilter;
+	const OBSRV_FILTER_LIST*   pAllow;
+	const OBSRV_FILTER_LIST*   pDeny;
+	OBSRV_U32                  nValues[OBSRV_FILTER_IMAGE_PREFIX];
+	OBSRV_U32                  nField;
+	int                        bAllowRules = 0;
+	int                        bAllowed    = 0;
+
+	nValues[OBSRV_FILTER_PROCESS_ID] = pEvent->ProcessId;
+	nValues[OBSRV_FILTER_PARENT_ID]  = pEvent->ParentId;
+	nValues[OBSRV_FILTER_SESSION_ID] = pEvent->SessionId;
+	for (nField = 0; nField < OBSRV_FILTER_IMAGE_PREFIX; nField++)
+	{
+		pAllow = &pHeader->Lists[OBSRV_FILTER_LIST(nField, OBSRV_FILTER_ALLOW)];
+		pDeny  = &pHeader->Lists[OBSRV_FILTER_LIST(nField, OBSRV_FILTER_DENY)];
+		if ((0 != pDeny->Count) && ObsrvFilterHasId(pbFilter, pDeny, nValues[nField]))
+			return 0;
+		if (0 != pAllow->Count)
+		{
+			bAllowRules = 1;
+			if (!bAllowed)
+				bAllowed = ObsrvFilterHasId(pbFilter, pAllow, nValues[nField]);
+		}
+	} // for
+	//
+	// An unknown path matches no prefix at all
+	//
+	pAllow = &pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_ALLOW)];
+	pDeny  = &pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_DENY)];
+	if ((0 != pDeny->Count) && (NULL != pEvent->ImagePath) &&
+	    ObsrvFilterHasPrefix(pbFilter, pDeny, pEvent->ImagePath, pEvent->ImagePathLength))
+		return 0;
+	if (0 != pAllow->Count)
+	{
+		bAllowRules = 1;
+		if (!bAllowed && (NULL != pEvent->ImagePath))
+			bAllowed = ObsrvFilterHasPrefix(pbFilter, pAllow, pEvent->ImagePath, pEvent->ImagePathLength);
+	}
+
+	return !bAllowRules || bAllowed;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVFILTER_H_)
+//----------------------------End of the file -------------------------------
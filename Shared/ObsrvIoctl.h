@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvIoctl.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Control codes and structures exchanged between the ProcObsrv
+//              driver and the user-mode applications
+//
+// DESCRIPTION:
+//              The one and only definition of the driver's interface. The
+//              records returned by the retrieval IOCTLs are described in
+//              ObsrvBatch.h and ObsrvRecord.h.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVIOCTL_H_)
+#define _OBSRVIOCTL_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvTypes.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+
+//
+// Provided by the DDK and winioctl.h; spelled out for other platforms
+//
+#if !defined(CTL_CODE)
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+	(((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+#define METHOD_BUFFERED                 0
+#define METHOD_OUT_DIRECT               2
+#define FILE_READ_ACCESS                0x0001
+#define FILE_WRITE_ACCESS               0x0002
+#endif
+#if !defined(FILE_DEVICE_UNKNOWN)
+#define FILE_DEVICE_UNKNOWN             0x00000022
+#endif
+
+#define IOCTL_UNKNOWN_BASE              FILE_DEVICE_UNKNOWN
+//
+// ACTIVATE_INFO::Subscriptions - events wanted on top of process create
+// and exit
+//
+#define OBSRV_SUBSCRIBE_IMAGE_LOAD      0x01
+#define OBSRV_SUBSCRIBE_THREAD          0x02
+//
+// Input ACTIVATE_INFO - register or unregister the notify routine
+//
+#define IOCTL_PROCOBSRV_ACTIVATE_MONITORING    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0800, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// Output PROCESS_CALLBACK_INFO - the oldest event, fixed fields only
+//
+#define IOCTL_PROCOBSRV_GET_PROCINFO    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0801, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// Output a batch (ObsrvBatch.h) of at least OBSRV_BATCH_MIN_SIZE bytes,
+// completed right away
+//
+#define IOCTL_PROCOBSRV_GET_PROCINFO_BATCH    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0802, METHOD_OUT_DIRECT, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// Same as above, but kept pending until there is at least one record
+//
+#define IOCTL_PROCOBSRV_WAIT_PROCINFO    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0803, METHOD_OUT_DIRECT, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// In/output SECTION_MAP_INFO - map the shared section (ObsrvSection.h) 
+// into the caller's address space. It stays mapped until the handle is
+// closed.
+//
+#define IOCTL_PROCOBSRV_MAP_SECTION    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0804, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// No buffers - move records the driver still holds into the section
+// (after the consumer has found OBSRV_SECTION_REFILL)
+//
+#define IOCTL_PROCOBSRV_REFILL_SECTION    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0805, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+//
+// Input a compiled filter (ObsrvFilter.h) replacing the current one, or
+// nothing to remove it
+//
+#define IOCTL_PROCOBSRV_SET_FILTER    \
+	CTL_CODE(IOCTL_UNKNOWN_BASE, 0x0806, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Structure for holding info about activating/deactivating the driver
+//
+typedef struct _ActivateInfo
+{
+	OBSRV_U8   bActivated;    // BOOLEAN
+	OBSRV_U8   Subscriptions; // OBSRV_SUBSCRIBE_xxx, taken on activation
+} ACTIVATE_INFO, *PACTIVATE_INFO;
+
+//
+// Structure for process callback information returned by
+// IOCTL_PROCOBSRV_GET_PROCINFO
+//
+typedef struct _ProcessCallbackInfo
+{
+	OBSRV_U32  hParentId;
+	OBSRV_U32  hProcessId;
+	OBSRV_U8   bCreate;       // BOOLEAN
+} PROCESS_CALLBACK_INFO, *PPROCESS_CALLBACK_INFO;
+
+//
+// Structure for mapping the shared section. Fields are 64-bit wide, thus
+// 32-bit apps talk to a 64-bit driver with the same layout.
+//
+typedef struct _SectionMapInfo
+{
+	OBSRV_U64  hEvent;        // In: event the driver sets to wake the app
+	OBSRV_U64  pvSection;     // Out: address of the section in the app
+	OBSRV_U64  cbSection;     // Out: size of the mapping
+} SECTION_MAP_INFO, *PSECTION_MAP_INFO;
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVIOCTL_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,169 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvPend.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Queue of read requests parked by the driver until process
+//              records become available ("inverted call")
+//
+// DESCRIPTION:
+//              The user-mode app keeps several read requests outstanding.
+//              The driver never decides on arrival whether a request can be
+//              completed; it follows a "park, then deliver" protocol:
+//
+//              1. An incoming read request is always parked at the tail.
+//              2. After parking a request and after appending a record, the
+//                 deliver step runs: while records are buffered and a
+//                 request is parked, unlink the oldest request and complete
+//                 it with as many records as it can hold.
+//
+//              Deliver steps must be serialized with each other (the same
+//              lock that serializes the ring's consumer). A record is thus
+//              either delivered by the step following its append, or it
+//              stays buffered because no request was parked - in which
+//              case the next parked request triggers a step that picks it
+//              up. There is no window in which a record waits while a
+//              request is parked.
+//
+//              The queue is a plain FIFO protected by the caller. The link
+//              is laid out like the NT LIST_ENTRY, thus the driver can
+//              queue IRPs through Irp->Tail.Overlay.ListEntry from its
+//              cancel-safe queue callbacks.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVPEND_H_)
+#define _OBSRVPEND_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvTypes.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Doubly linked list entry embedded in a request
+//
+typedef struct _ObsrvPendLink
+{
+	struct _ObsrvPendLink* Flink;
+	struct _ObsrvPendLink* Blink;
+} OBSRV_PEND_LINK, *POBSRV_PEND_LINK;
+
+//
+// FIFO of parked requests
+//
+typedef struct _ObsrvPendQueue
+{
+	OBSRV_PEND_LINK  List;
+	OBSRV_U32        Count;     // Currently parked
+	OBSRV_U64        Parked;    // Ever parked
+} OBSRV_PEND_QUEUE, *POBSRV_PEND_QUEUE;
+
+//---------------------------------------------------------------------------
+//
+// Functions
+//
+//---------------------------------------------------------------------------
+
+OBSRV_INLINE void ObsrvPendQueueInit(POBSRV_PEND_QUEUE pQueue)
+{
+	pQueue->List.Flink = &pQueue->List;
+	pQueue->List.Blink = &pQueue->List;
+	pQueue->Count      = 0;
+	pQueue->Parked     = 0;
+}
+
+OBSRV_INLINE int ObsrvPendQueueIsEmpty(POBSRV_PEND_QUEUE pQueue)
+{
+	return (pQueue->List.Flink == &pQueue->List);
+}
+
+//
+// Park a request at the tail
+//
+OBSRV_INLINE void ObsrvPendQueueInsert(
+	POBSRV_PEND_QUEUE pQueue,
+	POBSRV_PEND_LINK  pLink
+	)
+{
+	pLink->Flink              = &pQueue->List;
+	pLink->Blink              = pQueue->List.Blink;
+	pQueue->List.Blink->Flink = pLink;
+	pQueue->List.Blink        = pLink;
+	pQueue->Count++;
+	pQueue->Parked++;
+}
+
+//
+// Unlink a parked request (delivery or cancellation)
+//
+OBSRV_INLINE void ObsrvPendQueueRemove(
+	POBSRV_PEND_QUEUE pQueue,
+	POBSRV_PEND_LINK  pLink
+	)
+{
+	pLink->Blink->Flink = pLink->Flink;
+	pLink->Flink->Blink = pLink->Blink;
+	pLink->Flink        = pLink;
+	pLink->Blink        = pLink;
+	pQueue->Count--;
+}
+
+//
+// The request after pLink, or the oldest one if pLink is NULL. Returns
+// NULL at the end of the queue.
+//
+OBSRV_INLINE POBSRV_PEND_LINK ObsrvPendQueuePeekNext(
+	POBSRV_PEND_QUEUE pQueue,
+	POBSRV_PEND_LINK  pLink
+	)
+{
+	POBSRV_PEND_LINK pNext = (NULL == pLink) ? pQueue->List.Flink : pLink->Flink;
+
+	return (pNext == &pQueue->List) ? NULL : pNext;
+}
+
+//
+// Deliver step helper: unlink and return the oldest parked request if
+// there is data to hand out, NULL otherwise.
+//
+OBSRV_INLINE POBSRV_PEND_LINK ObsrvPendQueueNextToComplete(
+	POBSRV_PEND_QUEUE pQueue,
+	int               bDataAvailable
+	)
+{
+	POBSRV_PEND_LINK pLink;
+
+	if (!bDataAvailable)
+		return NULL;
+	pLink = ObsrvPendQueuePeekNext(pQueue, NULL);
+	if (NULL != pLink)
+		ObsrvPendQueueRemove(pQueue, pLink);
+
+	return pLink;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVPEND_H_)
+//----------------------------End of the file -------------------------------
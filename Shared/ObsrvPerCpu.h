@@ -0,0 +1,326 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvPerCpu.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Per-CPU buffers of thread events and the merge draining them
+//              in timestamp order
+//
+// DESCRIPTION:
+//              Thread creates and exits come at a rate no shared structure
+//              should have to take. Every CPU gets its own bounded buffer
+//              instead, written only by code running on that CPU with
+//              preemption disabled (DISPATCH_LEVEL in the driver), thus a
+//              buffer has exactly one producer and needs no interlocked
+//              operation at all. Producer and consumer indices live on
+//              separate cache lines and only ever grow.
+//
+//              A single consumer (serialized by the caller) drains all of
+//              them at once. Each buffer is in timestamp order by itself,
+//              so a k-way merge over the buffers' oldest entries, kept in
+//              a binary heap, yields the events of all CPUs in timestamp
+//              order. The merge only looks at what has been published when
+//              it begins; an event stamped meanwhile goes into the next
+//              drain.
+//
+//              A full buffer drops the new event and counts it. The
+//              consumer collects those counts, thus the loss is reported
+//              rather than silent.
+//
+//              The header depends on ObsrvRecord.h only and can be compiled
+//              in kernel mode as well as on Linux, where a thread pinned to
+//              each buffer plays the part of a CPU.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVPERCPU_H_)
+#define _OBSRVPERCPU_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvRecord.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+
+//
+// Capacity bounds (entries per CPU). The capacity is always rounded up
+// to a power of two.
+//
+#define OBSRV_CPU_BUFFER_MIN_CAPACITY      64
+#define OBSRV_CPU_BUFFER_DEFAULT_CAPACITY  1024
+#define OBSRV_CPU_BUFFER_MAX_CAPACITY      (64 * 1024)
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Buffer of a single CPU
+//
+typedef struct _ObsrvCpuBuffer
+{
+	POBSRV_THREAD_ENTRY Entries;
+	OBSRV_U64           Mask;
+	OBSRV_U32           Capacity;
+	OBSRV_U8            Pad0[OBSRV_CACHE_LINE - sizeof(void*) - 12];
+	//
+	// Producer's side, i.e. the owning CPU
+	//
+	volatile OBSRV_U64  Head;
+	volatile OBSRV_U64  Dropped;
+	OBSRV_U8            Pad1[OBSRV_CACHE_LINE - 16];
+	//
+	// Consumer's side
+	//
+	volatile OBSRV_U64  Tail;
+	OBSRV_U64           DroppedSeen;
+	OBSRV_U8            Pad2[OBSRV_CACHE_LINE - 16];
+} OBSRV_CPU_BUFFER, *POBSRV_CPU_BUFFER;
+
+//
+// Consumer's state while draining. The scratch space (see
+// ObsrvCpuMergeScratchSize()) is provided by the caller, thus nothing
+// gets allocated on the way.
+//
+typedef struct _ObsrvCpuMerge
+{
+	POBSRV_CPU_BUFFER pBuffers;
+	OBSRV_U32         nBuffers;
+	OBSRV_U32         nHeap;    // Buffers still having entries
+	OBSRV_U64*        pEnd;     // Head of every buffer when the merge began
+	OBSRV_U32*        pHeap;    // Buffer indices, oldest entry first
+} OBSRV_CPU_MERGE, *POBSRV_CPU_MERGE;
+
+//---------------------------------------------------------------------------
+//
+// Buffer functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Round the requested number of entries to a supported power of two
+//
+OBSRV_INLINE OBSRV_U32 ObsrvCpuBufferRoundCapacity(OBSRV_U32 nRequested)
+{
+	OBSRV_U32 nCapacity = OBSRV_CPU_BUFFER_MIN_CAPACITY;
+
+	if (nRequested > OBSRV_CPU_BUFFER_MAX_CAPACITY)
+		nRequested = OBSRV_CPU_BUFFER_MAX_CAPACITY;
+	while (nCapacity < nRequested)
+		nCapacity <<= 1;
+
+	return nCapacity;
+}
+
+//
+// Number of bytes the caller has to provide for the entries of a buffer
+//
+OBSRV_INLINE size_t ObsrvCpuBufferStorageSize(OBSRV_U32 nCapacity)
+{
+	return (size_t)nCapacity * sizeof(OBSRV_THREAD_ENTRY);
+}
+
+//
+// Setup a buffer on top of caller supplied storage. nCapacity must have
+// been produced by ObsrvCpuBufferRoundCapacity().
+//
+OBSRV_INLINE void ObsrvCpuBufferInit(
+	POBSRV_CPU_BUFFER   pBuffer,
+	POBSRV_THREAD_ENTRY pEntries,
+	OBSRV_U32           nCapacity
+	)
+{
+	pBuffer->Entries     = pEntries;
+	pBuffer->Capacity    = nCapacity;
+	pBuffer->Mask        = nCapacity - 1;
+	pBuffer->Head        = 0;
+	pBuffer->Dropped     = 0;
+	pBuffer->Tail        = 0;
+	pBuffer->DroppedSeen = 0;
+}
+
+//
+// Append an event. Must only be called by the buffer's CPU, which must
+// not be given away meanwhile. Returns 0 and counts a drop if the buffer
+// is full.
+//
+OBSRV_INLINE int ObsrvCpuBufferPush(
+	POBSRV_CPU_BUFFER         pBuffer,
+	const OBSRV_THREAD_ENTRY* pEntry
+	)
+{
+	OBSRV_U64 nHead = OBSRV_LOAD_RELAXED64(&pBuffer->Head);
+
+	if (nHead - OBSRV_LOAD_ACQUIRE64(&pBuffer->Tail) >= pBuffer->Capacity)
+	{
+		OBSRV_STORE_RELEASE64(&pBuffer->Dropped, OBSRV_LOAD_RELAXED64(&pBuffer->Dropped) + 1);
+		return 0;
+	}
+	pBuffer->Entries[nHead & pBuffer->Mask] = *pEntry;
+	OBSRV_STORE_RELEASE64(&pBuffer->Head, nHead + 1);
+
+	return 1;
+}
+
+//
+// Approximate number of entries waiting for the consumer
+//
+OBSRV_INLINE OBSRV_U64 ObsrvCpuBufferCount(POBSRV_CPU_BUFFER pBuffer)
+{
+	OBSRV_U64 nTail = OBSRV_LOAD_ACQUIRE64(&pBuffer->Tail);
+	OBSRV_U64 nHead = OBSRV_LOAD_ACQUIRE64(&pBuffer->Head);
+
+	return (nHead > nTail) ? (nHead - nTail) : 0;
+}
+
+//
+// Events dropped since the last call. Only the consumer may call it.
+//
+OBSRV_INLINE OBSRV_U64 ObsrvCpuBufferTakeDropped(POBSRV_CPU_BUFFER pBuffer)
+{
+	OBSRV_U64 nDropped = OBSRV_LOAD_ACQUIRE64(&pBuffer->Dropped);
+	OBSRV_U64 nNew     = nDropped - pBuffer->DroppedSeen;
+
+	pBuffer->DroppedSeen = nDropped;
+
+	return nNew;
+}
+
+//---------------------------------------------------------------------------
+//
+// Merge functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Bytes of scratch space a merge over nBuffers buffers needs
+//
+OBSRV_INLINE size_t ObsrvCpuMergeScratchSize(OBSRV_U32 nBuffers)
+{
+	return (size_t)nBuffers * (sizeof(OBSRV_U64) + sizeof(OBSRV_U32));
+}
+
+//
+// Tell whether buffer nLeft's oldest entry goes ahead of nRight's. Ties
+// are broken by the buffer index, thus the order is deterministic.
+//
+OBSRV_INLINE int ObsrvCpuMergeLess(
+	POBSRV_CPU_MERGE pMerge,
+	OBSRV_U32        nLeft,
+	OBSRV_U32        nRight
+	)
+{
+	POBSRV_CPU_BUFFER pLeft  = &pMerge->pBuffers[nLeft];
+	POBSRV_CPU_BUFFER pRight = &pMerge->pBuffers[nRight];
+	OBSRV_I64         llLeft  = pLeft->Entries[pLeft->Tail & pLeft->Mask].Timestamp;
+	OBSRV_I64         llRight = pRight->Entries[pRight->Tail & pRight->Mask].Timestamp;
+
+	return (llLeft < llRight) || ((llLeft == llRight) && (nLeft < nRight));
+}
+
+OBSRV_INLINE void ObsrvCpuMergeSift(
+	POBSRV_CPU_MERGE pMerge,
+	OBSRV_U32        nRoot
+	)
+{
+	OBSRV_U32* pHeap = pMerge->pHeap;
+	OBSRV_U32  nChild;
+	OBSRV_U32  nSwap;
+
+	while ((nChild = 2 * nRoot + 1) < pMerge->nHeap)
+	{
+		if ((nChild + 1 < pMerge->nHeap) &&
+		    ObsrvCpuMergeLess(pMerge, pHeap[nChild + 1], pHeap[nChild]))
+			nChild++;
+		if (!ObsrvCpuMergeLess(pMerge, pHeap[nChild], pHeap[nRoot]))
+			break;
+		nSwap         = pHeap[nRoot];
+		pHeap[nRoot]  = pHeap[nChild];
+		pHeap[nChild] = nSwap;
+		nRoot         = nChild;
+	} // while
+}
+
+//
+// Start draining nBuffers buffers. Only one consumer at a time may
+// merge them.
+//
+OBSRV_INLINE void ObsrvCpuMergeBegin(
+	POBSRV_CPU_MERGE  pMerge,
+	POBSRV_CPU_BUFFER pBuffers,
+	OBSRV_U32         nBuffers,
+	void*             pvScratch
+	)
+{
+	OBSRV_U32 i;
+
+	pMerge->pBuffers = pBuffers;
+	pMerge->nBuffers = nBuffers;
+	pMerge->nHeap    = 0;
+	pMerge->pEnd     = (OBSRV_U64*)pvScratch;
+	pMerge->pHeap    = (OBSRV_U32*)(pMerge->pEnd + nBuffers);
+	for (i = 0; i < nBuffers; i++)
+	{
+		pMerge->pEnd[i] = OBSRV_LOAD_ACQUIRE64(&pBuffers[i].Head);
+		if (pMerge->pEnd[i] != pBuffers[i].Tail)
+			pMerge->pHeap[pMerge->nHeap++] = i;
+	} // for
+	for (i = pMerge->nHeap / 2; i-- > 0; )
+		ObsrvCpuMergeSift(pMerge, i);
+}
+
+//
+// The oldest entry not merged yet, NULL if there is none. It stays valid
+// until ObsrvCpuMergePop() is called.
+//
+OBSRV_INLINE const OBSRV_THREAD_ENTRY* ObsrvCpuMergePeek(POBSRV_CPU_MERGE pMerge)
+{
+	POBSRV_CPU_BUFFER pBuffer;
+
+	if (0 == pMerge->nHeap)
+		return NULL;
+	pBuffer = &pMerge->pBuffers[pMerge->pHeap[0]];
+
+	return &pBuffer->Entries[pBuffer->Tail & pBuffer->Mask];
+}
+
+//
+// Give the entry ObsrvCpuMergePeek() has returned back to its CPU
+//
+OBSRV_INLINE void ObsrvCpuMergePop(POBSRV_CPU_MERGE pMerge)
+{
+	OBSRV_U32         nIndex  = pMerge->pHeap[0];
+	POBSRV_CPU_BUFFER pBuffer = &pMerge->pBuffers[nIndex];
+	OBSRV_U64         nTail   = pBuffer->Tail + 1;
+
+	OBSRV_STORE_RELEASE64(&pBuffer->Tail, nTail);
+	if (nTail == pMerge->pEnd[nIndex])
+		pMerge->pHeap[0] = pMerge->pHeap[--pMerge->nHeap];
+	ObsrvCpuMergeSift(pMerge, 0);
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVPERCPU_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,650 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvRecord.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Versioned tag-length-value event record format
+//
+// DESCRIPTION:
+//              Every event travels to the user-mode app as a record: a fixed
+//              header followed by any number of fields. A field is a 16-bit
+//              tag, a 16-bit length and the value, padded to 4 bytes. The
+//              whole record is padded to 8 bytes, thus records can be laid
+//              out back to back.
+//
+//              +--------+-------+------+-------+----------+-----------+
+//              | Size   |Version| Kind | Flags | Sequence | Timestamp |
+//              | 32     | 8     | 8    | 16    | 64       | 64        |
+//              +--------+-------+------+-------+----------+-----------+
+//              | Tag 16 | Length 16 | Value (Length bytes) | pad to 4  ...
+//              +--------+-----------+----------------------+-----------
+//
+//              Optional fields are simply left out. Decoders skip tags they
+//              don't know, so new fields don't break older apps; the
+//              version only changes if the meaning of existing fields does.
+//
+//              Neither the encoder nor the decoder allocates memory. The
+//              decoder validates every length against the bytes it has been
+//              given and never reads outside of them.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVRECORD_H_)
+#define _OBSRVRECORD_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvTypes.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+#define OBSRV_RECORD_VERSION           1
+//
+// Upper bound of a single record, including the header. Variable length
+// fields are truncated to stay below it.
+//
+#define OBSRV_RECORD_MAX_SIZE          8192
+#define OBSRV_RECORD_ALIGN(cb)         (((cb) + 7) & ~7)
+#define OBSRV_FIELD_ALIGN(cb)          (((cb) + 3) & ~3)
+
+//
+// Record kinds
+//
+#define OBSRV_KIND_PROCESS_CREATE      1
+#define OBSRV_KIND_PROCESS_EXIT        2
+#define OBSRV_KIND_IMAGE_LOAD          3  // Any number of OBSRV_TAG_IMAGE
+#define OBSRV_KIND_THREAD              4  // Any number of OBSRV_TAG_THREAD
+
+//
+// Record flags
+//
+#define OBSRV_RECORD_FLAG_TRUNCATED    0x0001 // A field didn't fit completely
+
+//
+// Field tags. Fixed size fields are little endian integers, strings are
+// UTF-16 without a terminating zero.
+//
+#define OBSRV_TAG_PAD                  0      // Padding, no value
+#define OBSRV_TAG_PROCESS_ID           1      // U32
+#define OBSRV_TAG_PARENT_ID            2      // U32
+#define OBSRV_TAG_CREATING_PROCESS_ID  3      // U32
+#define OBSRV_TAG_CREATING_THREAD_ID   4      // U32
+#define OBSRV_TAG_SESSION_ID           5      // U32
+#define OBSRV_TAG_EXIT_STATUS          6      // U32 (NTSTATUS)
+#define OBSRV_TAG_IMAGE_PATH           7      // UTF-16
+#define OBSRV_TAG_COMMAND_LINE         8      // UTF-16
+#define OBSRV_TAG_IMAGE                9      // OBSRV_IMAGE_ENTRY + UTF-16 path
+#define OBSRV_TAG_THREAD               10     // OBSRV_THREAD_ENTRY
+#define OBSRV_TAG_DROPPED              11     // U32, events lost before this record
+#define OBSRV_TAG_COUNT                12
+
+//
+// OBSRV_IMAGE_ENTRY flags
+//
+#define OBSRV_IMAGE_FLAG_SYSTEM        0x0001 // Mapped into kernel space
+
+//
+// OBSRV_THREAD_ENTRY flags
+//
+#define OBSRV_THREAD_FLAG_CREATE       0x0001 // Created, otherwise exited
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+typedef struct _ObsrvRecordHeader
+{
+	OBSRV_U32  Size;          // Bytes, including header and padding
+	OBSRV_U8   Version;       // OBSRV_RECORD_VERSION
+	OBSRV_U8   Kind;          // OBSRV_KIND_xxx
+	OBSRV_U16  Flags;         // OBSRV_RECORD_FLAG_xxx
+	OBSRV_U64  Sequence;      // 1-based, gaps mean lost records
+	OBSRV_I64  Timestamp;     // Performance counter ticks at the source
+} OBSRV_RECORD_HEADER, *POBSRV_RECORD_HEADER;
+
+typedef struct _ObsrvFieldHeader
+{
+	OBSRV_U16  Tag;           // OBSRV_TAG_xxx
+	OBSRV_U16  Length;        // Bytes of the value, without padding
+} OBSRV_FIELD_HEADER, *POBSRV_FIELD_HEADER;
+
+//
+// Fixed part of an OBSRV_TAG_IMAGE value. The image path follows up to
+// the end of the value.
+//
+typedef struct _ObsrvImageEntry
+{
+	OBSRV_U64  ImageBase;
+	OBSRV_U64  ImageSize;
+	OBSRV_U32  Flags;         // OBSRV_IMAGE_FLAG_xxx
+	OBSRV_U32  Reserved;
+} OBSRV_IMAGE_ENTRY, *POBSRV_IMAGE_ENTRY;
+
+//
+// Value of an OBSRV_TAG_THREAD field. Thread events carry their own
+// timestamp, the record's one is that of the oldest entry.
+//
+typedef struct _ObsrvThreadEntry
+{
+	OBSRV_I64  Timestamp;     // Performance counter ticks at the source
+	OBSRV_U32  ProcessId;
+	OBSRV_U32  ThreadId;
+	OBSRV_U32  Flags;         // OBSRV_THREAD_FLAG_xxx
+	OBSRV_U32  Reserved;
+} OBSRV_THREAD_ENTRY, *POBSRV_THREAD_ENTRY;
+
+//
+// Encoder state. The record is written straight into the caller's buffer.
+//
+typedef struct _ObsrvRecordWriter
+{
+	OBSRV_U8*  pbBase;
+	OBSRV_U32  cbCapacity;
+	OBSRV_U32  cbUsed;
+} OBSRV_RECORD_WRITER, *POBSRV_RECORD_WRITER;
+
+//
+// A decoded record. Strings point into the decoded buffer.
+//
+typedef struct _ObsrvRecordView
+{
+	OBSRV_U32         Size;
+	OBSRV_U8          Version;
+	OBSRV_U8          Kind;
+	OBSRV_U16         Flags;
+	OBSRV_U64         Sequence;
+	OBSRV_I64         Timestamp;
+	OBSRV_U32         Present;          // Bit (1 << tag) for every field seen
+	OBSRV_U32         ProcessId;
+	OBSRV_U32         ParentId;
+	OBSRV_U32         CreatingProcessId;
+	OBSRV_U32         CreatingThreadId;
+	OBSRV_U32         SessionId;
+	OBSRV_U32         ExitStatus;
+	const OBSRV_U16*  ImagePath;
+	OBSRV_U32         ImagePathLength;   // Characters
+	const OBSRV_U16*  CommandLine;
+	OBSRV_U32         CommandLineLength; // Characters
+	OBSRV_U32         ImageCount;        // See ObsrvRecordNextImage()
+	OBSRV_U32         ThreadCount;       // See ObsrvRecordNextThread()
+	OBSRV_U32         Dropped;
+} OBSRV_RECORD_VIEW, *POBSRV_RECORD_VIEW;
+
+//
+// A decoded OBSRV_TAG_IMAGE field
+//
+typedef struct _ObsrvImageView
+{
+	OBSRV_U64         ImageBase;
+	OBSRV_U64         ImageSize;
+	OBSRV_U32         Flags;
+	const OBSRV_U16*  ImagePath;
+	OBSRV_U32         ImagePathLength;   // Characters
+} OBSRV_IMAGE_VIEW, *POBSRV_IMAGE_VIEW;
+
+//---------------------------------------------------------------------------
+//
+// Encoder
+//
+//---------------------------------------------------------------------------
+
+//
+// Bytes a field with a cbValue bytes long value takes
+//
+OBSRV_INLINE OBSRV_U32 ObsrvRecordFieldSize(OBSRV_U32 cbValue)
+{
+	return (OBSRV_U32)sizeof(OBSRV_FIELD_HEADER) + OBSRV_FIELD_ALIGN(cbValue);
+}
+
+//
+// Start a record. Returns 0 if the buffer cannot even hold the header.
+//
+OBSRV_INLINE int ObsrvRecordBegin(
+	POBSRV_RECORD_WRITER pWriter,
+	void*                pvBuffer,
+	OBSRV_U32            cbBuffer,
+	OBSRV_U8             nKind,
+	OBSRV_U64            nSequence,
+	OBSRV_I64            nTimestamp
+	)
+{
+	POBSRV_RECORD_HEADER pHeader = (POBSRV_RECORD_HEADER)pvBuffer;
+
+	pWriter->pbBase     = (OBSRV_U8*)pvBuffer;
+	pWriter->cbCapacity = (cbBuffer > OBSRV_RECORD_MAX_SIZE) ?
+		OBSRV_RECORD_MAX_SIZE : (cbBuffer & ~7u);
+	pWriter->cbUsed     = 0;
+	if (pWriter->cbCapacity < sizeof(OBSRV_RECORD_HEADER))
+		return 0;
+
+	pHeader->Size      = 0;
+	pHeader->Version   = OBSRV_RECORD_VERSION;
+	pHeader->Kind      = nKind;
+	pHeader->Flags     = 0;
+	pHeader->Sequence  = nSequence;
+	pHeader->Timestamp = nTimestamp;
+	pWriter->cbUsed    = sizeof(OBSRV_RECORD_HEADER);
+
+	return 1;
+}
+
+//
+// Append a field. Returns 0, leaving the record as it was, if it doesn't
+// fit.
+//
+OBSRV_INLINE int ObsrvRecordPut(
+	POBSRV_RECORD_WRITER pWriter,
+	OBSRV_U16            nTag,
+	const void*          pvValue,
+	OBSRV_U32            cbValue
+	)
+{
+	OBSRV_FIELD_HEADER field;
+	OBSRV_U32          cbField = ObsrvRecordFieldSize(cbValue);
+	OBSRV_U8*          pbField = pWriter->pbBase + pWriter->cbUsed;
+
+	if ((cbValue > 0xFFFF) || (cbField > pWriter->cbCapacity - pWriter->cbUsed))
+		return 0;
+
+	field.Tag    = nTag;
+	field.Length = (OBSRV_U16)cbValue;
+	OBSRV_COPY(pbField, &field, sizeof(field));
+	OBSRV_COPY(pbField + sizeof(field), pvValue, cbValue);
+	while (cbValue < cbField - sizeof(field))
+		pbField[sizeof(field) + cbValue++] = 0;
+	pWriter->cbUsed += cbField;
+
+	return 1;
+}
+
+OBSRV_INLINE int ObsrvRecordPutU32(
+	POBSRV_RECORD_WRITER pWriter,
+	OBSRV_U16            nTag,
+	OBSRV_U32            nValue
+	)
+{
+	return ObsrvRecordPut(pWriter, nTag, &nValue, sizeof(nValue));
+}
+
+//
+// Append a UTF-16 string of cchText characters. It is truncated if it
+// doesn't fit completely, which is flagged in the header. Returns the
+// number of characters stored.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvRecordPutString(
+	POBSRV_RECORD_WRITER pWriter,
+	OBSRV_U16            nTag,
+	const OBSRV_U16*     pszText,
+	OBSRV_U32            cchText
+	)
+{
+	OBSRV_U32 cbRoom = pWriter->cbCapacity - pWriter->cbUsed;
+	OBSRV_U32 cchMax;
+
+	if (cbRoom <= sizeof(OBSRV_FIELD_HEADER))
+		cchMax = 0;
+	else
+		cchMax = ((cbRoom - sizeof(OBSRV_FIELD_HEADER)) & ~3u) / sizeof(OBSRV_U16);
+	if (cchMax > 0xFFFF / sizeof(OBSRV_U16))
+		cchMax = 0xFFFF / sizeof(OBSRV_U16);
+	if (cchText > cchMax)
+	{
+		((POBSRV_RECORD_HEADER)pWriter->pbBase)->Flags |= OBSRV_RECORD_FLAG_TRUNCATED;
+		cchText = cchMax;
+		if (0 == cchText)
+			return 0;
+	}
+	ObsrvRecordPut(pWriter, nTag, pszText, cchText * sizeof(OBSRV_U16));
+
+	return cchText;
+}
+
+//
+// Append an image entry. With bTruncate set the path is cut to what 
+// fits, which is flagged in the header; otherwise the entry is only 
+// stored if it fits completely. Returns 0, leaving the record as it was,
+// if it hasn't been stored.
+//
+OBSRV_INLINE int ObsrvRecordPutImage(
+	POBSRV_RECORD_WRITER pWriter,
+	OBSRV_U64            nImageBase,
+	OBSRV_U64            nImageSize,
+	OBSRV_U32            nFlags,
+	const OBSRV_U16*     pszPath,
+	OBSRV_U32            cchPath,
+	int                  bTruncate
+	)
+{
+	OBSRV_FIELD_HEADER field;
+	OBSRV_IMAGE_ENTRY  entry;
+	OBSRV_U32          cbRoom = pWriter->cbCapacity - pWriter->cbUsed;
+	OBSRV_U32          cbFixed = sizeof(OBSRV_FIELD_HEADER) + sizeof(OBSRV_IMAGE_ENTRY);
+	OBSRV_U32          cchMax;
+	OBSRV_U32          cbValue;
+	OBSRV_U32          cbField;
+	OBSRV_U8*          pbField = pWriter->pbBase + pWriter->cbUsed;
+
+	if (cbRoom < cbFixed)
+		return 0;
+	cchMax = ((cbRoom - cbFixed) & ~3u) / sizeof(OBSRV_U16);
+	if (cchMax > (0xFFFF - sizeof(OBSRV_IMAGE_ENTRY)) / sizeof(OBSRV_U16))
+		cchMax = (0xFFFF - sizeof(OBSRV_IMAGE_ENTRY)) / sizeof(OBSRV_U16);
+	if (cchPath > cchMax)
+	{
+		if (!bTruncate)
+			return 0;
+		((POBSRV_RECORD_HEADER)pWriter->pbBase)->Flags |= OBSRV_RECORD_FLAG_TRUNCATED;
+		cchPath = cchMax;
+	}
+
+	cbValue = sizeof(OBSRV_IMAGE_ENTRY) + cchPath * sizeof(OBSRV_U16);
+	cbField = ObsrvRecordFieldSize(cbValue);
+	field.Tag       = OBSRV_TAG_IMAGE;
+	field.Length    = (OBSRV_U16)cbValue;
+	entry.ImageBase = nImageBase;
+	entry.ImageSize = nImageSize;
+	entry.Flags     = nFlags;
+	entry.Reserved  = 0;
+	OBSRV_COPY(pbField, &field, sizeof(field));
+	OBSRV_COPY(pbField + sizeof(field), &entry, sizeof(entry));
+	if (0 != cchPath)
+		OBSRV_COPY(pbField + sizeof(field) + sizeof(entry), pszPath, cchPath * sizeof(OBSRV_U16));
+	while (cbValue < cbField - sizeof(field))
+		pbField[sizeof(field) + cbValue++] = 0;
+	pWriter->cbUsed += cbField;
+
+	return 1;
+}
+
+//
+// Copy all fields of another, already completed record (e.g. the
+// variable length fields the producer has encoded up front). Returns 0,
+// leaving the record as it was, if they don't fit.
+//
+OBSRV_INLINE int ObsrvRecordPutFields(
+	POBSRV_RECORD_WRITER pWriter,
+	const void*          pvRecord
+	)
+{
+	const OBSRV_RECORD_HEADER* pSource = (const OBSRV_RECORD_HEADER*)pvRecord;
+	OBSRV_U32                  cbFields;
+
+	if (pSource->Size < sizeof(OBSRV_RECORD_HEADER))
+		return 0;
+	cbFields = pSource->Size - sizeof(OBSRV_RECORD_HEADER);
+	if (cbFields > pWriter->cbCapacity - pWriter->cbUsed)
+		return 0;
+
+	OBSRV_COPY(pWriter->pbBase + pWriter->cbUsed, pSource + 1, cbFields);
+	pWriter->cbUsed += cbFields;
+	((POBSRV_RECORD_HEADER)pWriter->pbBase)->Flags |= pSource->Flags;
+
+	return 1;
+}
+
+//
+// Pad and close the record. Returns its size, 0 if the padding doesn't
+// fit.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvRecordEnd(POBSRV_RECORD_WRITER pWriter)
+{
+	OBSRV_U32 cbSize = OBSRV_RECORD_ALIGN(pWriter->cbUsed);
+
+	if (cbSize > pWriter->cbCapacity)
+		return 0;
+	while (pWriter->cbUsed < cbSize)
+		pWriter->pbBase[pWriter->cbUsed++] = 0;
+	((POBSRV_RECORD_HEADER)pWriter->pbBase)->Size = cbSize;
+
+	return cbSize;
+}
+
+//---------------------------------------------------------------------------
+//
+// Decoder
+//
+//---------------------------------------------------------------------------
+
+//
+// Decode the record at the start of cbBuffer bytes. Returns the record's
+// size, i.e. the offset of the next record, or 0 if it is malformed.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvRecordDecode(
+	const void*        pvBuffer,
+	size_t             cbBuffer,
+	POBSRV_RECORD_VIEW pView
+	)
+{
+	const OBSRV_U8*     pbRecord = (const OBSRV_U8*)pvBuffer;
+	OBSRV_RECORD_HEADER header;
+	OBSRV_FIELD_HEADER  field;
+	OBSRV_U32           nOffset;
+	OBSRV_U32           nValue;
+	const OBSRV_U8*     pbValue;
+
+	if ((NULL == pvBuffer) || (cbBuffer < sizeof(OBSRV_RECORD_HEADER)))
+		return 0;
+	OBSRV_COPY(&header, pbRecord, sizeof(header));
+	if ((header.Size < sizeof(OBSRV_RECORD_HEADER)) ||
+	    (header.Size > cbBuffer) ||
+	    (header.Size > OBSRV_RECORD_MAX_SIZE) ||
+	    (0 != (header.Size & 7)) ||
+	    (OBSRV_RECORD_VERSION != header.Version))
+		return 0;
+
+	pView->Size              = header.Size;
+	pView->Version           = header.Version;
+	pView->Kind              = header.Kind;
+	pView->Flags             = header.Flags;
+	pView->Sequence          = header.Sequence;
+	pView->Timestamp         = header.Timestamp;
+	pView->Present           = 0;
+	pView->ProcessId         = 0;
+	pView->ParentId          = 0;
+	pView->CreatingProcessId = 0;
+	pView->CreatingThreadId  = 0;
+	pView->SessionId         = 0;
+	pView->ExitStatus        = 0;
+	pView->ImagePath         = NULL;
+	pView->ImagePathLength   = 0;
+	pView->CommandLine       = NULL;
+	pView->CommandLineLength = 0;
+	pView->ImageCount        = 0;
+	pView->ThreadCount       = 0;
+	pView->Dropped           = 0;
+
+	nOffset = sizeof(OBSRV_RECORD_HEADER);
+	while (header.Size - nOffset >= sizeof(OBSRV_FIELD_HEADER))
+	{
+		OBSRV_COPY(&field, pbRecord + nOffset, sizeof(field));
+		nOffset += sizeof(field);
+		nValue   = 0;
+		if (field.Length > header.Size - nOffset)
+			return 0;
+		pbValue = pbRecord + nOffset;
+		nOffset += OBSRV_FIELD_ALIGN(field.Length);
+		if (nOffset > header.Size)
+			return 0;
+		//
+		// Fixed size fields must have exactly their size
+		//
+		if (((field.Tag >= OBSRV_TAG_PROCESS_ID) && (field.Tag <= OBSRV_TAG_EXIT_STATUS)) ||
+		    (OBSRV_TAG_DROPPED == field.Tag))
+		{
+			if (sizeof(OBSRV_U32) != field.Length)
+				return 0;
+			OBSRV_COPY(&nValue, pbValue, sizeof(nValue));
+		}
+		else if ((OBSRV_TAG_IMAGE_PATH == field.Tag) || (OBSRV_TAG_COMMAND_LINE == field.Tag))
+		{
+			if (0 != (field.Length & 1))
+				return 0;
+		}
+		else if (OBSRV_TAG_IMAGE == field.Tag)
+		{
+			if ((field.Length < sizeof(OBSRV_IMAGE_ENTRY)) || (0 != (field.Length & 1)))
+				return 0;
+		}
+		else if (OBSRV_TAG_THREAD == field.Tag)
+		{
+			if (field.Length < sizeof(OBSRV_THREAD_ENTRY))
+				return 0;
+		}
+		switch (field.Tag)
+		{
+			case OBSRV_TAG_PAD:                 break;
+			case OBSRV_TAG_PROCESS_ID:          pView->ProcessId         = nValue; break;
+			case OBSRV_TAG_PARENT_ID:           pView->ParentId          = nValue; break;
+			case OBSRV_TAG_CREATING_PROCESS_ID: pView->CreatingProcessId = nValue; break;
+			case OBSRV_TAG_CREATING_THREAD_ID:  pView->CreatingThreadId  = nValue; break;
+			case OBSRV_TAG_SESSION_ID:          pView->SessionId         = nValue; break;
+			case OBSRV_TAG_EXIT_STATUS:         pView->ExitStatus        = nValue; break;
+			case OBSRV_TAG_IMAGE_PATH:
+				pView->ImagePath       = (const OBSRV_U16*)pbValue;
+				pView->ImagePathLength = field.Length / sizeof(OBSRV_U16);
+				break;
+			case OBSRV_TAG_COMMAND_LINE:
+				pView->CommandLine       = (const OBSRV_U16*)pbValue;
+				pView->CommandLineLength = field.Length / sizeof(OBSRV_U16);
+				break;
+			case OBSRV_TAG_IMAGE:
+				pView->ImageCount++;
+				break;
+			case OBSRV_TAG_THREAD:
+				pView->ThreadCount++;
+				break;
+			case OBSRV_TAG_DROPPED:             pView->Dropped           = nValue; break;
+			default:
+				//
+				// A field added by a newer producer
+				//
+				break;
+		}
+		if (field.Tag < 32)
+			pView->Present |= (1u << field.Tag);
+	} // while
+
+	return header.Size;
+}
+
+//
+// Tell whether a record kind is a process create or exit
+//
+OBSRV_INLINE int ObsrvIsProcessKind(OBSRV_U8 nKind)
+{
+	return (OBSRV_KIND_PROCESS_CREATE == nKind) || (OBSRV_KIND_PROCESS_EXIT == nKind);
+}
+
+//
+// Tell whether a decoded record carries a given field
+//
+OBSRV_INLINE int ObsrvRecordHas(
+	const OBSRV_RECORD_VIEW* pView,
+	OBSRV_U16                nTag
+	)
+{
+	return (nTag < 32) && (0 != (pView->Present & (1u << nTag)));
+}
+
+//
+// Walk the image entries of a record ObsrvRecordDecode() has accepted.
+// *pnOffset must be 0 for the first call. Returns 0 once there are no
+// more entries.
+//
+OBSRV_INLINE int ObsrvRecordNextImage(
+	const void*       pvRecord,
+	OBSRV_U32*        pnOffset,
+	POBSRV_IMAGE_VIEW pImage
+	)
+{
+	const OBSRV_U8*     pbRecord = (const OBSRV_U8*)pvRecord;
+	OBSRV_RECORD_HEADER header;
+	OBSRV_FIELD_HEADER  field;
+	OBSRV_IMAGE_ENTRY   entry;
+	OBSRV_U32           nOffset;
+
+	OBSRV_COPY(&header, pbRecord, sizeof(header));
+	nOffset = (0 == *pnOffset) ? (OBSRV_U32)sizeof(OBSRV_RECORD_HEADER) : *pnOffset;
+	while ((nOffset <= header.Size) && (header.Size - nOffset >= sizeof(OBSRV_FIELD_HEADER)))
+	{
+		OBSRV_COPY(&field, pbRecord + nOffset, sizeof(field));
+		nOffset += sizeof(field);
+		if (field.Length > header.Size - nOffset)
+			break;
+		if ((OBSRV_TAG_IMAGE == field.Tag) && (field.Length >= sizeof(OBSRV_IMAGE_ENTRY)))
+		{
+			OBSRV_COPY(&entry, pbRecord + nOffset, sizeof(entry));
+			pImage->ImageBase       = entry.ImageBase;
+			pImage->ImageSize       = entry.ImageSize;
+			pImage->Flags           = entry.Flags;
+			pImage->ImagePath       = (const OBSRV_U16*)(pbRecord + nOffset + sizeof(entry));
+			pImage->ImagePathLength = (field.Length - sizeof(entry)) / sizeof(OBSRV_U16);
+			*pnOffset = nOffset + OBSRV_FIELD_ALIGN(field.Length);
+			return 1;
+		}
+		nOffset += OBSRV_FIELD_ALIGN(field.Length);
+	} // while
+	*pnOffset = header.Size;
+
+	return 0;
+}
+
+//
+// Walk the thread entries of a record ObsrvRecordDecode() has accepted,
+// the same way as ObsrvRecordNextImage() does
+//
+OBSRV_INLINE int ObsrvRecordNextThread(
+	const void*         pvRecord,
+	OBSRV_U32*          pnOffset,
+	POBSRV_THREAD_ENTRY pThread
+	)
+{
+	const OBSRV_U8*     pbRecord = (const OBSRV_U8*)pvRecord;
+	OBSRV_RECORD_HEADER header;
+	OBSRV_FIELD_HEADER  field;
+	OBSRV_U32           nOffset;
+
+	OBSRV_COPY(&header, pbRecord, sizeof(header));
+	nOffset = (0 == *pnOffset) ? (OBSRV_U32)sizeof(OBSRV_RECORD_HEADER) : *pnOffset;
+	while ((nOffset <= header.Size) && (header.Size - nOffset >= sizeof(OBSRV_FIELD_HEADER)))
+	{
+		OBSRV_COPY(&field, pbRecord + nOffset, sizeof(field));
+		nOffset += sizeof(field);
+		if (field.Length > header.Size - nOffset)
+			break;
+		if ((OBSRV_TAG_THREAD == field.Tag) && (field.Length >= sizeof(OBSRV_THREAD_ENTRY)))
+		{
+			OBSRV_COPY(pThread, pbRecord + nOffset, sizeof(OBSRV_THREAD_ENTRY));
+			*pnOffset = nOffset + OBSRV_FIELD_ALIGN(field.Length);
+			return 1;
+		}
+		nOffset += OBSRV_FIELD_ALIGN(field.Length);
+	} // while
+	*pnOffset = header.Size;
+
+	return 0;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVRECORD_H_)
+//----------------------------End of the file -------------------------------
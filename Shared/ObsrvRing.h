@@ -0,0 +1,312 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvRing.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Bounded multi-producer / single-consumer ring of process
+//              records
+//
+// DESCRIPTION:
+//              Replaces the single hParentId/hProcessId/bCreate slot of the
+//              driver's device extension. Any number of notify routines may
+//              push concurrently without taking a lock; a single consumer
+//              (serialized by the caller) pops records in order.
+//
+//              Every cell carries a turn counter (D. Vyukov's bounded queue).
+//              A producer owns a cell once it moved the head past it, and
+//              publishes the record by bumping the cell's turn with release
+//              semantics. The consumer releases the cell by advancing the
+//              turn by one lap.
+//
+//              When the ring is full the record is dropped and the Overflow
+//              counter is incremented. The consumer stamps each popped record
+//              with a 64-bit sequence number and skips one number for every
+//              dropped record, thus losses show up as gaps downstream.
+//
+//              The header depends on ObsrvTypes.h only and can be compiled
+//              in kernel mode as well as on Linux.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVRING_H_)
+#define _OBSRVRING_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvTypes.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+
+//
+// Capacity bounds (number of records). The capacity is always rounded up
+// to a power of two.
+//
+#define OBSRV_RING_MIN_CAPACITY        16
+#define OBSRV_RING_DEFAULT_CAPACITY    1024
+#define OBSRV_RING_MAX_CAPACITY        (1024 * 1024)
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A single event (a process create or exit, a batch of image loads of
+// one process or a batch of thread events) as it travels through the
+// ring. It never leaves the producer's address space as is - the
+// consumer encodes it into the wire format of ObsrvRecord.h.
+//
+typedef struct _ObsrvProcessRecord
+{
+	OBSRV_U64  Sequence;          // Assigned by the consumer, 1-based
+	OBSRV_I64  Timestamp;         // Performance counter ticks at the source
+	OBSRV_U32  hParentId;
+	OBSRV_U32  hProcessId;
+	OBSRV_U32  CreatingProcessId; // Create only
+	OBSRV_U32  CreatingThreadId;  // Create only
+	OBSRV_U32  SessionId;
+	OBSRV_U32  ExitStatus;        // Exit only
+	OBSRV_U8   bCreate;
+	OBSRV_U8   Kind;              // OBSRV_KIND_xxx of ObsrvRecord.h
+	OBSRV_U8   Reserved[6];
+	//
+	// Optional encoded record (ObsrvRecord.h) holding the variable length
+	// fields, owned by whoever holds the process record. NULL if none.
+	//
+	void*      Extra;
+} OBSRV_PROCESS_RECORD, *POBSRV_PROCESS_RECORD;
+
+//
+// Ring storage element
+//
+typedef struct _ObsrvRingCell
+{
+	volatile OBSRV_U64    Turn;
+	OBSRV_PROCESS_RECORD  Record;
+} OBSRV_RING_CELL, *POBSRV_RING_CELL;
+
+//
+// Ring control block. Producer and consumer indices live on separate
+// cache lines.
+//
+typedef struct _ObsrvRing
+{
+	POBSRV_RING_CELL    Cells;
+	OBSRV_U64           Mask;
+	OBSRV_U32           Capacity;
+	OBSRV_U8            Pad0[OBSRV_CACHE_LINE - sizeof(void*) - 12];
+	//
+	// Producers' side
+	//
+	volatile OBSRV_U64  Head;
+	volatile OBSRV_U64  Overflow;
+	OBSRV_U8            Pad1[OBSRV_CACHE_LINE - 16];
+	//
+	// Consumer's side
+	//
+	volatile OBSRV_U64  Tail;
+	OBSRV_U64           OverflowSeen;
+	OBSRV_U64           NextSequence;
+} OBSRV_RING, *POBSRV_RING;
+
+//---------------------------------------------------------------------------
+//
+// Functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Round the requested number of records to a supported power of two
+//
+OBSRV_INLINE OBSRV_U32 ObsrvRingRoundCapacity(OBSRV_U32 nRequested)
+{
+	OBSRV_U32 nCapacity = OBSRV_RING_MIN_CAPACITY;
+
+	if (nRequested > OBSRV_RING_MAX_CAPACITY)
+		nRequested = OBSRV_RING_MAX_CAPACITY;
+	while (nCapacity < nRequested)
+		nCapacity <<= 1;
+
+	return nCapacity;
+}
+
+//
+// Number of bytes the caller has to provide for the cells
+//
+OBSRV_INLINE size_t ObsrvRingStorageSize(OBSRV_U32 nCapacity)
+{
+	return (size_t)nCapacity * sizeof(OBSRV_RING_CELL);
+}
+
+//
+// Setup the ring on top of caller supplied storage. nCapacity must have
+// been produced by ObsrvRingRoundCapacity().
+//
+OBSRV_INLINE void ObsrvRingInit(
+	POBSRV_RING      pRing,
+	POBSRV_RING_CELL pCells,
+	OBSRV_U32        nCapacity
+	)
+{
+	OBSRV_U32 i;
+
+	pRing->Cells        = pCells;
+	pRing->Capacity     = nCapacity;
+	pRing->Mask         = nCapacity - 1;
+	pRing->Head         = 0;
+	pRing->Overflow     = 0;
+	pRing->Tail         = 0;
+	pRing->OverflowSeen = 0;
+	pRing->NextSequence = 1;
+	for (i = 0; i < nCapacity; i++)
+		pCells[i].Turn = i;
+}
+
+//
+// Append a record. Safe to call from any number of threads at once.
+// Returns 0 and counts an overflow if the ring is full.
+//
+OBSRV_INLINE int ObsrvRingPush(
+	POBSRV_RING                 pRing,
+	const OBSRV_PROCESS_RECORD* pRecord
+	)
+{
+	POBSRV_RING_CELL pCell;
+	OBSRV_U64        nPos = OBSRV_LOAD_RELAXED64(&pRing->Head);
+	OBSRV_U64        nTurn;
+	OBSRV_U64        nSeen;
+	OBSRV_I64        nDiff;
+
+	for (;;)
+	{
+		pCell = &pRing->Cells[nPos & pRing->Mask];
+		nTurn = OBSRV_LOAD_ACQUIRE64(&pCell->Turn);
+		nDiff = (OBSRV_I64)(nTurn - nPos);
+		if (0 == nDiff)
+		{
+			//
+			// The cell is free for this lap, try to claim it
+			//
+			nSeen = OBSRV_CAS64(&pRing->Head, nPos, nPos + 1);
+			if (nSeen == nPos)
+				break;
+			nPos = nSeen;
+		}
+		else if (nDiff < 0)
+		{
+			//
+			// The consumer hasn't released the cell yet - we are full
+			//
+			OBSRV_INC64(&pRing->Overflow);
+			return 0;
+		}
+		else
+			//
+			// Another producer took this cell, reload the head
+			//
+			nPos = OBSRV_LOAD_RELAXED64(&pRing->Head);
+	} // for
+
+	pCell->Record = *pRecord;
+	OBSRV_STORE_RELEASE64(&pCell->Turn, nPos + 1);
+	return 1;
+}
+
+//
+// Count a record a producer had to drop before pushing it (e.g. for lack
+// of memory), thus it shows up as a gap like any overflow
+//
+OBSRV_INLINE void ObsrvRingDrop(POBSRV_RING pRing)
+{
+	OBSRV_INC64(&pRing->Overflow);
+}
+
+//
+// Remove the oldest record. Only one consumer at a time may call it.
+// Returns 0 if there is nothing published yet.
+//
+OBSRV_INLINE int ObsrvRingPop(
+	POBSRV_RING           pRing,
+	POBSRV_PROCESS_RECORD pRecord
+	)
+{
+	OBSRV_U64        nPos  = pRing->Tail;
+	POBSRV_RING_CELL pCell = &pRing->Cells[nPos & pRing->Mask];
+	OBSRV_U64        nOverflow;
+
+	if (OBSRV_LOAD_ACQUIRE64(&pCell->Turn) != nPos + 1)
+		return 0;
+
+	*pRecord = pCell->Record;
+	OBSRV_STORE_RELEASE64(&pCell->Turn, nPos + pRing->Capacity);
+	OBSRV_STORE_RELEASE64(&pRing->Tail, nPos + 1);
+	//
+	// Skip a sequence number for every record dropped since the last pop
+	//
+	nOverflow = OBSRV_LOAD_ACQUIRE64(&pRing->Overflow);
+	pRing->NextSequence += nOverflow - pRing->OverflowSeen;
+	pRing->OverflowSeen  = nOverflow;
+	pRecord->Sequence    = pRing->NextSequence++;
+
+	return 1;
+}
+
+//
+// The oldest record without removing it, NULL if there is nothing
+// published yet. Only the consumer may call it; the record stays valid
+// until it pops it.
+//
+OBSRV_INLINE const OBSRV_PROCESS_RECORD* ObsrvRingPeek(POBSRV_RING pRing)
+{
+	OBSRV_U64        nPos  = pRing->Tail;
+	POBSRV_RING_CELL pCell = &pRing->Cells[nPos & pRing->Mask];
+
+	if (OBSRV_LOAD_ACQUIRE64(&pCell->Turn) != nPos + 1)
+		return NULL;
+
+	return &pCell->Record;
+}
+
+//
+// Approximate number of records waiting for the consumer
+//
+OBSRV_INLINE OBSRV_U64 ObsrvRingCount(POBSRV_RING pRing)
+{
+	OBSRV_U64 nTail = OBSRV_LOAD_ACQUIRE64(&pRing->Tail);
+	OBSRV_U64 nHead = OBSRV_LOAD_ACQUIRE64(&pRing->Head);
+
+	return (nHead > nTail) ? (nHead - nTail) : 0;
+}
+
+//
+// Total number of records dropped because the ring was full
+//
+OBSRV_INLINE OBSRV_U64 ObsrvRingOverflow(POBSRV_RING pRing)
+{
+	return OBSRV_LOAD_ACQUIRE64(&pRing->Overflow);
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVRING_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,479 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvSection.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Memory section shared by the driver and the user-mode app,
+//              holding a byte ring of encoded records
+//
+// DESCRIPTION:
+//              The driver maps the section into the consumer's address
+//              space once. From then on records travel without any IOCTL:
+//              the driver encodes them (ObsrvRecord.h) right into the ring
+//              and publishes them by moving Head with release semantics;
+//              the app reads them in place and gives the space back by
+//              moving Tail the same way. Both indices count bytes and
+//              only ever grow; their difference is the amount in use.
+//
+//              A record never wraps around the end of the data area. If it
+//              doesn't fit in front of the end, the producer leaves a wrap
+//              marker (a record size of OBSRV_SECTION_WRAP) and continues at
+//              offset 0.
+//
+//              Wake-ups: the consumer announces that it is about to sleep
+//              by setting ConsumerWaiting and then looks at Head once more;
+//              the producer publishes Head (or ProducerStalled, when it has
+//              left records behind) and then clears ConsumerWaiting.
+//              Both steps are full barriers, thus either the consumer sees
+//              the new record or the producer sees the flag and signals the
+//              event. A busy consumer costs the producer no signal at all.
+//
+//              The section is writable by the consumer, thus the producer
+//              treats Tail as untrusted and never lets it corrupt its own
+//              state. The consumer validates every record as well.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVSECTION_H_)
+#define _OBSRVSECTION_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "ObsrvBatch.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Defines
+//
+//---------------------------------------------------------------------------
+#define OBSRV_SECTION_MAGIC            0x6353624F  // 'ObSc'
+#define OBSRV_SECTION_VERSION          1
+//
+// Size bounds of the data area (bytes, always a power of two). The
+// minimum guarantees that a record of any size fits into an empty ring.
+//
+#define OBSRV_SECTION_MIN_SIZE         (64 * 1024)
+#define OBSRV_SECTION_DEFAULT_SIZE     (1024 * 1024)
+#define OBSRV_SECTION_MAX_SIZE         (64 * 1024 * 1024)
+//
+// Record size telling the consumer to continue at offset 0
+//
+#define OBSRV_SECTION_WRAP             0xFFFFFFFF
+
+//
+// ObsrvSectionPrepareWait() results
+//
+#define OBSRV_SECTION_WAIT             0  // Empty, sleep on the event
+#define OBSRV_SECTION_READY            1  // Records arrived meanwhile
+#define OBSRV_SECTION_REFILL           2  // Empty, but the driver has more
+
+//---------------------------------------------------------------------------
+//
+// Typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Control block at the start of the section. The data area follows it.
+//
+typedef struct _ObsrvSectionHeader
+{
+	OBSRV_U32           Magic;
+	OBSRV_U32           Version;
+	OBSRV_U32           HeaderSize;       // Offset of the data area
+	OBSRV_U32           DataSize;         // Power of two
+	OBSRV_U8            Pad0[OBSRV_CACHE_LINE - 16];
+	//
+	// Written by the producer
+	//
+	volatile OBSRV_U64  Head;
+	volatile OBSRV_U64  Overflow;         // Records dropped by the driver
+	volatile OBSRV_U64  ProducerStalled;  // Records left behind, no room
+	OBSRV_U8            Pad1[OBSRV_CACHE_LINE - 24];
+	//
+	// Written by the consumer
+	//
+	volatile OBSRV_U64  Tail;
+	volatile OBSRV_U64  ConsumerWaiting;
+	OBSRV_U8            Pad2[OBSRV_CACHE_LINE - 16];
+} OBSRV_SECTION_HEADER, *POBSRV_SECTION_HEADER;
+
+//
+// Producer's private state. Head is authoritative, the shared copy is
+// only published.
+//
+typedef struct _ObsrvSectionWriter
+{
+	POBSRV_SECTION_HEADER pShared;
+	OBSRV_U8*             pbData;
+	OBSRV_U64             Head;
+	OBSRV_U32             DataSize;
+} OBSRV_SECTION_WRITER, *POBSRV_SECTION_WRITER;
+
+//
+// Consumer's private state. Tail runs ahead of the shared copy until the
+// records read have been released.
+//
+typedef struct _ObsrvSectionReader
+{
+	POBSRV_SECTION_HEADER pShared;
+	const OBSRV_U8*       pbData;
+	OBSRV_U64             Tail;
+	OBSRV_U32             DataSize;
+} OBSRV_SECTION_READER, *POBSRV_SECTION_READER;
+
+//---------------------------------------------------------------------------
+//
+// Functions
+//
+//---------------------------------------------------------------------------
+
+//
+// Round the requested data area size to a supported power of two
+//
+OBSRV_INLINE OBSRV_U32 ObsrvSectionRoundSize(OBSRV_U32 cbRequested)
+{
+	OBSRV_U32 cbData = OBSRV_SECTION_MIN_SIZE;
+
+	if (cbRequested > OBSRV_SECTION_MAX_SIZE)
+		cbRequested = OBSRV_SECTION_MAX_SIZE;
+	while (cbData < cbRequested)
+		cbData <<= 1;
+
+	return cbData;
+}
+
+//
+// Bytes of the whole section for a given data area size
+//
+OBSRV_INLINE size_t ObsrvSectionTotalSize(OBSRV_U32 cbData)
+{
+	return sizeof(OBSRV_SECTION_HEADER) + (size_t)cbData;
+}
+
+//---------------------------------------------------------------------------
+//
+// Producer
+//
+//---------------------------------------------------------------------------
+
+//
+// Format a zeroed section of ObsrvSectionTotalSize(cbData) bytes. cbData
+// must have been produced by ObsrvSectionRoundSize().
+//
+OBSRV_INLINE void ObsrvSectionCreate(
+	POBSRV_SECTION_WRITER pWriter,
+	void*                 pvSection,
+	OBSRV_U32             cbData
+	)
+{
+	POBSRV_SECTION_HEADER pShared = (POBSRV_SECTION_HEADER)pvSection;
+
+	pShared->Magic           = OBSRV_SECTION_MAGIC;
+	pShared->Version         = OBSRV_SECTION_VERSION;
+	pShared->HeaderSize      = sizeof(OBSRV_SECTION_HEADER);
+	pShared->DataSize        = cbData;
+	pShared->Head            = 0;
+	pShared->Overflow        = 0;
+	pShared->ProducerStalled = 0;
+	pShared->Tail            = 0;
+	pShared->ConsumerWaiting = 0;
+
+	pWriter->pShared  = pShared;
+	pWriter->pbData   = (OBSRV_U8*)(pShared + 1);
+	pWriter->Head     = 0;
+	pWriter->DataSize = cbData;
+}
+
+//
+// Contiguous free space at Head. *pcbFree receives the free space in
+// total, which may be larger if the ring wraps.
+//
+OBSRV_INLINE OBSRV_U8* ObsrvSectionWriteSpace(
+	POBSRV_SECTION_WRITER pWriter,
+	OBSRV_U32*            pcbSpace,
+	OBSRV_U32*            pcbFree
+	)
+{
+	OBSRV_U64 nTail = OBSRV_LOAD_ACQUIRE64(&pWriter->pShared->Tail);
+	OBSRV_U32 nPos  = (OBSRV_U32)(pWriter->Head & (pWriter->DataSize - 1));
+	OBSRV_U32 cbEnd = pWriter->DataSize - nPos;
+	//
+	// A Tail outside of [Head - DataSize, Head] is garbage - treat the
+	// ring as full until the consumer comes to its senses
+	//
+	if ((nTail > pWriter->Head) || (pWriter->Head - nTail > pWriter->DataSize))
+		*pcbFree = 0;
+	else
+		*pcbFree = pWriter->DataSize - (OBSRV_U32)(pWriter->Head - nTail);
+	*pcbSpace = (*pcbFree < cbEnd) ? *pcbFree : cbEnd;
+
+	return pWriter->pbData + nPos;
+}
+
+//
+// Skip the rest of the data area, provided there is free space at its
+// start. Returns 0 if wrapping wouldn't gain anything.
+//
+OBSRV_INLINE int ObsrvSectionWrap(POBSRV_SECTION_WRITER pWriter)
+{
+	OBSRV_U32 cbSpace;
+	OBSRV_U32 cbFree;
+	OBSRV_U32 nMarker = OBSRV_SECTION_WRAP;
+	OBSRV_U8* pbSpace = ObsrvSectionWriteSpace(pWriter, &cbSpace, &cbFree);
+	OBSRV_U32 cbEnd   = pWriter->DataSize - (OBSRV_U32)(pWriter->Head & (pWriter->DataSize - 1));
+
+	if (cbFree <= cbEnd)
+		return 0;
+
+	OBSRV_COPY(pbSpace, &nMarker, sizeof(nMarker));
+	pWriter->Head += cbEnd;
+
+	return 1;
+}
+
+//
+// Account for cbRecord bytes written at the space returned above
+//
+OBSRV_INLINE void ObsrvSectionCommit(
+	POBSRV_SECTION_WRITER pWriter,
+	OBSRV_U32             cbRecord
+	)
+{
+	pWriter->Head += cbRecord;
+}
+
+//
+// Make the committed records visible. Returns non-zero if the consumer is
+// (about to be) sleeping and has to be woken up.
+//
+OBSRV_INLINE int ObsrvSectionPublish(
+	POBSRV_SECTION_WRITER pWriter,
+	OBSRV_U64             nOverflow,
+	int                   bStalled
+	)
+{
+	POBSRV_SECTION_HEADER pShared = pWriter->pShared;
+
+	OBSRV_STORE_RELEASE64(&pShared->Overflow, nOverflow);
+	OBSRV_STORE_RELEASE64(&pShared->ProducerStalled, bStalled ? 1 : 0);
+	OBSRV_STORE_RELEASE64(&pShared->Head, pWriter->Head);
+
+	return (1 == OBSRV_CAS64(&pShared->ConsumerWaiting, 1, 0));
+}
+
+//
+// Move as many records from the ring into the section as fit. Must be
+// called by the ring's only consumer; pfnRelease (may be NULL) is called
+// for every record moved. Returns non-zero if the consumer has to be
+// woken up.
+//
+OBSRV_INLINE int ObsrvSectionFillFromRing(
+	POBSRV_SECTION_WRITER pWriter,
+	POBSRV_RING           pRing,
+	OBSRV_RECORD_RELEASE  pfnRelease
+	)
+{
+	const OBSRV_PROCESS_RECORD* pPeeked;
+	OBSRV_PROCESS_RECORD        record;
+	OBSRV_U8*                   pbSpace;
+	OBSRV_U32                   cbSpace;
+	OBSRV_U32                   cbFree;
+	OBSRV_U32                   cbRecord;
+	OBSRV_U64                   nStart = pWriter->Head;
+
+	while (NULL != (pPeeked = ObsrvRingPeek(pRing)))
+	{
+		pbSpace  = ObsrvSectionWriteSpace(pWriter, &cbSpace, &cbFree);
+		cbRecord = ObsrvBatchEncodeProcess(pPeeked, pbSpace, cbSpace);
+		//
+		// Wrap only if it is the end of the data area that is in the way.
+		// The consumer may give space back meanwhile, thus don't let
+		// ObsrvSectionWrap() decide on a Tail read later.
+		//
+		if ((0 == cbRecord) && (cbFree > cbSpace) && ObsrvSectionWrap(pWriter))
+		{
+			pbSpace  = ObsrvSectionWriteSpace(pWriter, &cbSpace, &cbFree);
+			cbRecord = ObsrvBatchEncodeProcess(pPeeked, pbSpace, cbSpace);
+		}
+		if (0 == cbRecord)
+			break;
+		ObsrvRingPop(pRing, &record);
+		((POBSRV_RECORD_HEADER)pbSpace)->Sequence = record.Sequence;
+		if (NULL != pfnRelease)
+			pfnRelease(&record);
+		ObsrvSectionCommit(pWriter, cbRecord);
+	} // while
+
+	//
+	// Nothing new for the consumer - just keep the flags up to date. A
+	// consumer about to sleep has to be woken up all the same if records
+	// have been left behind, or it sleeps until some other event. A wrap
+	// marker counts as new even if the record didn't fit behind it: the
+	// consumer has to read past it to give the space at the end back.
+	//
+	if (pWriter->Head == nStart)
+	{
+		int bStalled = (ObsrvRingCount(pRing) > 0);
+
+		OBSRV_STORE_RELEASE64(&pWriter->pShared->Overflow, ObsrvRingOverflow(pRing));
+		OBSRV_STORE_RELEASE64(&pWriter->pShared->ProducerStalled, bStalled ? 1 : 0);
+		if (!bStalled)
+			return 0;
+
+		return (1 == OBSRV_CAS64(&pWriter->pShared->ConsumerWaiting, 1, 0));
+	}
+
+	return ObsrvSectionPublish(
+		pWriter,
+		ObsrvRingOverflow(pRing),
+		(ObsrvRingCount(pRing) > 0)
+		);
+}
+
+//---------------------------------------------------------------------------
+//
+// Consumer
+//
+//---------------------------------------------------------------------------
+
+//
+// Validate a mapped section of cbSection bytes and start reading it.
+// Returns 0 if it isn't a section of a known layout.
+//
+OBSRV_INLINE int ObsrvSectionAttach(
+	POBSRV_SECTION_READER pReader,
+	void*                 pvSection,
+	size_t                cbSection
+	)
+{
+	POBSRV_SECTION_HEADER pShared = (POBSRV_SECTION_HEADER)pvSection;
+
+	if ((NULL == pvSection) || (cbSection < sizeof(OBSRV_SECTION_HEADER)))
+		return 0;
+	if ((OBSRV_SECTION_MAGIC != pShared->Magic) ||
+	    (OBSRV_SECTION_VERSION != pShared->Version) ||
+	    (sizeof(OBSRV_SECTION_HEADER) != pShared->HeaderSize) ||
+	    (pShared->DataSize < OBSRV_SECTION_MIN_SIZE) ||
+	    (0 != (pShared->DataSize & (pShared->DataSize - 1))) ||
+	    (ObsrvSectionTotalSize(pShared->DataSize) > cbSection))
+		return 0;
+
+	pReader->pShared  = pShared;
+	pReader->pbData   = (const OBSRV_U8*)(pShared + 1);
+	pReader->Tail     = OBSRV_LOAD_ACQUIRE64(&pShared->Tail);
+	pReader->DataSize = pShared->DataSize;
+
+	return 1;
+}
+
+//
+// The next record, in place. Returns its size, 0 if there is none. The
+// record stays valid until ObsrvSectionRelease() is called.
+//
+OBSRV_INLINE OBSRV_U32 ObsrvSectionRead(
+	POBSRV_SECTION_READER pReader,
+	const void**          ppvRecord
+	)
+{
+	OBSRV_U64 nHead = OBSRV_LOAD_ACQUIRE64(&pReader->pShared->Head);
+	OBSRV_U32 nPos;
+	OBSRV_U32 cbEnd;
+	OBSRV_U32 cbRecord;
+
+	while (pReader->Tail != nHead)
+	{
+		nPos  = (OBSRV_U32)(pReader->Tail & (pReader->DataSize - 1));
+		cbEnd = pReader->DataSize - nPos;
+		OBSRV_COPY(&cbRecord, pReader->pbData + nPos, sizeof(cbRecord));
+		if ((OBSRV_SECTION_WRAP == cbRecord) && (nHead - pReader->Tail >= cbEnd))
+		{
+			pReader->Tail += cbEnd;
+			continue;
+		}
+		//
+		// Never follow a size that leaves the published records. Drop
+		// everything if the ring is garbled.
+		//
+		if ((cbRecord < sizeof(OBSRV_RECORD_HEADER)) ||
+		    (cbRecord > cbEnd) ||
+		    (cbRecord > nHead - pReader->Tail) ||
+		    (0 != (cbRecord & 7)))
+		{
+			pReader->Tail = nHead;
+			break;
+		}
+		*ppvRecord     = pReader->pbData + nPos;
+		pReader->Tail += cbRecord;
+		return cbRecord;
+	} // while
+
+	return 0;
+}
+
+//
+// Give the space of all records read so far back to the producer
+//
+OBSRV_INLINE void ObsrvSectionRelease(POBSRV_SECTION_READER pReader)
+{
+	OBSRV_STORE_RELEASE64(&pReader->pShared->Tail, pReader->Tail);
+}
+
+//
+// Called when ObsrvSectionRead() has found nothing. Releases the space
+// read and tells whether the consumer may go to sleep (see
+// OBSRV_SECTION_xxx).
+//
+OBSRV_INLINE int ObsrvSectionPrepareWait(POBSRV_SECTION_READER pReader)
+{
+	POBSRV_SECTION_HEADER pShared = pReader->pShared;
+
+	ObsrvSectionRelease(pReader);
+	if (0 != OBSRV_LOAD_ACQUIRE64(&pShared->ProducerStalled))
+		return OBSRV_SECTION_REFILL;
+	OBSRV_CAS64(&pShared->ConsumerWaiting, 0, 1);
+	//
+	// Both looked at again once the flag is out, thus either this sees
+	// what the producer has stored or the producer sees the flag
+	//
+	if (OBSRV_LOAD_ACQUIRE64(&pShared->Head) != pReader->Tail)
+	{
+		OBSRV_STORE_RELEASE64(&pShared->ConsumerWaiting, 0);
+		return OBSRV_SECTION_READY;
+	}
+	if (0 != OBSRV_LOAD_ACQUIRE64(&pShared->ProducerStalled))
+	{
+		OBSRV_STORE_RELEASE64(&pShared->ConsumerWaiting, 0);
+		return OBSRV_SECTION_REFILL;
+	}
+
+	return OBSRV_SECTION_WAIT;
+}
+
+//
+// Total number of records the driver has dropped
+//
+OBSRV_INLINE OBSRV_U64 ObsrvSectionOverflow(POBSRV_SECTION_READER pReader)
+{
+	return OBSRV_LOAD_ACQUIRE64(&pReader->pShared->Overflow);
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // !defined(_OBSRVSECTION_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,125 @@
+//---------------------------------------------------------------------------
+//
+// ObsrvTypes.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Portable base types and atomic primitives shared by the
+//              ProcObsrv driver and the user-mode applications
+//
+// DESCRIPTION:
+//              The shared headers are compiled as kernel-mode C by the WDK,
+//              as user-mode C++ by MSVC and as C/C++ by gcc/clang on Linux.
+//              Everything they need from the compiler is funneled through
+//              the few typedefs and macros below.
+//
+//---------------------------------------------------------------------------
+#if !defined(_OBSRVTYPES_H_)
+#define _OBSRVTYPES_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#if defined(_KERNEL_MODE)
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Fixed size types
+//
+//---------------------------------------------------------------------------
+#if defined(_MSC_VER)
+typedef unsigned __int8   OBSRV_U8;
+typedef unsigned __int16  OBSRV_U16;
+typedef unsigned __int32  OBSRV_U32;
+typedef unsigned __int64  OBSRV_U64;
+typedef __int64           OBSRV_I64;
+#else
+typedef uint8_t           OBSRV_U8;
+typedef uint16_t          OBSRV_U16;
+typedef uint32_t          OBSRV_U32;
+typedef uint64_t          OBSRV_U64;
+typedef int64_t           OBSRV_I64;
+#endif
+
+//---------------------------------------------------------------------------
+//
+// Compiler specific helpers
+//
+//---------------------------------------------------------------------------
+#if defined(_MSC_VER)
+#define OBSRV_INLINE            static __inline
+#define OBSRV_CACHE_ALIGN       __declspec(align(64))
+#else
+#define OBSRV_INLINE            static inline
+#define OBSRV_CACHE_ALIGN       __attribute__((aligned(64)))
+#endif
+
+#define OBSRV_CACHE_LINE        64
+
+//
+// Plain memory copy, memcpy() is available in all three environments
+//
+#define OBSRV_COPY(pvDest, pvSource, cb)   memcpy((pvDest), (pvSource), (cb))
+
+//---------------------------------------------------------------------------
+//
+// Atomic primitives on 64-bit counters
+//
+// LOAD/STORE come with acquire/release semantics, the read-modify-write
+// operations are full barriers. CAS returns the value observed before
+// the exchange.
+//
+//---------------------------------------------------------------------------
+#if defined(_MSC_VER)
+#define OBSRV_LOAD_ACQUIRE64(p)        \
+	((OBSRV_U64)ReadAcquire64((volatile LONG64*)(p)))
+#define OBSRV_STORE_RELEASE64(p, v)    \
+	WriteRelease64((volatile LONG64*)(p), (LONG64)(v))
+#define OBSRV_LOAD_RELAXED64(p)        \
+	((OBSRV_U64)ReadNoFence64((volatile LONG64*)(p)))
+#define OBSRV_CAS64(p, expected, desired)  \
+	((OBSRV_U64)InterlockedCompareExchange64(  \
+		(volatile LONG64*)(p), (LONG64)(desired), (LONG64)(expected)))
+#define OBSRV_ADD64(p, v)              \
+	((OBSRV_U64)InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v)) + (OBSRV_U64)(v))
+#define OBSRV_INC64(p)                 \
+	((OBSRV_U64)InterlockedIncrement64((volatile LONG64*)(p)))
+#define OBSRV_CPU_RELAX()              YieldProcessor()
+#else
+#define OBSRV_LOAD_ACQUIRE64(p)        \
+	__atomic_load_n((volatile OBSRV_U64*)(p), __ATOMIC_ACQUIRE)
+#define OBSRV_STORE_RELEASE64(p, v)    \
+	__atomic_store_n((volatile OBSRV_U64*)(p), (OBSRV_U64)(v), __ATOMIC_RELEASE)
+#define OBSRV_LOAD_RELAXED64(p)        \
+	__atomic_load_n((volatile OBSRV_U64*)(p), __ATOMIC_RELAXED)
+#define OBSRV_CAS64(p, expected, desired)  \
+	__sync_val_compare_and_swap((volatile OBSRV_U64*)(p),  \
+		(OBSRV_U64)(expected), (OBSRV_U64)(desired))
+#define OBSRV_ADD64(p, v)              \
+	__atomic_add_fetch((volatile OBSRV_U64*)(p), (OBSRV_U64)(v), __ATOMIC_SEQ_CST)
+#define OBSRV_INC64(p)                 OBSRV_ADD64(p, 1)
+#if defined(__x86_64__) || defined(__i386__)
+#define OBSRV_CPU_RELAX()              __builtin_ia32_pause()
+#else
+#define OBSRV_CPU_RELAX()              ((void)0)
+#endif
+#endif
+
+#endif // !defined(_OBSRVTYPES_H_)
+//----------------------------End of the file -------------------------------
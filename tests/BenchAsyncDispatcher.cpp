@@ -0,0 +1,117 @@
+//---------------------------------------------------------------------------
+//
+// BenchAsyncDispatcher.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the callback handlers written as C++20
+//              coroutines (ConsCtl/AsyncDispatcher.h)
+//
+// DESCRIPTION:
+//              2,000 events over 100 processes, dispatched in batches of
+//              64 to a handler waiting 6ms per event for a simulated I/O
+//              service: blocking in a synchronous handler, and co_await-ing
+//              with 16 and with 64 events in flight. Prints the time until
+//              the last one is handled.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "TestIoService.h"
+#include "../ConsCtl/AsyncDispatcher.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_PROCESSES         100
+#define BENCH_EVENTS            2000
+#define BENCH_BATCH             64
+#define BENCH_DELAY             6000
+
+//
+// Waits for the simulated I/O and records the event
+//
+class CBenchAsyncHandler: public CAsyncCallbackHandler
+{
+public:
+	CBenchAsyncHandler(
+		CTestIoService*    pService,
+		CRecordingHandler* pRecorder
+		):
+		m_pService(pService),
+		m_pRecorder(pRecorder)
+	{
+	}
+	virtual CHandlerTask OnProcessEventAsync(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		co_await m_pService->Delay(BENCH_DELAY);
+		m_pRecorder->OnProcessEvent(pQueuedItem, pvParam);
+	}
+private:
+	CTestIoService*    m_pService;
+	CRecordingHandler* m_pRecorder;
+};
+
+//
+// Seconds for pHandler to handle all events
+//
+static double Run(
+	CCallbackHandler*  pHandler,
+	CRecordingHandler* pRecorder
+	)
+{
+	vector<QUEUED_ITEM> batch;
+	LONGLONG            llStart = QueryTimestamp();
+
+	for (DWORD i = 0; i < BENCH_EVENTS; i++)
+	{
+		batch.push_back(MakeProcessEvent(1000 + i % BENCH_PROCESSES, 0, TRUE));
+		if ((BENCH_BATCH == batch.size()) || (i + 1 == BENCH_EVENTS))
+		{
+			pHandler->OnProcessEvents(&batch[0], (DWORD)batch.size(), NULL);
+			batch.clear();
+		}
+	} // for
+	pRecorder->WaitForCount(BENCH_EVENTS, 60000);
+
+	return NanosecondsSince(llStart) / 1e9;
+}
+
+int main()
+{
+	DWORD dwInFlight[] = { 16, 64 };
+
+	printf("%d events over %d processes, %dus of I/O per event\n", BENCH_EVENTS, BENCH_PROCESSES, BENCH_DELAY);
+	{
+		CRecordingHandler handler(BENCH_DELAY);
+
+		printf("synchronous:   %.2fs\n", Run(&handler, &handler));
+	}
+	for (size_t i = 0; i < sizeof(dwInFlight) / sizeof(dwInFlight[0]); i++)
+	{
+		CTestIoService     service;
+		CRecordingHandler  recorder;
+		CBenchAsyncHandler handler(&service, &recorder);
+		CAsyncDispatcher   dispatcher(&handler, dwInFlight[i]);
+
+		printf("%2u in flight:  %.2fs\n", dwInFlight[i], Run(&dispatcher, &recorder));
+	} // for
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,176 @@
+//---------------------------------------------------------------------------
+//
+// BenchEnrichmentStage.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the stage reading process details on a pool
+//              of threads (ConsCtl/EnrichmentStage.h) against short-lived
+//              processes
+//
+// DESCRIPTION:
+//              1000 children are forked 1ms apart, each exiting after
+//              20ms, and the create of each is appended to a queue as a
+//              source would, without details. The handler takes 2ms per
+//              event, thus it falls behind. Either it reads the image
+//              itself, or a stage with 4 workers reads it in front of it.
+//              Children are reaped only at the end; the image of one that
+//              has exited can't be read any more. Prints the share of the
+//              creates that got an image and the median, 99th percentile
+//              and largest time from the append to the handler.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/EnrichmentStage.h"
+#include "../ConsCtl/ProcFs.h"
+#include "../ConsCtl/QueueContainer.h"
+#include "../ConsCtl/StringTable.h"
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Children forked, microseconds between two of them, their lifetime and
+// the time the handler takes per event
+//
+#define BENCH_CHILDREN          1000
+#define BENCH_INTERVAL          1000
+#define BENCH_LIFETIME          20000
+#define BENCH_HANDLER_DELAY     2000
+
+//
+// Counts the creates with an image, reading it first if told to, and
+// records the time from the append (llSourceTime) to the call
+//
+class CDetailHandler: public CCallbackHandler
+{
+public:
+	CDetailHandler(BOOL bReadImage):
+		m_bReadImage(bReadImage),
+		m_lEvents(0),
+		m_lImages(0)
+	{
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pvParam);
+		if (m_bReadImage && (STRING_TABLE_NO_ID == pQueuedItem->dwImageId))
+		{
+			WCHAR szImagePath[MAX_PATH];
+
+			ReadProcessImage(pQueuedItem->hProcessId, szImagePath, MAX_PATH);
+			pQueuedItem->dwImageId = CStringTable::GetInstance().Intern(szImagePath);
+		}
+		if (STRING_TABLE_NO_ID != pQueuedItem->dwImageId)
+			m_lImages++;
+		m_Latency.RecordInterval(pQueuedItem->llSourceTime, QueryTimestamp());
+		std::this_thread::sleep_for(std::chrono::microseconds(BENCH_HANDLER_DELAY));
+		m_lEvents++;
+	}
+	BOOL              m_bReadImage;
+	std::atomic<LONG> m_lEvents;
+	std::atomic<LONG> m_lImages;
+	CLatencyHistogram m_Latency;
+};
+
+//
+// Fork the children, appending their creates, and wait for the handler
+//
+static void Feed(
+	CQueueContainer& queue,
+	CDetailHandler&  handler
+	)
+{
+	vector<pid_t> children;
+
+	queue.StartReceivingNotifications();
+	for (DWORD i = 0; i < BENCH_CHILDREN; i++)
+	{
+		pid_t pid = fork();
+
+		if (0 == pid)
+		{
+			usleep(BENCH_LIFETIME);
+			_exit(0);
+		}
+		if (pid < 0)
+			break;
+		children.push_back(pid);
+		queue.Append(MakeProcessEvent((DWORD)pid, (DWORD)getpid(), TRUE));
+		usleep(BENCH_INTERVAL);
+	} // for
+	while (handler.m_lEvents.load() < (LONG)children.size())
+		::Sleep(10);
+	queue.StopReceivingNotifications();
+	for (size_t i = 0; i < children.size(); i++)
+		waitpid(children[i], NULL, 0);
+}
+
+static void Print(
+	const char*     pszName,
+	CDetailHandler& handler
+	)
+{
+	printf("%-28s %5.1f%% with an image, p50 %5llums, p99 %5llums, max %5llums\n",
+		pszName,
+		100.0 * handler.m_lImages.load() / BENCH_CHILDREN,
+		(unsigned long long)handler.m_Latency.GetPercentile(50) / 1000000,
+		(unsigned long long)handler.m_Latency.GetPercentile(99) / 1000000,
+		(unsigned long long)handler.m_Latency.GetMax() / 1000000
+		);
+}
+
+static void RunHandler()
+{
+	CDetailHandler  handler(TRUE);
+	CQueueContainer queue(&handler);
+
+	Feed(queue, handler);
+	Print("read by the handler", handler);
+}
+
+static void RunStage(DWORD dwWindow)
+{
+	CDetailHandler handler(FALSE);
+	char           szName[64];
+
+	{
+		CEnrichmentStage stage(&handler, ENRICH_DEFAULT_WORKERS, dwWindow);
+		CQueueContainer  queue(&stage);
+
+		Feed(queue, handler);
+	}
+	snprintf(szName, sizeof(szName), "stage, %u-event buffer", dwWindow);
+	Print(szName, handler);
+}
+
+int main()
+{
+	printf("%d children %dus apart living %dms, handler taking %dms per event\n",
+		BENCH_CHILDREN, BENCH_INTERVAL, BENCH_LIFETIME / 1000, BENCH_HANDLER_DELAY / 1000);
+	RunHandler();
+	RunStage(64);
+	RunStage(256);
+	RunStage(ENRICH_DEFAULT_WINDOW);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
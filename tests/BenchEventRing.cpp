@@ -0,0 +1,165 @@
+//---------------------------------------------------------------------------
+//
+// BenchEventRing.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the ring of events shared by subscribers
+//              (ConsCtl/EventRing.h)
+//
+// DESCRIPTION:
+//              200,000 events written in batches of 64 to 1, 4 and 16
+//              RING_LAG_BLOCK subscribers of a ring of the default size,
+//              against one CQueueContainer per subscriber appended a copy
+//              of every batch. The subscribers only read the process ID of
+//              every event and count them. Prints the events handed over
+//              per second, all subscribers together.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/EventRing.h"
+#include "../ConsCtl/QueueContainer.h"
+#include <atomic>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_EVENTS            200000
+#define BENCH_BATCH             64
+
+//
+// Counts the events it is handed, reading each
+//
+class CCountingHandler: public CCallbackHandler
+{
+public:
+	CCountingHandler():
+		m_ullCount(0),
+		m_ullSum(0)
+	{
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		OnProcessEvents(pQueuedItem, 1, pvParam);
+	}
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pvParam);
+		for (DWORD i = 0; i < dwCount; i++)
+			m_ullSum += pQueuedItems[i].hProcessId;
+		m_ullCount.fetch_add(dwCount, std::memory_order_relaxed);
+	}
+	void WaitForCount(ULONG64 ullCount)
+	{
+		while (m_ullCount.load(std::memory_order_relaxed) < ullCount)
+			std::this_thread::yield();
+	}
+private:
+	std::atomic<ULONG64> m_ullCount;
+	ULONG64              m_ullSum;
+};
+
+//
+// Deliveries per second, events times subscribers
+//
+static double Rate(
+	LONGLONG llStart,
+	DWORD    dwSubscribers
+	)
+{
+	return (double)BENCH_EVENTS * dwSubscribers / (NanosecondsSince(llStart) / 1e9);
+}
+
+static double RunRing(DWORD dwSubscribers)
+{
+	CEventRing               ring;
+	vector<CCountingHandler> handlers(dwSubscribers);
+	QUEUED_ITEM              batch[BENCH_BATCH];
+
+	for (DWORD i = 0; i < dwSubscribers; i++)
+		ring.Subscribe(&handlers[i], RING_LAG_BLOCK);
+	ring.Start();
+	for (DWORD i = 0; i < BENCH_BATCH; i++)
+		batch[i] = MakeProcessEvent(i, 0, TRUE);
+
+	LONGLONG llStart = QueryTimestamp();
+
+	for (DWORD i = 0; i < BENCH_EVENTS; i += BENCH_BATCH)
+		ring.OnProcessEvents(batch, BENCH_BATCH, NULL);
+	for (DWORD i = 0; i < dwSubscribers; i++)
+		handlers[i].WaitForCount(BENCH_EVENTS);
+
+	double dRate = Rate(llStart, dwSubscribers);
+
+	ring.Stop();
+
+	return dRate;
+}
+
+static double RunCopies(DWORD dwSubscribers)
+{
+	vector<CCountingHandler> handlers(dwSubscribers);
+	vector<CQueueContainer*> queues;
+	QUEUED_ITEM              batch[BENCH_BATCH];
+
+	for (DWORD i = 0; i < dwSubscribers; i++)
+	{
+		queues.push_back(new CQueueContainer(&handlers[i]));
+		queues[i]->StartReceivingNotifications();
+	} // for
+	for (DWORD i = 0; i < BENCH_BATCH; i++)
+		batch[i] = MakeProcessEvent(i, 0, TRUE);
+
+	LONGLONG llStart = QueryTimestamp();
+
+	for (DWORD i = 0; i < BENCH_EVENTS; i += BENCH_BATCH)
+		for (DWORD j = 0; j < dwSubscribers; j++)
+			queues[j]->AppendBatch(batch, BENCH_BATCH);
+	for (DWORD i = 0; i < dwSubscribers; i++)
+		handlers[i].WaitForCount(BENCH_EVENTS);
+
+	double dRate = Rate(llStart, dwSubscribers);
+
+	for (DWORD i = 0; i < dwSubscribers; i++)
+		delete queues[i];
+
+	return dRate;
+}
+
+int main()
+{
+	DWORD dwSubscribers[] = { 1, 4, 16 };
+
+	printf("%d events in batches of %d, deliveries/s\n", BENCH_EVENTS, BENCH_BATCH);
+	printf("subscribers      ring    copies\n");
+	for (size_t i = 0; i < sizeof(dwSubscribers) / sizeof(dwSubscribers[0]); i++)
+	{
+		double dRing   = RunRing(dwSubscribers[i]);
+		double dCopies = RunCopies(dwSubscribers[i]);
+
+		printf("%11u  %7.2fM  %7.2fM\n", dwSubscribers[i], dRing / 1e6, dCopies / 1e6);
+	} // for
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,340 @@
+//---------------------------------------------------------------------------
+//
+// BenchImageLoads.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the image load path, from the driver's batches
+//              to CCallbackHandler::OnImageEvent()
+//
+// DESCRIPTION:
+//              A synthetic source plays the driver's image load callback:
+//              2,000 processes map 40 images each, 4 processes at a time,
+//              with paths taken from 200 DLLs. Images are coalesced per
+//              process into one record, in 16 slots, as the driver does,
+//              or appended one record per image. The records go through
+//              the ring, a 64KB batch and the decoder, are split into one
+//              queued item per image as CProcessThreadMonitor does, and
+//              are handed to a queue whose handler counts them. Prints
+//              the records and bytes per image, the time per image spent
+//              on the source side and the time until the last image has
+//              been handled.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvBatch.h"
+#include "../ConsCtl/QueueContainer.h"
+#include "../ConsCtl/StringTable.h"
+#include <atomic>
+#include <stdlib.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Processes, images mapped by each, processes mapping theirs at the same
+// time and different DLLs
+//
+#define BENCH_PROCESSES         2000
+#define BENCH_IMAGES            40
+#define BENCH_CONCURRENT        4
+#define BENCH_DLLS              200
+//
+// The driver's batch slots and ring, and the buffer ConsCtl reads into
+//
+#define BENCH_SLOTS             16
+#define BENCH_RING              1024
+#define BENCH_BATCH_SIZE        (64 * 1024)
+
+//
+// A handler that only counts the images
+//
+class CImageCounter: public CCallbackHandler
+{
+public:
+	CImageCounter():
+		m_lImages(0)
+	{
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pQueuedItem);
+		UNREFERENCED_PARAMETER(pvParam);
+	}
+	virtual void OnImageEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pQueuedItem);
+		UNREFERENCED_PARAMETER(pvParam);
+		m_lImages++;
+	}
+	LONG GetImages() const
+	{
+		return m_lImages.load();
+	}
+private:
+	atomic<LONG> m_lImages;
+};
+
+//
+// The open batch of a slot, as the driver keeps it
+//
+typedef struct _BenchImageBatch
+{
+	OBSRV_U64*          pBuffer;
+	OBSRV_U32           ulProcessId;
+	OBSRV_RECORD_WRITER writer;
+} BENCH_IMAGE_BATCH;
+
+//
+// The driver's side of the bench and ConsCtl's, run one after the other
+// on the same thread
+//
+class CImageSource
+{
+public:
+	CImageSource(
+		CQueueContainer* pQueue,
+		BOOL             bCoalesce
+		):
+		m_pQueue(pQueue),
+		m_bCoalesce(bCoalesce),
+		m_Cells(BENCH_RING),
+		m_Buffer(BENCH_BATCH_SIZE / sizeof(OBSRV_U64)),
+		m_ullRecords(0),
+		m_ullBytes(0)
+	{
+		ObsrvRingInit(&m_Ring, &m_Cells[0], BENCH_RING);
+		::ZeroMemory(m_Batches, sizeof(m_Batches));
+	}
+	//
+	// What LoadImageCallback() does with an image
+	//
+	void LoadImage(
+		OBSRV_U32        ulProcessId,
+		OBSRV_U64        ullImageBase,
+		const OBSRV_U16* pszPath,
+		OBSRV_U32        cchPath
+		)
+	{
+		BENCH_IMAGE_BATCH* pBatch = &m_Batches[(ulProcessId >> 2) % BENCH_SLOTS];
+		BOOL               bStored = FALSE;
+
+		if (NULL != pBatch->pBuffer)
+		{
+			if (pBatch->ulProcessId == ulProcessId)
+				bStored = ObsrvRecordPutImage(&pBatch->writer, ullImageBase, 0x10000, 0, pszPath, cchPath, FALSE);
+			if (!bStored)
+				Flush(pBatch);
+		}
+		if (!bStored)
+		{
+			pBatch->pBuffer     = (OBSRV_U64*)malloc(OBSRV_PROCESS_EXTRA_MAX_SIZE);
+			pBatch->ulProcessId = ulProcessId;
+			ObsrvRecordBegin(&pBatch->writer, pBatch->pBuffer, OBSRV_PROCESS_EXTRA_MAX_SIZE, 0, 0, 0);
+			ObsrvRecordPutImage(&pBatch->writer, ullImageBase, 0x10000, 0, pszPath, cchPath, TRUE);
+		}
+		//
+		// Without coalescing every image is a record of its own
+		//
+		if (!m_bCoalesce)
+			Flush(pBatch);
+	}
+	//
+	// What the flush timer does, then read what is left
+	//
+	void FlushAll()
+	{
+		for (DWORD i = 0; i < BENCH_SLOTS; i++)
+			Flush(&m_Batches[i]);
+		Read();
+	}
+	ULONG64 GetRecords() const
+	{
+		return m_ullRecords;
+	}
+	ULONG64 GetBytes() const
+	{
+		return m_ullBytes;
+	}
+private:
+	//
+	// FlushImageBatch(), making room in the ring first
+	//
+	void Flush(BENCH_IMAGE_BATCH* pBatch)
+	{
+		OBSRV_PROCESS_RECORD record;
+
+		if (NULL == pBatch->pBuffer)
+			return;
+		ObsrvRecordEnd(&pBatch->writer);
+		::ZeroMemory(&record, sizeof(record));
+		record.Kind       = OBSRV_KIND_IMAGE_LOAD;
+		record.Timestamp  = QueryTimestamp();
+		record.hProcessId = pBatch->ulProcessId;
+		record.Extra      = pBatch->pBuffer;
+		pBatch->pBuffer   = NULL;
+		if (BENCH_RING == ObsrvRingCount(&m_Ring))
+			Read();
+		ObsrvRingPush(&m_Ring, &record);
+	}
+	static void Release(POBSRV_PROCESS_RECORD pRecord)
+	{
+		free(pRecord->Extra);
+	}
+	//
+	// IOCTL_PROCOBSRV_GET_PROCINFO_BATCH, then what ConsCtl does with the
+	// batch
+	//
+	void Read()
+	{
+		OBSRV_BATCH_HEADER header;
+		OBSRV_RECORD_VIEW  view;
+		const BYTE*        pbRecord;
+		DWORD              cbRecord;
+
+		while (0 != ObsrvRingCount(&m_Ring))
+		{
+			ObsrvBatchFillFromRing(&m_Ring, &m_Buffer[0], BENCH_BATCH_SIZE, &CImageSource::Release);
+			pbRecord = (const BYTE*)ObsrvBatchDecode(&m_Buffer[0], BENCH_BATCH_SIZE, &header);
+			for (DWORD i = 0; (NULL != pbRecord) && (i < header.Count); i++)
+			{
+				cbRecord = ObsrvRecordDecode(pbRecord, header.Bytes, &view);
+				if (0 == cbRecord)
+					break;
+				AppendImages(pbRecord, view);
+				pbRecord += cbRecord;
+			} // for
+			m_ullRecords += header.Count;
+			m_ullBytes   += header.Bytes;
+		} // while
+	}
+	//
+	// CProcessThreadMonitor::AppendImages()
+	//
+	void AppendImages(
+		const BYTE*              pbRecord,
+		const OBSRV_RECORD_VIEW& view
+		)
+	{
+		QUEUED_ITEM      queuedItem;
+		OBSRV_IMAGE_VIEW image;
+		WCHAR            szImagePath[MAX_PATH];
+		OBSRV_U32        nOffset = 0;
+		OBSRV_U32        cchPath;
+
+		::ZeroMemory((PBYTE)&queuedItem, sizeof(queuedItem));
+		queuedItem.eKind        = QUEUED_ITEM_IMAGE_LOAD;
+		queuedItem.hProcessId   = view.ProcessId;
+		queuedItem.llSourceTime = view.Timestamp;
+		queuedItem.ullSequence  = view.Sequence;
+		while (ObsrvRecordNextImage(pbRecord, &nOffset, &image))
+		{
+			queuedItem.ullImageBase = image.ImageBase;
+			queuedItem.ullImageSize = image.ImageSize;
+			cchPath = (image.ImagePathLength < MAX_PATH) ? image.ImagePathLength : MAX_PATH - 1;
+			for (OBSRV_U32 i = 0; i < cchPath; i++)
+				szImagePath[i] = image.ImagePath[i];
+			szImagePath[cchPath] = L'\0';
+			queuedItem.dwImageId = CStringTable::GetInstance().Intern(szImagePath);
+			m_pQueue->Append(queuedItem);
+			queuedItem.ullSequence = 0;
+		} // while
+	}
+
+	CQueueContainer*        m_pQueue;
+	BOOL                    m_bCoalesce;
+	vector<OBSRV_RING_CELL> m_Cells;
+	OBSRV_RING              m_Ring;
+	vector<OBSRV_U64>       m_Buffer;
+	BENCH_IMAGE_BATCH       m_Batches[BENCH_SLOTS];
+	ULONG64                 m_ullRecords;
+	ULONG64                 m_ullBytes;
+};
+
+//
+// The device path of the n-th DLL
+//
+static vector<OBSRV_U16> MakePath(DWORD dwDll)
+{
+	vector<OBSRV_U16> path;
+	char              szPath[MAX_PATH];
+
+	snprintf(szPath, sizeof(szPath), "\\Device\\HarddiskVolume3\\Windows\\System32\\module%03u.dll", dwDll);
+	for (const char* pszChar = szPath; '\0' != *pszChar; pszChar++)
+		path.push_back((OBSRV_U16)*pszChar);
+
+	return path;
+}
+
+static void Run(
+	const vector< vector<OBSRV_U16> >& paths,
+	BOOL                               bCoalesce
+	)
+{
+	CImageCounter   handler;
+	CQueueContainer queue(&handler);
+	CImageSource    source(&queue, bCoalesce);
+	DWORD           dwTotal = BENCH_PROCESSES * BENCH_IMAGES;
+	LONGLONG        llStart;
+	double          dSource;
+
+	queue.StartReceivingNotifications();
+	llStart = QueryTimestamp();
+	for (DWORD dwFirst = 0; dwFirst < BENCH_PROCESSES; dwFirst += BENCH_CONCURRENT)
+	{
+		for (DWORD dwImage = 0; dwImage < BENCH_IMAGES; dwImage++)
+		{
+			for (DWORD i = dwFirst; i < dwFirst + BENCH_CONCURRENT; i++)
+			{
+				const vector<OBSRV_U16>& path = paths[(i * 7 + dwImage * 13) % BENCH_DLLS];
+
+				source.LoadImage(4 * (1000 + i), 0x7FF800000000ULL + dwImage * 0x100000ULL, &path[0], (OBSRV_U32)path.size());
+			} // for
+		} // for
+	} // for
+	source.FlushAll();
+	dSource = NanosecondsSince(llStart) / dwTotal;
+	while (handler.GetImages() < (LONG)dwTotal)
+		::Sleep(1);
+	printf("%-16s %5.3f records and %3.0f bytes per image, source %4.0fns per image, %.0fms until handled\n",
+		bCoalesce ? "coalesced:" : "one per image:",
+		(double)source.GetRecords() / dwTotal,
+		(double)source.GetBytes() / dwTotal,
+		dSource,
+		NanosecondsSince(llStart) / 1e6
+		);
+	queue.StopReceivingNotifications();
+}
+
+int main()
+{
+	vector< vector<OBSRV_U16> > paths;
+
+	for (DWORD i = 0; i < BENCH_DLLS; i++)
+		paths.push_back(MakePath(i));
+	printf("%d processes mapping %d images each, %d at a time\n", BENCH_PROCESSES, BENCH_IMAGES, BENCH_CONCURRENT);
+	Run(paths, FALSE);
+	Run(paths, TRUE);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
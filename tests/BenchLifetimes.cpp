@@ -0,0 +1,88 @@
+//---------------------------------------------------------------------------
+//
+// BenchLifetimes.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the folding of short-lived processes into
+//              lifetime records (CQueueContainer::SetLifetimeCoalescing())
+//
+// DESCRIPTION:
+//              20,000 processes are created, exec() and exit, appended as
+//              fast as they come to a queue whose handler takes 50us per
+//              call. Prints the time until the last one is handled and
+//              the number of handler calls, without and with coalescing.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_PROCESSES         20000
+#define BENCH_DELAY             50
+
+//
+// Append the triples and wait until they are handled
+//
+static void Run(BOOL bCoalesce)
+{
+	CRecordingHandler handler(BENCH_DELAY);
+	CQueueContainer   queue(&handler);
+	QUEUE_STATS       stats;
+	LONGLONG          llStart;
+
+	queue.SetLifetimeCoalescing(bCoalesce);
+	queue.StartReceivingNotifications();
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_PROCESSES; i++)
+	{
+		QUEUED_ITEM triple[3] =
+		{
+			MakeProcessEvent(1000 + i, 1, TRUE),
+			MakeProcessEvent(1000 + i, 1, FALSE),
+			MakeProcessEvent(1000 + i, 1, FALSE)
+		};
+
+		triple[1].eKind     = QUEUED_ITEM_EXEC;
+		triple[1].dwImageId = 1;
+		queue.AppendBatch(triple, 3);
+	} // for
+	for (queue.GetStats(stats); stats.ullDelivered < 3 * BENCH_PROCESSES; queue.GetStats(stats))
+		::Sleep(1);
+	//
+	// The last batch may still be with the handler
+	//
+	queue.StopReceivingNotifications();
+	queue.GetStats(stats);
+	printf("%-16s %.2fs, %u handler calls, %llu lifetimes\n",
+		bCoalesce ? "coalescing:" : "not coalescing:",
+		NanosecondsSince(llStart) / 1e9,
+		handler.GetCount(),
+		(unsigned long long)stats.ullLifetimes
+		);
+}
+
+int main()
+{
+	printf("%d create, exec() and exit triples, %dus per handler call\n", BENCH_PROCESSES, BENCH_DELAY);
+	Run(FALSE);
+	Run(TRUE);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
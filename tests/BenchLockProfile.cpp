@@ -0,0 +1,111 @@
+//---------------------------------------------------------------------------
+//
+// BenchLockProfile.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the lock profiling of CCSWrapper
+//              (ConsCtl/LockMgr.h)
+//
+// DESCRIPTION:
+//              Prints the cost of an Enter()/Leave() pair with profiling
+//              off and on, taken by one thread and by 4 threads at once,
+//              and that of CCustomThread::GetIsActive().
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/CustomThread.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_PAIRS             10000000
+#define BENCH_THREADS           4
+
+//
+// A thread that is never started
+//
+class CIdleThread: public CCustomThread
+{
+public:
+	CIdleThread():
+		CCustomThread(NULL)
+	{
+	}
+protected:
+	virtual void Run()
+	{
+	}
+};
+
+//
+// Nanoseconds per Enter()/Leave() pair, dwThreads taking the lock
+//
+static double MeasureLock(
+	BOOL  bProfiling,
+	DWORD dwThreads
+	)
+{
+	CCSWrapper     lock(TEXT("bench"));
+	vector<thread> threads;
+	LONGLONG       llStart;
+
+	CCSWrapper::SetProfiling(bProfiling);
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < dwThreads; i++)
+		threads.push_back(thread([&lock, dwThreads]()
+		{
+			for (DWORD j = 0; j < BENCH_PAIRS / dwThreads; j++)
+			{
+				lock.Enter();
+				lock.Leave();
+			} // for
+		}));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	double dNanoseconds = NanosecondsSince(llStart) / BENCH_PAIRS;
+
+	CCSWrapper::SetProfiling(FALSE);
+
+	return dNanoseconds;
+}
+
+//
+// Nanoseconds per GetIsActive() call
+//
+static double MeasureIsActive()
+{
+	CIdleThread      thread;
+	volatile ULONG64 ullActive = 0;
+	LONGLONG         llStart = QueryTimestamp();
+
+	for (DWORD i = 0; i < BENCH_PAIRS; i++)
+		ullActive = ullActive + thread.GetIsActive();
+
+	return NanosecondsSince(llStart) / BENCH_PAIRS;
+}
+
+int main()
+{
+	printf("Enter()/Leave() pair, profiling off / on\n");
+	printf("  1 thread:  %5.1fns / %5.1fns\n", MeasureLock(FALSE, 1), MeasureLock(TRUE, 1));
+	printf("  %d threads: %5.1fns / %5.1fns\n", BENCH_THREADS, MeasureLock(FALSE, BENCH_THREADS), MeasureLock(TRUE, BENCH_THREADS));
+	printf("GetIsActive(): %.1fns\n", MeasureIsActive());
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,118 @@
+//---------------------------------------------------------------------------
+//
+// BenchMpscQueue.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the lock-free queue build of CQueueContainer
+//              (QUEUE_LOCK_FREE) against the locked one (QUEUE_LOCKED)
+//
+// DESCRIPTION:
+//              1 and 4 producers append events to a handler that only
+//              records the time from the append to the call, flat out and
+//              paced at one event every 50us each. Prints the events
+//              handled per second and the median, 99th percentile and
+//              largest of that time.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events appended flat out, and paced, by all producers together
+//
+#define BENCH_EVENTS            400000
+#define BENCH_PACED_EVENTS      20000
+#define BENCH_INTERVAL          50
+
+//
+// Records the time from the append (llSourceTime) to the call
+//
+class CTimingHandler: public CCallbackHandler
+{
+public:
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pvParam);
+		m_Latency.RecordInterval(pQueuedItem->llSourceTime, QueryTimestamp());
+	}
+	CLatencyHistogram m_Latency;
+};
+
+static void Run(
+	QUEUE_IMPLEMENTATION eImplementation,
+	const char*          pszName,
+	DWORD                dwProducers,
+	BOOL                 bPaced
+	)
+{
+	CTimingHandler  handler;
+	CQueueContainer queue(&handler, eImplementation);
+	vector<thread>  producers;
+	DWORD           dwTotal = bPaced ? BENCH_PACED_EVENTS : BENCH_EVENTS;
+	LONGLONG        llStart;
+
+	queue.StartReceivingNotifications();
+	llStart = QueryTimestamp();
+	for (DWORD dwProducer = 0; dwProducer < dwProducers; dwProducer++)
+		producers.push_back(thread([&queue, dwProducer, dwProducers, dwTotal, bPaced]()
+		{
+			for (DWORD i = 0; i < dwTotal / dwProducers; i++)
+			{
+				if (bPaced)
+					std::this_thread::sleep_for(std::chrono::microseconds(BENCH_INTERVAL));
+				queue.Append(MakeProcessEvent(i, dwProducer, TRUE));
+			} // for
+		}));
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+	while (handler.m_Latency.GetCount() < dwTotal)
+		::Sleep(1);
+
+	double dSeconds = NanosecondsSince(llStart) / 1e9;
+
+	queue.StopReceivingNotifications();
+	printf("%-16s %d producer%s %-9s %9.0f events/s, p50 %7.1fus, p99 %8.1fus, max %9.1fus\n",
+		pszName,
+		dwProducers,
+		(1 == dwProducers) ? ", " : "s,",
+		bPaced ? "paced:" : "flat out:",
+		dwTotal / dSeconds,
+		handler.m_Latency.GetPercentile(50) / 1000.0,
+		handler.m_Latency.GetPercentile(99) / 1000.0,
+		handler.m_Latency.GetMax() / 1000.0
+		);
+}
+
+int main()
+{
+	printf("%d events flat out, %d paced at one every %dus per producer\n", BENCH_EVENTS, BENCH_PACED_EVENTS, BENCH_INTERVAL);
+	for (DWORD dwProducers = 1; dwProducers <= 4; dwProducers *= 4)
+		for (int bPaced = FALSE; bPaced <= TRUE; bPaced++)
+		{
+			Run(QUEUE_LOCKED, "QUEUE_LOCKED", dwProducers, bPaced);
+			Run(QUEUE_LOCK_FREE, "QUEUE_LOCK_FREE", dwProducers, bPaced);
+		} // for
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,150 @@
+//---------------------------------------------------------------------------
+//
+// BenchObsrvFilter.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the compiled event filter (Shared/ObsrvFilter.h)
+//
+// DESCRIPTION:
+//              Filters of 1000 to 10000 rules, a quarter on each field:
+//              process, parent and session IDs denied, image path
+//              prefixes (folders of a device path) allowed. Events with
+//              random IDs and paths, half of them below an allowed folder,
+//              are evaluated one after the other. Prints the size of the
+//              compiled filter, the time per event ObsrvFilterMatch()
+//              takes and the share of the events passing.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvFilter.h"
+#include <stdlib.h>
+#include <string>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events evaluated, and the different ones they are taken from in turn
+//
+#define BENCH_MATCHES           2000000
+#define BENCH_EVENTS            4096
+
+typedef basic_string<OBSRV_U16> CBenchPath;
+
+static CBenchPath MakePath(const char* pszText)
+{
+	CBenchPath path;
+
+	while ('\0' != *pszText)
+		path += (OBSRV_U16)*pszText++;
+
+	return path;
+}
+
+//
+// The folder of the n-th vendor
+//
+static CBenchPath MakeFolder(DWORD dwVendor)
+{
+	char szFolder[MAX_PATH];
+
+	snprintf(szFolder, sizeof(szFolder), "\\Device\\HarddiskVolume3\\Program Files\\Vendor%u\\", dwVendor);
+
+	return MakePath(szFolder);
+}
+
+static void Run(DWORD dwRules)
+{
+	vector<OBSRV_FILTER_RULE>  rules;
+	vector<CBenchPath>         prefixes;
+	vector<CBenchPath>         paths;
+	vector<OBSRV_FILTER_EVENT> events;
+	vector<OBSRV_U32>          filter;
+	OBSRV_U32                  cbFilter;
+	LONGLONG                   llStart;
+	ULONG64                    ullNanoseconds;
+	volatile DWORD             dwPassed = 0;
+
+	srand(dwRules);
+	prefixes.reserve(dwRules);
+	for (DWORD i = 0; i < dwRules; i++)
+	{
+		OBSRV_FILTER_RULE rule = { i % OBSRV_FILTER_FIELD_COUNT, OBSRV_FILTER_DENY, 0, 0, NULL };
+
+		if (OBSRV_FILTER_IMAGE_PREFIX == rule.Field)
+		{
+			prefixes.push_back(MakeFolder(2 * i));
+			rule.Action       = OBSRV_FILTER_ALLOW;
+			rule.Prefix       = prefixes.back().c_str();
+			rule.PrefixLength = (OBSRV_U32)prefixes.back().size();
+		}
+		else
+			rule.Value = (OBSRV_U32)rand() % 4000000;
+		rules.push_back(rule);
+	} // for
+	cbFilter = ObsrvFilterCompiledSize(&rules[0], dwRules);
+	filter.resize(cbFilter / sizeof(OBSRV_U32) + 1);
+	cbFilter = ObsrvFilterCompile(&rules[0], dwRules, &filter[0], cbFilter);
+	if ((0 == cbFilter) || !ObsrvFilterValidate(&filter[0], cbFilter))
+	{
+		printf("%6u rules: not compiled\n", dwRules);
+		return;
+	}
+	//
+	// Half of the events below an allowed folder, half below one between
+	// two of them
+	//
+	paths.reserve(BENCH_EVENTS);
+	for (DWORD i = 0; i < BENCH_EVENTS; i++)
+	{
+		DWORD dwRule   = (rand() % (dwRules / OBSRV_FILTER_FIELD_COUNT)) * OBSRV_FILTER_FIELD_COUNT + OBSRV_FILTER_IMAGE_PREFIX;
+		DWORD dwVendor = 2 * dwRule;
+
+		paths.push_back(MakeFolder(dwVendor + (i % 2)) + MakePath("bin\\service.exe"));
+
+		OBSRV_FILTER_EVENT event = {
+			(OBSRV_U32)rand() % 4000000,
+			(OBSRV_U32)rand() % 4000000,
+			(OBSRV_U32)rand() % 4000000,
+			paths.back().c_str(),
+			(OBSRV_U32)paths.back().size()
+			};
+
+		events.push_back(event);
+	} // for
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_MATCHES; i++)
+		dwPassed = dwPassed + ObsrvFilterMatch(&filter[0], &events[i % BENCH_EVENTS]);
+	ullNanoseconds = NanosecondsSince(llStart);
+	printf("%6u rules, %7u bytes: %4llu ns per event, %4.1f%% passed\n",
+		dwRules,
+		cbFilter,
+		(unsigned long long)(ullNanoseconds / BENCH_MATCHES),
+		100.0 * dwPassed / BENCH_MATCHES
+		);
+}
+
+int main()
+{
+	Run(1000);
+	Run(2000);
+	Run(5000);
+	Run(10000);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,128 @@
+//---------------------------------------------------------------------------
+//
+// BenchObsrvRecord.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the record format (Shared/ObsrvRecord.h)
+//
+// DESCRIPTION:
+//              Encodes and decodes a process create with its fixed fields,
+//              an image path of 60 characters and a command line of 120,
+//              as the driver captures it, and a create without strings.
+//              Prints the size of each and the time encoding and decoding
+//              take per record.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvRecord.h"
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Records encoded and decoded, and the buffers they take turns in, thus
+// no encoding is overwritten before it has been read
+//
+#define BENCH_RECORDS           1000000
+#define BENCH_BUFFERS           64
+
+//
+// A string of cchText characters
+//
+static vector<OBSRV_U16> MakeText(
+	const char* pszHead,
+	DWORD       cchText
+	)
+{
+	vector<OBSRV_U16> text;
+
+	for (; ('\0' != *pszHead) && (text.size() < cchText); pszHead++)
+		text.push_back((OBSRV_U16)*pszHead);
+	while (text.size() < cchText)
+		text.push_back((OBSRV_U16)('a' + text.size() % 26));
+
+	return text;
+}
+
+//
+// Encode a create the way the driver does
+//
+static OBSRV_U32 EncodeCreate(
+	BYTE*                    pbBuffer,
+	DWORD                    dwProcessId,
+	const vector<OBSRV_U16>* pImagePath,
+	const vector<OBSRV_U16>* pCommandLine
+	)
+{
+	OBSRV_RECORD_WRITER writer;
+
+	ObsrvRecordBegin(&writer, pbBuffer, OBSRV_RECORD_MAX_SIZE, OBSRV_KIND_PROCESS_CREATE, dwProcessId, dwProcessId);
+	ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, dwProcessId);
+	ObsrvRecordPutU32(&writer, OBSRV_TAG_PARENT_ID, 4);
+	ObsrvRecordPutU32(&writer, OBSRV_TAG_SESSION_ID, 1);
+	ObsrvRecordPutU32(&writer, OBSRV_TAG_CREATING_PROCESS_ID, 4);
+	ObsrvRecordPutU32(&writer, OBSRV_TAG_CREATING_THREAD_ID, 8);
+	if (NULL != pImagePath)
+		ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, &(*pImagePath)[0], (OBSRV_U32)pImagePath->size());
+	if (NULL != pCommandLine)
+		ObsrvRecordPutString(&writer, OBSRV_TAG_COMMAND_LINE, &(*pCommandLine)[0], (OBSRV_U32)pCommandLine->size());
+
+	return ObsrvRecordEnd(&writer);
+}
+
+static void Run(
+	const char* pszName,
+	BOOL        bStrings
+	)
+{
+	vector<OBSRV_U64>  buffer(BENCH_BUFFERS * OBSRV_RECORD_MAX_SIZE / sizeof(OBSRV_U64));
+	BYTE*              pbBuffer = (BYTE*)&buffer[0];
+	vector<OBSRV_U16>  imagePath = MakeText("\\Device\\HarddiskVolume3\\Windows\\System32\\", 60);
+	vector<OBSRV_U16>  commandLine = MakeText("C:\\Windows\\System32\\svchost.exe -k ", 120);
+	OBSRV_RECORD_VIEW  view;
+	OBSRV_U32          cbRecord = 0;
+	double             dEncode;
+	double             dDecode;
+	LONGLONG           llStart;
+	volatile OBSRV_U32 nSink = 0;
+
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_RECORDS; i++)
+	{
+		cbRecord = EncodeCreate(pbBuffer + (i % BENCH_BUFFERS) * OBSRV_RECORD_MAX_SIZE, i, bStrings ? &imagePath : NULL, bStrings ? &commandLine : NULL);
+		nSink = nSink + cbRecord;
+	} // for
+	dEncode = NanosecondsSince(llStart) / BENCH_RECORDS;
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_RECORDS; i++)
+	{
+		ObsrvRecordDecode(pbBuffer + (i % BENCH_BUFFERS) * OBSRV_RECORD_MAX_SIZE, cbRecord, &view);
+		nSink = nSink + view.ProcessId;
+	} // for
+	dDecode = NanosecondsSince(llStart) / BENCH_RECORDS;
+	printf("%-24s %4u bytes, encode %5.1fns, decode %5.1fns\n", pszName, cbRecord, dEncode, dDecode);
+}
+
+int main()
+{
+	Run("create with strings", TRUE);
+	Run("create without strings", FALSE);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
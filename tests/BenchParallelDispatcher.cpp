@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------------
+//
+// BenchParallelDispatcher.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the callback handler spreading the events
+//              over worker threads (ConsCtl/ParallelDispatcher.h)
+//
+// DESCRIPTION:
+//              2,000 events over 200 processes, dispatched in batches of
+//              64 to a handler taking 2ms per event, on 1, 4 and 16
+//              workers. Prints the time until the last one is handled.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ParallelDispatcher.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_PROCESSES         200
+#define BENCH_EVENTS            2000
+#define BENCH_BATCH             64
+#define BENCH_DELAY             2000
+
+//
+// Seconds to handle all events on dwWorkers workers
+//
+static double Run(DWORD dwWorkers)
+{
+	CRecordingHandler   handler(BENCH_DELAY);
+	CParallelDispatcher dispatcher(&handler, dwWorkers);
+	vector<QUEUED_ITEM> batch;
+	LONGLONG            llStart = QueryTimestamp();
+
+	for (DWORD i = 0; i < BENCH_EVENTS; i++)
+	{
+		batch.push_back(MakeProcessEvent(1000 + i % BENCH_PROCESSES, 0, TRUE));
+		if ((BENCH_BATCH == batch.size()) || (i + 1 == BENCH_EVENTS))
+		{
+			dispatcher.OnProcessEvents(&batch[0], (DWORD)batch.size(), NULL);
+			batch.clear();
+		}
+	} // for
+	handler.WaitForCount(BENCH_EVENTS, 60000);
+
+	return NanosecondsSince(llStart) / 1e9;
+}
+
+int main()
+{
+	DWORD dwWorkers[] = { 1, 4, 16 };
+
+	printf("%d events over %d processes, %dus per event\n", BENCH_EVENTS, BENCH_PROCESSES, BENCH_DELAY);
+	for (size_t i = 0; i < sizeof(dwWorkers) / sizeof(dwWorkers[0]); i++)
+		printf("%2u workers: %.2fs\n", dwWorkers[i], Run(dwWorkers[i]));
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
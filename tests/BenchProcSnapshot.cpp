@@ -0,0 +1,174 @@
+//---------------------------------------------------------------------------
+//
+// BenchProcSnapshot.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the /proc snapshot diff (ConsCtl/ProcSnapshot.h)
+//
+// DESCRIPTION:
+//              A snapshot fed synthetic listings of 10,000 and 100,000
+//              processes, either unchanged from scan to scan or with 50
+//              processes exiting and 50 others created, and one listing
+//              the real /proc. Prints the CPU time per scan of the
+//              scanning thread, copying the listing included.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ProcSnapshot.h"
+#include <time.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Scans timed per run, and processes exiting (as many created) per scan
+// when the listing changes
+//
+#define BENCH_SCANS             200
+#define BENCH_CHURN             50
+
+//
+// A snapshot taking its listings from the two given in turn
+//
+class CSyntheticSnapshot: public CProcSnapshot
+{
+public:
+	CSyntheticSnapshot():
+		m_dwListings(0),
+		m_dwNext(0)
+	{
+	}
+	vector<ULONG64> m_Listings[2];
+	DWORD           m_dwListings;
+	DWORD           m_dwNext;
+
+	static ULONG64 MakeProcessKey(DWORD dwProcessId)
+	{
+		return MakeKey(dwProcessId, dwProcessId);
+	}
+protected:
+	virtual BOOL ListProcesses(vector<ULONG64>& keys)
+	{
+		const vector<ULONG64>& listing = m_Listings[m_dwNext];
+
+		m_dwNext = (m_dwNext + 1) % m_dwListings;
+		keys.insert(keys.end(), listing.begin(), listing.end());
+
+		return TRUE;
+	}
+	virtual BOOL ReadProcess(
+		DWORD    dwProcessId,
+		PDWORD   pdwParentId,
+		ULONG64* pullStartTime
+		)
+	{
+		*pdwParentId   = 1;
+		*pullStartTime = dwProcessId;
+
+		return TRUE;
+	}
+};
+
+//
+// CPU time of the calling thread, in nanoseconds
+//
+static ULONG64 GetThreadTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+	return (ULONG64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//
+// Time the scans after the first one, which fills the table
+//
+static void Time(
+	CProcSnapshot& snapshot,
+	const char*    pszName
+	)
+{
+	vector<PROC_CHANGE> changes;
+	ULONG64             ullStart;
+	ULONG64             ullChanges = 0;
+
+	snapshot.Scan(changes);
+	ullStart = GetThreadTime();
+	for (DWORD i = 0; i < BENCH_SCANS; i++)
+	{
+		changes.clear();
+		snapshot.Scan(changes);
+		ullChanges += changes.size();
+	} // for
+	printf("%-34s %7.1fus per scan, %5.1f changes\n",
+		pszName,
+		(GetThreadTime() - ullStart) / 1000.0 / BENCH_SCANS,
+		(double)ullChanges / BENCH_SCANS
+		);
+}
+
+//
+// IDs spread over the whole range, with churn every other listing sees
+// 50 of them gone and 50 new ones in between
+//
+static void Run(
+	DWORD dwProcesses,
+	BOOL  bChurn
+	)
+{
+	CSyntheticSnapshot snapshot;
+	DWORD              dwStep = 4000000 / dwProcesses;
+	char               szName[64];
+
+	for (DWORD i = 0; i < dwProcesses; i++)
+		snapshot.m_Listings[0].push_back(CSyntheticSnapshot::MakeProcessKey(1 + i * dwStep));
+	snapshot.m_dwListings = 1;
+	if (bChurn)
+	{
+		vector<ULONG64>& churned = snapshot.m_Listings[1];
+
+		for (DWORD i = 0; i < dwProcesses; i++)
+		{
+			if (0 != i % (dwProcesses / BENCH_CHURN))
+				churned.push_back(CSyntheticSnapshot::MakeProcessKey(1 + i * dwStep));
+			else
+				churned.push_back(CSyntheticSnapshot::MakeProcessKey(2 + i * dwStep));
+		} // for
+		snapshot.m_dwListings = 2;
+	}
+	snprintf(szName, sizeof(szName), "%u processes, %s", dwProcesses, bChurn ? "100 changed" : "unchanged");
+	Time(snapshot, szName);
+}
+
+int main()
+{
+	CProcSnapshot       snapshot;
+	vector<PROC_CHANGE> changes;
+	char                szName[64];
+
+	Run(10000, FALSE);
+	Run(10000, TRUE);
+	Run(100000, FALSE);
+	Run(100000, TRUE);
+	snapshot.Scan(changes);
+	snprintf(szName, sizeof(szName), "/proc, %u processes", snapshot.GetCount());
+	Time(snapshot, szName);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,214 @@
+//---------------------------------------------------------------------------
+//
+// BenchProcessTree.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the process tree (ConsCtl/ProcessTree.h)
+//
+// DESCRIPTION:
+//              1M processes are created, three quarters of them children
+//              of one of the 64 processes created just before and the
+//              rest children of the root. Prints the time to insert one
+//              and the size of the pool, the time of GetProcess() of a
+//              random process against a lookup in a map alone, of
+//              GetAncestors() of a process 4 levels deep, of listing the
+//              whole tree and of handling the exits with no retention.
+//              Then 2M creates and exits churn around 10,000 running
+//              processes with the default retention; prints the nodes
+//              and the pool it ends with and the time per event.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ProcessTree.h"
+#include <random>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_PROCESSES         1000000
+#define BENCH_RECENT            64
+#define BENCH_QUERIES           1000000
+#define BENCH_RUNNING           10000
+#define BENCH_CHURN             1000000
+#define BENCH_BATCH             64
+#define BENCH_ROOT              1
+
+//
+// Takes the events and does nothing with them
+//
+class CNullHandler: public CCallbackHandler
+{
+public:
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pQueuedItem);
+		UNREFERENCED_PARAMETER(pvParam);
+	}
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pQueuedItems);
+		UNREFERENCED_PARAMETER(dwCount);
+		UNREFERENCED_PARAMETER(pvParam);
+	}
+};
+
+//
+// Hand the events to the tree BENCH_BATCH at a time
+//
+static void Feed(
+	CProcessTree&        tree,
+	vector<QUEUED_ITEM>& events
+	)
+{
+	for (size_t i = 0; i < events.size(); i += BENCH_BATCH)
+		tree.OnProcessEvents(&events[i], (DWORD)min<size_t>(BENCH_BATCH, events.size() - i), NULL);
+}
+
+//
+// 1M processes: inserts, queries and exits
+//
+static void RunQueries()
+{
+	CNullHandler              handler;
+	CProcessTree              tree(&handler, PROCESS_TREE_DEFAULT_RETENTION, 0);
+	PROCESS_TREE_STATS        stats;
+	PROCESS_NODE_INFO         info;
+	vector<QUEUED_ITEM>       events;
+	vector<DWORD>             ancestors;
+	vector<PROCESS_NODE_INFO> nodes;
+	vector<DWORD>             queries;
+	unordered_map<DWORD, DWORD> index;
+	mt19937                   random(1);
+	volatile DWORD            dwSink = 0;
+	DWORD                     dwDeep = 0;
+	LONGLONG                  llStart;
+
+	events.push_back(MakeProcessEvent(BENCH_ROOT, 0, TRUE));
+	for (DWORD i = 0; i < BENCH_PROCESSES; i++)
+	{
+		DWORD dwProcessId = BENCH_ROOT + 1 + i;
+		DWORD dwParentId  = BENCH_ROOT;
+
+		if ((0 != random() % 4) && (i > 0))
+			dwParentId = dwProcessId - 1 - random() % min<DWORD>(i, BENCH_RECENT);
+		events.push_back(MakeProcessEvent(dwProcessId, dwParentId, TRUE));
+		index[dwProcessId] = i;
+	} // for
+	llStart = QueryTimestamp();
+	Feed(tree, events);
+	tree.GetStats(stats);
+	printf("Insert:            %7.1fns, a %lluMB pool\n",
+		NanosecondsSince(llStart) / BENCH_PROCESSES,
+		(unsigned long long)stats.ullPoolBytes / (1024 * 1024)
+		);
+
+	for (DWORD i = 0; i < BENCH_QUERIES; i++)
+		queries.push_back(BENCH_ROOT + 1 + random() % BENCH_PROCESSES);
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_QUERIES; i++)
+		if (tree.GetProcess(queries[i], info))
+			dwSink = dwSink + info.dwDescendants;
+	printf("GetProcess():      %7.1fns, random\n", NanosecondsSince(llStart) / BENCH_QUERIES);
+
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_QUERIES; i++)
+		dwSink = dwSink + index.find(queries[i])->second;
+	printf("  map lookup:      %7.1fns, random\n", NanosecondsSince(llStart) / BENCH_QUERIES);
+
+	for (DWORD i = BENCH_PROCESSES; (0 == dwDeep) && (i > 0); i--)
+		if (4 == tree.GetAncestors(BENCH_ROOT + i, ancestors))
+			dwDeep = BENCH_ROOT + i;
+	llStart = QueryTimestamp();
+	for (DWORD i = 0; i < BENCH_QUERIES; i++)
+		dwSink = dwSink + tree.GetAncestors(dwDeep, ancestors);
+	printf("GetAncestors():    %7.1fns, 4 levels deep\n", NanosecondsSince(llStart) / BENCH_QUERIES);
+
+	llStart = QueryTimestamp();
+	dwSink = dwSink + tree.GetSubtree(BENCH_ROOT, nodes);
+	printf("GetSubtree():      %7.1fns per process\n", NanosecondsSince(llStart) / nodes.size());
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		events[i].bCreate      = FALSE;
+		events[i].llSourceTime = QueryTimestamp();
+	} // for
+	llStart = QueryTimestamp();
+	Feed(tree, events);
+	tree.GetStats(stats);
+	printf("Exit:              %7.1fns, %u nodes left\n",
+		NanosecondsSince(llStart) / events.size(),
+		stats.dwNodes
+		);
+}
+
+//
+// Creates and exits around BENCH_RUNNING processes, default retention
+//
+static void RunChurn()
+{
+	CNullHandler        handler;
+	CProcessTree        tree(&handler);
+	PROCESS_TREE_STATS  stats;
+	vector<QUEUED_ITEM> events;
+	vector<DWORD>       running;
+	mt19937             random(2);
+	DWORD               dwNextId = BENCH_ROOT + 1;
+	LONGLONG            llStart;
+
+	events.push_back(MakeProcessEvent(BENCH_ROOT, 0, TRUE));
+	for (DWORD i = 0; i < BENCH_RUNNING; i++, dwNextId++)
+	{
+		events.push_back(MakeProcessEvent(dwNextId, BENCH_ROOT, TRUE));
+		running.push_back(dwNextId);
+	} // for
+	Feed(tree, events);
+	events.clear();
+	for (DWORD i = 0; i < BENCH_CHURN; i++, dwNextId++)
+	{
+		DWORD dwExit = random() % BENCH_RUNNING;
+
+		events.push_back(MakeProcessEvent(running[dwExit], 0, FALSE));
+		running[dwExit] = dwNextId;
+		events.push_back(MakeProcessEvent(dwNextId, (0 == random() % 4) ? BENCH_ROOT : running[random() % BENCH_RUNNING], TRUE));
+	} // for
+	llStart = QueryTimestamp();
+	Feed(tree, events);
+	tree.GetStats(stats);
+	printf("Churn:             %7.1fns per event, %u nodes, a %lluMB pool\n",
+		NanosecondsSince(llStart) / events.size(),
+		stats.dwNodes,
+		(unsigned long long)stats.ullPoolBytes / (1024 * 1024)
+		);
+}
+
+int main()
+{
+	printf("%d processes, 3 in 4 children of one of the %d created before\n", BENCH_PROCESSES, BENCH_RECENT);
+	RunQueries();
+	printf("%d creates and exits around %d running processes\n", 2 * BENCH_CHURN, BENCH_RUNNING);
+	RunChurn();
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
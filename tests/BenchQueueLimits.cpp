@@ -0,0 +1,180 @@
+//---------------------------------------------------------------------------
+//
+// BenchQueueLimits.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Stress of the queue bounds and overflow policies
+//              (CQueueContainer::SetLimits())
+//
+// DESCRIPTION:
+//              The handler is stalled for 3s while 2M process events, a
+//              create and an exit of every process, are appended as fast
+//              as they come, with a 16MB budget. Every run is a process
+//              of its own, sampling its resident set (/proc/self/statm)
+//              every 4096 events. Prints the peak growth of the resident
+//              set and what the policy did.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_EVENTS            2000000
+#define BENCH_BUDGET            (16 * 1024 * 1024)
+#define BENCH_STALL             3000
+#define BENCH_SAMPLE            4096
+
+//
+// Stalled in its first call until released
+//
+class CStalledHandler: public CCallbackHandler
+{
+public:
+	CStalledHandler():
+		m_evtRelease(::CreateEvent(NULL, TRUE, FALSE, NULL))
+	{
+	}
+	virtual ~CStalledHandler()
+	{
+		::CloseHandle(m_evtRelease);
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pQueuedItem);
+		UNREFERENCED_PARAMETER(pvParam);
+		::WaitForSingleObject(m_evtRelease, INFINITE);
+	}
+	void Release()
+	{
+		::SetEvent(m_evtRelease);
+	}
+private:
+	HANDLE m_evtRelease;
+};
+
+//
+// Resident set of the process, in bytes
+//
+static ULONG64 GetResidentBytes()
+{
+	unsigned long ulSize = 0;
+	unsigned long ulResident = 0;
+	FILE*         pFile = fopen("/proc/self/statm", "r");
+
+	if (NULL == pFile)
+		return 0;
+	if (2 != fscanf(pFile, "%lu %lu", &ulSize, &ulResident))
+		ulResident = 0;
+	fclose(pFile);
+
+	return (ULONG64)ulResident * (ULONG64)sysconf(_SC_PAGESIZE);
+}
+
+static void Run(
+	QUEUE_IMPLEMENTATION  eImplementation,
+	QUEUE_OVERFLOW_POLICY ePolicy,
+	BOOL                  bBounded,
+	const char*           pszName
+	)
+{
+	CStalledHandler handler;
+	CQueueContainer queue(&handler, eImplementation);
+	QUEUE_STATS     stats;
+	ULONG64         ullBase;
+	ULONG64         ullPeak;
+
+	if (bBounded)
+		queue.SetLimits(0, BENCH_BUDGET, ePolicy);
+	queue.StartReceivingNotifications();
+	ullBase = ullPeak = GetResidentBytes();
+
+	thread release([&handler]()
+	{
+		::Sleep(BENCH_STALL);
+		handler.Release();
+	});
+
+	for (DWORD i = 0; i < BENCH_EVENTS; i++)
+	{
+		queue.Append(MakeProcessEvent(1000 + i / 2, 1, 0 == i % 2));
+		if (0 == i % BENCH_SAMPLE)
+			ullPeak = max(ullPeak, GetResidentBytes());
+	} // for
+	ullPeak = max(ullPeak, GetResidentBytes());
+	release.join();
+	for (queue.GetStats(stats); stats.ullDelivered + stats.ullDroppedNewest +
+	     stats.ullDroppedOldest + stats.ullCoalesced < BENCH_EVENTS; queue.GetStats(stats))
+		::Sleep(1);
+	queue.StopReceivingNotifications();
+	queue.GetStats(stats);
+	printf("%-24s +%4lluMB, delivered %7llu, dropped %7llu, coalesced %7llu, waits %llu\n",
+		pszName,
+		(unsigned long long)(ullPeak - ullBase) / (1024 * 1024),
+		(unsigned long long)stats.ullDelivered,
+		(unsigned long long)(stats.ullDroppedNewest + stats.ullDroppedOldest),
+		(unsigned long long)stats.ullCoalesced,
+		(unsigned long long)stats.ullProducerWaits
+		);
+}
+
+//
+// Each run in a process of its own, thus starting from the same heap
+//
+static void Fork(
+	QUEUE_IMPLEMENTATION  eImplementation,
+	QUEUE_OVERFLOW_POLICY ePolicy,
+	BOOL                  bBounded,
+	const char*           pszName
+	)
+{
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (0 == pid)
+	{
+		Run(eImplementation, ePolicy, bBounded, pszName);
+		fflush(stdout);
+		_exit(0);
+	}
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+}
+
+int main()
+{
+	printf("%d events, handler stalled for %dms, %dMB budget, peak resident set growth\n",
+		BENCH_EVENTS, BENCH_STALL, BENCH_BUDGET / (1024 * 1024));
+	Fork(QUEUE_LOCKED, QUEUE_OVERFLOW_BLOCK, FALSE, "locked    unbounded");
+	Fork(QUEUE_LOCKED, QUEUE_OVERFLOW_BLOCK, TRUE, "locked    block");
+	Fork(QUEUE_LOCKED, QUEUE_OVERFLOW_DROP_NEWEST, TRUE, "locked    drop-newest");
+	Fork(QUEUE_LOCKED, QUEUE_OVERFLOW_DROP_OLDEST, TRUE, "locked    drop-oldest");
+	Fork(QUEUE_LOCKED, QUEUE_OVERFLOW_COALESCE, TRUE, "locked    coalesce");
+	Fork(QUEUE_LOCK_FREE, QUEUE_OVERFLOW_BLOCK, FALSE, "lock-free unbounded");
+	Fork(QUEUE_LOCK_FREE, QUEUE_OVERFLOW_BLOCK, TRUE, "lock-free block");
+	Fork(QUEUE_LOCK_FREE, QUEUE_OVERFLOW_DROP_NEWEST, TRUE, "lock-free drop-newest");
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
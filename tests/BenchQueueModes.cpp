@@ -0,0 +1,107 @@
+//---------------------------------------------------------------------------
+//
+// BenchQueueModes.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the queue container builds, QUEUE_LOCKED,
+//              QUEUE_LOCK_FREE and QUEUE_INLINE
+//
+// DESCRIPTION:
+//              An event is appended every 50us to a handler that only
+//              records the time from the append to the call. Prints the
+//              context switches of the process per event (the sleep
+//              between the events is one of them) and the median and
+//              99th percentile of that time.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+#include <sys/resource.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_EVENTS            20000
+#define BENCH_INTERVAL          50
+
+//
+// Records the time from the append (llSourceTime) to the call
+//
+class CTimingHandler: public CCallbackHandler
+{
+public:
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pvParam);
+		m_Latency.RecordInterval(pQueuedItem->llSourceTime, QueryTimestamp());
+	}
+	CLatencyHistogram m_Latency;
+};
+
+//
+// Context switches of the process so far
+//
+static ULONG64 GetContextSwitches()
+{
+	struct rusage usage;
+
+	::getrusage(RUSAGE_SELF, &usage);
+
+	return (ULONG64)usage.ru_nvcsw + (ULONG64)usage.ru_nivcsw;
+}
+
+static void Run(
+	QUEUE_IMPLEMENTATION eImplementation,
+	const char*          pszName
+	)
+{
+	CTimingHandler  handler;
+	CQueueContainer queue(&handler, eImplementation);
+	ULONG64         ullSwitches;
+
+	queue.StartReceivingNotifications();
+	ullSwitches = GetContextSwitches();
+	for (DWORD i = 0; i < BENCH_EVENTS; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(BENCH_INTERVAL));
+		queue.Append(MakeProcessEvent(1000 + i, 1, TRUE));
+	} // for
+	while (handler.m_Latency.GetCount() < BENCH_EVENTS)
+		::Sleep(1);
+	ullSwitches = GetContextSwitches() - ullSwitches;
+	queue.StopReceivingNotifications();
+	printf("%-16s %.2f switches/event, p50 %.1fus, p99 %.1fus\n",
+		pszName,
+		(double)ullSwitches / BENCH_EVENTS,
+		handler.m_Latency.GetPercentile(50) / 1000.0,
+		handler.m_Latency.GetPercentile(99) / 1000.0
+		);
+}
+
+int main()
+{
+	printf("%d events, one every %dus\n", BENCH_EVENTS, BENCH_INTERVAL);
+	Run(QUEUE_LOCKED, "QUEUE_LOCKED");
+	Run(QUEUE_LOCK_FREE, "QUEUE_LOCK_FREE");
+	Run(QUEUE_INLINE, "QUEUE_INLINE");
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,102 @@
+//---------------------------------------------------------------------------
+//
+// BenchStringTable.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Benchmark of the string table (ConsCtl/StringTable.h)
+//
+// DESCRIPTION:
+//              3,000 paths of 67 characters are interned. Prints the bytes
+//              they take in the table against as MAX_PATH arrays, the time
+//              of Resolve() against that of copying a MAX_PATH array, the
+//              time of Intern() of a string already there and of hashing
+//              it, and the sizes of a queued item and of a cache record.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/StringTable.h"
+#include "../ConsCtl/ProcessCache.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+#define BENCH_PATHS             3000
+#define BENCH_PATH_LENGTH       67
+#define BENCH_ROUNDS            1000
+
+int main()
+{
+	CStringTable       table;
+	STRING_TABLE_STATS stats;
+	vector<wstring>    paths;
+	vector<DWORD>      ids;
+	volatile size_t    nSink = 0;
+	WCHAR              szCopy[MAX_PATH];
+	LONGLONG           llStart;
+
+	for (DWORD i = 0; i < BENCH_PATHS; i++)
+	{
+		wstring path = L"/usr/lib/x86_64-linux-gnu/bench/" + to_wstring(100000 + i) + L"/";
+
+		path.resize(BENCH_PATH_LENGTH, L'x');
+		paths.push_back(path);
+		ids.push_back(table.Intern(path.c_str()));
+	} // for
+	table.GetStats(stats);
+	printf("%d paths of %d characters: %lluKB as strings, %lluKB in the arena, %lluKB as MAX_PATH arrays\n",
+		BENCH_PATHS,
+		BENCH_PATH_LENGTH,
+		(unsigned long long)stats.ullStringBytes / 1024,
+		(unsigned long long)stats.ullArenaBytes / 1024,
+		(unsigned long long)(BENCH_PATHS * sizeof(szCopy)) / 1024
+		);
+
+	llStart = QueryTimestamp();
+	for (DWORD j = 0; j < BENCH_ROUNDS; j++)
+		for (DWORD i = 0; i < BENCH_PATHS; i++)
+			nSink = nSink + (size_t)table.Resolve(ids[i]);
+	printf("Resolve():           %5.1fns\n", NanosecondsSince(llStart) / (BENCH_ROUNDS * BENCH_PATHS));
+
+	llStart = QueryTimestamp();
+	for (DWORD j = 0; j < BENCH_ROUNDS; j++)
+		for (DWORD i = 0; i < BENCH_PATHS; i++)
+		{
+			memcpy(szCopy, paths[i].c_str(), sizeof(szCopy));
+			nSink = nSink + szCopy[i % MAX_PATH];
+		} // for
+	printf("MAX_PATH copy:       %5.1fns\n", NanosecondsSince(llStart) / (BENCH_ROUNDS * BENCH_PATHS));
+
+	llStart = QueryTimestamp();
+	for (DWORD j = 0; j < BENCH_ROUNDS / 10; j++)
+		for (DWORD i = 0; i < BENCH_PATHS; i++)
+			nSink = nSink + table.Intern(paths[i].c_str());
+	printf("Intern(), present:   %5.1fns\n", NanosecondsSince(llStart) / (BENCH_ROUNDS / 10 * BENCH_PATHS));
+
+	llStart = QueryTimestamp();
+	for (DWORD j = 0; j < BENCH_ROUNDS / 10; j++)
+		for (DWORD i = 0; i < BENCH_PATHS; i++)
+			nSink = nSink + hash<wstring_view>()(wstring_view(paths[i].c_str()));
+	printf("  of which hashing:  %5.1fns\n", NanosecondsSince(llStart) / (BENCH_ROUNDS / 10 * BENCH_PATHS));
+
+	printf("sizeof(QUEUED_ITEM) %u, sizeof(PROCESS_INFO) %u\n",
+		(unsigned)sizeof(QUEUED_ITEM),
+		(unsigned)sizeof(PROCESS_INFO)
+		);
+
+	return 0;
+}
+
+//----------------------------End of the file -------------------------------
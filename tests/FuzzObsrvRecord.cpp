@@ -0,0 +1,275 @@
+//---------------------------------------------------------------------------
+//
+// FuzzObsrvRecord.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Fuzz target of the record decoder (Shared/ObsrvRecord.h)
+//
+// DESCRIPTION:
+//              Whatever bytes it is given, the decoder either rejects them
+//              or returns a record within them: every string and entry it
+//              points to lies inside the record, and the image and thread
+//              walks find as many entries as it counted. The bytes are
+//              copied into a buffer of their exact size, thus a sanitizer
+//              catches any read past them.
+//
+//              Built with -DOBSRV_LIBFUZZER and -fsanitize=fuzzer (clang)
+//              it is a libFuzzer target. Otherwise it runs on its own, as
+//              ctest does, mutating valid records of every kind at random:
+//              flipped bytes, lengths and sizes changed, cut short.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvRecord.h"
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Mutated records the standalone run decodes
+//
+#define FUZZ_RUNS               200000
+
+//
+// Whether cch characters at pszText lie within the record
+//
+static BOOL IsInside(
+	const BYTE*      pbRecord,
+	OBSRV_U32        cbRecord,
+	const OBSRV_U16* pszText,
+	OBSRV_U32        cchText
+	)
+{
+	const BYTE* pbText = (const BYTE*)pszText;
+
+	return (pbText >= pbRecord) && (pbText <= pbRecord + cbRecord) &&
+	       ((size_t)cchText * sizeof(OBSRV_U16) <= (size_t)(pbRecord + cbRecord - pbText));
+}
+
+//
+// Sum of the characters, thus every one of them is read
+//
+static OBSRV_U32 Touch(
+	const OBSRV_U16* pszText,
+	OBSRV_U32        cchText
+	)
+{
+	OBSRV_U32 nSum = 0;
+
+	for (OBSRV_U32 i = 0; i < cchText; i++)
+		nSum += pszText[i];
+
+	return nSum;
+}
+
+//
+// Decode cbData bytes and check what the decoder made of them
+//
+static void DecodeOne(
+	const BYTE* pbData,
+	size_t      cbData
+	)
+{
+	vector<BYTE>       buffer(pbData, pbData + cbData);
+	const BYTE*        pbRecord = buffer.empty() ? NULL : &buffer[0];
+	OBSRV_RECORD_VIEW  view;
+	OBSRV_IMAGE_VIEW   image;
+	OBSRV_THREAD_ENTRY thread;
+	OBSRV_U32          cbRecord = ObsrvRecordDecode(pbRecord, buffer.size(), &view);
+	OBSRV_U32          nOffset;
+	OBSRV_U32          nCount;
+	volatile OBSRV_U32 nSink = 0;
+
+	if (0 == cbRecord)
+		return;
+	CHECK(cbRecord <= buffer.size());
+	CHECK(0 == (cbRecord & 7));
+	CHECK(cbRecord == view.Size);
+	if (NULL != view.ImagePath)
+	{
+		CHECK(IsInside(pbRecord, cbRecord, view.ImagePath, view.ImagePathLength));
+		nSink = nSink + Touch(view.ImagePath, view.ImagePathLength);
+	}
+	if (NULL != view.CommandLine)
+	{
+		CHECK(IsInside(pbRecord, cbRecord, view.CommandLine, view.CommandLineLength));
+		nSink = nSink + Touch(view.CommandLine, view.CommandLineLength);
+	}
+	for (nOffset = 0, nCount = 0; ObsrvRecordNextImage(pbRecord, &nOffset, &image); nCount++)
+	{
+		CHECK(nOffset <= cbRecord);
+		CHECK(IsInside(pbRecord, cbRecord, image.ImagePath, image.ImagePathLength));
+		nSink = nSink + Touch(image.ImagePath, image.ImagePathLength);
+	} // for
+	CHECK(view.ImageCount == nCount);
+	for (nOffset = 0, nCount = 0; ObsrvRecordNextThread(pbRecord, &nOffset, &thread); nCount++)
+	{
+		CHECK(nOffset <= cbRecord);
+		nSink = nSink + thread.ProcessId;
+	} // for
+	CHECK(view.ThreadCount == nCount);
+}
+
+#if defined(OBSRV_LIBFUZZER)
+
+extern "C" int LLVMFuzzerTestOneInput(
+	const uint8_t* pbData,
+	size_t         cbData
+	)
+{
+	DecodeOne(pbData, cbData);
+	if (0 != g_nTestFailures)
+		abort();
+
+	return 0;
+}
+
+#else
+
+//
+// A valid record of a kind chosen at random
+//
+static size_t MakeRecord(
+	BYTE*  pbBuffer,
+	size_t cbBuffer
+	)
+{
+	OBSRV_RECORD_WRITER writer;
+	OBSRV_THREAD_ENTRY  thread;
+	OBSRV_U16           szText[300];
+	OBSRV_U32           nKind = 1 + rand() % 4;
+
+	for (DWORD i = 0; i < sizeof(szText) / sizeof(szText[0]); i++)
+		szText[i] = (OBSRV_U16)('A' + rand() % 26);
+	ObsrvRecordBegin(&writer, pbBuffer, (OBSRV_U32)cbBuffer, (OBSRV_U8)nKind, rand(), rand());
+	ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, rand());
+	switch (nKind)
+	{
+		case OBSRV_KIND_PROCESS_CREATE:
+		case OBSRV_KIND_PROCESS_EXIT:
+			ObsrvRecordPutU32(&writer, OBSRV_TAG_PARENT_ID, rand());
+			ObsrvRecordPutU32(&writer, OBSRV_TAG_SESSION_ID, rand());
+			ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, szText, rand() % 300);
+			ObsrvRecordPutString(&writer, OBSRV_TAG_COMMAND_LINE, szText, rand() % 300);
+			break;
+		case OBSRV_KIND_IMAGE_LOAD:
+			for (DWORD i = rand() % 8; i > 0; i--)
+				ObsrvRecordPutImage(&writer, rand(), rand(), 0, szText, rand() % 100, TRUE);
+			break;
+		default:
+			::ZeroMemory(&thread, sizeof(thread));
+			for (DWORD i = rand() % 16; i > 0; i--)
+			{
+				thread.ProcessId = rand();
+				ObsrvRecordPut(&writer, OBSRV_TAG_THREAD, &thread, sizeof(thread));
+			} // for
+			break;
+	}
+	if (0 == rand() % 4)
+		ObsrvRecordPutU32(&writer, 20 + rand() % 40, rand());
+
+	return ObsrvRecordEnd(&writer);
+}
+
+//
+// Break a record the way a bad producer or a corrupt buffer would
+//
+static size_t Mutate(
+	BYTE*  pbBuffer,
+	size_t cbRecord,
+	size_t cbBuffer
+	)
+{
+	for (DWORD i = 1 + rand() % 4; i > 0; i--)
+	{
+		switch (rand() % 5)
+		{
+			case 0:
+				//
+				// Flip a byte
+				//
+				pbBuffer[rand() % cbRecord] ^= (BYTE)(1 << (rand() % 8));
+				break;
+			case 1:
+			{
+				//
+				// Change a field length, or the record size
+				//
+				OBSRV_U16 nValue = (OBSRV_U16)rand();
+				size_t    nAt = sizeof(OBSRV_RECORD_HEADER) + (rand() % cbRecord);
+
+				if (nAt + sizeof(nValue) <= cbRecord)
+					memcpy(pbBuffer + nAt, &nValue, sizeof(nValue));
+				break;
+			}
+			case 2:
+			{
+				OBSRV_U32 cbSize = (OBSRV_U32)((rand() % 2) ? (rand() % cbBuffer) : (cbRecord + 8 * (rand() % 4)));
+
+				memcpy(pbBuffer, &cbSize, sizeof(cbSize));
+				break;
+			}
+			case 3:
+				//
+				// Cut it short
+				//
+				cbRecord = 1 + rand() % cbRecord;
+				break;
+			default:
+				//
+				// Random bytes at random places
+				//
+				for (DWORD j = rand() % 16; j > 0; j--)
+					pbBuffer[rand() % cbRecord] = (BYTE)rand();
+				break;
+		}
+	} // for
+
+	return cbRecord;
+}
+
+int main()
+{
+	vector<BYTE> buffer(OBSRV_RECORD_MAX_SIZE);
+
+	srand(6);
+	for (DWORD i = 0; i < FUZZ_RUNS; i++)
+	{
+		OBSRV_RECORD_VIEW view;
+		size_t            cbRecord = MakeRecord(&buffer[0], buffer.size());
+
+		CHECK(0 != cbRecord);
+		if (0 == cbRecord)
+			break;
+		//
+		// Unbroken ones decode as well
+		//
+		if (0 == i % 8)
+			CHECK(cbRecord == ObsrvRecordDecode(&buffer[0], cbRecord, &view));
+		cbRecord = Mutate(&buffer[0], cbRecord, buffer.size());
+		DecodeOne(&buffer[0], cbRecord);
+		if (0 != g_nTestFailures)
+			break;
+	} // for
+
+	return TestResult("FuzzObsrvRecord");
+}
+
+#endif // defined(OBSRV_LIBFUZZER)
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,279 @@
+//---------------------------------------------------------------------------
+//
+// TestAsyncDispatcher.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the callback handlers written as C++20 coroutines
+//              (ConsCtl/AsyncDispatcher.h)
+//
+// DESCRIPTION:
+//              Every event is handled once, with the parameter it came
+//              with. The events of a process are handled one after the
+//              other and in order, those of different processes overlap
+//              while suspended, up to the number in flight allowed, and
+//              the dispatch waits beyond it. Handlers that don't suspend
+//              are done when the dispatch returns, and a handler that
+//              throws frees its slot like any other.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "TestIoService.h"
+#include "../ConsCtl/AsyncDispatcher.h"
+#include <map>
+#include <stdexcept>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A coroutine handler waiting for the simulated I/O, or not at all, and
+// recording the events it has handled. Events with an exit status of 1
+// make it throw.
+//
+class CTestAsyncHandler: public CAsyncCallbackHandler
+{
+public:
+	CTestAsyncHandler(
+		CTestIoService* pService,
+		DWORD           dwDelayMicroseconds,
+		PVOID           pvExpected
+		):
+		m_pService(pService),
+		m_dwDelay(dwDelayMicroseconds),
+		m_pvExpected(pvExpected),
+		m_dwRunning(0),
+		m_dwMostRunning(0),
+		m_dwOverlapping(0),
+		m_dwWrongParam(0)
+	{
+	}
+	virtual CHandlerTask OnProcessEventAsync(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		Enter(pQueuedItem->hProcessId, pvParam);
+		if (NULL != m_pService)
+			co_await m_pService->Delay(m_dwDelay);
+		Leave(pQueuedItem->hProcessId);
+		if (1 == pQueuedItem->dwExitStatus)
+			throw std::runtime_error("handler failed");
+		m_Recorder.OnProcessEvent(pQueuedItem, pvParam);
+	}
+	CRecordingHandler& GetRecorder()
+	{
+		return m_Recorder;
+	}
+	DWORD GetMostRunning() const
+	{
+		return m_dwMostRunning;
+	}
+	DWORD GetOverlapping() const
+	{
+		return m_dwOverlapping;
+	}
+	DWORD GetWrongParam() const
+	{
+		return m_dwWrongParam;
+	}
+private:
+	//
+	// Count the coroutines running, those of a process running along
+	// with another of the same process, and the wrong parameters
+	//
+	void Enter(
+		DWORD dwProcessId,
+		PVOID pvParam
+		)
+	{
+		CLockMgr<CCSWrapper> guard(m_csRunning, TRUE);
+
+		if (pvParam != m_pvExpected)
+			m_dwWrongParam++;
+		if (0 != m_Running[dwProcessId]++)
+			m_dwOverlapping++;
+		if (++m_dwRunning > m_dwMostRunning)
+			m_dwMostRunning = m_dwRunning;
+	}
+	void Leave(DWORD dwProcessId)
+	{
+		CLockMgr<CCSWrapper> guard(m_csRunning, TRUE);
+
+		m_Running[dwProcessId]--;
+		m_dwRunning--;
+	}
+
+	CTestIoService*   m_pService;
+	DWORD             m_dwDelay;
+	PVOID             m_pvExpected;
+	CRecordingHandler m_Recorder;
+	CCSWrapper        m_csRunning;
+	map<DWORD, DWORD> m_Running;
+	DWORD             m_dwRunning;
+	DWORD             m_dwMostRunning;
+	DWORD             m_dwOverlapping;
+	DWORD             m_dwWrongParam;
+};
+
+//
+// Dispatch dwEvents events round robin over dwProcesses processes, in
+// batches of dwBatch. The index of an event within its process is in
+// hParentId.
+//
+static void Dispatch(
+	CAsyncDispatcher& dispatcher,
+	DWORD             dwProcesses,
+	DWORD             dwEvents,
+	DWORD             dwBatch,
+	PVOID             pvParam
+	)
+{
+	vector<QUEUED_ITEM> batch;
+
+	for (DWORD i = 0; i < dwEvents; i++)
+	{
+		batch.push_back(MakeProcessEvent(1000 + i % dwProcesses, i / dwProcesses, 0 == i / dwProcesses));
+		if ((batch.size() == dwBatch) || (i + 1 == dwEvents))
+		{
+			dispatcher.OnProcessEvents(&batch[0], (DWORD)batch.size(), pvParam);
+			batch.clear();
+		}
+	} // for
+}
+
+//
+// Whether the events of every process came in order
+//
+static BOOL IsProcessOrder(const vector<QUEUED_ITEM>& events)
+{
+	map<DWORD, DWORD> next;
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		if (next[events[i].hProcessId] != events[i].hParentId)
+			return FALSE;
+		next[events[i].hProcessId] = events[i].hParentId + 1;
+	} // for
+
+	return TRUE;
+}
+
+//
+// Coroutines suspended on I/O, more events than slots
+//
+static void TestInFlight()
+{
+	CTestIoService      service;
+	int                 nParam;
+	CTestAsyncHandler   handler(&service, 5000, &nParam);
+	vector<QUEUED_ITEM> events;
+	DWORD               dwTotal = 400;
+	LONGLONG            llStart = QueryTimestamp();
+
+	{
+		CAsyncDispatcher dispatcher(&handler, 16);
+
+		Dispatch(dispatcher, 40, dwTotal, 64, &nParam);
+		CHECK(dispatcher.GetInFlight() <= 16);
+		CHECK(0 != dispatcher.GetWaits());
+		dispatcher.WaitUntilIdle();
+		CHECK(0 == dispatcher.GetInFlight());
+	}
+	//
+	// One at a time would take 2s
+	//
+	CHECK(NanosecondsSince(llStart) < 1e9);
+	events = handler.GetRecorder().GetEvents();
+	CHECK(dwTotal == events.size());
+	CHECK(IsProcessOrder(events));
+	CHECK(handler.GetMostRunning() > 1);
+	CHECK(handler.GetMostRunning() <= 16);
+	CHECK(0 == handler.GetOverlapping());
+	CHECK(0 == handler.GetWrongParam());
+}
+
+//
+// Handlers that never suspend are done once the dispatch returns
+//
+static void TestSynchronous()
+{
+	CTestAsyncHandler handler(NULL, 0, NULL);
+	CAsyncDispatcher  dispatcher(&handler, 4);
+
+	Dispatch(dispatcher, 3, 100, 10, NULL);
+	CHECK(0 == dispatcher.GetInFlight());
+	CHECK(0 == dispatcher.GetWaits());
+	CHECK(100 == handler.GetRecorder().GetCount());
+	CHECK(IsProcessOrder(handler.GetRecorder().GetEvents()));
+	CHECK(1 == handler.GetMostRunning());
+	//
+	// A single event, or none
+	//
+	QUEUED_ITEM item = MakeProcessEvent(2000, 0, TRUE);
+
+	dispatcher.OnProcessEvent(&item, NULL);
+	dispatcher.OnProcessEvent(NULL, NULL);
+	CHECK(101 == handler.GetRecorder().GetCount());
+}
+
+//
+// A handler that throws frees its slot, and the next event of its
+// process is started all the same
+//
+static void TestException()
+{
+	CTestIoService      service;
+	CTestAsyncHandler   handler(&service, 1000, NULL);
+	vector<QUEUED_ITEM> batch;
+
+	{
+		CAsyncDispatcher dispatcher(&handler, 2);
+
+		for (DWORD i = 0; i < 20; i++)
+		{
+			batch.push_back(MakeProcessEvent(1000 + i % 2, i / 2, FALSE));
+			batch.back().dwExitStatus = i % 3;
+		} // for
+		dispatcher.OnProcessEvents(&batch[0], (DWORD)batch.size(), NULL);
+		dispatcher.WaitUntilIdle();
+		CHECK(0 == dispatcher.GetInFlight());
+	}
+	//
+	// i % 3 == 1 for 7 of the 20
+	//
+	CHECK(13 == handler.GetRecorder().GetCount());
+	vector<QUEUED_ITEM> events = handler.GetRecorder().GetEvents();
+	map<DWORD, DWORD>   next;
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		CHECK(1 != events[i].dwExitStatus);
+		CHECK(next[events[i].hProcessId] <= events[i].hParentId);
+		next[events[i].hProcessId] = events[i].hParentId + 1;
+	} // for
+	CHECK(0 == handler.GetOverlapping());
+}
+
+int main()
+{
+	TestInFlight();
+	TestSynchronous();
+	TestException();
+
+	return TestResult("TestAsyncDispatcher");
+}
+
+//----------------------------End of the file -------------------------------
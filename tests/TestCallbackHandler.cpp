@@ -0,0 +1,285 @@
+//---------------------------------------------------------------------------
+//
+// TestCallbackHandler.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the batch delivery to the callback handler
+//              (ConsCtl/CallbackHandler.h)
+//
+// DESCRIPTION:
+//              The default OnProcessEvents() hands every event of a batch
+//              to the method of its kind, in order, with the parameter of
+//              the queue, and a lifetime as its create and its exit. While
+//              the handler is busy, QUEUE_LOCKED collects everything
+//              appended and hands it over in a single call; QUEUE_LOCK_FREE
+//              in calls of at most 256 events.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events appended while the handler is held, and the most the lock-free
+// build hands over per call
+//
+#define TEST_ELEMENTS           600
+#define TEST_LOCK_FREE_BATCH    256
+
+//
+// The method an event has been handed to
+//
+enum TEST_METHOD
+{
+	TEST_ON_PROCESS,
+	TEST_ON_IMAGE,
+	TEST_ON_THREAD,
+	TEST_ON_CHANGE
+};
+
+//
+// A handler overriding the methods of every kind but lifetimes, noting
+// which one each event went to
+//
+class CRoutingHandler: public CCallbackHandler
+{
+public:
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		Note(TEST_ON_PROCESS, pQueuedItem, pvParam);
+	}
+	virtual void OnImageEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		Note(TEST_ON_IMAGE, pQueuedItem, pvParam);
+	}
+	virtual void OnThreadEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		Note(TEST_ON_THREAD, pQueuedItem, pvParam);
+	}
+	virtual void OnProcessChangeEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		Note(TEST_ON_CHANGE, pQueuedItem, pvParam);
+	}
+	vector<TEST_METHOD> m_Methods;
+	vector<QUEUED_ITEM> m_Events;
+	vector<PVOID>       m_Params;
+private:
+	void Note(
+		TEST_METHOD  eMethod,
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		m_Methods.push_back(eMethod);
+		m_Events.push_back(*pQueuedItem);
+		m_Params.push_back(pvParam);
+	}
+};
+
+//
+// A handler noting the size of every batch, held in its first call
+// until released
+//
+class CBatchHandler: public CRecordingHandler
+{
+public:
+	CBatchHandler():
+		m_evtEntered(::CreateEvent(NULL, TRUE, FALSE, NULL)),
+		m_evtRelease(::CreateEvent(NULL, TRUE, FALSE, NULL))
+	{
+	}
+	virtual ~CBatchHandler()
+	{
+		::CloseHandle(m_evtEntered);
+		::CloseHandle(m_evtRelease);
+	}
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		)
+	{
+		::SetEvent(m_evtEntered);
+		::WaitForSingleObject(m_evtRelease, INFINITE);
+		{
+			CLockMgr<CCSWrapper> guard(m_csBatches, TRUE);
+			m_Batches.push_back(dwCount);
+		}
+		CRecordingHandler::OnProcessEvents(pQueuedItems, dwCount, pvParam);
+	}
+	BOOL WaitEntered()
+	{
+		return (WAIT_OBJECT_0 == ::WaitForSingleObject(m_evtEntered, 5000));
+	}
+	void Release()
+	{
+		::SetEvent(m_evtRelease);
+	}
+	vector<DWORD> GetBatches()
+	{
+		CLockMgr<CCSWrapper> guard(m_csBatches, TRUE);
+
+		return m_Batches;
+	}
+private:
+	HANDLE        m_evtEntered;
+	HANDLE        m_evtRelease;
+	CCSWrapper    m_csBatches;
+	vector<DWORD> m_Batches;
+};
+
+//
+// An event of the given kind, numbered by its process ID
+//
+static QUEUED_ITEM MakeEvent(
+	QUEUED_ITEM_KIND eKind,
+	DWORD            dwProcessId
+	)
+{
+	QUEUED_ITEM item = MakeProcessEvent(dwProcessId, 1, TRUE);
+
+	item.eKind = eKind;
+
+	return item;
+}
+
+static void TestRouting()
+{
+	CRoutingHandler handler;
+	int             nParam = 0;
+	QUEUED_ITEM     batch[] =
+	{
+		MakeEvent(QUEUED_ITEM_PROCESS, 1),
+		MakeEvent(QUEUED_ITEM_IMAGE_LOAD, 2),
+		MakeEvent(QUEUED_ITEM_THREAD, 3),
+		MakeEvent(QUEUED_ITEM_EXEC, 4),
+		MakeEvent(QUEUED_ITEM_UID, 5),
+		MakeEvent(QUEUED_ITEM_LIFETIME, 6),
+		MakeEvent(QUEUED_ITEM_PROCESS, 7)
+	};
+	const TEST_METHOD eExpected[] =
+	{
+		TEST_ON_PROCESS,
+		TEST_ON_IMAGE,
+		TEST_ON_THREAD,
+		TEST_ON_CHANGE,
+		TEST_ON_CHANGE,
+		TEST_ON_PROCESS,
+		TEST_ON_PROCESS,
+		TEST_ON_PROCESS
+	};
+	const DWORD dwExpected[] = { 1, 2, 3, 4, 5, 6, 6, 7 };
+	DWORD       dwCount = sizeof(eExpected) / sizeof(eExpected[0]);
+
+	batch[5].llSourceTime = 100;
+	batch[5].llExitTime   = 200;
+	batch[6].bCreate      = FALSE;
+	handler.OnProcessEvents(batch, sizeof(batch) / sizeof(batch[0]), &nParam);
+	CHECK(dwCount == handler.m_Methods.size());
+	if (dwCount != handler.m_Methods.size())
+		return;
+	for (DWORD i = 0; i < dwCount; i++)
+	{
+		CHECK(eExpected[i] == handler.m_Methods[i]);
+		CHECK(dwExpected[i] == handler.m_Events[i].hProcessId);
+		CHECK(&nParam == handler.m_Params[i]);
+	} // for
+	//
+	// The lifetime is a create at its start and an exit at its end
+	//
+	CHECK(QUEUED_ITEM_PROCESS == handler.m_Events[5].eKind);
+	CHECK(handler.m_Events[5].bCreate);
+	CHECK(100 == handler.m_Events[5].llSourceTime);
+	CHECK(QUEUED_ITEM_PROCESS == handler.m_Events[6].eKind);
+	CHECK(!handler.m_Events[6].bCreate);
+	CHECK(200 == handler.m_Events[6].llSourceTime);
+	CHECK(!handler.m_Events[7].bCreate);
+	//
+	// The batch itself is left as it was
+	//
+	CHECK(QUEUED_ITEM_LIFETIME == batch[5].eKind);
+}
+
+//
+// The handler is held on a first event while more are appended, then
+// released
+//
+static void TestBatches(QUEUE_IMPLEMENTATION eImplementation)
+{
+	CBatchHandler       handler;
+	CQueueContainer     queue(&handler, eImplementation);
+	int                 nParam = 0;
+	vector<QUEUED_ITEM> events;
+	vector<DWORD>       batches;
+
+	queue.SetExternalParam(&nParam);
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(queue.Append(MakeProcessEvent(1000, 1, TRUE)));
+	CHECK(handler.WaitEntered());
+	for (DWORD i = 1; i <= TEST_ELEMENTS; i++)
+		CHECK(queue.Append(MakeProcessEvent(1000 + i, 1, TRUE)));
+	handler.Release();
+	CHECK(handler.WaitForCount(TEST_ELEMENTS + 1, 10000));
+	queue.StopReceivingNotifications();
+	events = handler.GetEvents();
+	batches = handler.GetBatches();
+	CHECK(TEST_ELEMENTS + 1 == events.size());
+	for (size_t i = 0; i < events.size(); i++)
+		CHECK(1000 + i == events[i].hProcessId);
+	CHECK(batches.size() >= 2);
+	if (batches.size() < 2)
+		return;
+	CHECK(1 == batches[0]);
+	if (QUEUE_LOCKED == eImplementation)
+	{
+		//
+		// Everything appended meanwhile, swapped out at once
+		//
+		CHECK(2 == batches.size());
+		CHECK(TEST_ELEMENTS == batches[1]);
+	}
+	else
+	{
+		CHECK(TEST_LOCK_FREE_BATCH == batches[1]);
+		for (size_t i = 1; i < batches.size(); i++)
+			CHECK(batches[i] <= TEST_LOCK_FREE_BATCH);
+	}
+}
+
+int main()
+{
+	TestRouting();
+	TestBatches(QUEUE_LOCKED);
+	TestBatches(QUEUE_LOCK_FREE);
+
+	return TestResult("TestCallbackHandler");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,141 @@
+//---------------------------------------------------------------------------
+//
+// TestCommandLineTable.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the command line table (ConsCtl/CommandLineTable.h)
+//
+// DESCRIPTION:
+//              Every command line added gets an ID of its own, even one
+//              added before, and resolves to a copy of it. The oldest go
+//              once the budget is used up, never more than needed, and
+//              resolving them fails and is counted. Empty command lines
+//              and those larger than the budget are not kept.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/CommandLineTable.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Command lines added, each taking TEST_BYTES with its terminating zero
+//
+#define TEST_LINES              100
+#define TEST_BYTES              (16 * sizeof(WCHAR))
+
+//
+// A command line of 15 characters made up of a number
+//
+static wstring MakeCommandLine(DWORD dwNumber)
+{
+	wstring commandLine = L"cc -c " + to_wstring(100000 + dwNumber);
+
+	commandLine.resize(15, L'x');
+
+	return commandLine;
+}
+
+//
+// Adding and resolving within the budget
+//
+static void TestAdd()
+{
+	CCommandLineTable        table;
+	COMMAND_LINE_TABLE_STATS stats;
+	wstring                  commandLine;
+	DWORD                    dwFirst;
+
+	CHECK(COMMAND_LINE_TABLE_NO_ID == table.Add(NULL));
+	CHECK(COMMAND_LINE_TABLE_NO_ID == table.Add(L""));
+	CHECK(!table.Resolve(COMMAND_LINE_TABLE_NO_ID, commandLine));
+	CHECK(!table.Resolve(1, commandLine));
+	dwFirst = table.Add(MakeCommandLine(0).c_str());
+	CHECK(COMMAND_LINE_TABLE_NO_ID != dwFirst);
+	//
+	// The same command line again is another one
+	//
+	CHECK(dwFirst + 1 == table.Add(MakeCommandLine(0).c_str()));
+	CHECK(table.Resolve(dwFirst, commandLine));
+	CHECK(MakeCommandLine(0) == commandLine);
+	CHECK(table.Resolve(dwFirst + 1, commandLine));
+	CHECK(MakeCommandLine(0) == commandLine);
+	//
+	// A failed resolve leaves the string as it was
+	//
+	CHECK(!table.Resolve(dwFirst + 2, commandLine));
+	CHECK(MakeCommandLine(0) == commandLine);
+	table.GetStats(stats);
+	CHECK(2 == stats.ullAdded);
+	CHECK(0 == stats.ullEvicted);
+	CHECK(2 == stats.ullMissed);
+	CHECK(2 == stats.dwStrings);
+	CHECK(2 * TEST_BYTES == stats.ullBytes);
+}
+
+//
+// The oldest go for room
+//
+static void TestEviction()
+{
+	CCommandLineTable        table(10 * TEST_BYTES);
+	COMMAND_LINE_TABLE_STATS stats;
+	wstring                  commandLine;
+	vector<DWORD>            ids;
+
+	for (DWORD i = 0; i < TEST_LINES; i++)
+		ids.push_back(table.Add(MakeCommandLine(i).c_str()));
+	for (DWORD i = 0; i < TEST_LINES; i++)
+	{
+		CHECK(COMMAND_LINE_TABLE_NO_ID != ids[i]);
+		CHECK((i + 10 >= TEST_LINES) == table.Resolve(ids[i], commandLine));
+	} // for
+	CHECK(table.Resolve(ids[TEST_LINES - 10], commandLine));
+	CHECK(MakeCommandLine(TEST_LINES - 10) == commandLine);
+	table.GetStats(stats);
+	CHECK(TEST_LINES == stats.ullAdded);
+	CHECK(TEST_LINES - 10 == stats.ullEvicted);
+	CHECK(TEST_LINES - 10 == stats.ullMissed);
+	CHECK(10 == stats.dwStrings);
+	CHECK(10 * TEST_BYTES == stats.ullBytes);
+	//
+	// A longer one takes the room of two
+	//
+	commandLine = MakeCommandLine(0) + MakeCommandLine(1);
+	CHECK(COMMAND_LINE_TABLE_NO_ID != table.Add(commandLine.c_str()));
+	table.GetStats(stats);
+	CHECK(TEST_LINES - 8 == stats.ullEvicted);
+	CHECK(9 == stats.dwStrings);
+	//
+	// One larger than the budget is not kept, and takes nothing out
+	//
+	commandLine.resize(10 * TEST_BYTES / sizeof(WCHAR), L'x');
+	CHECK(COMMAND_LINE_TABLE_NO_ID == table.Add(commandLine.c_str()));
+	table.GetStats(stats);
+	CHECK(TEST_LINES + 1 == stats.ullAdded);
+	CHECK(9 == stats.dwStrings);
+}
+
+int main()
+{
+	TestAdd();
+	TestEviction();
+
+	return TestResult("TestCommandLineTable");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,211 @@
+//---------------------------------------------------------------------------
+//
+// TestCommon.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Checks, timing and a recording handler shared by the
+//              test programs
+//
+// DESCRIPTION:
+//              A test program is a main() running checks. A check that
+//              fails prints where it is and is counted, and the program
+//              returns non-zero if any check has failed, thus ctest
+//              reports it as failed. The Bench programs only print what
+//              they measure and are not run by ctest.
+//
+//---------------------------------------------------------------------------
+#if !defined(_TESTCOMMON_H_)
+#define _TESTCOMMON_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "../ConsCtl/Common.h"
+#include "../ConsCtl/CallbackHandler.h"
+#include "../ConsCtl/LatencyHistogram.h"
+#include "../ConsCtl/LockMgr.h"
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------------
+//
+// Checks
+//
+//---------------------------------------------------------------------------
+
+//
+// Checks failed so far
+//
+inline int g_nTestFailures = 0;
+
+inline void TestFailed(
+	const char* pszFile,
+	int         nLine,
+	const char* pszCondition
+	)
+{
+	printf("%s(%d): check failed: %s\n", pszFile, nLine, pszCondition);
+	fflush(stdout);
+	g_nTestFailures++;
+}
+
+#define CHECK(bCondition)  \
+	((bCondition) ? (void)0 : TestFailed(__FILE__, __LINE__, #bCondition))
+
+//
+// The exit code of a test program
+//
+inline int TestResult(const char* pszName)
+{
+	if (0 == g_nTestFailures)
+		printf("%s: all checks passed\n", pszName);
+	else
+		printf("%s: %d checks failed\n", pszName, g_nTestFailures);
+
+	return (0 == g_nTestFailures) ? 0 : 1;
+}
+
+//---------------------------------------------------------------------------
+//
+// Timing
+//
+//---------------------------------------------------------------------------
+
+//
+// Nanoseconds since a QueryTimestamp() value
+//
+inline double NanosecondsSince(LONGLONG llStart)
+{
+	return (double)TimestampToNanoseconds(QueryTimestamp() - llStart);
+}
+
+//---------------------------------------------------------------------------
+//
+// class CRecordingHandler
+//
+// Keeps a copy of every event it is handed, whatever its kind, in the
+// order it was handed. Thread safe. With a delay it sleeps that long per
+// event, as a handler waiting for I/O would.
+//
+//---------------------------------------------------------------------------
+class CRecordingHandler: public CCallbackHandler
+{
+public:
+	CRecordingHandler(DWORD dwDelayMicroseconds = 0):
+		m_dwDelay(dwDelayMicroseconds)
+	{
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pvParam);
+		if (0 != m_dwDelay)
+			std::this_thread::sleep_for(std::chrono::microseconds(m_dwDelay));
+
+		CLockMgr<CCSWrapper> guard(m_csEvents, TRUE);
+
+		m_Events.push_back(*pQueuedItem);
+	}
+	virtual void OnImageEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		OnProcessEvent(pQueuedItem, pvParam);
+	}
+	virtual void OnThreadEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		OnProcessEvent(pQueuedItem, pvParam);
+	}
+	virtual void OnProcessChangeEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		OnProcessEvent(pQueuedItem, pvParam);
+	}
+	virtual void OnProcessLifetimeEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		OnProcessEvent(pQueuedItem, pvParam);
+	}
+	//
+	// A copy of the events handed so far
+	//
+	std::vector<QUEUED_ITEM> GetEvents()
+	{
+		CLockMgr<CCSWrapper> guard(m_csEvents, TRUE);
+
+		return m_Events;
+	}
+	DWORD GetCount()
+	{
+		CLockMgr<CCSWrapper> guard(m_csEvents, TRUE);
+
+		return (DWORD)m_Events.size();
+	}
+	//
+	// Wait until dwCount events have been handed, FALSE if they haven't
+	// within dwTimeout milliseconds
+	//
+	BOOL WaitForCount(
+		DWORD dwCount,
+		DWORD dwTimeout
+		)
+	{
+		for (DWORD dwWaited = 0; GetCount() < dwCount; dwWaited++)
+		{
+			if (dwWaited >= dwTimeout)
+				return FALSE;
+			::Sleep(1);
+		} // for
+
+		return TRUE;
+	}
+private:
+	DWORD                    m_dwDelay;
+	CCSWrapper               m_csEvents;
+	std::vector<QUEUED_ITEM> m_Events;
+};
+
+//
+// A process event
+//
+inline QUEUED_ITEM MakeProcessEvent(
+	DWORD dwProcessId,
+	DWORD dwParentId,
+	BOOL  bCreate
+	)
+{
+	QUEUED_ITEM item;
+
+	::ZeroMemory(&item, sizeof(item));
+	item.eKind        = QUEUED_ITEM_PROCESS;
+	item.hProcessId   = dwProcessId;
+	item.hParentId    = dwParentId;
+	item.bCreate      = bCreate;
+	item.llSourceTime = QueryTimestamp();
+
+	return item;
+}
+
+#endif // !defined(_TESTCOMMON_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,256 @@
+//---------------------------------------------------------------------------
+//
+// TestEnrichmentStage.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the stage reading process details on a pool of
+//              threads (ConsCtl/EnrichmentStage.h)
+//
+// DESCRIPTION:
+//              Creates of this process, of processes that don't exist and
+//              exits, needing no details, are mixed, thus the workers
+//              finish out of order. The handler gets every event, in the
+//              order they came, with the image of this process read. A
+//              reorder buffer far smaller than the events goes round many
+//              times, also within a single batch. A held handler stops
+//              the thread passing events in once the buffer and the
+//              output queue are full.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/EnrichmentStage.h"
+#include "../ConsCtl/StringTable.h"
+#include <unistd.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Process IDs above the largest the kernel gives (4M)
+//
+#define TEST_MISSING_ID         5000000
+
+//
+// A recording handler which doesn't return from its first event until
+// it is let go
+//
+class CHeldHandler: public CRecordingHandler
+{
+public:
+	CHeldHandler():
+		m_evtEntered(::CreateEvent(NULL, TRUE, FALSE, NULL)),
+		m_evtRelease(::CreateEvent(NULL, TRUE, FALSE, NULL))
+	{
+	}
+	virtual ~CHeldHandler()
+	{
+		::CloseHandle(m_evtEntered);
+		::CloseHandle(m_evtRelease);
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		::SetEvent(m_evtEntered);
+		::WaitForSingleObject(m_evtRelease, INFINITE);
+		CRecordingHandler::OnProcessEvent(pQueuedItem, pvParam);
+	}
+	BOOL WaitEntered()
+	{
+		return (WAIT_OBJECT_0 == ::WaitForSingleObject(m_evtEntered, 5000));
+	}
+	void Release()
+	{
+		::SetEvent(m_evtRelease);
+	}
+private:
+	HANDLE m_evtEntered;
+	HANDLE m_evtRelease;
+};
+
+//
+// The i-th event of a mix: a create of this process, a create of one
+// that doesn't exist, or an exit. The session ID keeps the position.
+//
+static QUEUED_ITEM MakeMixedEvent(DWORD i)
+{
+	QUEUED_ITEM item;
+
+	if (0 == i % 3)
+		item = MakeProcessEvent((DWORD)getpid(), 1, TRUE);
+	else if (1 == i % 3)
+		item = MakeProcessEvent(TEST_MISSING_ID + i, 1, TRUE);
+	else
+		item = MakeProcessEvent(TEST_MISSING_ID + i, 1, FALSE);
+	item.dwSessionId = i;
+
+	return item;
+}
+
+//
+// Every event comes out, in the order it went in, the creates of this
+// process with its image
+//
+static void CheckMixedEvents(
+	CRecordingHandler& handler,
+	DWORD              dwEvents
+	)
+{
+	vector<QUEUED_ITEM> events;
+	DWORD               dwOrdered = 0;
+	DWORD               dwImages = 0;
+
+	CHECK(handler.WaitForCount(dwEvents, 30000));
+	events = handler.GetEvents();
+	CHECK(dwEvents == events.size());
+	for (DWORD i = 0; i < events.size(); i++)
+	{
+		if (i == events[i].dwSessionId)
+			dwOrdered++;
+		if ((0 == i % 3) && (STRING_TABLE_NO_ID != events[i].dwImageId))
+			dwImages++;
+	} // for
+	CHECK(dwOrdered == events.size());
+	CHECK((dwEvents + 2) / 3 == dwImages);
+}
+
+//
+// Several workers, batches of various sizes
+//
+static void TestOrder()
+{
+	CRecordingHandler handler;
+	ENRICH_STATS      stats;
+	DWORD             dwEvents = 3000;
+
+	{
+		CEnrichmentStage stage(&handler, 4, 64);
+		DWORD            dwBatch = 1;
+
+		for (DWORD i = 0; i < dwEvents; i += dwBatch)
+		{
+			vector<QUEUED_ITEM> batch;
+
+			dwBatch = 1 + i % 17;
+			for (DWORD j = i; (j < i + dwBatch) && (j < dwEvents); j++)
+				batch.push_back(MakeMixedEvent(j));
+			stage.OnProcessEvents(&batch[0], (DWORD)batch.size(), NULL);
+		} // for
+		CheckMixedEvents(handler, dwEvents);
+		stage.GetStats(stats);
+	}
+	CHECK(dwEvents == stats.ullEvents);
+	CHECK(2 * dwEvents / 3 == stats.ullEnriched);
+	CHECK(dwEvents / 3 == stats.ullSucceeded);
+}
+
+//
+// A buffer of 8 events goes round, with batches far larger than it and
+// events one at a time
+//
+static void TestWrap()
+{
+	CRecordingHandler   handler;
+	DWORD               dwEvents = 999;
+	vector<QUEUED_ITEM> batch;
+
+	CEnrichmentStage stage(&handler, 2, 8);
+
+	for (DWORD i = 0; i < 500; i++)
+		batch.push_back(MakeMixedEvent(i));
+	stage.OnProcessEvents(&batch[0], (DWORD)batch.size(), NULL);
+	for (DWORD i = 500; i < dwEvents; i++)
+	{
+		QUEUED_ITEM item = MakeMixedEvent(i);
+
+		stage.OnProcessEvent(&item, NULL);
+	} // for
+	CheckMixedEvents(handler, dwEvents);
+}
+
+//
+// Events needing nothing only, thus the thread passing them in is the
+// one passing them on
+//
+static void TestWrapUndetailed()
+{
+	CRecordingHandler   handler;
+	vector<QUEUED_ITEM> batch;
+	vector<QUEUED_ITEM> events;
+
+	CEnrichmentStage stage(&handler, 1, 16);
+
+	for (DWORD i = 0; i < 1000; i++)
+		batch.push_back(MakeProcessEvent(i, 1, FALSE));
+	stage.OnProcessEvents(&batch[0], (DWORD)batch.size(), NULL);
+	CHECK(handler.WaitForCount(1000, 10000));
+	events = handler.GetEvents();
+	for (DWORD i = 0; i < events.size(); i++)
+		CHECK(i == events[i].hProcessId);
+}
+
+//
+// While the handler is held no more than the buffer, the output queue
+// and the batch the handler holds get in; the rest follows once it is
+// let go
+//
+static void TestProducerBlocks()
+{
+	CHeldHandler      handler;
+	ENRICH_STATS      stats;
+	DWORD             dwEvents = 1000;
+	DWORD             dwWindow = 16;
+	std::atomic<LONG> lPassed(0);
+	LONG              lStuck;
+
+	CEnrichmentStage stage(&handler, 2, dwWindow);
+
+	thread producer([&stage, &lPassed, dwEvents]()
+	{
+		for (DWORD i = 0; i < dwEvents; i++)
+		{
+			QUEUED_ITEM item = MakeMixedEvent(i);
+
+			stage.OnProcessEvent(&item, NULL);
+			lPassed++;
+		} // for
+	});
+	CHECK(handler.WaitEntered());
+	//
+	// Wait until it is stuck
+	//
+	for (lStuck = -1; lStuck != lPassed.load(); ::Sleep(100))
+		lStuck = lPassed.load();
+	CHECK(lStuck < (LONG)(4 * dwWindow));
+	stage.GetStats(stats);
+	CHECK(stats.ullEvents <= (ULONG64)lStuck + 1);
+	handler.Release();
+	producer.join();
+	CheckMixedEvents(handler, dwEvents);
+}
+
+int main()
+{
+	TestOrder();
+	TestWrap();
+	TestWrapUndetailed();
+	TestProducerBlocks();
+
+	return TestResult("TestEnrichmentStage");
+}
+
+//----------------------------End of the file -------------------------------
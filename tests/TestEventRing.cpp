@@ -0,0 +1,255 @@
+//---------------------------------------------------------------------------
+//
+// TestEventRing.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the ring of events shared by subscribers
+//              (ConsCtl/EventRing.h)
+//
+// DESCRIPTION:
+//              A small ring is written to in batches smaller and larger
+//              than itself. Every RING_LAG_BLOCK subscriber is handed all
+//              events in order, a slow one holding the producer up. A
+//              slow RING_LAG_DROP subscriber is handed what it can keep up
+//              with, in order, and what it is handed and what it has
+//              missed add up to what has been written. A subscriber
+//              writing into its events changes none of the others'.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/EventRing.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events written, the event's index being its process ID
+//
+#define TEST_EVENTS             20000
+
+//
+// Writes into the events it is handed, as wrapping handlers do
+//
+class CStampingHandler: public CRecordingHandler
+{
+public:
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		)
+	{
+		for (DWORD i = 0; i < dwCount; i++)
+			pQueuedItems[i].hParentId = 0xFFFF;
+		CRecordingHandler::OnProcessEvents(pQueuedItems, dwCount, pvParam);
+	}
+};
+
+//
+// Write dwTotal events in batches of 1 to 150 events
+//
+static void Write(
+	CEventRing& ring,
+	DWORD       dwTotal,
+	PVOID       pvParam
+	)
+{
+	vector<QUEUED_ITEM> batch;
+	DWORD               dwIndex = 0;
+
+	while (dwIndex < dwTotal)
+	{
+		DWORD dwCount = 1 + (dwIndex * 7) % 150;
+
+		if (dwCount > dwTotal - dwIndex)
+			dwCount = dwTotal - dwIndex;
+		batch.clear();
+		for (DWORD i = 0; i < dwCount; i++)
+			batch.push_back(MakeProcessEvent(dwIndex++, 0, TRUE));
+		if (1 == dwCount)
+			ring.OnProcessEvent(&batch[0], pvParam);
+		else
+			ring.OnProcessEvents(&batch[0], dwCount, pvParam);
+	} // while
+}
+
+//
+// Wait until a subscriber has been handed or has missed dwTotal events
+//
+static BOOL WaitForSubscriber(
+	CEventRing& ring,
+	DWORD       dwIndex,
+	DWORD       dwTotal
+	)
+{
+	RING_SUBSCRIBER_STATS stats;
+
+	for (DWORD dwWaited = 0; dwWaited < 10000; dwWaited++)
+	{
+		ring.GetSubscriberStats(dwIndex, stats);
+		if (stats.ullDelivered + stats.ullMissed >= dwTotal)
+			return TRUE;
+		::Sleep(1);
+	} // for
+
+	return FALSE;
+}
+
+//
+// Whether the events are in the order written, with gaps if bGaps
+//
+static BOOL IsWriteOrder(
+	const vector<QUEUED_ITEM>& events,
+	BOOL                       bGaps
+	)
+{
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		if (!bGaps && (i != events[i].hProcessId))
+			return FALSE;
+		if ((i > 0) && (events[i - 1].hProcessId >= events[i].hProcessId))
+			return FALSE;
+	} // for
+
+	return TRUE;
+}
+
+//
+// Subscribers are added before the ring starts only
+//
+static void TestSubscribe()
+{
+	CEventRing        ring(100);
+	CRecordingHandler handler;
+
+	CHECK(0 == ring.Subscribe(&handler, RING_LAG_BLOCK));
+	CHECK(1 == ring.Subscribe(&handler, RING_LAG_DROP));
+	CHECK(-1 == ring.Subscribe(NULL, RING_LAG_DROP));
+	CHECK(ring.Start());
+	CHECK(!ring.Start());
+	CHECK(-1 == ring.Subscribe(&handler, RING_LAG_BLOCK));
+	CHECK(2 == ring.GetSubscriberCount());
+	ring.Stop();
+}
+
+//
+// Blocking subscribers get every event, the slowest holds the ring up
+//
+static void TestBlock()
+{
+	CEventRing            ring(64);
+	CRecordingHandler     fast;
+	CRecordingHandler     other;
+	CRecordingHandler     slow(20);
+	RING_SUBSCRIBER_STATS stats;
+
+	ring.Subscribe(&fast, RING_LAG_BLOCK);
+	ring.Subscribe(&other, RING_LAG_BLOCK);
+	ring.Subscribe(&slow, RING_LAG_BLOCK);
+	CHECK(ring.Start());
+	Write(ring, TEST_EVENTS, NULL);
+	for (DWORD i = 0; i < 3; i++)
+		CHECK(WaitForSubscriber(ring, i, TEST_EVENTS));
+	CHECK(fast.WaitForCount(TEST_EVENTS, 10000));
+	CHECK(other.WaitForCount(TEST_EVENTS, 10000));
+	CHECK(slow.WaitForCount(TEST_EVENTS, 10000));
+	ring.Stop();
+	CHECK(IsWriteOrder(fast.GetEvents(), FALSE));
+	CHECK(IsWriteOrder(other.GetEvents(), FALSE));
+	CHECK(IsWriteOrder(slow.GetEvents(), FALSE));
+	for (DWORD i = 0; i < 3; i++)
+	{
+		ring.GetSubscriberStats(i, stats);
+		CHECK(TEST_EVENTS == stats.ullDelivered);
+		CHECK(0 == stats.ullMissed);
+		CHECK(0 == stats.ullLag);
+	} // for
+	CHECK(0 != ring.GetProducerWaits());
+}
+
+//
+// A slow dropping subscriber misses events, never holding the ring up
+// for long
+//
+static void TestDrop()
+{
+	CEventRing            ring(64);
+	CRecordingHandler     blocking;
+	CRecordingHandler     dropping(200);
+	RING_SUBSCRIBER_STATS stats;
+	vector<QUEUED_ITEM>   events;
+
+	ring.Subscribe(&blocking, RING_LAG_BLOCK);
+	ring.Subscribe(&dropping, RING_LAG_DROP);
+	CHECK(ring.Start());
+	Write(ring, TEST_EVENTS, NULL);
+	CHECK(WaitForSubscriber(ring, 0, TEST_EVENTS));
+	CHECK(WaitForSubscriber(ring, 1, TEST_EVENTS));
+	CHECK(blocking.WaitForCount(TEST_EVENTS, 10000));
+	ring.GetSubscriberStats(1, stats);
+	CHECK(dropping.WaitForCount((DWORD)stats.ullDelivered, 10000));
+	ring.Stop();
+	CHECK(IsWriteOrder(blocking.GetEvents(), FALSE));
+	events = dropping.GetEvents();
+	CHECK(IsWriteOrder(events, TRUE));
+	CHECK(events.size() == stats.ullDelivered);
+	CHECK(TEST_EVENTS == stats.ullDelivered + stats.ullMissed);
+	CHECK(0 != stats.ullMissed);
+	CHECK(!events.empty() && (TEST_EVENTS - 1 == events.back().hProcessId));
+}
+
+//
+// Subscribers are handed events of their own
+//
+static void TestWriters()
+{
+	CEventRing          ring(64);
+	CStampingHandler    stamping;
+	CRecordingHandler   blocking;
+	CRecordingHandler   dropping;
+	vector<QUEUED_ITEM> events;
+
+	ring.Subscribe(&stamping, RING_LAG_BLOCK);
+	ring.Subscribe(&blocking, RING_LAG_BLOCK);
+	ring.Subscribe(&dropping, RING_LAG_DROP);
+	CHECK(ring.Start());
+	Write(ring, TEST_EVENTS, NULL);
+	for (DWORD i = 0; i < 3; i++)
+		CHECK(WaitForSubscriber(ring, i, TEST_EVENTS));
+	CHECK(stamping.WaitForCount(TEST_EVENTS, 10000));
+	CHECK(blocking.WaitForCount(TEST_EVENTS, 10000));
+	ring.Stop();
+	events = blocking.GetEvents();
+	for (size_t i = 0; i < events.size(); i++)
+		CHECK(0 == events[i].hParentId);
+	events = dropping.GetEvents();
+	for (size_t i = 0; i < events.size(); i++)
+		CHECK(0 == events[i].hParentId);
+	events = stamping.GetEvents();
+	CHECK(!events.empty() && (0xFFFF == events.back().hParentId));
+}
+
+int main()
+{
+	TestSubscribe();
+	TestBlock();
+	TestDrop();
+	TestWriters();
+
+	return TestResult("TestEventRing");
+}
+
+//----------------------------End of the file -------------------------------
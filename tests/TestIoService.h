@@ -0,0 +1,143 @@
+//---------------------------------------------------------------------------
+//
+// TestIoService.h
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              A simulated I/O service for the coroutine handlers of the
+//              tests
+//
+// DESCRIPTION:
+//              co_await Delay() suspends a coroutine for a given time, as
+//              a request to a remote service would. A thread of the
+//              service resumes it when the time is up, thus any number
+//              of requests are pending at once.
+//
+//---------------------------------------------------------------------------
+#if !defined(_TESTIOSERVICE_H_)
+#define _TESTIOSERVICE_H_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include <condition_variable>
+#include <coroutine>
+#include <mutex>
+#include <queue>
+
+//---------------------------------------------------------------------------
+//
+// class CTestIoService
+//
+//---------------------------------------------------------------------------
+class CTestIoService
+{
+public:
+	typedef std::chrono::steady_clock CClock;
+
+	CTestIoService():
+		m_bStop(FALSE),
+		m_Thread(&CTestIoService::Run, this)
+	{
+	}
+	//
+	// Resumes nothing pending any more
+	//
+	~CTestIoService()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_Lock);
+			m_bStop = TRUE;
+		}
+		m_Wake.notify_one();
+		m_Thread.join();
+	}
+	//
+	// What co_await Delay() waits on
+	//
+	struct CDelay
+	{
+		CTestIoService* pService;
+		DWORD           dwMicroseconds;
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+		void await_suspend(std::coroutine_handle<> hCoroutine)
+		{
+			pService->Schedule(hCoroutine, dwMicroseconds);
+		}
+		void await_resume() const noexcept
+		{
+		}
+	};
+	CDelay Delay(DWORD dwMicroseconds)
+	{
+		CDelay delay = { this, dwMicroseconds };
+
+		return delay;
+	}
+private:
+	typedef std::pair<CClock::time_point, void*> CPending;
+	typedef std::priority_queue<CPending, std::vector<CPending>, std::greater<CPending> > CPendingQueue;
+
+	void Schedule(
+		std::coroutine_handle<> hCoroutine,
+		DWORD                   dwMicroseconds
+		)
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_Lock);
+			m_Pending.push(CPending(
+				CClock::now() + std::chrono::microseconds(dwMicroseconds),
+				hCoroutine.address()
+				));
+		}
+		m_Wake.notify_one();
+	}
+	//
+	// Resume the coroutines whose time is up, earliest first
+	//
+	void Run()
+	{
+		std::unique_lock<std::mutex> guard(m_Lock);
+
+		while (!m_bStop)
+		{
+			if (m_Pending.empty())
+			{
+				m_Wake.wait(guard);
+				continue;
+			}
+			CPending next = m_Pending.top();
+			if (CClock::now() < next.first)
+			{
+				m_Wake.wait_until(guard, next.first);
+				continue;
+			}
+			m_Pending.pop();
+			guard.unlock();
+			std::coroutine_handle<>::from_address(next.second).resume();
+			guard.lock();
+		} // while
+	}
+
+	std::mutex              m_Lock;
+	std::condition_variable m_Wake;
+	CPendingQueue           m_Pending;
+	BOOL                    m_bStop;
+	std::thread             m_Thread;
+};
+
+#endif // !defined(_TESTIOSERVICE_H_)
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,176 @@
+//---------------------------------------------------------------------------
+//
+// TestLatencyHistogram.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the latency histograms and of the timestamps
+//              events take along the pipeline
+//
+// DESCRIPTION:
+//              Percentiles stay within the histogram's precision over the
+//              whole range, the extremes are exact, and threads recording
+//              at once lose no value. Every build of the queue stamps the
+//              events it hands over, in the order of the stages.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+#include <math.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Relative error a percentile may have (32 sub-buckets per power of 2)
+//
+#define TEST_PRECISION          0.032
+
+//
+// Whether ullValue is within the precision of ullExpected
+//
+static BOOL IsClose(
+	ULONG64 ullValue,
+	ULONG64 ullExpected
+	)
+{
+	double dError = fabs((double)ullValue - (double)ullExpected);
+
+	return dError <= TEST_PRECISION * (double)ullExpected + 1.0;
+}
+
+//
+// Uniform values and a few far out ones
+//
+static void TestPercentiles()
+{
+	CLatencyHistogram histogram;
+
+	CHECK(0 == histogram.GetCount());
+	CHECK(0 == histogram.GetPercentile(50.0));
+	CHECK(0 == histogram.GetMin());
+	for (ULONG64 i = 1; i <= 100000; i++)
+		histogram.Record(i * 1000);
+	CHECK(100000 == histogram.GetCount());
+	CHECK(1000 == histogram.GetMin());
+	CHECK(100000000 == histogram.GetMax());
+	CHECK(IsClose(histogram.GetPercentile(50.0), 50000000));
+	CHECK(IsClose(histogram.GetPercentile(90.0), 90000000));
+	CHECK(IsClose(histogram.GetPercentile(99.0), 99000000));
+	CHECK(IsClose(histogram.GetPercentile(99.9), 99900000));
+	CHECK(histogram.GetPercentile(100.0) <= histogram.GetMax());
+	CHECK(histogram.GetPercentile(0.0) >= histogram.GetMin());
+	//
+	// Values below the sub-bucket count are exact
+	//
+	histogram.Reset();
+	CHECK(0 == histogram.GetCount());
+	for (ULONG64 i = 0; i < 10; i++)
+		histogram.Record(i);
+	CHECK(4 == histogram.GetPercentile(50.0));
+	CHECK(0 == histogram.GetMin());
+	CHECK(9 == histogram.GetMax());
+	//
+	// The top of the range
+	//
+	histogram.Reset();
+	histogram.Record(1ULL << 62);
+	histogram.Record(~0ULL);
+	CHECK(IsClose(histogram.GetPercentile(50.0), 1ULL << 62));
+	CHECK(IsClose(histogram.GetPercentile(100.0), ~0ULL));
+	CHECK(~0ULL == histogram.GetMax());
+}
+
+//
+// Several threads recording at once
+//
+static void TestConcurrent()
+{
+	CLatencyHistogram histogram;
+	vector<thread>    threads;
+
+	for (DWORD dwThread = 0; dwThread < 4; dwThread++)
+		threads.push_back(thread([&histogram, dwThread]()
+		{
+			for (ULONG64 i = 1; i <= 100000; i++)
+				histogram.Record(dwThread * 100000 + i);
+		}));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	CHECK(400000 == histogram.GetCount());
+	CHECK(1 == histogram.GetMin());
+	CHECK(400000 == histogram.GetMax());
+	CHECK(IsClose(histogram.GetPercentile(50.0), 200000));
+}
+
+//
+// Intervals are converted from timestamps, unset ones are skipped
+//
+static void TestIntervals()
+{
+	CLatencyHistogram histogram;
+	LONGLONG          llStart = QueryTimestamp();
+
+	::Sleep(2);
+	histogram.RecordInterval(llStart, QueryTimestamp());
+	histogram.RecordInterval(0, QueryTimestamp());
+	histogram.RecordInterval(llStart, 0);
+	CHECK(1 == histogram.GetCount());
+	CHECK(histogram.GetMin() >= 2000000);
+	CHECK(histogram.GetMax() < 1000000000);
+	CHECK(0 == TimestampToNanoseconds(-1));
+}
+
+//
+// The queue stamps every event on its way, whatever its build
+//
+static void TestPipelineStamps(QUEUE_IMPLEMENTATION eImplementation)
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler, eImplementation);
+	vector<QUEUED_ITEM> events;
+
+	CHECK(queue.StartReceivingNotifications());
+	for (DWORD i = 1; i <= 100; i++)
+		queue.Append(MakeProcessEvent(i, 1, TRUE));
+	CHECK(handler.WaitForCount(100, 10000));
+	queue.StopReceivingNotifications();
+	events = handler.GetEvents();
+	CHECK(100 == events.size());
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const QUEUED_ITEM& item = events[i];
+
+		CHECK(i + 1 == item.hProcessId);
+		CHECK(0 != item.llSourceTime);
+		CHECK(item.llSourceTime <= item.llEnqueueTime);
+		CHECK(item.llEnqueueTime <= item.llDequeueTime);
+		CHECK(item.llDequeueTime <= item.llCallbackTime);
+	} // for
+}
+
+int main()
+{
+	TestPercentiles();
+	TestConcurrent();
+	TestIntervals();
+	TestPipelineStamps(QUEUE_LOCKED);
+	TestPipelineStamps(QUEUE_LOCK_FREE);
+	TestPipelineStamps(QUEUE_INLINE);
+
+	return TestResult("TestLatencyHistogram");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,195 @@
+//---------------------------------------------------------------------------
+//
+// TestLifetimes.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the folding of short-lived processes into lifetime
+//              records (CQueueContainer::SetLifetimeCoalescing())
+//
+// DESCRIPTION:
+//              A batch holding the create, the exec()s and the exit of a
+//              process hands a single record over, carrying the last
+//              image and the exit, in place of the create. Processes with
+//              something else in between, or without both events in the
+//              batch, are handed over as they are. Handlers that don't
+//              know about lifetimes see the create and the exit.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// An event of another kind
+//
+static QUEUED_ITEM MakeEvent(
+	QUEUED_ITEM_KIND eKind,
+	DWORD            dwProcessId
+	)
+{
+	QUEUED_ITEM item = MakeProcessEvent(dwProcessId, 1, FALSE);
+
+	item.eKind = eKind;
+
+	return item;
+}
+
+//
+// A handler that knows nothing about lifetimes
+//
+class CPlainHandler: public CCallbackHandler
+{
+public:
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		UNREFERENCED_PARAMETER(pvParam);
+		m_Events.push_back(*pQueuedItem);
+	}
+	vector<QUEUED_ITEM> m_Events;
+};
+
+//
+// Hand a batch over through a locked queue with coalescing on. The queue
+// is filled before the retrieval thread starts, thus it takes the batch
+// at once.
+//
+static void Deliver(
+	CCallbackHandler*          pHandler,
+	const vector<QUEUED_ITEM>& batch,
+	QUEUE_STATS&               stats
+	)
+{
+	CQueueContainer queue(pHandler, QUEUE_LOCKED);
+
+	CHECK(queue.SetLifetimeCoalescing(TRUE));
+	queue.AppendBatch(&batch[0], (DWORD)batch.size());
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(!queue.SetLifetimeCoalescing(FALSE));
+	for (DWORD dwWaited = 0; dwWaited < 10000; dwWaited++)
+	{
+		queue.GetStats(stats);
+		if (stats.ullDelivered == batch.size())
+			break;
+		::Sleep(1);
+	} // for
+	queue.StopReceivingNotifications();
+	queue.GetStats(stats);
+}
+
+//
+// The folding, event by event
+//
+static void TestFold()
+{
+	CRecordingHandler   handler;
+	vector<QUEUED_ITEM> batch;
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+
+	//
+	// 10: create, two exec()s, exit
+	//
+	batch.push_back(MakeProcessEvent(10, 1, TRUE));
+	batch.back().dwImageId       = 1;
+	batch.back().dwCommandLineId = 2;
+	batch.push_back(MakeEvent(QUEUED_ITEM_EXEC, 10));
+	batch.back().dwImageId       = 7;
+	batch.back().dwCommandLineId = 8;
+	//
+	// 20: a thread in between
+	//
+	batch.push_back(MakeProcessEvent(20, 1, TRUE));
+	batch.push_back(MakeEvent(QUEUED_ITEM_EXEC, 10));
+	batch.back().dwImageId       = 9;
+	batch.back().dwCommandLineId = 10;
+	batch.push_back(MakeEvent(QUEUED_ITEM_THREAD, 20));
+	batch.push_back(MakeProcessEvent(10, 1, FALSE));
+	batch.back().dwExitStatus = 3;
+	batch.push_back(MakeProcessEvent(20, 1, FALSE));
+	//
+	// 30: exit only, 40: create only
+	//
+	batch.push_back(MakeProcessEvent(30, 1, FALSE));
+	batch.push_back(MakeProcessEvent(40, 1, TRUE));
+	//
+	// 50: twice, the ID reused
+	//
+	batch.push_back(MakeProcessEvent(50, 1, TRUE));
+	batch.push_back(MakeProcessEvent(50, 1, FALSE));
+	batch.push_back(MakeProcessEvent(50, 2, TRUE));
+	batch.push_back(MakeProcessEvent(50, 2, FALSE));
+	batch.back().dwExitStatus = 4;
+	Deliver(&handler, batch, stats);
+	CHECK(batch.size() == stats.ullDelivered);
+	CHECK(3 == stats.ullLifetimes);
+	CHECK(5 == stats.ullLifetimeEvents);
+	events = handler.GetEvents();
+	CHECK(8 == events.size());
+	if (8 != events.size())
+		return;
+	CHECK((QUEUED_ITEM_LIFETIME == events[0].eKind) && (10 == events[0].hProcessId));
+	CHECK((9 == events[0].dwImageId) && (10 == events[0].dwCommandLineId));
+	CHECK(3 == events[0].dwExitStatus);
+	CHECK(batch[5].llSourceTime == events[0].llExitTime);
+	CHECK(batch[0].llSourceTime == events[0].llSourceTime);
+	CHECK((QUEUED_ITEM_PROCESS == events[1].eKind) && (20 == events[1].hProcessId) && events[1].bCreate);
+	CHECK((QUEUED_ITEM_THREAD == events[2].eKind) && (20 == events[2].hProcessId));
+	CHECK((QUEUED_ITEM_PROCESS == events[3].eKind) && (20 == events[3].hProcessId) && !events[3].bCreate);
+	CHECK((QUEUED_ITEM_PROCESS == events[4].eKind) && (30 == events[4].hProcessId));
+	CHECK((QUEUED_ITEM_PROCESS == events[5].eKind) && (40 == events[5].hProcessId));
+	CHECK((QUEUED_ITEM_LIFETIME == events[6].eKind) && (1 == events[6].hParentId));
+	CHECK((QUEUED_ITEM_LIFETIME == events[7].eKind) && (2 == events[7].hParentId));
+	CHECK(4 == events[7].dwExitStatus);
+}
+
+//
+// A handler that doesn't know about lifetimes sees both events
+//
+static void TestPlain()
+{
+	CPlainHandler       handler;
+	vector<QUEUED_ITEM> batch;
+	QUEUE_STATS         stats;
+
+	batch.push_back(MakeProcessEvent(10, 1, TRUE));
+	batch.push_back(MakeProcessEvent(10, 1, FALSE));
+	batch.back().dwExitStatus = 5;
+	Deliver(&handler, batch, stats);
+	CHECK(1 == stats.ullLifetimes);
+	CHECK(2 == handler.m_Events.size());
+	if (2 != handler.m_Events.size())
+		return;
+	CHECK((QUEUED_ITEM_PROCESS == handler.m_Events[0].eKind) && handler.m_Events[0].bCreate);
+	CHECK(batch[0].llSourceTime == handler.m_Events[0].llSourceTime);
+	CHECK((QUEUED_ITEM_PROCESS == handler.m_Events[1].eKind) && !handler.m_Events[1].bCreate);
+	CHECK(batch[1].llSourceTime == handler.m_Events[1].llSourceTime);
+	CHECK(5 == handler.m_Events[1].dwExitStatus);
+}
+
+int main()
+{
+	TestFold();
+	TestPlain();
+
+	return TestResult("TestLifetimes");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,171 @@
+//---------------------------------------------------------------------------
+//
+// TestLockProfile.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the lock profiling of CCSWrapper (ConsCtl/LockMgr.h)
+//
+// DESCRIPTION:
+//              Nothing is counted while profiling is off. While it is on,
+//              every acquisition is counted, recursive ones included, and
+//              one outermost acquisition in LOCK_HOLD_SAMPLE has its hold
+//              timed. An acquisition that waits for another thread is
+//              counted as contended, with the time it waited. Threads
+//              taking the same lock lose no count.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Threads and acquisitions each in the concurrent test
+//
+#define TEST_THREADS            4
+#define TEST_ACQUISITIONS       100000
+
+//
+// Counting on and off, recursion and sampling
+//
+static void TestCounts()
+{
+	CCSWrapper lock(TEXT("test counts"));
+	LOCK_STATS stats;
+
+	CHECK(!CCSWrapper::GetProfiling());
+	for (DWORD i = 0; i < 100; i++)
+	{
+		CLockMgr<CCSWrapper> guard(lock, TRUE);
+	} // for
+	lock.GetStats(stats);
+	CHECK(0 == stats.ullAcquisitions);
+	CCSWrapper::SetProfiling(TRUE);
+	CHECK(CCSWrapper::GetProfiling());
+	for (DWORD i = 0; i < 32 * LOCK_HOLD_SAMPLE; i++)
+	{
+		CLockMgr<CCSWrapper> guard(lock, TRUE);
+	} // for
+	{
+		CLockMgr<CCSWrapper> disabled(lock, FALSE);
+	}
+	lock.GetStats(stats);
+	CHECK(32 * LOCK_HOLD_SAMPLE == stats.ullAcquisitions);
+	CHECK(0 == stats.ullContended);
+	CHECK(0 == stats.ullWaitTotal);
+	CHECK(32 == stats.ullHoldSamples);
+	CHECK(stats.ullHoldMax <= stats.ullHoldTotal);
+	//
+	// A sampled hold taking 10ms, held recursively
+	//
+	for (DWORD i = 1; i < LOCK_HOLD_SAMPLE; i++)
+	{
+		CLockMgr<CCSWrapper> guard(lock, TRUE);
+	} // for
+	lock.Enter();
+	lock.Enter();
+	::Sleep(10);
+	lock.Leave();
+	lock.Leave();
+	lock.GetStats(stats);
+	CHECK(33 * LOCK_HOLD_SAMPLE + 1 == stats.ullAcquisitions);
+	CHECK(33 == stats.ullHoldSamples);
+	CHECK(TimestampToNanoseconds(stats.ullHoldMax) >= 10000000);
+	CCSWrapper::SetProfiling(FALSE);
+	lock.Enter();
+	lock.Leave();
+	lock.GetStats(stats);
+	CHECK(33 * LOCK_HOLD_SAMPLE + 1 == stats.ullAcquisitions);
+}
+
+//
+// An acquisition waiting for another thread
+//
+static void TestContended()
+{
+	CCSWrapper lock;
+	LOCK_STATS stats;
+	HANDLE     evtHeld = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	CCSWrapper::SetProfiling(TRUE);
+
+	thread holder([&lock, evtHeld]()
+	{
+		CLockMgr<CCSWrapper> guard(lock, TRUE);
+
+		::SetEvent(evtHeld);
+		::Sleep(20);
+	});
+	::WaitForSingleObject(evtHeld, INFINITE);
+	{
+		CLockMgr<CCSWrapper> guard(lock, TRUE);
+	}
+	holder.join();
+	CCSWrapper::SetProfiling(FALSE);
+	::CloseHandle(evtHeld);
+	lock.GetStats(stats);
+	CHECK(2 == stats.ullAcquisitions);
+	CHECK(1 == stats.ullContended);
+	CHECK(stats.ullWaitMax == stats.ullWaitTotal);
+	CHECK(TimestampToNanoseconds(stats.ullWaitTotal) >= 5000000);
+}
+
+//
+// Threads taking the same lock
+//
+static void TestConcurrent()
+{
+	CCSWrapper     lock(TEXT("test concurrent"));
+	LOCK_STATS     stats;
+	vector<thread> threads;
+	ULONG64        ullShared = 0;
+
+	CCSWrapper::SetProfiling(TRUE);
+	for (DWORD i = 0; i < TEST_THREADS; i++)
+		threads.push_back(thread([&lock, &ullShared]()
+		{
+			for (DWORD j = 0; j < TEST_ACQUISITIONS; j++)
+			{
+				CLockMgr<CCSWrapper> guard(lock, TRUE);
+
+				ullShared++;
+			} // for
+		}));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	CCSWrapper::SetProfiling(FALSE);
+	lock.GetStats(stats);
+	CHECK(TEST_THREADS * TEST_ACQUISITIONS == ullShared);
+	CHECK(TEST_THREADS * TEST_ACQUISITIONS == stats.ullAcquisitions);
+	CHECK(TEST_THREADS * TEST_ACQUISITIONS / LOCK_HOLD_SAMPLE == stats.ullHoldSamples);
+	CHECK(stats.ullContended <= stats.ullAcquisitions);
+	CHECK(stats.ullWaitMax <= stats.ullWaitTotal);
+	//
+	// The named locks, alive and destroyed
+	//
+	CCSWrapper::DumpProfile();
+}
+
+int main()
+{
+	TestCounts();
+	TestContended();
+	TestConcurrent();
+
+	return TestResult("TestLockProfile");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,224 @@
+//---------------------------------------------------------------------------
+//
+// TestMpscQueue.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the lock-free queue (ConsCtl/MpscQueue.h) and of
+//              the queue container built on it
+//
+// DESCRIPTION:
+//              Elements come off in the order they were appended, a
+//              batch as a whole, and stamped. Only the first append after
+//              the consumer has announced it sleeps asks for a wake-up.
+//              Producer threads appending at once lose no element and no
+//              wake-up, and each producer's elements stay in order, in
+//              the queue as well as through CQueueContainer, locked or
+//              not.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Producer threads and the elements each appends
+//
+#define TEST_PRODUCERS          4
+#define TEST_ELEMENTS           100000
+
+//
+// Element dwIndex of a producer: the producer in hParentId, the index
+// in hProcessId
+//
+static QUEUED_ITEM MakeElement(
+	DWORD dwProducer,
+	DWORD dwIndex
+	)
+{
+	return MakeProcessEvent(dwIndex, dwProducer, TRUE);
+}
+
+//
+// One thread does it all
+//
+static void TestSingle()
+{
+	CMpscQueue  queue;
+	QUEUED_ITEM batch[10];
+	QUEUED_ITEM item;
+
+	CHECK(!queue.Pop(item));
+	CHECK(0 == queue.GetDepth());
+	for (DWORD i = 0; i < 10; i++)
+		batch[i] = MakeElement(0, i);
+	queue.PushBatch(batch, 10, 1234);
+	queue.PushBatch(batch, 3, 5678);
+	CHECK(13 == queue.GetDepth());
+	CHECK(13 == queue.GetPushedCount());
+	for (DWORD i = 0; i < 13; i++)
+	{
+		CHECK(queue.Pop(item));
+		CHECK(i % 10 == item.hProcessId);
+		CHECK(((i < 10) ? 1234 : 5678) == item.llEnqueueTime);
+	} // for
+	CHECK(!queue.Pop(item));
+	CHECK(0 == queue.GetDepth());
+	//
+	// Only the first append after PrepareToSleep() wakes the consumer
+	//
+	CHECK(queue.PrepareToSleep());
+	CHECK(queue.PushBatch(batch, 1, 0));
+	CHECK(!queue.PushBatch(batch, 1, 0));
+	CHECK(!queue.PrepareToSleep());
+	CHECK(queue.Pop(item));
+	CHECK(queue.Pop(item));
+	CHECK(queue.PrepareToSleep());
+	CHECK(queue.PushBatch(batch, 2, 0));
+	//
+	// Many more elements than spare nodes, in waves
+	//
+	for (DWORD dwWave = 0; dwWave < 20; dwWave++)
+	{
+		for (DWORD i = 0; i < 100; i++)
+			queue.PushBatch(batch, 10, dwWave);
+		for (DWORD i = 0; i < 1000; i++)
+			CHECK(queue.Pop(item));
+	} // for
+	CHECK(queue.Pop(item));
+	CHECK(queue.Pop(item));
+	CHECK(!queue.Pop(item));
+	CHECK(2 + 2 + 13 + 20000 == queue.GetPushedCount());
+}
+
+//
+// Producer threads and a consumer sleeping whenever it runs dry
+//
+static void TestConcurrent()
+{
+	CMpscQueue     queue;
+	HANDLE         hWake = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	vector<thread> producers;
+	vector<DWORD>  dwNext(TEST_PRODUCERS, 0);
+	QUEUED_ITEM    item;
+	DWORD          dwPopped = 0;
+	DWORD          dwLostWakeUps = 0;
+
+	for (DWORD dwProducer = 0; dwProducer < TEST_PRODUCERS; dwProducer++)
+		producers.push_back(thread([&queue, hWake, dwProducer]()
+		{
+			QUEUED_ITEM batch[16];
+			DWORD       dwIndex = 0;
+
+			while (dwIndex < TEST_ELEMENTS)
+			{
+				DWORD dwCount = 1 + (dwIndex / 7) % 16;
+
+				if (dwCount > TEST_ELEMENTS - dwIndex)
+					dwCount = TEST_ELEMENTS - dwIndex;
+				for (DWORD i = 0; i < dwCount; i++)
+					batch[i] = MakeElement(dwProducer, dwIndex++);
+				if (queue.PushBatch(batch, dwCount, QueryTimestamp()))
+					::SetEvent(hWake);
+			} // while
+		}));
+	while (dwPopped < TEST_PRODUCERS * TEST_ELEMENTS)
+	{
+		if (queue.Pop(item))
+		{
+			CHECK(dwNext[item.hParentId] == item.hProcessId);
+			dwNext[item.hParentId] = item.hProcessId + 1;
+			dwPopped++;
+			continue;
+		}
+		if (!queue.PrepareToSleep())
+			continue;
+		if (WAIT_TIMEOUT == ::WaitForSingleObject(hWake, 5000))
+		{
+			dwLostWakeUps++;
+			break;
+		}
+	} // while
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+	::CloseHandle(hWake);
+
+	CHECK(0 == dwLostWakeUps);
+	CHECK(TEST_PRODUCERS * TEST_ELEMENTS == dwPopped);
+	CHECK(TEST_PRODUCERS * TEST_ELEMENTS == queue.GetPushedCount());
+	CHECK(0 == queue.GetDepth());
+}
+
+//
+// The container, appended to from several threads at once
+//
+static void TestContainer(QUEUE_IMPLEMENTATION eImplementation)
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler, eImplementation);
+	vector<thread>      producers;
+	vector<DWORD>       dwNext(TEST_PRODUCERS, 0);
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+	DWORD               dwTotal = TEST_PRODUCERS * TEST_ELEMENTS / 10;
+
+	CHECK(queue.StartReceivingNotifications());
+	for (DWORD dwProducer = 0; dwProducer < TEST_PRODUCERS; dwProducer++)
+		producers.push_back(thread([&queue, dwProducer]()
+		{
+			for (DWORD i = 0; i < TEST_ELEMENTS / 10; i++)
+			{
+				if ((0 == i % 3) && (i + 1 < TEST_ELEMENTS / 10))
+				{
+					QUEUED_ITEM batch[2] = { MakeElement(dwProducer, i), MakeElement(dwProducer, i + 1) };
+
+					queue.AppendBatch(batch, 2);
+					i++;
+				}
+				else
+					queue.Append(MakeElement(dwProducer, i));
+			} // for
+		}));
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+	CHECK(handler.WaitForCount(dwTotal, 10000));
+	queue.StopReceivingNotifications();
+	events = handler.GetEvents();
+	CHECK(dwTotal == events.size());
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		CHECK(dwNext[events[i].hParentId] == events[i].hProcessId);
+		dwNext[events[i].hParentId] = events[i].hProcessId + 1;
+	} // for
+	queue.GetStats(stats);
+	CHECK(dwTotal == stats.ullReceived);
+	CHECK(dwTotal == stats.ullDelivered);
+	CHECK(0 == stats.dwQueueDepth);
+	CHECK(0 == stats.ullMissed);
+}
+
+int main()
+{
+	TestSingle();
+	TestConcurrent();
+	TestContainer(QUEUE_LOCKED);
+	TestContainer(QUEUE_LOCK_FREE);
+
+	return TestResult("TestMpscQueue");
+}
+
+//----------------------------End of the file -------------------------------
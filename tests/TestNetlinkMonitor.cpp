@@ -0,0 +1,380 @@
+//---------------------------------------------------------------------------
+//
+// TestNetlinkMonitor.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the decoding of the process events connector
+//              (ConsCtl/NetlinkMonitor.h)
+//
+// DESCRIPTION:
+//              Datagrams are built the way the kernel sends them, no
+//              socket involved. Forks, exec()s, user ID changes and exits
+//              become their queued items, threads only when subscribed
+//              to. Acknowledgements, other connectors, no-ops and
+//              truncated messages are skipped, and events shorter than
+//              the headers know leave the missing fields zero. Gaps in
+//              the numbers of each CPU count as missed and show up as
+//              gaps in the sequence numbers of the items, a numbering
+//              that steps back or wraps around does not.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/NetlinkMonitor.h"
+#include <stddef.h>
+#include <string.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// proc_event::what values, as the monitor names them
+//
+#define TEST_EVENT_NONE         0x00000000
+#define TEST_EVENT_FORK         0x00000001
+#define TEST_EVENT_EXEC         0x00000002
+#define TEST_EVENT_UID          0x00000004
+#define TEST_EVENT_EXIT         0x80000000
+
+//
+// A monitor whose datagrams come from the test rather than from the
+// socket, never activated
+//
+class CTestMonitor: public CNetlinkMonitor
+{
+public:
+	CTestMonitor(
+		CQueueContainer* pRequestManager,
+		BYTE             bySubscriptions
+		):
+		CNetlinkMonitor(NULL, pRequestManager, bySubscriptions, FALSE)
+	{
+	}
+	//
+	// The items a datagram decodes into
+	//
+	vector<QUEUED_ITEM> Decode(const vector<BYTE>& datagram)
+	{
+		m_dwItems = 0;
+		DecodeDatagram(&datagram[0], (DWORD)datagram.size());
+
+		return vector<QUEUED_ITEM>(m_Items.begin(), m_Items.begin() + m_dwItems);
+	}
+	DWORD Missed(
+		DWORD dwCpu,
+		DWORD dwCpuSequence
+		)
+	{
+		return CountMissed(dwCpu, dwCpuSequence);
+	}
+};
+
+//
+// An event of the given kind on a CPU
+//
+static struct proc_event MakeEvent(
+	DWORD dwWhat,
+	DWORD dwCpu
+	)
+{
+	struct proc_event event;
+
+	::ZeroMemory(&event, sizeof(event));
+	event.what         = (decltype(event.what))dwWhat;
+	event.cpu          = dwCpu;
+	event.timestamp_ns = 1000 + dwCpu;
+
+	return event;
+}
+
+//
+// Append a netlink message carrying cbEvent bytes of the event to a
+// datagram, as the connector numbered it
+//
+static void AddMessage(
+	vector<BYTE>&            datagram,
+	const struct proc_event& event,
+	DWORD                    dwCpuSequence,
+	DWORD                    cbEvent = sizeof(struct proc_event),
+	DWORD                    dwIndex = CN_IDX_PROC,
+	DWORD                    dwType = NLMSG_DONE
+	)
+{
+	size_t           nAt = datagram.size();
+	DWORD            cbMessage = NLMSG_LENGTH(sizeof(struct cn_msg) + cbEvent);
+	struct nlmsghdr* pHeader;
+	struct cn_msg*   pMsg;
+
+	datagram.resize(nAt + NLMSG_ALIGN(cbMessage), 0);
+	pHeader = (struct nlmsghdr*)&datagram[nAt];
+	pHeader->nlmsg_len  = cbMessage;
+	pHeader->nlmsg_type = (__u16)dwType;
+	pMsg = (struct cn_msg*)NLMSG_DATA(pHeader);
+	pMsg->id.idx = dwIndex;
+	pMsg->id.val = CN_VAL_PROC;
+	pMsg->seq    = dwCpuSequence;
+	pMsg->len    = cbEvent;
+	memcpy(pMsg->data, &event, cbEvent);
+}
+
+static void TestDecode()
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler);
+	CTestMonitor        monitor(&queue, 0);
+	vector<BYTE>        datagram;
+	vector<QUEUED_ITEM> items;
+	struct proc_event   event;
+
+	//
+	// A process forks a process and a thread
+	//
+	event = MakeEvent(TEST_EVENT_FORK, 0);
+	event.event_data.fork.parent_pid  = 11;
+	event.event_data.fork.parent_tgid = 10;
+	event.event_data.fork.child_pid   = 20;
+	event.event_data.fork.child_tgid  = 20;
+	AddMessage(datagram, event, 1);
+	event.event_data.fork.child_pid   = 12;
+	event.event_data.fork.child_tgid  = 10;
+	AddMessage(datagram, event, 2);
+	//
+	// The child executes, changes its user and exits
+	//
+	event = MakeEvent(TEST_EVENT_EXEC, 0);
+	event.event_data.exec.process_pid  = 20;
+	event.event_data.exec.process_tgid = 20;
+	AddMessage(datagram, event, 3);
+	event = MakeEvent(TEST_EVENT_UID, 0);
+	event.event_data.id.process_pid  = 21;
+	event.event_data.id.process_tgid = 20;
+	event.event_data.id.r.ruid       = 1000;
+	event.event_data.id.e.euid       = 0;
+	AddMessage(datagram, event, 4);
+	event = MakeEvent(TEST_EVENT_EXIT, 0);
+	event.event_data.exit.process_pid  = 20;
+	event.event_data.exit.process_tgid = 20;
+	event.event_data.exit.exit_code    = 256;
+	event.event_data.exit.parent_tgid  = 10;
+	AddMessage(datagram, event, 5);
+	//
+	// The thread exits
+	//
+	event.event_data.exit.process_pid  = 12;
+	event.event_data.exit.process_tgid = 10;
+	AddMessage(datagram, event, 6);
+
+	items = monitor.Decode(datagram);
+	CHECK(4 == items.size());
+	if (4 != items.size())
+		return;
+	CHECK(QUEUED_ITEM_PROCESS == items[0].eKind);
+	CHECK(items[0].bCreate);
+	CHECK(20 == items[0].hProcessId);
+	CHECK(10 == items[0].hParentId);
+	CHECK(11 == items[0].dwCreatingThreadId);
+	CHECK(1000 == items[0].llSourceTime);
+	CHECK(QUEUED_ITEM_EXEC == items[1].eKind);
+	CHECK(20 == items[1].hProcessId);
+	CHECK(QUEUED_ITEM_UID == items[2].eKind);
+	CHECK(20 == items[2].hProcessId);
+	CHECK(21 == items[2].dwThreadId);
+	CHECK(1000 == items[2].dwRealUid);
+	CHECK(0 == items[2].dwEffectiveUid);
+	CHECK(QUEUED_ITEM_PROCESS == items[3].eKind);
+	CHECK(!items[3].bCreate);
+	CHECK(20 == items[3].hProcessId);
+	CHECK(10 == items[3].hParentId);
+	CHECK(256 == items[3].dwExitStatus);
+	//
+	// The threads not subscribed to are not numbered either
+	//
+	for (DWORD i = 0; i < 4; i++)
+		CHECK(i + 1 == items[i].ullSequence);
+}
+
+static void TestThreads()
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler);
+	CTestMonitor        monitor(&queue, OBSRV_SUBSCRIBE_THREAD);
+	vector<BYTE>        datagram;
+	vector<QUEUED_ITEM> items;
+	struct proc_event   event;
+
+	event = MakeEvent(TEST_EVENT_FORK, 1);
+	event.event_data.fork.parent_pid  = 10;
+	event.event_data.fork.parent_tgid = 10;
+	event.event_data.fork.child_pid   = 12;
+	event.event_data.fork.child_tgid  = 10;
+	AddMessage(datagram, event, 1);
+	event = MakeEvent(TEST_EVENT_EXIT, 1);
+	event.event_data.exit.process_pid  = 12;
+	event.event_data.exit.process_tgid = 10;
+	AddMessage(datagram, event, 2);
+	items = monitor.Decode(datagram);
+	CHECK(2 == items.size());
+	if (2 != items.size())
+		return;
+	CHECK(QUEUED_ITEM_THREAD == items[0].eKind);
+	CHECK(items[0].bCreate);
+	CHECK(10 == items[0].hProcessId);
+	CHECK(12 == items[0].dwThreadId);
+	CHECK(QUEUED_ITEM_THREAD == items[1].eKind);
+	CHECK(!items[1].bCreate);
+	CHECK(10 == items[1].hProcessId);
+	CHECK(12 == items[1].dwThreadId);
+	CHECK(1001 == items[1].llSourceTime);
+}
+
+//
+// Messages that are no events of this connector, or not whole ones
+//
+static void TestSkipped()
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler);
+	CTestMonitor        monitor(&queue, 0);
+	vector<BYTE>        datagram;
+	vector<QUEUED_ITEM> items;
+	struct proc_event   event;
+
+	//
+	// The acknowledgement of listening, a no-op, another connector and
+	// a message too short for the header of an event
+	//
+	event = MakeEvent(TEST_EVENT_NONE, 0);
+	AddMessage(datagram, event, 0);
+	event = MakeEvent(TEST_EVENT_EXEC, 0);
+	event.event_data.exec.process_tgid = 30;
+	AddMessage(datagram, event, 1, sizeof(event), CN_IDX_PROC, NLMSG_NOOP);
+	AddMessage(datagram, event, 1, sizeof(event), CN_IDX_PROC + 1);
+	AddMessage(datagram, event, 1, offsetof(struct proc_event, event_data) - 1);
+	items = monitor.Decode(datagram);
+	CHECK(0 == items.size());
+	//
+	// An exit of an older kernel, without the parent; the numbering
+	// starts with it, the messages skipped counted nothing
+	//
+	datagram.clear();
+	event = MakeEvent(TEST_EVENT_EXIT, 0);
+	event.event_data.exit.process_pid  = 30;
+	event.event_data.exit.process_tgid = 30;
+	event.event_data.exit.exit_code    = 9;
+	event.event_data.exit.parent_tgid  = 10;
+	AddMessage(datagram, event, 7, offsetof(struct proc_event, event_data.exit.parent_pid));
+	items = monitor.Decode(datagram);
+	CHECK(1 == items.size());
+	if (1 != items.size())
+		return;
+	CHECK(30 == items[0].hProcessId);
+	CHECK(9 == items[0].dwExitStatus);
+	CHECK(0 == items[0].hParentId);
+	CHECK(1 == items[0].ullSequence);
+	//
+	// A datagram cut within a message ends with the whole ones before
+	//
+	datagram.clear();
+	event.event_data.exit.process_pid  = 31;
+	event.event_data.exit.process_tgid = 31;
+	AddMessage(datagram, event, 8);
+	AddMessage(datagram, event, 9);
+	datagram.resize(datagram.size() - 8);
+	items = monitor.Decode(datagram);
+	CHECK(1 == items.size());
+}
+
+static void TestMissed()
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler);
+	CTestMonitor        monitor(&queue, 0);
+	vector<BYTE>        datagram;
+	vector<QUEUED_ITEM> items;
+	struct proc_event   event;
+
+	//
+	// The first number of a CPU counts nothing, gaps count per CPU
+	//
+	CHECK(0 == monitor.Missed(3, 10));
+	CHECK(0 == monitor.Missed(3, 11));
+	CHECK(3 == monitor.Missed(3, 15));
+	CHECK(0 == monitor.Missed(0, 100));
+	CHECK(0 == monitor.Missed(3, 16));
+	CHECK(1 == monitor.Missed(0, 102));
+	//
+	// A step back restarts the numbering, a wrap-around continues it
+	//
+	CHECK(0 == monitor.Missed(3, 5));
+	CHECK(0 == monitor.Missed(3, 6));
+	CHECK(0 == monitor.Missed(1, 0xFFFFFFFE));
+	CHECK(0 == monitor.Missed(1, 0xFFFFFFFF));
+	CHECK(0 == monitor.Missed(1, 0));
+	CHECK(2 == monitor.Missed(1, 3));
+	//
+	// Gaps go on into the sequence numbers of the items, and on into
+	// the queue's count of missed events
+	//
+	event = MakeEvent(TEST_EVENT_EXEC, 2);
+	event.event_data.exec.process_tgid = 40;
+	AddMessage(datagram, event, 1);
+	AddMessage(datagram, event, 2);
+	AddMessage(datagram, event, 5);
+	event = MakeEvent(TEST_EVENT_EXEC, 4);
+	event.event_data.exec.process_tgid = 41;
+	AddMessage(datagram, event, 50);
+	AddMessage(datagram, event, 52);
+	event = MakeEvent(TEST_EVENT_EXEC, 2);
+	event.event_data.exec.process_tgid = 40;
+	AddMessage(datagram, event, 6);
+	items = monitor.Decode(datagram);
+	CHECK(6 == items.size());
+	if (6 != items.size())
+		return;
+
+	const ULONG64 ullExpected[] = { 1, 2, 5, 6, 8, 9 };
+	QUEUE_STATS   stats;
+
+	for (DWORD i = 0; i < 6; i++)
+		CHECK(ullExpected[i] == items[i].ullSequence);
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(queue.AppendBatch(&items[0], (DWORD)items.size()));
+	CHECK(handler.WaitForCount(6, 10000));
+	for (DWORD dwWaited = 0; dwWaited < 10000; dwWaited++)
+	{
+		queue.GetStats(stats);
+		if (6 == stats.ullDelivered)
+			break;
+		::Sleep(1);
+	} // for
+	queue.StopReceivingNotifications();
+	CHECK(3 == stats.ullMissed);
+	CHECK(0 == stats.ullOutOfOrder);
+}
+
+int main()
+{
+	TestDecode();
+	TestThreads();
+	TestSkipped();
+	TestMissed();
+
+	return TestResult("TestNetlinkMonitor");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,262 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvBatch.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the batch retrieval layout (Shared/ObsrvBatch.h)
+//
+// DESCRIPTION:
+//              A batch takes as many records off the ring as fit, in
+//              order, tells whether more are pending and carries the
+//              overflow count. What doesn't fit stays in the ring for
+//              the next batch. Truncated or corrupt buffers are
+//              rejected.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvBatch.h"
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Records released so far by ReleaseRecord()
+//
+static DWORD g_dwReleased = 0;
+
+static void ReleaseRecord(POBSRV_PROCESS_RECORD pRecord)
+{
+	UNREFERENCED_PARAMETER(pRecord);
+	g_dwReleased++;
+}
+
+//
+// Push a create of dwProcessId
+//
+static BOOL PushCreate(
+	POBSRV_RING pRing,
+	DWORD       dwProcessId
+	)
+{
+	OBSRV_PROCESS_RECORD record;
+
+	::ZeroMemory(&record, sizeof(record));
+	record.Kind       = OBSRV_KIND_PROCESS_CREATE;
+	record.bCreate    = 1;
+	record.hProcessId = dwProcessId;
+	record.hParentId  = dwProcessId - 1;
+	record.SessionId  = 1;
+	record.Timestamp  = dwProcessId * 10;
+
+	return ObsrvRingPush(pRing, &record);
+}
+
+//
+// Decode a batch and check its records are the creates of dwFirst on
+//
+static DWORD CheckBatch(
+	const vector<BYTE>& buffer,
+	size_t              cbUsed,
+	DWORD               dwFirst
+	)
+{
+	OBSRV_BATCH_HEADER header;
+	OBSRV_RECORD_VIEW  view;
+	const BYTE*        pbRecord = (const BYTE*)ObsrvBatchDecode(&buffer[0], cbUsed, &header);
+	size_t             cbLeft;
+
+	CHECK(NULL != pbRecord);
+	if (NULL == pbRecord)
+		return 0;
+	CHECK(header.Bytes + sizeof(OBSRV_BATCH_HEADER) == cbUsed);
+	cbLeft = header.Bytes;
+	for (DWORD i = 0; i < header.Count; i++)
+	{
+		OBSRV_U32 cbRecord = ObsrvRecordDecode(pbRecord, cbLeft, &view);
+
+		CHECK(0 != cbRecord);
+		if (0 == cbRecord)
+			return 0;
+		CHECK(OBSRV_KIND_PROCESS_CREATE == view.Kind);
+		CHECK(dwFirst + i == view.ProcessId);
+		CHECK(dwFirst + i - 1 == view.ParentId);
+		CHECK(1 == view.SessionId);
+		CHECK((OBSRV_I64)(dwFirst + i) * 10 == view.Timestamp);
+		CHECK(ObsrvRecordHas(&view, OBSRV_TAG_CREATING_THREAD_ID));
+		pbRecord += cbRecord;
+		cbLeft   -= cbRecord;
+	} // for
+	CHECK(0 == cbLeft);
+
+	return header.Count;
+}
+
+//
+// Fill batches from a ring until it is empty
+//
+static void TestFill()
+{
+	vector<OBSRV_RING_CELL> cells(64);
+	vector<BYTE>            buffer(sizeof(OBSRV_BATCH_HEADER) + 10 * 64);
+	OBSRV_RING              ring;
+	OBSRV_BATCH_HEADER      header;
+	DWORD                   dwNext = 1;
+	DWORD                   dwBatches = 0;
+
+	ObsrvRingInit(&ring, &cells[0], 64);
+	for (DWORD i = 1; i <= 50; i++)
+		CHECK(PushCreate(&ring, i));
+	g_dwReleased = 0;
+	while (ObsrvRingCount(&ring) > 0)
+	{
+		size_t cbUsed = ObsrvBatchFillFromRing(&ring, &buffer[0], buffer.size(), ReleaseRecord);
+		DWORD  dwCount;
+
+		CHECK(cbUsed <= buffer.size());
+		ObsrvBatchDecode(&buffer[0], cbUsed, &header);
+		dwCount = CheckBatch(buffer, cbUsed, dwNext);
+		CHECK(dwCount > 0);
+		if (0 == dwCount)
+			break;
+		//
+		// Only the last batch finds the ring empty
+		//
+		CHECK((ObsrvRingCount(&ring) > 0) == (0 != (header.Flags & OBSRV_BATCH_FLAG_MORE_PENDING)));
+		dwNext += dwCount;
+		dwBatches++;
+	} // while
+	CHECK(51 == dwNext);
+	CHECK(50 == g_dwReleased);
+	CHECK(dwBatches > 1);
+	//
+	// An empty ring gives an empty batch
+	//
+	size_t cbEmpty = ObsrvBatchFillFromRing(&ring, &buffer[0], buffer.size(), NULL);
+
+	CHECK(sizeof(OBSRV_BATCH_HEADER) == cbEmpty);
+	CHECK(NULL != ObsrvBatchDecode(&buffer[0], cbEmpty, &header));
+	CHECK(0 == header.Count);
+	CHECK(0 == header.Flags);
+}
+
+//
+// The overflow count and the sequence gaps reach the batch
+//
+static void TestOverflow()
+{
+	vector<OBSRV_RING_CELL> cells(16);
+	vector<BYTE>            buffer(OBSRV_BATCH_DEFAULT_SIZE);
+	OBSRV_RING              ring;
+	OBSRV_BATCH_HEADER      header;
+	OBSRV_RECORD_VIEW       view;
+
+	ObsrvRingInit(&ring, &cells[0], 16);
+	for (DWORD i = 1; i <= 20; i++)
+		PushCreate(&ring, i);
+
+	size_t      cbUsed   = ObsrvBatchFillFromRing(&ring, &buffer[0], buffer.size(), NULL);
+	const BYTE* pbRecord = (const BYTE*)ObsrvBatchDecode(&buffer[0], cbUsed, &header);
+
+	CHECK(NULL != pbRecord);
+	CHECK(16 == header.Count);
+	CHECK(4 == header.Overflow);
+	CHECK(0 == (header.Flags & OBSRV_BATCH_FLAG_MORE_PENDING));
+	CHECK(0 != ObsrvRecordDecode(pbRecord, header.Bytes, &view));
+	CHECK(5 == view.Sequence);
+}
+
+//
+// Variable length fields travel in Extra
+//
+static void TestExtra()
+{
+	vector<OBSRV_RING_CELL> cells(16);
+	vector<BYTE>            extra(256);
+	vector<BYTE>            buffer(OBSRV_BATCH_DEFAULT_SIZE);
+	OBSRV_RING              ring;
+	OBSRV_RECORD_WRITER     writer;
+	OBSRV_PROCESS_RECORD    record;
+	OBSRV_BATCH_HEADER      header;
+	OBSRV_RECORD_VIEW       view;
+	const OBSRV_U16         szPath[] = { '\\', 'a', '.', 'e', 'x', 'e' };
+
+	CHECK(ObsrvRecordBegin(&writer, &extra[0], (OBSRV_U32)extra.size(), OBSRV_KIND_PROCESS_CREATE, 0, 0));
+	CHECK(6 == ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, szPath, 6));
+	CHECK(0 != ObsrvRecordEnd(&writer));
+
+	ObsrvRingInit(&ring, &cells[0], 16);
+	::ZeroMemory(&record, sizeof(record));
+	record.Kind       = OBSRV_KIND_PROCESS_EXIT;
+	record.hProcessId = 42;
+	record.ExitStatus = 7;
+	record.Extra      = &extra[0];
+	CHECK(ObsrvRingPush(&ring, &record));
+
+	size_t      cbUsed   = ObsrvBatchFillFromRing(&ring, &buffer[0], buffer.size(), NULL);
+	const BYTE* pbRecord = (const BYTE*)ObsrvBatchDecode(&buffer[0], cbUsed, &header);
+
+	CHECK(1 == header.Count);
+	CHECK(0 != ObsrvRecordDecode(pbRecord, header.Bytes, &view));
+	CHECK(OBSRV_KIND_PROCESS_EXIT == view.Kind);
+	CHECK(42 == view.ProcessId);
+	CHECK(7 == view.ExitStatus);
+	CHECK(6 == view.ImagePathLength);
+	CHECK((NULL != view.ImagePath) && ('a' == view.ImagePath[1]));
+	CHECK(!ObsrvRecordHas(&view, OBSRV_TAG_CREATING_PROCESS_ID));
+}
+
+//
+// Short and corrupt buffers
+//
+static void TestDecode()
+{
+	vector<OBSRV_RING_CELL> cells(16);
+	vector<BYTE>            buffer(OBSRV_BATCH_DEFAULT_SIZE);
+	OBSRV_RING              ring;
+	OBSRV_BATCH_HEADER      header;
+
+	ObsrvRingInit(&ring, &cells[0], 16);
+	PushCreate(&ring, 1);
+	CHECK(0 == ObsrvBatchFillFromRing(&ring, &buffer[0], sizeof(OBSRV_BATCH_HEADER) - 1, NULL));
+	CHECK(1 == ObsrvRingCount(&ring));
+	//
+	// A buffer that holds the header only takes no record
+	//
+	size_t cbUsed = ObsrvBatchFillFromRing(&ring, &buffer[0], sizeof(OBSRV_BATCH_HEADER), NULL);
+
+	CHECK(sizeof(OBSRV_BATCH_HEADER) == cbUsed);
+	CHECK(1 == ObsrvRingCount(&ring));
+	cbUsed = ObsrvBatchFillFromRing(&ring, &buffer[0], buffer.size(), NULL);
+	CHECK(NULL != ObsrvBatchDecode(&buffer[0], cbUsed, &header));
+	CHECK(NULL == ObsrvBatchDecode(&buffer[0], cbUsed - 1, &header));
+	CHECK(NULL == ObsrvBatchDecode(&buffer[0], sizeof(OBSRV_BATCH_HEADER) - 1, &header));
+	CHECK(NULL == ObsrvBatchDecode(NULL, cbUsed, &header));
+	((POBSRV_BATCH_HEADER)&buffer[0])->Version = OBSRV_BATCH_VERSION + 1;
+	CHECK(NULL == ObsrvBatchDecode(&buffer[0], cbUsed, &header));
+}
+
+int main()
+{
+	TestFill();
+	TestOverflow();
+	TestExtra();
+	TestDecode();
+
+	return TestResult("TestObsrvBatch");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,350 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvFilter.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the compiled event filter (Shared/ObsrvFilter.h)
+//
+// DESCRIPTION:
+//              A compiled filter decides as the rules say, checked against
+//              a plain walk over the rules for random rule sets and
+//              events. Deny rules win, prefixes ignore ASCII case and an
+//              unknown path matches none. Compiled filters pass the
+//              driver's validation, broken ones don't.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvFilter.h"
+#include <stdlib.h>
+#include <string>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+typedef basic_string<OBSRV_U16> CTestPath;
+
+//
+// A path out of a few letters, thus prefixes of each other are common
+//
+static CTestPath MakePath(DWORD dwMaxLength)
+{
+	static const char szLetters[] = "\\aAbB";
+	CTestPath         path;
+	DWORD             dwLength = 1 + rand() % dwMaxLength;
+
+	for (DWORD i = 0; i < dwLength; i++)
+		path += (OBSRV_U16)szLetters[rand() % (sizeof(szLetters) - 1)];
+
+	return path;
+}
+
+static CTestPath MakePath(const char* pszText)
+{
+	CTestPath path;
+
+	while ('\0' != *pszText)
+		path += (OBSRV_U16)*pszText++;
+
+	return path;
+}
+
+//
+// Rules together with the strings their prefixes point to
+//
+class CTestRules
+{
+public:
+	void Add(
+		OBSRV_U32 nField,
+		OBSRV_U32 nAction,
+		OBSRV_U32 nValue
+		)
+	{
+		OBSRV_FILTER_RULE rule = { nField, nAction, nValue, 0, NULL };
+
+		m_Rules.push_back(rule);
+		m_Prefixes.push_back(CTestPath());
+	}
+	void Add(
+		OBSRV_U32        nAction,
+		const CTestPath& prefix
+		)
+	{
+		OBSRV_FILTER_RULE rule = { OBSRV_FILTER_IMAGE_PREFIX, nAction, 0, 0, NULL };
+
+		m_Rules.push_back(rule);
+		m_Prefixes.push_back(prefix);
+	}
+	//
+	// Compile them, an empty vector if they don't compile
+	//
+	vector<OBSRV_U32> Compile()
+	{
+		OBSRV_U32         cbSize;
+		vector<OBSRV_U32> filter;
+
+		for (size_t i = 0; i < m_Rules.size(); i++)
+		{
+			m_Rules[i].Prefix       = m_Prefixes[i].empty() ? NULL : m_Prefixes[i].c_str();
+			m_Rules[i].PrefixLength = (OBSRV_U32)m_Prefixes[i].size();
+		} // for
+		cbSize = ObsrvFilterCompiledSize(m_Rules.data(), (OBSRV_U32)m_Rules.size());
+		if (0 == cbSize)
+			return filter;
+		filter.resize(cbSize / sizeof(OBSRV_U32));
+		CHECK(0 == ObsrvFilterCompile(m_Rules.data(), (OBSRV_U32)m_Rules.size(), &filter[0], cbSize - 4));
+		CHECK(cbSize == ObsrvFilterCompile(m_Rules.data(), (OBSRV_U32)m_Rules.size(), &filter[0], cbSize));
+
+		return filter;
+	}
+	//
+	// What the rules say, the slow way
+	//
+	BOOL Match(
+		const OBSRV_FILTER_EVENT& event,
+		const CTestPath*          pPath
+		)
+	{
+		BOOL bAllowRules = FALSE;
+		BOOL bAllowed    = FALSE;
+
+		for (size_t i = 0; i < m_Rules.size(); i++)
+		{
+			BOOL bMatch;
+
+			switch (m_Rules[i].Field)
+			{
+				case OBSRV_FILTER_PROCESS_ID: bMatch = (event.ProcessId == m_Rules[i].Value); break;
+				case OBSRV_FILTER_PARENT_ID:  bMatch = (event.ParentId == m_Rules[i].Value); break;
+				case OBSRV_FILTER_SESSION_ID: bMatch = (event.SessionId == m_Rules[i].Value); break;
+				default:
+					bMatch = (NULL != pPath) && StartsWith(*pPath, m_Prefixes[i]);
+					break;
+			}
+			if (OBSRV_FILTER_DENY == m_Rules[i].Action)
+			{
+				if (bMatch)
+					return FALSE;
+				continue;
+			}
+			bAllowRules = TRUE;
+			bAllowed   |= bMatch;
+		} // for
+
+		return !bAllowRules || bAllowed;
+	}
+private:
+	static BOOL StartsWith(
+		const CTestPath& path,
+		const CTestPath& prefix
+		)
+	{
+		if (prefix.size() > path.size())
+			return FALSE;
+		for (size_t i = 0; i < prefix.size(); i++)
+			if (OBSRV_FILTER_FOLD(path[i]) != OBSRV_FILTER_FOLD(prefix[i]))
+				return FALSE;
+
+		return TRUE;
+	}
+	vector<OBSRV_FILTER_RULE> m_Rules;
+	vector<CTestPath>         m_Prefixes;
+};
+
+//
+// The rules' own examples
+//
+static void TestRules()
+{
+	CTestRules        rules;
+	vector<OBSRV_U32> filter;
+	CTestPath         system = MakePath("\\Windows\\System32\\cmd.exe");
+	CTestPath         temp   = MakePath("\\Windows\\Temp\\x.exe");
+	CTestPath         other  = MakePath("\\Program Files\\y.exe");
+	OBSRV_FILTER_EVENT event = { 10, 4, 1, NULL, 0 };
+
+	//
+	// No rules, everything passes
+	//
+	filter = rules.Compile();
+	CHECK(!filter.empty());
+	CHECK(ObsrvFilterValidate(&filter[0], filter.size() * sizeof(OBSRV_U32)));
+	CHECK(ObsrvFilterMatch(&filter[0], &event));
+	CHECK(!ObsrvFilterNeedsImagePath(&filter[0]));
+	//
+	// Allow a folder, deny a folder in it and a session
+	//
+	rules.Add(OBSRV_FILTER_ALLOW, MakePath("\\WINDOWS\\"));
+	rules.Add(OBSRV_FILTER_DENY, MakePath("\\windows\\temp"));
+	rules.Add(OBSRV_FILTER_SESSION_ID, OBSRV_FILTER_DENY, 0);
+	filter = rules.Compile();
+	CHECK(ObsrvFilterValidate(&filter[0], filter.size() * sizeof(OBSRV_U32)));
+	CHECK(ObsrvFilterNeedsImagePath(&filter[0]));
+	event.ImagePath = system.c_str(); event.ImagePathLength = (OBSRV_U32)system.size();
+	CHECK(ObsrvFilterMatch(&filter[0], &event));
+	event.ImagePath = temp.c_str(); event.ImagePathLength = (OBSRV_U32)temp.size();
+	CHECK(!ObsrvFilterMatch(&filter[0], &event));
+	event.ImagePath = other.c_str(); event.ImagePathLength = (OBSRV_U32)other.size();
+	CHECK(!ObsrvFilterMatch(&filter[0], &event));
+	event.ImagePath = NULL; event.ImagePathLength = 0;
+	CHECK(!ObsrvFilterMatch(&filter[0], &event));
+	//
+	// An ID allow rule lets an unknown path through, a deny rule wins
+	//
+	rules.Add(OBSRV_FILTER_PARENT_ID, OBSRV_FILTER_ALLOW, 4);
+	filter = rules.Compile();
+	CHECK(ObsrvFilterMatch(&filter[0], &event));
+	event.SessionId = 0;
+	CHECK(!ObsrvFilterMatch(&filter[0], &event));
+	//
+	// Rules that make no sense don't compile
+	//
+	CTestRules bad;
+
+	bad.Add(OBSRV_FILTER_FIELD_COUNT, OBSRV_FILTER_ALLOW, 1);
+	CHECK(bad.Compile().empty());
+	CTestRules badAction;
+
+	badAction.Add(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY + 1, 1);
+	CHECK(badAction.Compile().empty());
+	CTestRules emptyPrefix;
+
+	emptyPrefix.Add(OBSRV_FILTER_ALLOW, CTestPath());
+	CHECK(emptyPrefix.Compile().empty());
+}
+
+//
+// Random rule sets against random events
+//
+static void TestRandom()
+{
+	srand(7);
+	for (DWORD dwSet = 0; dwSet < 300; dwSet++)
+	{
+		CTestRules        rules;
+		vector<OBSRV_U32> filter;
+		DWORD             dwRules = rand() % 40;
+
+		for (DWORD i = 0; i < dwRules; i++)
+		{
+			OBSRV_U32 nField  = rand() % OBSRV_FILTER_FIELD_COUNT;
+			OBSRV_U32 nAction = (0 == rand() % 4) ? OBSRV_FILTER_DENY : OBSRV_FILTER_ALLOW;
+
+			if (OBSRV_FILTER_IMAGE_PREFIX == nField)
+				rules.Add(nAction, MakePath(6));
+			else
+				rules.Add(nField, nAction, rand() % 16);
+		} // for
+		filter = rules.Compile();
+		CHECK(!filter.empty());
+		if (filter.empty())
+			continue;
+		CHECK(ObsrvFilterValidate(&filter[0], filter.size() * sizeof(OBSRV_U32)));
+		for (DWORD dwEvent = 0; dwEvent < 200; dwEvent++)
+		{
+			CTestPath          path = MakePath(10);
+			BOOL               bKnown = (0 != rand() % 8);
+			OBSRV_FILTER_EVENT event;
+
+			event.ProcessId       = rand() % 16;
+			event.ParentId        = rand() % 16;
+			event.SessionId       = rand() % 16;
+			event.ImagePath       = bKnown ? path.c_str() : NULL;
+			event.ImagePathLength = bKnown ? (OBSRV_U32)path.size() : 0;
+			CHECK(!!ObsrvFilterMatch(&filter[0], &event) == rules.Match(event, bKnown ? &path : NULL));
+		} // for
+	} // for
+}
+
+//
+// The driver takes nothing it cannot walk safely
+//
+static void TestValidate()
+{
+	CTestRules           rules;
+	vector<OBSRV_U32>    filter;
+	vector<OBSRV_U32>    broken;
+	POBSRV_FILTER_HEADER pHeader;
+	size_t               cbFilter;
+
+	rules.Add(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY, 5);
+	rules.Add(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY, 3);
+	rules.Add(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY, 5);
+	rules.Add(OBSRV_FILTER_DENY, MakePath("\\a\\b"));
+	rules.Add(OBSRV_FILTER_DENY, MakePath("\\A"));
+	rules.Add(OBSRV_FILTER_DENY, MakePath("\\c"));
+	filter   = rules.Compile();
+	cbFilter = filter.size() * sizeof(OBSRV_U32);
+	pHeader  = (POBSRV_FILTER_HEADER)&filter[0];
+	//
+	// Duplicates and covered prefixes are gone
+	//
+	CHECK(2 == pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY)].Count);
+	CHECK(2 == pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_DENY)].Count);
+	CHECK(ObsrvFilterValidate(&filter[0], cbFilter));
+	CHECK(!ObsrvFilterValidate(NULL, cbFilter));
+	CHECK(!ObsrvFilterValidate(&filter[0], cbFilter - 4));
+	CHECK(!ObsrvFilterValidate((OBSRV_U8*)&filter[0] + 1, cbFilter));
+	broken = filter;
+	((POBSRV_FILTER_HEADER)&broken[0])->Version++;
+	CHECK(!ObsrvFilterValidate(&broken[0], cbFilter));
+	//
+	// A list running out of the filter
+	//
+	broken = filter;
+	((POBSRV_FILTER_HEADER)&broken[0])->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY)].Count = (OBSRV_U32)cbFilter;
+	CHECK(!ObsrvFilterValidate(&broken[0], cbFilter));
+	broken = filter;
+	((POBSRV_FILTER_HEADER)&broken[0])->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_PARENT_ID, OBSRV_FILTER_ALLOW)].Offset = (OBSRV_U32)cbFilter + 4;
+	CHECK(!ObsrvFilterValidate(&broken[0], cbFilter));
+	//
+	// IDs out of order, the lookup would miss them
+	//
+	broken = filter;
+	pHeader = (POBSRV_FILTER_HEADER)&broken[0];
+	{
+		OBSRV_U32* pIds = (OBSRV_U32*)((OBSRV_U8*)&broken[0] + pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_PROCESS_ID, OBSRV_FILTER_DENY)].Offset);
+
+		swap(pIds[0], pIds[1]);
+	}
+	CHECK(!ObsrvFilterValidate(&broken[0], cbFilter));
+	//
+	// A prefix running out of the filter, and prefixes out of order
+	//
+	broken = filter;
+	pHeader = (POBSRV_FILTER_HEADER)&broken[0];
+	{
+		POBSRV_FILTER_PREFIX pPrefixes = (POBSRV_FILTER_PREFIX)((OBSRV_U8*)&broken[0] + pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_DENY)].Offset);
+
+		pPrefixes[1].Length = (OBSRV_U32)cbFilter;
+		CHECK(!ObsrvFilterValidate(&broken[0], cbFilter));
+		broken = filter;
+		pPrefixes = (POBSRV_FILTER_PREFIX)((OBSRV_U8*)&broken[0] + pHeader->Lists[OBSRV_FILTER_LIST(OBSRV_FILTER_IMAGE_PREFIX, OBSRV_FILTER_DENY)].Offset);
+		swap(pPrefixes[0], pPrefixes[1]);
+		CHECK(!ObsrvFilterValidate(&broken[0], cbFilter));
+	}
+}
+
+int main()
+{
+	TestRules();
+	TestRandom();
+	TestValidate();
+
+	return TestResult("TestObsrvFilter");
+}
+
+//----------------------------End of the file -------------------------------
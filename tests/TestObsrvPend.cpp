@@ -0,0 +1,364 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvPend.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the pended read protocol (Shared/ObsrvPend.h)
+//
+// DESCRIPTION:
+//              DeliverStep() is the driver's DeliverPendingReads() without
+//              the IRPs. Requests complete in the order they were parked,
+//              a record never waits while a request is parked, and a
+//              head a producer has claimed but not published yet leaves
+//              the parked requests as they are. Producers running the
+//              deliver step concurrently hand every record out once, in
+//              order.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvPend.h"
+#include "../Shared/ObsrvBatch.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Producers and records pushed by each of them in the concurrent test
+//
+#define TEST_PRODUCERS          4
+#define TEST_RECORDS_PER_THREAD 20000
+
+//
+// A read request. The link comes first, thus a link is its request.
+//
+typedef struct _TestRequest
+{
+	OBSRV_PEND_LINK Link;
+	DWORD           dwIssued;     // 1-based, in the order parked
+	DWORD           dwCompleted;  // 1-based, 0 while parked
+	size_t          cbReturned;
+	vector<BYTE>    buffer;
+} TEST_REQUEST, *PTEST_REQUEST;
+
+//
+// The driver's state: the ring, the parked requests and the lock that
+// serializes the deliver steps
+//
+class CTestDriver
+{
+public:
+	CTestDriver(OBSRV_U32 nCapacity):
+		m_Cells(nCapacity),
+		m_dwCompleted(0)
+	{
+		ObsrvRingInit(&m_Ring, &m_Cells[0], nCapacity);
+		ObsrvPendQueueInit(&m_Queue);
+	}
+	//
+	// Complete the oldest parked requests while records are published
+	//
+	void DeliverStep()
+	{
+		lock_guard<mutex> guard(m_Lock);
+
+		while (NULL != ObsrvRingPeek(&m_Ring))
+		{
+			PTEST_REQUEST pRequest = (PTEST_REQUEST)ObsrvPendQueueNextToComplete(&m_Queue, TRUE);
+
+			if (NULL == pRequest)
+				break;
+			pRequest->cbReturned  = ObsrvBatchFillFromRing(
+				&m_Ring,
+				&pRequest->buffer[0],
+				pRequest->buffer.size(),
+				NULL
+				);
+			pRequest->dwCompleted = ++m_dwCompleted;
+		} // while
+	}
+	//
+	// Park a request, then deliver
+	//
+	void Park(PTEST_REQUEST pRequest)
+	{
+		{
+			lock_guard<mutex> guard(m_Lock);
+
+			ObsrvPendQueueInsert(&m_Queue, &pRequest->Link);
+		}
+		DeliverStep();
+	}
+	//
+	// Append a record, then deliver
+	//
+	BOOL Push(DWORD dwProcessId)
+	{
+		OBSRV_PROCESS_RECORD record;
+		BOOL                 bPushed;
+
+		::ZeroMemory(&record, sizeof(record));
+		record.Kind       = OBSRV_KIND_PROCESS_CREATE;
+		record.hProcessId = dwProcessId;
+		bPushed = ObsrvRingPush(&m_Ring, &record);
+		DeliverStep();
+
+		return bPushed;
+	}
+	vector<OBSRV_RING_CELL> m_Cells;
+	OBSRV_RING              m_Ring;
+	OBSRV_PEND_QUEUE        m_Queue;
+	DWORD                   m_dwCompleted;
+	mutex                   m_Lock;
+};
+
+//
+// The process IDs a completed request has returned
+//
+static vector<DWORD> GetProcessIds(const TEST_REQUEST& request)
+{
+	vector<DWORD>      ids;
+	OBSRV_BATCH_HEADER header;
+	OBSRV_RECORD_VIEW  view;
+	const BYTE*        pbRecord = (const BYTE*)ObsrvBatchDecode(&request.buffer[0], request.cbReturned, &header);
+	size_t             cbLeft = header.Bytes;
+
+	if (NULL == pbRecord)
+		return ids;
+	for (DWORD i = 0; i < header.Count; i++)
+	{
+		OBSRV_U32 cbRecord = ObsrvRecordDecode(pbRecord, cbLeft, &view);
+
+		if (0 == cbRecord)
+			break;
+		ids.push_back(view.ProcessId);
+		pbRecord += cbRecord;
+		cbLeft   -= cbRecord;
+	} // for
+
+	return ids;
+}
+
+//
+// The queue itself: FIFO order and cancellation
+//
+static void TestQueue()
+{
+	OBSRV_PEND_QUEUE queue;
+	TEST_REQUEST     requests[4];
+
+	ObsrvPendQueueInit(&queue);
+	CHECK(ObsrvPendQueueIsEmpty(&queue));
+	CHECK(NULL == ObsrvPendQueueNextToComplete(&queue, TRUE));
+	for (DWORD i = 0; i < 4; i++)
+		ObsrvPendQueueInsert(&queue, &requests[i].Link);
+	CHECK(4 == queue.Count);
+	CHECK(4 == queue.Parked);
+	CHECK(&requests[0].Link == ObsrvPendQueuePeekNext(&queue, NULL));
+	CHECK(&requests[1].Link == ObsrvPendQueuePeekNext(&queue, &requests[0].Link));
+	CHECK(NULL == ObsrvPendQueuePeekNext(&queue, &requests[3].Link));
+	//
+	// A cancelled request leaves the others in order
+	//
+	ObsrvPendQueueRemove(&queue, &requests[1].Link);
+	CHECK(3 == queue.Count);
+	CHECK(NULL == ObsrvPendQueueNextToComplete(&queue, FALSE));
+	CHECK(&requests[0].Link == ObsrvPendQueueNextToComplete(&queue, TRUE));
+	CHECK(&requests[2].Link == ObsrvPendQueueNextToComplete(&queue, TRUE));
+	CHECK(&requests[3].Link == ObsrvPendQueueNextToComplete(&queue, TRUE));
+	CHECK(ObsrvPendQueueIsEmpty(&queue));
+	CHECK(0 == queue.Count);
+	CHECK(4 == queue.Parked);
+}
+
+//
+// Park, then deliver: either side arriving first
+//
+static void TestParkThenDeliver()
+{
+	CTestDriver  driver(64);
+	TEST_REQUEST requests[3];
+
+	for (DWORD i = 0; i < 3; i++)
+	{
+		requests[i].dwIssued    = i + 1;
+		requests[i].dwCompleted = 0;
+		requests[i].cbReturned  = 0;
+		requests[i].buffer.resize(OBSRV_BATCH_DEFAULT_SIZE);
+	} // for
+	//
+	// Records buffered before any request are picked up by the first
+	//
+	driver.Push(1);
+	driver.Push(2);
+	CHECK(2 == ObsrvRingCount(&driver.m_Ring));
+	driver.Park(&requests[0]);
+	CHECK(1 == requests[0].dwCompleted);
+	CHECK((vector<DWORD>{ 1, 2 }) == GetProcessIds(requests[0]));
+	//
+	// Requests parked first are completed by the next record, oldest first
+	//
+	driver.Park(&requests[1]);
+	driver.Park(&requests[2]);
+	CHECK(0 == requests[1].dwCompleted);
+	CHECK(2 == driver.m_Queue.Count);
+	driver.Push(3);
+	CHECK(2 == requests[1].dwCompleted);
+	CHECK(0 == requests[2].dwCompleted);
+	CHECK((vector<DWORD>{ 3 }) == GetProcessIds(requests[1]));
+	driver.Push(4);
+	CHECK(3 == requests[2].dwCompleted);
+	CHECK((vector<DWORD>{ 4 }) == GetProcessIds(requests[2]));
+	CHECK(0 == ObsrvRingCount(&driver.m_Ring));
+}
+
+//
+// A producer has claimed the head but not published it yet
+//
+static void TestUnpublishedHead()
+{
+	CTestDriver          driver(16);
+	TEST_REQUEST         requests[2];
+	OBSRV_PROCESS_RECORD record;
+	OBSRV_U64            nPos;
+
+	for (DWORD i = 0; i < 2; i++)
+	{
+		requests[i].dwIssued    = i + 1;
+		requests[i].dwCompleted = 0;
+		requests[i].cbReturned  = 0;
+		requests[i].buffer.resize(OBSRV_BATCH_DEFAULT_SIZE);
+	} // for
+	//
+	// Claim a cell the way ObsrvRingPush() does, without publishing
+	//
+	nPos = driver.m_Ring.Head;
+	driver.m_Ring.Head = nPos + 1;
+	CHECK(1 == ObsrvRingCount(&driver.m_Ring));
+	driver.Park(&requests[0]);
+	driver.Park(&requests[1]);
+	CHECK(0 == requests[0].dwCompleted);
+	CHECK(0 == requests[1].dwCompleted);
+	CHECK(&requests[0].Link == ObsrvPendQueuePeekNext(&driver.m_Queue, NULL));
+	CHECK(&requests[1].Link == ObsrvPendQueuePeekNext(&driver.m_Queue, &requests[0].Link));
+	//
+	// Publishing it, the producer runs the deliver step, which completes
+	// the request issued first
+	//
+	::ZeroMemory(&record, sizeof(record));
+	record.Kind       = OBSRV_KIND_PROCESS_CREATE;
+	record.hProcessId = 9;
+	driver.m_Cells[nPos & driver.m_Ring.Mask].Record = record;
+	OBSRV_STORE_RELEASE64(&driver.m_Cells[nPos & driver.m_Ring.Mask].Turn, nPos + 1);
+	driver.DeliverStep();
+	CHECK(1 == requests[0].dwCompleted);
+	CHECK(0 == requests[1].dwCompleted);
+	CHECK((vector<DWORD>{ 9 }) == GetProcessIds(requests[0]));
+	driver.Push(10);
+	CHECK(2 == requests[1].dwCompleted);
+}
+
+//
+// Producers pushing and delivering while requests are parked one after
+// the other, the way the app keeps a few outstanding
+//
+static void TestConcurrent()
+{
+	CTestDriver          driver(ObsrvRingRoundCapacity(TEST_PRODUCERS * TEST_RECORDS_PER_THREAD));
+	vector<thread>       producers;
+	vector<TEST_REQUEST> requests(4096);
+	vector<DWORD>        lastSeen(TEST_PRODUCERS, 0);
+	DWORD                dwParked = 0;
+	DWORD                dwNextToCheck = 0;
+	DWORD                dwReceived = 0;
+	BOOL                 bOrdered = TRUE;
+	BOOL                 bInIssueOrder = TRUE;
+	DWORD                dwTotal = TEST_PRODUCERS * TEST_RECORDS_PER_THREAD;
+
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		requests[i].dwIssued    = (DWORD)i + 1;
+		requests[i].dwCompleted = 0;
+		requests[i].cbReturned  = 0;
+		requests[i].buffer.resize(sizeof(OBSRV_BATCH_HEADER) + 64 * 64);
+	} // for
+	for (DWORD dwProducer = 0; dwProducer < TEST_PRODUCERS; dwProducer++)
+		producers.push_back(thread([&driver, dwProducer]()
+		{
+			//
+			// The process ID tells the producer and the order. The ring
+			// holds them all, nothing is dropped.
+			//
+			for (DWORD i = 1; i <= TEST_RECORDS_PER_THREAD; i++)
+				driver.Push(dwProducer * TEST_RECORDS_PER_THREAD + i);
+		}));
+	//
+	// Keep 4 requests outstanding, check them as they complete
+	//
+	while ((dwReceived < dwTotal) && (dwNextToCheck < requests.size()))
+	{
+		BOOL bCompleted;
+
+		while ((dwParked < requests.size()) && (dwParked - dwNextToCheck < 4))
+			driver.Park(&requests[dwParked++]);
+		{
+			lock_guard<mutex> guard(driver.m_Lock);
+
+			bCompleted = (0 != requests[dwNextToCheck].dwCompleted);
+		}
+		if (!bCompleted)
+		{
+			this_thread::yield();
+			continue;
+		}
+		TEST_REQUEST& request = requests[dwNextToCheck++];
+		vector<DWORD> ids = GetProcessIds(request);
+
+		if (request.dwCompleted != request.dwIssued)
+			bInIssueOrder = FALSE;
+		for (size_t i = 0; i < ids.size(); i++)
+		{
+			DWORD dwProducer = (ids[i] - 1) / TEST_RECORDS_PER_THREAD;
+
+			if ((dwProducer >= TEST_PRODUCERS) || (ids[i] <= lastSeen[dwProducer]))
+				bOrdered = FALSE;
+			else
+				lastSeen[dwProducer] = ids[i];
+		} // for
+		dwReceived += (DWORD)ids.size();
+	} // while
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+
+	CHECK(dwTotal == dwReceived);
+	CHECK(bOrdered);
+	CHECK(bInIssueOrder);
+	CHECK(0 == ObsrvRingOverflow(&driver.m_Ring));
+}
+
+int main()
+{
+	TestQueue();
+	TestParkThenDeliver();
+	TestUnpublishedHead();
+	TestConcurrent();
+
+	return TestResult("TestObsrvPend");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,280 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvPerCpu.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the per-CPU thread event buffers and their merge
+//              (Shared/ObsrvPerCpu.h)
+//
+// DESCRIPTION:
+//              A full buffer counts what it drops. The merge yields the
+//              entries of all buffers in timestamp order, ties in buffer
+//              order, and leaves what is pushed while it runs to the next
+//              one. With a thread per buffer, what is merged and what is
+//              dropped add up to what has been pushed.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvPerCpu.h"
+#include <atomic>
+#include <stdlib.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Events every thread pushes in the concurrent test
+//
+#define TEST_EVENTS             200000
+
+//
+// Buffers with their entries and the merge's scratch space
+//
+class CTestBuffers
+{
+public:
+	CTestBuffers(
+		OBSRV_U32 nBuffers,
+		OBSRV_U32 nCapacity
+		):
+		m_Buffers(nBuffers),
+		m_Entries(nBuffers * nCapacity),
+		m_Scratch(ObsrvCpuMergeScratchSize(nBuffers) / sizeof(OBSRV_U64) + 1)
+	{
+		for (OBSRV_U32 i = 0; i < nBuffers; i++)
+			ObsrvCpuBufferInit(&m_Buffers[i], &m_Entries[i * nCapacity], nCapacity);
+	}
+	POBSRV_CPU_BUFFER GetBuffer(OBSRV_U32 nIndex)
+	{
+		return &m_Buffers[nIndex];
+	}
+	//
+	// Push a thread create stamped llTimestamp, tagged with its buffer
+	//
+	BOOL Push(
+		OBSRV_U32 nIndex,
+		OBSRV_I64 llTimestamp,
+		OBSRV_U32 nThreadId
+		)
+	{
+		OBSRV_THREAD_ENTRY entry;
+
+		::ZeroMemory(&entry, sizeof(entry));
+		entry.Timestamp = llTimestamp;
+		entry.ProcessId = nIndex;
+		entry.ThreadId  = nThreadId;
+		entry.Flags     = OBSRV_THREAD_FLAG_CREATE;
+
+		return ObsrvCpuBufferPush(&m_Buffers[nIndex], &entry);
+	}
+	//
+	// Merge what all buffers hold right now
+	//
+	vector<OBSRV_THREAD_ENTRY> Drain()
+	{
+		OBSRV_CPU_MERGE            merge;
+		const OBSRV_THREAD_ENTRY*  pEntry;
+		vector<OBSRV_THREAD_ENTRY> entries;
+
+		ObsrvCpuMergeBegin(&merge, &m_Buffers[0], (OBSRV_U32)m_Buffers.size(), &m_Scratch[0]);
+		while (NULL != (pEntry = ObsrvCpuMergePeek(&merge)))
+		{
+			entries.push_back(*pEntry);
+			ObsrvCpuMergePop(&merge);
+		} // while
+
+		return entries;
+	}
+private:
+	vector<OBSRV_CPU_BUFFER>   m_Buffers;
+	vector<OBSRV_THREAD_ENTRY> m_Entries;
+	vector<OBSRV_U64>          m_Scratch;
+};
+
+//
+// Whether entries are in merge order: by timestamp, then by buffer
+//
+static BOOL IsMergeOrder(const vector<OBSRV_THREAD_ENTRY>& entries)
+{
+	for (size_t i = 1; i < entries.size(); i++)
+	{
+		if (entries[i - 1].Timestamp > entries[i].Timestamp)
+			return FALSE;
+		if ((entries[i - 1].Timestamp == entries[i].Timestamp) &&
+		    (entries[i - 1].ProcessId > entries[i].ProcessId))
+			return FALSE;
+	} // for
+
+	return TRUE;
+}
+
+//
+// A buffer on its own
+//
+static void TestBuffer()
+{
+	OBSRV_U32    nCapacity = ObsrvCpuBufferRoundCapacity(100);
+	CTestBuffers buffers(1, nCapacity);
+
+	CHECK(128 == nCapacity);
+	CHECK(OBSRV_CPU_BUFFER_MIN_CAPACITY == ObsrvCpuBufferRoundCapacity(0));
+	CHECK(OBSRV_CPU_BUFFER_MAX_CAPACITY == ObsrvCpuBufferRoundCapacity(0xFFFFFFFF));
+	for (OBSRV_U32 i = 0; i < nCapacity; i++)
+		CHECK(buffers.Push(0, i, i));
+	CHECK(!buffers.Push(0, 1000, 1000));
+	CHECK(!buffers.Push(0, 1001, 1001));
+	CHECK(nCapacity == ObsrvCpuBufferCount(buffers.GetBuffer(0)));
+	CHECK(2 == ObsrvCpuBufferTakeDropped(buffers.GetBuffer(0)));
+	CHECK(0 == ObsrvCpuBufferTakeDropped(buffers.GetBuffer(0)));
+	//
+	// The dropped ones are gone, the rest comes out in order
+	//
+	vector<OBSRV_THREAD_ENTRY> entries = buffers.Drain();
+
+	CHECK(nCapacity == entries.size());
+	for (OBSRV_U32 i = 0; i < entries.size(); i++)
+		CHECK(i == entries[i].ThreadId);
+	CHECK(0 == ObsrvCpuBufferCount(buffers.GetBuffer(0)));
+	CHECK(buffers.Push(0, 2000, 2000));
+	CHECK(0 == ObsrvCpuBufferTakeDropped(buffers.GetBuffer(0)));
+}
+
+//
+// Interleaved timestamps, ties, and empty buffers
+//
+static void TestMerge()
+{
+	CTestBuffers               buffers(16, 256);
+	vector<OBSRV_THREAD_ENTRY> entries;
+	DWORD                      dwPushed = 0;
+
+	CHECK(buffers.Drain().empty());
+	srand(3);
+	for (OBSRV_U32 i = 0; i < 16; i++)
+	{
+		OBSRV_I64 llTimestamp = 0;
+
+		//
+		// Every third buffer stays empty
+		//
+		if (0 == i % 3)
+			continue;
+		for (OBSRV_U32 j = 0; j < 200; j++)
+		{
+			llTimestamp += rand() % 4;
+			CHECK(buffers.Push(i, llTimestamp, j));
+			dwPushed++;
+		} // for
+	} // for
+	entries = buffers.Drain();
+	CHECK(dwPushed == entries.size());
+	CHECK(IsMergeOrder(entries));
+	CHECK(buffers.Drain().empty());
+}
+
+//
+// What is pushed once the merge has begun waits for the next one
+//
+static void TestSnapshot()
+{
+	CTestBuffers              buffers(2, 64);
+	vector<OBSRV_U64>         scratch(ObsrvCpuMergeScratchSize(2) / sizeof(OBSRV_U64) + 1);
+	OBSRV_CPU_MERGE           merge;
+	const OBSRV_THREAD_ENTRY* pEntry;
+	DWORD                     dwMerged = 0;
+
+	buffers.Push(0, 10, 1);
+	buffers.Push(1, 20, 2);
+	ObsrvCpuMergeBegin(&merge, buffers.GetBuffer(0), 2, &scratch[0]);
+	buffers.Push(0, 30, 3);
+	buffers.Push(1, 5, 4);
+	while (NULL != (pEntry = ObsrvCpuMergePeek(&merge)))
+	{
+		CHECK(pEntry->ThreadId == ++dwMerged);
+		ObsrvCpuMergePop(&merge);
+	} // while
+	CHECK(2 == dwMerged);
+
+	vector<OBSRV_THREAD_ENTRY> entries = buffers.Drain();
+
+	CHECK(2 == entries.size());
+	CHECK((2 == entries.size()) && (4 == entries[0].ThreadId) && (3 == entries[1].ThreadId));
+}
+
+//
+// A thread per buffer, playing its CPU, and a consumer draining them
+//
+static void TestConcurrent()
+{
+	CTestBuffers             buffers(4, 1024);
+	atomic<OBSRV_I64>        llClock(0);
+	atomic<DWORD>            dwRunning(4);
+	vector<thread>           producers;
+	vector<OBSRV_U32>        nNext(4, 0);
+	ULONG64                  ullMerged = 0;
+	ULONG64                  ullDropped = 0;
+	BOOL                     bLast = FALSE;
+
+	for (OBSRV_U32 i = 0; i < 4; i++)
+		producers.push_back(thread([&buffers, &llClock, &dwRunning, i]()
+		{
+			for (OBSRV_U32 j = 0; j < TEST_EVENTS; j++)
+				buffers.Push(i, llClock++, j);
+			dwRunning--;
+		}));
+	//
+	// One more drain once all of them are done
+	//
+	while (!bLast)
+	{
+		bLast = (0 == dwRunning);
+
+		vector<OBSRV_THREAD_ENTRY> entries = buffers.Drain();
+
+		CHECK(IsMergeOrder(entries));
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			//
+			// A buffer's entries come in the order it took them, with
+			// gaps where it was full
+			//
+			OBSRV_U32 nIndex = entries[i].ProcessId;
+
+			CHECK(entries[i].ThreadId >= nNext[nIndex]);
+			nNext[nIndex] = entries[i].ThreadId + 1;
+		} // for
+		ullMerged += entries.size();
+		for (OBSRV_U32 i = 0; i < 4; i++)
+			ullDropped += ObsrvCpuBufferTakeDropped(buffers.GetBuffer(i));
+		std::this_thread::yield();
+	} // while
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+	CHECK(4ULL * TEST_EVENTS == ullMerged + ullDropped);
+	CHECK(ullMerged > 0);
+}
+
+int main()
+{
+	TestBuffer();
+	TestMerge();
+	TestSnapshot();
+	TestConcurrent();
+
+	return TestResult("TestObsrvPerCpu");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,376 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvRecord.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the event record format (Shared/ObsrvRecord.h)
+//
+// DESCRIPTION:
+//              What is encoded decodes to the same values, unknown fields
+//              are skipped, and strings and image paths that don't fit are
+//              cut and flagged. Image load records carry their images and
+//              thread records their entries in the order they were put.
+//              Truncated, misaligned and inconsistent records are
+//              rejected without reading outside of the buffer.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvRecord.h"
+#include <stdlib.h>
+#include <string.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A tag no decoder knows yet
+//
+#define TEST_TAG_UNKNOWN        20
+
+//
+// A UTF-16 string of cchText characters
+//
+static vector<OBSRV_U16> MakeText(
+	OBSRV_U32 cchText,
+	OBSRV_U16 chFirst
+	)
+{
+	vector<OBSRV_U16> text(cchText + 1, 0);
+
+	for (OBSRV_U32 i = 0; i < cchText; i++)
+		text[i] = (OBSRV_U16)(chFirst + i % 26);
+
+	return text;
+}
+
+//
+// Whether a decoded string is the text it was made of
+//
+static BOOL IsText(
+	const OBSRV_U16* pszText,
+	OBSRV_U32        cchText,
+	OBSRV_U16        chFirst
+	)
+{
+	for (OBSRV_U32 i = 0; i < cchText; i++)
+		if (pszText[i] != (OBSRV_U16)(chFirst + i % 26))
+			return FALSE;
+
+	return TRUE;
+}
+
+//
+// A process create with every field, and one a newer producer added
+//
+static void TestRoundTrip()
+{
+	vector<OBSRV_U64>   buffer(OBSRV_RECORD_MAX_SIZE / sizeof(OBSRV_U64));
+	vector<OBSRV_U16>   szPath = MakeText(37, 'a');
+	vector<OBSRV_U16>   szCommandLine = MakeText(101, 'A');
+	OBSRV_RECORD_WRITER writer;
+	OBSRV_RECORD_VIEW   view;
+	OBSRV_U32           cbRecord;
+	OBSRV_U8            abUnknown[3] = { 1, 2, 3 };
+
+	CHECK(ObsrvRecordBegin(&writer, &buffer[0], OBSRV_RECORD_MAX_SIZE, OBSRV_KIND_PROCESS_CREATE, 77, -5));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, 1000));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_PARENT_ID, 999));
+	CHECK(ObsrvRecordPut(&writer, TEST_TAG_UNKNOWN, abUnknown, sizeof(abUnknown)));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_CREATING_PROCESS_ID, 998));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_CREATING_THREAD_ID, 997));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_SESSION_ID, 2));
+	CHECK(37 == ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, &szPath[0], 37));
+	CHECK(101 == ObsrvRecordPutString(&writer, OBSRV_TAG_COMMAND_LINE, &szCommandLine[0], 101));
+	cbRecord = ObsrvRecordEnd(&writer);
+	CHECK(0 != cbRecord);
+	CHECK(0 == (cbRecord & 7));
+	//
+	// Decoding doesn't need more than the record, records follow each
+	// other back to back
+	//
+	CHECK(cbRecord == ObsrvRecordDecode(&buffer[0], cbRecord, &view));
+	CHECK(cbRecord == ObsrvRecordDecode(&buffer[0], OBSRV_RECORD_MAX_SIZE, &view));
+	CHECK(OBSRV_RECORD_VERSION == view.Version);
+	CHECK(OBSRV_KIND_PROCESS_CREATE == view.Kind);
+	CHECK(ObsrvIsProcessKind(view.Kind));
+	CHECK(0 == view.Flags);
+	CHECK(77 == view.Sequence);
+	CHECK(-5 == view.Timestamp);
+	CHECK(1000 == view.ProcessId);
+	CHECK(999 == view.ParentId);
+	CHECK(998 == view.CreatingProcessId);
+	CHECK(997 == view.CreatingThreadId);
+	CHECK(2 == view.SessionId);
+	CHECK(37 == view.ImagePathLength);
+	CHECK(IsText(view.ImagePath, 37, 'a'));
+	CHECK(101 == view.CommandLineLength);
+	CHECK(IsText(view.CommandLine, 101, 'A'));
+	CHECK(ObsrvRecordHas(&view, TEST_TAG_UNKNOWN));
+	CHECK(!ObsrvRecordHas(&view, OBSRV_TAG_EXIT_STATUS));
+	CHECK(!ObsrvRecordHas(&view, 40));
+	CHECK(0 == view.ImageCount);
+	CHECK(0 == view.ThreadCount);
+	//
+	// Fields encoded up front travel into another record with the flags
+	//
+	vector<OBSRV_U64>   copy(OBSRV_RECORD_MAX_SIZE / sizeof(OBSRV_U64));
+	OBSRV_RECORD_WRITER other;
+
+	((POBSRV_RECORD_HEADER)&buffer[0])->Flags = OBSRV_RECORD_FLAG_TRUNCATED;
+	CHECK(ObsrvRecordBegin(&other, &copy[0], OBSRV_RECORD_MAX_SIZE, OBSRV_KIND_PROCESS_EXIT, 1, 1));
+	CHECK(ObsrvRecordPutU32(&other, OBSRV_TAG_EXIT_STATUS, 0xC0000005));
+	CHECK(ObsrvRecordPutFields(&other, &buffer[0]));
+	CHECK(0 != ObsrvRecordEnd(&other));
+	CHECK(0 != ObsrvRecordDecode(&copy[0], OBSRV_RECORD_MAX_SIZE, &view));
+	CHECK(OBSRV_KIND_PROCESS_EXIT == view.Kind);
+	CHECK(0xC0000005 == view.ExitStatus);
+	CHECK(1000 == view.ProcessId);
+	CHECK(IsText(view.CommandLine, view.CommandLineLength, 'A'));
+	CHECK(0 != (view.Flags & OBSRV_RECORD_FLAG_TRUNCATED));
+}
+
+//
+// Whatever doesn't fit is left out or cut, never written past the end
+//
+static void TestTruncation()
+{
+	vector<OBSRV_U64>   buffer(OBSRV_RECORD_MAX_SIZE / sizeof(OBSRV_U64) + 2);
+	vector<OBSRV_U16>   szPath = MakeText(5000, 'a');
+	OBSRV_RECORD_WRITER writer;
+	OBSRV_RECORD_VIEW   view;
+	OBSRV_U32           cchStored;
+	OBSRV_U32           cbUsed;
+
+	CHECK(!ObsrvRecordBegin(&writer, &buffer[0], sizeof(OBSRV_RECORD_HEADER) - 1, OBSRV_KIND_PROCESS_CREATE, 1, 0));
+	CHECK(ObsrvRecordBegin(&writer, &buffer[0], sizeof(OBSRV_RECORD_HEADER), OBSRV_KIND_PROCESS_CREATE, 1, 0));
+	CHECK(!ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, 1));
+	CHECK(sizeof(OBSRV_RECORD_HEADER) == ObsrvRecordEnd(&writer));
+	//
+	// A record is never larger than OBSRV_RECORD_MAX_SIZE, whatever the
+	// buffer
+	//
+	buffer.back() = 0x5A5A5A5A5A5A5A5AULL;
+	CHECK(ObsrvRecordBegin(&writer, &buffer[0], (OBSRV_U32)(buffer.size() * sizeof(OBSRV_U64)), OBSRV_KIND_PROCESS_CREATE, 1, 0));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, 1));
+	cchStored = ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, &szPath[0], 5000);
+	CHECK(cchStored < 5000);
+	CHECK(cchStored > 4000);
+	cbUsed = writer.cbUsed;
+	CHECK(!ObsrvRecordPutU32(&writer, OBSRV_TAG_SESSION_ID, 1));
+	CHECK(cbUsed == writer.cbUsed);
+	CHECK(0 == ObsrvRecordPutString(&writer, OBSRV_TAG_COMMAND_LINE, &szPath[0], 10));
+	CHECK(OBSRV_RECORD_MAX_SIZE == ObsrvRecordEnd(&writer));
+	CHECK(0x5A5A5A5A5A5A5A5AULL == buffer.back());
+	CHECK(OBSRV_RECORD_MAX_SIZE == ObsrvRecordDecode(&buffer[0], OBSRV_RECORD_MAX_SIZE, &view));
+	CHECK(0 != (view.Flags & OBSRV_RECORD_FLAG_TRUNCATED));
+	CHECK(cchStored == view.ImagePathLength);
+	CHECK(IsText(view.ImagePath, view.ImagePathLength, 'a'));
+	CHECK(!ObsrvRecordHas(&view, OBSRV_TAG_COMMAND_LINE));
+	//
+	// A string that fits is not flagged
+	//
+	CHECK(ObsrvRecordBegin(&writer, &buffer[0], 256, OBSRV_KIND_PROCESS_CREATE, 1, 0));
+	CHECK(10 == ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, &szPath[0], 10));
+	CHECK(0 != ObsrvRecordEnd(&writer));
+	CHECK(0 != ObsrvRecordDecode(&buffer[0], 256, &view));
+	CHECK(0 == view.Flags);
+}
+
+//
+// An image load record carries any number of images
+//
+static void TestImages()
+{
+	vector<OBSRV_U64>   buffer(1024 / sizeof(OBSRV_U64));
+	vector<OBSRV_U16>   szPath = MakeText(200, 'a');
+	OBSRV_RECORD_WRITER writer;
+	OBSRV_RECORD_VIEW   view;
+	OBSRV_IMAGE_VIEW    image;
+	OBSRV_U32           nOffset = 0;
+	OBSRV_U32           nImages = 0;
+	OBSRV_U32           cbUsed;
+
+	CHECK(ObsrvRecordBegin(&writer, &buffer[0], 1024, OBSRV_KIND_IMAGE_LOAD, 3, 30));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, 42));
+	//
+	// Whole entries while they fit
+	//
+	while (ObsrvRecordPutImage(&writer, 0x10000 * (nImages + 1), 0x1000, nImages & 1, &szPath[0], 7 * nImages, FALSE))
+		nImages++;
+	CHECK(nImages > 3);
+	cbUsed = writer.cbUsed;
+	CHECK(!ObsrvRecordPutImage(&writer, 0, 0, 0, &szPath[0], 200, FALSE));
+	CHECK(cbUsed == writer.cbUsed);
+	//
+	// One more, with its path cut to what fits
+	//
+	CHECK(ObsrvRecordPutImage(&writer, 0xFFFF0000, 0x2000, OBSRV_IMAGE_FLAG_SYSTEM, &szPath[0], 200, TRUE));
+	CHECK(0 != ObsrvRecordEnd(&writer));
+	CHECK(0 != ObsrvRecordDecode(&buffer[0], 1024, &view));
+	CHECK(OBSRV_KIND_IMAGE_LOAD == view.Kind);
+	CHECK(!ObsrvIsProcessKind(view.Kind));
+	CHECK(42 == view.ProcessId);
+	CHECK(nImages + 1 == view.ImageCount);
+	CHECK(0 != (view.Flags & OBSRV_RECORD_FLAG_TRUNCATED));
+	for (OBSRV_U32 i = 0; i < nImages; i++)
+	{
+		CHECK(ObsrvRecordNextImage(&buffer[0], &nOffset, &image));
+		CHECK(0x10000ULL * (i + 1) == image.ImageBase);
+		CHECK(0x1000 == image.ImageSize);
+		CHECK((i & 1) == image.Flags);
+		CHECK(7 * i == image.ImagePathLength);
+		CHECK(IsText(image.ImagePath, image.ImagePathLength, 'a'));
+	} // for
+	CHECK(ObsrvRecordNextImage(&buffer[0], &nOffset, &image));
+	CHECK(0xFFFF0000 == image.ImageBase);
+	CHECK(OBSRV_IMAGE_FLAG_SYSTEM == image.Flags);
+	CHECK((image.ImagePathLength > 0) && (image.ImagePathLength < 200));
+	CHECK(IsText(image.ImagePath, image.ImagePathLength, 'a'));
+	CHECK(!ObsrvRecordNextImage(&buffer[0], &nOffset, &image));
+	CHECK(!ObsrvRecordNextImage(&buffer[0], &nOffset, &image));
+}
+
+//
+// A thread record carries its entries in order, and what has been lost
+//
+static void TestThreads()
+{
+	vector<OBSRV_U64>   buffer(OBSRV_RECORD_MAX_SIZE / sizeof(OBSRV_U64));
+	OBSRV_RECORD_WRITER writer;
+	OBSRV_RECORD_VIEW   view;
+	OBSRV_THREAD_ENTRY  entry;
+	OBSRV_U32           nOffset = 0;
+
+	CHECK(ObsrvRecordBegin(&writer, &buffer[0], OBSRV_RECORD_MAX_SIZE, OBSRV_KIND_THREAD, 9, 100));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_DROPPED, 12));
+	for (OBSRV_U32 i = 0; i < 50; i++)
+	{
+		::ZeroMemory(&entry, sizeof(entry));
+		entry.Timestamp = 100 + i;
+		entry.ProcessId = 4 + i / 10;
+		entry.ThreadId  = 1000 + i;
+		entry.Flags     = (i < 25) ? OBSRV_THREAD_FLAG_CREATE : 0;
+		CHECK(ObsrvRecordPut(&writer, OBSRV_TAG_THREAD, &entry, sizeof(entry)));
+	} // for
+	CHECK(0 != ObsrvRecordEnd(&writer));
+	CHECK(0 != ObsrvRecordDecode(&buffer[0], OBSRV_RECORD_MAX_SIZE, &view));
+	CHECK(OBSRV_KIND_THREAD == view.Kind);
+	CHECK(50 == view.ThreadCount);
+	CHECK(12 == view.Dropped);
+	CHECK(0 == view.ImageCount);
+	for (OBSRV_U32 i = 0; i < 50; i++)
+	{
+		CHECK(ObsrvRecordNextThread(&buffer[0], &nOffset, &entry));
+		CHECK(100 + (OBSRV_I64)i == entry.Timestamp);
+		CHECK(4 + i / 10 == entry.ProcessId);
+		CHECK(1000 + i == entry.ThreadId);
+		CHECK(((i < 25) ? OBSRV_THREAD_FLAG_CREATE : 0) == entry.Flags);
+	} // for
+	CHECK(!ObsrvRecordNextThread(&buffer[0], &nOffset, &entry));
+}
+
+//
+// Every way a record can be broken
+//
+static void TestMalformed()
+{
+	vector<OBSRV_U64>   buffer(64);
+	vector<OBSRV_U64>   good(64);
+	vector<OBSRV_U16>   szPath = MakeText(9, 'a');
+	OBSRV_RECORD_WRITER writer;
+	OBSRV_RECORD_VIEW   view;
+	OBSRV_U32           cbRecord;
+	OBSRV_U8*           pbRecord = (OBSRV_U8*)&buffer[0];
+	POBSRV_FIELD_HEADER pField = (POBSRV_FIELD_HEADER)(pbRecord + sizeof(OBSRV_RECORD_HEADER));
+
+	CHECK(ObsrvRecordBegin(&writer, &good[0], (OBSRV_U32)(good.size() * sizeof(OBSRV_U64)), OBSRV_KIND_PROCESS_CREATE, 1, 0));
+	CHECK(ObsrvRecordPutU32(&writer, OBSRV_TAG_PROCESS_ID, 1));
+	CHECK(ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, &szPath[0], 9));
+	cbRecord = ObsrvRecordEnd(&writer);
+	CHECK(cbRecord == ObsrvRecordDecode(&good[0], cbRecord, &view));
+	//
+	// Less than the whole record
+	//
+	CHECK(0 == ObsrvRecordDecode(NULL, cbRecord, &view));
+	for (OBSRV_U32 cbBuffer = 0; cbBuffer < cbRecord; cbBuffer++)
+		CHECK(0 == ObsrvRecordDecode(&good[0], cbBuffer, &view));
+	//
+	// A header that doesn't add up
+	//
+	buffer = good;
+	((POBSRV_RECORD_HEADER)pbRecord)->Size = cbRecord - 4;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	buffer = good;
+	((POBSRV_RECORD_HEADER)pbRecord)->Size = sizeof(OBSRV_RECORD_HEADER) - 8;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	buffer = good;
+	((POBSRV_RECORD_HEADER)pbRecord)->Version = OBSRV_RECORD_VERSION + 1;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	//
+	// A field running past the record
+	//
+	buffer = good;
+	pField->Length = (OBSRV_U16)cbRecord;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	//
+	// A fixed size field of the wrong size
+	//
+	buffer = good;
+	pField->Length = 2;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	//
+	// Half a character
+	//
+	buffer = good;
+	pField->Tag = OBSRV_TAG_COMMAND_LINE;
+	pField->Length = 3;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	//
+	// An image or thread entry shorter than its fixed part
+	//
+	buffer = good;
+	pField->Tag = OBSRV_TAG_IMAGE;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	buffer = good;
+	pField->Tag = OBSRV_TAG_THREAD;
+	CHECK(0 == ObsrvRecordDecode(pbRecord, cbRecord, &view));
+	//
+	// Garbage never makes the decoder claim more than it was given
+	//
+	srand(1);
+	for (DWORD i = 0; i < 100000; i++)
+	{
+		size_t cbBuffer = rand() % (buffer.size() * sizeof(OBSRV_U64));
+
+		buffer = good;
+		for (DWORD j = rand() % 8; j > 0; j--)
+			pbRecord[rand() % cbRecord] = (OBSRV_U8)rand();
+		CHECK(ObsrvRecordDecode(pbRecord, cbBuffer, &view) <= cbBuffer);
+	} // for
+}
+
+int main()
+{
+	TestRoundTrip();
+	TestTruncation();
+	TestImages();
+	TestThreads();
+	TestMalformed();
+
+	return TestResult("TestObsrvRecord");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,227 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvRing.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the driver's record ring (Shared/ObsrvRing.h)
+//
+// DESCRIPTION:
+//              Records come out in the order they went in, a full ring
+//              drops and counts, and the sequence numbers skip the
+//              dropped records. Several producers pushing at once lose
+//              nothing they weren't told about, and the records of each
+//              producer stay in order.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvRing.h"
+#include <thread>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Producers and records pushed by each of them in the concurrent test
+//
+#define TEST_PRODUCERS          4
+#define TEST_RECORDS_PER_THREAD 200000
+
+//
+// A ring with its own storage
+//
+class CTestRing
+{
+public:
+	CTestRing(OBSRV_U32 nRequested):
+		m_Cells(ObsrvRingRoundCapacity(nRequested))
+	{
+		ObsrvRingInit(&m_Ring, &m_Cells[0], (OBSRV_U32)m_Cells.size());
+	}
+	OBSRV_RING m_Ring;
+private:
+	vector<OBSRV_RING_CELL> m_Cells;
+};
+
+//
+// A record of process dwProcessId
+//
+static OBSRV_PROCESS_RECORD MakeRecord(
+	DWORD dwProcessId,
+	DWORD dwParentId
+	)
+{
+	OBSRV_PROCESS_RECORD record;
+
+	::ZeroMemory(&record, sizeof(record));
+	record.hProcessId = dwProcessId;
+	record.hParentId  = dwParentId;
+	record.bCreate    = 1;
+
+	return record;
+}
+
+//
+// Capacities are powers of two within the bounds
+//
+static void TestRoundCapacity()
+{
+	CHECK(OBSRV_RING_MIN_CAPACITY == ObsrvRingRoundCapacity(0));
+	CHECK(OBSRV_RING_MIN_CAPACITY == ObsrvRingRoundCapacity(OBSRV_RING_MIN_CAPACITY));
+	CHECK(1024 == ObsrvRingRoundCapacity(1000));
+	CHECK(1024 == ObsrvRingRoundCapacity(1024));
+	CHECK(2048 == ObsrvRingRoundCapacity(1025));
+	CHECK(OBSRV_RING_MAX_CAPACITY == ObsrvRingRoundCapacity(0xFFFFFFFF));
+}
+
+//
+// A single thread pushing and popping, across laps
+//
+static void TestOrder()
+{
+	CTestRing            ring(16);
+	OBSRV_PROCESS_RECORD record;
+	DWORD                dwNext = 1;
+
+	CHECK(0 == ObsrvRingPop(&ring.m_Ring, &record));
+	CHECK(NULL == ObsrvRingPeek(&ring.m_Ring));
+	for (DWORD dwLap = 0; dwLap < 10; dwLap++)
+	{
+		for (DWORD i = 0; i < 12; i++)
+		{
+			OBSRV_PROCESS_RECORD pushed = MakeRecord(dwLap * 12 + i + 1, 4);
+
+			CHECK(1 == ObsrvRingPush(&ring.m_Ring, &pushed));
+		} // for
+		CHECK(12 == ObsrvRingCount(&ring.m_Ring));
+		CHECK(dwNext == ObsrvRingPeek(&ring.m_Ring)->hProcessId);
+		while (ObsrvRingPop(&ring.m_Ring, &record))
+		{
+			CHECK(dwNext == record.hProcessId);
+			CHECK(dwNext == record.Sequence);
+			CHECK(4 == record.hParentId);
+			dwNext++;
+		} // while
+	} // for
+	CHECK(121 == dwNext);
+	CHECK(0 == ObsrvRingOverflow(&ring.m_Ring));
+}
+
+//
+// A full ring drops, and the next record popped skips their numbers
+//
+static void TestOverflow()
+{
+	CTestRing            ring(16);
+	OBSRV_PROCESS_RECORD record;
+	OBSRV_PROCESS_RECORD pushed;
+
+	for (DWORD i = 1; i <= 16; i++)
+	{
+		pushed = MakeRecord(i, 0);
+		CHECK(1 == ObsrvRingPush(&ring.m_Ring, &pushed));
+	} // for
+	pushed = MakeRecord(17, 0);
+	CHECK(0 == ObsrvRingPush(&ring.m_Ring, &pushed));
+	CHECK(0 == ObsrvRingPush(&ring.m_Ring, &pushed));
+	CHECK(2 == ObsrvRingOverflow(&ring.m_Ring));
+	//
+	// The drops are seen by the first pop after them
+	//
+	CHECK(1 == ObsrvRingPop(&ring.m_Ring, &record));
+	CHECK(1 == record.hProcessId);
+	CHECK(3 == record.Sequence);
+	ObsrvRingDrop(&ring.m_Ring);
+	CHECK(1 == ObsrvRingPop(&ring.m_Ring, &record));
+	CHECK(2 == record.hProcessId);
+	CHECK(5 == record.Sequence);
+	pushed = MakeRecord(18, 0);
+	CHECK(1 == ObsrvRingPush(&ring.m_Ring, &pushed));
+}
+
+//
+// Several producers at once, a consumer popping as they go
+//
+static void TestConcurrent()
+{
+	CTestRing      ring(1024);
+	vector<thread> producers;
+	vector<DWORD>  lastSeen(TEST_PRODUCERS, 0);
+	OBSRV_U64      ullPopped = 0;
+	OBSRV_U64      ullLastSequence = 0;
+	BOOL           bOrdered = TRUE;
+	BOOL           bNumbered = TRUE;
+
+	for (DWORD dwProducer = 0; dwProducer < TEST_PRODUCERS; dwProducer++)
+		producers.push_back(thread([&ring, dwProducer]()
+		{
+			for (DWORD i = 1; i <= TEST_RECORDS_PER_THREAD; i++)
+			{
+				OBSRV_PROCESS_RECORD record = MakeRecord(i, dwProducer);
+
+				ObsrvRingPush(&ring.m_Ring, &record);
+			} // for
+		}));
+	for (;;)
+	{
+		OBSRV_PROCESS_RECORD record;
+		BOOL                 bDone = (ullPopped + ObsrvRingOverflow(&ring.m_Ring) ==
+			(OBSRV_U64)TEST_PRODUCERS * TEST_RECORDS_PER_THREAD);
+
+		if (!ObsrvRingPop(&ring.m_Ring, &record))
+		{
+			if (bDone)
+				break;
+			this_thread::yield();
+			continue;
+		}
+		ullPopped++;
+		//
+		// The ID grows within a producer, the sequence number overall
+		//
+		if (record.hProcessId <= lastSeen[record.hParentId])
+			bOrdered = FALSE;
+		lastSeen[record.hParentId] = record.hProcessId;
+		if (record.Sequence <= ullLastSequence)
+			bNumbered = FALSE;
+		ullLastSequence = record.Sequence;
+	} // for
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+
+	CHECK(bOrdered);
+	CHECK(bNumbered);
+	CHECK(ullPopped > 0);
+	CHECK(ullPopped + ObsrvRingOverflow(&ring.m_Ring) ==
+		(OBSRV_U64)TEST_PRODUCERS * TEST_RECORDS_PER_THREAD);
+	//
+	// Numbers are taken by popped and dropped records alike
+	//
+	CHECK(ullLastSequence <= (OBSRV_U64)TEST_PRODUCERS * TEST_RECORDS_PER_THREAD);
+	CHECK(0 == ObsrvRingCount(&ring.m_Ring));
+}
+
+int main()
+{
+	TestRoundCapacity();
+	TestOrder();
+	TestOverflow();
+	TestConcurrent();
+
+	return TestResult("TestObsrvRing");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,399 @@
+//---------------------------------------------------------------------------
+//
+// TestObsrvSection.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the shared event section (Shared/ObsrvSection.h)
+//
+// DESCRIPTION:
+//              Records of varying sizes go round the byte ring many times
+//              and come out in order. A section of the wrong layout is
+//              refused. A producer that has to leave records behind
+//              wakes a consumer that is about to sleep, a wrap is never
+//              left unpublished, and a producer and a consumer thread
+//              running at once lose no record and no wake-up.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../Shared/ObsrvSection.h"
+#include <mutex>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Records pushed in the concurrent test
+//
+#define TEST_RECORDS            200000
+
+//
+// Different image paths the records carry, from 0 to 1000 characters
+//
+#define TEST_PATHS              16
+
+//
+// A section with its own memory, and encoded image paths the records
+// point to in Extra
+//
+class CTestSection
+{
+public:
+	CTestSection(OBSRV_U32 cbData):
+		m_Memory(ObsrvSectionTotalSize(cbData) / sizeof(OBSRV_U64) + 1),
+		m_Paths(TEST_PATHS)
+	{
+		ObsrvSectionCreate(&m_Writer, &m_Memory[0], cbData);
+		for (DWORD i = 0; i < TEST_PATHS; i++)
+		{
+			OBSRV_RECORD_WRITER writer;
+			vector<OBSRV_U16>   szPath(i * 1000 / (TEST_PATHS - 1) + 1, 'p');
+
+			m_Paths[i].resize(OBSRV_RECORD_MAX_SIZE);
+			ObsrvRecordBegin(&writer, &m_Paths[i][0], OBSRV_RECORD_MAX_SIZE, OBSRV_KIND_PROCESS_CREATE, 0, 0);
+			ObsrvRecordPutString(&writer, OBSRV_TAG_IMAGE_PATH, &szPath[0], (OBSRV_U32)szPath.size() - 1);
+			ObsrvRecordEnd(&writer);
+		} // for
+	}
+	void* GetMemory()
+	{
+		return &m_Memory[0];
+	}
+	size_t GetSize()
+	{
+		return m_Memory.size() * sizeof(OBSRV_U64);
+	}
+	//
+	// A create of dwProcessId, with one of the image paths
+	//
+	OBSRV_PROCESS_RECORD MakeRecord(DWORD dwProcessId)
+	{
+		OBSRV_PROCESS_RECORD record;
+
+		::ZeroMemory(&record, sizeof(record));
+		record.Kind       = OBSRV_KIND_PROCESS_CREATE;
+		record.hProcessId = dwProcessId;
+		record.Extra      = &m_Paths[(dwProcessId * 7) % TEST_PATHS][0];
+
+		return record;
+	}
+	OBSRV_SECTION_WRITER m_Writer;
+private:
+	vector<OBSRV_U64>          m_Memory;
+	vector< vector<OBSRV_U8> > m_Paths;
+};
+
+//
+// Read what the section holds. Checks that the records are the creates
+// following *pdwLast and have the image path they were given.
+//
+static DWORD ReadAll(
+	POBSRV_SECTION_READER pReader,
+	DWORD*                pdwLast,
+	OBSRV_U64*            pullLastSequence
+	)
+{
+	const void*       pvRecord;
+	OBSRV_U32         cbRecord;
+	OBSRV_RECORD_VIEW view;
+	DWORD             dwRead = 0;
+
+	while (0 != (cbRecord = ObsrvSectionRead(pReader, &pvRecord)))
+	{
+		BOOL bDecoded = (0 != ObsrvRecordDecode(pvRecord, cbRecord, &view));
+
+		CHECK(bDecoded);
+		if (!bDecoded)
+			break;
+		CHECK(view.ProcessId > *pdwLast);
+		CHECK(view.Sequence > *pullLastSequence);
+		CHECK(view.ImagePathLength == ((view.ProcessId * 7) % TEST_PATHS) * 1000 / (TEST_PATHS - 1));
+		*pdwLast          = view.ProcessId;
+		*pullLastSequence = view.Sequence;
+		dwRead++;
+	} // while
+
+	return dwRead;
+}
+
+//
+// A section of the wrong layout is refused
+//
+static void TestAttach()
+{
+	CTestSection         section(OBSRV_SECTION_MIN_SIZE);
+	OBSRV_SECTION_READER reader;
+
+	CHECK(OBSRV_SECTION_MIN_SIZE == ObsrvSectionRoundSize(0));
+	CHECK(2 * OBSRV_SECTION_MIN_SIZE == ObsrvSectionRoundSize(OBSRV_SECTION_MIN_SIZE + 1));
+	CHECK(OBSRV_SECTION_MAX_SIZE == ObsrvSectionRoundSize(0xFFFFFFFF));
+	CHECK(ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+	CHECK(!ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize() - 2 * sizeof(OBSRV_U64)));
+	CHECK(!ObsrvSectionAttach(&reader, NULL, section.GetSize()));
+	section.m_Writer.pShared->Magic++;
+	CHECK(!ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+	section.m_Writer.pShared->Magic--;
+	section.m_Writer.pShared->DataSize++;
+	CHECK(!ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+}
+
+//
+// Many laps of records of different sizes, wrapping at the end
+//
+static void TestLaps()
+{
+	CTestSection            section(OBSRV_SECTION_MIN_SIZE);
+	vector<OBSRV_RING_CELL> cells(256);
+	OBSRV_RING              ring;
+	OBSRV_SECTION_READER    reader;
+	DWORD                   dwPushed = 0;
+	DWORD                   dwRead = 0;
+	DWORD                   dwLast = 0;
+	OBSRV_U64               ullLastSequence = 0;
+
+	ObsrvRingInit(&ring, &cells[0], 256);
+	CHECK(ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+	while (dwPushed < 20000)
+	{
+		while ((dwPushed < 20000) && (ObsrvRingCount(&ring) < 256))
+		{
+			OBSRV_PROCESS_RECORD record = section.MakeRecord(++dwPushed);
+
+			ObsrvRingPush(&ring, &record);
+		} // while
+		ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+		dwRead += ReadAll(&reader, &dwLast, &ullLastSequence);
+		ObsrvSectionRelease(&reader);
+	} // while
+	while (ObsrvRingCount(&ring) > 0)
+	{
+		ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+		dwRead += ReadAll(&reader, &dwLast, &ullLastSequence);
+		ObsrvSectionRelease(&reader);
+	} // while
+	CHECK(20000 == dwRead);
+	CHECK(20000 == dwLast);
+	CHECK(0 == ObsrvSectionOverflow(&reader));
+	//
+	// It has gone round more than once
+	//
+	CHECK(section.m_Writer.Head > 4 * (OBSRV_U64)OBSRV_SECTION_MIN_SIZE);
+	CHECK(OBSRV_SECTION_WAIT == ObsrvSectionPrepareWait(&reader));
+}
+
+//
+// The producer has to leave records behind while the consumer is about
+// to sleep
+//
+static void TestStalled()
+{
+	CTestSection            section(OBSRV_SECTION_MIN_SIZE);
+	vector<OBSRV_RING_CELL> cells(1024);
+	OBSRV_RING              ring;
+	OBSRV_SECTION_READER    reader;
+	DWORD                   dwLast = 0;
+	OBSRV_U64               ullLastSequence = 0;
+	DWORD                   dwRead;
+
+	ObsrvRingInit(&ring, &cells[0], 1024);
+	CHECK(ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+	for (DWORD i = 1; i <= 1000; i++)
+	{
+		OBSRV_PROCESS_RECORD record = section.MakeRecord(i);
+
+		ObsrvRingPush(&ring, &record);
+	} // for
+	//
+	// Nobody waits yet, thus no wake-up, but the section is full
+	//
+	CHECK(!ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL));
+	CHECK(ObsrvRingCount(&ring) > 0);
+	CHECK(1 == section.m_Writer.pShared->ProducerStalled);
+	dwRead = ReadAll(&reader, &dwLast, &ullLastSequence);
+	CHECK(dwRead > 0);
+	//
+	// The consumer has announced it is going to sleep, but the producer
+	// has read Tail before the space was given back: nothing moves, and
+	// the consumer has to be woken up all the same
+	//
+	section.m_Writer.pShared->ConsumerWaiting = 1;
+	CHECK(ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL));
+	CHECK(0 == section.m_Writer.pShared->ConsumerWaiting);
+	//
+	// Woken up, it finds the producer stalled and asks for a refill
+	//
+	CHECK(OBSRV_SECTION_REFILL == ObsrvSectionPrepareWait(&reader));
+	while (ObsrvRingCount(&ring) > 0)
+	{
+		ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+		dwRead += ReadAll(&reader, &dwLast, &ullLastSequence);
+		ObsrvSectionRelease(&reader);
+	} // while
+	CHECK(1000 == dwRead);
+	CHECK(0 == section.m_Writer.pShared->ProducerStalled);
+	CHECK(OBSRV_SECTION_WAIT == ObsrvSectionPrepareWait(&reader));
+	//
+	// A record published now wakes it
+	//
+	OBSRV_PROCESS_RECORD record = section.MakeRecord(1001);
+
+	ObsrvRingPush(&ring, &record);
+	CHECK(ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL));
+	CHECK(1 == ReadAll(&reader, &dwLast, &ullLastSequence));
+}
+
+//
+// A record that fits neither in front of the end nor at the start. The
+// wrap marker is published all the same, or the consumer never reads
+// past it and the space at the end is never given back.
+//
+static void TestWrap()
+{
+	CTestSection            section(OBSRV_SECTION_MIN_SIZE);
+	vector<OBSRV_RING_CELL> cells(64);
+	OBSRV_RING              ring;
+	OBSRV_SECTION_READER    reader;
+	const void*             pvRecord;
+	DWORD                   dwLast = 16;
+	OBSRV_U64               ullLastSequence = 1;
+	DWORD                   dwRead;
+
+	ObsrvRingInit(&ring, &cells[0], 64);
+	CHECK(ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+	//
+	// An empty path first, then the longest ones
+	//
+	for (DWORD i = 0; i <= 40; i++)
+	{
+		OBSRV_PROCESS_RECORD record = section.MakeRecord((0 == i) ? 16 : 9 + i * 16);
+
+		ObsrvRingPush(&ring, &record);
+	} // for
+	CHECK(!ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL));
+	CHECK(1 == section.m_Writer.pShared->ProducerStalled);
+	//
+	// Only the short record is given back: too little for any other
+	//
+	CHECK(0 != ObsrvSectionRead(&reader, &pvRecord));
+	ObsrvSectionRelease(&reader);
+	ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+	CHECK(0 == (section.m_Writer.Head & (OBSRV_SECTION_MIN_SIZE - 1)));
+	CHECK(section.m_Writer.Head == section.m_Writer.pShared->Head);
+	dwRead = 1;
+	for (DWORD dwRound = 0; (dwRound < 100) && (ObsrvRingCount(&ring) > 0); dwRound++)
+	{
+		dwRead += ReadAll(&reader, &dwLast, &ullLastSequence);
+		ObsrvSectionRelease(&reader);
+		ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+	} // for
+	dwRead += ReadAll(&reader, &dwLast, &ullLastSequence);
+	CHECK(41 == dwRead);
+	CHECK(9 + 40 * 16 == dwLast);
+}
+
+//
+// A producer thread and a consumer thread, the consumer sleeping on an
+// event whenever it runs dry
+//
+static void TestConcurrent()
+{
+	CTestSection            section(OBSRV_SECTION_MIN_SIZE);
+	vector<OBSRV_RING_CELL> cells(1024);
+	OBSRV_RING              ring;
+	OBSRV_SECTION_READER    reader;
+	mutex                   fillLock;
+	HANDLE                  hEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	DWORD                   dwLast = 0;
+	OBSRV_U64               ullLastSequence = 0;
+	DWORD                   dwRead = 0;
+	DWORD                   dwLostWakeUps = 0;
+	BOOL                    bDone = FALSE;
+
+	ObsrvRingInit(&ring, &cells[0], 1024);
+	CHECK(ObsrvSectionAttach(&reader, section.GetMemory(), section.GetSize()));
+	//
+	// The driver's notify routines: push, then move what fits
+	//
+	thread producer([&]()
+	{
+		for (DWORD i = 1; i <= TEST_RECORDS; i++)
+		{
+			OBSRV_PROCESS_RECORD record = section.MakeRecord(i);
+			int                  bWake;
+
+			ObsrvRingPush(&ring, &record);
+			{
+				lock_guard<mutex> guard(fillLock);
+
+				bWake = ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+			}
+			if (bWake)
+				::SetEvent(hEvent);
+		} // for
+	});
+	while (!bDone)
+	{
+		dwRead += ReadAll(&reader, &dwLast, &ullLastSequence);
+		switch (ObsrvSectionPrepareWait(&reader))
+		{
+			case OBSRV_SECTION_READY:
+				break;
+			case OBSRV_SECTION_REFILL:
+			{
+				//
+				// The app asks the driver to move what it has left behind
+				//
+				lock_guard<mutex> guard(fillLock);
+
+				ObsrvSectionFillFromRing(&section.m_Writer, &ring, NULL);
+				break;
+			}
+			default:
+				//
+				// Everything pushed is either read or dropped
+				//
+				if (dwRead + ObsrvSectionOverflow(&reader) == TEST_RECORDS)
+				{
+					bDone = TRUE;
+					break;
+				}
+				if (WAIT_TIMEOUT == ::WaitForSingleObject(hEvent, 5000))
+				{
+					dwLostWakeUps++;
+					bDone = TRUE;
+				}
+				break;
+		}
+	} // while
+	producer.join();
+	::CloseHandle(hEvent);
+
+	CHECK(0 == dwLostWakeUps);
+	CHECK(dwRead > 0);
+	CHECK(dwRead + ObsrvSectionOverflow(&reader) == TEST_RECORDS);
+}
+
+int main()
+{
+	TestAttach();
+	TestLaps();
+	TestStalled();
+	TestWrap();
+	TestConcurrent();
+
+	return TestResult("TestObsrvSection");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,216 @@
+//---------------------------------------------------------------------------
+//
+// TestParallelDispatcher.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the callback handler spreading the events over
+//              worker threads (ConsCtl/ParallelDispatcher.h)
+//
+// DESCRIPTION:
+//              Every event dispatched is handled once, with the parameter
+//              it came with, and the events of a process in the order
+//              they were dispatched. A slow handler is called by several
+//              workers at once, and a worker whose queue is full holds
+//              the dispatch up rather than losing events.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ParallelDispatcher.h"
+#include <atomic>
+#include <map>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Processes and events per process
+//
+#define TEST_PROCESSES          200
+#define TEST_EVENTS             20
+
+//
+// A recording handler checking the parameter and counting the calls
+// running at once
+//
+class CCountingHandler: public CRecordingHandler
+{
+public:
+	CCountingHandler(
+		PVOID pvExpected,
+		DWORD dwDelayMicroseconds = 0
+		):
+		CRecordingHandler(dwDelayMicroseconds),
+		m_pvExpected(pvExpected),
+		m_dwRunning(0),
+		m_dwMostRunning(0),
+		m_dwWrongParam(0)
+	{
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		DWORD dwRunning = ++m_dwRunning;
+		DWORD dwMost    = m_dwMostRunning;
+
+		while ((dwRunning > dwMost) && !m_dwMostRunning.compare_exchange_weak(dwMost, dwRunning))
+			;
+		if (pvParam != m_pvExpected)
+			m_dwWrongParam++;
+		CRecordingHandler::OnProcessEvent(pQueuedItem, pvParam);
+		m_dwRunning--;
+	}
+	DWORD GetMostRunning() const
+	{
+		return m_dwMostRunning;
+	}
+	DWORD GetWrongParam() const
+	{
+		return m_dwWrongParam;
+	}
+private:
+	PVOID         m_pvExpected;
+	atomic<DWORD> m_dwRunning;
+	atomic<DWORD> m_dwMostRunning;
+	atomic<DWORD> m_dwWrongParam;
+};
+
+//
+// Dispatch the events of dwProcesses processes, dwEvents each, round
+// robin in batches of dwBatch as the retrieval thread would. The index
+// of an event within its process is in hParentId.
+//
+static void Dispatch(
+	CParallelDispatcher& dispatcher,
+	DWORD                dwProcesses,
+	DWORD                dwEvents,
+	DWORD                dwBatch,
+	PVOID                pvParam
+	)
+{
+	vector<QUEUED_ITEM> batch;
+
+	for (DWORD i = 0; i < dwEvents; i++)
+		for (DWORD dwProcess = 0; dwProcess < dwProcesses; dwProcess++)
+		{
+			batch.push_back(MakeProcessEvent(1000 + dwProcess, i, 0 == i));
+			if (batch.size() == dwBatch)
+			{
+				dispatcher.OnProcessEvents(&batch[0], dwBatch, pvParam);
+				batch.clear();
+			}
+		} // for
+	if (!batch.empty())
+		dispatcher.OnProcessEvents(&batch[0], (DWORD)batch.size(), pvParam);
+}
+
+//
+// Every event handled once, in order per process
+//
+static void TestOrder(DWORD dwWorkers)
+{
+	int                 nParam;
+	CCountingHandler    handler(&nParam);
+	vector<QUEUED_ITEM> events;
+	map<DWORD, DWORD>   next;
+	QUEUE_STATS         stats;
+	DWORD               dwTotal = TEST_PROCESSES * TEST_EVENTS;
+
+	{
+		CParallelDispatcher dispatcher(&handler, dwWorkers, 16);
+
+		Dispatch(dispatcher, TEST_PROCESSES, TEST_EVENTS, 64, &nParam);
+		dispatcher.OnProcessEvent(NULL, &nParam);
+		CHECK(handler.WaitForCount(dwTotal, 10000));
+		dispatcher.GetStats(stats);
+		CHECK(dwTotal == stats.ullReceived);
+		CHECK(dwTotal == stats.ullDelivered);
+		CHECK(0 == stats.dwQueueDepth);
+	}
+	events = handler.GetEvents();
+	CHECK(dwTotal == events.size());
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		CHECK(next[events[i].hProcessId] == events[i].hParentId);
+		next[events[i].hProcessId] = events[i].hParentId + 1;
+	} // for
+	CHECK(TEST_PROCESSES == next.size());
+	CHECK(0 == handler.GetWrongParam());
+	if (1 == dwWorkers)
+		CHECK(1 == handler.GetMostRunning());
+}
+
+//
+// A slow handler runs on several workers at once, and full worker queues
+// make the dispatch wait
+//
+static void TestParallel()
+{
+	CCountingHandler    handler(NULL, 2000);
+	QUEUE_STATS         stats;
+	DWORD               dwTotal = 400;
+
+	{
+		CParallelDispatcher dispatcher(&handler, 4, 8);
+		LONGLONG            llStart = QueryTimestamp();
+
+		CHECK(4 == dispatcher.GetWorkerCount());
+		Dispatch(dispatcher, 40, dwTotal / 40, 32, NULL);
+		CHECK(handler.WaitForCount(dwTotal, 10000));
+		dispatcher.GetStats(stats);
+		//
+		// One worker alone would take 800ms
+		//
+		CHECK(NanosecondsSince(llStart) < 600e6);
+	}
+	CHECK(handler.GetMostRunning() > 1);
+	CHECK(handler.GetMostRunning() <= 4);
+	CHECK(0 != stats.ullProducerWaits);
+	CHECK(dwTotal == stats.ullDelivered);
+}
+
+//
+// The number of workers is kept within bounds
+//
+static void TestWorkerCount()
+{
+	CRecordingHandler handler;
+
+	{
+		CParallelDispatcher dispatcher(&handler, 0);
+		CHECK(1 == dispatcher.GetWorkerCount());
+	}
+	{
+		CParallelDispatcher dispatcher(&handler, 1000, 0);
+		CHECK(DISPATCH_MAX_WORKERS == dispatcher.GetWorkerCount());
+		Dispatch(dispatcher, 500, 2, 100, NULL);
+		CHECK(handler.WaitForCount(1000, 10000));
+	}
+}
+
+int main()
+{
+	TestOrder(1);
+	TestOrder(4);
+	TestOrder(16);
+	TestParallel();
+	TestWorkerCount();
+
+	return TestResult("TestParallelDispatcher");
+}
+
+//----------------------------End of the file -------------------------------
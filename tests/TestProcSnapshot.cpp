@@ -0,0 +1,278 @@
+//---------------------------------------------------------------------------
+//
+// TestProcSnapshot.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the /proc snapshot diff (ConsCtl/ProcSnapshot.h)
+//
+// DESCRIPTION:
+//              A simulated /proc churns through processes: some exit,
+//              some are created, IDs are reused, directories are rebuilt
+//              and processes vanish between the listing and the reading
+//              of their stat file. Every scan reports exactly what a plain
+//              comparison of the two process sets finds, in the order of
+//              the process IDs. A scan of the real /proc sees a child
+//              process come and go.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ProcSnapshot.h"
+#include <algorithm>
+#include <map>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A process of the simulated /proc
+//
+typedef struct _TestProcess
+{
+	ULONG64 ullInode;
+	DWORD   dwParentId;
+	ULONG64 ullStartTime;
+	BOOL    bVanishing;  // Listed, but gone when its stat is read
+} TEST_PROCESS;
+
+//
+// A snapshot listing a simulated /proc
+//
+class CTestSnapshot: public CProcSnapshot
+{
+public:
+	map<DWORD, TEST_PROCESS> m_Processes;
+	BOOL                     m_bShuffle;
+	DWORD                    m_dwReads;
+
+	CTestSnapshot():
+		m_bShuffle(FALSE),
+		m_dwReads(0)
+	{
+	}
+protected:
+	virtual BOOL ListProcesses(vector<ULONG64>& keys)
+	{
+		map<DWORD, TEST_PROCESS>::const_iterator it;
+
+		for (it = m_Processes.begin(); it != m_Processes.end(); it++)
+			keys.push_back(MakeKey(it->first, it->second.ullInode));
+		if (m_bShuffle)
+			std::reverse(keys.begin(), keys.end());
+
+		return TRUE;
+	}
+	virtual BOOL ReadProcess(
+		DWORD    dwProcessId,
+		PDWORD   pdwParentId,
+		ULONG64* pullStartTime
+		)
+	{
+		map<DWORD, TEST_PROCESS>::const_iterator it = m_Processes.find(dwProcessId);
+
+		m_dwReads++;
+		if ((it == m_Processes.end()) || it->second.bVanishing)
+			return FALSE;
+		*pdwParentId   = it->second.dwParentId;
+		*pullStartTime = it->second.ullStartTime;
+
+		return TRUE;
+	}
+};
+
+//
+// Process ID and start time of a process as a scan sees it
+//
+typedef map<DWORD, ULONG64> CTestProcessSet;
+
+static CTestProcessSet GetAlive(const map<DWORD, TEST_PROCESS>& processes)
+{
+	CTestProcessSet                          alive;
+	map<DWORD, TEST_PROCESS>::const_iterator it;
+
+	for (it = processes.begin(); it != processes.end(); it++)
+		if (!it->second.bVanishing)
+			alive[it->first] = it->second.ullStartTime;
+
+	return alive;
+}
+
+//
+// Random churn against a model of what the scans have seen
+//
+static void TestChurn()
+{
+	CTestSnapshot       snapshot;
+	vector<PROC_CHANGE> changes;
+	CTestProcessSet     seen;
+	ULONG64             ullInode = 1;
+	ULONG64             ullClock = 1;
+
+	srand(5);
+	for (DWORD i = 0; i < 2000; i++)
+	{
+		TEST_PROCESS process = { ullInode++, 1, ullClock++, FALSE };
+
+		snapshot.m_Processes[1 + rand() % 30000] = process;
+	} // for
+	CHECK(snapshot.Scan(changes));
+	CHECK(changes.empty());
+	seen = GetAlive(snapshot.m_Processes);
+	CHECK(seen.size() == snapshot.GetCount());
+	for (DWORD dwRound = 0; dwRound < 300; dwRound++)
+	{
+		DWORD dwReads;
+		DWORD dwTouched = 0;
+		//
+		// Vanished processes are gone for good
+		//
+		for (map<DWORD, TEST_PROCESS>::iterator it = snapshot.m_Processes.begin(); it != snapshot.m_Processes.end(); )
+			if (it->second.bVanishing)
+				it = snapshot.m_Processes.erase(it);
+			else
+				it++;
+		for (DWORD dwChange = rand() % 20; dwChange > 0; dwChange--, dwTouched++)
+		{
+			DWORD                              dwProcessId = 1 + rand() % 30000;
+			map<DWORD, TEST_PROCESS>::iterator it = snapshot.m_Processes.find(dwProcessId);
+			TEST_PROCESS                       process = { ullInode++, dwProcessId / 2, ullClock++, FALSE };
+
+			switch (rand() % 4)
+			{
+				case 0:
+					//
+					// Exit, or the ID is reused right away
+					//
+					if (it != snapshot.m_Processes.end())
+						snapshot.m_Processes.erase(it);
+					else
+						snapshot.m_Processes[dwProcessId] = process;
+					break;
+				case 1:
+					//
+					// The directory is rebuilt, same process
+					//
+					if (it != snapshot.m_Processes.end())
+						it->second.ullInode = ullInode++;
+					break;
+				case 2:
+					process.bVanishing = TRUE;
+					snapshot.m_Processes[dwProcessId] = process;
+					break;
+				default:
+					snapshot.m_Processes[dwProcessId] = process;
+					break;
+			}
+		} // for
+		snapshot.m_bShuffle = (0 == dwRound % 7);
+		dwReads = snapshot.m_dwReads;
+		changes.clear();
+		CHECK(snapshot.Scan(changes));
+		//
+		// Only what differs has been read
+		//
+		CHECK(snapshot.m_dwReads - dwReads <= 2 * dwTouched);
+		//
+		// The changes are the difference of the two sets, in order
+		//
+		CTestProcessSet alive = GetAlive(snapshot.m_Processes);
+		CTestProcessSet expected = seen;
+
+		for (size_t i = 0; i < changes.size(); i++)
+		{
+			const PROC_CHANGE& change = changes[i];
+
+			if (i > 0)
+				CHECK((changes[i - 1].dwProcessId < change.dwProcessId) ||
+				      ((changes[i - 1].dwProcessId == change.dwProcessId) && !changes[i - 1].bCreate && change.bCreate));
+			if (change.bCreate)
+			{
+				CHECK(0 == expected.count(change.dwProcessId));
+				CHECK(alive.count(change.dwProcessId) && (alive[change.dwProcessId] == change.ullStartTime));
+				CHECK(change.dwProcessId / 2 == change.dwParentId);
+				expected[change.dwProcessId] = change.ullStartTime;
+			}
+			else
+			{
+				CHECK(expected.count(change.dwProcessId) && (expected[change.dwProcessId] == change.ullStartTime));
+				expected.erase(change.dwProcessId);
+			}
+		} // for
+		CHECK(expected == alive);
+		CHECK(alive.size() == snapshot.GetCount());
+		seen = alive;
+	} // for
+	//
+	// Starting over reports nothing
+	//
+	snapshot.Reset();
+	CHECK(0 == snapshot.GetCount());
+	changes.clear();
+	CHECK(snapshot.Scan(changes));
+	CHECK(changes.empty());
+}
+
+//
+// The real /proc, with a child of our own
+//
+static void TestProc()
+{
+	CProcSnapshot       snapshot;
+	vector<PROC_CHANGE> changes;
+	pid_t               hChild;
+	BOOL                bCreated = FALSE;
+	BOOL                bExited = FALSE;
+
+	CHECK(snapshot.Scan(changes));
+	CHECK(changes.empty());
+	CHECK(snapshot.GetCount() > 0);
+	hChild = ::fork();
+	if (0 == hChild)
+	{
+		::pause();
+		::_exit(0);
+	}
+	CHECK(hChild > 0);
+	CHECK(snapshot.Scan(changes));
+	for (size_t i = 0; i < changes.size(); i++)
+		if (((DWORD)hChild == changes[i].dwProcessId) && changes[i].bCreate)
+		{
+			bCreated = TRUE;
+			CHECK((DWORD)::getpid() == changes[i].dwParentId);
+		}
+	CHECK(bCreated);
+	::kill(hChild, SIGKILL);
+	::waitpid(hChild, NULL, 0);
+	changes.clear();
+	CHECK(snapshot.Scan(changes));
+	for (size_t i = 0; i < changes.size(); i++)
+		if (((DWORD)hChild == changes[i].dwProcessId) && !changes[i].bCreate)
+			bExited = TRUE;
+	CHECK(bExited);
+}
+
+int main()
+{
+	TestChurn();
+	TestProc();
+
+	return TestResult("TestProcSnapshot");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,309 @@
+//---------------------------------------------------------------------------
+//
+// TestProcessCache.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the process cache (ConsCtl/ProcessCache.h)
+//
+// DESCRIPTION:
+//              A process ID reused is looked up as the process that had
+//              it at the time asked for, including a process that has
+//              exited since. Beyond the bound exited processes go first,
+//              oldest exit first, then the least recently used running
+//              ones, whatever order the processes were retired and
+//              created again in. Every batch is passed on with the image
+//              IDs of its processes.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ProcessCache.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Process IDs no process of the system has, thus nothing is read from
+// /proc for them
+//
+#define TEST_PID                4000000
+
+//
+// Append a create or an exit at llTime, with an image ID
+//
+static void Send(
+	CProcessCache& cache,
+	DWORD          dwProcessId,
+	BOOL           bCreate,
+	LONGLONG       llTime,
+	DWORD          dwImageId = 1
+	)
+{
+	QUEUED_ITEM item = MakeProcessEvent(dwProcessId, 1, bCreate);
+
+	item.llSourceTime = llTime;
+	item.dwImageId    = bCreate ? dwImageId : STRING_TABLE_NO_ID;
+	cache.OnProcessEvents(&item, 1, NULL);
+}
+
+//
+// Whether the process that had the ID at llTime is known, started at
+// llStartTime
+//
+static BOOL IsKnown(
+	CProcessCache& cache,
+	DWORD          dwProcessId,
+	LONGLONG       llTime,
+	LONGLONG       llStartTime
+	)
+{
+	PROCESS_INFO info;
+
+	if (!cache.Lookup(dwProcessId, llTime, info))
+		return FALSE;
+
+	return (info.dwProcessId == dwProcessId) && (info.llStartTime == llStartTime);
+}
+
+static void TestReuse()
+{
+	CRecordingHandler   handler;
+	CProcessCache       cache(&handler);
+	PROCESS_INFO        info;
+	PROCESS_CACHE_STATS stats;
+	vector<QUEUED_ITEM> events;
+	wstring             commandLine;
+	QUEUED_ITEM         item;
+
+	//
+	// The ID is used from 10 to 20, then from 30 on
+	//
+	item = MakeProcessEvent(TEST_PID, 1, TRUE);
+	item.llSourceTime    = 10;
+	item.dwImageId       = 7;
+	item.dwCommandLineId = CCommandLineTable::GetInstance().Add(L"first --arg");
+	cache.OnProcessEvents(&item, 1, NULL);
+	Send(cache, TEST_PID, FALSE, 20);
+	Send(cache, TEST_PID, TRUE, 30, 8);
+
+	CHECK(!IsKnown(cache, TEST_PID, 5, 10));
+	CHECK(IsKnown(cache, TEST_PID, 10, 10));
+	CHECK(IsKnown(cache, TEST_PID, 15, 10));
+	CHECK(IsKnown(cache, TEST_PID, 20, 10));
+	CHECK(!cache.Lookup(TEST_PID, 25, info));
+	CHECK(IsKnown(cache, TEST_PID, 30, 30));
+	CHECK(IsKnown(cache, TEST_PID, 1000, 30));
+	//
+	// The exited one keeps its details
+	//
+	CHECK(cache.Lookup(TEST_PID, 15, info, &commandLine));
+	CHECK(info.bExited);
+	CHECK(20 == info.llExitTime);
+	CHECK(7 == info.dwImageId);
+	CHECK(L"first --arg" == commandLine);
+	CHECK(cache.Lookup(TEST_PID, 30, info));
+	CHECK(!info.bExited);
+	CHECK(8 == info.dwImageId);
+	//
+	// The exit went on with the image of its process
+	//
+	events = handler.GetEvents();
+	CHECK(3 == events.size());
+	if (3 == events.size())
+		CHECK(7 == events[1].dwImageId);
+	//
+	// A create while the ID is still taken means its exit was lost
+	//
+	Send(cache, TEST_PID, TRUE, 40, 9);
+	CHECK(cache.Lookup(TEST_PID, 35, info));
+	CHECK(info.bExited && (40 == info.llExitTime));
+	CHECK(IsKnown(cache, TEST_PID, 40, 40));
+	//
+	// A process unknown, and one known but asked for before it started
+	//
+	CHECK(!cache.Lookup(TEST_PID + 4, 15, info));
+	CHECK(!cache.Lookup(TEST_PID, 0, info));
+	cache.GetStats(stats);
+	CHECK(3 == stats.dwEntries);
+	CHECK(3 == stats.ullFilled);
+	CHECK(0 == stats.ullQueried);
+	CHECK(0 == stats.ullEvicted);
+}
+
+static void TestLifetime()
+{
+	CRecordingHandler handler;
+	CProcessCache     cache(&handler);
+	PROCESS_INFO      info;
+	QUEUED_ITEM       item = MakeProcessEvent(TEST_PID, 1, TRUE);
+
+	//
+	// Created and exited within a batch, it is kept as exited
+	//
+	item.eKind        = QUEUED_ITEM_LIFETIME;
+	item.llSourceTime = 100;
+	item.llExitTime   = 200;
+	item.dwExitStatus = 3;
+	item.dwImageId    = 5;
+	cache.OnProcessEvents(&item, 1, NULL);
+	CHECK(cache.Lookup(TEST_PID, 150, info));
+	CHECK(info.bExited);
+	CHECK(200 == info.llExitTime);
+	CHECK(3 == info.dwExitStatus);
+	CHECK(5 == info.dwImageId);
+	CHECK(!cache.Lookup(TEST_PID, 250, info));
+}
+
+static void TestEviction()
+{
+	CRecordingHandler   handler;
+	CProcessCache       cache(&handler, 4);
+	PROCESS_INFO        info;
+	PROCESS_CACHE_STATS stats;
+
+	//
+	// A to D run, B exits; E takes the place of B, not of A, the least
+	// recently used
+	//
+	for (DWORD i = 0; i < 4; i++)
+		Send(cache, TEST_PID + 4 * i, TRUE, 10 + i);
+	Send(cache, TEST_PID + 4, FALSE, 20);
+	Send(cache, TEST_PID + 16, TRUE, 30);
+	CHECK(!cache.Lookup(TEST_PID + 4, 15, info));
+	CHECK(cache.Lookup(TEST_PID, 30, info));
+	CHECK(cache.Lookup(TEST_PID + 8, 30, info));
+	CHECK(cache.Lookup(TEST_PID + 12, 30, info));
+	//
+	// A, C and D have just been looked up, thus E is the least recently
+	// used and goes for F
+	//
+	Send(cache, TEST_PID + 20, TRUE, 40);
+	CHECK(!cache.Lookup(TEST_PID + 16, 40, info));
+	CHECK(cache.Lookup(TEST_PID + 20, 40, info));
+	//
+	// F is the most recently used now; with A, C and D looked up in that
+	// order, F is the least recently used of them all
+	//
+	CHECK(cache.Lookup(TEST_PID, 40, info));
+	CHECK(cache.Lookup(TEST_PID + 8, 40, info));
+	CHECK(cache.Lookup(TEST_PID + 12, 40, info));
+	Send(cache, TEST_PID + 24, TRUE, 50);
+	CHECK(!cache.Lookup(TEST_PID + 20, 50, info));
+	cache.GetStats(stats);
+	CHECK(4 == stats.dwEntries);
+	CHECK(3 == stats.ullEvicted);
+}
+
+static void TestExitedOrder()
+{
+	CRecordingHandler   handler;
+	CProcessCache       cache(&handler, 3);
+	PROCESS_INFO        info;
+	PROCESS_CACHE_STATS stats;
+
+	//
+	// 1 exits after 2, thus 2 goes first; then 1, and only then the
+	// running 3, although it is the least recently used
+	//
+	for (DWORD i = 1; i <= 3; i++)
+		Send(cache, TEST_PID + 4 * i, TRUE, i);
+	Send(cache, TEST_PID + 8, FALSE, 10);
+	Send(cache, TEST_PID + 4, FALSE, 11);
+	Send(cache, TEST_PID + 16, TRUE, 20);
+	CHECK(!cache.Lookup(TEST_PID + 8, 5, info));
+	CHECK(cache.Lookup(TEST_PID + 4, 5, info));
+	Send(cache, TEST_PID + 20, TRUE, 21);
+	CHECK(!cache.Lookup(TEST_PID + 4, 5, info));
+	Send(cache, TEST_PID + 24, TRUE, 22);
+	CHECK(!cache.Lookup(TEST_PID + 12, 22, info));
+	CHECK(cache.Lookup(TEST_PID + 16, 22, info));
+	CHECK(cache.Lookup(TEST_PID + 20, 22, info));
+	CHECK(cache.Lookup(TEST_PID + 24, 22, info));
+	//
+	// Looking an exited process up leaves it where it is, the oldest
+	// exit
+	//
+	Send(cache, TEST_PID + 16, FALSE, 30);
+	Send(cache, TEST_PID + 20, FALSE, 31);
+	CHECK(cache.Lookup(TEST_PID + 16, 25, info));
+	Send(cache, TEST_PID + 28, TRUE, 40);
+	CHECK(!cache.Lookup(TEST_PID + 16, 25, info));
+	CHECK(cache.Lookup(TEST_PID + 20, 25, info));
+	cache.GetStats(stats);
+	CHECK(3 == stats.dwEntries);
+	CHECK(4 == stats.ullEvicted);
+}
+
+//
+// The first exited process taken out by a repeated create or by
+// eviction, and the last running one retired
+//
+static void TestFirstExited()
+{
+	CRecordingHandler   handler;
+	CProcessCache       cache(&handler, 2);
+	PROCESS_INFO        info;
+	PROCESS_CACHE_STATS stats;
+
+	//
+	// The only exited process is created again at the same time
+	//
+	Send(cache, TEST_PID, TRUE, 10);
+	Send(cache, TEST_PID, FALSE, 20);
+	Send(cache, TEST_PID, TRUE, 10);
+	CHECK(cache.Lookup(TEST_PID, 30, info));
+	CHECK(!info.bExited);
+	//
+	// Then two running ones take its place and each other's
+	//
+	Send(cache, TEST_PID + 4, TRUE, 40);
+	Send(cache, TEST_PID + 8, TRUE, 50);
+	CHECK(!cache.Lookup(TEST_PID, 30, info));
+	CHECK(cache.Lookup(TEST_PID + 4, 50, info));
+	CHECK(cache.Lookup(TEST_PID + 8, 50, info));
+	//
+	// Both exit, the last one running going among the exited, and both
+	// are evicted in turn
+	//
+	Send(cache, TEST_PID + 4, FALSE, 60);
+	Send(cache, TEST_PID + 8, FALSE, 61);
+	Send(cache, TEST_PID + 12, TRUE, 70);
+	CHECK(!cache.Lookup(TEST_PID + 4, 55, info));
+	CHECK(cache.Lookup(TEST_PID + 8, 55, info));
+	Send(cache, TEST_PID + 16, TRUE, 80);
+	CHECK(!cache.Lookup(TEST_PID + 8, 55, info));
+	//
+	// The new ones are running, and evicted as such
+	//
+	Send(cache, TEST_PID + 20, TRUE, 90);
+	CHECK(!cache.Lookup(TEST_PID + 12, 90, info));
+	CHECK(cache.Lookup(TEST_PID + 16, 90, info) && !info.bExited);
+	CHECK(cache.Lookup(TEST_PID + 20, 90, info) && !info.bExited);
+	cache.GetStats(stats);
+	CHECK(2 == stats.dwEntries);
+}
+
+int main()
+{
+	TestReuse();
+	TestLifetime();
+	TestEviction();
+	TestExitedOrder();
+	TestFirstExited();
+
+	return TestResult("TestProcessCache");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,285 @@
+//---------------------------------------------------------------------------
+//
+// TestProcessTree.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the process tree (ConsCtl/ProcessTree.h)
+//
+// DESCRIPTION:
+//              Processes created are linked to their parents, and the
+//              counts of descendants follow the creates and exits.
+//              Parents never seen being created are asked for, with
+//              their own ancestors. Exited processes go beyond the bound,
+//              but not before their descendants, and a process whose ID
+//              comes back is taken as exited. Every batch is passed on.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/ProcessTree.h"
+#include <map>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// A tree whose parents not seen being created come from a map rather
+// than from /proc
+//
+class CTestTree: public CProcessTree
+{
+public:
+	CTestTree(
+		CCallbackHandler* pHandler,
+		DWORD             dwMaxExited = PROCESS_TREE_DEFAULT_MAX_EXITED
+		):
+		CProcessTree(pHandler, PROCESS_TREE_DEFAULT_RETENTION, dwMaxExited)
+	{
+	}
+	map<DWORD, DWORD> m_Parents;
+protected:
+	virtual BOOL QueryParent(
+		DWORD  dwProcessId,
+		PDWORD pdwParentId
+		)
+	{
+		map<DWORD, DWORD>::const_iterator it = m_Parents.find(dwProcessId);
+
+		if (it == m_Parents.end())
+			return FALSE;
+		*pdwParentId = it->second;
+
+		return TRUE;
+	}
+};
+
+//
+// Append a create or an exit
+//
+static void Send(
+	CProcessTree& tree,
+	DWORD         dwProcessId,
+	DWORD         dwParentId,
+	BOOL          bCreate
+	)
+{
+	QUEUED_ITEM item = MakeProcessEvent(dwProcessId, dwParentId, bCreate);
+
+	tree.OnProcessEvents(&item, 1, NULL);
+}
+
+//
+// Links, queries and counts
+//
+static void TestLinks()
+{
+	CRecordingHandler         handler;
+	CTestTree                 tree(&handler);
+	PROCESS_NODE_INFO         info;
+	PROCESS_TREE_STATS        stats;
+	vector<DWORD>             ancestors;
+	vector<PROCESS_NODE_INFO> nodes;
+
+	//
+	// 1 <- 10 <- 11 <- 13
+	//        <- 12
+	//
+	Send(tree, 1, 0, TRUE);
+	Send(tree, 10, 1, TRUE);
+	Send(tree, 11, 10, TRUE);
+	Send(tree, 12, 10, TRUE);
+	Send(tree, 13, 11, TRUE);
+	CHECK(5 == handler.GetCount());
+	CHECK(!tree.GetProcess(2, info));
+	CHECK(tree.GetProcess(13, info));
+	CHECK((13 == info.dwProcessId) && (11 == info.dwParentId) && !info.bExited);
+	CHECK(tree.GetProcess(1, info));
+	CHECK((0 == info.dwParentId) && (4 == info.dwDescendants) && (4 == info.dwRunningDescendants));
+	CHECK(tree.IsDescendant(13, 1));
+	CHECK(tree.IsDescendant(13, 10));
+	CHECK(!tree.IsDescendant(13, 12));
+	CHECK(!tree.IsDescendant(1, 13));
+	CHECK(!tree.IsDescendant(13, 13));
+	CHECK(3 == tree.GetAncestors(13, ancestors));
+	CHECK((3 == ancestors.size()) && (11 == ancestors[0]) && (10 == ancestors[1]) && (1 == ancestors[2]));
+	CHECK(0 == tree.GetAncestors(1, ancestors));
+	CHECK(0 == tree.GetAncestors(2, ancestors));
+	CHECK(4 == tree.GetSubtree(10, nodes));
+	CHECK((4 == nodes.size()) && (10 == nodes[0].dwProcessId));
+	CHECK(0 == tree.GetSubtree(2, nodes));
+	//
+	// An exit counts out of the running, not out of the descendants
+	//
+	Send(tree, 11, 10, FALSE);
+	CHECK(tree.GetProcess(11, info));
+	CHECK(info.bExited && (info.llExitTime >= info.llStartTime));
+	CHECK(tree.GetProcess(1, info));
+	CHECK((4 == info.dwDescendants) && (3 == info.dwRunningDescendants));
+	CHECK(4 == tree.GetSubtree(10, nodes));
+	CHECK(3 == tree.GetSubtree(10, nodes, TRUE));
+	for (size_t i = 0; i < nodes.size(); i++)
+		CHECK(11 != nodes[i].dwProcessId);
+	//
+	// An exit twice, and one of a process not there, change nothing
+	//
+	Send(tree, 11, 10, FALSE);
+	Send(tree, 99, 1, FALSE);
+	tree.GetStats(stats);
+	CHECK(5 == stats.dwNodes);
+	CHECK(4 == stats.dwRunning);
+	CHECK(1 == stats.dwExited);
+	CHECK(5 == stats.ullInserted);
+	CHECK(0 == stats.ullQueried);
+	CHECK(0 == stats.ullRemoved);
+	CHECK((ULONG64)(56 << PROCESS_TREE_CHUNK_SHIFT) == stats.ullPoolBytes);
+	CHECK(8 == handler.GetCount());
+}
+
+//
+// Parents not seen being created
+//
+static void TestMissingParents()
+{
+	CRecordingHandler  handler;
+	CTestTree          tree(&handler);
+	PROCESS_NODE_INFO  info;
+	PROCESS_TREE_STATS stats;
+	vector<DWORD>      ancestors;
+
+	//
+	// 300 is not known, thus the top; 700 is its own parent's parent
+	//
+	tree.m_Parents[500] = 400;
+	tree.m_Parents[400] = 300;
+	tree.m_Parents[700] = 800;
+	tree.m_Parents[800] = 700;
+	Send(tree, 600, 500, TRUE);
+	CHECK(3 == tree.GetAncestors(600, ancestors));
+	CHECK((3 == ancestors.size()) && (500 == ancestors[0]) && (400 == ancestors[1]) && (300 == ancestors[2]));
+	CHECK(tree.GetProcess(300, info));
+	CHECK((0 == info.llStartTime) && (3 == info.dwDescendants));
+	tree.GetStats(stats);
+	CHECK(3 == stats.ullQueried);
+	CHECK(4 == stats.ullInserted);
+	//
+	// Known now, not asked for again
+	//
+	Send(tree, 601, 500, TRUE);
+	tree.GetStats(stats);
+	CHECK(3 == stats.ullQueried);
+	CHECK(tree.GetProcess(400, info));
+	CHECK(3 == info.dwDescendants);
+	Send(tree, 900, 700, TRUE);
+	CHECK(2 == tree.GetAncestors(900, ancestors));
+	CHECK((2 == ancestors.size()) && (700 == ancestors[0]) && (800 == ancestors[1]));
+	//
+	// A process that is its own parent is a root
+	//
+	Send(tree, 5, 5, TRUE);
+	CHECK(0 == tree.GetAncestors(5, ancestors));
+}
+
+//
+// Exited processes beyond the bound, lingering parents, lifetimes and
+// IDs coming back
+//
+static void TestRemoval()
+{
+	CRecordingHandler  handler;
+	CTestTree          tree(&handler, 0);
+	PROCESS_NODE_INFO  info;
+	PROCESS_TREE_STATS stats;
+	vector<DWORD>      ancestors;
+
+	//
+	// 1 <- 2 <- 3, 2 exits first and lingers for 3
+	//
+	Send(tree, 1, 0, TRUE);
+	Send(tree, 2, 1, TRUE);
+	Send(tree, 3, 2, TRUE);
+	Send(tree, 2, 1, FALSE);
+	tree.GetStats(stats);
+	CHECK(3 == stats.dwNodes);
+	CHECK(0 == stats.dwExited);
+	CHECK(1 == stats.dwLingering);
+	CHECK(tree.IsDescendant(3, 1));
+	CHECK(tree.GetProcess(2, info) && info.bExited);
+	Send(tree, 3, 2, FALSE);
+	tree.GetStats(stats);
+	CHECK(1 == stats.dwNodes);
+	CHECK(0 == stats.dwLingering);
+	CHECK(2 == stats.ullRemoved);
+	CHECK(!tree.GetProcess(2, info));
+	CHECK(!tree.GetProcess(3, info));
+	CHECK(tree.GetProcess(1, info));
+	CHECK((0 == info.dwDescendants) && (0 == info.dwRunningDescendants));
+	//
+	// A lifetime is a create and an exit
+	//
+	QUEUED_ITEM lifetime = MakeProcessEvent(4, 1, TRUE);
+
+	lifetime.eKind      = QUEUED_ITEM_LIFETIME;
+	lifetime.llExitTime = lifetime.llSourceTime + 1000;
+	tree.OnProcessEvents(&lifetime, 1, NULL);
+	tree.GetStats(stats);
+	CHECK(1 == stats.dwNodes);
+	CHECK(3 == stats.ullRemoved);
+	CHECK(4 == stats.ullInserted);
+	//
+	// The exit of the first 5 has been lost
+	//
+	Send(tree, 5, 1, TRUE);
+	Send(tree, 6, 5, TRUE);
+	Send(tree, 5, 1, TRUE);
+	tree.GetStats(stats);
+	CHECK(4 == stats.dwNodes);
+	CHECK(3 == stats.dwRunning);
+	CHECK(1 == stats.dwLingering);
+	CHECK(tree.GetProcess(5, info) && !info.bExited && (0 == info.dwDescendants));
+	CHECK(2 == tree.GetAncestors(6, ancestors));
+	CHECK((2 == ancestors.size()) && (5 == ancestors[0]) && (1 == ancestors[1]));
+	CHECK(tree.GetProcess(1, info));
+	CHECK((3 == info.dwDescendants) && (2 == info.dwRunningDescendants));
+	//
+	// The node of the first 5 goes with 6, the second 5 stays
+	//
+	Send(tree, 6, 5, FALSE);
+	tree.GetStats(stats);
+	CHECK(2 == stats.dwNodes);
+	CHECK(tree.GetProcess(5, info) && !info.bExited);
+	Send(tree, 5, 1, FALSE);
+	Send(tree, 1, 0, FALSE);
+	tree.GetStats(stats);
+	CHECK(0 == stats.dwNodes);
+	CHECK(0 == stats.dwRunning);
+	CHECK(stats.ullInserted == stats.ullRemoved);
+	//
+	// The nodes given back are taken again
+	//
+	Send(tree, 7, 0, TRUE);
+	tree.GetStats(stats);
+	CHECK((ULONG64)(56 << PROCESS_TREE_CHUNK_SHIFT) == stats.ullPoolBytes);
+}
+
+int main()
+{
+	TestLinks();
+	TestMissingParents();
+	TestRemoval();
+
+	return TestResult("TestProcessTree");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,191 @@
+//---------------------------------------------------------------------------
+//
+// TestQueueInline.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the queue container without a queue (QUEUE_INLINE)
+//
+// DESCRIPTION:
+//              The events appended are handed over before the append
+//              returns, on the appending thread, stamped and counted, as
+//              long as the container is receiving. Threads appending at
+//              once never have the handler called by two of them at the
+//              same time, and lifetimes are folded up within a batch.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+#include <atomic>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Appending threads and the events each appends
+//
+#define TEST_PRODUCERS          4
+#define TEST_ELEMENTS           20000
+
+//
+// A recording handler noting the thread it is called on and whether it
+// is ever called by two threads at once
+//
+class CThreadHandler: public CRecordingHandler
+{
+public:
+	CThreadHandler():
+		m_nInside(0),
+		m_dwOverlapping(0)
+	{
+	}
+	virtual void OnProcessEvents(
+		PQUEUED_ITEM pQueuedItems,
+		DWORD        dwCount,
+		PVOID        pvParam
+		)
+	{
+		if (0 != m_nInside++)
+			m_dwOverlapping++;
+		m_LastThread = std::this_thread::get_id();
+		CRecordingHandler::OnProcessEvents(pQueuedItems, dwCount, pvParam);
+		m_nInside--;
+	}
+	std::thread::id GetLastThread() const
+	{
+		return m_LastThread;
+	}
+	DWORD GetOverlapping() const
+	{
+		return m_dwOverlapping;
+	}
+private:
+	atomic<int>     m_nInside;
+	atomic<DWORD>   m_dwOverlapping;
+	std::thread::id m_LastThread;
+};
+
+//
+// One thread, start to stop
+//
+static void TestSingle()
+{
+	CThreadHandler      handler;
+	CQueueContainer     queue(&handler, QUEUE_INLINE);
+	QUEUED_ITEM         batch[3];
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+
+	//
+	// Not before it has been started
+	//
+	CHECK(!queue.Append(MakeProcessEvent(1, 0, TRUE)));
+	CHECK(0 == handler.GetCount());
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(!queue.StartReceivingNotifications());
+	for (DWORD i = 0; i < 3; i++)
+	{
+		batch[i] = MakeProcessEvent(10 + i, 0, TRUE);
+		batch[i].ullSequence = 1 + i;
+	} // for
+	batch[2].ullSequence = 5;
+	CHECK(queue.AppendBatch(batch, 3));
+	//
+	// Handed over by now, on this thread
+	//
+	CHECK(3 == handler.GetCount());
+	CHECK(std::this_thread::get_id() == handler.GetLastThread());
+	CHECK(queue.AppendBatch(batch, 0));
+	events = handler.GetEvents();
+	for (DWORD i = 0; i < events.size(); i++)
+	{
+		CHECK(10 + i == events[i].hProcessId);
+		CHECK(events[i].llEnqueueTime == events[i].llDequeueTime);
+		CHECK(events[i].llEnqueueTime >= events[i].llSourceTime);
+		CHECK(events[i].llCallbackTime >= events[i].llDequeueTime);
+	} // for
+	queue.GetStats(stats);
+	CHECK(3 == stats.ullReceived);
+	CHECK(3 == stats.ullDelivered);
+	CHECK(2 == stats.ullMissed);
+	CHECK(5 == stats.ullLastSequence);
+	CHECK(0 == stats.dwQueueDepth);
+	queue.StopReceivingNotifications();
+	CHECK(!queue.Append(batch[0]));
+	CHECK(3 == handler.GetCount());
+	//
+	// Lifetimes are folded up within the batch appended
+	//
+	CHECK(queue.SetLifetimeCoalescing(TRUE));
+	CHECK(queue.StartReceivingNotifications());
+	batch[0] = MakeProcessEvent(20, 0, TRUE);
+	batch[1] = MakeProcessEvent(20, 0, FALSE);
+	batch[2] = MakeProcessEvent(21, 0, TRUE);
+	CHECK(queue.AppendBatch(batch, 3));
+	events = handler.GetEvents();
+	CHECK(5 == events.size());
+	CHECK((5 == events.size()) && (QUEUED_ITEM_LIFETIME == events[3].eKind));
+	queue.GetStats(stats);
+	CHECK(1 == stats.ullLifetimes);
+	queue.StopReceivingNotifications();
+}
+
+//
+// Threads appending at once take turns with the handler
+//
+static void TestConcurrent()
+{
+	CThreadHandler      handler;
+	CQueueContainer     queue(&handler, QUEUE_INLINE);
+	vector<thread>      producers;
+	vector<DWORD>       dwNext(TEST_PRODUCERS, 0);
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+
+	CHECK(queue.StartReceivingNotifications());
+	for (DWORD dwProducer = 0; dwProducer < TEST_PRODUCERS; dwProducer++)
+		producers.push_back(thread([&queue, dwProducer]()
+		{
+			for (DWORD i = 0; i < TEST_ELEMENTS; i++)
+				queue.Append(MakeProcessEvent(i, dwProducer, TRUE));
+		}));
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+	//
+	// Nothing is left to wait for
+	//
+	CHECK(TEST_PRODUCERS * TEST_ELEMENTS == handler.GetCount());
+	queue.StopReceivingNotifications();
+	events = handler.GetEvents();
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		CHECK(dwNext[events[i].hParentId] == events[i].hProcessId);
+		dwNext[events[i].hParentId] = events[i].hProcessId + 1;
+	} // for
+	CHECK(0 == handler.GetOverlapping());
+	queue.GetStats(stats);
+	CHECK(TEST_PRODUCERS * TEST_ELEMENTS == stats.ullReceived);
+	CHECK(TEST_PRODUCERS * TEST_ELEMENTS == stats.ullDelivered);
+}
+
+int main()
+{
+	TestSingle();
+	TestConcurrent();
+
+	return TestResult("TestQueueInline");
+}
+
+//----------------------------End of the file -------------------------------
@@ -0,0 +1,372 @@
+//---------------------------------------------------------------------------
+//
+// TestQueueLimits.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the queue bounds and the overflow policies of the
+//              queue container (ConsCtl/QueueContainer.h)
+//
+// DESCRIPTION:
+//              The callback handler is held in its first event, thus
+//              nothing is taken off the queue while it is being filled.
+//              A full queue then drops the newest events, drops the
+//              oldest ones, removes processes created and exited while
+//              queued, or has the producer wait until the handler is let
+//              go, losing nothing. Every event is accounted for in the
+//              statistics. Bounds the implementation can't keep are
+//              refused.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Process ID of the event the handler is held in
+//
+#define TEST_HOLDER_ID          1000000
+
+//
+// A recording handler which doesn't return from its first event until
+// it is let go
+//
+class CHeldHandler: public CRecordingHandler
+{
+public:
+	CHeldHandler():
+		m_evtEntered(::CreateEvent(NULL, TRUE, FALSE, NULL)),
+		m_evtRelease(::CreateEvent(NULL, TRUE, FALSE, NULL))
+	{
+	}
+	virtual ~CHeldHandler()
+	{
+		::CloseHandle(m_evtEntered);
+		::CloseHandle(m_evtRelease);
+	}
+	virtual void OnProcessEvent(
+		PQUEUED_ITEM pQueuedItem,
+		PVOID        pvParam
+		)
+	{
+		::SetEvent(m_evtEntered);
+		::WaitForSingleObject(m_evtRelease, INFINITE);
+		CRecordingHandler::OnProcessEvent(pQueuedItem, pvParam);
+	}
+	//
+	// Append an event and wait until the handler is held in it. The
+	// queue is empty then.
+	//
+	BOOL Hold(CQueueContainer& queue)
+	{
+		queue.Append(MakeProcessEvent(TEST_HOLDER_ID, 0, TRUE));
+
+		return (WAIT_OBJECT_0 == ::WaitForSingleObject(m_evtEntered, 5000));
+	}
+	void Release()
+	{
+		::SetEvent(m_evtRelease);
+	}
+private:
+	HANDLE m_evtEntered;
+	HANDLE m_evtRelease;
+};
+
+//
+// Let the handler go and collect what it is handed, the holder first
+//
+static vector<QUEUED_ITEM> ReleaseAndCollect(
+	CHeldHandler&    handler,
+	CQueueContainer& queue,
+	DWORD            dwExpected
+	)
+{
+	vector<QUEUED_ITEM> events;
+
+	handler.Release();
+	CHECK(handler.WaitForCount(dwExpected, 10000));
+	queue.StopReceivingNotifications();
+	events = handler.GetEvents();
+	CHECK(dwExpected == events.size());
+	CHECK(!events.empty() && (TEST_HOLDER_ID == events[0].hProcessId));
+	if (!events.empty())
+		events.erase(events.begin());
+
+	return events;
+}
+
+//
+// The process IDs of the events
+//
+static vector<DWORD> GetProcessIds(const vector<QUEUED_ITEM>& events)
+{
+	vector<DWORD> ids;
+
+	for (size_t i = 0; i < events.size(); i++)
+		ids.push_back(events[i].hProcessId);
+
+	return ids;
+}
+
+//
+// Bounds that can't be kept are refused
+//
+static void TestSetLimits()
+{
+	CRecordingHandler handler;
+	CQueueContainer   locked(&handler, QUEUE_LOCKED);
+	CQueueContainer   lockFree(&handler, QUEUE_LOCK_FREE);
+	CQueueContainer   direct(&handler, QUEUE_INLINE);
+
+	CHECK(locked.SetLimits(10, 0, QUEUE_OVERFLOW_DROP_OLDEST));
+	CHECK(locked.SetLimits(10, 0, QUEUE_OVERFLOW_COALESCE));
+	CHECK(lockFree.SetLimits(10, 0, QUEUE_OVERFLOW_BLOCK));
+	CHECK(lockFree.SetLimits(10, 0, QUEUE_OVERFLOW_DROP_NEWEST));
+	CHECK(!lockFree.SetLimits(10, 0, QUEUE_OVERFLOW_DROP_OLDEST));
+	CHECK(!lockFree.SetLimits(10, 0, QUEUE_OVERFLOW_COALESCE));
+	CHECK(!direct.SetLimits(10, 0, QUEUE_OVERFLOW_DROP_NEWEST));
+	CHECK(!direct.SetLimits(0, 4096, QUEUE_OVERFLOW_DROP_NEWEST));
+	CHECK(direct.SetLimits(0, 0, QUEUE_OVERFLOW_DROP_NEWEST));
+	//
+	// Not while the events are being handed over
+	//
+	CHECK(locked.StartReceivingNotifications());
+	CHECK(!locked.SetLimits(10, 0, QUEUE_OVERFLOW_BLOCK));
+	locked.StopReceivingNotifications();
+	CHECK(locked.SetLimits(10, 0, QUEUE_OVERFLOW_BLOCK));
+}
+
+//
+// The events that don't fit are dropped. The bound is given in elements,
+// in bytes, or both and the lower one holds.
+//
+static void TestDropNewest(
+	QUEUE_IMPLEMENTATION eImplementation,
+	DWORD                dwMaxElements,
+	ULONG64              ullMaxBytes,
+	DWORD                dwCapacity
+	)
+{
+	CHeldHandler        handler;
+	CQueueContainer     queue(&handler, eImplementation);
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+	DWORD               dwAppended = 3 * dwCapacity;
+
+	CHECK(queue.SetLimits(dwMaxElements, ullMaxBytes, QUEUE_OVERFLOW_DROP_NEWEST));
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(handler.Hold(queue));
+	for (DWORD i = 0; i < dwAppended; i++)
+	{
+		//
+		// A batch goes in as far as it fits
+		//
+		if ((0 == i % 5) && (i + 2 < dwAppended))
+		{
+			QUEUED_ITEM batch[3] = { MakeProcessEvent(i, 0, TRUE), MakeProcessEvent(i + 1, 0, TRUE), MakeProcessEvent(i + 2, 0, TRUE) };
+
+			queue.AppendBatch(batch, 3);
+			i += 2;
+		}
+		else
+			queue.Append(MakeProcessEvent(i, 0, TRUE));
+	} // for
+	queue.GetStats(stats);
+	CHECK(dwCapacity == stats.dwQueueDepth);
+	events = ReleaseAndCollect(handler, queue, 1 + dwCapacity);
+	for (DWORD i = 0; i < events.size(); i++)
+		CHECK(i == events[i].hProcessId);
+	queue.GetStats(stats);
+	CHECK(dwAppended - dwCapacity == stats.ullDroppedNewest);
+	CHECK(1 + dwCapacity == stats.ullDelivered);
+	if (QUEUE_LOCKED == eImplementation)
+		CHECK(1 + dwAppended == stats.ullReceived);
+	else
+		CHECK(1 + dwCapacity == stats.ullReceived);
+	CHECK(0 == stats.ullDroppedOldest);
+	CHECK(0 == stats.ullProducerWaits);
+	CHECK(0 == stats.dwQueueDepth);
+}
+
+//
+// The oldest events make room for the newest, enough of them to have the
+// queue moved forward now and then
+//
+static void TestDropOldest()
+{
+	CHeldHandler        handler;
+	CQueueContainer     queue(&handler, QUEUE_LOCKED);
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+	DWORD               dwCapacity = 100;
+	DWORD               dwAppended = 1000;
+
+	CHECK(queue.SetLimits(dwCapacity, 0, QUEUE_OVERFLOW_DROP_OLDEST));
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(handler.Hold(queue));
+	for (DWORD i = 0; i < dwAppended; i++)
+		queue.Append(MakeProcessEvent(i, 0, TRUE));
+	queue.GetStats(stats);
+	CHECK(dwCapacity == stats.dwQueueDepth);
+	events = ReleaseAndCollect(handler, queue, 1 + dwCapacity);
+	for (DWORD i = 0; i < events.size(); i++)
+		CHECK(dwAppended - dwCapacity + i == events[i].hProcessId);
+	queue.GetStats(stats);
+	CHECK(dwAppended - dwCapacity == stats.ullDroppedOldest);
+	CHECK(1 + dwAppended == stats.ullReceived);
+	CHECK(1 + dwCapacity == stats.ullDelivered);
+	CHECK(0 == stats.ullDroppedNewest);
+}
+
+//
+// A full queue holding processes created and exited drops them both and
+// takes the new event
+//
+static void TestCoalescePairs()
+{
+	CHeldHandler        handler;
+	CQueueContainer     queue(&handler, QUEUE_LOCKED);
+	vector<DWORD>       ids;
+	vector<DWORD>       expected;
+	QUEUE_STATS         stats;
+
+	CHECK(queue.SetLimits(64, 0, QUEUE_OVERFLOW_COALESCE));
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(handler.Hold(queue));
+	for (DWORD i = 1; i <= 40; i++)
+		queue.Append(MakeProcessEvent(i, 0, TRUE));
+	for (DWORD i = 1; i <= 24; i++)
+		queue.Append(MakeProcessEvent(i, 0, FALSE));
+	queue.GetStats(stats);
+	CHECK(64 == stats.dwQueueDepth);
+	CHECK(0 == stats.ullCoalesced);
+	queue.Append(MakeProcessEvent(41, 0, TRUE));
+	queue.GetStats(stats);
+	CHECK(48 == stats.ullCoalesced);
+	CHECK(17 == stats.dwQueueDepth);
+	ids = GetProcessIds(ReleaseAndCollect(handler, queue, 1 + 17));
+	for (DWORD i = 25; i <= 41; i++)
+		expected.push_back(i);
+	CHECK(expected == ids);
+	queue.GetStats(stats);
+	CHECK(0 == stats.ullDroppedNewest);
+	CHECK(0 == stats.ullDroppedOldest);
+	CHECK(1 + 65 == stats.ullReceived);
+}
+
+//
+// The exit of a queued process takes its create out, with no pairs to
+// drop the newest event is dropped
+//
+static void TestCoalesceAbsorb()
+{
+	CHeldHandler        handler;
+	CQueueContainer     queue(&handler, QUEUE_LOCKED);
+	vector<DWORD>       ids;
+	vector<DWORD>       expected;
+	QUEUE_STATS         stats;
+
+	CHECK(queue.SetLimits(64, 0, QUEUE_OVERFLOW_COALESCE));
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(handler.Hold(queue));
+	for (DWORD i = 1; i <= 64; i++)
+		queue.Append(MakeProcessEvent(i, 0, TRUE));
+	queue.Append(MakeProcessEvent(5, 0, FALSE));
+	queue.GetStats(stats);
+	CHECK(63 == stats.dwQueueDepth);
+	CHECK(0 == stats.ullDroppedNewest);
+	queue.Append(MakeProcessEvent(100, 0, TRUE));
+	queue.Append(MakeProcessEvent(101, 0, TRUE));
+	queue.GetStats(stats);
+	CHECK(1 == stats.ullDroppedNewest);
+	ids = GetProcessIds(ReleaseAndCollect(handler, queue, 1 + 64));
+	for (DWORD i = 1; i <= 64; i++)
+		if (5 != i)
+			expected.push_back(i);
+	expected.push_back(100);
+	CHECK(expected == ids);
+	queue.GetStats(stats);
+	CHECK(2 == stats.ullCoalesced);
+	CHECK(1 + 67 == stats.ullReceived);
+}
+
+//
+// The producer waits for room until the handler is let go, nothing is
+// lost and the order is kept
+//
+static void TestBlock(QUEUE_IMPLEMENTATION eImplementation)
+{
+	CHeldHandler        handler;
+	CQueueContainer     queue(&handler, eImplementation);
+	vector<QUEUED_ITEM> events;
+	QUEUE_STATS         stats;
+	DWORD               dwAppended = 200;
+
+	CHECK(queue.SetLimits(8, 0, QUEUE_OVERFLOW_BLOCK));
+	CHECK(queue.StartReceivingNotifications());
+	CHECK(handler.Hold(queue));
+
+	thread producer([&queue, dwAppended]()
+	{
+		for (DWORD i = 0; i < dwAppended; i += 5)
+		{
+			QUEUED_ITEM batch[5];
+
+			for (DWORD j = 0; j < 5; j++)
+				batch[j] = MakeProcessEvent(i + j, 0, TRUE);
+			queue.AppendBatch(batch, 5);
+		} // for
+	});
+	//
+	// Wait until it is stuck
+	//
+	for (DWORD dwWaited = 0; dwWaited < 5000; dwWaited++)
+	{
+		queue.GetStats(stats);
+		if (0 != stats.ullProducerWaits)
+			break;
+		::Sleep(1);
+	} // for
+	CHECK(0 != stats.ullProducerWaits);
+	CHECK(8 == stats.dwQueueDepth);
+	events = ReleaseAndCollect(handler, queue, 1 + dwAppended);
+	producer.join();
+	for (DWORD i = 0; i < events.size(); i++)
+		CHECK(i == events[i].hProcessId);
+	queue.GetStats(stats);
+	CHECK(1 + dwAppended == stats.ullReceived);
+	CHECK(1 + dwAppended == stats.ullDelivered);
+	CHECK(0 == stats.ullDroppedNewest);
+}
+
+int main()
+{
+	TestSetLimits();
+	TestDropNewest(QUEUE_LOCKED, 8, 0, 8);
+	TestDropNewest(QUEUE_LOCK_FREE, 8, 0, 8);
+	TestDropNewest(QUEUE_LOCKED, 0, 8 * sizeof(QUEUED_ITEM) + 1, 8);
+	TestDropNewest(QUEUE_LOCK_FREE, 100, 4 * sizeof(QUEUED_ITEM), 4);
+	TestDropOldest();
+	TestCoalescePairs();
+	TestCoalesceAbsorb();
+	TestBlock(QUEUE_LOCKED);
+	TestBlock(QUEUE_LOCK_FREE);
+
+	return TestResult("TestQueueLimits");
+}
+
+//----------------------------End of the file -------------------------------
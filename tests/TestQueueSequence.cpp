@@ -0,0 +1,131 @@
+//---------------------------------------------------------------------------
+//
+// TestQueueSequence.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the sequence number checks of the queue container
+//              (ConsCtl/QueueContainer.h)
+//
+// DESCRIPTION:
+//              Events numbered by the source are appended with gaps, a
+//              restart of the numbering, a repeat and unnumbered events
+//              in between, one by one and in batches. Every build of the
+//              queue counts the numbers skipped and the steps back the
+//              same way, and GetStats() reports them once the events have
+//              been handed over.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/QueueContainer.h"
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// An event numbered ullSequence, 0 for none
+//
+static QUEUED_ITEM MakeNumbered(ULONG64 ullSequence)
+{
+	QUEUED_ITEM item = MakeProcessEvent(1000 + (DWORD)ullSequence, 1, TRUE);
+
+	item.ullSequence = ullSequence;
+
+	return item;
+}
+
+static void TestSequence(QUEUE_IMPLEMENTATION eImplementation)
+{
+	CRecordingHandler   handler;
+	CQueueContainer     queue(&handler, eImplementation);
+	QUEUE_STATS         stats;
+	vector<QUEUED_ITEM> events;
+	//
+	// The first number seen counts for nothing, 103 and 104 are skipped,
+	// then the source starts over from 1 and repeats 3
+	//
+	const ULONG64       ullSingle[] = { 100, 101, 0, 102, 105, 0, 106, 1, 2, 3, 3, 4 };
+	//
+	// Images following the first of a batch are not numbered, 6 and 7
+	// are skipped
+	//
+	QUEUED_ITEM         batch[4] = { MakeNumbered(5), MakeNumbered(0), MakeNumbered(0), MakeNumbered(8) };
+	DWORD               dwTotal = sizeof(ullSingle) / sizeof(ullSingle[0]) + 4;
+
+	CHECK(queue.StartReceivingNotifications());
+	for (DWORD i = 0; i < sizeof(ullSingle) / sizeof(ullSingle[0]); i++)
+		CHECK(queue.Append(MakeNumbered(ullSingle[i])));
+	CHECK(queue.AppendBatch(batch, 4));
+	CHECK(handler.WaitForCount(dwTotal, 10000));
+	//
+	// The lock-free build publishes its counters along with the events
+	// it hands over; wait for the last of them
+	//
+	for (DWORD dwWaited = 0; dwWaited < 10000; dwWaited++)
+	{
+		queue.GetStats(stats);
+		if (dwTotal == stats.ullDelivered)
+			break;
+		::Sleep(1);
+	} // for
+	queue.StopReceivingNotifications();
+	queue.GetStats(stats);
+	CHECK(dwTotal == stats.ullReceived);
+	CHECK(dwTotal == stats.ullDelivered);
+	CHECK(4 == stats.ullMissed);
+	CHECK(2 == stats.ullOutOfOrder);
+	CHECK(8 == stats.ullLastSequence);
+	//
+	// Counting takes nothing out
+	//
+	events = handler.GetEvents();
+	CHECK(dwTotal == events.size());
+	if (dwTotal == events.size())
+		CHECK(8 == events.back().ullSequence);
+}
+
+//
+// A source that numbers nothing has nothing counted
+//
+static void TestUnnumbered(QUEUE_IMPLEMENTATION eImplementation)
+{
+	CRecordingHandler handler;
+	CQueueContainer   queue(&handler, eImplementation);
+	QUEUE_STATS       stats;
+
+	CHECK(queue.StartReceivingNotifications());
+	for (DWORD i = 0; i < 100; i++)
+		CHECK(queue.Append(MakeNumbered(0)));
+	CHECK(handler.WaitForCount(100, 10000));
+	queue.StopReceivingNotifications();
+	queue.GetStats(stats);
+	CHECK(0 == stats.ullMissed);
+	CHECK(0 == stats.ullOutOfOrder);
+	CHECK(0 == stats.ullLastSequence);
+}
+
+int main()
+{
+	TestSequence(QUEUE_LOCKED);
+	TestSequence(QUEUE_LOCK_FREE);
+	TestSequence(QUEUE_INLINE);
+	TestUnnumbered(QUEUE_LOCKED);
+	TestUnnumbered(QUEUE_LOCK_FREE);
+	TestUnnumbered(QUEUE_INLINE);
+
+	return TestResult("TestQueueSequence");
+}
+
+//----------------------------End of the file -------------------------------
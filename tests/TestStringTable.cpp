@@ -0,0 +1,174 @@
+//---------------------------------------------------------------------------
+//
+// TestStringTable.cpp
+//
+// SUBSYSTEM:
+//              Monitoring process creation and termination
+//
+// MODULE:
+//              Tests of the string table (ConsCtl/StringTable.h)
+//
+// DESCRIPTION:
+//              A string interned twice gets the same ID and distinct
+//              strings distinct ones, which resolve to the same text at
+//              the same address for the lifetime of the table. The empty
+//              string, unknown IDs and strings beyond the budget resolve
+//              to the empty string. Threads interning the same strings at
+//              once agree on their IDs.
+//
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+//
+// Includes
+//
+//---------------------------------------------------------------------------
+#include "TestCommon.h"
+#include "../ConsCtl/StringTable.h"
+#include <wchar.h>
+using namespace std;
+
+//---------------------------------------------------------------------------
+//
+// Aplication scope consts and typedefs
+//
+//---------------------------------------------------------------------------
+
+//
+// Strings in the tests, and the interning threads
+//
+#define TEST_STRINGS            10000
+#define TEST_THREADS            4
+
+//
+// A path made up of a number
+//
+static wstring MakePath(DWORD dwNumber)
+{
+	return L"/usr/lib/x86_64-linux-gnu/test/" + to_wstring(dwNumber) + L"/image";
+}
+
+//
+// Interning and resolving on one thread
+//
+static void TestIntern()
+{
+	CStringTable       table;
+	STRING_TABLE_STATS stats;
+	vector<DWORD>      ids;
+
+	CHECK(STRING_TABLE_NO_ID == table.Intern(NULL));
+	CHECK(STRING_TABLE_NO_ID == table.Intern(L""));
+	CHECK(0 == wcscmp(L"", table.Resolve(STRING_TABLE_NO_ID)));
+	CHECK(0 == wcscmp(L"", table.Resolve(1)));
+	CHECK(0 == wcscmp(L"", table.Resolve(0xFFFFFFFF)));
+	for (DWORD i = 0; i < TEST_STRINGS; i++)
+		ids.push_back(table.Intern(MakePath(i).c_str()));
+	for (DWORD i = 0; i < TEST_STRINGS; i++)
+	{
+		CHECK(STRING_TABLE_NO_ID != ids[i]);
+		CHECK(0 == wcscmp(MakePath(i).c_str(), table.Resolve(ids[i])));
+	} // for
+	//
+	// The IDs are given in order, and the strings stay where they are
+	//
+	for (DWORD i = 1; i < TEST_STRINGS; i++)
+		CHECK(ids[i - 1] + 1 == ids[i]);
+
+	const WCHAR* pszFirst = table.Resolve(ids[0]);
+
+	for (DWORD i = 0; i < TEST_STRINGS; i++)
+		CHECK(ids[i] == table.Intern(MakePath(i).c_str()));
+	CHECK(pszFirst == table.Resolve(ids[0]));
+	table.GetStats(stats);
+	CHECK(2 * TEST_STRINGS == stats.ullLookups);
+	CHECK(TEST_STRINGS == stats.ullAdded);
+	CHECK(0 == stats.ullRefused);
+	CHECK(TEST_STRINGS == stats.dwStrings);
+	CHECK(stats.ullStringBytes <= stats.ullArenaBytes);
+	CHECK(0 == stats.ullArenaBytes % STRING_TABLE_CHUNK);
+}
+
+//
+// Strings beyond the budget are refused, those kept still resolve
+//
+static void TestBudget()
+{
+	CStringTable       table(STRING_TABLE_CHUNK);
+	STRING_TABLE_STATS stats;
+	CStringTable       empty(0);
+	DWORD              dwKept = STRING_TABLE_NO_ID;
+	DWORD              dwRefused = 0;
+
+	CHECK(STRING_TABLE_NO_ID == empty.Intern(L"/bin/sh"));
+	empty.GetStats(stats);
+	CHECK(1 == stats.ullRefused);
+	CHECK(0 == stats.dwStrings);
+	CHECK(0 == stats.ullArenaBytes);
+	//
+	// One chunk, thus one shard, is all the table may take
+	//
+	for (DWORD i = 0; i < TEST_STRINGS; i++)
+	{
+		DWORD dwId = table.Intern(MakePath(i).c_str());
+
+		if (STRING_TABLE_NO_ID == dwId)
+			dwRefused++;
+		else if (STRING_TABLE_NO_ID == dwKept)
+			dwKept = dwId;
+	} // for
+	table.GetStats(stats);
+	CHECK(dwRefused > 0);
+	CHECK(dwRefused == stats.ullRefused);
+	CHECK(TEST_STRINGS - dwRefused == stats.dwStrings);
+	CHECK(STRING_TABLE_CHUNK == stats.ullArenaBytes);
+	CHECK(0 == wcscmp(MakePath(0).c_str(), table.Resolve(dwKept)));
+}
+
+//
+// Threads interning the same strings at once
+//
+static void TestConcurrent()
+{
+	CStringTable          table;
+	STRING_TABLE_STATS    stats;
+	vector<thread>        threads;
+	vector<vector<DWORD>> ids(TEST_THREADS, vector<DWORD>(TEST_STRINGS));
+
+	for (DWORD dwThread = 0; dwThread < TEST_THREADS; dwThread++)
+		threads.push_back(thread([&table, &ids, dwThread]()
+		{
+			//
+			// Each starting at a string of its own
+			//
+			for (DWORD i = 0; i < TEST_STRINGS; i++)
+			{
+				DWORD dwString = (i + dwThread * TEST_STRINGS / TEST_THREADS) % TEST_STRINGS;
+
+				ids[dwThread][dwString] = table.Intern(MakePath(dwString).c_str());
+			} // for
+		}));
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	for (DWORD i = 0; i < TEST_STRINGS; i++)
+	{
+		for (DWORD dwThread = 1; dwThread < TEST_THREADS; dwThread++)
+			CHECK(ids[0][i] == ids[dwThread][i]);
+		CHECK(0 == wcscmp(MakePath(i).c_str(), table.Resolve(ids[0][i])));
+	} // for
+	table.GetStats(stats);
+	CHECK(TEST_THREADS * TEST_STRINGS == stats.ullLookups);
+	CHECK(TEST_STRINGS == stats.ullAdded);
+	CHECK(TEST_STRINGS == stats.dwStrings);
+}
+
+int main()
+{
+	TestIntern();
+	TestBudget();
+	TestConcurrent();
+
+	return TestResult("TestStringTable");
+}
+
+//----------------------------End of the file -------------------------------